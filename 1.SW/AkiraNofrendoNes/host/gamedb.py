@@ -0,0 +1,115 @@
+#!/usr/bin/env python3
+"""Per-game profile table of the core, main/nofrendo/nes/nes_gamedb.inc.
+
+Reads gamedb.txt, one game a line:
+
+    <PRG CRC32> [idleskip] [skipcap=N] [runahead=N] [mhz=80|160|240] [# title]
+
+and writes the gamedb_t rows nes_gamedb.c takes, sorted by CRC so
+gamedb_find can search them. Anything left out keeps the build's default.
+
+    gamedb.py gamedb.txt > ../main/nofrendo/nes/nes_gamedb.inc   (make gamedb)
+    gamedb.py --bench uart.log [gamedb.txt]
+
+--bench reads the lines the launcher benchmark (main/rombench.h) prints and
+suggests an entry for each game from its fps; what gamedb.txt already has
+for a game is kept. Frame rates are taken to be at 240 MHz, as an unpaced
+run keeps the clock at the top.
+"""
+
+import re
+import sys
+
+GAMEDB_IDLESKIP = 0x01
+CLOCKS = (80, 160, 240)
+REFRESH = 60
+HEADROOM = 1.15  # power.c steps the clock up above 85% busy
+
+
+def parse(path):
+    games = {}
+    with open(path) as f:
+        for number, line in enumerate(f, 1):
+            text, _, title = line.partition("#")
+            words = text.split()
+            if not words:
+                continue
+            where = f"{path}:{number}"
+            try:
+                crc = int(words[0], 16)
+            except ValueError:
+                sys.exit(f"{where}: {words[0]} is not a CRC")
+            if crc in games:
+                sys.exit(f"{where}: {crc:08X} is in twice")
+            game = {"flags": 0, "skipcap": 0, "runahead": 0, "mhz": 0, "title": title.strip()}
+            for word in words[1:]:
+                key, _, value = word.partition("=")
+                if key == "idleskip" and not value:
+                    game["flags"] |= GAMEDB_IDLESKIP
+                elif key in ("skipcap", "runahead", "mhz") and value.isdigit():
+                    game[key] = int(value)
+                else:
+                    sys.exit(f"{where}: don't know {word}")
+            if game["mhz"] and game["mhz"] not in CLOCKS:
+                sys.exit(f"{where}: mhz is one of {CLOCKS}")
+            if game["skipcap"] > 255 or game["runahead"] > 255:
+                sys.exit(f"{where}: {word} is too big")
+            games[crc] = game
+    return games
+
+
+def table(games):
+    out = []
+    for crc in sorted(games):
+        g = games[crc]
+        flags = "GAMEDB_IDLESKIP" if g["flags"] & GAMEDB_IDLESKIP else "0"
+        row = f"   {{ 0x{crc:08X}, {flags}, {g['skipcap']}, {g['runahead']}, {g['mhz'] // 8} }},"
+        out.append(row + (f" /* {g['title']} */" if g["title"] else ""))
+    return out
+
+
+def suggest(fps):
+    """skipcap, runahead and mhz for a game that ran at fps unpaced."""
+    need = 240 * REFRESH * HEADROOM / fps
+    mhz = next((c for c in CLOCKS if c >= need), 240)
+    skipcap = 2 if fps < REFRESH else 0
+    # every frame run ahead costs a whole frame on top
+    runahead = max(0, min(2, int(fps / (REFRESH * HEADROOM)) - 1))
+    return skipcap, runahead, mhz
+
+
+def bench(log, games):
+    line_re = re.compile(r"bench: (\d+) ([0-9A-Fa-f]{8}) (\d+) (\d+\.\d)")
+    with open(log, errors="replace") as f:
+        for line in f:
+            m = line_re.search(line)
+            if not m:
+                continue
+            crc, fps = int(m.group(2), 16), float(m.group(4))
+            skipcap, runahead, mhz = suggest(fps)
+            g = games.get(crc, {"flags": 0, "skipcap": 0, "runahead": 0, "mhz": 0, "title": ""})
+            words = [f"{crc:08X}"]
+            if g["flags"] & GAMEDB_IDLESKIP:
+                words.append("idleskip")
+            for key, value in (("skipcap", skipcap), ("runahead", runahead), ("mhz", mhz)):
+                value = g[key] or value
+                if value:
+                    words.append(f"{key}={value}")
+            title = g["title"] or f"entry {m.group(1)}, {fps} fps"
+            print(" ".join(words) + f"  # {title}")
+
+
+def main():
+    args = sys.argv[1:]
+    if len(args) in (2, 3) and args[0] == "--bench":
+        bench(args[1], parse(args[2]) if len(args) == 3 else {})
+    elif len(args) == 1:
+        print("/* generated by host/gamedb.py from host/gamedb.txt, don't edit */")
+        for row in table(parse(args[0])):
+            print(row)
+    else:
+        sys.exit(__doc__)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,703 @@
+/* vim: set tabstop=3 expandtab:
+**
+** This file is in the public domain.
+**
+** host_osd.c
+**
+** Headless OSD for running the core on a PC: the ROM comes from a file,
+** frames and sound are hashed instead of shown, input comes from a script
+** and the timer runs as fast as the emulator does. Prints emulated fps,
+** per-subsystem time and the hashes when done.
+**
+** usage: nesbench rom.nes [-f frames] [-i input.txt] [-g golden.txt]
+**                         [-c codes] [-r ntsc|pal|dendy] [-x on|off] [-v]
+**                         [-t trace.txt [-b pc] [-w address]]
+**                         [-R render.trc [-S first] | -P render.trc [-p passes]]
+**
+** The input script and golden list formats are in nes_replay.h. With -g
+** the hashes are checked against the golden entry for this ROM and frame
+** count: exit code 0 on a match, 1 on a mismatch, 2 if there's no entry
+** (the line to add is printed). -c takes cheat codes as in nes_cheat.h,
+** separated by commas. -r plays the ROM as that TV system whatever its
+** header says. -x turns the CPU's idle loop skipping on or off whatever
+** the game's profile says; the hashes have to come out the same either
+** way. With a core built with NES6502_TRACE, -t writes the last
+** instructions run to trace.txt, in the format tracedis reads: up to the
+** end, or to a while past the instruction at -b or a write to -w.
+** With NES_RENDERTRACE, -R writes a render trace (nes_rtrace.h) of the
+** frames from -S on, and -P replays one instead of running the game:
+** passes times with the blit off and on, with the results and the
+** frames' hash printed.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <noftypes.h>
+#include <bitmap.h>
+#include <event.h>
+#include <log.h>
+#include <osd.h>
+#include <nofrendo.h>
+#include <nes.h>
+#include <nesinput.h>
+#include <nes_prof.h>
+#include <nes_replay.h>
+#include <nes_rtrace.h>
+#include <nes_rom.h>
+#include <nes6502.h>
+
+#define  HOST_SAMPLERATE   32000
+
+static const char *rom_path;
+static int frames_wanted = 3600;
+static bool verbose = false;
+static char *golden;
+
+static uint32 start_us;
+static uint32 rom_crc; /* kept for the report, the ROM is gone by then */
+static int frames; /* emulated so far */
+static int drawn;
+
+static void (*frame_tick)(void);
+static void (*audio_callback)(void *buffer, int length);
+static int16 audio_buf[HOST_SAMPLERATE / NES_REFRESH_MIN];
+static int frame_samples = HOST_SAMPLERATE / NES_REFRESH_RATE;
+static int region = -1;
+static int idle_skip = -1; /* -x, -1 for the profile's */
+
+/*
+** Timing
+*/
+
+uint32 osd_getmicros(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint32)(ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+}
+
+#ifdef NES_PROFILE
+/* nanoseconds stand in for CPU cycles */
+uint32 osd_getcycles(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint32)(ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+
+void osd_profinfo(int line, char *buf, int len)
+{
+   if (0 == line)
+      snprintf(buf, len, "frm %08X snd %08X", replay_framehash(), replay_audiohash());
+   else
+      buf[0] = 0;
+}
+#endif
+
+#ifdef NES_HEATMAP
+/* no flash here */
+uint32 osd_getcachemisses(void)
+{
+   return 0;
+}
+#endif
+
+int osd_installtimer(int frequency, void *func, int funcsize, void *counter, int countersize)
+{
+   frame_tick = func;
+   frame_samples = HOST_SAMPLERATE / frequency;
+   /* every frame is drawn, so the hashes don't depend on how fast we are */
+   nes_setframeskipcap(1);
+   return 0;
+}
+
+/* the frame is due as soon as we ask */
+void osd_waitframe(void)
+{
+   frame_tick();
+}
+
+void osd_pause(bool paused)
+{
+}
+
+/* the host runs at whatever clock it runs at */
+void osd_setminclock(int mhz)
+{
+}
+
+/* no background storage: gui_savesnap writes the file itself */
+int osd_savesnap(bitmap_t *bmp, rgb_t *pal)
+{
+   return -1;
+}
+
+#ifdef NES_FASTFORWARD
+void osd_fastforward(bool on)
+{
+}
+#endif
+
+/*
+** Sound
+*/
+
+void osd_setsound(void (*playfunc)(void *buffer, int length))
+{
+   audio_callback = playfunc;
+}
+
+void osd_getsoundinfo(sndinfo_t *info)
+{
+   info->sample_rate = HOST_SAMPLERATE;
+   info->bps = 16;
+}
+
+void osd_endframe(void)
+{
+   if (audio_callback)
+   {
+      PROF_BEGIN(t0);
+      audio_callback(audio_buf, frame_samples);
+      PROF_END(PROF_APU, t0);
+      replay_audio(audio_buf, frame_samples);
+   }
+   frames++;
+}
+
+/*
+** Video
+*/
+
+static int init(int width, int height) { return 0; }
+static void shutdown(void) {}
+static int set_mode(int width, int height) { return 0; }
+static void set_palette(rgb_t *pal) {}
+static void clear(uint8 color) {}
+
+static bitmap_t *screen;
+
+static bitmap_t *lock_write(void)
+{
+   if (NULL == screen)
+      screen = bmp_create(NES_SCREEN_WIDTH, NES_SCREEN_HEIGHT, 0);
+   return screen;
+}
+
+/* full height, the hashes cover all 240 lines: the PPU only draws those within a bitmap's height */
+static bitmap_t *create_buffer(int width, int height)
+{
+   static bitmap_t *frame;
+
+   if (NULL == frame)
+      frame = bmp_create(NES_SCREEN_WIDTH, NES_SCREEN_HEIGHT, 0);
+   return frame;
+}
+
+static void custom_blit(bitmap_t *bmp, int num_dirties, rect_t *dirty_rects)
+{
+   uint32 hash = replay_frame(bmp);
+
+   if (verbose)
+      printf("frame %d %08X\n", frames, hash);
+   drawn++;
+}
+
+static viddriver_t hostDriver =
+{
+   "headless",    /* name */
+   init,          /* init */
+   shutdown,      /* shutdown */
+   set_mode,      /* set_mode */
+   set_palette,   /* set_palette */
+   clear,         /* clear */
+   lock_write,    /* lock_write */
+   NULL,          /* free_write */
+   custom_blit,   /* custom_blit */
+   false,         /* invalidate flag */
+   create_buffer, /* create_buffer */
+   NULL,          /* line_done */
+   NULL           /* next_buffer */
+};
+
+void osd_getvideoinfo(vidinfo_t *info)
+{
+   info->default_width = NES_SCREEN_WIDTH;
+   info->default_height = NES_SCREEN_HEIGHT;
+   info->driver = &hostDriver;
+}
+
+/*
+** Results
+*/
+
+static int report(void)
+{
+   uint32 crc = rom_crc;
+   uint32 us = osd_getmicros() - start_us;
+#ifdef NES_PROFILE
+   static const char *names[] = { "cpu", "ppu", "map", "apu" };
+   int i;
+#endif
+
+   printf("%d frames (%d drawn) in %u ms: %.1f fps\n", frames, drawn,
+          (unsigned) (us / 1000), us ? frames * 1e6 / us : 0.0);
+#ifdef NES_PROFILE
+   for (i = 0; i < 4; i++)
+      printf("%s %8.1f us/frame\n", names[i], prof_cycles[i] / 1000.0 / frames);
+#endif
+   printf("frame hash %08X\naudio hash %08X\n", replay_framehash(), replay_audiohash());
+
+   if (NULL == golden)
+      return 0;
+   switch (replay_check(golden, crc, frames))
+   {
+   case 1:
+      printf("PASS\n");
+      return 0;
+   case 0:
+      printf("FAIL\n");
+      return 1;
+   default:
+      printf("no golden entry, add:\n%08X %d %08X %08X\n", crc, frames,
+             replay_framehash(), replay_audiohash());
+      return 2;
+   }
+}
+
+/*
+** CPU trace
+*/
+
+#ifdef NES6502_TRACE
+#define  HOST_TRACE_ENTRIES   4096
+#define  HOST_TRACE_AFTER     256
+
+static const char *trace_path;
+static uint32 trace_pc = NES6502_TRACE_NONE, trace_addr = NES6502_TRACE_NONE;
+static nes6502_trace trace_ring[HOST_TRACE_ENTRIES];
+
+static void trace_start(void)
+{
+   nes6502_settrace(trace_ring, HOST_TRACE_ENTRIES, HOST_TRACE_AFTER);
+   nes6502_tracewatch(trace_pc, trace_addr);
+}
+
+/* the same lines the device prints, see cputrace.c */
+static int trace_write(void)
+{
+   FILE *fp;
+   uint32 first;
+   int count, i;
+
+   nes6502_tracestop();
+   count = nes6502_gettrace(&first);
+   fp = fopen(trace_path, "w");
+   if (NULL == fp)
+   {
+      fprintf(stderr, "can't write %s\n", trace_path);
+      return 1;
+   }
+   fprintf(fp, "cputrace %d %08X\n", count, rom_crc);
+   for (i = 0; i < count; i++)
+   {
+      nes6502_trace *ent = &trace_ring[(first + i) & (HOST_TRACE_ENTRIES - 1)];
+
+      fprintf(fp, "%08X %04X %02X%02X%02X %02X %02X %02X %02X %02X\n",
+              ent->cycles, ent->pc, ent->code[0], ent->code[1], ent->code[2],
+              ent->a, ent->x, ent->y, ent->s, ent->p);
+   }
+   fprintf(fp, "cputrace end\n");
+   fclose(fp);
+   return 0;
+}
+#endif /* NES6502_TRACE */
+
+/*
+** Input
+*/
+
+/* read a whole file, NUL terminated */
+static char *load_file(const char *path, long *length)
+{
+   FILE *fp = fopen(path, "rb");
+   char *data;
+   long size;
+
+   if (NULL == fp)
+      return NULL;
+   fseek(fp, 0, SEEK_END);
+   size = ftell(fp);
+   fseek(fp, 0, SEEK_SET);
+   data = malloc(size + 1);
+   if (data && fread(data, 1, size, fp) != (size_t) size)
+   {
+      free(data);
+      data = NULL;
+   }
+   fclose(fp);
+   if (NULL == data)
+      return NULL;
+
+   data[size] = '\0';
+   if (length)
+      *length = size;
+   return data;
+}
+
+/*
+** Render trace
+*/
+
+#ifdef NES_RENDERTRACE
+#define  HOST_RTRACE_BYTES    (64 << 20)
+
+static const char *rtrace_path, *rtrace_replay;
+static int rtrace_first = 0;
+static int rtrace_passes = 10;
+static uint8 *rtrace_buf;
+static bool rtrace_ok = true;
+
+static void rtrace_arm(void)
+{
+   rtrace_buf = malloc(HOST_RTRACE_BYTES);
+   if (rtrace_buf)
+      rtrace_capture(rtrace_buf, HOST_RTRACE_BYTES, frames_wanted - rtrace_first);
+}
+
+static void rtrace_bench_file(void)
+{
+   rtrace_result_t result;
+   long length;
+   char *trace = load_file(rtrace_replay, &length);
+
+   if (NULL == trace || rtrace_bench((uint8 *) trace, length, rtrace_passes, &result))
+   {
+      fprintf(stderr, "can't replay %s with this ROM\n", rtrace_replay);
+      rtrace_ok = false;
+   }
+   else
+   {
+      printf("%d frames, %d passes\n", result.frames, rtrace_passes);
+      printf("ppu  %8u us/frame\nblit %8u us/frame\n", (unsigned) result.ppu_us, (unsigned) result.blit_us);
+      printf("render hash %08X\n", result.hash);
+   }
+   free(trace);
+}
+
+/* between frames: start the capture, or replay in place of the game */
+static void rtrace_host_frame(void)
+{
+   if (rtrace_path && frames == rtrace_first && rtrace_first > 0)
+      rtrace_arm();
+   if (rtrace_replay)
+   {
+      rtrace_bench_file();
+      frames_wanted = frames;
+   }
+}
+
+static int rtrace_write_file(void)
+{
+   FILE *fp;
+   int length = rtrace_done();
+
+   if (0 == length || NULL == (fp = fopen(rtrace_path, "wb")))
+   {
+      fprintf(stderr, "can't write %s\n", rtrace_path);
+      return 1;
+   }
+   fwrite(rtrace_buf, 1, length, fp);
+   fclose(fp);
+   printf("render trace: %d bytes\n", length);
+   return 0;
+}
+#endif /* NES_RENDERTRACE */
+
+void osd_getinput(void)
+{
+   const int ev[16] = {
+      event_joypad1_select, 0, 0, event_joypad1_start, event_joypad1_up, event_joypad1_right, event_joypad1_down, event_joypad1_left,
+      0, 0, event_rewind, event_fastforward, event_soft_reset, event_joypad1_a, event_joypad1_b, event_hard_reset};
+   static int held = 0;
+   static bool idle_forced = false;
+   int b, chg, x;
+   event_t evh;
+
+#ifdef NES_RENDERTRACE
+   rtrace_host_frame();
+#endif /* NES_RENDERTRACE */
+
+   /* quit the way the launcher does on the device, so teardown gets run too */
+   if (frames >= frames_wanted)
+   {
+      rom_crc = nes_getcontextptr()->rominfo->crc;
+#ifdef NES_RENDERTRACE
+      rtrace_stop();
+#endif /* NES_RENDERTRACE */
+      evh = event_get(event_quit);
+      if (evh)
+         evh(INP_STATE_MAKE);
+      return;
+   }
+
+   /* from the end of the first frame on, once the profile has had its say */
+   if (idle_skip >= 0 && !idle_forced)
+   {
+      nes_t *machine = nes_getcontextptr();
+
+      nes6502_getcontext(machine->cpu);
+      machine->cpu->idle_skip = idle_skip;
+      nes6502_setcontext(machine->cpu);
+      idle_forced = true;
+   }
+
+   b = replay_buttons(frames);
+
+   chg = b ^ held;
+   held = b;
+   for (x = 0; x < 16; x++, chg >>= 1, b >>= 1)
+   {
+      if (0 == (chg & 1) || 0 == ev[x])
+         continue;
+      evh = event_get(ev[x]);
+      if (evh)
+         evh((b & 1) ? INP_STATE_MAKE : INP_STATE_BREAK);
+   }
+}
+
+/* the replay script changes buttons at frame boundaries only */
+void osd_strobeinput(void)
+{
+}
+
+void osd_getmouse(int *x, int *y, int *button)
+{
+}
+
+/*
+** ROM
+*/
+
+char *osd_getromdata(void)
+{
+   char *data = load_file(rom_path, NULL);
+
+   if (NULL == data)
+   {
+      fprintf(stderr, "can't read %s\n", rom_path);
+      exit(1);
+   }
+
+   return data;
+}
+
+void osd_freeromdata(char *data)
+{
+   free(data);
+}
+
+/* one heap block per arena region */
+void *osd_arenareserve(int region, int size)
+{
+   return malloc(size);
+}
+
+void osd_arenarelease(int region, void *block)
+{
+   free(block);
+}
+
+int osd_romregion(void)
+{
+   return region;
+}
+
+static const char *cheat_codes;
+
+int osd_loadcheats(uint32 crc, char *buf, int size)
+{
+   if (NULL == cheat_codes)
+      return -1;
+   strncpy(buf, cheat_codes, size);
+   return strlen(cheat_codes) < size ? strlen(cheat_codes) : size;
+}
+
+/* battery RAM always starts out clear, so runs are repeatable */
+int osd_loadsram(uint32 crc, uint8 *data, int length)
+{
+   return -1;
+}
+
+void osd_savesram(uint32 crc, const uint8 *data, int length)
+{
+   if (verbose)
+      printf("frame %d battery RAM %08X, %d bytes\n", frames, crc, length);
+}
+
+/* save states only live as long as the run */
+#define  HOST_STATE_SLOTS  10
+
+static struct
+{
+   uint8 *data;
+   int length;
+   uint32 crc;
+} host_state[HOST_STATE_SLOTS];
+
+int osd_loadstate(uint32 crc, int slot, uint8 *data, int size)
+{
+   if (NULL == host_state[slot].data || crc != host_state[slot].crc || size < host_state[slot].length)
+      return -1;
+   memcpy(data, host_state[slot].data, host_state[slot].length);
+   return host_state[slot].length;
+}
+
+void osd_savestate(uint32 crc, int slot, const uint8 *data, int length)
+{
+   free(host_state[slot].data);
+   host_state[slot].data = malloc(length);
+   if (NULL == host_state[slot].data)
+      return;
+   memcpy(host_state[slot].data, data, length);
+   host_state[slot].length = length;
+   host_state[slot].crc = crc;
+}
+
+/*
+** Startup / shutdown
+*/
+
+/* the core's log, the profiler's lines among it, straight to stdout */
+static int host_log(const char *string)
+{
+   return fputs(string, stdout);
+}
+
+int osd_init(void)
+{
+   log_chain_logfunc(host_log);
+   return 0;
+}
+
+void osd_shutdown(void)
+{
+}
+
+int main(int argc, char *argv[])
+{
+   int i;
+
+   for (i = 1; i < argc; i++)
+   {
+      if (0 == strcmp(argv[i], "-f") && i + 1 < argc)
+         frames_wanted = atoi(argv[++i]);
+      else if (0 == strcmp(argv[i], "-i") && i + 1 < argc)
+      {
+         char *script = load_file(argv[++i], NULL);
+
+         if (NULL == script)
+         {
+            fprintf(stderr, "can't read input script %s\n", argv[i]);
+            return 1;
+         }
+         /* read as the frames come, it stays for the run */
+         replay_load(script);
+      }
+      else if (0 == strcmp(argv[i], "-g") && i + 1 < argc)
+      {
+         golden = load_file(argv[++i], NULL);
+         if (NULL == golden)
+         {
+            fprintf(stderr, "can't read golden list %s\n", argv[i]);
+            return 1;
+         }
+      }
+      else if (0 == strcmp(argv[i], "-c") && i + 1 < argc)
+         cheat_codes = argv[++i];
+      else if (0 == strcmp(argv[i], "-r") && i + 1 < argc)
+      {
+         static const char *names[] = { "ntsc", "pal", "dendy" };
+
+         for (region = 2; region >= 0; region--)
+         {
+            if (0 == strcmp(argv[i + 1], names[region]))
+               break;
+         }
+         if (region < 0)
+         {
+            fprintf(stderr, "no TV system called %s\n", argv[i + 1]);
+            return 1;
+         }
+         i++;
+      }
+      else if (0 == strcmp(argv[i], "-x") && i + 1 < argc)
+      {
+         i++;
+         if (0 == strcmp(argv[i], "on") || 0 == strcmp(argv[i], "off"))
+            idle_skip = (0 == strcmp(argv[i], "on"));
+         else
+         {
+            fprintf(stderr, "-x takes on or off, not %s\n", argv[i]);
+            return 1;
+         }
+      }
+      else if (0 == strcmp(argv[i], "-v"))
+         verbose = true;
+#ifdef NES6502_TRACE
+      else if (0 == strcmp(argv[i], "-t") && i + 1 < argc)
+         trace_path = argv[++i];
+      else if (0 == strcmp(argv[i], "-b") && i + 1 < argc)
+         trace_pc = strtoul(argv[++i], NULL, 16);
+      else if (0 == strcmp(argv[i], "-w") && i + 1 < argc)
+         trace_addr = strtoul(argv[++i], NULL, 16);
+#endif /* NES6502_TRACE */
+#ifdef NES_RENDERTRACE
+      else if (0 == strcmp(argv[i], "-R") && i + 1 < argc)
+         rtrace_path = argv[++i];
+      else if (0 == strcmp(argv[i], "-S") && i + 1 < argc)
+         rtrace_first = atoi(argv[++i]);
+      else if (0 == strcmp(argv[i], "-P") && i + 1 < argc)
+         rtrace_replay = argv[++i];
+      else if (0 == strcmp(argv[i], "-p") && i + 1 < argc)
+         rtrace_passes = atoi(argv[++i]);
+#endif /* NES_RENDERTRACE */
+      else
+         rom_path = argv[i];
+   }
+   if (NULL == rom_path)
+   {
+      fprintf(stderr, "usage: %s rom.nes [-f frames] [-i input.txt] [-g golden.txt] [-c codes] [-r region] [-x on|off] [-v]\n", argv[0]);
+      return 1;
+   }
+
+#ifdef NES6502_TRACE
+   if (trace_path)
+      trace_start();
+#endif /* NES6502_TRACE */
+#ifdef NES_RENDERTRACE
+   if (rtrace_path && 0 == rtrace_first)
+      rtrace_arm();
+#endif /* NES_RENDERTRACE */
+
+   start_us = osd_getmicros();
+   if (nofrendo_main(0, NULL))
+      return 1;
+
+#ifdef NES6502_TRACE
+   if (trace_path && trace_write())
+      return 1;
+#endif /* NES6502_TRACE */
+#ifdef NES_RENDERTRACE
+   if (rtrace_replay)
+      return rtrace_ok ? 0 : 1;
+   if (rtrace_path && rtrace_write_file())
+      return 1;
+#endif /* NES_RENDERTRACE */
+
+   return report();
+}
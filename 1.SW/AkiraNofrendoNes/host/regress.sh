@@ -0,0 +1,36 @@
+#!/bin/sh
+# Frame/audio hash regression run. Every "<rom> <input script> <frames>" line
+# of the suite file is replayed with nesbench and checked against golden.txt;
+# ROM paths are relative to $ROMDIR (default roms/, not part of the tree).
+# New entries print the golden line to add. Each is then replayed again with
+# the CPU's idle loop skipping forced on and off (nesbench -x): a game on
+# the gamedb idleskip list has to hash the same as one that isn't.
+#
+#   make && ./regress.sh [suite.txt]
+
+cd "$(dirname "$0")"
+SUITE=${1:-suite.txt}
+ROMDIR=${ROMDIR:-roms}
+pass=0
+fail=0
+new=0
+
+while read -r rom input frames; do
+	case "$rom" in ''|\#*) continue ;; esac
+	out=$(./nesbench "$ROMDIR/$rom" -i "$input" -f "$frames" -g golden.txt)
+	case $? in
+	0) pass=$((pass + 1)) ;;
+	1) fail=$((fail + 1)); echo "FAIL $rom ($input, $frames frames)" ;;
+	*) new=$((new + 1)); echo "NEW  $rom: $(echo "$out" | tail -n 1)"; continue ;;
+	esac
+	for idle in on off; do
+		./nesbench "$ROMDIR/$rom" -i "$input" -f "$frames" -g golden.txt -x $idle > /dev/null
+		case $? in
+		0) pass=$((pass + 1)) ;;
+		*) fail=$((fail + 1)); echo "FAIL $rom ($input, $frames frames, idle skip $idle)" ;;
+		esac
+	done
+done < "$SUITE"
+
+echo "$pass passed, $fail failed, $new without golden hashes"
+[ "$fail" -eq 0 ]
@@ -0,0 +1,95 @@
+#!/usr/bin/env python3
+"""Lookup tables of the core worked out here rather than at every game start.
+
+    tables.py pal   > ../main/nofrendo/nes/nes_pal.inc       (make tables)
+    tables.py blip  > ../main/nofrendo/sndhrdw/nes_apu_blip.inc
+
+pal is what pal_generate makes of the default hue and tint, blip the band
+limited step kernel of APU_BLIP. Both are the same sums in the same
+precision as the C they stand in for: the ESP32 has no double FPU, so its
+sin() and cos() in software were most of the time to the first frame.
+"""
+
+import math
+import struct
+import sys
+
+PI = 3.1415926535897932384626433832795
+
+# nes_pal.c
+HUE = 334.0
+TINT = 0.4
+BRIGHTNESS = ((0.50, 0.75, 1.00, 1.00),
+              (0.29, 0.45, 0.73, 0.90),
+              (0.00, 0.24, 0.47, 0.77),
+              (0.02, 0.04, 0.05, 0.07))
+COL_ANGLES = (0, 240, 210, 180, 150, 120, 90, 60, 30, 0, 330, 300, 270, 0, 0, 0)
+
+# nes_apu.c
+BLIP_PHASES = 16
+BLIP_TAPS = 8
+BLIP_DELAY = BLIP_TAPS // 2 - 1
+
+
+def f32(x):
+    """x rounded to a C float"""
+    return struct.unpack("f", struct.pack("f", x))[0]
+
+
+def clamp(v):
+    return max(0, min(255, v))
+
+
+def pal():
+    out = []
+    hue, tint = f32(HUE), f32(TINT)
+    for x in range(4):
+        for z in range(16):
+            if z == 0:
+                s, y = 0.0, BRIGHTNESS[0][x]
+            elif z == 13:
+                s, y = 0.0, BRIGHTNESS[2][x]
+            elif z in (14, 15):
+                s, y = 0.0, BRIGHTNESS[3][x]
+            else:
+                s, y = tint, BRIGHTNESS[1][x]
+            y = f32(y)
+            theta = f32(PI * (f32(COL_ANGLES[z] + hue) / 180.0))
+            r = int(256.0 * (y + s * math.sin(theta)))
+            g = int(256.0 * (y - ((27 / 53.0) * s * math.sin(theta)) + ((10 / 53.0) * s * math.cos(theta))))
+            b = int(256.0 * (y - (s * math.cos(theta))))
+            out.append(f"   {{ {clamp(r)}, {clamp(g)}, {clamp(b)} }}, /* ${x:X}{z:X} */")
+    return out
+
+
+def blip():
+    out = []
+    for phase in range(BLIP_PHASES):
+        impulse = []
+        for tap in range(BLIP_TAPS):
+            x = tap - BLIP_DELAY - phase / BLIP_PHASES
+            window = 0.42 + 0.5 * math.cos(2 * PI * x / BLIP_TAPS) + 0.08 * math.cos(4 * PI * x / BLIP_TAPS)
+            sinc = 1.0 if x == 0 else math.sin(PI * x * 0.9) / (PI * x * 0.9)
+            impulse.append(sinc * window)
+        # summed in tap order, as the C does
+        total = 0.0
+        for v in impulse:
+            total += v
+        kernel = [int(v * 0x8000 / total + 0.5) for v in impulse]
+        # rounding error goes to the centre tap, so a step is exactly 1.0
+        kernel[BLIP_DELAY + (phase >= BLIP_PHASES // 2)] += 0x8000 - sum(kernel)
+        out.append("   { " + ", ".join(str(k) for k in kernel) + " },")
+    return out
+
+
+def main():
+    tables = {"pal": pal, "blip": blip}
+    if len(sys.argv) != 2 or sys.argv[1] not in tables:
+        sys.exit(__doc__)
+    print(f"/* generated by host/tables.py {sys.argv[1]}, don't edit */")
+    for row in tables[sys.argv[1]]():
+        print(row)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,75 @@
+/* vim: set tabstop=3 expandtab:
+**
+** This file is in the public domain.
+**
+** tracedis.c
+**
+** Disassembles a CPU trace, as the device prints it over UART (cputrace.c)
+** or nesbench -t writes it. Anything in the capture outside a trace is
+** skipped, so a whole UART log can go in as it is. Every instruction is
+** printed with the cycles since the one before, its disassembly and the
+** registers before it ran.
+**
+** usage: tracedis [capture.txt]   (stdin without one)
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <noftypes.h>
+#include <nes6502.h>
+#include <dis6502.h>
+
+/* the instruction being disassembled, read back by dis6502.c */
+static uint32 cur_pc;
+static uint8 cur_code[3];
+
+uint8 nes6502_getbyte(uint32 address)
+{
+   uint32 offset = (address - cur_pc) & 0xFFFF;
+
+   return offset < 3 ? cur_code[offset] : 0;
+}
+
+int main(int argc, char *argv[])
+{
+   FILE *fp = stdin;
+   char line[256];
+   bool in_trace = false;
+   uint32 last_cycles = 0;
+   int count;
+   unsigned crc;
+
+   if (argc > 2 || (argc == 2 && NULL == (fp = fopen(argv[1], "r"))))
+   {
+      fprintf(stderr, "usage: %s [capture.txt]\n", argv[0]);
+      return 1;
+   }
+
+   while (fgets(line, sizeof(line), fp))
+   {
+      unsigned cycles, pc, code, a, x, y, s, p;
+
+      if (0 == strncmp(line, "cputrace end", 12))
+      {
+         in_trace = false;
+      }
+      else if (2 == sscanf(line, "cputrace %d %X", &count, &crc))
+      {
+         printf("; %d instructions, ROM %08X\n", count, crc);
+         in_trace = true;
+         last_cycles = 0;
+      }
+      else if (in_trace && 8 == sscanf(line, "%X %X %6X %X %X %X %X %X", &cycles, &pc, &code, &a, &x, &y, &s, &p))
+      {
+         cur_pc = pc;
+         cur_code[0] = code >> 16;
+         cur_code[1] = code >> 8;
+         cur_code[2] = code;
+         /* a state loaded sets the clock back, show that as 0 */
+         printf("%+5d %s", last_cycles && cycles >= last_cycles ? (int)(cycles - last_cycles) : 0,
+                nes6502_disasm(pc, p, a, x, y, s));
+         last_cycles = cycles;
+      }
+   }
+   return 0;
+}
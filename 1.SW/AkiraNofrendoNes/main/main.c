@@ -7,64 +7,141 @@
 #include "nvs_flash.h"
 #include "driver/gpio.h"
 #include "nofrendo/nofrendo.h"
+#include "nes/nes_arena.h"
 #include "menu.h"
 #include "esp_spi_flash.h"
+#include "esp_timer.h"
+#include "esp_attr.h"
+#include "esp_heap_caps.h"
+#include "psxcontroller.h"
+#include "video_audio.h"
+#include "romsave.h"
+#include "romslot.h"
+#include "romsd.h"
+#include "romupload.h"
+#include "rombench.h"
+#include "settings.h"
+#include "snapshot.h"
+#include "memplace.h"
+#include "tasks.h"
+#include "power.h"
 
 int romPartition;
+uint32_t romOffset;
+
+// What the power button suspended, kept in RTC memory through deep sleep.
+// Not set up at power on, the check word tells garbage from a real one.
+#define RESUME_MAGIC 0x524B4153 // "SAKR"
+
+typedef struct
+{
+	uint32_t magic;
+	int partition;
+	uint32_t offset;
+	uint32_t check;
+} resume_t;
+
+static RTC_NOINIT_ATTR resume_t resume;
+
+static uint32_t resume_check(void)
+{
+	return ~(resume.magic ^ resume.partition ^ resume.offset);
+}
+
+static void suspend_to_sleep(void)
+{
+	resume.magic = RESUME_MAGIC;
+	resume.partition = romPartition;
+	resume.offset = romOffset;
+	resume.check = resume_check();
+
+	// the state, the battery RAM and the settings are on their way to flash
+	romsave_flush();
+	settings_flush();
+	setBr(-2);
+	printf("Suspended, sleeping\n");
+	psxSleep();
+}
 
 char *osd_getromdata()
 {
 	// printf("choosen: %d\n",romPartition);
 	char *romdata;
-	const esp_partition_t *part;
-	spi_flash_mmap_handle_t hrom;
-	esp_err_t err;
-	nvs_flash_init();
 
-	part = esp_partition_find_first(0x41 + romPartition, 1, NULL);
-	if (part == 0)
-		printf("Couldn't find rom part!\n");
+	if (romPartition == ROMSD_SLOT)
+		romdata = romsd_load(romOffset);
+	else
+		romdata = romslot_load(romPartition, romOffset);
+	if (romdata)
+		printf("Initialized. ROM@%p\n", romdata);
+	return romdata;
+}
 
-	int partSize;
-	switch (romPartition)
+// the TV system of the game, -1 to go by its iNES header: see romslot.h
+int osd_romregion(void)
+{
+	romslot_t hdr;
+	int region;
+
+	if (romPartition == ROMSD_SLOT)
 	{
-	case 0:
-	case 5:
-	case 6:
-	case 7:
-		partSize = 100;
-		break;
-	case 1:
-	case 4:
-	case 11:
-	case 12:
-		partSize = 260;
-		break;
-	case 2:
-		partSize = 388;
-		break;
-	case 3:
-	case 13:
-		partSize = 132;
-		break;
-	case 8:
-		partSize = 772;
-		break;
-	case 9:
-		partSize = 516;
-		break;
-	case 10:
-		partSize = 296;
-		break;
-	default:
-		partSize = 0;
-		break;
+		const romsd_entry_t *e = romsd_entry(romOffset);
+		region = e ? romslot_region(e->name) : ROMSLOT_REGION_HEADER;
 	}
-	err = esp_partition_mmap(part, 0, partSize * 1024, SPI_FLASH_MMAP_DATA, (const void **)&romdata, &hrom);
-	if (err != ESP_OK)
-		printf("Couldn't map rom part!\n");
-	printf("Initialized. ROM@%p\n", romdata);
-	return (char *)romdata;
+	else
+		region = romslot_read(romPartition, romOffset, &hdr) ? hdr.region : ROMSLOT_REGION_HEADER;
+	// REGION_NTSC, REGION_PAL and REGION_DENDY of nes_rom.h are one less
+	return region - 1;
+}
+
+// called by rom_free when the emulator is done with a game
+void osd_freeromdata(char *data)
+{
+	romslot_free(data);
+}
+
+// the emulator's arena regions, see nes_arena.h: the per-frame state in
+// internal RAM, snapshots and the rewind ring in PSRAM when there is some
+void *osd_arenareserve(int region, int size)
+{
+	return memplace_alloc(region == ARENA_BULK ? MEM_COLD : MEM_HOT, size);
+}
+
+void osd_arenarelease(int region, void *block)
+{
+	free(block);
+}
+
+// battery RAM, see romsave.h
+int osd_loadsram(uint32_t crc, uint8_t *data, int length)
+{
+	return romsave_load(crc, data, length);
+}
+
+void osd_savesram(uint32_t crc, const uint8_t *data, int length)
+{
+	romsave_store(crc, data, length);
+}
+
+// save states, see romsave.h
+int osd_loadstate(uint32_t crc, int slot, uint8_t *data, int size)
+{
+	int length = romsave_loadstate(crc, slot, data, size);
+
+	if (length >= 0)
+		movieStateLoaded();
+	return length;
+}
+
+void osd_savestate(uint32_t crc, int slot, const uint8_t *data, int length)
+{
+	romsave_storestate(crc, slot, data, length);
+}
+
+// cheat codes, see romsave.h
+int osd_loadcheats(uint32_t crc, char *buf, int size)
+{
+	return romsave_loadcheats(crc, buf, size);
 }
 
 void esp_wake_deep_sleep()
@@ -77,12 +154,93 @@ esp_err_t event_handler(void *arg, esp_event_base_t event_base,
 {
 	return ESP_OK;
 }
+// Benchmark mode: every game of the menu in turn, see rombench.h. The
+// entries after the games are upload and the benchmark itself.
+static void run_bench(int mode)
+{
+	rombench_begin(mode);
+	for (int entry = 0;; entry++)
+	{
+		romListEntry(entry, &romPartition, &romOffset);
+		if (romPartition < 0 && romPartition != ROMSD_SLOT)
+			break;
+		rombench_game(entry);
+		int failed = nofrendo_main(0, NULL);
+		settings_rom(0);
+		if (getSuspended())
+			suspend_to_sleep();
+		if (failed)
+			printf("bench: entry %d doesn't start\n", entry + 1);
+		else if (!rombench_finished())
+			break; // Button1 stopped the run
+	}
+	rombench_end();
+}
+
+// The launcher and the emulator, on the core, priority and stack tasks.h has for them
+static void emuTask(void *arg)
+{
+	// nofrendo_main returns when Button1 asks for the menu, suspends the
+	// game or the game doesn't load, the next one starts without a reset
+	// NVS is set up here once, for the saves, the SD index and the menu
+	bootStage("start");
+	nvs_flash_init();
+	bootStage("nvs");
+	romsave_init();
+	settings_init();
+#if CONFIG_NES_SNAPSHOT
+	snapshot_init();
+#endif
+	while (1)
+	{
+		if (resume.magic == RESUME_MAGIC && resume.check == resume_check())
+		{
+			// straight back into the game, a crash on the way gets the menu next time
+			resume.magic = 0;
+			romPartition = resume.partition;
+			romOffset = resume.offset;
+			if (romPartition == ROMSD_SLOT)
+				romsd_init();
+			initDisplay();
+			setResume();
+			printf("Resuming\n");
+		}
+		else
+			romListEntry(runMenu(), &romPartition, &romOffset);
+		if (romPartition == ROMUPLOAD_SLOT)
+		{
+			// back to a menu that lists what came in
+			romupload_run();
+			continue;
+		}
+		if (romPartition == ROMBENCH_SLOT)
+		{
+			run_bench(romOffset);
+			continue;
+		}
+		printf("NoFrendo start!\n");
+		int64_t t0 = esp_timer_get_time();
+		if (nofrendo_main(0, NULL))
+			printf("NoFrendo couldn't start the game\n");
+		else
+			printf("NoFrendo stopped after %d s\n", (int)((esp_timer_get_time() - t0) / 1000000));
+		// the launcher goes by the global settings
+		settings_rom(0);
+		if (getSuspended())
+			suspend_to_sleep();
+	}
+}
+
 int app_main(void)
 {
-	romPartition = runMenu();
-	printf("NoFrendo start!\n");
-	nofrendo_main(0, NULL);
-	printf("NoFrendo died? WtF?\n");
-	asm("break.n 1");
+	// the ULP woke us for a flat battery: straight back to sleep
+	powerStandbyCheck();
+	// app_main's own task is gone once this returns; without the room for
+	// emuTask everything runs here, as it did before there was a table
+	if (!tasks_start(TASK_EMU, &emuTask, NULL, NULL))
+	{
+		printf("No room for emuTask, the emulator runs in the main task\n");
+		emuTask(NULL);
+	}
 	return 0;
 }
@@ -0,0 +1,26 @@
+#include "esp_heap_caps.h"
+#include "memplace.h"
+#include "nes/nes_arena.h"
+
+static uint32_t moved;
+
+void *memplace_alloc(int place, size_t size)
+{
+	void *block = NULL;
+
+	if (place == MEM_COLD)
+		block = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+	if (block == NULL)
+		block = heap_caps_malloc(size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+	return block;
+}
+
+void memplace_traffic(int bytes)
+{
+	moved += bytes;
+}
+
+uint32_t memplace_moved(void)
+{
+	return moved + arena_gettraffic(ARENA_BULK);
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// Where the big blocks go on a board with PSRAM (WROVER). PSRAM is read and
+// written through the same small cache as flash, so a block touched now and
+// then costs next to nothing there, and one gone over every frame thrashes
+// the cache for everything else. With CONFIG_SPIRAM_USE_MALLOC plain malloc
+// puts any block over 16KB in PSRAM, whatever it is, so whatever is large
+// says where it belongs. The core's arena regions map onto these too:
+// ARENA_FAST is MEM_HOT, ARENA_BULK MEM_COLD.
+#define MEM_HOT 0  // internal RAM only: per-frame state, frame and line buffers
+#define MEM_COLD 1 // PSRAM if there is any, else internal: images, save states, staging
+
+/**
+ * @brief a block of size bytes placed as place says, NULL if there's no room; free() it
+ */
+void *memplace_alloc(int place, size_t size);
+
+/**
+ * @brief count bytes just read or written in a MEM_COLD block
+ *
+ * Called by the code that goes over one, with roughly what it moved: there's no
+ * hardware counter for PSRAM accesses, so this is what the traffic report sees.
+ */
+void memplace_traffic(int bytes);
+
+/**
+ * @brief bytes counted since boot, the core's ARENA_BULK traffic included
+ */
+uint32_t memplace_moved(void);
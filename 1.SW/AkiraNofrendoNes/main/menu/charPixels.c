@@ -9,13 +9,13 @@
 #include "iconData.c"
 #include "pretty_effect.h"
 #include "esp_spi_flash.h"
+#include "romslot.h"
+#include "romsd.h"
+#include "romupload.h"
+#include "rombench.h"
 
-bool endOfLine;
 bool endOfFile;
-int yLineEnded;
-int linesRomList;
 int charOff;
-bool endCharLine;
 int change;
 int lineCounter;
 
@@ -26,6 +26,134 @@ bool cpGetPixel(char cpChar, int cp1, int cp2)
 	return getPixel(cpChar, cp1, cp2);
 }
 
+#define ROMLIST_MAX 64
+// the hand written list, flashed at 0x68000 (partition type 0x40, subtype 1)
+#define ROMLIST_LABEL "romlist"
+
+// The list is drawn in 16x18 cells from y = 3, 13 entries a page: the
+// icon in x 7-22, shown for the selected entry only, then MENU_COLS
+// characters of title from x 26. It is parsed once into menuLine, and
+// the font into a glyph atlas of 16 bit pixel rows, so a row of the
+// menu is a few table lookups instead of a scan through the text. The
+// icons are drawn once into an atlas too, every animation step of them.
+#define MENU_ROWS 13
+#define MENU_COLS 18
+#define MENU_CELL_H 18
+#define MENU_GLYPHS 80
+#define MENU_COLOR 0x001F
+#define MENU_ICONS 24
+#define MENU_ICON_W 16
+#define MENU_ICON_H 14
+#define MENU_PHASES 3 // getIconPixel() animates by change % 3
+
+typedef struct
+{
+	bool present; // text line has an entry number
+	char icon;
+	uint8_t length; // characters before the '\n', up to MENU_COLS
+	uint8_t glyph[MENU_COLS];
+} menuLine_t;
+
+static menuLine_t menuLine[ROMLIST_MAX + 1]; // [0] is the header line
+static int menuLines;
+static uint16_t glyphAtlas[MENU_GLYPHS][MENU_CELL_H]; // bit x set: pixel x of the cell lit
+static uint8_t glyphOf[256];
+static uint8_t glyphBlank;
+static uint16_t iconAtlas[MENU_ICONS][MENU_ICON_H][MENU_ICON_W];
+static uint8_t iconOf[256][MENU_PHASES];
+
+// What the panel shows of the list, so that a pass only redraws the rows
+// that changed: the page, the selected row and the icon drawn on it
+static int shownPage = -1;
+static int shownRow;
+static int shownIcon;
+static uint16_t rowDirty; // bit r: menu row r, bit MENU_ROWS: the margins above and below
+
+// slot and offset of each menu entry
+int romSlots[ROMLIST_MAX];
+uint32_t romOffsets[ROMLIST_MAX];
+
+void romListEntry(int entry, int *slot, uint32_t *offset)
+{
+	if (entry >= 0 && entry < ROMLIST_MAX)
+	{
+		*slot = romSlots[entry];
+		*offset = romOffsets[entry];
+	}
+	else
+	{
+		*slot = entry;
+		*offset = 0;
+	}
+}
+
+// Build the rom list from the slot headers and the SD card, in the same layout as the text partition.
+// Returns the number of games found, 0 if there are none.
+static int initRomListSlots()
+{
+	romslot_t hdr;
+	uint32_t offset;
+	int count = 0;
+	int len;
+
+	lines = calloc(16 + ROMLIST_MAX * (8 + sizeof(hdr.title)), sizeof(char));
+	if (lines == NULL)
+		return 0;
+	len = sprintf(lines, "No.\tIcon Name\n");
+	for (int slot = 0; slot < ROMSLOT_COUNT; slot++)
+	{
+		offset = 0;
+		do
+		{
+			if (count == ROMLIST_MAX || romslot_read(slot, offset, &hdr) == NULL)
+				break;
+			// '*' ends the list and '\n' a line
+			for (char *c = hdr.title; *c; c++)
+				if (*c == '*' || *c == '\n' || *c == '\r')
+					*c = ' ';
+			len += sprintf(lines + len, "%d.\t%c\t%s\n", count + 1, hdr.icon ? hdr.icon : ';', hdr.title);
+			romSlots[count] = slot;
+			romOffsets[count++] = offset;
+			offset = romslot_next(&hdr, offset);
+		} while (offset);
+	}
+	// then the SD card, titled by file name
+	int sdCount = romsd_init();
+	for (int i = 0; i < sdCount && count < ROMLIST_MAX; i++)
+	{
+		const romsd_entry_t *e = romsd_entry(i);
+
+		len += sprintf(lines + len, "%d.\t;\t%.*s\n", count + 1, (int)strlen(e->name) - 4, e->name);
+		romSlots[count] = ROMSD_SLOT;
+		romOffsets[count++] = i;
+	}
+	int games = count;
+	// upload mode last; a board with only the hand written list keeps that
+	if (romupload_enabled() && count < ROMLIST_MAX && (count || esp_partition_find_first(0x40, 1, ROMLIST_LABEL) == NULL))
+	{
+		len += sprintf(lines + len, "%d.\t;\tWi-Fi upload\n", count + 1);
+		romSlots[count] = ROMUPLOAD_SLOT;
+		romOffsets[count++] = 0;
+	}
+	// and the benchmark, which runs every game above it
+	if (rombench_enabled() && games && count + 2 <= ROMLIST_MAX)
+	{
+		len += sprintf(lines + len, "%d.\t;\tBenchmark\n", count + 1);
+		romSlots[count] = ROMBENCH_SLOT;
+		romOffsets[count++] = ROMBENCH_LCD;
+		len += sprintf(lines + len, "%d.\t;\tBenchmark, no LCD\n", count + 1);
+		romSlots[count] = ROMBENCH_SLOT;
+		romOffsets[count++] = ROMBENCH_HEADLESS;
+	}
+	strcpy(lines + len, "*");
+	if (count == 0)
+	{
+		free(lines);
+		lines = NULL;
+	}
+	return count;
+}
+
 // Load Rom list from flash partition to char array(lines), init some variables for printing rom list
 void initRomList()
 {
@@ -33,8 +161,30 @@ void initRomList()
 	const esp_partition_t *part;
 	spi_flash_mmap_handle_t hrom;
 	esp_err_t err;
-	nvs_flash_init();
-	part = esp_partition_find_first(0x40, 1, NULL);
+
+	endOfFile = 0;
+	charOff = 0;
+	change = 0;
+	lineCounter = 0;
+	// a game or upload mode had the panel, all of it is redrawn
+	shownPage = -1;
+
+	int count = initRomListSlots();
+	if (count)
+	{
+		indexRomList();
+		setLineMax(count - 1);
+		printf("lineMax = %d\n", count - 1);
+		return;
+	}
+
+	// no slot headers, fall back to the hand written list
+	for (int i = 0; i < ROMLIST_MAX; i++)
+	{
+		romSlots[i] = i;
+		romOffsets[i] = 0;
+	}
+	part = esp_partition_find_first(0x40, 1, ROMLIST_LABEL);
 	if (part == 0)
 		strcpy(lines, "No Rom List Found\n*");
 	err = esp_partition_mmap(part, 0, /*3*1024*1024*/ 4 * 1024, SPI_FLASH_MMAP_DATA, (const void **)&romdata, &hrom);
@@ -62,64 +212,165 @@ void initRomList()
 			break;
 		}
 	}
+	// the menu comes back after every game, don't leave the MMU pages mapped
+	spi_flash_munmap(hrom);
+	indexRomList();
 	setLineMax(lineCounter - 2);
 	printf("lineMax = %d\n", lineCounter);
-
-	endOfFile = 0;
-	endOfLine = 0;
-	charOff = 0;
-	change = 0;
 }
 
-// get depending on x/y value the actual char from lines array
-// depending on x/y/actChar return color/black if char value is true/false(charData.c)
-// depending on x/y/actChar read and return icon pixel color(iconData.c)
-int getCharPixel(int x, int y, int change, int choosen)
+// the font as getPixel draws it, every character code once
+static void initGlyphAtlas()
 {
-	int line = ((y - 3) / 18) + 1;
-	int charNo = (x - 26) / 16;
-	int lineLength;
-	char actChar;
-	int page = choosen / 13;
-	lineCounter = 0;
+	static int glyphs;
+	uint16_t rows[MENU_CELL_H];
+	int g;
 
-	if (x == 7)
-		endOfLine = 0;
-	if (!endOfLine)
+	if (glyphs)
+		return;
+	for (int c = 0; c < 256; c++)
 	{
-		for (lineLength = 0; lineLength < 1000; lineLength++)
-		{
-			if (lines[lineLength] == '\n')
-				lineCounter += 1;
-			if (lines[lineLength] == '.' && lineCounter == line + 13 * page)
-			{
+		memset(rows, 0, sizeof(rows));
+		for (int y = 0; y < MENU_CELL_H; y++)
+			for (int x = 0; x < 16; x++)
+				if (getPixel((char)c, x, y))
+					rows[y] |= 1 << x;
+		for (g = 0; g < glyphs; g++)
+			if (memcmp(glyphAtlas[g], rows, sizeof(rows)) == 0)
 				break;
-			}
-			if (lines[lineLength] == '*')
-				return 0x0000;
-		}
-		if (x >= 7 && x <= 22)
+		if (g == glyphs && glyphs < MENU_GLYPHS)
+			memcpy(glyphAtlas[glyphs++], rows, sizeof(rows));
+		glyphOf[c] = g < MENU_GLYPHS ? g : 0;
+	}
+	glyphBlank = glyphOf[' '];
+}
+
+// the icons as getIconPixel draws them, every character code in every step
+static void initIconAtlas()
+{
+	static int icons;
+	uint16_t pix[MENU_ICON_H][MENU_ICON_W];
+	int i;
+
+	if (icons)
+		return;
+	for (int c = 0; c < 256; c++)
+		for (int p = 0; p < MENU_PHASES; p++)
 		{
-			if (line - 1 == choosen % 13)
-				return getIconPixel(lines[lineLength + 2], x - 7, (y - 5) % 18, change);
-			else
-				return 0x0000;
+			for (int y = 0; y < MENU_ICON_H; y++)
+				for (int x = 0; x < MENU_ICON_W; x++)
+					pix[y][x] = getIconPixel((char)c, x, y, p);
+			for (i = 0; i < icons; i++)
+				if (memcmp(iconAtlas[i], pix, sizeof(pix)) == 0)
+					break;
+			if (i == icons && icons < MENU_ICONS)
+				memcpy(iconAtlas[icons++], pix, sizeof(pix));
+			iconOf[c][p] = i < MENU_ICONS ? i : 0;
 		}
-		actChar = lines[lineLength + 2 + 2 + charNo];
-		if (actChar == '\n')
+}
+
+// Text line k shows from the first '.' on it: the icon character two
+// after it, the title from four after it up to the '\n'. A '\r' is blank.
+static void indexRomList()
+{
+	int line = 0;
+	bool found = false;
+
+	initGlyphAtlas();
+	initIconAtlas();
+	memset(menuLine, 0, sizeof(menuLine));
+	menuLines = 0;
+	if (lines == NULL)
+		return;
+	for (char *c = lines; *c && *c != '*'; c++)
+	{
+		if (*c == '\n')
 		{
-			endOfLine = 1;
-			return 0x0000;
+			if (++line > ROMLIST_MAX)
+				break;
+			found = false;
+			continue;
 		}
-		if (actChar == '\r')
-			return 0x0000;
+		if (*c != '.' || found || line == 0)
+			continue;
+		found = true;
+
+		menuLine_t *m = &menuLine[line];
+		char *t = NULL;
+		int n = 0;
+
+		// how much of the "\tI\t" after the '.' is there
+		while (n < 3 && c[n + 1] && c[n + 1] != '\n' && c[n + 1] != '*')
+			n++;
+		m->present = true;
+		m->icon = n >= 2 ? c[2] : 0;
+		if (n == 3)
+			t = c + 4;
+		for (m->length = 0; t && m->length < MENU_COLS && t[m->length] && t[m->length] != '\n' && t[m->length] != '*'; m->length++)
+			m->glyph[m->length] = t[m->length] == '\r' ? glyphBlank : glyphOf[(uint8_t)t[m->length]];
+		if (line + 1 > menuLines)
+			menuLines = line + 1;
+	}
+}
+
+// One row of pixels of the rom list
+void drawRomListLine(uint16_t *dest, int y, int change, int choosen)
+{
+	int yMod = (y - 3) % MENU_CELL_H;
+	int line = (y - 3) / MENU_CELL_H + 1 + MENU_ROWS * (choosen / MENU_ROWS);
+	menuLine_t *m;
+
+	memset(dest, 0, 320 * sizeof(uint16_t));
+	if (y < 3 || y > 236 || yMod < 2 || yMod >= 16 || line >= menuLines || !menuLine[line].present)
+		return;
+	m = &menuLine[line];
+
+	if ((y - 3) / MENU_CELL_H == choosen % MENU_ROWS)
+		memcpy(dest + 7, iconAtlas[iconOf[(uint8_t)m->icon][change % MENU_PHASES]][yMod - 2], MENU_ICON_W * sizeof(uint16_t));
+
+	for (int c = 0; c < m->length; c++)
+	{
+		uint16_t bits = glyphAtlas[m->glyph[c]][yMod];
+		uint16_t *d = dest + 26 + c * 16;
+
+		for (int x = 0; bits && x < 16 && d + x < dest + 313; x++, bits >>= 1)
+			if (bits & 1)
+				d[x] = MENU_COLOR;
 	}
+}
+
+// Once a pass: mark the rows whose picture is not what the panel shows,
+// all of them on a new page, else the row the selection left and the one
+// it went to, and the selected one when its icon steps to another picture.
+// Still icons are one atlas entry in every step and never redraw.
+void romListUpdate(int change, int choosen)
+{
+	int page = choosen / MENU_ROWS;
+	int row = choosen % MENU_ROWS;
+	int line = row + 1 + page * MENU_ROWS;
+	int icon = line < menuLines ? iconOf[(uint8_t)menuLine[line].icon][change % MENU_PHASES] : -1;
+
+	rowDirty = 0;
+	if (page != shownPage)
+		rowDirty = (1 << (MENU_ROWS + 1)) - 1;
 	else
-		return 0x0000;
+	{
+		if (row != shownRow)
+			rowDirty |= 1 << shownRow | 1 << row;
+		if (icon != shownIcon)
+			rowDirty |= 1 << row;
+	}
+	shownPage = page;
+	shownRow = row;
+	shownIcon = icon;
+}
 
-	if (getPixel(actChar, (x - 26) % 16, (y - 3) % 18) == 1)
-		return 0x001F;
-	return 0x0000;
+// whether line y is in a row romListUpdate() marked
+bool romListLineDirty(int y)
+{
+	if (y < 3 || y > 236)
+		return rowDirty >> MENU_ROWS & 1;
+	return rowDirty >> ((y - 3) / MENU_CELL_H) & 1;
 }
 
 void freeRL()
@@ -22,6 +22,7 @@ format if you want to use a different image file.
 #include "decode_image.h"
 #include "rom/tjpgd.h"
 #include "esp_log.h"
+#include "memplace.h"
 #include <string.h>
 
 //Reference the binary-included jpeg file
@@ -29,8 +30,8 @@ extern const uint8_t image_jpg_start[]   asm("_binary_image_jpg_start");
 extern const uint8_t image_jpg_end[]     asm("_binary_image_jpg_end");
 //Define the height and width of the jpeg file. Make sure this matches the actual jpeg
 //dimensions.
-#define IMAGE_W 113//336
-#define IMAGE_H 256
+#define IMAGE_W DECODE_IMAGE_W
+#define IMAGE_H DECODE_IMAGE_H
 
 
 const char *TAG="ImageDec";
@@ -40,7 +41,7 @@ const char *TAG="ImageDec";
 typedef struct {
     const unsigned char *inData;	//Pointer to jpeg data
     int inPos;						//Current position in jpeg data
-    uint16_t **outData;				//Array of IMAGE_H pointers to arrays of IMAGE_W 16-bit pixel values
+    uint16_t *outData;				//IMAGE_H rows of IMAGE_W 16-bit pixel values, one after the other
     int outW;						//Width of the resulting file
     int outH;						//Height of the resulting file
 } JpegDev;
@@ -71,7 +72,7 @@ static UINT outfunc(JDEC *decoder, void *bitmap, JRECT *rect)
             v|=((in[2]>>3)<<0);
             //The LCD wants the 16-bit value in big-endian, so swap bytes
             v=(v>>8)|(v<<8);
-            jd->outData[y][x]=v;
+            jd->outData[y*IMAGE_W+x]=v;
             in+=3;
         }
     }
@@ -81,8 +82,8 @@ static UINT outfunc(JDEC *decoder, void *bitmap, JRECT *rect)
 //Size of the work space for the jpeg decoder.
 #define WORKSZ 3100
 
-//Decode the embedded image into pixel lines that can be used with the rest of the logic.
-esp_err_t decode_image(uint16_t ***pixels) 
+//Decode the embedded image into one block of pixels that can be used with the rest of the logic.
+esp_err_t decode_image(uint16_t **pixels) 
 {
     char *work=NULL;
     int r;
@@ -92,21 +93,15 @@ esp_err_t decode_image(uint16_t ***pixels)
     esp_err_t ret=ESP_OK;
 
 
-    //Alocate pixel memory. Each line is an array of IMAGE_W 16-bit pixels; the `*pixels` array itself contains pointers to these lines.
-    *pixels=calloc(IMAGE_H, sizeof(uint16_t*));
+    //Alocate pixel memory in one piece, IMAGE_H lines of IMAGE_W 16-bit pixels. One block instead of a
+    //malloc per line doesn't leave holes in the heap the emulator allocates its buffers from after it.
+    //Only the menu reads it, so it can live in PSRAM.
+    *pixels=memplace_alloc(MEM_COLD, IMAGE_W*IMAGE_H*sizeof(uint16_t));
     if (*pixels==NULL) {
-        ESP_LOGE(TAG, "Error allocating memory for lines");
+        ESP_LOGE(TAG, "Error allocating memory for the image");
         ret=ESP_ERR_NO_MEM;
         goto err;
     }
-    for (int i=0; i<IMAGE_H; i++) {
-        (*pixels)[i]=malloc(IMAGE_W*sizeof(uint16_t));
-        if ((*pixels)[i]==NULL) {
-            ESP_LOGE(TAG, "Error allocating memory for line %d", i);
-            ret=ESP_ERR_NO_MEM;
-            goto err;
-        }
-    }
 
     //Allocate the work space for the jpeg decoder.
     work=calloc(WORKSZ, 1);
@@ -138,16 +133,12 @@ esp_err_t decode_image(uint16_t ***pixels)
     }
     
     //All done! Free the work area (as we don't need it anymore) and return victoriously.
-    //free(work);
+    free(work);
     return ret;
 err:
     //Something went wrong! Exit cleanly, de-allocating everything we allocated.
-    if (*pixels!=NULL) {
-        for (int i=0; i<IMAGE_H; i++) {
-            free((*pixels)[i]);
-        }
-        free(*pixels);
-    }
+    free(*pixels);
+    *pixels=NULL;
     free(work);
     return ret;
 }
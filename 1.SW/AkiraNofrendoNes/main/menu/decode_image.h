@@ -2,13 +2,17 @@
 #include <stdint.h>
 #include "esp_err.h"
 
+//Size of the embedded image; it has to match the jpeg.
+#define DECODE_IMAGE_W 113
+#define DECODE_IMAGE_H 256
+
 /**
  * @brief Decode the jpeg ``image.jpg`` embedded into the program file into pixel data.
  *
- * @param pixels A pointer to a pointer for an array of rows, which themselves are an array of pixels.
- *        Effectively, you can get the pixel data by doing ``decode_image(&myPixels); pixelval=myPixels[ypos][xpos];``
+ * @param pixels A pointer to a pointer for DECODE_IMAGE_H rows of DECODE_IMAGE_W pixels, RGB565 in the byte
+ *        order of the LCD, one block to free(). ``decode_image(&myPixels); pixelval=myPixels[ypos*DECODE_IMAGE_W+xpos];``
  * @return - ESP_ERR_NOT_SUPPORTED if image is malformed or a progressive jpeg file
  *         - ESP_ERR_NO_MEM if out of memory
  *         - ESP_OK on succesful decode
  */
-esp_err_t decode_image(uint16_t ***pixels);
\ No newline at end of file
+esp_err_t decode_image(uint16_t **pixels);
\ No newline at end of file
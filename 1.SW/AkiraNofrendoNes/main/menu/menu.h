@@ -1,11 +1,41 @@
 #pragma once
 #include <stdint.h>
+#include <stdbool.h>
 #include "esp_err.h"
 
 /**
  * @brief running intro and menu (choose rom/game)
  *
- * @return - integer for choosing game partition
+ * @return - menu entry of the chosen game, see romListEntry()
  */
 int runMenu();
-void setBr(int bright);
\ No newline at end of file
+
+/**
+ * @brief ROM slot and offset in it of the game picked in the menu
+ *
+ * @param entry what runMenu() returned
+ */
+void romListEntry(int entry, int *slot, uint32_t *offset);
+void setBr(int bright);
+
+/**
+ * @brief backlight saver: setBr runs the backlight lower, for a picture that makes up for it
+ *
+ * Only while something draws through palettes that follow getBrGain(), i.e. a game.
+ */
+void setBrSaver(bool on);
+
+/**
+ * @brief the backlight's light now over what the brightness setting normally gives, /256
+ */
+int getBrGain();
+
+/**
+ * @brief LCD and backlight only, for a game started without the menu
+ */
+void initDisplay();
+
+/**
+ * @brief print how long after reset a boot step finished, to track the time to the list
+ */
+void bootStage(const char *name);
\ No newline at end of file
@@ -17,8 +17,22 @@
 #include "charPixels.c"
 #include "esp_deep_sleep.h"
 #include "menu.h"
+#include "esp_timer.h"
+#include "freertos/task.h"
+#include "tasks.h"
+#include "power.h"
 
-uint16_t **pixels;
+#define MENU_REPEAT_US 150000
+//a step of the icon animation, what redrawing the whole frame took at 40MHz SPI
+#define MENU_BLINK_US 33333
+//the intro by the clock: TV static, the logo scrolling in, then it stays until the list
+#define INTRO_TV_US 600000
+#define INTRO_SCROLL_US 2000000
+#define INTRO_US 4000000
+
+uint16_t *pixels; //the intro picture, DECODE_IMAGE_H rows of DECODE_IMAGE_W, NULL until decoded
+static volatile bool decoding;
+static int64_t introStart;
 int yOff;
 int newX;
 int bootTV;
@@ -28,13 +42,11 @@ int page;
 int test;
 int change;
 int choosen;
-int inputDelay;
+int64_t inputDelay; //esp_timer_get_time() the next up/down may move at
+static int64_t blinkAt; //esp_timer_get_time() of the next animation step
 int lineMax;
 int selRom;
 
-bool xStretch;
-bool yStretch;
-
 void setBright(int bright){
 	setBr(bright);
 }
@@ -43,21 +55,6 @@ bool peGetPixel(char peChar, int pe1, int pe2){
 	return cpGetPixel(peChar,pe1,pe2);
 }
 
-bool getYStretch(){
-	return yStretch;
-}
-
-bool getXStretch(){
-	return xStretch;
-}
-
-void setXStretch(bool str){
-	xStretch=str;
-}
-
-void setYStretch(bool str){
-	yStretch=str;
-}
 void setLineMax(int lineM){
 	lineMax = lineM;
 }
@@ -84,28 +81,28 @@ int getNoise(){
 
 //Grab a rgb16 pixel from the esp32_tiles image, scroll part of it in
 static inline uint16_t bootScreen(int x, int y, int yOff, int bootTV){
-	if(gpio_get_level(14)==1)test=0;
 	if(bootTV<slow*251 && bootTV>slow*150) return getNoise();
+	if(pixels==NULL) return getNoise();
 	else if(bootTV>0){
 		if(x>250 && x<284 && y>210 && y<228){
 			int xAct = ((x-250)/2)+96;
 			int yAct = ((y-210)/2)+210;
-			if(pixels[yAct+30][xAct]<0x8000+1000)return 0x8000+31;
+			if(pixels[(yAct+30)*DECODE_IMAGE_W+xAct]<0x8000+1000)return 0x8000+31;
 			else return getNoise();
 		}
 		return getNoise();
 	}
 	if(x>=105 && x <=216){
-	if(y<65 && pixels[y][x-104]!=0x0000 ){
-		return pixels[y][x-104];
+	if(y<65 && pixels[y*DECODE_IMAGE_W+x-104]!=0x0000 ){
+		return pixels[y*DECODE_IMAGE_W+x-104];
 	}
 	else y=y-yOff/8;
 	
-	if(y<65 || pixels[y][x-104]==0x0000){		
+	if(y<65 || pixels[y*DECODE_IMAGE_W+x-104]==0x0000){		
 		return getNoise();
 	}
 
-    return pixels[y][x-104];}
+    return pixels[y*DECODE_IMAGE_W+x-104];}
 	else return getNoise();
 }
 
@@ -113,64 +110,102 @@ static inline uint16_t bootScreen(int x, int y, int yOff, int bootTV){
 static inline uint16_t get_bgnd_pixel(int x, int y, int yOff, int bootTV, int choosen1)
 {
 	page=0;
-	if(test>=0){
-		if(y==0)test--;
+	if(test>=0)
 		return bootScreen(x,y,yOff,bootTV);
-	}
 	
-	if(x<=6 || x>=313 || y<3 || y>236 || (x>=23 && x<=25)) return 0x0000;
-	if((y-3)%18<2 || (y-3)%18>=16) return 0x0000;
-
-	return getCharPixel(x, y, change, choosen1);
+	//the rest of a row the intro ended in, the list starts on the next one
+	return 0x0000;
 }
 
 
-//This variable is used to detect the next frame.
-static int prev_frame=-1;
+static void freeImage(){
+	while(decoding)vTaskDelay(1);
+	free(pixels);
+	pixels=NULL;
+}
 
-//Instead of calculating the offsets for each pixel we grab, we pre-calculate the valueswhenever a frame changes, then re-use
-//these as we go through all the pixels in the frame. This is much, much faster.
-/*static int8_t xofs[320], yofs[240];
-static int8_t xcomp[320], ycomp[240];*/
+//where the intro is after t us, in the counters bootScreen works with; Start skips it
+static void introTimers(int64_t t){
+	if(test<0)return;
+	bootTV = t<INTRO_TV_US ? slow*250-(int)(slow*250*t/INTRO_TV_US) : 0;
+	t-=INTRO_TV_US;
+	yOff = t<=0 ? slow*880 : t<INTRO_SCROLL_US ? slow*880-(int)(slow*880*t/INTRO_SCROLL_US) : 0;
+	if(t+INTRO_TV_US>=INTRO_US || gpio_get_level(14)==1){
+		test=-1;
+		bootStage("list");
+	}
+}
 
-//Calculate the pixel data for a set of lines (with implied line size of 320). Pixels go in dest, line is the Y-coordinate of the
-//first line to be calculated, linect is the amount of lines to calculate. Frame increases by one every time the entire image
-//is displayed; this is used to go to the next frame of animation.
+static void decodeTask(void *arg){
+	uint16_t *img;
 
-void pretty_effect_calc_lines(uint16_t *dest, int line, int frame, int linect)
+	if(decode_image(&img)==ESP_OK){
+		pixels=img;
+		bootStage("image");
+	}
+	decoding=false;
+	vTaskDelete(NULL);
+}
+
+//Once a pass over the frame: the intro clock, the buttons and the icon animation. Key repeat and
+//the animation go by the clock, not by frames, as a pass of the list may send nothing at all.
+void pretty_effect_update()
 {
-	if(bootTV>0)bootTV--;
-    if(yOff>0 && bootTV==0)yOff--;
-	
-	if(inputDelay>0)inputDelay-=1;
-	if(gpio_get_level(34)==1 && inputDelay==0 && choosen>0){
+	int64_t now=esp_timer_get_time();
+	if(introStart==0)introStart=now;
+	introTimers(now-introStart);
+
+	if(gpio_get_level(34)==1 && now>=inputDelay && choosen>0){
 		choosen-=1;
-		inputDelay=200;
+		inputDelay=now+MENU_REPEAT_US;
 	}
-	if(gpio_get_level(33)==1 && inputDelay==0 && choosen<lineMax){
+	if(gpio_get_level(33)==1 && now>=inputDelay && choosen<lineMax){
 		choosen+=1;
-		inputDelay=200;
+		inputDelay=now+MENU_REPEAT_US;
 	}
 	if(gpio_get_level(13)==1) selRom=choosen;
 	if(gpio_get_level(12)==1){
 		//gpio_set_level(5, 0);
-		esp_deep_sleep_pd_config(ESP_PD_DOMAIN_RTC_PERIPH, ESP_PD_OPTION_AUTO);
-		gpio_pullup_dis(12);
-		gpio_pulldown_en(12);
-		esp_deep_sleep_enable_ext0_wakeup(12, 1);
-		
 		vTaskDelay(1000);
-		esp_deep_sleep_start();
+		powerStandby();
 	}
 
-	if (frame!=prev_frame) {
+	if (now>=blinkAt) {
 		//variable for blinking icons - very ugly solution, i know
 		change+=1;
 		if(change == 30)change = 0;
-        prev_frame=frame;
-    }
-	
+		blinkAt=now+MENU_BLINK_US;
+	}
+
+	if(test<0){
+		//done with the picture, give its memory back before a game is started
+		if(pixels)freeImage();
+		romListUpdate(change, choosen);
+	}
+}
+
+//Whether any of the lines has to be sent this pass: all of the intro, only changed rows of the list.
+bool pretty_effect_dirty(int line, int linect)
+{
+	if(test>=0)return true;
+	for (int y=line; y<line+linect; y++)
+		if(romListLineDirty(y))return true;
+	return false;
+}
+
+//Calculate the pixel data for a set of lines (with implied line size of 320). Pixels go in dest, line is the Y-coordinate of the
+//first line to be calculated, linect is the amount of lines to calculate. What they show is what the last
+//pretty_effect_update() left.
+
+void pretty_effect_calc_lines(uint16_t *dest, int line, int linect)
+{
     for (int y=line; y<line+linect; y++) {
+		//the intro a pixel at a time, the list a row at a time
+		if(test<0){
+			drawRomListLine(dest, y, change, choosen);
+			dest+=320;
+			continue;
+		}
 		for (int x=0; x<320; x++){
 			*dest++=get_bgnd_pixel(x, y, yOff, bootTV, choosen);
         }
@@ -183,25 +218,30 @@ void initGPIO(int gpioNo){
 }
 
 void freeMem(){
-	for (int i=0; i<256; i++) {
-            free((pixels)[i]);
-        }
-    free(pixels);
+	freeImage();
 	freeRL();
 }
 
 //initialize varibles for "timers" and input, gpios and load picture
 esp_err_t pretty_effect_init() 
 {
+	static bool booted;
+
 	slow=4;
     yOff=slow*880;
 	bootTV=slow*250;
 	test=slow*6000;
+	//back from a game: straight to the list, the picture is only for the intro
+	if(booted){
+		yOff=0;
+		bootTV=0;
+		test=-1;
+	}
 	choosen=0;
 	inputDelay=0;
+	blinkAt=0;
+	introStart=0;
 	lineMax = 0;
-	yStretch=0;
-	xStretch=0;
 	initRomList();
 	initGPIO(34);
 	initGPIO(35);
@@ -213,5 +253,14 @@ esp_err_t pretty_effect_init()
 	initGPIO(13);
 	initGPIO(33);
 	initGPIO(16);
-	return decode_image(&pixels);
+	bootStage("menu");
+	if(booted)return ESP_OK;
+	booted=true;
+	//in parallel with bringing the panel up, the intro shows static until it's there
+	decoding=true;
+	if(!tasks_start(TASK_DECODE, &decodeTask, NULL, NULL)){
+		decoding=false;
+		return ESP_ERR_NO_MEM;
+	}
+	return ESP_OK;
 }
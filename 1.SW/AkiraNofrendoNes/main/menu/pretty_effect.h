@@ -3,21 +3,35 @@
 #include "esp_err.h"
 
 
+/**
+ * @brief Once a pass over the frame: read the buttons, run the intro clock and the animation.
+ */
+void pretty_effect_update();
+
+
+/**
+ * @brief Whether a bunch of lines differs from what the panel shows since the last pass.
+ *
+ * @param line Starting line of the chunk of lines.
+ * @param linect Amount of lines to check
+ */
+bool pretty_effect_dirty(int line, int linect);
+
+
 /**
  * @brief Calculate the effect for a bunch of lines.
  *
  * @param dest Destination for the pixels. Assumed to be LINECT * 320 16-bit pixel values.
  * @param line Starting line of the chunk of lines.
- * @param frame Current frame, used for animation
  * @param linect Amount of lines to calculate
  */
-void pretty_effect_calc_lines(uint16_t *dest, int line, int frame, int linect);
+void pretty_effect_calc_lines(uint16_t *dest, int line, int linect);
 
 
 /**
- * @brief Initialize the effect
+ * @brief Initialize the effect, the first time also start decoding the intro picture on core 1
  *
- * @return ESP_OK on success, an error from the jpeg decoder otherwise.
+ * @return ESP_OK on success, ESP_ERR_NO_MEM if the decoder task couldn't be started.
  */
 esp_err_t pretty_effect_init();
 
@@ -31,12 +45,4 @@ void setSelRom(int selR);
 
 void freeMem();
 
-bool getYStretch();
-
-bool getXStretch();
-
-void setXStretch(bool str);
-
-void setYStretch(bool str);
-
 void setBright(int bright);
\ No newline at end of file
@@ -0,0 +1,492 @@
+#include <stdio.h>
+#include <string.h>
+#include "sdkconfig.h"
+#include "bthid.h"
+
+#if CONFIG_NES_BT_HID
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_timer.h"
+#include "esp_bt.h"
+#include "esp_bt_main.h"
+#include "esp_gap_ble_api.h"
+#include "esp_gattc_api.h"
+#include "esp_hidh.h"
+#include "esp_hidh_gattc.h"
+#include "psxcontroller.h"
+#include "tasks.h"
+
+// A Bluetooth task on the emulator's core would take its time in the middle of a frame
+#if CONFIG_BT_BLUEDROID_PINNED_TO_CORE == CONFIG_TASK_EMU_CORE || \
+	(defined(CONFIG_BTDM_CTRL_PINNED_TO_CORE) && CONFIG_BTDM_CTRL_PINNED_TO_CORE == CONFIG_TASK_EMU_CORE)
+#warning "Bluetooth shares a core with the emulator, pin Bluedroid and the controller to the other one"
+#endif
+
+#define BT_PADS 2
+#define BT_STATS_US 10000000
+#define BT_APPEARANCE_JOYSTICK 0x03c3
+#define BT_APPEARANCE_GAMEPAD 0x03c4
+#define BT_UUID_HID 0x1812
+
+// Where the descriptor puts what we need in the report, bit offsets, -1 if it doesn't
+typedef struct
+{
+	bool bound;          // a field of interest was seen, the report is id's
+	uint8_t id;          // report ID, 0 without
+	int16_t button[16];  // buttons 1-16
+	int16_t dpad[4];     // up, down, right, left as buttons
+	int16_t hat;         // hat switch: 0 up, clockwise to 7, anything else is centred
+	uint8_t hatSize;
+	int32_t hatMin;
+	int16_t axis[2];     // X, Y
+	uint8_t axisSize[2];
+	int32_t axisMin[2], axisMax[2];
+} hidLayout_t;
+
+typedef struct
+{
+	esp_hidh_dev_t *dev;
+	hidLayout_t layout;
+	int buttons; // psxReadInput bits last passed on
+	uint32_t reports, lastUs, gapSum, gapMax;
+	char name[24];
+} btPad_t;
+
+typedef struct
+{
+	esp_bd_addr_t bda;
+	esp_ble_addr_type_t type;
+} btFound_t;
+
+static btPad_t pads[BT_PADS];
+static QueueHandle_t foundQueue;
+static volatile bool scanning;
+
+static void hid_field(hidLayout_t *l, int id, uint32_t usage, int pos, int size, int32_t min, int32_t max)
+{
+	int page = usage >> 16, u = usage & 0xffff;
+	bool want = (page == 9 && u >= 1 && u <= 16) || (page == 1 && (u == 0x30 || u == 0x31 || u == 0x39 || (u >= 0x90 && u <= 0x93)));
+
+	if (!want)
+		return;
+	if (!l->bound)
+	{
+		l->bound = true;
+		l->id = id;
+	}
+	if (id != l->id)
+		return;
+	if (page == 9)
+		l->button[u - 1] = pos;
+	else if (u == 0x39)
+	{
+		l->hat = pos;
+		l->hatSize = size;
+		l->hatMin = min;
+	}
+	else if (u >= 0x90)
+		l->dpad[u - 0x90] = pos;
+	else
+	{
+		l->axis[u - 0x30] = pos;
+		l->axisSize[u - 0x30] = size;
+		l->axisMin[u - 0x30] = min;
+		l->axisMax[u - 0x30] = max;
+	}
+}
+
+// Short items only, the long ones are skipped. Input fields are laid out per report ID, the first
+// ID with buttons, a hat or a stick is the one read.
+static void hid_parse(const uint8_t *d, int len, hidLayout_t *l)
+{
+	static uint16_t offset[256];
+	uint32_t page = 0, size = 0, count = 0, id = 0;
+	int32_t min = 0, max = 0;
+	uint32_t usage[16], umin = 0, umax = 0;
+	int nusage = 0;
+	bool range = false;
+
+	memset(l, 0xff, sizeof(*l));
+	l->bound = false;
+	memset(offset, 0, sizeof(offset));
+	for (int i = 0; i < len;)
+	{
+		uint8_t pre = d[i++];
+		int n = (pre & 3) == 3 ? 4 : pre & 3;
+		uint32_t v = 0;
+
+		if (pre == 0xfe)
+		{
+			i += (i < len ? d[i] : 0) + 2;
+			continue;
+		}
+		for (int k = 0; k < n && i + k < len; k++)
+			v |= d[i + k] << (8 * k);
+		i += n;
+		int32_t sv = n == 1 ? (int8_t)v : n == 2 ? (int16_t)v : (int32_t)v;
+
+		switch (pre & 0xfc)
+		{
+		case 0x04: // usage page
+			page = v;
+			break;
+		case 0x14: // logical minimum
+			min = sv;
+			break;
+		case 0x24: // logical maximum, unsigned when the minimum isn't negative
+			max = min < 0 ? sv : (int32_t)v;
+			break;
+		case 0x74: // report size
+			size = v;
+			break;
+		case 0x84: // report ID
+			id = v & 0xff;
+			break;
+		case 0x94: // report count
+			count = v;
+			break;
+		case 0x08: // usage
+			if (nusage < 16)
+				usage[nusage++] = n == 4 ? v : page << 16 | v;
+			break;
+		case 0x18: // usage minimum
+			umin = n == 4 ? v : page << 16 | v;
+			range = true;
+			break;
+		case 0x28: // usage maximum
+			umax = n == 4 ? v : page << 16 | v;
+			break;
+		case 0x80: // input
+			// variables only, arrays (keyboards) and constants (padding) just take room
+			if ((v & 3) == 2)
+			{
+				for (int j = 0; j < count; j++)
+				{
+					uint32_t u = range ? umin + j : nusage ? usage[j < nusage ? j : nusage - 1] : 0;
+					if (range && u > umax)
+						break;
+					hid_field(l, id, u, offset[id] + j * size, size, min, max);
+				}
+			}
+			offset[id] += size * count;
+			// the locals are for one main item
+			/* fall through */
+		case 0x90: // output
+		case 0xb0: // feature
+		case 0xa0: // collection
+		case 0xc0: // end collection
+			nusage = 0;
+			range = false;
+			break;
+		}
+	}
+}
+
+static uint32_t hid_bits(const uint8_t *data, int len, int pos, int size)
+{
+	uint32_t v = 0;
+
+	for (int b = 0; b < size && (pos + b) / 8 < len; b++)
+		v |= ((data[(pos + b) / 8] >> ((pos + b) % 8)) & 1u) << b;
+	return v;
+}
+
+static bool hid_button(const hidLayout_t *l, const uint8_t *data, int len, int n)
+{
+	return n >= 1 && n <= 16 && l->button[n - 1] >= 0 && hid_bits(data, len, l->button[n - 1], 1);
+}
+
+// -1, 0, 1 for the first, middle and last quarter of the axis
+static int hid_axis(const hidLayout_t *l, const uint8_t *data, int len, int a)
+{
+	int32_t v, quarter;
+
+	if (l->axis[a] < 0 || l->axisSize[a] == 0 || l->axisSize[a] > 32)
+		return 0;
+	v = hid_bits(data, len, l->axis[a], l->axisSize[a]);
+	if (l->axisMin[a] < 0 && l->axisSize[a] < 32 && (v & (1 << (l->axisSize[a] - 1))))
+		v -= 1 << l->axisSize[a];
+	quarter = (l->axisMax[a] - l->axisMin[a]) / 4;
+	return v < l->axisMin[a] + quarter ? -1 : v > l->axisMax[a] - quarter ? 1 : 0;
+}
+
+// a report in psxReadInput bits, active low
+static int hid_pad(const hidLayout_t *l, const uint8_t *data, int len)
+{
+	static const int dirBits[4] = {16, 64, 32, 128}; // up, down, right, left
+	int b = 0xffff;
+	bool dir[4] = {false};
+
+	if (hid_button(l, data, len, CONFIG_NES_BT_HID_BUTTON_A))
+		b &= ~8192;
+	if (hid_button(l, data, len, CONFIG_NES_BT_HID_BUTTON_B))
+		b &= ~16384;
+	if (hid_button(l, data, len, CONFIG_NES_BT_HID_BUTTON_SELECT))
+		b &= ~1;
+	if (hid_button(l, data, len, CONFIG_NES_BT_HID_BUTTON_START))
+		b &= ~8;
+	if (l->hat >= 0)
+	{
+		int h = (int)hid_bits(data, len, l->hat, l->hatSize) - l->hatMin;
+		if (h >= 0 && h <= 7)
+		{
+			dir[0] = h == 7 || h <= 1;
+			dir[1] = h >= 3 && h <= 5;
+			dir[2] = h >= 1 && h <= 3;
+			dir[3] = h >= 5;
+		}
+	}
+	dir[0] |= hid_axis(l, data, len, 1) < 0;
+	dir[1] |= hid_axis(l, data, len, 1) > 0;
+	dir[2] |= hid_axis(l, data, len, 0) > 0;
+	dir[3] |= hid_axis(l, data, len, 0) < 0;
+	for (int i = 0; i < 4; i++)
+	{
+		if (l->dpad[i] >= 0 && hid_bits(data, len, l->dpad[i], 1))
+			dir[i] = true;
+		if (dir[i])
+			b &= ~dirBits[i];
+	}
+	return b;
+}
+
+static int bt_player(esp_hidh_dev_t *dev)
+{
+	for (int i = 0; i < BT_PADS; i++)
+		if (pads[i].dev == dev)
+			return i;
+	return -1;
+}
+
+// while a player has no pad
+static void bt_scan()
+{
+	if (bt_player(NULL) >= 0)
+	{
+		scanning = true;
+		esp_ble_gap_start_scanning(CONFIG_NES_BT_HID_SCAN_SECONDS);
+	}
+}
+
+static void bt_open(esp_hidh_dev_t *dev)
+{
+	const uint8_t *bda = esp_hidh_dev_bda_get(dev);
+	esp_hid_raw_report_map_t *maps;
+	size_t nmaps = 0;
+	btPad_t *p;
+	int player = bt_player(NULL);
+
+	if (player < 0)
+	{
+		esp_hidh_dev_close(dev);
+		return;
+	}
+	p = &pads[player];
+	memset(p, 0, sizeof(*p));
+	snprintf(p->name, sizeof(p->name), "%s", esp_hidh_dev_name_get(dev) ? esp_hidh_dev_name_get(dev) : "?");
+	esp_hidh_dev_report_maps_get(dev, &nmaps, &maps);
+	for (int i = 0; i < nmaps && !p->layout.bound; i++)
+		hid_parse(maps[i].data, maps[i].len, &p->layout);
+	if (!p->layout.bound)
+	{
+		printf("bt: %s has no buttons in its reports\n", p->name);
+		esp_hidh_dev_close(dev);
+		return;
+	}
+	p->buttons = PAD_MASK;
+	p->dev = dev;
+
+	// 7.5 ms, the shortest connection interval there is: a report waits that long at the most
+	esp_ble_conn_update_params_t conn = {.min_int = 6, .max_int = 6, .latency = 0, .timeout = 400};
+	memcpy(conn.bda, bda, sizeof(esp_bd_addr_t));
+	esp_ble_gap_update_conn_params(&conn);
+	printf("bt: %s is player %d\n", p->name, player + 1);
+}
+
+static void bt_hidh_event(void *arg, esp_event_base_t base, int32_t id, void *data)
+{
+	esp_hidh_event_data_t *e = data;
+	int64_t now = esp_timer_get_time();
+	int player;
+
+	switch ((esp_hidh_event_t)id)
+	{
+	case ESP_HIDH_OPEN_EVENT:
+		if (e->open.status == ESP_OK)
+			bt_open(e->open.dev);
+		bt_scan();
+		break;
+	case ESP_HIDH_INPUT_EVENT:
+		player = bt_player(e->input.dev);
+		if (player < 0 || e->input.report_id != pads[player].layout.id)
+			break;
+		btPad_t *p = &pads[player];
+		int b = hid_pad(&p->layout, e->input.data, e->input.length);
+		// straight into the pad queue, stamped now; unchanged reports cost only the parse
+		if ((b & PAD_MASK) != p->buttons)
+		{
+			p->buttons = b & PAD_MASK;
+			psxPadReport(player, p->buttons, now);
+		}
+		if (p->reports++)
+		{
+			uint32_t gap = (uint32_t)now - p->lastUs;
+			p->gapSum += gap;
+			if (gap > p->gapMax)
+				p->gapMax = gap;
+		}
+		p->lastUs = (uint32_t)now;
+		break;
+	case ESP_HIDH_CLOSE_EVENT:
+		player = bt_player(e->close.dev);
+		if (player < 0)
+			break;
+		printf("bt: %s gone\n", pads[player].name);
+		pads[player].dev = NULL;
+		psxPadReport(player, PAD_MASK, now); // let go of everything
+		esp_hidh_dev_free(e->close.dev);
+		if (!scanning)
+			bt_scan();
+		break;
+	default:
+		break;
+	}
+}
+
+static bool bt_is_pad(uint8_t *adv)
+{
+	uint8_t n = 0;
+	uint8_t *d = esp_ble_resolve_adv_data(adv, ESP_BLE_AD_TYPE_APPEARANCE, &n);
+
+	if (d && n == 2)
+	{
+		int appearance = d[0] | d[1] << 8;
+		return appearance == BT_APPEARANCE_GAMEPAD || appearance == BT_APPEARANCE_JOYSTICK;
+	}
+	// no appearance: a HID service will do
+	d = esp_ble_resolve_adv_data(adv, ESP_BLE_AD_TYPE_16SRV_CMPL, &n);
+	if (d == NULL)
+		d = esp_ble_resolve_adv_data(adv, ESP_BLE_AD_TYPE_16SRV_PART, &n);
+	for (int i = 0; d && i + 1 < n; i += 2)
+		if ((d[i] | d[i + 1] << 8) == BT_UUID_HID)
+			return true;
+	return false;
+}
+
+static void bt_gap_event(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param)
+{
+	btFound_t found;
+
+	switch (event)
+	{
+	case ESP_GAP_BLE_SCAN_PARAM_SET_COMPLETE_EVT:
+		bt_scan();
+		break;
+	case ESP_GAP_BLE_SCAN_RESULT_EVT:
+		if (param->scan_rst.search_evt == ESP_GAP_SEARCH_INQ_CMPL_EVT)
+			scanning = false;
+		else if (param->scan_rst.search_evt == ESP_GAP_SEARCH_INQ_RES_EVT && scanning &&
+				 bt_is_pad(param->scan_rst.ble_adv))
+		{
+			// connecting is done by btTask, it blocks
+			scanning = false;
+			esp_ble_gap_stop_scanning();
+			memcpy(found.bda, param->scan_rst.bda, sizeof(esp_bd_addr_t));
+			found.type = param->scan_rst.ble_addr_type;
+			xQueueSend(foundQueue, &found, 0);
+		}
+		break;
+	case ESP_GAP_BLE_SEC_REQ_EVT:
+		esp_ble_gap_security_rsp(param->ble_security.ble_req.bd_addr, true);
+		break;
+	default:
+		break;
+	}
+}
+
+static void bt_stats()
+{
+	uint32_t latchMax;
+	int latch;
+
+	for (int i = 0; i < BT_PADS; i++)
+	{
+		btPad_t *p = &pads[i];
+		if (p->dev == NULL || p->reports < 2)
+			continue;
+		latch = psxLatency(PAD_SOURCE_BT + i, &latchMax);
+		printf("bt: %s, %u reports, every %u ms (max %u), to the game %d ms (max %u)\n", p->name,
+			   (unsigned)p->reports, (unsigned)(p->gapSum / (p->reports - 1) / 1000), (unsigned)(p->gapMax / 1000),
+			   latch < 0 ? -1 : latch / 1000, (unsigned)(latchMax / 1000));
+		p->reports = p->gapSum = p->gapMax = 0;
+	}
+}
+
+static void btTask(void *arg)
+{
+	esp_hidh_config_t hidh = {.callback = bt_hidh_event, .event_stack_size = 4096, .callback_arg = NULL};
+	esp_ble_scan_params_t scan = {
+		.scan_type = BLE_SCAN_TYPE_ACTIVE,
+		.own_addr_type = BLE_ADDR_TYPE_PUBLIC,
+		.scan_filter_policy = BLE_SCAN_FILTER_ALLOW_ALL,
+		.scan_interval = 0x50,
+		.scan_window = 0x30,
+		.scan_duplicate = BLE_SCAN_DUPLICATE_DISABLE,
+	};
+	esp_ble_auth_req_t auth = ESP_LE_AUTH_BOND;
+	esp_ble_io_cap_t iocap = ESP_IO_CAP_NONE;
+	btFound_t found;
+	int64_t statsAt = esp_timer_get_time() + BT_STATS_US;
+
+	// everything BLE from here is created on this core
+	esp_bt_controller_config_t cfg = BT_CONTROLLER_INIT_CONFIG_DEFAULT();
+	esp_bt_controller_mem_release(ESP_BT_MODE_CLASSIC_BT);
+	if (esp_bt_controller_init(&cfg) != ESP_OK || esp_bt_controller_enable(ESP_BT_MODE_BLE) != ESP_OK ||
+		esp_bluedroid_init() != ESP_OK || esp_bluedroid_enable() != ESP_OK)
+	{
+		printf("bt: no Bluetooth\n");
+		vTaskDelete(NULL);
+		return;
+	}
+	esp_ble_gap_set_security_param(ESP_BLE_SM_AUTHEN_REQ_MODE, &auth, sizeof(auth));
+	esp_ble_gap_set_security_param(ESP_BLE_SM_IOCAP_MODE, &iocap, sizeof(iocap));
+	esp_ble_gap_register_callback(bt_gap_event);
+	esp_ble_gattc_register_callback(esp_hidh_gattc_event_handler);
+	esp_hidh_init(&hidh);
+	esp_ble_gap_set_scan_params(&scan);
+
+	while (1)
+	{
+		if (xQueueReceive(foundQueue, &found, 1000 / portTICK_PERIOD_MS) == pdTRUE)
+		{
+			// OPEN_EVENT does the rest, and scans on; a failed open only gets here
+			if (esp_hidh_dev_open(found.bda, ESP_HID_TRANSPORT_BLE, found.type) == NULL)
+				bt_scan();
+		}
+		if (esp_timer_get_time() >= statsAt)
+		{
+			bt_stats();
+			statsAt = esp_timer_get_time() + BT_STATS_US;
+		}
+	}
+}
+
+void bthidInit()
+{
+	static bool started;
+
+	if (started)
+		return;
+	started = true;
+	foundQueue = xQueueCreate(2, sizeof(btFound_t));
+	tasks_start(TASK_BT, &btTask, NULL, NULL);
+}
+
+#else /* !CONFIG_NES_BT_HID */
+
+void bthidInit()
+{
+}
+
+#endif /* !CONFIG_NES_BT_HID */
@@ -0,0 +1,13 @@
+#ifndef BTHID_H
+#define BTHID_H
+
+// Bluetooth LE gamepads as pads 1 and 2 (CONFIG_NES_BT_HID). Scans for HID devices that call
+// themselves a gamepad or joystick and connects to the first two it finds, in that order as
+// player 1 and 2. The report descriptor says where the buttons, the hat and the stick are. A
+// report changes the pad straight away through psxPadReport, into the queue the buttons' ISR
+// fills, so the game sees it at its next strobe. The Bluetooth tasks must not run on the
+// emulator's core, 0; see CONFIG_NES_BT_HID.
+
+// call once before the first game: Bluetooth up and scanning on the other core
+void bthidInit();
+#endif
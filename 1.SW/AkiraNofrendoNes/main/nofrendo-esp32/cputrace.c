@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include "sdkconfig.h"
+#include "cputrace.h"
+
+#if CONFIG_NES_CPU_TRACE
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "nofrendo/nes/nes.h"
+#include "nofrendo/cpu/nes6502.h"
+#include "memplace.h"
+#include "tasks.h"
+
+#define TRACE_ENTRIES CONFIG_NES_CPU_TRACE_ENTRIES // power of two
+#define TRACE_COMBO ((1 << 0) | (1 << 3))          // SELECT and START, psxReadInput's bits
+
+_Static_assert((TRACE_ENTRIES & (TRACE_ENTRIES - 1)) == 0, "CONFIG_NES_CPU_TRACE_ENTRIES must be a power of two");
+
+#define TRACE_RECORDING 0
+#define TRACE_DUMPING 1 // traceTask has the ring
+#define TRACE_DUMPED 2  // out, the emulator starts recording again
+
+static nes6502_trace *ring;
+static TaskHandle_t dumper;
+static volatile int state;
+static uint32_t dumpFirst;
+static int dumpCount;
+static uint32_t dumpCrc;
+static int oldButtons = 0xffff;
+
+// Straight to the UART, not through the log ring: a trace is thousands of lines, and the
+// ring would drop all but the first few. About 35 bytes a line, 2048 lines take 6 s at 115200.
+static void traceTask(void *arg)
+{
+	while (1)
+	{
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+		printf("cputrace %d %08X\n", dumpCount, (unsigned)dumpCrc);
+		for (int i = 0; i < dumpCount; i++)
+		{
+			nes6502_trace *ent = &ring[(dumpFirst + i) & (TRACE_ENTRIES - 1)];
+
+			printf("%08X %04X %02X%02X%02X %02X %02X %02X %02X %02X\n", (unsigned)ent->cycles, ent->pc,
+				   ent->code[0], ent->code[1], ent->code[2], ent->a, ent->x, ent->y, ent->s, ent->p);
+		}
+		printf("cputrace end\n");
+		state = TRACE_DUMPED;
+	}
+}
+
+static void arm()
+{
+	nes6502_settrace(ring, TRACE_ENTRIES, CONFIG_NES_CPU_TRACE_AFTER);
+	nes6502_tracewatch(CONFIG_NES_CPU_TRACE_WATCH_PC, CONFIG_NES_CPU_TRACE_WATCH_WRITE);
+	state = TRACE_RECORDING;
+}
+
+void cputraceStart()
+{
+	if (ring == NULL)
+	{
+		// written every instruction, so internal RAM
+		ring = memplace_alloc(MEM_HOT, TRACE_ENTRIES * sizeof(nes6502_trace));
+		if (ring == NULL)
+		{
+			printf("cputrace: no room for %d entries\n", TRACE_ENTRIES);
+			return;
+		}
+		tasks_start(TASK_TRACE, &traceTask, NULL, &dumper);
+	}
+	// a trace still going out is let finish, cputraceFrame starts the next one
+	if (state != TRACE_DUMPING)
+		arm();
+}
+
+void cputraceFrame(int buttons)
+{
+	// both held now and not both a frame ago
+	bool combo = (~buttons & TRACE_COMBO) == TRACE_COMBO && (~oldButtons & TRACE_COMBO) != TRACE_COMBO;
+	uint32_t first;
+	int count;
+
+	oldButtons = buttons;
+	if (ring == NULL)
+		return;
+	if (state == TRACE_DUMPED)
+		arm();
+	if (state != TRACE_RECORDING)
+		return;
+
+	if (combo)
+		nes6502_tracetrigger();
+	count = nes6502_gettrace(&first);
+	if (count == 0)
+		return;
+	dumpFirst = first;
+	dumpCount = count;
+	dumpCrc = nes_getcontextptr()->rominfo->crc;
+	state = TRACE_DUMPING;
+	xTaskNotifyGive(dumper);
+}
+
+#else /* !CONFIG_NES_CPU_TRACE */
+
+void cputraceStart()
+{
+}
+
+void cputraceFrame(int buttons)
+{
+}
+
+#endif /* !CONFIG_NES_CPU_TRACE */
@@ -0,0 +1,14 @@
+#ifndef CPUTRACE_H
+#define CPUTRACE_H
+
+// The 6502 core's instruction trace on the device (CONFIG_NES_CPU_TRACE). The core records
+// every instruction into a ring in internal RAM; SELECT and START pressed together, or the
+// watchpoints in Kconfig, stop it a little later with what led up to it, and a low priority
+// task on core 1 prints the ring over UART. host/tracedis turns the capture into a listing.
+// Recording starts again once it's out.
+
+// a game is starting
+void cputraceStart();
+// once a frame, with psxReadInput's buttons
+void cputraceFrame(int buttons);
+#endif
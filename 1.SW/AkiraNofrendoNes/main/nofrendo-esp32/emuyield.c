@@ -0,0 +1,173 @@
+#include <stdio.h>
+#include "sdkconfig.h"
+#include "emuyield.h"
+
+#if CONFIG_NES_YIELD
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
+#include "../nofrendo/nes/nes_prof.h"
+#include "tasks.h"
+
+typedef struct
+{
+	int sliceUs;
+	int64_t deadlineUs;
+	volatile int64_t since; // the wait started, emuYieldWant or the end of its last slice
+} yieldClient_t;
+
+static yieldClient_t clients[EMU_YIELD_CLIENTS];
+static int clientCount;
+static uint32_t pending;  // a bit per client with work waiting
+static int granted = -1;  // the client whose slice runs
+static SemaphoreHandle_t sliceSem;
+static esp_timer_handle_t sliceTimer;
+static int given; // us yielded since the last emulated frame
+
+// the figures since the last report, the emulator's but for maxWait which clients add to
+static volatile int maxWait;
+static int maxSlice, forced;
+
+static void slice_end(void *arg)
+{
+	xSemaphoreGive(sliceSem);
+}
+
+int emuYieldRegister(int task, int deadlineMs, int sliceUs)
+{
+	int emu = tasks_core(TASK_EMU), core = tasks_core(task);
+	yieldClient_t *c;
+
+	// pinned to different cores they never get in each other's way
+	if (emu >= 0 && core >= 0 && emu != core)
+		return -1;
+	if (clientCount == EMU_YIELD_CLIENTS)
+		return -1;
+	if (sliceSem == NULL)
+	{
+		const esp_timer_create_args_t args = {.callback = slice_end, .name = "yield"};
+
+		sliceSem = xSemaphoreCreateBinary();
+		if (sliceSem == NULL || esp_timer_create(&args, &sliceTimer) != ESP_OK)
+			return -1;
+	}
+	c = &clients[clientCount];
+	c->sliceUs = sliceUs;
+	c->deadlineUs = deadlineMs * 1000LL;
+	printf("Yield: %s gets %d us of the emulator's core within %d ms\n", tasks_name(task), sliceUs, deadlineMs);
+	return clientCount++;
+}
+
+void emuYieldWant(int client)
+{
+	uint32_t bit;
+
+	if (client < 0)
+		return;
+	bit = 1u << client;
+	if (__atomic_load_n(&pending, __ATOMIC_ACQUIRE) & bit)
+		return;
+	clients[client].since = esp_timer_get_time();
+	__atomic_or_fetch(&pending, bit, __ATOMIC_RELEASE);
+}
+
+void emuYieldDone(int client)
+{
+	int wait;
+
+	if (client < 0 || !(__atomic_fetch_and(&pending, ~(1u << client), __ATOMIC_SEQ_CST) & (1u << client)))
+		return;
+	// the emulator stores granted and then loads pending, this the other way round; sequentially
+	// consistent on both sides, so one of the two sees the other's store
+	if (__atomic_load_n(&granted, __ATOMIC_SEQ_CST) == client)
+		xSemaphoreGive(sliceSem);
+	// what it waited, when it got done in the emulator's own idle time
+	wait = (int)(esp_timer_get_time() - clients[client].since);
+	if (wait > maxWait)
+		maxWait = wait;
+}
+
+void emuYieldPoint(bool frameEnd, int slackUs)
+{
+	uint32_t want = __atomic_load_n(&pending, __ATOMIC_ACQUIRE);
+	int64_t now, start;
+	int i, pick = -1, wait = 0, us;
+	bool late;
+
+	if (frameEnd)
+		given = 0;
+	if (want == 0)
+		return;
+
+	// the one that has waited longest goes first
+	now = esp_timer_get_time();
+	for (i = 0; i < clientCount; i++)
+		if ((want & (1u << i)) && (pick < 0 || now - clients[i].since > wait))
+		{
+			pick = i;
+			wait = (int)(now - clients[i].since);
+		}
+	if (pick < 0)
+		return;
+	late = wait >= clients[pick].deadlineUs;
+	if (!late && (clients[pick].sliceUs > slackUs || given + clients[pick].sliceUs > CONFIG_NES_YIELD_BUDGET_US))
+		return;
+
+	PROF_BEGIN(t0);
+	start = esp_timer_get_time();
+	xSemaphoreTake(sliceSem, 0); // a timer or a done left over from the last slice
+	__atomic_store_n(&granted, pick, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&pending, __ATOMIC_SEQ_CST) & (1u << pick))
+	{
+		esp_timer_start_once(sliceTimer, clients[pick].sliceUs);
+		xSemaphoreTake(sliceSem, portMAX_DELAY);
+		esp_timer_stop(sliceTimer);
+	}
+	__atomic_store_n(&granted, -1, __ATOMIC_RELEASE);
+	PROF_END(PROF_YIELD, t0);
+
+	now = esp_timer_get_time();
+	us = (int)(now - start);
+	// not through yet: its next deadline counts from here
+	clients[pick].since = now;
+	given += us;
+	if (us > maxSlice)
+		maxSlice = us;
+	if (wait > maxWait)
+		maxWait = wait;
+	if (late)
+		forced++;
+}
+
+void emuYieldReport(char *buf, int len)
+{
+	if (clientCount == 0)
+		return;
+	snprintf(buf, len, "yld %dms %dus %df", maxWait / 1000, maxSlice, forced);
+	maxWait = maxSlice = forced = 0;
+}
+
+#else /* !CONFIG_NES_YIELD */
+
+int emuYieldRegister(int task, int deadlineMs, int sliceUs)
+{
+	return -1;
+}
+
+void emuYieldWant(int client)
+{
+}
+
+void emuYieldDone(int client)
+{
+}
+
+void emuYieldPoint(bool frameEnd, int slackUs)
+{
+}
+
+void emuYieldReport(char *buf, int len)
+{
+}
+
+#endif /* !CONFIG_NES_YIELD */
@@ -0,0 +1,30 @@
+#ifndef EMUYIELD_H
+#define EMUYIELD_H
+#include <stdbool.h>
+
+// Bounded-jitter yielding of the emulator's core (CONFIG_NES_YIELD). The emulator only blocks
+// in osd_waitframe, which it never reaches while it is behind, unpaced or fast-forwarding, so
+// a lower priority task put on its core (see "Task topology") would not run at all. Such a
+// task registers with the longest it may wait and the slice it needs. Whoever hands it work
+// says so with emuYieldWant, the task says emuYieldDone when it is through. At its yield
+// points, after each emulated frame and after each frame handed to the LCD, the emulator
+// blocks for the slice of the task that has waited longest: when the time to the next frame
+// tick and what is left of CONFIG_NES_YIELD_BUDGET_US this frame cover it, or regardless
+// once the task is past its deadline. An esp_timer ends the slice to the microsecond if the
+// task isn't done by then. Tasks on the other core never need this and register as -1.
+
+#define EMU_YIELD_CLIENTS 8
+
+// task id of tasks.h waits at most deadlineMs for sliceUs of the emulator's core at a time;
+// -1 when it runs on the other core, or there's no room. Call before emuYieldWant.
+int emuYieldRegister(int task, int deadlineMs, int sliceUs);
+// client has work waiting, from any task; a no-op for -1 and once already waiting
+void emuYieldWant(int client);
+// client is through with its work, from the client's task; ends its slice
+void emuYieldDone(int client);
+// the emulator at a yield point, slackUs till the next frame tick is due, 0 when it's late;
+// frameEnd after an emulated frame, which starts the next frame's budget
+void emuYieldPoint(bool frameEnd, int slackUs);
+// profiler overlay text for the last window: longest wait, longest slice, forced slices
+void emuYieldReport(char *buf, int len);
+#endif
@@ -0,0 +1,52 @@
+#ifndef LCD_BUS_H
+#define LCD_BUS_H
+#include <stdint.h>
+#include <stdbool.h>
+#include "sdkconfig.h"
+
+// The wire between spi_lcd.c and the panel, picked by CONFIG_HW_LCD_BUS:
+// lcd_bus_spi.c drives VSPI (SPI3) through its registers, lcd_bus_i80.c the
+// ESP32-S3's LCD_CAM as an 8-bit i8080 bus. spi_lcd.c only deals in commands,
+// address windows and line buffers, the panel setup and the frame pipeline
+// are the same on both. Pixels are RGB565 high byte first in memory, which
+// both buses put on the wire in order.
+
+// Pins and the peripheral, at a safe clock; call once before anything else
+void lcd_bus_init();
+// After the panel is set up: go to the fastest clock it takes
+void lcd_bus_pick_clock();
+// The clock the bus ended up at, in kHz
+int lcd_bus_clock_khz();
+// A command byte, or one byte of its parameters. Waits for whatever was sent before.
+// The command may only go out with the next bus call, lcd_bus_wait before a delay
+// that has to start from it.
+void lcd_bus_cmd(uint8_t cmd);
+void lcd_bus_data(uint8_t data);
+// Column and page address window x0-x1, y0-y1 (inclusive) and the memory write that
+// the lines sent next go into
+void lcd_bus_window(uint16_t x0, uint16_t x1, uint16_t y0, uint16_t y1);
+// Start sending bytes of buf (DMA capable, word aligned, a multiple of 4 bytes long).
+// Waits for the send before; with DMA it returns while this one goes out, and buf must
+// not change until the next lcd_bus_send or lcd_bus_wait.
+void lcd_bus_send(const uint32_t *buf, int bytes);
+// Until everything sent is out
+void lcd_bus_wait();
+
+#if CONFIG_HW_LCD_CHAIN
+// Chained sends, SPI with DMA only: a run of lines as one DMA transfer. After lcd_bus_window,
+// lcd_bus_chain_begin with the bytes of the whole run, then for each line lcd_bus_chain_line
+// for the buffer to build it in and lcd_bus_chain_push with its length (at most
+// LCD_BUS_CHAIN_BYTES, a multiple of 4). The buffers are a ring of CONFIG_HW_LCD_CHAIN_LINES
+// the DMA engine goes round, started once it is full or the run is all in; lcd_bus_chain_line
+// waits for the engine to be done with the one it returns. lcd_bus_chain_end sleeps until the
+// transfer's one interrupt.
+#define LCD_BUS_CHAIN_BYTES 640 // a panel line of RGB565
+// false when there's no ring, nothing was started then
+bool lcd_bus_chain_begin(int bytes);
+uint32_t *lcd_bus_chain_line();
+void lcd_bus_chain_push(int bytes);
+// false if the engine got to a line before it was pushed, and sent the ring's last lap of it
+bool lcd_bus_chain_end();
+#endif
+
+#endif
@@ -0,0 +1,132 @@
+#include "sdkconfig.h"
+#include "lcd_bus.h"
+
+#if CONFIG_HW_LCD_BUS_I80
+#include <stdio.h>
+#include <assert.h>
+#include "esp_idf_version.h"
+#include "esp_lcd_panel_io.h"
+#include "spi_lcd.h"
+
+//The ESP32-S3's LCD_CAM as an 8-bit i8080 bus, through esp_lcd. DC and the
+//data lines are the peripheral's, every line buffer goes out by its own DMA.
+
+//A memory write is as long as a line buffer of the widest lines
+#define I80_MAX_BYTES (LCD_BUF_LINES*320*2)
+#define I80_MAX_PARAMS 16
+
+static esp_lcd_panel_io_handle_t io;
+//Line buffers handed over and not sent yet; the done callback counts them down
+static volatile int i80_queued;
+//The command lcd_bus_data collects parameters for, -1 if none. esp_lcd sends a
+//command together with its parameters, so it goes out once they're complete.
+static int i80_cmd = -1;
+static uint8_t i80_params[I80_MAX_PARAMS];
+static int i80_nparams;
+//The next send opens the memory write, RAMWR, or carries on where the last one ended
+static bool i80_ramwr;
+
+static bool i80_sent(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_io_event_data_t *edata, void *ctx)
+{
+    i80_queued--;
+    return false;
+}
+
+static void i80_flush_cmd()
+{
+    if (i80_cmd < 0)
+        return;
+    //waits for the memory writes queued before it
+    esp_lcd_panel_io_tx_param(io, i80_cmd, i80_nparams ? i80_params : NULL, i80_nparams);
+    i80_cmd = -1;
+    i80_nparams = 0;
+}
+
+void lcd_bus_init()
+{
+    esp_lcd_i80_bus_handle_t bus;
+    esp_lcd_i80_bus_config_t bus_cfg = {
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+        .clk_src = LCD_CLK_SRC_DEFAULT,
+#else
+        .clk_src = LCD_CLK_SRC_PLL160M,
+#endif
+        .dc_gpio_num = CONFIG_HW_LCD_DC_GPIO,
+        .wr_gpio_num = CONFIG_HW_LCD_I80_WR_GPIO,
+        .data_gpio_nums = {
+            CONFIG_HW_LCD_I80_D0_GPIO, CONFIG_HW_LCD_I80_D1_GPIO, CONFIG_HW_LCD_I80_D2_GPIO, CONFIG_HW_LCD_I80_D3_GPIO,
+            CONFIG_HW_LCD_I80_D4_GPIO, CONFIG_HW_LCD_I80_D5_GPIO, CONFIG_HW_LCD_I80_D6_GPIO, CONFIG_HW_LCD_I80_D7_GPIO,
+        },
+        .bus_width = 8,
+        .max_transfer_bytes = I80_MAX_BYTES,
+    };
+    esp_lcd_panel_io_i80_config_t io_cfg = {
+        .cs_gpio_num = CONFIG_HW_LCD_CS_GPIO,
+        .pclk_hz = CONFIG_HW_LCD_I80_PCLK_MHZ*1000000,
+        .trans_queue_depth = 2,
+        .on_color_trans_done = i80_sent,
+        .lcd_cmd_bits = 8,
+        .lcd_param_bits = 8,
+        .dc_levels = {
+            .dc_idle_level = 0,
+            .dc_cmd_level = 0,
+            .dc_dummy_level = 0,
+            .dc_data_level = 1,
+        },
+    };
+
+    ESP_ERROR_CHECK(esp_lcd_new_i80_bus(&bus_cfg, &bus));
+    ESP_ERROR_CHECK(esp_lcd_new_panel_io_i80(bus, &io_cfg, &io));
+}
+
+//The write strobe can't be read back on, the clock is what Kconfig says
+void lcd_bus_pick_clock()
+{
+    printf("lcd: i80 clock %d kHz\n", lcd_bus_clock_khz());
+}
+
+int lcd_bus_clock_khz()
+{
+    return CONFIG_HW_LCD_I80_PCLK_MHZ*1000;
+}
+
+void lcd_bus_cmd(uint8_t cmd)
+{
+    i80_flush_cmd();
+    i80_cmd = cmd;
+}
+
+void lcd_bus_data(uint8_t data)
+{
+    assert(i80_cmd >= 0 && i80_nparams < I80_MAX_PARAMS);
+    i80_params[i80_nparams++] = data;
+}
+
+void lcd_bus_window(uint16_t x0, uint16_t x1, uint16_t y0, uint16_t y1)
+{
+    uint8_t xv[4] = {x0 >> 8, x0 & 0xFF, x1 >> 8, x1 & 0xFF};
+    uint8_t yv[4] = {y0 >> 8, y0 & 0xFF, y1 >> 8, y1 & 0xFF};
+
+    i80_flush_cmd();
+    esp_lcd_panel_io_tx_param(io, 0x2A, xv, 4);
+    esp_lcd_panel_io_tx_param(io, 0x2B, yv, 4);
+    i80_ramwr = true;
+}
+
+void lcd_bus_send(const uint32_t *buf, int bytes)
+{
+    i80_flush_cmd();
+    //one in flight, as with SPI DMA: the caller builds the next buffer meanwhile
+    while (i80_queued);
+    i80_queued++;
+    //RAMWRC (0x3C) goes on after the last pixel written, without a new window
+    esp_lcd_panel_io_tx_color(io, i80_ramwr ? 0x2C : 0x3C, buf, bytes);
+    i80_ramwr = false;
+}
+
+void lcd_bus_wait()
+{
+    i80_flush_cmd();
+    while (i80_queued);
+}
+#endif /* CONFIG_HW_LCD_BUS_I80 */
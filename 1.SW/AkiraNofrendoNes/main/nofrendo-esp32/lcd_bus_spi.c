@@ -0,0 +1,465 @@
+// Copyright 2015-2016 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "sdkconfig.h"
+#include "lcd_bus.h"
+
+#if CONFIG_HW_LCD_BUS_SPI
+#include "rom/ets_sys.h"
+#include "rom/gpio.h"
+#include "soc/gpio_reg.h"
+#include "soc/gpio_sig_map.h"
+#include "soc/gpio_struct.h"
+#include "soc/io_mux_reg.h"
+#include "soc/spi_reg.h"
+#include "driver/periph_ctrl.h"
+#if CONFIG_HW_LCD_DMA
+#include "rom/lldesc.h"
+#include "soc/dport_reg.h"
+#endif
+#if CONFIG_HW_LCD_CHAIN
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_heap_caps.h"
+#include "esp_intr_alloc.h"
+#include "soc/soc.h"
+#endif
+
+#define PIN_NUM_MISO CONFIG_HW_LCD_MISO_GPIO
+#define PIN_NUM_MOSI CONFIG_HW_LCD_MOSI_GPIO
+#define PIN_NUM_CLK  CONFIG_HW_LCD_CLK_GPIO
+#define PIN_NUM_CS   CONFIG_HW_LCD_CS_GPIO
+#define PIN_NUM_DC   CONFIG_HW_LCD_DC_GPIO
+#define LCD_SEL_CMD()   GPIO.out_w1tc = (1 << PIN_NUM_DC) // Low to send command 
+#define LCD_SEL_DATA()  GPIO.out_w1ts = (1 << PIN_NUM_DC) // High to send data
+
+#define SPI_NUM  0x3
+#define LCD_DMA_CHAN  1
+
+#if CONFIG_HW_LCD_DMA
+//One transfer is out at a time, lcd_bus_send waits for the last one first
+static lldesc_t lcd_dma_desc;
+#endif
+
+#if CONFIG_HW_LCD_CHAIN
+//A run of lines as one transfer: a ring of line buffers, each with its descriptor, that the
+//DMA engine goes round while the CPU refills the ones it is through with. With
+//SPI_OUT_AUTO_WRBACK the engine clears a descriptor's owner bit once it has sent it, which is
+//the CPU's cue. The transfer's length is the run's, so the engine stops in the ring wherever
+//the run ends, and raises the SPI's transfer done interrupt then.
+#define CHAIN_BUFS       CONFIG_HW_LCD_CHAIN_LINES
+#define CHAIN_TIMEOUT_MS 100    //a whole frame is ~30ms at 40MHz
+static lldesc_t chain_desc[CHAIN_BUFS];
+static uint32_t *chain_buf[CHAIN_BUFS];
+static int chain_total, chain_left;     //bytes of the run, and of it still to be pushed
+static int chain_next;                  //the slot the next line goes into
+static bool chain_running, chain_late;
+static SemaphoreHandle_t chain_done;
+static intr_handle_t chain_intr;
+static void chain_init();
+#endif
+
+static void spi_write_byte(const uint8_t data){
+    SET_PERI_REG_BITS(SPI_MOSI_DLEN_REG(SPI_NUM), SPI_USR_MOSI_DBITLEN, 0x7, SPI_USR_MOSI_DBITLEN_S);
+    WRITE_PERI_REG((SPI_W0_REG(SPI_NUM)), data);
+    SET_PERI_REG_MASK(SPI_CMD_REG(SPI_NUM), SPI_USR);
+    while (READ_PERI_REG(SPI_CMD_REG(SPI_NUM))&SPI_USR);
+}
+
+void lcd_bus_cmd(uint8_t cmd)
+{
+    lcd_bus_wait();
+    LCD_SEL_CMD();
+    spi_write_byte(cmd);
+}
+
+void lcd_bus_data(uint8_t data)
+{
+    lcd_bus_wait();
+    LCD_SEL_DATA();
+    spi_write_byte(data);
+}
+
+//SPI clock, as a divider of the 80MHz APB clock. Tried fastest first, the first one whose
+//GRAM write reads back correctly is kept.
+#if CONFIG_LCD_OVERCLOCK
+static const int lcd_clk_div[] = {1, 2, 3}; //80, 40, 26.7MHz
+#else
+static const int lcd_clk_div[] = {2, 3};    //40, 26.7MHz
+#endif
+#define LCD_CLK_DIV_DEFAULT 2   //used when the panel can't be read back (MISO not connected)
+#define LCD_CLK_DIV_READ    16  //5MHz, reads are a lot slower than writes on these controllers
+#define LCD_PROBE_PIXELS    16
+
+static int lcd_clk_cur = LCD_CLK_DIV_DEFAULT;
+
+static void spi_set_clock(int div){
+    while (READ_PERI_REG(SPI_CMD_REG(SPI_NUM))&SPI_USR);
+    if (div <= 1) {
+        WRITE_PERI_REG(SPI_CLOCK_REG(SPI_NUM), SPI_CLK_EQU_SYSCLK);
+    } else {
+        WRITE_PERI_REG(SPI_CLOCK_REG(SPI_NUM), ((div-1) << SPI_CLKCNT_N_S) | ((div/2-1) << SPI_CLKCNT_H_S) | ((div-1) << SPI_CLKCNT_L_S));
+    }
+}
+
+//Probe colour i: red equals blue so the BGR bit in MADCTL doesn't matter on readback
+static uint16_t lcd_probe_color(int i){
+    int v = (i*7+3)&0x1f;
+    int g = (i*13+5)&0x3f;
+    return (v<<11)|(g<<5)|v;
+}
+
+//Write the probe pixels into the top left corner of GRAM at the current clock
+static void lcd_probe_write(){
+    uint8_t b[LCD_PROBE_PIXELS*2];
+    int i;
+
+    lcd_bus_cmd(0x2A);
+    lcd_bus_data(0x00);
+    lcd_bus_data(0x00);
+    lcd_bus_data(0x00);
+    lcd_bus_data(LCD_PROBE_PIXELS-1);
+    lcd_bus_cmd(0x2B);
+    lcd_bus_data(0x00);
+    lcd_bus_data(0x00);
+    lcd_bus_data(0x00);
+    lcd_bus_data(0x00);
+    lcd_bus_cmd(0x2C);
+
+    for (i = 0; i < LCD_PROBE_PIXELS; i++) {
+        b[i*2] = lcd_probe_color(i)>>8;
+        b[i*2+1] = lcd_probe_color(i)&0xff;
+    }
+    LCD_SEL_DATA();
+    SET_PERI_REG_BITS(SPI_MOSI_DLEN_REG(SPI_NUM), SPI_USR_MOSI_DBITLEN, sizeof(b)*8-1, SPI_USR_MOSI_DBITLEN_S);
+    for (i = 0; i < sizeof(b)/4; i++) {
+        WRITE_PERI_REG((SPI_W0_REG(SPI_NUM) + (i << 2)), b[i*4] | (b[i*4+1]<<8) | (b[i*4+2]<<16) | (b[i*4+3]<<24));
+    }
+    SET_PERI_REG_MASK(SPI_CMD_REG(SPI_NUM), SPI_USR);
+    while (READ_PERI_REG(SPI_CMD_REG(SPI_NUM))&SPI_USR);
+}
+
+//Read the probe pixels back with RAMRD (0x2E) in one command + MISO transaction. The panel
+//answers with a dummy byte and then 3 bytes (6 bits used each) per pixel.
+//Returns 1 if they match, 0 if not and -1 if MISO never moves.
+static int lcd_probe_read(){
+    uint8_t b[1+LCD_PROBE_PIXELS*3];
+    int i, ok = 1, ones = 0, zeros = 0;
+
+    LCD_SEL_CMD();
+    CLEAR_PERI_REG_MASK(SPI_USER_REG(SPI_NUM), SPI_USR_MOSI);
+    SET_PERI_REG_MASK(SPI_USER_REG(SPI_NUM), SPI_USR_COMMAND | SPI_USR_MISO);
+    SET_PERI_REG_BITS(SPI_USER2_REG(SPI_NUM), SPI_USR_COMMAND_BITLEN, 7, SPI_USR_COMMAND_BITLEN_S);
+    SET_PERI_REG_BITS(SPI_USER2_REG(SPI_NUM), SPI_USR_COMMAND_VALUE, 0x2E, SPI_USR_COMMAND_VALUE_S);
+    SET_PERI_REG_BITS(SPI_MISO_DLEN_REG(SPI_NUM), SPI_USR_MISO_DBITLEN, sizeof(b)*8-1, SPI_USR_MISO_DBITLEN_S);
+    SET_PERI_REG_MASK(SPI_CMD_REG(SPI_NUM), SPI_USR);
+    while (READ_PERI_REG(SPI_CMD_REG(SPI_NUM))&SPI_USR);
+    for (i = 0; i < sizeof(b); i++) {
+        b[i] = READ_PERI_REG(SPI_W0_REG(SPI_NUM) + ((i/4) << 2)) >> ((i%4)*8);
+    }
+    CLEAR_PERI_REG_MASK(SPI_USER_REG(SPI_NUM), SPI_USR_COMMAND | SPI_USR_MISO);
+    SET_PERI_REG_BITS(SPI_USER2_REG(SPI_NUM), SPI_USR_COMMAND_BITLEN, 0, SPI_USR_COMMAND_BITLEN_S);
+    SET_PERI_REG_MASK(SPI_USER_REG(SPI_NUM), SPI_USR_MOSI);
+
+    for (i = 0; i < LCD_PROBE_PIXELS; i++) {
+        uint16_t c = lcd_probe_color(i);
+        const uint8_t *p = &b[1+i*3];
+        if ((p[0]>>3) != (c>>11) || (p[1]>>2) != ((c>>5)&0x3f) || (p[2]>>3) != (c&0x1f)) ok = 0;
+        ones += (p[0]&p[1]&p[2]) == 0xff;
+        zeros += (p[0]|p[1]|p[2]) == 0;
+    }
+    if (ones == LCD_PROBE_PIXELS || zeros == LCD_PROBE_PIXELS) return -1;
+    return ok;
+}
+
+//Pick the fastest clock in lcd_clk_div the panel takes without corrupting data
+void lcd_bus_pick_clock(){
+    int i, r = 0;
+
+    for (i = 0; i < sizeof(lcd_clk_div)/sizeof(lcd_clk_div[0]); i++) {
+        spi_set_clock(lcd_clk_div[i]);
+        lcd_probe_write();
+        spi_set_clock(LCD_CLK_DIV_READ);
+        r = lcd_probe_read();
+        if (r != 0) break;
+        ets_printf("lcd: %d kHz failed readback\r\n", 80000/lcd_clk_div[i]);
+    }
+    if (r == 1) {
+        lcd_clk_cur = lcd_clk_div[i];
+    } else if (r < 0) {
+        ets_printf("lcd: no readback on MISO, using default clock\r\n");
+        lcd_clk_cur = LCD_CLK_DIV_DEFAULT;
+    } else {
+        lcd_clk_cur = lcd_clk_div[sizeof(lcd_clk_div)/sizeof(lcd_clk_div[0])-1];
+    }
+    spi_set_clock(lcd_clk_cur);
+    ets_printf("lcd: spi clock %d kHz\r\n", 80000/lcd_clk_cur);
+}
+
+void lcd_bus_init()
+{
+    periph_module_enable(PERIPH_VSPI_MODULE);
+    periph_module_enable(PERIPH_SPI_DMA_MODULE);
+
+    ets_printf("lcd spi pin mux init ...\r\n");
+    PIN_FUNC_SELECT(PERIPHS_IO_MUX_GPIO19_U,2);
+    PIN_FUNC_SELECT(PERIPHS_IO_MUX_GPIO23_U,2);
+    PIN_FUNC_SELECT(PERIPHS_IO_MUX_GPIO22_U,2);
+    PIN_FUNC_SELECT(PERIPHS_IO_MUX_GPIO25_U,2);
+    WRITE_PERI_REG(GPIO_ENABLE_W1TS_REG, BIT19|BIT23|BIT22);
+
+    ets_printf("lcd spi signal init\r\n");
+    gpio_matrix_in(PIN_NUM_MISO, VSPIQ_IN_IDX,0);
+    gpio_matrix_out(PIN_NUM_MOSI, VSPID_OUT_IDX,0,0);
+    gpio_matrix_out(PIN_NUM_CLK, VSPICLK_OUT_IDX,0,0);
+    gpio_matrix_out(PIN_NUM_CS, VSPICS0_OUT_IDX,0,0);
+    ets_printf("Hspi config\r\n");
+
+    CLEAR_PERI_REG_MASK(SPI_SLAVE_REG(SPI_NUM), SPI_TRANS_DONE << 5);
+    SET_PERI_REG_MASK(SPI_USER_REG(SPI_NUM), SPI_CS_SETUP);
+    CLEAR_PERI_REG_MASK(SPI_PIN_REG(SPI_NUM), SPI_CK_IDLE_EDGE);
+    CLEAR_PERI_REG_MASK(SPI_USER_REG(SPI_NUM),  SPI_CK_OUT_EDGE);
+    CLEAR_PERI_REG_MASK(SPI_CTRL_REG(SPI_NUM), SPI_WR_BIT_ORDER);
+    CLEAR_PERI_REG_MASK(SPI_CTRL_REG(SPI_NUM), SPI_RD_BIT_ORDER);
+    CLEAR_PERI_REG_MASK(SPI_USER_REG(SPI_NUM), SPI_DOUTDIN);
+    WRITE_PERI_REG(SPI_USER1_REG(SPI_NUM), 0);
+    SET_PERI_REG_BITS(SPI_CTRL2_REG(SPI_NUM), SPI_MISO_DELAY_MODE, 0, SPI_MISO_DELAY_MODE_S);
+    CLEAR_PERI_REG_MASK(SPI_SLAVE_REG(SPI_NUM), SPI_SLAVE_MODE);
+    
+    spi_set_clock(LCD_CLK_DIV_DEFAULT); //raised by lcd_bus_pick_clock once the panel is up
+    
+    SET_PERI_REG_MASK(SPI_USER_REG(SPI_NUM), SPI_CS_SETUP | SPI_CS_HOLD | SPI_USR_MOSI);
+    SET_PERI_REG_MASK(SPI_CTRL2_REG(SPI_NUM), ((0x4 & SPI_MISO_DELAY_NUM) << SPI_MISO_DELAY_NUM_S));
+    CLEAR_PERI_REG_MASK(SPI_USER_REG(SPI_NUM), SPI_USR_COMMAND);
+    SET_PERI_REG_BITS(SPI_USER2_REG(SPI_NUM), SPI_USR_COMMAND_BITLEN, 0, SPI_USR_COMMAND_BITLEN_S);
+    CLEAR_PERI_REG_MASK(SPI_USER_REG(SPI_NUM), SPI_USR_ADDR);
+    SET_PERI_REG_BITS(SPI_USER1_REG(SPI_NUM), SPI_USR_ADDR_BITLEN, 0, SPI_USR_ADDR_BITLEN_S);
+    CLEAR_PERI_REG_MASK(SPI_USER_REG(SPI_NUM), SPI_USR_MISO);
+    SET_PERI_REG_MASK(SPI_USER_REG(SPI_NUM), SPI_USR_MOSI);
+    char i;
+    for (i = 0; i < 16; ++i) {
+        WRITE_PERI_REG((SPI_W0_REG(SPI_NUM) + (i << 2)), 0);
+    }
+
+#if CONFIG_HW_LCD_DMA
+    ets_printf("lcd spi dma init\r\n");
+    DPORT_SET_PERI_REG_BITS(DPORT_SPI_DMA_CHAN_SEL_REG, 3, LCD_DMA_CHAN, DPORT_SPI_SPI3_DMA_CHAN_SEL_S);
+    CLEAR_PERI_REG_MASK(SPI_USER_REG(SPI_NUM), SPI_USR_MOSI_HIGHPART);
+#endif
+#if CONFIG_HW_LCD_CHAIN
+    chain_init();
+#endif
+}
+
+#define U16x2toU32(m,l) ((((uint32_t)(l>>8|(l&0xFF)<<8))<<16)|(m>>8|(m&0xFF)<<8))
+
+//CASET, PASET and RAMWR, each parameter pair in one 32-bit transfer
+void lcd_bus_window(uint16_t x0, uint16_t x1, uint16_t y0, uint16_t y1){
+    uint32_t xv, yv, dc;
+    dc = (1 << PIN_NUM_DC);
+
+    xv = U16x2toU32(x0,x1);
+    yv = U16x2toU32(y0,y1);
+    
+    lcd_bus_wait();
+    GPIO.out_w1tc = dc;
+    SET_PERI_REG_BITS(SPI_MOSI_DLEN_REG(SPI_NUM), SPI_USR_MOSI_DBITLEN, 7, SPI_USR_MOSI_DBITLEN_S);
+    WRITE_PERI_REG((SPI_W0_REG(SPI_NUM)), 0x2A);
+    SET_PERI_REG_MASK(SPI_CMD_REG(SPI_NUM), SPI_USR);
+    while (READ_PERI_REG(SPI_CMD_REG(SPI_NUM))&SPI_USR);
+    GPIO.out_w1ts = dc;
+    SET_PERI_REG_BITS(SPI_MOSI_DLEN_REG(SPI_NUM), SPI_USR_MOSI_DBITLEN, 31, SPI_USR_MOSI_DBITLEN_S);
+    WRITE_PERI_REG((SPI_W0_REG(SPI_NUM)), xv);
+    SET_PERI_REG_MASK(SPI_CMD_REG(SPI_NUM), SPI_USR);
+    while (READ_PERI_REG(SPI_CMD_REG(SPI_NUM))&SPI_USR);
+    GPIO.out_w1tc = dc;
+    SET_PERI_REG_BITS(SPI_MOSI_DLEN_REG(SPI_NUM), SPI_USR_MOSI_DBITLEN, 7, SPI_USR_MOSI_DBITLEN_S);
+    WRITE_PERI_REG((SPI_W0_REG(SPI_NUM)), 0x2B);
+    SET_PERI_REG_MASK(SPI_CMD_REG(SPI_NUM), SPI_USR);
+    while (READ_PERI_REG(SPI_CMD_REG(SPI_NUM))&SPI_USR);
+    GPIO.out_w1ts = dc;
+    SET_PERI_REG_BITS(SPI_MOSI_DLEN_REG(SPI_NUM), SPI_USR_MOSI_DBITLEN, 31, SPI_USR_MOSI_DBITLEN_S);
+    WRITE_PERI_REG((SPI_W0_REG(SPI_NUM)), yv);
+    SET_PERI_REG_MASK(SPI_CMD_REG(SPI_NUM), SPI_USR);
+    while (READ_PERI_REG(SPI_CMD_REG(SPI_NUM))&SPI_USR);
+    GPIO.out_w1tc = dc;
+    SET_PERI_REG_BITS(SPI_MOSI_DLEN_REG(SPI_NUM), SPI_USR_MOSI_DBITLEN, 7, SPI_USR_MOSI_DBITLEN_S);
+    WRITE_PERI_REG((SPI_W0_REG(SPI_NUM)), 0x2C);
+    SET_PERI_REG_MASK(SPI_CMD_REG(SPI_NUM), SPI_USR);
+    while (READ_PERI_REG(SPI_CMD_REG(SPI_NUM))&SPI_USR);
+    GPIO.out_w1ts = dc;
+}
+
+#if CONFIG_HW_LCD_DMA
+//Start sending len bytes of buf. Returns immediately, the SPI DMA engine
+//pulls the data out of RAM while the CPU builds the next line.
+static void spi_dma_send(const uint32_t *buf, int len){
+    lldesc_t *d = &lcd_dma_desc;
+
+    d->size = len;
+    d->length = len;
+    d->offset = 0;
+    d->sosf = 0;
+    d->eof = 1;
+    d->owner = 1;
+    d->buf = (uint8_t *)buf;
+    d->empty = 0;
+
+    SET_PERI_REG_MASK(SPI_DMA_CONF_REG(SPI_NUM), SPI_OUT_RST | SPI_AHBM_RST | SPI_AHBM_FIFO_RST);
+    CLEAR_PERI_REG_MASK(SPI_DMA_CONF_REG(SPI_NUM), SPI_OUT_RST | SPI_AHBM_RST | SPI_AHBM_FIFO_RST);
+    SET_PERI_REG_MASK(SPI_DMA_CONF_REG(SPI_NUM), SPI_OUTDSCR_BURST_EN | SPI_OUT_DATA_BURST_EN);
+    SET_PERI_REG_BITS(SPI_MOSI_DLEN_REG(SPI_NUM), SPI_USR_MOSI_DBITLEN, len*8-1, SPI_USR_MOSI_DBITLEN_S);
+    WRITE_PERI_REG(SPI_DMA_OUT_LINK_REG(SPI_NUM), (((uint32_t)d) & SPI_OUTLINK_ADDR) | SPI_OUTLINK_START);
+    SET_PERI_REG_MASK(SPI_CMD_REG(SPI_NUM), SPI_USR);
+}
+
+//Wait for the running DMA transfer and hand the data lines back to the W0..W15 registers
+static void spi_dma_wait(){
+    while (READ_PERI_REG(SPI_CMD_REG(SPI_NUM))&SPI_USR);
+    SET_PERI_REG_MASK(SPI_DMA_OUT_LINK_REG(SPI_NUM), SPI_OUTLINK_STOP);
+    SET_PERI_REG_MASK(SPI_DMA_CONF_REG(SPI_NUM), SPI_OUT_RST | SPI_AHBM_FIFO_RST);
+    CLEAR_PERI_REG_MASK(SPI_DMA_CONF_REG(SPI_NUM), SPI_OUT_RST | SPI_AHBM_FIFO_RST);
+    WRITE_PERI_REG(SPI_DMA_OUT_LINK_REG(SPI_NUM), 0);
+}
+#endif
+
+#if CONFIG_HW_LCD_CHAIN
+static void chain_isr(void *arg){
+    BaseType_t woken = pdFALSE;
+
+    CLEAR_PERI_REG_MASK(SPI_SLAVE_REG(SPI_NUM), SPI_TRANS_DONE);
+    xSemaphoreGiveFromISR(chain_done, &woken);
+    if (woken) portYIELD_FROM_ISR();
+}
+
+//The ring and the interrupt; without room for them every line goes out on its own
+static void chain_init(){
+    int i;
+
+    for (i = 0; i < CHAIN_BUFS; i++) {
+        chain_buf[i] = heap_caps_malloc(LCD_BUS_CHAIN_BYTES, MALLOC_CAP_DMA);
+        if (chain_buf[i] == NULL) break;
+        chain_desc[i].buf = (uint8_t *)chain_buf[i];
+        chain_desc[i].qe.stqe_next = &chain_desc[(i+1) % CHAIN_BUFS];
+    }
+    chain_done = xSemaphoreCreateBinary();
+    if (i < CHAIN_BUFS || chain_done == NULL ||
+        esp_intr_alloc(ETS_SPI3_INTR_SOURCE, 0, chain_isr, NULL, &chain_intr) != ESP_OK) {
+        ets_printf("lcd: no room for the DMA chain, lines go out one by one\r\n");
+        while (i > 0) heap_caps_free(chain_buf[--i]);
+        chain_buf[0] = NULL;
+        return;
+    }
+    ets_printf("lcd: %d line DMA chain\r\n", CHAIN_BUFS);
+}
+
+//The ring is full, or the run is all in: off it goes, as one transfer
+static void chain_start(){
+    xSemaphoreTake(chain_done, 0);
+    SET_PERI_REG_MASK(SPI_DMA_CONF_REG(SPI_NUM), SPI_OUT_RST | SPI_AHBM_RST | SPI_AHBM_FIFO_RST);
+    CLEAR_PERI_REG_MASK(SPI_DMA_CONF_REG(SPI_NUM), SPI_OUT_RST | SPI_AHBM_RST | SPI_AHBM_FIFO_RST);
+    SET_PERI_REG_MASK(SPI_DMA_CONF_REG(SPI_NUM), SPI_OUTDSCR_BURST_EN | SPI_OUT_DATA_BURST_EN | SPI_OUT_AUTO_WRBACK);
+    SET_PERI_REG_BITS(SPI_MOSI_DLEN_REG(SPI_NUM), SPI_USR_MOSI_DBITLEN, chain_total*8-1, SPI_USR_MOSI_DBITLEN_S);
+    CLEAR_PERI_REG_MASK(SPI_SLAVE_REG(SPI_NUM), SPI_TRANS_DONE);
+    SET_PERI_REG_MASK(SPI_SLAVE_REG(SPI_NUM), SPI_TRANS_INTEN);
+    WRITE_PERI_REG(SPI_DMA_OUT_LINK_REG(SPI_NUM), (((uint32_t)&chain_desc[0]) & SPI_OUTLINK_ADDR) | SPI_OUTLINK_START);
+    SET_PERI_REG_MASK(SPI_CMD_REG(SPI_NUM), SPI_USR);
+    chain_running = true;
+}
+
+bool lcd_bus_chain_begin(int bytes){
+    int i;
+
+    if (chain_buf[0] == NULL || bytes <= 0) return false;
+    lcd_bus_wait();
+    for (i = 0; i < CHAIN_BUFS; i++) chain_desc[i].owner = 0;
+    chain_total = chain_left = bytes;
+    chain_next = 0;
+    chain_running = chain_late = false;
+    return true;
+}
+
+uint32_t *lcd_bus_chain_line(){
+    volatile lldesc_t *d = &chain_desc[chain_next];
+
+    //the engine hands the slot back once it has sent last lap's line out of it
+    while (chain_running && d->owner);
+    return chain_buf[chain_next];
+}
+
+void lcd_bus_chain_push(int bytes){
+    lldesc_t *d = &chain_desc[chain_next];
+
+    d->size = bytes;
+    d->length = bytes;
+    d->offset = 0;
+    d->sosf = 0;
+    chain_left -= bytes;
+    d->eof = (chain_left <= 0);
+    d->owner = 1;
+    //the slot before already back: the engine may have read this one before it was handed over
+    if (chain_running && ((volatile lldesc_t *)&chain_desc[(chain_next+CHAIN_BUFS-1) % CHAIN_BUFS])->owner == 0)
+        chain_late = true;
+    chain_next = (chain_next+1) % CHAIN_BUFS;
+    if (!chain_running && (chain_next == 0 || chain_left <= 0)) chain_start();
+}
+
+bool lcd_bus_chain_end(){
+    if (!chain_running) return true;
+    //the spin in lcd_bus_wait only runs if the interrupt never came
+    xSemaphoreTake(chain_done, pdMS_TO_TICKS(CHAIN_TIMEOUT_MS));
+    CLEAR_PERI_REG_MASK(SPI_SLAVE_REG(SPI_NUM), SPI_TRANS_INTEN);
+    lcd_bus_wait();
+    CLEAR_PERI_REG_MASK(SPI_DMA_CONF_REG(SPI_NUM), SPI_OUT_AUTO_WRBACK);
+    chain_running = false;
+    return !chain_late;
+}
+#endif
+
+#if !CONFIG_HW_LCD_DMA
+//Feed words 32-bit words to the SPI FIFO from the CPU, 64 bytes at a time
+static void spi_fifo_send(const uint32_t *buf, int words){
+    int x, i;
+
+    SET_PERI_REG_BITS(SPI_MOSI_DLEN_REG(SPI_NUM), SPI_USR_MOSI_DBITLEN, 511, SPI_USR_MOSI_DBITLEN_S);
+    for (x=0; x<words; x+=16) {
+        while (READ_PERI_REG(SPI_CMD_REG(SPI_NUM))&SPI_USR);
+        for (i=0; i<16; i++) {
+            WRITE_PERI_REG((SPI_W0_REG(SPI_NUM) + (i << 2)), buf[x+i]);
+        }
+        SET_PERI_REG_MASK(SPI_CMD_REG(SPI_NUM), SPI_USR);
+    }
+}
+#endif
+
+int lcd_bus_clock_khz(){
+    return 80000/lcd_clk_cur;
+}
+
+void lcd_bus_send(const uint32_t *buf, int bytes){
+    lcd_bus_wait();
+#if CONFIG_HW_LCD_DMA
+    spi_dma_send(buf, bytes);
+#else
+    spi_fifo_send(buf, bytes/4);
+#endif
+}
+
+void lcd_bus_wait(){
+#if CONFIG_HW_LCD_DMA
+    spi_dma_wait();
+#endif
+    while (READ_PERI_REG(SPI_CMD_REG(SPI_NUM))&SPI_USR);
+}
+#endif /* CONFIG_HW_LCD_BUS_SPI */
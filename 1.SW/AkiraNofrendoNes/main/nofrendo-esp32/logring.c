@@ -0,0 +1,214 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include <log.h>
+#include "logring.h"
+#include "tasks.h"
+#include "emuyield.h"
+
+#if CONFIG_NES_LOG_ASYNC
+#define LOG_LINES CONFIG_NES_LOG_LINES // power of two
+#define LOG_LINE 120                   // longer lines are cut
+#define LOG_DRAIN_MS 20
+#define LOG_YIELD_MS 50   // on the emulator's core, with CONFIG_NES_YIELD: the longest a line waits
+#define LOG_SLICE_US 500  // and the slice, a couple of lines at 115200 baud into the UART FIFO
+
+// A bounded multi-producer queue: a slot's seq is its position when it is free to be written,
+// and position + 1 once it holds a line. Writers claim a position by moving head on with a
+// compare and swap, so the emulator, videoTask and the Wi-Fi and Bluetooth tasks can all log
+// at once without a lock; only logTask reads.
+typedef struct
+{
+	uint32_t seq;
+	char text[LOG_LINE];
+} logSlot_t;
+
+static logSlot_t *ring;
+static uint32_t head;
+static uint32_t tail;
+static uint32_t dropped;
+static uint32_t rateSecond; // ~1 s window the count is for
+static uint32_t rateCount;
+static int yieldClient = -1;
+
+_Static_assert((LOG_LINES & (LOG_LINES - 1)) == 0, "CONFIG_NES_LOG_LINES must be a power of two");
+
+// a free slot and its position, or NULL when the ring is full or the rate is used up
+static logSlot_t *log_claim(uint32_t *pos)
+{
+	uint32_t second = (uint32_t)(esp_timer_get_time() >> 20);
+	uint32_t p;
+
+	if (__atomic_load_n(&rateSecond, __ATOMIC_RELAXED) != second)
+	{
+		__atomic_store_n(&rateSecond, second, __ATOMIC_RELAXED);
+		__atomic_store_n(&rateCount, 0, __ATOMIC_RELAXED);
+	}
+	if (__atomic_add_fetch(&rateCount, 1, __ATOMIC_RELAXED) > CONFIG_NES_LOG_RATE)
+		goto drop;
+
+	p = __atomic_load_n(&head, __ATOMIC_RELAXED);
+	for (;;)
+	{
+		logSlot_t *s = &ring[p & (LOG_LINES - 1)];
+		int32_t dif = (int32_t)(__atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) - p);
+
+		if (dif < 0)
+			goto drop; // still holds a line from a lap ago
+		if (dif == 0 && __atomic_compare_exchange_n(&head, &p, p + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		{
+			*pos = p;
+			return s;
+		}
+		if (dif > 0)
+			p = __atomic_load_n(&head, __ATOMIC_RELAXED);
+	}
+
+drop:
+	__atomic_add_fetch(&dropped, 1, __ATOMIC_RELAXED);
+	return NULL;
+}
+
+static void log_publish(logSlot_t *s, uint32_t pos)
+{
+	__atomic_store_n(&s->seq, pos + 1, __ATOMIC_RELEASE);
+	emuYieldWant(yieldClient);
+}
+
+int logPrintf(const char *fmt, ...)
+{
+	logSlot_t *s;
+	uint32_t pos;
+	va_list ap;
+	int n = 0;
+
+	va_start(ap, fmt);
+	if (ring == NULL)
+		n = vprintf(fmt, ap); // no ring: the old way
+	else if ((s = log_claim(&pos)) != NULL)
+	{
+		n = vsnprintf(s->text, LOG_LINE, fmt, ap);
+		log_publish(s, pos);
+	}
+	va_end(ap);
+	return n;
+}
+
+int logPuts(const char *string)
+{
+	logSlot_t *s;
+	uint32_t pos;
+
+	if (ring == NULL)
+		return printf("%s", string);
+	if ((s = log_claim(&pos)) == NULL)
+		return 0;
+	snprintf(s->text, LOG_LINE, "%s", string);
+	log_publish(s, pos);
+	return strlen(string);
+}
+
+static void logTask(void *arg)
+{
+	uint32_t lost = 0;
+
+	for (;;)
+	{
+		logSlot_t *s = &ring[tail & (LOG_LINES - 1)];
+
+		if (__atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) != tail + 1)
+		{
+			uint32_t d = __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+
+			if (d != lost)
+			{
+				printf("log: %u lines dropped\n", (unsigned)(d - lost));
+				lost = d;
+			}
+			emuYieldDone(yieldClient);
+			vTaskDelay(pdMS_TO_TICKS(LOG_DRAIN_MS));
+			continue;
+		}
+		fputs(s->text, stdout);
+		__atomic_store_n(&s->seq, tail + LOG_LINES, __ATOMIC_RELEASE);
+		tail++;
+	}
+}
+
+static bool log_start()
+{
+	ring = malloc(LOG_LINES * sizeof(logSlot_t));
+	if (ring == NULL)
+		return false;
+	for (int i = 0; i < LOG_LINES; i++)
+		ring[i].seq = i;
+	if (!tasks_start(TASK_LOG, &logTask, NULL, NULL))
+	{
+		free(ring);
+		ring = NULL;
+		return false;
+	}
+	yieldClient = emuYieldRegister(TASK_LOG, LOG_YIELD_MS, LOG_SLICE_US);
+	return true;
+}
+#else
+int logPrintf(const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	va_start(ap, fmt);
+	n = vprintf(fmt, ap);
+	va_end(ap);
+	return n;
+}
+
+int logPuts(const char *string)
+{
+	return printf("%s", string);
+}
+#endif
+
+// CONFIG_NES_LOG_MODULES: "module=level" entries separated by ';'
+static void log_modules(const char *list)
+{
+	char module[16];
+
+	while (*list)
+	{
+		const char *eq = strchr(list, '=');
+		const char *end = strchr(list, ';');
+
+		if (end == NULL)
+			end = list + strlen(list);
+		if (eq && eq < end && eq - list < (int)sizeof(module))
+		{
+			memcpy(module, list, eq - list);
+			module[eq - list] = 0;
+			if (log_setlevel(module, atoi(eq + 1)) < 0)
+				printf("log: no room for a level for %s\n", module);
+		}
+		list = *end ? end + 1 : end;
+	}
+}
+
+void logringInit()
+{
+	static bool ready;
+
+	if (ready)
+		return;
+	ready = true;
+#if CONFIG_NES_LOG_ASYNC
+	if (!log_start())
+		printf("log: no room for the ring, logging straight to the UART\n");
+#endif
+	log_setlevel(NULL, CONFIG_NES_LOG_LEVEL);
+	log_modules(CONFIG_NES_LOG_MODULES);
+	log_chain_logfunc(logPuts);
+}
@@ -0,0 +1,17 @@
+#ifndef LOGRING_H
+#define LOGRING_H
+
+// Logging that never waits for the UART (CONFIG_NES_LOG_ASYNC). A message is formatted into a
+// slot of a lock-free ring and a low priority task on core 1 prints it from there, so a line
+// costs the caller a vsnprintf, not the ~10 ms 115200 baud takes to send it. When the ring is
+// full, or more than CONFIG_NES_LOG_RATE lines come in a second, lines are dropped and counted
+// instead. The core's log_printf goes here too, filtered by level and module first, see
+// log_setlevel and CONFIG_NES_LOG_LEVEL.
+
+// call before anything is logged; sets the core's levels and takes over its log function
+void logringInit();
+// printf into the ring, for anything on the emulator's or the video path
+int logPrintf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+// a string as it is; the core's log function
+int logPuts(const char *string);
+#endif
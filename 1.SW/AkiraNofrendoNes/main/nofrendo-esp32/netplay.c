@@ -0,0 +1,356 @@
+#include <stdio.h>
+#include <string.h>
+#include "sdkconfig.h"
+#include "netplay.h"
+
+#if CONFIG_NES_NETPLAY
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_idf_version.h"
+#include "esp_event.h"
+#include "esp_wifi.h"
+#include "esp_now.h"
+#include "esp_timer.h"
+#include "driver/gpio.h"
+#include "psxcontroller.h"
+#include "logring.h"
+
+#define NET_MAGIC 0xA5
+#define NET_HELLO 1
+#define NET_INPUT 2
+#define NET_BATCH 4         // pads per packet, the oldest the other side is missing on
+#define NET_RING 64         // frames of pads and hashes kept, power of 2
+#define NET_RESEND_US 4000  // no pad from the other side for this long while waiting: send ours again
+#define NET_LOST_US 3000000 // nothing heard for this long: the link is gone
+#define NET_STATS_US 10000000
+#define NET_SELECT_PIN 17
+
+typedef struct __attribute__((packed))
+{
+	uint8_t magic;      // NET_MAGIC
+	uint8_t type;       // NET_HELLO, NET_INPUT
+	uint8_t heard;      // hello: the sender has heard our hello
+	uint8_t count;      // input: pads in pad[]
+	uint32_t crc;       // PRG ROM CRC, only the same game pairs up
+	uint32_t frame;     // the frame pad[0] is for
+	uint32_t ack;       // the sender has the other side's pads up to this frame
+	uint32_t sentUs;    // sender's clock
+	uint32_t echoUs;    // the last sentUs the sender got from us, plus how long it held it
+	uint32_t hashFrame; // the sender's RAM hash at the end of this frame...
+	uint32_t hash;      // ...is this
+	uint16_t pad[NET_BATCH];
+} netPacket_t; // 40 bytes
+
+static const uint8_t broadcast[6] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+static uint8_t peerMac[6];
+static uint32_t linkCrc;
+static bool active;
+static bool player1;
+static SemaphoreHandle_t rxSem;
+
+// written by the receive callback (Wi-Fi task), read by the emulator
+static volatile uint16_t remotePad[NET_RING];
+static volatile uint32_t remoteNewest; // frames up to here are in remotePad, 0: none yet
+static volatile bool heardHello, heardHeard;
+static volatile uint32_t peerAck; // the other side has our pads up to here
+static volatile uint32_t lastRxUs, peerSentUs, peerSentAt;
+// the frame in the top word, its hash in the bottom one: a pair is only read or written whole
+static uint64_t peerHash;
+
+// emulator side
+static uint16_t localPad[NET_RING];
+static uint32_t localHash[NET_RING];
+static uint32_t frame; // frames done
+static struct
+{
+	uint32_t rttSum, rttMax, rttCount;
+	uint32_t stalls, stallUs, stallMax;
+	uint32_t desyncs, firstDesync;
+	int64_t reportAt;
+} ns;
+
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+static void net_recv(const esp_now_recv_info_t *info, const uint8_t *data, int len)
+{
+	const uint8_t *mac = info->src_addr;
+#else
+static void net_recv(const uint8_t *mac, const uint8_t *data, int len)
+{
+#endif
+	const netPacket_t *p = (const netPacket_t *)data;
+	uint32_t now = (uint32_t)esp_timer_get_time();
+
+	if (len != sizeof(*p) || p->magic != NET_MAGIC || p->crc != linkCrc)
+		return;
+	if (p->type == NET_HELLO)
+	{
+		if (!active)
+		{
+			memcpy(peerMac, mac, 6);
+			heardHello = true;
+			heardHeard = heardHeard || p->heard;
+		}
+	}
+	else if (p->type == NET_INPUT && active && memcmp(mac, peerMac, 6) == 0 && p->count <= NET_BATCH)
+	{
+		// the pads only ever get newer, the ones of a late packet are in already
+		for (int i = 0; i < p->count; i++)
+		{
+			uint32_t f = p->frame + i;
+			if (f == remoteNewest + 1)
+			{
+				remotePad[f % NET_RING] = p->pad[i];
+				__atomic_store_n(&remoteNewest, f, __ATOMIC_RELEASE);
+			}
+		}
+		if (p->ack > peerAck)
+			peerAck = p->ack;
+		peerSentUs = p->sentUs;
+		peerSentAt = now;
+		if (p->echoUs)
+		{
+			uint32_t rtt = now - p->echoUs;
+			ns.rttSum += rtt;
+			ns.rttCount++;
+			if (rtt > ns.rttMax)
+				ns.rttMax = rtt;
+		}
+		__atomic_store_n(&peerHash, (uint64_t)p->hashFrame << 32 | p->hash, __ATOMIC_RELAXED);
+	}
+	lastRxUs = now;
+	xSemaphoreGive(rxSem);
+}
+
+static void net_send(const uint8_t *mac, int type)
+{
+	netPacket_t p = {.magic = NET_MAGIC, .type = type, .crc = linkCrc};
+	uint32_t now = (uint32_t)esp_timer_get_time();
+
+	if (type == NET_HELLO)
+		p.heard = heardHello;
+	else
+	{
+		// Ours are known up to frame + delay. From the first the other side hasn't got, so a
+		// gap of more lost packets than NET_BATCH still fills up.
+		uint32_t newest = frame + CONFIG_NES_NETPLAY_DELAY;
+		p.frame = peerAck + 1;
+		p.ack = remoteNewest;
+		while (p.count < NET_BATCH && p.frame + p.count <= newest)
+		{
+			p.pad[p.count] = localPad[(p.frame + p.count) % NET_RING];
+			p.count++;
+		}
+		p.sentUs = now | 1; // never 0
+		if (peerSentUs)
+			p.echoUs = peerSentUs + (now - peerSentAt);
+		p.hashFrame = frame;
+		p.hash = localHash[frame % NET_RING];
+	}
+	esp_now_send(mac, (const uint8_t *)&p, sizeof(p));
+}
+
+static void net_peer(const uint8_t *mac)
+{
+	esp_now_peer_info_t peer = {0};
+
+	memcpy(peer.peer_addr, mac, 6);
+	peer.channel = CONFIG_NES_NETPLAY_CHANNEL;
+	peer.ifidx = WIFI_IF_STA;
+	peer.encrypt = false;
+	esp_now_add_peer(&peer);
+}
+
+static void net_stop()
+{
+	esp_now_deinit();
+	esp_wifi_stop();
+	esp_wifi_deinit();
+}
+
+static void net_stats(bool last)
+{
+	int64_t now = esp_timer_get_time();
+	char first[32] = "";
+
+	if (!last && now < ns.reportAt)
+		return;
+	if (ns.desyncs)
+		snprintf(first, sizeof(first), ", first at frame %u", (unsigned)ns.firstDesync);
+	logPrintf("link: frame %u, rtt %u/%u ms, %u stalls %u ms (max %u ms), %u desyncs%s\n",
+			  (unsigned)frame, (unsigned)(ns.rttCount ? ns.rttSum / ns.rttCount / 1000 : 0), (unsigned)(ns.rttMax / 1000),
+			  (unsigned)ns.stalls, (unsigned)(ns.stallUs / 1000), (unsigned)(ns.stallMax / 1000), (unsigned)ns.desyncs,
+			  first);
+	ns.rttSum = ns.rttMax = ns.rttCount = 0;
+	ns.stalls = ns.stallUs = ns.stallMax = 0;
+	ns.reportAt = now + NET_STATS_US;
+}
+
+bool netplayBegin(uint32_t romCrc)
+{
+	wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+	uint8_t mac[6];
+	int64_t until;
+
+	if (gpio_get_level(NET_SELECT_PIN) != 1)
+		return false;
+
+	if (rxSem == NULL)
+		rxSem = xSemaphoreCreateBinary();
+	esp_event_loop_create_default(); // there already, from an upload, is fine
+	if (esp_wifi_init(&cfg) != ESP_OK)
+		return false;
+	esp_wifi_set_storage(WIFI_STORAGE_RAM);
+	esp_wifi_set_mode(WIFI_MODE_STA);
+	esp_wifi_start();
+	esp_wifi_set_ps(WIFI_PS_NONE);
+	esp_wifi_set_channel(CONFIG_NES_NETPLAY_CHANNEL, WIFI_SECOND_CHAN_NONE);
+	if (esp_now_init() != ESP_OK)
+	{
+		esp_wifi_stop();
+		esp_wifi_deinit();
+		return false;
+	}
+	esp_now_register_recv_cb(net_recv);
+	net_peer(broadcast);
+
+	linkCrc = romCrc;
+	heardHello = heardHeard = false;
+	remoteNewest = peerAck = 0;
+	peerSentUs = 0;
+	frame = 0;
+	memset(localPad, 0xff, sizeof(localPad)); // psxReadInput bits are active low
+	memset((void *)remotePad, 0xff, sizeof(remotePad));
+	memset(&ns, 0, sizeof(ns));
+	printf("link: looking for the other console\n");
+
+	// Both say hello until each has heard the other say it heard them
+	until = esp_timer_get_time() + CONFIG_NES_NETPLAY_WAIT * 1000000LL;
+	while (!heardHeard && esp_timer_get_time() < until)
+	{
+		net_send(broadcast, NET_HELLO);
+		xSemaphoreTake(rxSem, 100 / portTICK_PERIOD_MS);
+	}
+	if (!heardHeard)
+	{
+		printf("link: nobody there, playing alone\n");
+		net_stop();
+		return false;
+	}
+	// a few more, the other side may still be waiting for our heard
+	for (int i = 0; i < 5; i++)
+	{
+		net_send(broadcast, NET_HELLO);
+		vTaskDelay(10 / portTICK_PERIOD_MS);
+	}
+
+	net_peer(peerMac);
+	esp_wifi_get_mac(WIFI_IF_STA, mac);
+	player1 = memcmp(mac, peerMac, 6) < 0;
+	lastRxUs = (uint32_t)esp_timer_get_time();
+	ns.reportAt = esp_timer_get_time() + NET_STATS_US;
+	active = true;
+	printf("link: with %02x:%02x:%02x:%02x:%02x:%02x, player %d, %d frames input delay\n", peerMac[0], peerMac[1],
+		   peerMac[2], peerMac[3], peerMac[4], peerMac[5], player1 ? 1 : 2, CONFIG_NES_NETPLAY_DELAY);
+	return true;
+}
+
+bool netplayActive()
+{
+	return active;
+}
+
+void netplayFrame(int local, uint32_t ramHash, int *pad1, int *pad2)
+{
+	uint32_t next = frame + 1;
+	uint64_t peer = __atomic_load_n(&peerHash, __ATOMIC_RELAXED);
+	uint32_t hf = (uint32_t)(peer >> 32);
+	int64_t t0, now;
+	int remote;
+
+	*pad1 = local;
+	*pad2 = 0xffff;
+	if (!active)
+		return;
+
+	localHash[frame % NET_RING] = ramHash;
+	localPad[(frame + CONFIG_NES_NETPLAY_DELAY) % NET_RING] = local;
+	net_send(peerMac, NET_INPUT);
+
+	// the other side's hashes of frames we have too
+	if (hf <= frame && frame - hf < NET_RING && localHash[hf % NET_RING] != (uint32_t)peer && hf)
+	{
+		if (ns.desyncs++ == 0)
+			ns.firstDesync = hf;
+		logPrintf("link: consoles differ at frame %u\n", (unsigned)hf);
+		// once a pair, unless a newer one came in meanwhile
+		__atomic_compare_exchange_n(&peerHash, &peer, 0, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+	}
+
+	// the first frames are played on no input, on both sides
+	t0 = esp_timer_get_time();
+	if (next > CONFIG_NES_NETPLAY_DELAY)
+	{
+		while (__atomic_load_n(&remoteNewest, __ATOMIC_ACQUIRE) < next)
+		{
+			now = esp_timer_get_time();
+			if ((uint32_t)now - lastRxUs > NET_LOST_US)
+			{
+				logPrintf("link: lost at frame %u, playing alone\n", (unsigned)frame);
+				net_stats(true);
+				active = false;
+				net_stop();
+				return;
+			}
+			if (xSemaphoreTake(rxSem, 1 + NET_RESEND_US / 1000 / portTICK_PERIOD_MS) != pdTRUE)
+				net_send(peerMac, NET_INPUT);
+		}
+		now = esp_timer_get_time();
+		if (now - t0 > 1000)
+		{
+			ns.stalls++;
+			ns.stallUs += now - t0;
+			if (now - t0 > ns.stallMax)
+				ns.stallMax = now - t0;
+		}
+	}
+	remote = remotePad[next % NET_RING];
+	local = localPad[next % NET_RING];
+	*pad1 = player1 ? local : remote;
+	*pad2 = player1 ? remote : local;
+	frame = next;
+	net_stats(false);
+}
+
+void netplayEnd()
+{
+	if (!active)
+		return;
+	net_stats(true);
+	active = false;
+	net_stop();
+}
+
+#else /* !CONFIG_NES_NETPLAY */
+
+bool netplayBegin(uint32_t romCrc)
+{
+	return false;
+}
+
+bool netplayActive()
+{
+	return false;
+}
+
+void netplayFrame(int local, uint32_t ramHash, int *pad1, int *pad2)
+{
+	*pad1 = local;
+	*pad2 = 0xffff;
+}
+
+void netplayEnd()
+{
+}
+
+#endif /* !CONFIG_NES_NETPLAY */
@@ -0,0 +1,24 @@
+#ifndef NETPLAY_H
+#define NETPLAY_H
+#include <stdint.h>
+#include <stdbool.h>
+
+// Two consoles running the same game in lockstep over ESP-NOW (CONFIG_NES_NETPLAY). The pad
+// read at the end of frame f is what its player holds in frame f + CONFIG_NES_NETPLAY_DELAY,
+// on both consoles; a frame only starts once both pads for it are in. The console with the
+// lower MAC address is player 1. Every packet carries up to four pads, from the first the other
+// side doesn't have yet, so a lost packet costs nothing, and the RAM hash of the frame just
+// finished, to catch the two drifting apart.
+
+// Look for the other console if Select is held as the game starts, for up to
+// CONFIG_NES_NETPLAY_WAIT seconds. Only the same ROM CRC pairs up. True once linked.
+bool netplayBegin(uint32_t romCrc);
+// true while linked; a link falls back to playing alone when the other side goes quiet
+bool netplayActive();
+// The frame just emulated is done, local is this console's pad now (psxReadInput bits) and
+// ramHash the RAM hash. Gives the pads of player 1 and 2 for the next frame, waits for the
+// other console's if it isn't in yet.
+void netplayFrame(int local, uint32_t ramHash, int *pad1, int *pad2);
+// the game is left: Wi-Fi off, the stats printed
+void netplayEnd();
+#endif
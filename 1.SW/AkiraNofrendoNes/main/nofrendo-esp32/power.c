@@ -0,0 +1,338 @@
+#include <stdio.h>
+#include "sdkconfig.h"
+#include "power.h"
+#include "logring.h"
+
+#if CONFIG_NES_DFS || CONFIG_NES_LIGHT_SLEEP
+#include "esp_pm.h"
+#if __has_include("esp32/pm.h")
+#include "esp32/pm.h"
+#endif
+#include "esp_timer.h"
+
+#define DFS_PERIOD_US 16639  // one NTSC frame
+#define DFS_UP_PCT 85        // busier than this: a step up
+#define DFS_LATE_PCT 100     // or over the period: straight to the top
+#define DFS_DOWN_PCT 65      // the step below would be at most this busy...
+#define DFS_DOWN_FRAMES 120  // ...for this many frames in a row: a step down
+#define DFS_STATS_US 10000000
+
+#define DFS_TOP 2
+static const int dfsMhz[DFS_TOP + 1] = {80, 160, 240};
+
+// Held by the emulator and by videoTask while they work, so the clock is the max of the PM
+// config then. Moving the max moves the clock, the locks the I2S and SPI drivers take only
+// pin the APB. With neither held the clock drops to 80 MHz, or the chip light sleeps until
+// the next esp_timer or FreeRTOS timeout.
+static esp_pm_lock_handle_t emuLock, videoLock;
+static bool active;
+static int level = DFS_TOP;
+
+static esp_err_t pm_config(int l)
+{
+	esp_pm_config_esp32_t pm = {
+		.max_freq_mhz = dfsMhz[l],
+		.min_freq_mhz = dfsMhz[0],
+#if CONFIG_NES_LIGHT_SLEEP
+		.light_sleep_enable = true,
+#else
+		.light_sleep_enable = false,
+#endif
+	};
+
+	return esp_pm_configure(&pm);
+}
+
+#if CONFIG_NES_DFS
+static int floorLevel; // the lowest step the running game's profile allows
+static int quiet;
+static volatile int videoBusy; // worst blit since the emulator last looked, us
+static int64_t residency[DFS_TOP + 1];
+static int64_t levelSince, statsAt;
+
+static void dfs_set(int l)
+{
+	int64_t now;
+
+	if (l == level || pm_config(l) != ESP_OK)
+		return;
+	now = esp_timer_get_time();
+	residency[level] += now - levelSince;
+	levelSince = now;
+	level = l;
+	quiet = 0;
+}
+
+static void dfs_stats()
+{
+	int64_t now = esp_timer_get_time();
+	int64_t total;
+
+	if (now < statsAt)
+		return;
+	residency[level] += now - levelSince;
+	levelSince = now;
+	total = 0;
+	for (int i = 0; i <= DFS_TOP; i++)
+		total += residency[i];
+	if (total)
+		logPrintf("dfs: %d MHz, 80 %d%% 160 %d%% 240 %d%%\n", dfsMhz[level],
+				  (int)(residency[0] * 100 / total), (int)(residency[1] * 100 / total), (int)(residency[2] * 100 / total));
+	for (int i = 0; i <= DFS_TOP; i++)
+		residency[i] = 0;
+	statsAt = now + DFS_STATS_US;
+}
+
+void powerEmuBusy(int busyUs, int frames)
+{
+	int busy;
+
+	if (!active || frames <= 0)
+		return;
+	// more than one frame between waits: the emulator fell behind
+	busy = frames > 1 ? DFS_PERIOD_US * 2 : busyUs;
+	if (videoBusy > busy)
+		busy = videoBusy;
+	videoBusy = 0;
+
+	if (busy * 100 > DFS_PERIOD_US * DFS_LATE_PCT)
+		dfs_set(DFS_TOP);
+	else if (busy * 100 > DFS_PERIOD_US * DFS_UP_PCT && level < DFS_TOP)
+		dfs_set(level + 1);
+	// what it would take at the next step down, the work is assumed to scale with the clock
+	else if (level > floorLevel && busy * dfsMhz[level] / dfsMhz[level - 1] * 100 < DFS_PERIOD_US * DFS_DOWN_PCT)
+	{
+		if (++quiet >= DFS_DOWN_FRAMES)
+			dfs_set(level - 1);
+	}
+	else
+		quiet = 0;
+	dfs_stats();
+}
+
+void powerVideoBusy(int busyUs)
+{
+	if (busyUs > videoBusy)
+		videoBusy = busyUs;
+}
+
+void powerMinClock(int mhz)
+{
+	floorLevel = 0;
+	while (floorLevel < DFS_TOP && dfsMhz[floorLevel] < mhz)
+		floorLevel++;
+	if (active && level < floorLevel)
+		dfs_set(floorLevel);
+}
+#endif /* CONFIG_NES_DFS */
+
+void powerInit()
+{
+	if (esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "emu", &emuLock) != ESP_OK
+		|| esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "video", &videoLock) != ESP_OK
+		|| esp_pm_lock_acquire(emuLock) != ESP_OK || pm_config(DFS_TOP) != ESP_OK)
+	{
+		printf("power: power management not available, staying at full clock\n");
+		return;
+	}
+	level = DFS_TOP;
+#if CONFIG_NES_DFS
+	levelSince = esp_timer_get_time();
+	statsAt = levelSince + DFS_STATS_US;
+#endif
+	active = true;
+}
+
+void powerEmuIdle(bool idle)
+{
+	if (!active)
+		return;
+	if (idle)
+		esp_pm_lock_release(emuLock);
+	else
+		esp_pm_lock_acquire(emuLock);
+}
+
+void powerVideoIdle(bool idle)
+{
+	if (!active)
+		return;
+	if (idle)
+		esp_pm_lock_release(videoLock);
+	else
+		esp_pm_lock_acquire(videoLock);
+}
+
+#else /* !(CONFIG_NES_DFS || CONFIG_NES_LIGHT_SLEEP) */
+
+void powerInit()
+{
+}
+
+void powerEmuIdle(bool idle)
+{
+}
+
+void powerVideoIdle(bool idle)
+{
+}
+
+#endif /* !(CONFIG_NES_DFS || CONFIG_NES_LIGHT_SLEEP) */
+
+#if !CONFIG_NES_DFS
+void powerEmuBusy(int busyUs, int frames)
+{
+}
+
+void powerVideoBusy(int busyUs)
+{
+}
+
+void powerMinClock(int mhz)
+{
+}
+#endif
+
+#if CONFIG_NES_ULP_STANDBY
+#include "esp_sleep.h"
+#include "esp32/ulp.h"
+#include "driver/rtc_io.h"
+#include "driver/adc.h"
+#include "soc/rtc_io_reg.h"
+
+#define STANDBY_POWER_GPIO 12 // Button1
+#define STANDBY_START_GPIO 14
+
+// RTC slow memory words the ULP program shares with us, the program follows them. The wake
+// stub restarts, so the wakeup cause is gone by app_main: ULP_CAUSE is what tells a ULP wake,
+// ULP_WAKE_MAGIC in the top byte of the cause, which keeps power on garbage from passing
+#define ULP_BATTERY 0 // its last battery reading
+#define ULP_CAUSE 1   // why it woke the cores, cleared once read
+#define ULP_PROG 2
+#define ULP_WAKE_MAGIC 0xa500
+#define ULP_WAKE_BUTTON (ULP_WAKE_MAGIC | 1)
+#define ULP_WAKE_BATTERY (ULP_WAKE_MAGIC | 2)
+
+#define LBL_BATTERY 1
+#define LBL_WAKE 2
+
+// Every CONFIG_NES_ULP_POLL_MS the ULP timer starts this: a button held wakes the cores,
+// so does the battery reading below CONFIG_NES_ULP_BATTERY_LOW. Either way the cause goes
+// to ULP_CAUSE and the timer stops, nothing runs until the cores are up.
+static esp_err_t ulp_start(void)
+{
+	int power = rtc_io_number_get(STANDBY_POWER_GPIO);
+	int start = rtc_io_number_get(STANDBY_START_GPIO);
+	const ulp_insn_t program[] = {
+		I_MOVI(R2, ULP_WAKE_BUTTON),
+		I_RD_REG(RTC_GPIO_IN_REG, RTC_GPIO_IN_NEXT_S + power, RTC_GPIO_IN_NEXT_S + power),
+		M_BGE(LBL_WAKE, 1),
+		I_RD_REG(RTC_GPIO_IN_REG, RTC_GPIO_IN_NEXT_S + start, RTC_GPIO_IN_NEXT_S + start),
+		M_BGE(LBL_WAKE, 1),
+#if CONFIG_NES_ULP_BATTERY_CHANNEL >= 0
+		I_ADC(R0, 0, CONFIG_NES_ULP_BATTERY_CHANNEL),
+		I_MOVI(R1, ULP_BATTERY),
+		I_ST(R0, R1, 0),
+		M_BL(LBL_BATTERY, CONFIG_NES_ULP_BATTERY_LOW),
+#endif
+		I_HALT(),
+		M_LABEL(LBL_BATTERY),
+		I_MOVI(R2, ULP_WAKE_BATTERY),
+		M_LABEL(LBL_WAKE),
+		I_MOVI(R1, ULP_CAUSE),
+		I_ST(R2, R1, 0),
+		I_WAKE(),
+		I_END(),
+		I_HALT(),
+	};
+	size_t size = sizeof(program) / sizeof(ulp_insn_t);
+	esp_err_t err;
+
+	if (power < 0 || start < 0)
+		return ESP_ERR_INVALID_ARG;
+	// the pad's pull-downs have to hold with the digital GPIOs off
+	rtc_gpio_init(STANDBY_POWER_GPIO);
+	rtc_gpio_set_direction(STANDBY_POWER_GPIO, RTC_GPIO_MODE_INPUT_ONLY);
+	rtc_gpio_pullup_dis(STANDBY_POWER_GPIO);
+	rtc_gpio_pulldown_en(STANDBY_POWER_GPIO);
+	rtc_gpio_init(STANDBY_START_GPIO);
+	rtc_gpio_set_direction(STANDBY_START_GPIO, RTC_GPIO_MODE_INPUT_ONLY);
+	rtc_gpio_pullup_dis(STANDBY_START_GPIO);
+	rtc_gpio_pulldown_en(STANDBY_START_GPIO);
+#if CONFIG_NES_ULP_BATTERY_CHANNEL >= 0
+	adc1_config_width(ADC_WIDTH_BIT_12);
+	adc1_config_channel_atten(CONFIG_NES_ULP_BATTERY_CHANNEL, ADC_ATTEN_DB_11);
+	adc1_ulp_enable();
+#endif
+	RTC_SLOW_MEM[ULP_BATTERY] = 0;
+	RTC_SLOW_MEM[ULP_CAUSE] = 0;
+	err = ulp_process_macros_and_load(ULP_PROG, program, &size);
+	if (err == ESP_OK)
+		err = ulp_set_wakeup_period(0, CONFIG_NES_ULP_POLL_MS * 1000);
+	if (err == ESP_OK)
+		err = esp_sleep_enable_ulp_wakeup();
+	if (err == ESP_OK)
+		err = ulp_run(ULP_PROG);
+	return err;
+}
+
+// Button1 alone, by the RTC IO mux, with nothing polling
+static void ext0_sleep(void)
+{
+	esp_sleep_pd_config(ESP_PD_DOMAIN_RTC_PERIPH, ESP_PD_OPTION_AUTO);
+	gpio_pullup_dis(STANDBY_POWER_GPIO);
+	gpio_pulldown_en(STANDBY_POWER_GPIO);
+	esp_sleep_enable_ext0_wakeup(STANDBY_POWER_GPIO, 1);
+	esp_deep_sleep_start();
+}
+
+void powerStandby()
+{
+	esp_err_t err;
+
+	// RTC IO and the pull-downs stay powered for the ULP to read them
+	esp_sleep_pd_config(ESP_PD_DOMAIN_RTC_PERIPH, ESP_PD_OPTION_ON);
+	err = ulp_start();
+	if (err != ESP_OK)
+	{
+		printf("power: ULP standby not available (%s), Button1 wakes\n", esp_err_to_name(err));
+		ext0_sleep();
+	}
+	esp_deep_sleep_start();
+}
+
+void powerStandbyCheck()
+{
+	// the ULP stores the low half word, the top one is its program counter
+	int cause = RTC_SLOW_MEM[ULP_CAUSE] & 0xffff;
+
+	if ((cause & 0xff00) != ULP_WAKE_MAGIC)
+		return;
+	RTC_SLOW_MEM[ULP_CAUSE] = 0;
+	if (CONFIG_NES_ULP_BATTERY_CHANNEL >= 0)
+		printf("power: battery %d in standby\n", (int)(RTC_SLOW_MEM[ULP_BATTERY] & 0xffff));
+	if (cause != ULP_WAKE_BATTERY)
+		return;
+	// flat: nothing polls any more, Button1 still wakes into the suspended game
+	printf("power: battery low, ULP off\n");
+	ext0_sleep();
+}
+
+#else /* !CONFIG_NES_ULP_STANDBY */
+#include "esp_deep_sleep.h"
+#include "driver/gpio.h"
+
+void powerStandby()
+{
+	esp_deep_sleep_pd_config(ESP_PD_DOMAIN_RTC_PERIPH, ESP_PD_OPTION_AUTO);
+	gpio_pullup_dis(12);
+	gpio_pulldown_en(12);
+	esp_deep_sleep_enable_ext0_wakeup(12, 1);
+	esp_deep_sleep_start();
+}
+
+void powerStandbyCheck()
+{
+}
+
+#endif /* !CONFIG_NES_ULP_STANDBY */
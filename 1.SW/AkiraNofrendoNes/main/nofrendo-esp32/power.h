@@ -0,0 +1,30 @@
+#ifndef POWER_H
+#define POWER_H
+#include <stdbool.h>
+
+// Power management of the emulator tasks, with CONFIG_NES_DFS or CONFIG_NES_LIGHT_SLEEP.
+// The emulator and videoTask each hold a PM lock while they work and let go of it while
+// they wait, so the clock drops, or the chip light sleeps, whenever both are idle.
+// CONFIG_NES_DFS also steps the working clock between 80, 160 and 240 MHz on how much of
+// the frame period they were busy: up at once when a frame comes close to its deadline,
+// down only after a couple of seconds of headroom.
+
+// call once before the first game; the emulator's lock is held from here on
+void powerInit();
+// the emulator is about to wait for the next frame tick (true), or has woken up (false)
+void powerEmuIdle(bool idle);
+// videoTask waits for a frame (true), or has one to send (false)
+void powerVideoIdle(bool idle);
+// the emulator is about to wait: busy us since it last woke, frames emulated in that time
+void powerEmuBusy(int busyUs, int frames);
+// videoTask sent a frame to the LCD in busyUs
+void powerVideoBusy(int busyUs);
+// CONFIG_NES_DFS doesn't step below mhz while this game runs, 0 for no floor
+void powerMinClock(int mhz);
+
+// Standby: deep sleep until Button1, or with CONFIG_NES_ULP_STANDBY until Button1 or Start,
+// the ULP coprocessor polling them and the battery while both cores are off. Doesn't return.
+void powerStandby();
+// once at boot: a ULP wake for a flat battery goes back to sleep at once, Button1 only
+void powerStandbyCheck();
+#endif
@@ -21,9 +21,17 @@
 #include "driver/gpio.h"
 #include "soc/gpio_struct.h"
 #include "psxcontroller.h"
+#include "logring.h"
 #include "sdkconfig.h"
 #include "pretty_effect.h"
 #include <esp_deep_sleep.h>
+#include "esp_attr.h"
+#include "esp_timer.h"
+#include "settings.h"
+#include "power.h"
+#if CONFIG_HW_PSX_SPI
+#include "driver/spi_master.h"
+#endif
 
 #define PSX_CLK CONFIG_HW_PSX_CLK
 #define PSX_DAT CONFIG_HW_PSX_DAT
@@ -34,10 +42,13 @@
 
 #if CONFIG_HW_PSX_ENA
 
-int volume, bright;
 int inpDelay;
 bool shutdown;
+static bool blanked; // Button1 is down, the backlight is off until it's let go
+static bool launcher;
+static bool suspend;
 
+#if !CONFIG_HW_PSX_SPI
 /* Sends and receives a byte from/to the PSX controller using SPI */
 static int psxSendRecv(int send)
 {
@@ -82,19 +93,327 @@ static int psxSendRecv(int send)
 	return ret;
 }
 
-bool showMenu;
-
 static void psxDone()
 {
 	DELAY();
 	GPIO_REG_WRITE(GPIO_OUT_W1TS_REG, (1 << PSX_ATT));
 }
+#endif
+
+#if CONFIG_HW_PSX_SPI
+// The controller on HSPI: mode 3, LSB first, ATT as the chip select. A
+// periodic esp_timer queues one DMA transfer of the whole poll and picks up
+// the result of the one before, so polling costs the emulator nothing; it
+// only ever reads psxPad.
+#define PSX_SPI_HOST SPI2_HOST
+#define PSX_POLL_US 4000
+
+static spi_device_handle_t psxSpi;
+static spi_transaction_t psxTrans;
+static WORD_ALIGNED_ATTR uint8_t psxCmd[5] = {0x01, 0x42, 0x00, 0x00, 0x00}; // wake up, get data
+static WORD_ALIGNED_ATTR uint8_t psxRx[5];
+static volatile int psxPad = 0xffff; // psxReadInput bits, active low
+static int psxId;
+
+static void psxPollTimer(void *arg)
+{
+	spi_transaction_t *t;
+
+	if (spi_device_get_trans_result(psxSpi, &t, 0) == ESP_OK)
+	{
+		// id, 0x5a, then the two button bytes; anything else is no controller
+		psxId = psxRx[1];
+		psxPad = psxRx[2] == 0x5a ? psxRx[3] | (psxRx[4] << 8) : 0xffff;
+	}
+	spi_device_queue_trans(psxSpi, &psxTrans, 0);
+}
+
+static void psxSpiInit()
+{
+	spi_bus_config_t bus = {
+		.mosi_io_num = PSX_CMD,
+		.miso_io_num = PSX_DAT,
+		.sclk_io_num = PSX_CLK,
+		.quadwp_io_num = -1,
+		.quadhd_io_num = -1,
+		.max_transfer_sz = sizeof(psxRx),
+	};
+	spi_device_interface_config_t dev = {
+		.clock_speed_hz = 250000,
+		.mode = 3,
+		.spics_io_num = PSX_ATT,
+		.cs_ena_pretrans = 2,
+		.queue_size = 1,
+		.flags = SPI_DEVICE_TXBIT_LSBFIRST | SPI_DEVICE_RXBIT_LSBFIRST,
+	};
+	const esp_timer_create_args_t timer = {
+		.callback = &psxPollTimer,
+		.name = "psx",
+	};
+	esp_timer_handle_t handle;
+
+	if (spi_bus_initialize(PSX_SPI_HOST, &bus, SPI_DMA_CH_AUTO) != ESP_OK
+		|| spi_bus_add_device(PSX_SPI_HOST, &dev, &psxSpi) != ESP_OK)
+	{
+		printf("PSX: can't set up SPI\n");
+		return;
+	}
+	// DAT is open drain on the controller
+	gpio_pullup_en(PSX_DAT);
+	psxTrans.length = sizeof(psxCmd) * 8;
+	psxTrans.tx_buffer = psxCmd;
+	psxTrans.rx_buffer = psxRx;
+
+	// one poll up front to tell whether there is a controller
+	spi_device_transmit(psxSpi, &psxTrans);
+	psxId = psxRx[1];
+	if (psxRx[2] == 0x5a)
+		printf("PSX controller type 0x%X\n", psxId);
+	else
+		printf("No PSX/PS2 controller detected (0x%X). You will not be able to control the game.\n", psxId);
+
+	spi_device_queue_trans(psxSpi, &psxTrans, 0);
+	esp_timer_create(&timer, &handle);
+	esp_timer_start_periodic(handle, PSX_POLL_US);
+}
+#else
+static const int psxPad = 0xffff;
+#endif
+
+bool showMenu;
+
+// The pad buttons also raise GPIO interrupts on both edges. The ISR keeps
+// the debounced state and queues it, stamped, for the emulator to take at
+// the moment the game strobes $4016 (psxLatchPad). An edge within
+// PAD_DEBOUNCE_US of the last one taken on that pin is contact bounce;
+// the frame poll puts right a pin that settled the other way after it.
+// Bluetooth pads (psxPadReport) go into the same queue: an entry holds
+// pad 1, the buttons and the first Bluetooth pad together, in its low
+// half and the second Bluetooth pad, player 2, in its high half.
+#define PAD_DEBOUNCE_US 5000
+#define PAD_QUEUE 32 // power of 2
+#define PAD_PINS 8
+
+static const int padPins[PAD_PINS] = {34, 33, 32, 39, 17, 14, 35, 13};
+static const int padBits[PAD_PINS] = {16, 64, 32, 128, 1, 8, 8192 * 2, 8192};
+
+typedef struct
+{
+	uint32_t us;      // esp_timer_get_time() of the edge
+	uint32_t buttons; // pad bits of the psxReadInput words of both pads after it
+	uint8_t source;   // PAD_SOURCE_BUTTONS, or the Bluetooth pad that made it
+} padEvent_t;
+
+static portMUX_TYPE padLock = portMUX_INITIALIZER_UNLOCKED;
+static padEvent_t padQueue[PAD_QUEUE];
+static volatile int64_t padActive; // esp_timer_get_time() of the last button down or pad edge
+static volatile uint32_t padHead, padTail; // head: ISR and poll, under padLock; tail: emulator
+static volatile int padState = PAD_MASK; // the buttons'
+static volatile int padBt[2] = {PAD_MASK, PAD_MASK};
+static int64_t padEdge[PAD_PINS];
+static uint32_t padPressUs; // of the last press psxLatchPad took, 0 once read
+static int padLatched2 = PAD_MASK;
+static struct
+{
+	uint32_t sum, max, count;
+} padLatency[PAD_SOURCES]; // edge or report to the game's strobe
+
+static inline int IRAM_ATTR padLevel(int pin)
+{
+	return pin < 32 ? (GPIO.in >> pin) & 1 : (GPIO.in1.data >> (pin - 32)) & 1;
+}
+
+static inline uint32_t IRAM_ATTR padWord()
+{
+	return (padState & padBt[0]) | (uint32_t)padBt[1] << 16;
+}
+
+// under padLock
+static void IRAM_ATTR padPush(int64_t now, int source)
+{
+	padActive = now;
+	// full means nobody is playing, psxLatchPad catches up with padWord()
+	if (padHead - padTail < PAD_QUEUE)
+	{
+		padQueue[padHead % PAD_QUEUE].us = now;
+		padQueue[padHead % PAD_QUEUE].buttons = padWord();
+		padQueue[padHead % PAD_QUEUE].source = source;
+		__atomic_store_n(&padHead, padHead + 1, __ATOMIC_RELEASE);
+	}
+}
+
+static void IRAM_ATTR padIsr(void *arg)
+{
+	int i = (int)arg;
+	int64_t now = esp_timer_get_time();
+	int s;
+
+	portENTER_CRITICAL_ISR(&padLock);
+	if (now - padEdge[i] >= PAD_DEBOUNCE_US)
+	{
+		// buttons pull the pin high
+		s = padLevel(padPins[i]) ? padState & ~padBits[i] : padState | padBits[i];
+		if (s != padState)
+		{
+			padEdge[i] = now;
+			padState = s;
+			padPush(now, PAD_SOURCE_BUTTONS);
+		}
+	}
+	portEXIT_CRITICAL_ISR(&padLock);
+}
+
+// once a frame, with what the buttons read now
+static void padPoll(int levels)
+{
+	int64_t now = esp_timer_get_time();
+	int s;
+
+	portENTER_CRITICAL(&padLock);
+	s = padState;
+	for (int i = 0; i < PAD_PINS; i++)
+	{
+		if (((s ^ levels) & padBits[i]) && now - padEdge[i] >= PAD_DEBOUNCE_US)
+		{
+			s ^= padBits[i];
+			padEdge[i] = now;
+		}
+	}
+	if (s != padState)
+	{
+		padState = s;
+		padPush(now, PAD_SOURCE_BUTTONS);
+	}
+	portEXIT_CRITICAL(&padLock);
+}
+
+void psxPadReport(int player, int buttons, int64_t us)
+{
+	portENTER_CRITICAL(&padLock);
+	if (buttons != padBt[player])
+	{
+		padBt[player] = buttons;
+		padPush(us, PAD_SOURCE_BT + player);
+	}
+	portEXIT_CRITICAL(&padLock);
+}
+
+static void padInit()
+{
+	static bool installed;
+
+	if (installed)
+		return;
+	installed = true;
+	gpio_install_isr_service(ESP_INTR_FLAG_IRAM);
+	for (int i = 0; i < PAD_PINS; i++)
+	{
+		gpio_set_intr_type(padPins[i], GPIO_INTR_ANYEDGE);
+		gpio_isr_handler_add(padPins[i], padIsr, (void *)i);
+	}
+}
+
+int psxLatchPad()
+{
+	static uint32_t applied = PAD_MASK | PAD_MASK << 16;
+	uint32_t head = __atomic_load_n(&padHead, __ATOMIC_ACQUIRE);
+	uint32_t now = (uint32_t)esp_timer_get_time();
+	uint32_t flipped = 0, chg;
+	padEvent_t *e;
+
+	// the settings overlay has the buttons, the game sees them let go
+	if (showMenu)
+	{
+		__atomic_store_n(&padTail, head, __ATOMIC_RELEASE);
+		applied = padWord();
+		padLatched2 = PAD_MASK;
+		return PAD_MASK;
+	}
+	// everything that came in since the last strobe, up to a button
+	// changing back: a tap shorter than a frame still gets one press
+	while (padTail != head)
+	{
+		e = &padQueue[padTail % PAD_QUEUE];
+		chg = e->buttons ^ applied;
+		if (chg & flipped)
+			break;
+		flipped |= chg;
+		applied ^= chg;
+		if (chg & ~applied)
+			padPressUs = e->us | 1; // never 0
+		padLatency[e->source].sum += now - e->us;
+		padLatency[e->source].count++;
+		if (now - e->us > padLatency[e->source].max)
+			padLatency[e->source].max = now - e->us;
+		__atomic_store_n(&padTail, padTail + 1, __ATOMIC_RELEASE);
+	}
+	if (padTail == head && flipped == 0)
+		applied = padWord();
+	padLatched2 = applied >> 16;
+	chg = applied & 0xffff & (psxPad | ~PAD_MASK);
+#if CONFIG_NES_REWIND
+	// Select+Left is the rewind button, not for the game
+	if ((chg & (1 | 128)) == 0)
+		return chg | 1 | 128;
+#endif
+#if CONFIG_NES_FASTFORWARD
+	// and Select+Right fast-forward
+	if ((chg & (1 | 32)) == 0)
+		return chg | 1 | 32;
+#endif
+#if CONFIG_NES_SNAPSHOT
+	// and Select+Up the screenshot
+	if ((chg & (1 | 16)) == 0)
+		return chg | 1 | 16;
+#endif
+	return chg;
+}
+
+int psxLatchPad2()
+{
+	return padLatched2;
+}
+
+uint32_t psxPressTime()
+{
+	uint32_t us = padPressUs;
+
+	padPressUs = 0;
+	return us;
+}
+
+int psxLatency(int source, uint32_t *maxUs)
+{
+	int avg = padLatency[source].count ? padLatency[source].sum / padLatency[source].count : -1;
+
+	*maxUs = padLatency[source].max;
+	padLatency[source].sum = padLatency[source].max = padLatency[source].count = 0;
+	return avg;
+}
 
 bool getShowMenu()
 {
 	return showMenu;
 }
 
+// the pad and the other buttons, the menu reads them all without psxReadInput
+static const int idlePins[] = {12, 13, 14, 16, 17, 32, 33, 34, 35, 39};
+
+int psxIdleMs()
+{
+	int64_t now = esp_timer_get_time();
+
+	for (int i = 0; i < sizeof(idlePins) / sizeof(idlePins[0]); i++)
+	{
+		if (gpio_get_level(idlePins[i]) == 1)
+		{
+			padActive = now;
+			break;
+		}
+	}
+	return (int)((now - padActive) / 1000);
+}
+
 int psxReadInput()
 {
 	/*int b1, b2;
@@ -112,38 +431,39 @@ int psxReadInput()
 	{
 		if (gpio_get_level(34) == 1 && inpDelay == 0)
 		{
-			if (volume < 4)
-				volume += 1;
+			settings_set(SETTING_VOLUME, settings.volume + 1);
 			inpDelay = 15;
 		}
 		if (gpio_get_level(33) == 1 && inpDelay == 0)
 		{
-			if (volume > 0)
-				volume -= 1;
+			settings_set(SETTING_VOLUME, settings.volume - 1);
 			inpDelay = 15;
 		}
 		if (gpio_get_level(32) == 1 && inpDelay == 0)
 		{
-			if (bright < 4)
-				bright += 1;
+			settings_set(SETTING_BRIGHT, settings.bright + 1);
 			inpDelay = 15;
 		}
 		if (gpio_get_level(39) == 1 && inpDelay == 0)
 		{
-			if (bright > 0)
-				bright -= 1;
+			settings_set(SETTING_BRIGHT, settings.bright - 1);
 			inpDelay = 15;
 		}
 		if (gpio_get_level(35) == 1 && inpDelay == 0)
 		{
-			getYStretch() ? setYStretch(0) : setYStretch(1);
+			settings_set(SETTING_YSTRETCH, !settings.yStretch);
 			inpDelay = 15;
 		}
 		if (gpio_get_level(13) == 1 && inpDelay == 0)
 		{
-			getXStretch() ? setXStretch(0) : setXStretch(1);
+			settings_set(SETTING_XSTRETCH, !settings.xStretch);
 			inpDelay = 15;
 		}
+		// save states, held until let go so they fire once
+		if (gpio_get_level(14) == 1)
+			b2b1 -= 512; // save
+		if (gpio_get_level(17) == 1)
+			b2b1 -= 256; // load
 	}
 	// Bit0 Bit1 Bit2 Bit3 Bit4 Bit5 Bit6 Bit7
 	// SLCT           STRT UP   RGHT DOWN LEFT
@@ -166,6 +486,22 @@ int psxReadInput()
 			b2b1 -= 8192 * 2; // 4096;//B
 		if (gpio_get_level(13) == 1)
 			b2b1 -= 8192; // A
+		padPoll(b2b1 & PAD_MASK);
+#if CONFIG_NES_REWIND
+		// Select+Left: rewind instead
+		if ((b2b1 & (1 | 128)) == 0)
+			b2b1 += 1 + 128 - 1024;
+#endif
+#if CONFIG_NES_FASTFORWARD
+		// Select+Right: fast-forward instead
+		if ((b2b1 & (1 | 32)) == 0)
+			b2b1 += 1 + 32 - 2048;
+#endif
+#if CONFIG_NES_SNAPSHOT
+		// Select+Up: screenshot instead
+		if ((b2b1 & (1 | 16)) == 0)
+			b2b1 += 1 + 16 - 4;
+#endif
 	}
 	// Button2
 	if (gpio_get_level(16) == 1 && inpDelay == 0)
@@ -173,32 +509,28 @@ int psxReadInput()
 		showMenu = showMenu ? 0 : 1;
 		inpDelay = 15;
 	}
-	// Button1
+	// Button1: short press goes back to the menu, long press switches off
 	if (gpio_get_level(12) == 1)
 	{
-		bright = -1;
+		blanked = true;
 		inpDelay += 2;
-		printf("delay %d\n", inpDelay);
+		logPrintf("delay %d\n", inpDelay);
 	}
 
-	if (bright == -1 && inpDelay == 0)
+	if (blanked && inpDelay == 0)
 	{
-		esp_sleep_enable_timer_wakeup(1000 * 100);
-		vTaskDelay(100);
-		esp_deep_sleep_start();
+		blanked = false;
+		showMenu = 0;
+		launcher = 1;
 	}
 
-	if (bright == -1 && inpDelay > 100)
+	// held: main.c snapshots the game and sleeps, see psxSleep()
+	if (blanked && inpDelay > 100)
 	{
-		bright = -2;
-		shutdown = 1;
-		esp_deep_sleep_pd_config(ESP_PD_DOMAIN_RTC_PERIPH, ESP_PD_OPTION_AUTO);
-		gpio_pullup_dis(12);
-		gpio_pulldown_en(12);
-		esp_deep_sleep_enable_ext0_wakeup(12, 1);
-
-		vTaskDelay(1500);
-		esp_deep_sleep_start();
+		blanked = false;
+		showMenu = 0;
+		suspend = 1;
+		inpDelay = 0;
 	}
 
 	return b2b1;
@@ -208,25 +540,47 @@ int psxReadInput()
 
 int getBright()
 {
-	return bright;
+	return blanked ? -1 : settings.bright;
 }
 
-int getVolume()
+bool getShutdown()
 {
-	return volume;
+	return shutdown;
 }
 
-bool getShutdown()
+bool getLauncher()
 {
-	return shutdown;
+	bool ret = launcher;
+
+	launcher = 0;
+	return ret;
+}
+
+bool getSuspend()
+{
+	bool ret = suspend;
+
+	suspend = 0;
+	return ret;
+}
+
+void psxSleep()
+{
+	// wait for the button to be let go, it is what wakes us
+	while (gpio_get_level(12) == 1)
+		vTaskDelay(10);
+	powerStandby();
 }
 
 void psxcontrollerInit()
 {
-	volatile int delay;
-	int t;
 	showMenu = 0;
 	shutdown = 0;
+#if CONFIG_HW_PSX_SPI
+	psxSpiInit();
+#else
+	volatile int delay;
+	int t;
 	/*gpio_config_t gpioconf[2]={
 		{
 			.pin_bit_mask=(1<<PSX_CLK)|(1<<PSX_CMD)|(1<<PSX_ATT),
@@ -266,9 +620,12 @@ void psxcontrollerInit()
 	{
 		printf("PSX controller type 0x%X\n", t);
 	}
+#endif
 	inpDelay = 0;
-	volume = 0;
-	bright = 2;
+	blanked = false;
+	launcher = 0;
+	suspend = 0;
+	padInit();
 }
 
 #else
@@ -278,6 +635,51 @@ int psxReadInput()
 	return 0xFFFF;
 }
 
+bool getLauncher()
+{
+	return false;
+}
+
+bool getSuspend()
+{
+	return false;
+}
+
+int psxLatchPad()
+{
+	return PAD_MASK;
+}
+
+int psxLatchPad2()
+{
+	return PAD_MASK;
+}
+
+void psxPadReport(int player, int buttons, int64_t us)
+{
+}
+
+int psxLatency(int source, uint32_t *maxUs)
+{
+	*maxUs = 0;
+	return -1;
+}
+
+uint32_t psxPressTime()
+{
+	return 0;
+}
+
+int psxIdleMs()
+{
+	return 0;
+}
+
+void psxSleep()
+{
+	esp_deep_sleep_start();
+}
+
 void psxcontrollerInit()
 {
 	printf("PSX controller disabled in menuconfig; no input enabled.\n");
@@ -1,10 +1,37 @@
 #ifndef PSXCONTROLLER_H
 #define PSXCONTROLLER_H
+#include <stdint.h>
+#include <stdbool.h>
+
+// psxReadInput bits of the NES pad buttons: select, start, the cross, A and B
+#define PAD_MASK (1 | 8 | 16 | 32 | 64 | 128 | 8192 | 16384)
 
 int psxReadInput();
+// pad bits as of now, fed by the button interrupts, for when the game reads the pad
+int psxLatchPad();
+// player 2's pad bits as of the last psxLatchPad, a Bluetooth pad's
+int psxLatchPad2();
+// a Bluetooth pad's buttons changed, psxReadInput bits, player 0 or 1, us its esp_timer_get_time()
+void psxPadReport(int player, int buttons, int64_t us);
+// what psxLatency is asked about: the buttons, or Bluetooth pad 0 or 1
+#define PAD_SOURCE_BUTTONS 0
+#define PAD_SOURCE_BT 1
+#define PAD_SOURCES 3
+// average us from a change to the game strobing it since the last call, -1 if none; the max in maxUs
+int psxLatency(int source, uint32_t *maxUs);
+// esp_timer_get_time() of the edge of the last press psxLatchPad passed on, 0 if none since the last call
+uint32_t psxPressTime();
+// ms since a button was last down, for the LCD idle dimming; looks at all the buttons itself
+int psxIdleMs();
 void psxcontrollerInit();
 bool getShowMenu();
+// the backlight setting, -1 while Button1 blanks it; the volume is settings.volume
 int getBright();
-int getVolume();
 bool getShutdown();
+// true once after Button1 was tapped, the emulator should go back to the menu
+bool getLauncher();
+// true once after Button1 was held in a game, the game should be suspended
+bool getSuspend();
+// deep sleep until Button1 is pressed again
+void psxSleep();
 #endif
\ No newline at end of file
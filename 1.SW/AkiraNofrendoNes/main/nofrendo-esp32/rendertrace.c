@@ -0,0 +1,137 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include "sdkconfig.h"
+#include "rendertrace.h"
+
+#if CONFIG_NES_RENDER_TRACE
+#include "nofrendo/nes/nes.h"
+#include "nofrendo/nes/nes_rtrace.h"
+#include "memplace.h"
+#include "romsd.h"
+
+#define RTRACE_BYTES (CONFIG_NES_RENDER_TRACE_KB * 1024)
+#define RTRACE_COMBO ((1 << 0) | (1 << 14)) // SELECT and B, psxReadInput's bits
+#define RTRACE_PASSES 3
+
+static uint8_t *buf;
+static bool capturing;
+static bool started; // the card's trace, if any, has been replayed for this game
+static int oldButtons = 0xffff;
+
+static void tracePath(char *path, int len, uint32_t crc)
+{
+	snprintf(path, len, ROMSD_MOUNT "/%08X.trc", (unsigned)crc);
+}
+
+static void bench(int len, const char *what)
+{
+	rtrace_result_t r;
+
+	if (rtrace_bench(buf, len, RTRACE_PASSES, &r))
+	{
+		printf("rtrace: %s doesn't replay with this game\n", what);
+		return;
+	}
+	printf("rtrace: %s, %d frames x %d: ppu %u us/frame, blit %u us/frame, hash %08X\n", what, r.frames,
+		   RTRACE_PASSES, (unsigned)r.ppu_us, (unsigned)r.blit_us, (unsigned)r.hash);
+}
+
+// the game's trace from the card, if there is one
+static void benchCard(uint32_t crc)
+{
+	char path[32];
+	FILE *fp;
+	int len;
+
+	if (!romsd_mounted())
+		return;
+	tracePath(path, sizeof(path), crc);
+	fp = fopen(path, "rb");
+	if (fp == NULL)
+		return;
+	len = fread(buf, 1, RTRACE_BYTES, fp);
+	fclose(fp);
+	memplace_traffic(len);
+	bench(len, path);
+}
+
+static void saveCard(int len, uint32_t crc)
+{
+	char path[32];
+	FILE *fp;
+
+	if (!romsd_mounted())
+	{
+		printf("rtrace: %d bytes, no SD card to keep them on\n", len);
+		return;
+	}
+	tracePath(path, sizeof(path), crc);
+	fp = fopen(path, "wb");
+	if (fp == NULL || fwrite(buf, 1, len, fp) != len)
+		printf("rtrace: can't write %s\n", path);
+	else
+		printf("rtrace: %d bytes to %s\n", len, path);
+	if (fp)
+		fclose(fp);
+	memplace_traffic(len);
+}
+
+void rendertraceStart()
+{
+	// PSRAM: a capture only adds a few bytes per PPU call
+	if (buf == NULL)
+	{
+		buf = memplace_alloc(MEM_COLD, RTRACE_BYTES);
+		if (buf == NULL)
+			printf("rtrace: no room for %d KB\n", CONFIG_NES_RENDER_TRACE_KB);
+	}
+	rtrace_stop();
+	capturing = false;
+	started = false;
+}
+
+void rendertraceFrame(int buttons)
+{
+	// both held now and not both a frame ago
+	bool combo = (~buttons & RTRACE_COMBO) == RTRACE_COMBO && (~oldButtons & RTRACE_COMBO) != RTRACE_COMBO;
+	uint32_t crc;
+	int len;
+
+	oldButtons = buttons;
+	if (buf == NULL)
+		return;
+	crc = nes_getcontextptr()->rominfo->crc;
+	if (!started)
+	{
+		started = true;
+		benchCard(crc);
+	}
+
+	if (capturing)
+	{
+		len = rtrace_done();
+		if (len == 0)
+			return;
+		capturing = false;
+		saveCard(len, crc);
+		bench(len, "capture");
+	}
+	else if (combo)
+	{
+		printf("rtrace: capturing %d frames\n", CONFIG_NES_RENDER_TRACE_FRAMES);
+		rtrace_capture(buf, RTRACE_BYTES, CONFIG_NES_RENDER_TRACE_FRAMES);
+		capturing = true;
+	}
+}
+
+#else /* !CONFIG_NES_RENDER_TRACE */
+
+void rendertraceStart()
+{
+}
+
+void rendertraceFrame(int buttons)
+{
+}
+
+#endif /* !CONFIG_NES_RENDER_TRACE */
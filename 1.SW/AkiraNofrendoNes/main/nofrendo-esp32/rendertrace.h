@@ -0,0 +1,15 @@
+#ifndef RENDERTRACE_H
+#define RENDERTRACE_H
+
+// The core's render trace on the device (CONFIG_NES_RENDER_TRACE). SELECT and B pressed together
+// capture the next CONFIG_NES_RENDER_TRACE_FRAMES frames of PPU calls into PSRAM; the trace goes
+// to the SD card as /sd/<ROM CRC>.trc and is replayed there and then, with the display off and
+// through the LCD, with the times printed over UART. A game that has a trace on the card gets
+// it replayed when it starts, so firmware builds can be compared on the same frames. host/nesbench
+// -P replays the same files.
+
+// a game is starting
+void rendertraceStart();
+// once a frame, with psxReadInput's buttons
+void rendertraceFrame(int buttons);
+#endif
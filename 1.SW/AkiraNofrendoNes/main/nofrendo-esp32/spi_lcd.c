@@ -14,6 +14,8 @@
 
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
 #include "sdkconfig.h"
 #include "rom/ets_sys.h"
 #include "rom/gpio.h"
@@ -21,24 +23,20 @@
 #include "soc/gpio_sig_map.h"
 #include "soc/gpio_struct.h"
 #include "soc/io_mux_reg.h"
-#include "soc/spi_reg.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
-#include "driver/periph_ctrl.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "driver/gpio.h"
 #include "spi_lcd.h"
+#include "lcd_bus.h"
 #include "psxcontroller.h"
 #include "driver/ledc.h"
 #include "pretty_effect.h"
+#include "settings.h"
 
-#define PIN_NUM_MISO CONFIG_HW_LCD_MISO_GPIO
-#define PIN_NUM_MOSI CONFIG_HW_LCD_MOSI_GPIO
-#define PIN_NUM_CLK  CONFIG_HW_LCD_CLK_GPIO
-#define PIN_NUM_CS   CONFIG_HW_LCD_CS_GPIO
-#define PIN_NUM_DC   CONFIG_HW_LCD_DC_GPIO
 #define PIN_NUM_RST  CONFIG_HW_LCD_RESET_GPIO
 //#define PIN_NUM_BCKL CONFIG_HW_LCD_BL_GPIO
-#define LCD_SEL_CMD()   GPIO.out_w1tc = (1 << PIN_NUM_DC) // Low to send command 
-#define LCD_SEL_DATA()  GPIO.out_w1ts = (1 << PIN_NUM_DC) // High to send data
 #define LCD_RST_SET()   GPIO.out_w1ts = (1 << PIN_NUM_RST) 
 #define LCD_RST_CLR()   GPIO.out_w1tc = (1 << PIN_NUM_RST)
 
@@ -55,13 +53,30 @@
 #define LCD_BKG_OFF()   GPIO.out_w1tc = (1 << PIN_NUM_BCKL) //Backlight OFF
 #endif
 
-#define SPI_NUM  0x3
+#define LCD_LINE_WIDTH  320
+#define LCD_LINE_BYTES  (LCD_LINE_WIDTH*2)
+#define LCD_HEIGHT      240
+
+//Size of the emulator picture fed to ili9341_write_frame
+#define LCD_SRC_WIDTH   256
+#define LCD_SRC_HEIGHT  224
+
+#if CONFIG_LCD_SCALE_INTEGER
+#define LCD_SCALE_DEFAULT_MODE LCD_SCALE_INTEGER
+#elif CONFIG_LCD_SCALE_ASPECT
+#define LCD_SCALE_DEFAULT_MODE LCD_SCALE_ASPECT
+#else
+#define LCD_SCALE_DEFAULT_MODE LCD_SCALE_DEFAULT
+#endif
 
 #define LCD_TYPE_ILI 0
 #define LCD_TYPE_ST 1
 
 ledc_channel_config_t ledc_channel;
 
+//Two DMA-capable buffers of LCD_BUF_LINES lines: one is being sent while the other one is built
+static uint32_t *lcd_line_buf[2];
+
 /*void initBCKL(){
 	ledc_timer_config_t ledc_timer = {
         .duty_resolution = LEDC_TIMER_13_BIT,
@@ -94,23 +109,18 @@ void setBrightness(int bright){
 	setBright(bright);
 }
 
-static void spi_write_byte(const uint8_t data){
-    SET_PERI_REG_BITS(SPI_MOSI_DLEN_REG(SPI_NUM), SPI_USR_MOSI_DBITLEN, 0x7, SPI_USR_MOSI_DBITLEN_S);
-    WRITE_PERI_REG((SPI_W0_REG(SPI_NUM)), data);
-    SET_PERI_REG_MASK(SPI_CMD_REG(SPI_NUM), SPI_USR);
-    while (READ_PERI_REG(SPI_CMD_REG(SPI_NUM))&SPI_USR);
-}
-
 static void LCD_WriteCommand(const uint8_t cmd)
 {
-    LCD_SEL_CMD();
-    spi_write_byte(cmd);
+    lcd_bus_cmd(cmd);
 }
 
 static void LCD_WriteData(const uint8_t data)
 {
-    LCD_SEL_DATA();
-    spi_write_byte(data);
+    lcd_bus_data(data);
+}
+
+int ili9341_get_clock_khz(){
+    return lcd_bus_clock_khz();
 }
 
 static void  ILI9341_INITIAL ()
@@ -329,8 +339,10 @@ static void  ILI9341_INITIAL ()
 
 
     LCD_WriteCommand(0x11);    //Exit Sleep
+    lcd_bus_wait();
     ets_delay_us(100000);
     LCD_WriteCommand(0x29);    //Display on
+    lcd_bus_wait();
     ets_delay_us(100000);
 
 
@@ -339,62 +351,31 @@ static void  ILI9341_INITIAL ()
 
 static void ili_gpio_init()
 {
+#if CONFIG_HW_LCD_BUS_SPI
     PIN_FUNC_SELECT(PERIPHS_IO_MUX_GPIO21_U,2);   //DC PIN
     PIN_FUNC_SELECT(PERIPHS_IO_MUX_GPIO18_U,2);   //RESET PIN
     PIN_FUNC_SELECT(PERIPHS_IO_MUX_GPIO5_U,2);    //BKL PIN
     WRITE_PERI_REG(GPIO_ENABLE_W1TS_REG, BIT21|BIT18|BIT5);
+#else
+    //DC is one of the bus's signals there
+    gpio_set_direction(PIN_NUM_RST, GPIO_MODE_OUTPUT);
+    gpio_set_direction(PIN_NUM_BCKL, GPIO_MODE_OUTPUT);
+#endif
 }
 
-static void spi_master_init()
+//The line buffers belong to the pipeline, whichever bus sends them
+static void ili_alloc_lines()
 {
-    periph_module_enable(PERIPH_VSPI_MODULE);
-    periph_module_enable(PERIPH_SPI_DMA_MODULE);
-
-    ets_printf("lcd spi pin mux init ...\r\n");
-    PIN_FUNC_SELECT(PERIPHS_IO_MUX_GPIO19_U,2);
-    PIN_FUNC_SELECT(PERIPHS_IO_MUX_GPIO23_U,2);
-    PIN_FUNC_SELECT(PERIPHS_IO_MUX_GPIO22_U,2);
-    PIN_FUNC_SELECT(PERIPHS_IO_MUX_GPIO25_U,2);
-    WRITE_PERI_REG(GPIO_ENABLE_W1TS_REG, BIT19|BIT23|BIT22);
-
-    ets_printf("lcd spi signal init\r\n");
-    gpio_matrix_in(PIN_NUM_MISO, VSPIQ_IN_IDX,0);
-    gpio_matrix_out(PIN_NUM_MOSI, VSPID_OUT_IDX,0,0);
-    gpio_matrix_out(PIN_NUM_CLK, VSPICLK_OUT_IDX,0,0);
-    gpio_matrix_out(PIN_NUM_CS, VSPICS0_OUT_IDX,0,0);
-    ets_printf("Hspi config\r\n");
-
-    CLEAR_PERI_REG_MASK(SPI_SLAVE_REG(SPI_NUM), SPI_TRANS_DONE << 5);
-    SET_PERI_REG_MASK(SPI_USER_REG(SPI_NUM), SPI_CS_SETUP);
-    CLEAR_PERI_REG_MASK(SPI_PIN_REG(SPI_NUM), SPI_CK_IDLE_EDGE);
-    CLEAR_PERI_REG_MASK(SPI_USER_REG(SPI_NUM),  SPI_CK_OUT_EDGE);
-    CLEAR_PERI_REG_MASK(SPI_CTRL_REG(SPI_NUM), SPI_WR_BIT_ORDER);
-    CLEAR_PERI_REG_MASK(SPI_CTRL_REG(SPI_NUM), SPI_RD_BIT_ORDER);
-    CLEAR_PERI_REG_MASK(SPI_USER_REG(SPI_NUM), SPI_DOUTDIN);
-    WRITE_PERI_REG(SPI_USER1_REG(SPI_NUM), 0);
-    SET_PERI_REG_BITS(SPI_CTRL2_REG(SPI_NUM), SPI_MISO_DELAY_MODE, 0, SPI_MISO_DELAY_MODE_S);
-    CLEAR_PERI_REG_MASK(SPI_SLAVE_REG(SPI_NUM), SPI_SLAVE_MODE);
-    
-    WRITE_PERI_REG(SPI_CLOCK_REG(SPI_NUM), (1 << SPI_CLKCNT_N_S) | (1 << SPI_CLKCNT_L_S));//40MHz
-    //WRITE_PERI_REG(SPI_CLOCK_REG(SPI_NUM), SPI_CLK_EQU_SYSCLK); // 80Mhz
-    
-    SET_PERI_REG_MASK(SPI_USER_REG(SPI_NUM), SPI_CS_SETUP | SPI_CS_HOLD | SPI_USR_MOSI);
-    SET_PERI_REG_MASK(SPI_CTRL2_REG(SPI_NUM), ((0x4 & SPI_MISO_DELAY_NUM) << SPI_MISO_DELAY_NUM_S));
-    CLEAR_PERI_REG_MASK(SPI_USER_REG(SPI_NUM), SPI_USR_COMMAND);
-    SET_PERI_REG_BITS(SPI_USER2_REG(SPI_NUM), SPI_USR_COMMAND_BITLEN, 0, SPI_USR_COMMAND_BITLEN_S);
-    CLEAR_PERI_REG_MASK(SPI_USER_REG(SPI_NUM), SPI_USR_ADDR);
-    SET_PERI_REG_BITS(SPI_USER1_REG(SPI_NUM), SPI_USR_ADDR_BITLEN, 0, SPI_USR_ADDR_BITLEN_S);
-    CLEAR_PERI_REG_MASK(SPI_USER_REG(SPI_NUM), SPI_USR_MISO);
-    SET_PERI_REG_MASK(SPI_USER_REG(SPI_NUM), SPI_USR_MOSI);
-    char i;
-    for (i = 0; i < 16; ++i) {
-        WRITE_PERI_REG((SPI_W0_REG(SPI_NUM) + (i << 2)), 0);
+    for (int b = 0; b < 2; ++b) {
+        lcd_line_buf[b] = heap_caps_malloc(LCD_BUF_LINES*LCD_LINE_BYTES, MALLOC_CAP_DMA);
+        assert(lcd_line_buf[b] != NULL);
     }
 }
 
 #define U16x2toU32(m,l) ((((uint32_t)(l>>8|(l&0xFF)<<8))<<16)|(m>>8|(m&0xFF)<<8))
 
-extern uint16_t myPalette[];
+//RGB565, byte swapped for the wire by set_palette(); one per colour emphasis
+extern uint16_t myPalette[][256];
 
 char *menuText[10] = {"brightness46  0.","volume82      9."," .","hor stretch1  5.","vert stretch3 7."," .","  stretch can.", " cause graphic.", "   problems!.","*"};
 bool arrow[9][9] = {{0,0,0,0,0,0,0,0,0},
@@ -454,160 +435,647 @@ bool scale[9][9]=  {{0,0,0,0,0,0,0,0,0},
 bool lineEnd;
 bool textEnd;
 
-void ili9341_write_frame(const uint16_t xs, const uint16_t ys, const uint16_t width, const uint16_t height, const uint8_t * data[],
-							bool xStr, bool yStr){
-    int x, y;
+//Source column (-1 = border) for every LCD column, source row for every LCD line.
+//Rebuilt by ili_build_scaler() only when the stretch settings or scale mode change.
+static int16_t lcd_col[LCD_LINE_WIDTH];
+static int16_t lcd_row[LCD_HEIGHT];
+static int lcd_xstart, lcd_xend;
+//Blit kernels: the picture's span lcd_xstart..lcd_xend of a line, two pixels per word.
+//ili_build_scaler picks one whose fixed pattern is what lcd_col says, else the LUT one.
+typedef void (*ili_kernel_t)(uint32_t *dst, const uint8_t *src, const uint16_t *pal);
+static ili_kernel_t lcd_kernel;
+static int lcd_scaler_key = -1;
+//The black around the picture isn't on the panel yet: every line goes out full width until
+//a frame has been sent that way. After that only the picture's columns and rows are sent.
+static bool lcd_borders = true;
+static int lcd_scale_mode = LCD_SCALE_DEFAULT_MODE;
+
+void ili9341_set_scale_mode(int mode){
+    lcd_scale_mode = mode;
+}
+
+int ili9341_get_scale_mode(){
+    return lcd_scale_mode;
+}
+
+//Map dst display pixels starting at dst0 onto src source pixels, nearest neighbour
+static void ili_map_axis(int16_t *lut, int len, int dst0, int dst, int src){
     int i;
-    uint16_t x1, y1;
-    uint32_t xv, yv, dc;
-    uint32_t temp[16];
-    dc = (1 << PIN_NUM_DC);
-    
-    for (y=0; y<height; y++) {
-        //start line
-        x1 = xs+(width-1);
-        y1 = ys+y+(height-1);
-        xv = U16x2toU32(xs,x1);
-        yv = U16x2toU32((ys+y),y1);
-        
-        while (READ_PERI_REG(SPI_CMD_REG(SPI_NUM))&SPI_USR);
-        GPIO.out_w1tc = dc;
-        SET_PERI_REG_BITS(SPI_MOSI_DLEN_REG(SPI_NUM), SPI_USR_MOSI_DBITLEN, 7, SPI_USR_MOSI_DBITLEN_S);
-        WRITE_PERI_REG((SPI_W0_REG(SPI_NUM)), 0x2A);
-        SET_PERI_REG_MASK(SPI_CMD_REG(SPI_NUM), SPI_USR);
-        while (READ_PERI_REG(SPI_CMD_REG(SPI_NUM))&SPI_USR);
-        GPIO.out_w1ts = dc;
-        SET_PERI_REG_BITS(SPI_MOSI_DLEN_REG(SPI_NUM), SPI_USR_MOSI_DBITLEN, 31, SPI_USR_MOSI_DBITLEN_S);
-        WRITE_PERI_REG((SPI_W0_REG(SPI_NUM)), xv);
-        SET_PERI_REG_MASK(SPI_CMD_REG(SPI_NUM), SPI_USR);
-        while (READ_PERI_REG(SPI_CMD_REG(SPI_NUM))&SPI_USR);
-        GPIO.out_w1tc = dc;
-        SET_PERI_REG_BITS(SPI_MOSI_DLEN_REG(SPI_NUM), SPI_USR_MOSI_DBITLEN, 7, SPI_USR_MOSI_DBITLEN_S);
-        WRITE_PERI_REG((SPI_W0_REG(SPI_NUM)), 0x2B);
-        SET_PERI_REG_MASK(SPI_CMD_REG(SPI_NUM), SPI_USR);
-        while (READ_PERI_REG(SPI_CMD_REG(SPI_NUM))&SPI_USR);
-        GPIO.out_w1ts = dc;
-        SET_PERI_REG_BITS(SPI_MOSI_DLEN_REG(SPI_NUM), SPI_USR_MOSI_DBITLEN, 31, SPI_USR_MOSI_DBITLEN_S);
-        WRITE_PERI_REG((SPI_W0_REG(SPI_NUM)), yv);
-        SET_PERI_REG_MASK(SPI_CMD_REG(SPI_NUM), SPI_USR);
-        while (READ_PERI_REG(SPI_CMD_REG(SPI_NUM))&SPI_USR);
-        GPIO.out_w1tc = dc;
-        SET_PERI_REG_BITS(SPI_MOSI_DLEN_REG(SPI_NUM), SPI_USR_MOSI_DBITLEN, 7, SPI_USR_MOSI_DBITLEN_S);
-        WRITE_PERI_REG((SPI_W0_REG(SPI_NUM)), 0x2C);
-        SET_PERI_REG_MASK(SPI_CMD_REG(SPI_NUM), SPI_USR);
-        while (READ_PERI_REG(SPI_CMD_REG(SPI_NUM))&SPI_USR);
-        
-		if(getBright()==-1)LCD_BKG_OFF();
-		
-        x = 0;
-        GPIO.out_w1ts = dc;
-        SET_PERI_REG_BITS(SPI_MOSI_DLEN_REG(SPI_NUM), SPI_USR_MOSI_DBITLEN, 511, SPI_USR_MOSI_DBITLEN_S);
-        while (x<width) {
-			for (i=0; i<16; i++) {
-                if(data == NULL){
-                    temp[i] = 0;
-                    x += 2;
-                    continue;
+    for (i=0; i<len; i++) {
+        if (i<dst0 || i>=dst0+dst) lut[i] = -1;
+        else lut[i] = ((i-dst0)*src)/dst;
+    }
+}
+
+//Any mapping: every display pixel through lcd_col
+static void ili_kernel_lut(uint32_t *dst, const uint8_t *src, const uint16_t *pal){
+    int x;
+
+    for (x=lcd_xstart; x<lcd_xend; x+=2)
+        *dst++ = pal[src[lcd_col[x]]] | ((uint32_t)pal[src[lcd_col[x+1]]]<<16);
+}
+
+//1:1, the source read four pixels a word
+static void ili_kernel_direct(uint32_t *dst, const uint8_t *src, const uint16_t *pal){
+    const uint32_t *s = (const uint32_t *)(src + lcd_col[lcd_xstart]);
+    uint32_t q;
+    int x;
+
+    for (x=lcd_xstart; x<lcd_xend; x+=4) {
+        q = *s++;
+        *dst++ = pal[q&0xFF] | ((uint32_t)pal[(q>>8)&0xFF]<<16);
+        *dst++ = pal[(q>>16)&0xFF] | ((uint32_t)pal[q>>24]<<16);
+    }
+}
+
+//5:4, the full width stretch of 256 to 320: two source words are ten display pixels,
+//the first of every four doubled. Each source pixel is looked up once.
+static void ili_kernel_5to4(uint32_t *dst, const uint8_t *src, const uint16_t *pal){
+    const uint32_t *s = (const uint32_t *)(src + lcd_col[lcd_xstart]);
+    uint32_t a, b, a0, a1, a2, a3, b0, b1, b2, b3;
+    int x;
+
+    for (x=lcd_xstart; x<lcd_xend; x+=10) {
+        a = *s++;
+        b = *s++;
+        a0 = pal[a&0xFF]; a1 = pal[(a>>8)&0xFF]; a2 = pal[(a>>16)&0xFF]; a3 = pal[a>>24];
+        b0 = pal[b&0xFF]; b1 = pal[(b>>8)&0xFF]; b2 = pal[(b>>16)&0xFF]; b3 = pal[b>>24];
+        *dst++ = a0 | (a0<<16);
+        *dst++ = a1 | (a2<<16);
+        *dst++ = a3 | (b0<<16);
+        *dst++ = b0 | (b1<<16);
+        *dst++ = b2 | (b3<<16);
+    }
+}
+
+//lcd_col over the span goes src source pixels for every dst display pixels, from a word
+//aligned column and in whole steps of step display pixels
+static bool ili_span_is(int dst, int src, int step){
+    int base = lcd_col[lcd_xstart];
+    int i;
+
+    if (lcd_xend <= lcd_xstart || (base&3) || (lcd_xend-lcd_xstart)%step)
+        return false;
+    for (i=lcd_xstart; i<lcd_xend; i++)
+        if (lcd_col[i] != base+((i-lcd_xstart)*src)/dst) return false;
+    return true;
+}
+
+static void ili_build_scaler(const uint16_t width, const uint16_t height, bool xStr, bool yStr){
+    int key = (lcd_scale_mode<<2) | (xStr<<1) | yStr;
+    int w, i;
+
+    if (key == lcd_scaler_key)
+        return;
+    lcd_scaler_key = key;
+    ili9341_invalidate();
+    lcd_borders = true;
+
+    if (xStr)
+        ili_map_axis(lcd_col, width, 0, width, LCD_SRC_WIDTH);
+    else if (lcd_scale_mode == LCD_SCALE_ASPECT) {
+        w = (LCD_SRC_WIDTH*8)/7; //NES pixels are 8:7
+        if (w > width) w = width;
+        ili_map_axis(lcd_col, width, (width-w)/2, w, LCD_SRC_WIDTH);
+    }
+    else
+        ili_map_axis(lcd_col, width, (width-LCD_SRC_WIDTH)/2, LCD_SRC_WIDTH, LCD_SRC_WIDTH);
+
+    if (yStr)
+        ili_map_axis(lcd_row, height, 0, height, LCD_SRC_HEIGHT);
+    else if (lcd_scale_mode == LCD_SCALE_DEFAULT)
+        ili_map_axis(lcd_row, height, 0, LCD_SRC_HEIGHT, LCD_SRC_HEIGHT); //top aligned
+    else
+        ili_map_axis(lcd_row, height, (height-LCD_SRC_HEIGHT)/2, LCD_SRC_HEIGHT, LCD_SRC_HEIGHT);
+
+    //Visible span, rounded in to whole pixel pairs so the blit loop never sees a border column
+    for (i=0; i<width && lcd_col[i]<0; i++);
+    lcd_xstart = (i+1)&~1;
+    for (i=width; i>0 && lcd_col[i-1]<0; i--);
+    lcd_xend = i&~1;
+    if (lcd_xend < lcd_xstart) lcd_xend = lcd_xstart;
+
+    if (ili_span_is(1, 1, 4))
+        lcd_kernel = ili_kernel_direct;
+    else if (ili_span_is(5, 4, 10))
+        lcd_kernel = ili_kernel_5to4;
+    else
+        lcd_kernel = ili_kernel_lut;
+}
+
+//The menu box covers pixel pairs MENU_PAIR0..MENU_PAIR0+MENU_PAIRS-1 of lines MENU_Y0..MENU_Y0+MENU_H-1
+#define MENU_Y0         34
+#define MENU_H          (206-MENU_Y0+1)
+#define MENU_PAIR0      15
+#define MENU_PAIRS      128
+#define MENU_MAX_COLORS 16
+
+static uint8_t *menu_layer;
+static uint32_t menu_colors[MENU_MAX_COLORS];
+static int menu_ncolors;
+static int menu_key = -1;
+//The box lines have to go out this frame, whatever the row hashes say
+static bool menu_dirty;
+//ili9341_write_menu: the picture is on the panel already, only the box lines are sent
+static bool menu_only;
+
+//Menu overlay for the pixel pair ending at x on line y
+static void ili_menu_pair(const int x, const int y, uint16_t *px1, uint16_t *py1, bool xStr, bool yStr){
+    uint16_t x1 = *px1, y1 = *py1;
+    char actChar=' ';
+    if(y==38)textEnd=0;
+    if(x==40)lineEnd=0;
+    int line =(y-38)/18;
+    int charNo=(x-40)/16;
+    if(x<32 || x>286 || y<34 || y>206);
+    else if(x<40 || x>280 || y<38 || y>202)x1=y1=0x0F;
+    else{
+        if(!lineEnd && !textEnd){ 
+            x1=y1=0x00;
+            actChar=menuText[line][charNo];
+            //printf("char %c, x = %d, y = %d{\n",actChar,x,y);
+            //color c = [b](0to31)*1 + [g](0to31)*31 + [r] (0to31)*1024 +0x8000 --> x1=y1=c; !? 
+            if(actChar=='2' && arrow[8-((y-38)%18)/2][((x-40)%16)/2])x1=y1=0xDDDD;
+            else if(actChar=='4' && arrow[((x-40)%16)/2][((y-38)%18)/2])x1=y1=0xDDDD;
+            else if(actChar=='6' && arrow[8-((x-40)%16)/2][8-((y-38)%18)/2])x1=y1=0xDDDD;
+            else if(actChar=='8' && arrow[((y-38)%18)/2][((x-40)%16)/2])x1=y1=0xDDDD;
+            else if(actChar=='1' && buttonA[((y-38)%18)/2][((x-40)%16)/2])x1=y1=0xDDDD;
+            else if(actChar=='3' && buttonB[((y-38)%18)/2][((x-40)%16)/2])x1=y1=0xDDDD;
+            else if(actChar=='5'){
+                if(xStr && enabled[((y-38)%18)/2][((x-40)%16)/2])x1=y1=31*31+0x8000;
+                else if(!xStr && disabled[((y-38)%18)/2][((x-40)%16)/2])x1=y1=31*1024+0x8000;
+                else x1=y1=0x0F;;
+            }
+            else if(actChar=='7'){ 
+                if(yStr && enabled[((y-38)%18)/2][((x-40)%16)/2])x1=y1=31*31+0x8000;
+                else if(!yStr && disabled[((y-38)%18)/2][((x-40)%16)/2])x1=y1=31*1024+0x8000;
+                else x1=y1=0x0F;
+            }
+            else if(actChar=='0'){
+                if(scale[((y-38)%18)/2][((x-40)%16)/2] && (((x-40)%16)/2)< settings.bright*2)x1=y1=0xFFFF;
+                else if (scale[((y-38)%18)/2][((x-40)%16)/2] && (((x-40)%16)/2)>= settings.bright*2)x1=y1=0xDDDD;
+                else x1=y1=0x0F;
+            }
+            else if(actChar=='9'){
+                if(settings.volume==0 && disabled[((y-38)%18)/2][((x-40)%16)/2])x1=y1=31*1024+0x8000;
+                else x1=y1=0x0F;;
+                    
+                if(settings.volume>0){
+                    if(scale[((y-38)%18)/2][((x-40)%16)/2] && (((x-40)%16)/2)< settings.volume*2)x1=y1=0xFFFF;
+                    else if (scale[((y-38)%18)/2][((x-40)%16)/2] && (((x-40)%16)/2)>= settings.volume*2)x1=y1=0xDDDD;
+                    else x1=y1=0x0F;
                 }
-				int newX=x;
-				int newy=y;
-					//temp[i]==0x0F;
-				if(xStr)newX=newX*0.8;
-				if(yStr)newy=newy*0.94;
-				if(newX>=32&&!xStr)newX=newX-32;
-				x1 = myPalette[(unsigned char)(data[newy][newX])]; 
-				x++;
-				newX++;
-                //if(xStr)newX=newX*0.8;
-				//if(yStr)newy=newy*0.94;
-				y1 = myPalette[(unsigned char)(data[newy][newX])]; 
-				x++;
-				newX++;
-				if(!xStr && (x<=32||x>=288))x1=y1=0x00;
-				//"ambilight"
-				/*if(!xStr && x<=32)x1 = myPalette[(unsigned char)(data[newy][0])];
-				if(!xStr && x<=32)y1 = myPalette[(unsigned char)(data[newy][0])];
-				if(!xStr && x>=288)x1 = myPalette[(unsigned char)(data[newy][250])];
-				if(!xStr && x>=288)y1 = myPalette[(unsigned char)(data[newy][250])];*/
-				if(!yStr && y>=224)x1=y1=0x00;
-                if(getShowMenu()){
-					char actChar=' ';
-					if(y==38)textEnd=0;
-					if(x==40)lineEnd=0;
-					int line =(y-38)/18;
-					int charNo=(x-40)/16;
-					if(x<32 || x>286 || y<34 || y>206);
-					else if(x<40 || x>280 || y<38 || y>202)x1=y1=0x0F;
-					else{
-						if(!lineEnd && !textEnd){ 
-							x1=y1=0x00;
-							actChar=menuText[line][charNo];
-							//printf("char %c, x = %d, y = %d{\n",actChar,x,y);
-							//color c = [b](0to31)*1 + [g](0to31)*31 + [r] (0to31)*1024 +0x8000 --> x1=y1=c; !? 
-							if(actChar=='2' && arrow[8-((y-38)%18)/2][((x-40)%16)/2])x1=y1=0xDDDD;
-							else if(actChar=='4' && arrow[((x-40)%16)/2][((y-38)%18)/2])x1=y1=0xDDDD;
-							else if(actChar=='6' && arrow[8-((x-40)%16)/2][8-((y-38)%18)/2])x1=y1=0xDDDD;
-							else if(actChar=='8' && arrow[((y-38)%18)/2][((x-40)%16)/2])x1=y1=0xDDDD;
-							else if(actChar=='1' && buttonA[((y-38)%18)/2][((x-40)%16)/2])x1=y1=0xDDDD;
-							else if(actChar=='3' && buttonB[((y-38)%18)/2][((x-40)%16)/2])x1=y1=0xDDDD;
-							else if(actChar=='5'){
-								if(xStr && enabled[((y-38)%18)/2][((x-40)%16)/2])x1=y1=31*31+0x8000;
-								else if(!xStr && disabled[((y-38)%18)/2][((x-40)%16)/2])x1=y1=31*1024+0x8000;
-								else x1=y1=0x0F;;
-							}
-							else if(actChar=='7'){ 
-								if(yStr && enabled[((y-38)%18)/2][((x-40)%16)/2])x1=y1=31*31+0x8000;
-								else if(!yStr && disabled[((y-38)%18)/2][((x-40)%16)/2])x1=y1=31*1024+0x8000;
-								else x1=y1=0x0F;
-							}
-							else if(actChar=='0'){
-								if(scale[((y-38)%18)/2][((x-40)%16)/2] && (((x-40)%16)/2)< getBright()*2)x1=y1=0xFFFF;
-								else if (scale[((y-38)%18)/2][((x-40)%16)/2] && (((x-40)%16)/2)>= getBright()*2)x1=y1=0xDDDD;
-								else x1=y1=0x0F;
-								setBrightness(getBright());
-							}
-							else if(actChar=='9'){
-								if(getVolume()==0 && disabled[((y-38)%18)/2][((x-40)%16)/2])x1=y1=31*1024+0x8000;
-								else x1=y1=0x0F;;
-									
-								if(getVolume()>0){
-									if(scale[((y-38)%18)/2][((x-40)%16)/2] && (((x-40)%16)/2)< getVolume()*2)x1=y1=0xFFFF;
-									else if (scale[((y-38)%18)/2][((x-40)%16)/2] && (((x-40)%16)/2)>= getVolume()*2)x1=y1=0xDDDD;
-									else x1=y1=0x0F;
-								}
-							}
-							else if((actChar<47 || actChar>57) && peGetPixel(actChar,(x-40)%16,(y-38)%18))x1=y1=0xFFFF;//0x55;
-							else x1=y1=0x0F;
-							if(actChar=='.'){lineEnd=1;x1=y1=0x0F;}
-							if(actChar=='*'){textEnd=1;x1=y1=0x0F;}
-						}
-						else x1=y1=0x0F;
-					}
-				}
-				temp[i] = U16x2toU32(x1,y1);
-				if(getShutdown())setBrightness(getBright());
             }
-            while (READ_PERI_REG(SPI_CMD_REG(SPI_NUM))&SPI_USR);
-            for (i=0; i<16; i++) {
-                WRITE_PERI_REG((SPI_W0_REG(SPI_NUM) + (i << 2)), temp[i]);
+            else if((actChar<47 || actChar>57) && peGetPixel(actChar,(x-40)%16,(y-38)%18))x1=y1=0xFFFF;//0x55;
+            else x1=y1=0x0F;
+            if(actChar=='.'){lineEnd=1;x1=y1=0x0F;}
+            if(actChar=='*'){textEnd=1;x1=y1=0x0F;}
+        }
+        else x1=y1=0x0F;
+    }
+    *px1 = x1;
+    *py1 = y1;
+}
+
+//Line y has the menu box on it
+static bool ili_menu_line(int y){
+    return menu_layer != NULL && y>=MENU_Y0 && y<MENU_Y0+MENU_H;
+}
+
+//Build columns x0..x1-1 of display line y as RGB565 pixel pairs (already in SPI byte order)
+//into dst from the emulator line src (NULL for a black line), in the colours of pal
+static void ili_build_line(uint32_t *dst, const int y, const int x0, const int x1, const uint8_t *src,
+                            const uint16_t *pal){
+    int x = x0;
+    int i = 0;
+
+    if(src == NULL){
+        memset(dst, 0, (x1-x0)*2);
+    }
+    else {
+        for (; x<lcd_xstart; x+=2) dst[i++] = 0;
+        //myPalette is already in wire byte order, the kernels only look up and pack
+        lcd_kernel(&dst[i], src, pal);
+        i += (lcd_xend-lcd_xstart)/2;
+        x = lcd_xend;
+        for (; x<x1; x+=2) dst[i++] = 0;
+    }
+
+    //the box reaches into the border, lines with it always go out full width
+    if(ili_menu_line(y)){
+        const uint8_t *m = &menu_layer[(y-MENU_Y0)*MENU_PAIRS];
+        uint32_t *d = &dst[MENU_PAIR0];
+        for (x=0; x<MENU_PAIRS; x++) d[x] = menu_colors[m[x]];
+    }
+}
+
+//Rasterise the menu into menu_layer. The menu always paints both pixels of a pair with
+//the same colour, so the layer keeps one colour index per pixel pair.
+static void ili_build_menu(bool xStr, bool yStr){
+    int x, y, c, i = 0;
+    uint16_t x1, y1;
+    uint32_t pair;
+
+    if (menu_layer == NULL) {
+        menu_layer = malloc(MENU_PAIRS*MENU_H);
+        if (menu_layer == NULL) return;
+    }
+    menu_ncolors = 0;
+    lineEnd=textEnd=0;
+    for (y=MENU_Y0; y<MENU_Y0+MENU_H; y++) {
+        for (x=(MENU_PAIR0+1)*2; x<=(MENU_PAIR0+MENU_PAIRS)*2; x+=2) {
+            x1 = y1 = 0;
+            ili_menu_pair(x, y, &x1, &y1, xStr, yStr);
+            pair = U16x2toU32(x1,y1);
+            for (c=0; c<menu_ncolors && menu_colors[c]!=pair; c++);
+            if (c == menu_ncolors && menu_ncolors < MENU_MAX_COLORS) menu_colors[menu_ncolors++] = pair;
+            menu_layer[i++] = c;
+        }
+    }
+}
+
+static int ili_menu_key(bool xStr, bool yStr){
+    return ((getBright()+2)<<8) | (settings.volume<<4) | (xStr<<1) | yStr;
+}
+
+//Keep the cached menu layer in sync with the settings it shows. Opening, closing or changing
+//the box resends the lines under it; a brightness change recolours everything.
+static void ili_update_menu(bool xStr, bool yStr){
+    int key;
+
+    if (!getShowMenu()) {
+        if (menu_layer != NULL) {
+            free(menu_layer);
+            menu_layer = NULL;
+            menu_dirty = true;
+            lcd_borders = true; //the box was drawn over them
+        }
+        menu_key = -1;
+        return;
+    }
+    key = ili_menu_key(xStr, yStr);
+    if (key == menu_key && menu_layer != NULL)
+        return;
+    if (menu_key >= 0 && (key>>8) != (menu_key>>8))
+        ili9341_invalidate();
+    menu_key = key;
+    setBrightness(getBright());
+    ili_build_menu(xStr, yStr);
+    menu_dirty = true;
+}
+
+//Line buffer the next line gets built in
+static int line_cur;
+//Last line sent through ili9341_send_lines, to see if the window has to move
+static int lines_last = -2;
+//Display line the other buffer was built for, and from what: the next line showing the same
+//source row (vertical stretch repeats one in fifteen) sends that buffer again unconverted
+static int line_prev_y = -2;
+static int line_prev_row, line_prev_pal;
+static const uint8_t *line_prev_src;
+
+//Put the current line buffer on the wire as lines y.. of the area. With DMA the caller can
+//fill the other buffer while this one is sent. window opens a new address window at y first:
+//from line y down to the bottom of the area, lines sent after it fill the window in order.
+static void ili_send_buffer(const uint16_t xs, const uint16_t ys, const uint16_t width, const uint16_t height, int y,
+							int bytes, bool window){
+    if (window) lcd_bus_window(xs, xs+width-1, ys+y, ys+height-1);
+	if(getBright()==-1)LCD_BKG_OFF();
+    lcd_bus_send(lcd_line_buf[line_cur], bytes);
+    line_cur ^= 1;
+}
+
+//Build display line y and put it on the wire, overlapping the transfer of the previous line.
+//Full width while the borders are still to be cleared, else only the picture's columns.
+static void ili_send_line(const uint16_t xs, const uint16_t ys, const uint16_t width, const uint16_t height, int y,
+							const uint8_t *src, int pal, bool window){
+    int x0 = lcd_borders ? 0 : lcd_xstart;
+    int x1 = lcd_borders ? width : lcd_xend;
+
+    //only one send is out at a time, so the repeat waits for the first and line_cur stays free
+    if (!window && y == line_prev_y+1 && lcd_row[y] == line_prev_row && src == line_prev_src &&
+        pal == line_prev_pal && !ili_menu_line(y) && !ili_menu_line(line_prev_y)) {
+        line_cur ^= 1;
+        ili_send_buffer(xs+x0, ys, x1-x0, height, y, (x1-x0)*2, false);
+        lines_last = -2;
+        line_prev_y = y;
+        return;
+    }
+    ili_build_line(lcd_line_buf[line_cur], y, x0, x1, src, myPalette[pal]);
+    ili_send_buffer(xs+x0, ys, x1-x0, height, y, (x1-x0)*2, window);
+    lines_last = -2;
+    line_prev_y = y;
+    line_prev_row = lcd_row[y];
+    line_prev_src = src;
+    line_prev_pal = pal;
+}
+
+//A line that only shows border, which is on the panel already
+static bool ili_border_line(int y){
+    return !lcd_borders && lcd_row[y] < 0;
+}
+
+//Wait until the last line is out
+static void ili_flush_lines(){
+    lcd_bus_wait();
+}
+
+//Raw line interface for the launcher, which renders its own RGB565 (wire byte order) lines
+uint16_t *ili9341_get_lines_buffer(){
+    return (uint16_t *)lcd_line_buf[line_cur];
+}
+
+void ili9341_send_lines(int ypos, int nlines){
+    ili_send_buffer(0, 0, LCD_LINE_WIDTH, LCD_HEIGHT, ypos, nlines*LCD_LINE_BYTES, ypos != lines_last+1);
+    lines_last = ypos+nlines-1;
+    line_prev_y = -2;
+}
+
+void ili9341_wait_lines(){
+    ili_flush_lines();
+}
+
+static const uint8_t *ili_src_row(const uint8_t * data[], int y){
+    if (data == NULL || lcd_row[y] < 0)
+        return NULL;
+    return data[lcd_row[y]];
+}
+
+static int ili_src_pal(const uint8_t *linePal, int y){
+    if (linePal == NULL || lcd_row[y] < 0)
+        return 0;
+    return linePal[lcd_row[y]];
+}
+
+//Hash of every source row as last sent; only lines whose row changed get sent again
+static uint32_t lcd_row_hash[LCD_SRC_HEIGHT];
+static bool lcd_row_dirty[LCD_SRC_HEIGHT];
+static bool lcd_full_refresh = true;
+
+void ili9341_invalidate(){
+    lcd_full_refresh = true;
+}
+
+static uint32_t ili_hash_row(const uint8_t *row, int pal){
+    const uint32_t *w = (const uint32_t *)row;
+    uint32_t h = 0x811C9DC5 ^ pal; //same pixels in another palette are a change too
+    int i;
+
+    for (i=0; i<LCD_SRC_WIDTH/4; i++) h = (h ^ w[i]) * 16777619;
+    return h;
+}
+
+static void ili_mark_dirty(const uint8_t *data[], const uint8_t *linePal){
+    uint32_t h;
+    int r;
+
+    for (r=0; r<LCD_SRC_HEIGHT; r++) {
+        h = ili_hash_row(data[r], linePal ? linePal[r] : 0);
+        lcd_row_dirty[r] = (h != lcd_row_hash[r]);
+        lcd_row_hash[r] = h;
+    }
+}
+
+//First line at or after y that has to be sent this frame
+static int ili_next_line(int y, const uint16_t height){
+    if (lcd_full_refresh) {
+        while (y<height && ili_border_line(y)) y++;
+        return y;
+    }
+    for (; y<height; y++) {
+        if (lcd_row[y]>=0 && lcd_row_dirty[lcd_row[y]]) break;
+        if (menu_dirty && y>=MENU_Y0 && y<MENU_Y0+MENU_H) break;
+    }
+    return y;
+}
+
+#if CONFIG_HW_LCD_CHAIN
+//The first line after y that isn't sent right after the one before it
+static int ili_run_end(int y, const uint16_t height){
+    for (y++; y<height && ili_next_line(y, height) == y; y++);
+    return y;
+}
+
+//A line of the last run went out before it was built, the panel is behind the row hashes
+static bool lcd_chain_late;
+
+//Lines y..end-1 as one chained transfer in a window of their own, see lcd_bus_chain_begin.
+//A line that repeats the one above is copied instead of built. False, before anything was
+//sent, if the bus has no ring.
+static bool ili_chain_lines(const uint16_t xs, const uint16_t ys, const uint16_t width, const uint16_t height,
+                            int y, int end, const uint8_t *data[], const uint8_t *linePal){
+    int x0 = lcd_borders ? 0 : lcd_xstart;
+    int x1 = lcd_borders ? width : lcd_xend;
+    int bytes = (x1-x0)*2;
+    const uint32_t *prev = NULL;
+    uint32_t *buf;
+
+    lcd_bus_window(xs+x0, xs+x1-1, ys+y, ys+height-1);
+    if (!lcd_bus_chain_begin((end-y)*bytes)) return false;
+    if(getBright()==-1)LCD_BKG_OFF();
+    for (; y<end; y++) {
+        buf = lcd_bus_chain_line();
+        if (prev && lcd_row[y] == lcd_row[y-1] && !ili_menu_line(y) && !ili_menu_line(y-1))
+            memcpy(buf, prev, bytes);
+        else
+            ili_build_line(buf, y, x0, x1, ili_src_row(data, y), myPalette[ili_src_pal(linePal, y)]);
+        lcd_bus_chain_push(bytes);
+        prev = buf;
+    }
+    if (!lcd_bus_chain_end()) lcd_chain_late = true;
+    lines_last = -2;
+    line_prev_y = -2;
+    return true;
+}
+#endif
+
+#define LCD_AWAKE  0
+#define LCD_DIMMED 1
+#define LCD_ASLEEP 2
+#define LCD_SLEEP_SETTLE_US 120000 //sleep-in to sleep-out, or back, is at least this long
+static int lcd_power = LCD_AWAKE;
+static int64_t lcd_power_us;
+
+bool ili9341_awake(){
+    int idle = psxIdleMs();
+    int state = LCD_AWAKE;
+    int64_t wait;
+
+#if CONFIG_LCD_SLEEP_SECONDS
+    if (idle >= CONFIG_LCD_SLEEP_SECONDS*1000) state = LCD_ASLEEP;
+    else
+#endif
+#if CONFIG_LCD_DIM_SECONDS
+    if (idle >= CONFIG_LCD_DIM_SECONDS*1000) state = LCD_DIMMED;
+#endif
+    if (state == lcd_power)
+        return state != LCD_ASLEEP;
+
+    if (lcd_power == LCD_ASLEEP || state == LCD_ASLEEP) {
+        wait = lcd_power_us + LCD_SLEEP_SETTLE_US - esp_timer_get_time();
+        if (wait > 0) vTaskDelay(wait/1000/portTICK_PERIOD_MS + 1);
+    }
+    if (lcd_power == LCD_ASLEEP) {
+        LCD_WriteCommand(0x11);    //Sleep out
+        lcd_bus_wait();
+        ets_delay_us(5000);
+        LCD_WriteCommand(0x29);    //Display on
+        lcd_bus_wait();
+        //GRAM kept its picture, but whatever changed since has to go out
+        ili9341_invalidate();
+        lcd_power_us = esp_timer_get_time();
+    }
+    if (state == LCD_ASLEEP) {
+        setBrightness(-2);
+        LCD_WriteCommand(0x28);    //Display off
+        LCD_WriteCommand(0x10);    //Sleep in
+        lcd_bus_wait();
+        lcd_power_us = esp_timer_get_time();
+    } else {
+        setBrightness(state == LCD_DIMMED ? 0 : getBright());
+    }
+    lcd_power = state;
+    return state != LCD_ASLEEP;
+}
+
+static int lcd_time_row = -1;
+static int64_t lcd_row_us;
+
+void ili9341_time_row(int row){
+    lcd_time_row = row;
+    lcd_row_us = 0;
+}
+
+int64_t ili9341_row_time(){
+    return lcd_row_us;
+}
+
+void ili9341_write_frame(const uint16_t xs, const uint16_t ys, const uint16_t width, const uint16_t height, const uint8_t * data[],
+							const uint8_t *linePal, bool xStr, bool yStr){
+    int y;
+    int last = -2;
+
+    ili_build_scaler(width, height, xStr, yStr);
+    ili_update_menu(xStr, yStr);
+    if(getShutdown())setBrightness(getBright());
+    if(!ili9341_awake())return;
+    if (data == NULL || menu_layer != NULL) lcd_borders = true;
+    line_prev_y = -2;
+    if (menu_only && !lcd_full_refresh && data != NULL)
+        memset(lcd_row_dirty, 0, sizeof(lcd_row_dirty));
+#if CONFIG_HW_LCD_PARTIAL
+    else if (data == NULL) lcd_full_refresh = true;
+    else ili_mark_dirty(data, linePal);
+#else
+    else lcd_full_refresh = true;
+#endif
+    //a full frame is one window, partial updates need a new one after every gap
+    for (y=ili_next_line(0, height); y<height; y=ili_next_line(y+1, height)) {
+#if CONFIG_HW_LCD_CHAIN
+        //every run of lines in one go, but for the latency test, which times a line
+        if (y != last+1 && lcd_time_row < 0) {
+            int end = ili_run_end(y, height);
+
+            if (end-y > 1 && ili_chain_lines(xs, ys, width, height, y, end, data, linePal)) {
+                y = last = end-1;
+                continue;
             }
-            SET_PERI_REG_MASK(SPI_CMD_REG(SPI_NUM), SPI_USR);
         }
+#endif
+        ili_send_line(xs, ys, width, height, y, ili_src_row(data, y), ili_src_pal(linePal, y), y != last+1);
+        last = y;
+        if (lcd_time_row >= 0 && lcd_row[y] >= lcd_time_row) {
+            //costs this one line its overlap with building the next
+            ili_flush_lines();
+            lcd_row_us = esp_timer_get_time();
+            lcd_time_row = -1;
+        }
+    }
+    ili_flush_lines();
+    lcd_time_row = -1;
+    //A blank frame leaves nothing to compare the next one against
+    lcd_full_refresh = (data == NULL);
+#if CONFIG_HW_LCD_CHAIN
+    //nor does one that had a line go out before it was built
+    if (lcd_chain_late) lcd_full_refresh = true;
+    lcd_chain_late = false;
+#endif
+    menu_dirty = false;
+    //this one went out whole, black around the picture included
+    if (menu_layer == NULL) lcd_borders = false;
+}
+
+void ili9341_write_menu(const uint16_t xs, const uint16_t ys, const uint16_t width, const uint16_t height, const uint8_t * data[],
+							const uint8_t *linePal, bool xStr, bool yStr){
+    if (getShowMenu() && menu_layer != NULL && ili_menu_key(xStr, yStr) == menu_key)
+        return;
+    menu_only = true;
+    ili9341_write_frame(xs, ys, width, height, data, linePal, xStr, yStr);
+    menu_only = false;
+}
+
+#if CONFIG_HW_LCD_BEAM_RACE
+//Beam racing: the emulator hands over its lines as they are rendered and they go out
+//to the panel right away, so there is no full frame buffer and no frame of latency.
+static uint16_t stream_xs, stream_ys, stream_w, stream_h;
+static int stream_y, stream_last;
+
+bool ili9341_stream_begin(const uint16_t xs, const uint16_t ys, const uint16_t width, const uint16_t height,
+							bool xStr, bool yStr){
+    ili_build_scaler(width, height, xStr, yStr);
+    ili_update_menu(xStr, yStr);
+    if(getShutdown())setBrightness(getBright());
+    if(!ili9341_awake())return false;
+    stream_xs = xs;
+    stream_ys = ys;
+    stream_w = width;
+    stream_h = height;
+    stream_y = 0;
+    stream_last = -2;
+    line_prev_y = -2;
+    if (menu_layer != NULL) lcd_borders = true;
+    //the row hashes don't follow the stream, a later write_frame has to start over
+    ili9341_invalidate();
+    return true;
+}
+
+//Send every display line up to and including the ones showing emulator line row
+void ili9341_stream_row(int row, const uint8_t *line, int pal){
+    while (stream_y<stream_h && lcd_row[stream_y]<=row) {
+        if (!ili_border_line(stream_y)) {
+            ili_send_line(stream_xs, stream_ys, stream_w, stream_h, stream_y,
+                            (lcd_row[stream_y]<0) ? NULL : line, pal, stream_y != stream_last+1);
+            stream_last = stream_y;
+        }
+        stream_y++;
     }
-    while (READ_PERI_REG(SPI_CMD_REG(SPI_NUM))&SPI_USR);
 }
 
+void ili9341_stream_end(){
+    for (; stream_y<stream_h; stream_y++) {
+        if (ili_border_line(stream_y)) continue;
+        ili_send_line(stream_xs, stream_ys, stream_w, stream_h, stream_y, NULL, 0, stream_y != stream_last+1);
+        stream_last = stream_y;
+    }
+    ili_flush_lines();
+    if (menu_layer == NULL) lcd_borders = false;
+}
+#endif
+
+//The launcher and the emulator share the panel; it only gets set up the first time
+static bool lcd_ready;
+
 void ili9341_init()
 {
+    if (lcd_ready)
+        return;
+    lcd_ready = true;
     lineEnd=textEnd=0;
-	spi_master_init();
+	lcd_bus_init();
+    ili_alloc_lines();
     ili_gpio_init();
     ILI9341_INITIAL ();
+    lcd_bus_pick_clock();
 	//LCD_BKG_ON();
 	//initBCKL();
 }
-
-
-
-
-
@@ -14,6 +14,7 @@
 #ifndef _DRIVER_SPI_LCD_H_
 #define _DRIVER_SPI_LCD_H_
 #include <stdint.h>
+#include <stdbool.h>
 
 //*****************************************************************************
 //
@@ -26,9 +27,48 @@ extern "C"
 {
 #endif
 
+//How the picture is laid out on the axes that are not stretched
+#define LCD_SCALE_DEFAULT 0 //1:1, horizontally centred, top aligned
+#define LCD_SCALE_INTEGER 1 //1:1, centred on both axes
+#define LCD_SCALE_ASPECT  2 //8:7 pixel aspect horizontally, centred
+
+void ili9341_set_scale_mode(int mode);
+int ili9341_get_scale_mode();
+//linePal: which of the palettes each source row is drawn with, NULL for the first one
 void ili9341_write_frame(const uint16_t x, const uint16_t y, const uint16_t width, const uint16_t height, const uint8_t *data[],
-							bool xStr, bool yStr);
+							const uint8_t *linePal, bool xStr, bool yStr);
+//The frame last written is still the one on the panel: if the menu box changed since, send
+//only the lines under it (all of them if the stretch or brightness changed)
+void ili9341_write_menu(const uint16_t x, const uint16_t y, const uint16_t width, const uint16_t height, const uint8_t *data[],
+							const uint8_t *linePal, bool xStr, bool yStr);
 void ili9341_init();
+//SPI clock the panel ended up running at after the readback check in ili9341_init
+int ili9341_get_clock_khz();
+
+//Lines per buffer for ili9341_get_lines_buffer/ili9341_send_lines, 320 pixels each
+#define LCD_BUF_LINES 2
+//Fill the buffer returned by ili9341_get_lines_buffer with RGB565 pixels (already byte
+//swapped), then send it with ili9341_send_lines. The next buffer can be filled while it goes out.
+uint16_t *ili9341_get_lines_buffer();
+void ili9341_send_lines(int ypos, int nlines);
+void ili9341_wait_lines();
+//Beam racing: send a frame line by line while the emulator is still rendering it
+//false if the panel is asleep, the frame isn't streamed then
+bool ili9341_stream_begin(const uint16_t x, const uint16_t y, const uint16_t width, const uint16_t height,
+							bool xStr, bool yStr);
+void ili9341_stream_row(int row, const uint8_t *line, int pal);
+void ili9341_stream_end();
+//Send every line on the next frame, e.g. after the palette changed
+void ili9341_invalidate();
+//Backlight and panel power by how long no button was pressed: dimmed after
+//CONFIG_LCD_DIM_SECONDS, panel in sleep-in with the backlight off after
+//CONFIG_LCD_SLEEP_SECONDS. False while asleep, nothing should be sent then.
+//Called before every frame; the first one after a button press wakes the panel.
+bool ili9341_awake();
+//Latency test: the next ili9341_write_frame notes when the first display line showing
+//emulator row has left the SPI FIFO, ili9341_row_time returns it (0 if it wasn't sent)
+void ili9341_time_row(int row);
+int64_t ili9341_row_time();
 
 
 #ifdef __cplusplus
@@ -17,6 +17,7 @@
 #include <freertos/timers.h>
 #include <freertos/task.h>
 #include <freertos/queue.h>
+#include <freertos/semphr.h>
 #include "pretty_effect.h"
 // Nes stuff wants to define this as well...
 #undef false
@@ -24,6 +25,7 @@
 #undef bool
 
 #include <math.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
 #include "../nofrendo/noftypes.h"
@@ -34,15 +36,52 @@
 #include "../nofrendo/log.h"
 #include "../nofrendo/nes/nes.h"
 #include "../nofrendo/nes/nes_pal.h"
+#include "../nofrendo/nes/nes_ppu.h"
 #include "../nofrendo/nes/nesinput.h"
+#include "../nofrendo/nes/nes_prof.h"
+#include "../nofrendo/nes/nes_replay.h"
+#include "../nofrendo/nes/nes_rom.h"
+#include "../nofrendo/nes/nesstate.h"
 #include "../nofrendo/osd.h"
 #include <stdint.h>
 #include "driver/i2s.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#if CONFIG_NES_PROFILE
+#if __has_include("esp_cpu.h")
+#include "esp_cpu.h"
+#else
+#include "soc/cpu.h"
+#endif
+#endif
+#if CONFIG_NES_CACHE_STATS || CONFIG_NES_HEATMAP
+#include "xtensa_perfmon_access.h"
+#include "xtensa_perfmon_masks.h"
+#endif
 #include "sdkconfig.h"
 #include "spi_lcd.h"
 #include "psxcontroller.h"
+#include "video_audio.h"
+#include "romsave.h"
+#include "settings.h"
+#include "menu.h"
+#include "power.h"
+#include "netplay.h"
+#include "bthid.h"
+#include "logring.h"
+#include "cputrace.h"
+#include "rendertrace.h"
+#include "rombench.h"
+#include "snapshot.h"
+#include "memplace.h"
+#include "tasks.h"
+#include "emuyield.h"
 
-#define DEFAULT_SAMPLERATE 33252 * 2 // 22100
+#if CONFIG_SOUND_ENA
+#define DEFAULT_SAMPLERATE CONFIG_SOUND_SAMPLE_RATE
+#else
+#define DEFAULT_SAMPLERATE 32000
+#endif
 #define DEFAULT_FRAGSIZE 128
 
 #define DEFAULT_WIDTH 320  // 256
@@ -51,17 +90,268 @@
 int xWidth;
 int yHight;
 
-TimerHandle_t timer;
+// Real frame rates of the consoles; the core hands osd_installtimer the rounded one of the
+// cart's TV system, Dendy's is PAL's
+#define NTSC_REFRESH_HZ 60.0988
+#define PAL_REFRESH_HZ 50.007
+
+// A frame at the game's rate, set by osd_installtimer: in microseconds, and in samples of
+// DEFAULT_SAMPLERATE
+static int framePeriodUs = 1000000 / NES_REFRESH_RATE;
+static int frameSamples = DEFAULT_SAMPLERATE / NES_REFRESH_RATE;
+
+static esp_timer_handle_t timer;
+static void (*frame_tick)(void);
+static SemaphoreHandle_t frameSem;
+#if CONFIG_NES_YIELD
+static int64_t lastTick; // esp_timer time of the last frame tick
+#endif
+
+#if CONFIG_NES_REPLAY
+// Frames emulated since power on; the first CONFIG_NES_REPLAY_FRAMES are hashed
+static int replayFrames;
+#define REPLAY_HASHING() (replayFrames <= CONFIG_NES_REPLAY_FRAMES)
+#endif
+
+#if CONFIG_NES_MOVIE
+// The game's buttons since power on as a replay script, NULL when nothing is recorded; frames
+// are counted the way CONFIG_NES_REPLAY counts them, so the script plays back as it was played
+static char *movie;
+static int movieFrames;
+static void movie_start(void);
+#endif
+
+#if CONFIG_NES_PACE_STATS
+// Frame pacing: frame ticks, frames emulated, drawn and sent to the LCD are running totals, each
+// kept by the one task that counts it, and videoTask times the interval from one frame sent to
+// the next against the frame period. Every 5 seconds of emulated frames: the tick rate that came
+// out (60.0988 Hz is NTSC's), the frames the emulator fell behind, skipped drawing, and drew
+// but never showed (videoTask dropped them or the emulator took them back), and the intervals
+// in quarter periods, | at one period, with their mean and worst distance from it. A pause or
+// fast-forward starts over, fast-forwarded frames aren't counted.
+#define PACE_FRAMES (5 * NES_REFRESH_RATE)
+#define PACE_HIST 8
+#define PACE_TEXT 40
+
+typedef struct
+{
+	uint32_t ticks, emulated, drawn, presented, dropped, reclaimed;
+	uint32_t hist[PACE_HIST];
+	uint32_t devSum; // us, a window's worth is far from wrapping
+} paceTotals_t;
+
+static paceTotals_t pace; // ticks by the tick's task, presents and drops by videoTask, the rest by the emulator
+static paceTotals_t paceLast; // as of the window's start
+static int64_t paceStart;
+static int paceFrames;
+static int pacePeriodUs;
+static volatile int paceWindow; // goes up as a window starts, videoTask starts its own over
+static volatile int paceDevMax;
+static char paceText[2][PACE_TEXT];
+
+static void pace_restart()
+{
+	pacePeriodUs = nes_getcontextptr()->timing->frame_us;
+	paceLast = pace;
+	paceStart = esp_timer_get_time();
+	paceFrames = 0;
+	paceWindow++;
+	paceDevMax = 0;
+}
+
+// videoTask, a frame is out on the LCD
+static void pace_present()
+{
+	static int64_t last;
+	static int window;
+	int64_t now = esp_timer_get_time();
+	int us, dev, b;
+
+	pace.presented++;
+	// the first of a window, after a pause or another game, has nothing to go by
+	if (window != paceWindow)
+	{
+		window = paceWindow;
+		last = 0;
+	}
+	if (last && pacePeriodUs)
+	{
+		us = (int)(now - last);
+		dev = us > pacePeriodUs ? us - pacePeriodUs : pacePeriodUs - us;
+		b = us * 4 / pacePeriodUs;
+		pace.hist[b < PACE_HIST ? b : PACE_HIST - 1]++;
+		pace.devSum += dev;
+		if (dev > paceDevMax)
+			paceDevMax = dev;
+	}
+	last = now;
+}
+
+// emulator, at the end of every emulated frame
+static void pace_frame()
+{
+	paceTotals_t d;
+	uint32_t intervals = 0;
+	int64_t us;
+	int millihz, behind, avg;
+
+	pace.emulated++;
+	if (++paceFrames < PACE_FRAMES)
+		return;
+
+	d = pace;
+	us = esp_timer_get_time() - paceStart;
+	d.ticks -= paceLast.ticks;
+	d.emulated -= paceLast.emulated;
+	d.drawn -= paceLast.drawn;
+	d.presented -= paceLast.presented;
+	d.dropped -= paceLast.dropped;
+	d.reclaimed -= paceLast.reclaimed;
+	d.dropped += d.reclaimed; // so presented + dropped is drawn
+	for (int i = 0; i < PACE_HIST; i++)
+	{
+		d.hist[i] -= paceLast.hist[i];
+		intervals += d.hist[i];
+	}
+	d.devSum -= paceLast.devSum;
+	millihz = us > 0 ? (int)(d.ticks * 1000000000LL / us) : 0;
+	behind = (int)(d.ticks - d.emulated);
+	avg = intervals ? (int)(d.devSum / intervals) : 0;
+
+	logPrintf("pace: %d.%03d Hz, %u emulated %u drawn %u presented, %d behind %u skipped %u dropped, "
+			  "interval %u %u %u %u|%u %u %u %u, off by %d us avg %d us max\n",
+			  millihz / 1000, millihz % 1000, (unsigned)d.emulated, (unsigned)d.drawn, (unsigned)d.presented, behind,
+			  (unsigned)(d.emulated - d.drawn), (unsigned)d.dropped, (unsigned)d.hist[0], (unsigned)d.hist[1],
+			  (unsigned)d.hist[2], (unsigned)d.hist[3], (unsigned)d.hist[4], (unsigned)d.hist[5], (unsigned)d.hist[6],
+			  (unsigned)d.hist[7], avg, paceDevMax);
+	snprintf(paceText[0], PACE_TEXT, "pac %d.%02d s%u d%u b%d j%d/%d", millihz / 1000, millihz % 1000 / 10,
+			 (unsigned)(d.emulated - d.drawn), (unsigned)d.dropped, behind, avg, paceDevMax);
+	snprintf(paceText[1], PACE_TEXT, "ivl %u %u %u %u|%u %u %u %u", (unsigned)d.hist[0], (unsigned)d.hist[1],
+			 (unsigned)d.hist[2], (unsigned)d.hist[3], (unsigned)d.hist[4], (unsigned)d.hist[5], (unsigned)d.hist[6],
+			 (unsigned)d.hist[7]);
+	pace_restart();
+}
+#endif
+
+// One frame of emulated time has passed: count it and wake the emulator in osd_waitframe.
+// Comes from the esp_timer task, or from audioTask with CONFIG_SOUND_SYNC.
+static void osd_frametick()
+{
+#if CONFIG_NES_YIELD
+	lastTick = esp_timer_get_time();
+#endif
+#if CONFIG_NES_PACE_STATS
+	pace.ticks++;
+#endif
+	frame_tick();
+	xSemaphoreGive(frameSem);
+}
+
+#if CONFIG_NES_YIELD
+// What is left of the frame period before the emulator owes the next frame, 0 when it already
+// does: how long it could lend its core at a yield point without falling behind.
+static int frame_slack()
+{
+	int slack;
+
+	if (frameSem == NULL || uxSemaphoreGetCount(frameSem))
+		return 0;
+	slack = (int)(lastTick + framePeriodUs - esp_timer_get_time());
+	return slack > 0 ? slack : 0;
+}
+#endif
+
+#if !CONFIG_SOUND_SYNC
+static void frame_timer_cb(void *arg)
+{
+	osd_frametick();
+}
+#endif
 
 // Seemingly, this will be called only once. Should call func with a freq of frequency,
 int osd_installtimer(int frequency, void *func, int funcsize, void *counter, int countersize)
 {
 	printf("Timer install, freq=%d\n", frequency);
-	timer = xTimerCreate("nes", configTICK_RATE_HZ / frequency, pdTRUE, NULL, func);
-	xTimerStart(timer, 0);
+	frame_tick = func;
+	framePeriodUs = 1000000 / frequency;
+	frameSamples = DEFAULT_SAMPLERATE / frequency;
+	// once per game, with the cart in: the game's own settings from here on
+	settings_rom(nes_getcontextptr()->rominfo->crc);
+#if CONFIG_NES_REPLAY
+	// Draw every frame, whatever the timing, so every frame gets hashed
+	nes_setframeskipcap(1);
+#endif
+#if CONFIG_NES_MOVIE
+	movie_start();
+#endif
+#if CONFIG_NES_PACE_STATS
+	pace_restart();
+#endif
+	// the benchmark runs every frame as soon as the last one is done
+	if (rombench_running())
+		nes_setpaced(false);
+	if (frameSem == NULL)
+		frameSem = xSemaphoreCreateBinary();
+	if (frameSem == NULL)
+		return -1;
+#if !CONFIG_SOUND_SYNC
+	// The DAC is the clock with CONFIG_SOUND_SYNC: audioTask ticks once per frame of samples played
+	double hz = frequency;
+	if (frequency == 60)
+		hz = NTSC_REFRESH_HZ;
+	else if (frequency == 50)
+		hz = PAL_REFRESH_HZ;
+	if (timer == NULL)
+	{
+		const esp_timer_create_args_t args = {
+			.callback = frame_timer_cb,
+			.name = "nes"};
+		if (esp_timer_create(&args, &timer) != ESP_OK)
+			return -1;
+	}
+	else
+	{
+		esp_timer_stop(timer);
+	}
+	esp_timer_start_periodic(timer, (uint64_t)(1000000.0 / hz + 0.5));
+#endif
 	return 0;
 }
 
+#if CONFIG_NES_DFS
+static int64_t emuWoke;
+static int emuFrames; // emulated since emuWoke
+#endif
+
+// Sleep until the next frame tick instead of polling nofrendo_ticks
+void osd_waitframe(void)
+{
+#if CONFIG_NES_DFS
+	if (emuWoke)
+		powerEmuBusy((int)(esp_timer_get_time() - emuWoke), emuFrames);
+	emuFrames = 0;
+#endif
+	powerEmuIdle(true);
+	if (frameSem)
+		xSemaphoreTake(frameSem, portMAX_DELAY);
+	powerEmuIdle(false);
+#if CONFIG_NES_DFS
+	emuWoke = esp_timer_get_time();
+#endif
+}
+
+uint32 osd_getmicros(void)
+{
+	return (uint32)esp_timer_get_time();
+}
+
+#if CONFIG_NES_PROFILE
+uint32 osd_getcycles(void)
+{
+	return esp_cpu_get_ccount();
+}
+#endif
+
 /*
 ** Audio
 */
@@ -69,30 +359,350 @@ static void (*audio_callback)(void *buffer, int length) = NULL;
 #if CONFIG_SOUND_ENA
 QueueHandle_t queue;
 static uint16_t *audio_frame;
+
+// Samples from apu_process go through a single producer/single consumer ring: the emulator
+// writes ring_head, audioTask writes ring_tail. Both only grow, the fill level is head - tail.
+// volatile makes the compiler put a memw around every access, which is all the ordering needed.
+#define AUDIO_RING_SAMPLES (DEFAULT_SAMPLERATE > 44100 ? 4096 : 2048) // power of two, ~30-50ms
+// Dynamic rate control: the frameSamples rendered per frame are nudged by up to
+// 1/AUDIO_DRC_RANGE (0.5%) to pull the fill level back to AUDIO_RING_TARGET, so a clock
+// mismatch between frame timer and DAC never ends in an underrun or a full ring.
+#define AUDIO_RING_TARGET (AUDIO_RING_SAMPLES / 2)
+#define AUDIO_DRC_RANGE 200
+#define AUDIO_FRAME_LONGEST (DEFAULT_SAMPLERATE / NES_REFRESH_MIN)
+#define AUDIO_FRAME_MAX (AUDIO_FRAME_LONGEST + AUDIO_FRAME_LONGEST / AUDIO_DRC_RANGE)
+// past the end, for a frame rendered in place to run on into; a word more for DAC16's parity
+#define AUDIO_RING_SLACK (AUDIO_FRAME_MAX + 2)
+static uint16_t *audio_ring;
+static volatile uint32_t ring_head;
+static volatile uint32_t ring_tail;
+static uint16_t *audio_out;
+static TaskHandle_t audioTaskHandle;
+// The driver posts one event per DMA buffer sent; leave room for a full round of them
+#define AUDIO_EVENT_QUEUE (2 * CONFIG_SOUND_DMA_BUF_COUNT)
+
+// Frames on the I2S side: mono to the built-in DAC, stereo to a codec
+#if CONFIG_SOUND_I2S_CODEC
+#define AUDIO_CHANNELS 2
+#else
+#define AUDIO_CHANNELS 1
+#endif
+#if CONFIG_SOUND_RESAMPLE
+#define AUDIO_I2S_RATE CONFIG_SOUND_I2S_RATE
+// APU samples per I2S frame, 16.16; the +2 frames cover rounding and the phase carried over
+#define AUDIO_RESAMPLE_STEP ((uint32_t)(((uint64_t)DEFAULT_SAMPLERATE << 16) / AUDIO_I2S_RATE))
+#define AUDIO_OUT_FRAMES (DEFAULT_FRAGSIZE * AUDIO_I2S_RATE / DEFAULT_SAMPLERATE + 2)
+#else
+#define AUDIO_I2S_RATE DEFAULT_SAMPLERATE
+#define AUDIO_OUT_FRAMES DEFAULT_FRAGSIZE
+#endif
+
+static int audio_ring_fill()
+{
+	return ring_head - ring_tail;
+}
+
+#if CONFIG_SOUND_STATS
+// Frame counts are I2S frames, ring levels APU samples. audioTask owns written, done and the
+// error counters, the emulator task the rest; ring_low is reset by the emulator between windows.
+static struct
+{
+	volatile uint32_t written; // frames handed to the driver
+	volatile uint32_t done;    // frames sent by DMA, one buffer per TX_DONE
+	volatile uint32_t underruns;
+	volatile uint32_t dma_errors;
+	volatile int ring_low;
+	int ring_high;
+	uint32_t apu_us;
+	uint32_t apu_us_max;
+} astats = {.ring_low = AUDIO_RING_SAMPLES};
+static audio_stats_t astats_last;
+
+// When it has nothing new the driver sends the last buffer again (or silence), and posts
+// TX_DONE for it all the same, so DMA getting ahead of what was written is an underrun.
+static void audio_stats_events()
+{
+	i2s_event_t evt;
+	while (xQueueReceive(queue, &evt, 0) == pdTRUE)
+	{
+		if (evt.type == I2S_EVENT_DMA_ERROR)
+		{
+			astats.dma_errors++;
+		}
+		else if (evt.type == I2S_EVENT_TX_DONE && astats.written)
+		{
+			uint32_t done = astats.done + CONFIG_SOUND_DMA_BUF_LEN;
+			if ((int32_t)(done - astats.written) > 0)
+			{
+				astats.underruns++;
+				done = astats.written;
+			}
+			astats.done = done;
+		}
+	}
+}
+
+static int audio_latency_ms()
+{
+	int queued = (int32_t)(astats.written - astats.done);
+	if (queued < 0)
+		queued = 0;
+	return audio_ring_fill() * 1000 / DEFAULT_SAMPLERATE + queued * 1000 / AUDIO_I2S_RATE;
+}
+#endif
+
+static void audio_i2s_write(const void *buf, int bytes)
+{
+#if CONFIG_SOUND_STATS
+	audio_stats_events();
+#endif
+	PROF_BEGIN(t0);
+	i2s_write_bytes(0, (const char *)buf, bytes, portMAX_DELAY);
+	PROF_END(PROF_I2S, t0);
+#if CONFIG_SOUND_STATS
+	astats.written += bytes / (2 * AUDIO_CHANNELS);
+#endif
+}
+
+#if CONFIG_SOUND_I2S_CODEC
+// One stereo I2S frame from a mono sample
+#define AUDIO_PUT(out, s) \
+	do                    \
+	{                     \
+		*(out)++ = (s);   \
+		*(out)++ = (s);   \
+	} while (0)
+#endif
+
+static void audioTask(void *arg)
+{
+#if CONFIG_SOUND_I2S_CODEC
+	uint16_t whatever = 0;
+#else
+	uint16_t last = 0x8000; // DAC midpoint
+#endif
+#if CONFIG_SOUND_RESAMPLE
+	uint16_t prev = 0;
+	uint32_t phase = 0;
+#endif
+#if CONFIG_SOUND_SYNC
+	int played = 0;
+#endif
+	while (1)
+	{
+		int n = audio_ring_fill();
+#if CONFIG_SOUND_STATS
+		if (n < astats.ring_low)
+			astats.ring_low = n;
+#endif
+		if (n == 0)
+		{
+#if CONFIG_SOUND_SYNC
+			// Keep the DAC, and with it the frame clock, running: repeat the last sample
+			n = DEFAULT_FRAGSIZE;
+#else
+			ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+			continue;
+#endif
+		}
+		if (n > DEFAULT_FRAGSIZE)
+			n = DEFAULT_FRAGSIZE;
+		bool have = audio_ring_fill() != 0;
+#if CONFIG_SOUND_I2S_CODEC
+		uint16_t *out = audio_out;
+		for (int i = 0; i < n; i++)
+		{
+			if (have)
+				whatever = audio_ring[(ring_tail + i) & (AUDIO_RING_SAMPLES - 1)];
+#if CONFIG_SOUND_RESAMPLE
+			// Linear interpolation between the previous and this sample for every I2S frame
+			// that falls before it
+			for (; phase < 0x10000; phase += AUDIO_RESAMPLE_STEP)
+			{
+				uint16_t s = prev + (((int32_t)((int16_t)whatever - (int16_t)prev) * (int32_t)phase) >> 16);
+				AUDIO_PUT(out, s);
+			}
+			phase -= 0x10000;
+			prev = whatever;
+#else
+			AUDIO_PUT(out, whatever);
+#endif
+		}
+		if (have)
+			ring_tail += n;
+		audio_i2s_write(audio_out, (char *)out - (char *)audio_out);
+#else
+		// The mixer already wrote DAC-ready words in FIFO order: hand the ring over as is
+		if (have)
+		{
+			int pos = ring_tail & (AUDIO_RING_SAMPLES - 1);
+			if (n > AUDIO_RING_SAMPLES - pos)
+				n = AUDIO_RING_SAMPLES - pos;
+			audio_i2s_write(&audio_ring[pos], 2 * n);
+			last = audio_ring[pos + n - 1];
+			ring_tail += n;
+		}
+		else
+		{
+			for (int i = 0; i < n; i++)
+				audio_out[i] = last;
+			audio_i2s_write(audio_out, 2 * n);
+		}
+#endif
+#if CONFIG_SOUND_SYNC
+		played += n;
+		while (played >= frameSamples)
+		{
+			played -= frameSamples;
+			if (frame_tick)
+				osd_frametick();
+		}
+#endif
+	}
+}
+#endif
+
+#if CONFIG_NES_REPLAY && CONFIG_SOUND_ENA
+// Hash the samples as the APU made them, before the DAC formatting: sample i of the
+// DAC16 output sits at the other half of its 32-bit word, offset by the ring's parity
+static void replay_hash_samples(const uint16_t *src, int parity, int count)
+{
+#if CONFIG_SOUND_I2S_CODEC
+	replay_audio((const int16 *)src, count);
+#else
+	const uint16_t *words = src - parity;
+	int16 chunk[64];
+	int i = 0;
+
+	while (i < count)
+	{
+		int n = 0;
+		for (; n < 64 && i < count; n++, i++)
+			chunk[n] = (int16)(words[(parity + i) ^ 1] ^ 0x8000);
+		replay_audio(chunk, n);
+	}
+#endif
+}
+#endif
+
+#if CONFIG_NES_FASTFORWARD
+static bool ffOn;
+static int ffFrame; // made since fast-forward went on
+
+// Fast-forward: the APU still makes every frame's sound, so it keeps up with the game, but only
+// the frames that get drawn, one in NES_FASTFORWARD, go in the ring.
+void osd_fastforward(bool on)
+{
+	ffOn = on;
+	ffFrame = 0;
+#if CONFIG_NES_PACE_STATS
+	// frames run flat out aren't paced, a window has the ones before or after
+	pace_restart();
+#endif
+}
 #endif
 
+// Called once per emulated frame: let the APU render a frame worth of samples in one go, then
+// copy them into the ring. Never waits for the audio task; if the ring is full the tail of the
+// frame is dropped, so the APU still keeps up with the register writes. One call per frame
+// also lets the band-limited APU match its resampling ratio to the count asked for here.
 static void do_audio_frame()
 {
 
 #if CONFIG_SOUND_ENA
-	int left = DEFAULT_SAMPLERATE / NES_REFRESH_RATE;
-	while (left)
-	{
-		int n = DEFAULT_FRAGSIZE;
-		if (n > left)
-			n = left;
-		audio_callback(audio_frame, n); // get more data
-		// 16 bit mono -> 32-bit (16 bit r+l)
-		for (int i = n - 1; i >= 0; i--)
+	int left = frameSamples;
+	int drc = (AUDIO_RING_TARGET - audio_ring_fill()) * (frameSamples / AUDIO_DRC_RANGE) / AUDIO_RING_TARGET;
+	if (drc > frameSamples / AUDIO_DRC_RANGE)
+		drc = frameSamples / AUDIO_DRC_RANGE;
+	if (drc < -frameSamples / AUDIO_DRC_RANGE)
+		drc = -frameSamples / AUDIO_DRC_RANGE;
+#if CONFIG_NES_REPLAY
+	// The APU's output depends on how many samples it is asked for
+	if (REPLAY_HASHING())
+		drc = 0;
+#endif
+	left += drc;
+
+	// Whenever the whole frame fits, the APU renders straight into the ring at the head; a frame
+	// that runs past the end goes on into the slack after it, and that part is moved to the start.
+	// Frames that won't be kept, or only in part, go through audio_frame as before.
+	bool drop = false;
+#if CONFIG_NES_FASTFORWARD
+	drop = ffOn && ffFrame++ % NES_FASTFORWARD;
+#endif
+	uint32_t head = ring_head;
+	int room = AUDIO_RING_SAMPLES - (int)(head - ring_tail);
+	int pos = head & (AUDIO_RING_SAMPLES - 1);
+	bool direct = !drop && left <= room;
+	uint16_t *src = direct ? &audio_ring[pos] : audio_frame;
+
+	// Volume is a per-frame gain in the mixer. Format and gain are set every frame, which is
+	// cheap and survives the APU context being swapped on a cart change.
+#if CONFIG_NES_REPLAY
+	apu_setgain(REPLAY_HASHING() ? 0x100 : 0x100 >> (8 - settings.volume * 2));
+#else
+	apu_setgain(0x100 >> (8 - settings.volume * 2));
+#endif
+#if CONFIG_SOUND_I2S_CODEC
+	apu_setformat(APU_FORMAT_NATIVE);
+#else
+	// DAC16 swaps samples within 32-bit words by address, so render at the ring's parity
+	apu_setformat(APU_FORMAT_DAC16);
+	if (!direct)
+		src += head & 1;
+#endif
+	PROF_BEGIN(c0);
+#if CONFIG_SOUND_STATS
+	uint32_t t0 = osd_getmicros();
+	audio_callback(src, left);
+	uint32_t us = osd_getmicros() - t0;
+	astats.apu_us += us;
+	if (us > astats.apu_us_max)
+		astats.apu_us_max = us;
+#else
+	audio_callback(src, left);
+#endif
+	PROF_END(PROF_APU, c0);
+#if CONFIG_NES_REPLAY
+	if (REPLAY_HASHING())
+		replay_hash_samples(src, head & 1, left);
+#endif
+
+	if (direct)
+	{
+		int over = pos + left - AUDIO_RING_SAMPLES;
+#if !CONFIG_SOUND_I2S_CODEC
+		// whole words, the last DAC16 sample can sit in the other half of one
+		over = (over + 1) & ~1;
+#endif
+		if (over > 0)
+			memcpy(audio_ring, &audio_ring[AUDIO_RING_SAMPLES], 2 * over);
+		head += left;
+	}
+	else
+	{
+		if (drop)
+			left = 0;
+		if (left > room)
+			left = room;
+		while (left)
 		{
-			uint16_t whatever = audio_frame[i];
-			int volShift = getVolume();
-			audio_frame[i * 2 + 1] = whatever >> (8 - volShift * 2); // audio_frame[i];
-			audio_frame[i * 2] = whatever >> (8 - volShift * 2);	 // audio_frame[i];
+			int at = head & (AUDIO_RING_SAMPLES - 1);
+			int n = AUDIO_RING_SAMPLES - at;
+			if (n > left)
+				n = left;
+			memcpy(&audio_ring[at], src, 2 * n);
+			src += n;
+			head += n;
+			left -= n;
 		}
-		i2s_write_bytes(0, audio_frame, 4 * n, portMAX_DELAY);
-		left -= n;
 	}
+	ring_head = head;
+#if CONFIG_SOUND_STATS
+	if ((int)(head - ring_tail) > astats.ring_high)
+		astats.ring_high = head - ring_tail;
+#endif
+	xTaskNotifyGive(audioTaskHandle);
 #endif
 }
 
@@ -110,17 +720,41 @@ static void osd_stopsound(void)
 static int osd_init_sound(void)
 {
 #if CONFIG_SOUND_ENA
-	audio_frame = malloc(4 * DEFAULT_FRAGSIZE);
+	audio_frame = malloc(2 * (AUDIO_FRAME_MAX + 1));
+	audio_ring = malloc(2 * (AUDIO_RING_SAMPLES + AUDIO_RING_SLACK));
+	audio_out = malloc(2 * AUDIO_CHANNELS * AUDIO_OUT_FRAMES);
+	if (audio_frame == NULL || audio_ring == NULL || audio_out == NULL)
+		return -1;
+	ring_head = ring_tail = 0;
+#if CONFIG_SOUND_I2S_CODEC
 	i2s_config_t cfg = {
-		.mode = I2S_MODE_DAC_BUILT_IN | I2S_MODE_TX | I2S_MODE_MASTER,
-		.sample_rate = DEFAULT_SAMPLERATE,
+		.mode = I2S_MODE_TX | I2S_MODE_MASTER,
+		.sample_rate = AUDIO_I2S_RATE,
 		.bits_per_sample = I2S_BITS_PER_SAMPLE_16BIT,
 		.channel_format = I2S_CHANNEL_FMT_RIGHT_LEFT,
+		.communication_format = I2S_COMM_FORMAT_I2S | I2S_COMM_FORMAT_I2S_MSB,
+		.intr_alloc_flags = 0,
+		.dma_buf_count = CONFIG_SOUND_DMA_BUF_COUNT,
+		.dma_buf_len = CONFIG_SOUND_DMA_BUF_LEN};
+	i2s_pin_config_t pins = {
+		.bck_io_num = CONFIG_SOUND_I2S_BCK,
+		.ws_io_num = CONFIG_SOUND_I2S_WS,
+		.data_out_num = CONFIG_SOUND_I2S_DOUT,
+		.data_in_num = I2S_PIN_NO_CHANGE};
+	i2s_driver_install(0, &cfg, AUDIO_EVENT_QUEUE, &queue);
+	i2s_set_pin(0, &pins);
+#else
+	// Mono: one 16-bit word per frame, the DAC takes its top byte (see APU_FORMAT_DAC16)
+	i2s_config_t cfg = {
+		.mode = I2S_MODE_DAC_BUILT_IN | I2S_MODE_TX | I2S_MODE_MASTER,
+		.sample_rate = AUDIO_I2S_RATE,
+		.bits_per_sample = I2S_BITS_PER_SAMPLE_16BIT,
+		.channel_format = I2S_CHANNEL_FMT_ONLY_LEFT,
 		.communication_format = I2S_COMM_FORMAT_I2S_MSB,
 		.intr_alloc_flags = 0,
-		.dma_buf_count = 4,
-		.dma_buf_len = 512};
-	i2s_driver_install(0, &cfg, 4, &queue);
+		.dma_buf_count = CONFIG_SOUND_DMA_BUF_COUNT,
+		.dma_buf_len = CONFIG_SOUND_DMA_BUF_LEN};
+	i2s_driver_install(0, &cfg, AUDIO_EVENT_QUEUE, &queue);
 	i2s_set_pin(0, NULL);
 	i2s_set_dac_mode(I2S_DAC_CHANNEL_LEFT_EN);
 
@@ -128,7 +762,9 @@ static int osd_init_sound(void)
 	// ToDo: still needed now I2S supports set_dac_mode?
 	CLEAR_PERI_REG_MASK(RTC_IO_PAD_DAC1_REG, RTC_IO_PDAC1_DAC_XPD_FORCE_M);
 	CLEAR_PERI_REG_MASK(RTC_IO_PAD_DAC1_REG, RTC_IO_PDAC1_XPD_DAC_M);
+#endif
 
+	tasks_start(TASK_AUDIO, &audioTask, NULL, &audioTaskHandle);
 #endif
 
 	audio_callback = NULL;
@@ -154,10 +790,29 @@ static void clear(uint8 color);
 static bitmap_t *lock_write(void);
 static void free_write(int num_dirties, rect_t *dirty_rects);
 static void custom_blit(bitmap_t *bmp, int num_dirties, rect_t *dirty_rects);
+static bitmap_t *create_buffer(int width, int height);
+#if CONFIG_HW_LCD_BEAM_RACE
+static void line_done(bitmap_t *bmp, int scanline);
+#else
+static bitmap_t *next_buffer(void);
+#endif
 static char fb[1]; // dummy
 
 QueueHandle_t vidQueue;
 
+/* how videoTask presents the frames the emulator hands it */
+#define PRESENT_MODE_60 0
+#define PRESENT_MODE_30 1
+#define PRESENT_MODE_ADAPTIVE 2
+
+#if CONFIG_PRESENT_MODE_60
+static int presentMode = PRESENT_MODE_60;
+#elif CONFIG_PRESENT_MODE_30
+static int presentMode = PRESENT_MODE_30;
+#else
+static int presentMode = PRESENT_MODE_ADAPTIVE;
+#endif
+
 viddriver_t sdlDriver =
 	{
 		"Simple DirectMedia Layer", /* name */
@@ -169,7 +824,15 @@ viddriver_t sdlDriver =
 		lock_write,					/* lock_write */
 		free_write,					/* free_write */
 		custom_blit,				/* custom_blit */
-		false						/* invalidate flag */
+		false,						/* invalidate flag */
+		create_buffer,				/* create_buffer */
+#if CONFIG_HW_LCD_BEAM_RACE
+		line_done,					/* line_done */
+		NULL						/* next_buffer */
+#else
+		NULL,						/* line_done */
+		next_buffer					/* next_buffer */
+#endif
 };
 
 bitmap_t *myBitmap;
@@ -186,14 +849,31 @@ void osd_togglefullscreen(int code)
 {
 }
 
+// A snapshot is copied out here and stored by snapTask. The beam racing driver keeps a few
+// lines of the frame, not all of it, so there is nothing to take then.
+int osd_savesnap(bitmap_t *bmp, rgb_t *pal)
+{
+#if CONFIG_NES_SNAPSHOT && !CONFIG_HW_LCD_BEAM_RACE
+	return snapshot_take(bmp, pal, nes_getcontextptr()->rominfo->crc);
+#else
+	return -1;
+#endif
+}
+
 /* initialise video */
 static int init(int width, int height)
 {
+#if CONFIG_LCD_BACKLIGHT_SAVER
+	setBrSaver(true);
+#endif
 	return 0;
 }
 
 static void shutdown(void)
 {
+#if CONFIG_LCD_BACKLIGHT_SAVER
+	setBrSaver(false);
+#endif
 }
 
 /* set a video mode */
@@ -202,21 +882,68 @@ static int set_mode(int width, int height)
 	return 0;
 }
 
-uint16 myPalette[256];
+// One palette per colour emphasis, the frame's linepal picks one for every line
+uint16 myPalette[PPU_EMPHASES][256];
+// what they're built from, and the backlight gain they make up for
+static rgb_t nesPal[256];
+static int palGain = 256;
 
-/* copy nes palette over to hardware */
-static void set_palette(rgb_t *pal)
+// what emphasis leaves of a channel whose own bit isn't set, /256
+#define EMPHASIS_ATTENUATE 209
+// the NES colours, three times over for the priority trickery; the GUI's come after
+#define EMPHASIS_COLORS 192
+
+// A backlight at gain/256 of its light gets the colours through a gamma
+// curve that keeps mid grey (at a display gamma of 2.2) where it was;
+// only white can't be made up for
+static void boost_curve(uint8_t *curve, int gain)
 {
-	uint16 c;
+	float gamma = 1.0f - log2f(256.0f / gain) / 2.2f;
+	int v;
 
-	int i;
+	for (v = 0; v < 256; v++)
+		curve[v] = (gain >= 256) ? v : (uint8_t)(255.0f * powf(v / 255.0f, gamma) + 0.5f);
+}
+
+// every palette is built here, so a mid-frame $2001 write costs nothing
+static void build_palettes(void)
+{
+	uint8_t curve[256];
+	uint16 c;
+	int r, g, b;
+	int i, e;
 
-	for (i = 0; i < 256; i++)
+	boost_curve(curve, palGain);
+	for (e = 0; e < PPU_EMPHASES; e++)
 	{
-		c = (pal[i].b >> 3) + ((pal[i].g >> 2) << 5) + ((pal[i].r >> 3) << 11);
-		// myPalette[i]=(c>>8)|((c&0xff)<<8);
-		myPalette[i] = c;
+		for (i = 0; i < 256; i++)
+		{
+			r = curve[nesPal[i].r & 0xFF];
+			g = curve[nesPal[i].g & 0xFF];
+			b = curve[nesPal[i].b & 0xFF];
+			if (e && i < EMPHASIS_COLORS)
+			{
+				if (e & ~1)
+					r = r * EMPHASIS_ATTENUATE >> 8;
+				if (e & ~2)
+					g = g * EMPHASIS_ATTENUATE >> 8;
+				if (e & ~4)
+					b = b * EMPHASIS_ATTENUATE >> 8;
+			}
+			c = (b >> 3) + ((g >> 2) << 5) + ((r >> 3) << 11);
+			myPalette[e][i] = (c >> 8) | ((c & 0xff) << 8);
+		}
 	}
+	ili9341_invalidate();
+}
+
+/* copy nes palette over to hardware */
+/* entries are stored byte swapped, ready to go to the LCD as-is */
+static void set_palette(rgb_t *pal)
+{
+	memcpy(nesPal, pal, sizeof(nesPal));
+	palGain = getBrGain();
+	build_palettes();
 }
 
 /* clear all frames to a particular color */
@@ -226,99 +953,1048 @@ static void clear(uint8 color)
 }
 
 /* acquire the directbuffer for writing */
+// The screen is only a descriptor, nothing is drawn through it: it's made once and kept, like
+// the frame buffers from create_buffer, so locking it doesn't go to the heap
 static bitmap_t *lock_write(void)
 {
 	//   SDL_LockSurface(mySurface);
-	myBitmap = bmp_createhw((uint8 *)fb, xWidth, yHight, xWidth * 2); // DEFAULT_WIDTH, DEFAULT_HEIGHT, DEFAULT_WIDTH*2);
+	if (NULL == myBitmap)
+		myBitmap = bmp_createhw((uint8 *)fb, xWidth, yHight, xWidth * 2); // DEFAULT_WIDTH, DEFAULT_HEIGHT, DEFAULT_WIDTH*2);
 	return myBitmap;
 }
 
 /* release the resource */
 static void free_write(int num_dirties, rect_t *dirty_rects)
 {
-	bmp_destroy(&myBitmap);
 }
 
-static void custom_blit(bitmap_t *bmp, int num_dirties, rect_t *dirty_rects)
+#if CONFIG_NES_LATENCY_TEST
+// Button to photon: applyPad takes a press and its ISR timestamp, the first frame drawn after
+// that which differs from the frame before it is where the game reacted. That frame is tagged
+// with the press and the first row that changed, and videoTask times that row going out to
+// the LCD. Needs a screen that stands still until a button is pressed, a menu or a pause screen.
+#define LATENCY_BUCKET_MS 4
+#define LATENCY_BUCKETS 32
+#define LATENCY_REPORT 20		// samples between reports
+#define LATENCY_GIVE_UP 60		// frames without a reaction
+
+static uint32_t rowHash[NES_SCREEN_HEIGHT];
+static uint32_t latencyPress; // armed: waiting for the game to react to this press
+static int latencyFrames;
+static bitmap_t *volatile latencyBmp; // the reacting frame on its way to the LCD
+static int latencyRow;
+static uint32_t latencyBmpPress;
+
+static struct
 {
-	xQueueSend(vidQueue, &bmp, 0);
-	do_audio_frame();
-}
+	int hist[LATENCY_BUCKETS];
+	int count, lost, min, max;
+	int64_t total;
+} lstats;
 
-// This runs on core 1.
-static void videoTask(void *arg)
+// emulator side, every frame drawn
+static void latency_frame(bitmap_t *bmp)
 {
-	int x, y;
-	bitmap_t *bmp = NULL;
+	uint32_t press = psxPressTime();
+	int changed = -1;
 
-	xWidth = 320;
-	yHight = 240;
-	x = (320 - xWidth) / 2;
-	y = ((240 - yHight) / 2);
-	while (1)
+	for (int r = 0; r < bmp->height; r++)
 	{
-		xQueueReceive(vidQueue, &bmp, portMAX_DELAY); // skip one frame to drop to 30
-		xQueueReceive(vidQueue, &bmp, portMAX_DELAY);
-		ili9341_write_frame(x, y, /*DEFAULT_WIDTH, DEFAULT_HEIGHT,*/ xWidth, yHight, (const uint8_t **)bmp->line, getXStretch(), getYStretch());
+		const uint32_t *w = (const uint32_t *)bmp->line[r];
+		uint32_t h = 0x811C9DC5;
+
+		for (int i = 0; i < NES_SCREEN_WIDTH / 4; i++)
+			h = (h ^ w[i]) * 16777619;
+		if (h != rowHash[r] && changed < 0)
+			changed = r;
+		rowHash[r] = h;
 	}
-}
 
-/*
-** Input
-*/
+	if (latencyPress && changed >= 0 && latencyBmp == NULL)
+	{
+		latencyRow = changed;
+		latencyBmpPress = latencyPress;
+		latencyBmp = bmp;
+		latencyPress = 0;
+	}
+	else if (latencyPress && ++latencyFrames > LATENCY_GIVE_UP)
+	{
+		lstats.lost++;
+		latencyPress = 0;
+	}
+	// a press while one is being measured is ignored
+	if (press && latencyPress == 0 && latencyBmp == NULL)
+	{
+		latencyPress = press;
+		latencyFrames = 0;
+	}
+}
 
-static void osd_initinput()
+static void latency_report()
 {
-	psxcontrollerInit();
+	static const char bar[] = "########################################################";
+	int b, n;
+
+	logPrintf("Latency: %d presses, %d-%d ms, avg %d ms, %d lost\n", lstats.count, lstats.min, lstats.max,
+			  (int)(lstats.total / lstats.count), lstats.lost);
+	for (b = 0; b < LATENCY_BUCKETS; b++)
+	{
+		if (lstats.hist[b] == 0)
+			continue;
+		n = lstats.hist[b] < (int)sizeof(bar) - 1 ? lstats.hist[b] : (int)sizeof(bar) - 1;
+		logPrintf("  %3d-%3d ms %3d %.*s\n", b * LATENCY_BUCKET_MS, (b + 1) * LATENCY_BUCKET_MS - 1, lstats.hist[b],
+				  n, bar);
+	}
 }
 
-void osd_getinput(void)
+// videoTask, around ili9341_write_frame: before with the frame about to go out, then after with
+// it sent
+static void latency_blit(bitmap_t *bmp, bool sent)
 {
-	const int ev[16] = {
-		event_joypad1_select, 0, 0, event_joypad1_start, event_joypad1_up, event_joypad1_right, event_joypad1_down, event_joypad1_left,
-		0, 0, 0, 0, event_soft_reset, event_joypad1_a, event_joypad1_b, event_hard_reset};
-	static int oldb = 0xffff;
-	int b = psxReadInput();
-	int chg = b ^ oldb;
-	int x;
-	oldb = b;
-	event_t evh;
-	//	printf("Input: %x\n", b);
-	for (x = 0; x < 16; x++)
+	int64_t t;
+	int ms;
+
+	if (bmp != latencyBmp)
+		return;
+	if (!sent)
 	{
-		if (chg & 1)
-		{
-			evh = event_get(ev[x]);
-			if (evh)
-				evh((b & 1) ? INP_STATE_BREAK : INP_STATE_MAKE);
-		}
-		chg >>= 1;
-		b >>= 1;
+		ili9341_time_row(latencyRow);
+		return;
+	}
+	t = ili9341_row_time();
+	latencyBmp = NULL;
+	if (t == 0)
+	{
+		lstats.lost++;
+		return;
 	}
+	ms = (int)((uint32_t)t - latencyBmpPress) / 1000;
+	lstats.hist[ms / LATENCY_BUCKET_MS < LATENCY_BUCKETS ? ms / LATENCY_BUCKET_MS : LATENCY_BUCKETS - 1]++;
+	if (lstats.count == 0 || ms < lstats.min)
+		lstats.min = ms;
+	if (ms > lstats.max)
+		lstats.max = ms;
+	lstats.total += ms;
+	if (++lstats.count % LATENCY_REPORT == 0)
+		latency_report();
 }
 
-static void osd_freeinput(void)
+// videoTask dropped bmp without showing it, or the emulator took it back
+static void latency_drop(bitmap_t *bmp)
 {
+	if (bmp == latencyBmp)
+	{
+		lstats.lost++;
+		latencyBmp = NULL;
+	}
 }
+#else
+#define latency_frame(bmp)
+#define latency_blit(bmp, sent)
+#define latency_drop(bmp)
+#endif
 
-void osd_getmouse(int *x, int *y, int *button)
+static void custom_blit(bitmap_t *bmp, int num_dirties, rect_t *dirty_rects)
 {
+#if CONFIG_LCD_BACKLIGHT_SAVER
+	// the backlight moved (videoTask's dimming, the menu): follow it on this core, between frames
+	if (getBrGain() != palGain)
+	{
+		palGain = getBrGain();
+		build_palettes();
+	}
+#endif
+#if CONFIG_NES_REPLAY
+	if (REPLAY_HASHING())
+		replay_frame(bmp);
+#endif
+	latency_frame(bmp);
+#if CONFIG_NES_PACE_STATS
+	pace.drawn++;
+#endif
+#if !CONFIG_HW_LCD_BEAM_RACE
+	// vidQueue can hold every buffer, this never blocks; the headless
+	// benchmark draws the next frame over this one
+	if (!rombench_headless())
+		xQueueSend(vidQueue, &bmp, portMAX_DELAY);
+#endif
+#if CONFIG_NES_YIELD
+	emuYieldPoint(false, frame_slack());
+#endif
 }
 
-/*
-** Shutdown
-*/
-
-/* this is at the bottom, to eliminate warnings */
-void osd_shutdown()
+#if CONFIG_NES_CACHE_STATS
+// Instruction fetches that missed the flash cache, counted by performance counter 0 of the
+// core the emulator runs on (the counters are per core), reported every 5 seconds
+#define CACHE_STATS_FRAMES (5 * NES_REFRESH_RATE)
+static void cache_stats_frame()
 {
-	osd_stopsound();
-	osd_freeinput();
+	static int frames = -1;
+
+	if (frames < 0)
+	{
+		xtensa_perfmon_init(0, XTPERF_CNT_I_MEM, XTPERF_MASK_I_MEM_CACHE_MISS, 0, -1);
+		xtensa_perfmon_reset(0);
+		xtensa_perfmon_start();
+		frames = 0;
+		return;
+	}
+	if (++frames == CACHE_STATS_FRAMES)
+	{
+		logPrintf("icache: %u misses/frame\n", (unsigned)(xtensa_perfmon_value(0) / CACHE_STATS_FRAMES));
+		xtensa_perfmon_reset(0);
+		frames = 0;
+	}
+}
+#endif
+
+#if CONFIG_NES_HEATMAP
+// The same misses for the core's bank heat map, on counter 1 so CONFIG_NES_CACHE_STATS can go on
+// resetting counter 0. Started the first time the core asks, from the emulator's core.
+uint32 osd_getcachemisses(void)
+{
+	static bool started;
+
+	if (!started)
+	{
+		xtensa_perfmon_init(1, XTPERF_CNT_I_MEM, XTPERF_MASK_I_MEM_CACHE_MISS, 0, -1);
+		xtensa_perfmon_reset(1);
+		xtensa_perfmon_start();
+		started = true;
+	}
+	return xtensa_perfmon_value(1);
+}
+#endif
+
+#if CONFIG_SOUND_STATS
+// Closes a 5 second window: keeps it for audio_get_stats and prints it
+#define AUDIO_STATS_FRAMES (5 * NES_REFRESH_RATE)
+static void audio_stats_frame()
+{
+	static int frames;
+
+	if (++frames < AUDIO_STATS_FRAMES)
+		return;
+	astats_last.underruns = astats.underruns;
+	astats_last.dma_errors = astats.dma_errors;
+	astats_last.ring_low = astats.ring_low;
+	astats_last.ring_high = astats.ring_high;
+	astats_last.latency_ms = audio_latency_ms();
+	astats_last.apu_us_avg = astats.apu_us / frames;
+	astats_last.apu_us_max = astats.apu_us_max;
+	logPrintf("audio: %u underruns, %u dma errors, ring %d..%d, latency %dms, apu %uus avg %uus max\n",
+			  (unsigned)astats_last.underruns, (unsigned)astats_last.dma_errors, astats_last.ring_low,
+			  astats_last.ring_high, astats_last.latency_ms, (unsigned)astats_last.apu_us_avg,
+			  (unsigned)astats_last.apu_us_max);
+	astats.ring_low = AUDIO_RING_SAMPLES;
+	astats.ring_high = 0;
+	astats.apu_us = astats.apu_us_max = 0;
+	frames = 0;
+}
+
+void audio_get_stats(audio_stats_t *stats)
+{
+	*stats = astats_last;
+}
+#endif
+
+#if CONFIG_NES_MEM_STATS
+// Stack headroom of the tasks a game runs with, and free, largest free block and low water mark
+// of each kind of heap, printed every 5 seconds. The allocated block count moving between two
+// reports means something on a per-frame path is calling malloc.
+#define MEM_STATS_FRAMES (5 * NES_REFRESH_RATE)
+static const struct
+{
+	const char *name;
+	uint32_t caps;
+} memHeaps[] = {
+	{"internal", MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT},
+	{"dma", MALLOC_CAP_DMA},
+	{"psram", MALLOC_CAP_SPIRAM},
+};
+static int memStack = -1; // least stack left in any task at the last report, bytes
+static const char *memStackTask = "";
+static int memBlocks = -1;
+static uint32_t memMoved; // memplace_moved() at the last report
+
+static void mem_stats_frame()
+{
+	static int frames;
+	multi_heap_info_t info;
+	char line[200];
+	int len;
+
+	if (++frames < MEM_STATS_FRAMES)
+		return;
+	frames = 0;
+
+	memStack = -1;
+	len = snprintf(line, sizeof(line), "stack left:");
+	// every task of the table that is running, and the one ticking the frames
+	for (int i = 0; i <= TASK_COUNT; i++)
+	{
+		const char *name = i < TASK_COUNT ? tasks_name(i) : "esp_timer";
+		TaskHandle_t task = xTaskGetHandle(name);
+		int left;
+
+		if (task == NULL)
+			continue;
+		left = uxTaskGetStackHighWaterMark(task);
+		if (len < sizeof(line))
+			len += snprintf(line + len, sizeof(line) - len, " %s %d", name, left);
+		if (memStack < 0 || left < memStack)
+		{
+			memStack = left;
+			memStackTask = name;
+		}
+	}
+	logPrintf("%s\n", line);
+
+	for (int i = 0; i < sizeof(memHeaps) / sizeof(memHeaps[0]); i++)
+	{
+		heap_caps_get_info(&info, memHeaps[i].caps);
+		if (info.total_free_bytes + info.total_allocated_bytes == 0)
+			continue;
+		logPrintf("heap %s: %d free, %d largest block, %d lowest\n", memHeaps[i].name, (int)info.total_free_bytes,
+				  (int)info.largest_free_block, (int)info.minimum_free_bytes);
+	}
+
+	heap_caps_get_info(&info, MALLOC_CAP_8BIT);
+	if (memBlocks >= 0)
+		logPrintf("heap: %d blocks allocated, %+d in 5 s\n", (int)info.allocated_blocks, (int)info.allocated_blocks - memBlocks);
+	memBlocks = info.allocated_blocks;
+
+	// counted by the code that goes over the PSRAM blocks, not measured
+	uint32_t moved = memplace_moved();
+	logPrintf("psram traffic: %d KB/s\n", (int)((moved - memMoved) / 5 / 1024));
+	memMoved = moved;
+}
+#endif
+
+#if CONFIG_NES_PROFILE
+void osd_profinfo(int line, char *buf, int len)
+{
+	buf[0] = 0;
+#if CONFIG_SOUND_STATS
+	if (line == 0)
+	{
+		audio_stats_t s;
+		audio_get_stats(&s);
+		snprintf(buf, len, "snd %uu %dms %d-%d", (unsigned)s.underruns, s.latency_ms, s.ring_low, s.ring_high);
+	}
+#endif
+#if CONFIG_NES_MEM_STATS
+	// free and largest block of internal RAM in KB, the tightest stack as of the last report
+	if (line == 1)
+		snprintf(buf, len, "mem %uk %uk stk %d %.6s",
+				 (unsigned)(heap_caps_get_free_size(memHeaps[0].caps) / 1024),
+				 (unsigned)(heap_caps_get_largest_free_block(memHeaps[0].caps) / 1024), memStack, memStackTask);
+#endif
+#if CONFIG_NES_YIELD
+	// the longest wait for this core, the longest slice lent, the slices forced by a deadline
+	if (line == 2)
+		emuYieldReport(buf, len);
+#endif
+#if CONFIG_NES_PACE_STATS
+	// tick rate, skipped, dropped, behind, present jitter avg/max; present intervals
+	if (line == 3 || line == 4)
+		snprintf(buf, len, "%s", paceText[line - 3]);
+#endif
+}
+#endif
+
+// a game's profile wants at least this clock, see nes_gamedb.h
+void osd_setminclock(int mhz)
+{
+	powerMinClock(mhz);
+}
+
+// Paused: nothing plays, stop the I2S DMA so its PM lock goes too and the chip can sleep.
+// With CONFIG_SOUND_SYNC the DAC is the frame clock, it keeps running on silence.
+void osd_pause(bool paused)
+{
+#if CONFIG_NES_PACE_STATS
+	// the ticks of a pause are owed to nobody
+	pace_restart();
+#endif
+#if CONFIG_SOUND_ENA && !CONFIG_SOUND_SYNC
+	if (paused)
+	{
+		i2s_zero_dma_buffer(0);
+		i2s_stop(0);
+	}
+	else
+		i2s_start(0);
+#endif
+}
+
+#if CONFIG_NES_NETPLAY
+static void linkFrame();
+#endif
+
+// Skipped frames make sound too, so audio goes per emulated frame rather than per blit
+void osd_endframe(void)
+{
+#if CONFIG_NES_REPLAY
+	replayFrames++;
+#endif
+#if CONFIG_NES_MOVIE
+	movieFrames++;
+#endif
+#if CONFIG_NES_DFS
+	emuFrames++;
+#endif
+#if CONFIG_NES_NETPLAY
+	linkFrame();
+#endif
+	do_audio_frame();
+#if CONFIG_SOUND_STATS
+	audio_stats_frame();
+#endif
+#if CONFIG_NES_CACHE_STATS
+	cache_stats_frame();
+#endif
+#if CONFIG_NES_MEM_STATS
+	mem_stats_frame();
+#endif
+#if CONFIG_NES_PACE_STATS && CONFIG_NES_FASTFORWARD
+	if (!ffOn)
+		pace_frame();
+#elif CONFIG_NES_PACE_STATS
+	pace_frame();
+#endif
+#if CONFIG_NES_YIELD
+	emuYieldPoint(true, frame_slack());
+#endif
+}
+
+#if !CONFIG_HW_LCD_BEAM_RACE
+/*
+** Frame buffers are handed around explicitly: the emulator renders into one,
+** custom_blit queues it to videoTask, and videoTask puts it on freeQueue once
+** it has been sent to the LCD. Nothing is ever drawn into a buffer that is
+** still being shown, so there is no tearing.
+*/
+#define VID_BUFFERS CONFIG_VID_BUFFERS
+
+static bitmap_t *vidBuffers[VID_BUFFERS];
+static uint8_t vidLinePal[VID_BUFFERS][NES_SCREEN_HEIGHT];
+static bitmap_t *renderBuffer;
+static QueueHandle_t freeQueue;
+
+static bitmap_t *create_buffer(int width, int height)
+{
+	int i;
+
+	if (NULL == vidBuffers[0])
+	{
+		for (i = 0; i < VID_BUFFERS; i++)
+		{
+			// room for all NES_SCREEN_HEIGHT lines; the PPU only draws the shown ones, but
+			// a cart with CHR latches gets all of them. They're written every frame, so
+			// internal RAM even when a plain malloc of this size would go to PSRAM.
+			uint8_t *data = memplace_alloc(MEM_HOT, width * NES_SCREEN_HEIGHT);
+
+			if (NULL == data)
+				return NULL;
+			vidBuffers[i] = bmp_createhw(data, width, NES_SCREEN_HEIGHT, width);
+			if (NULL == vidBuffers[i])
+				return NULL;
+			vidBuffers[i]->height = height;
+			vidBuffers[i]->linepal = vidLinePal[i];
+			bmp_clear(vidBuffers[i], GUI_BLACK);
+			if (i > 0)
+				xQueueSend(freeQueue, &vidBuffers[i], 0);
+		}
+		renderBuffer = vidBuffers[0];
+	}
+	return renderBuffer;
+}
+
+static bitmap_t *next_buffer(void)
+{
+	bitmap_t *bmp;
+
+	if (rombench_headless())
+		return renderBuffer;
+	// Prefer a buffer the display is done with. With none free, take back the
+	// oldest frame that is still waiting to be shown instead of stalling; only
+	// with two buffers and the other one on the LCD do we have to wait.
+	if (pdTRUE != xQueueReceive(freeQueue, &bmp, 0))
+	{
+		if (uxQueueMessagesWaiting(vidQueue) < 2 || pdTRUE != xQueueReceive(vidQueue, &bmp, 0))
+			xQueueReceive(freeQueue, &bmp, portMAX_DELAY);
+		else
+		{
+			latency_drop(bmp);
+#if CONFIG_NES_PACE_STATS
+			pace.reclaimed++;
+#endif
+		}
+	}
+	renderBuffer = bmp;
+	return bmp;
+}
+#endif
+
+#if CONFIG_HW_LCD_BEAM_RACE
+/*
+** Beam racing: the PPU renders into a ring of STREAM_LINES lines instead of a
+** full frame, and every finished line is queued to videoTask which sends it
+** to the LCD straight away. The queue is shorter than the ring, so the
+** emulator blocks before it can overwrite a line that hasn't been sent yet.
+*/
+#define STREAM_LINES 16
+
+static bitmap_t *streamBitmap;
+static uint8_t *streamRing;
+static uint8_t streamLinePal[NES_SCREEN_HEIGHT];
+static QueueHandle_t lineQueue;
+
+static bitmap_t *create_buffer(int width, int height)
+{
+	int i;
+
+	if (NULL == streamRing)
+		streamRing = malloc(STREAM_LINES * width);
+	if (NULL == streamRing)
+		return NULL;
+	memset(streamRing, GUI_BLACK, STREAM_LINES * width);
+
+	// room for all NES_SCREEN_HEIGHT lines, as above
+	if (NULL == streamBitmap)
+		streamBitmap = bmp_createhw(streamRing, width, NES_SCREEN_HEIGHT, width);
+	if (NULL == streamBitmap)
+		return NULL;
+	streamBitmap->height = height;
+	streamBitmap->linepal = streamLinePal;
+	streamBitmap->sharedlines = true;
+	for (i = 0; i < NES_SCREEN_HEIGHT; i++)
+		streamBitmap->line[i] = streamRing + (i % STREAM_LINES) * width;
+	return streamBitmap;
+}
+
+static void line_done(bitmap_t *bmp, int scanline)
+{
+	if (scanline < bmp->height && !rombench_headless())
+		xQueueSend(lineQueue, &scanline, portMAX_DELAY);
+}
+#endif
+
+#if CONFIG_NES_PPU_WORKER
+/*
+** PPU worker: the emulator (core 0) only snapshots the PPU state per scanline
+** and ppuTask on core 1 turns the snapshots into pixels. Single producer,
+** single consumer ring, same scheme as the audio ring.
+*/
+#define PPU_WORKER_LINES 32 // power of two
+static ppu_line_t *workerRing;
+static volatile uint32_t worker_head;
+static volatile uint32_t worker_tail;
+static volatile bool emuWaiting;
+static TaskHandle_t ppuTaskHandle;
+static TaskHandle_t emuTaskHandle;
+
+// Sleep the emulator until ppuTask drew another line
+// Until ppuTask moves worker_tail on from tail. The flag goes up before the ring is looked at
+// again and ppuTask moves the tail before it looks at the flag, both sequentially consistent:
+// either ppuTask sees the flag and notifies, or this sees the tail move and doesn't block.
+static void worker_wait_emu(uint32_t tail)
+{
+	__atomic_store_n(&emuWaiting, true, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&worker_tail, __ATOMIC_SEQ_CST) == tail)
+		ulTaskNotifyTake(pdTRUE, 1);
+	__atomic_store_n(&emuWaiting, false, __ATOMIC_RELEASE);
+}
+
+static ppu_line_t *worker_getline(void)
+{
+	while (worker_head - worker_tail >= PPU_WORKER_LINES)
+		worker_wait_emu(worker_tail);
+	return &workerRing[worker_head & (PPU_WORKER_LINES - 1)];
+}
+
+static void worker_putline(ppu_line_t *line)
+{
+	worker_head++;
+	xTaskNotifyGive(ppuTaskHandle);
+}
+
+static void worker_sync(void)
+{
+	while (worker_tail != worker_head)
+		worker_wait_emu(worker_tail);
+}
+
+static ppu_worker_t ppuWorker = {worker_getline, worker_putline, worker_sync};
+
+static void ppuTask(void *arg)
+{
+	while (1)
+	{
+		if (worker_tail == worker_head)
+		{
+			ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+			continue;
+		}
+		ppu_renderline(&workerRing[worker_tail & (PPU_WORKER_LINES - 1)]);
+		__atomic_store_n(&worker_tail, worker_tail + 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&emuWaiting, __ATOMIC_SEQ_CST))
+			xTaskNotifyGive(emuTaskHandle);
+	}
+}
+
+static int osd_init_ppuworker(void)
+{
+	workerRing = malloc(PPU_WORKER_LINES * sizeof(ppu_line_t));
+	if (workerRing == NULL)
+		return -1;
+	worker_head = worker_tail = 0;
+	// osd_init runs on the task that goes on to run the emulator
+	emuTaskHandle = xTaskGetCurrentTaskHandle();
+	tasks_start(TASK_PPU, &ppuTask, NULL, &ppuTaskHandle);
+	ppu_setworker(&ppuWorker);
+	return 0;
+}
+#endif
+
+#if CONFIG_NES_MENU_FREEZE
+#define MENU_POLL_MS 20
+#endif
+
+// This runs on core 1.
+static void videoTask(void *arg)
+{
+	int x, y;
+
+	xWidth = 320;
+	yHight = 240;
+	x = (320 - xWidth) / 2;
+	y = ((240 - yHight) / 2);
+#if CONFIG_HW_LCD_BEAM_RACE
+	int line;
+	bool streaming = false;
+
+	while (1)
+	{
+		PROF_BEGIN(t0);
+		xQueueReceive(lineQueue, &line, portMAX_DELAY);
+		PROF_END(PROF_VIDWAIT, t0);
+		if (0 == line)
+		{
+			powerVideoIdle(false);
+			streaming = ili9341_stream_begin(x, y, xWidth, yHight, settings.xStretch, settings.yStretch);
+			if (!streaming)
+				powerVideoIdle(true);
+		}
+		if (!streaming)
+			continue; // joined in the middle of a frame, or the panel sleeps
+		PROF_BEGIN(t1);
+		ili9341_stream_row(line, streamBitmap->line[line], streamLinePal[line]);
+		PROF_END(PROF_LCD, t1);
+		if (streamBitmap->height - 1 == line)
+		{
+			ili9341_stream_end();
+#if CONFIG_NES_PACE_STATS
+			pace_present();
+#endif
+			streaming = false;
+			powerVideoIdle(true);
+		}
+	}
+#else
+	bitmap_t *bmp = NULL;
+	int64_t blitStart;
+	int blitTime = 0; // running average, us
+
+	while (1)
+	{
+		PROF_BEGIN(t0);
+#if CONFIG_NES_MENU_FREEZE
+		// frozen under the menu no frames come, but what the box shows still changes; the
+		// last frame sent is still in its buffer, nothing renders while frozen
+		while (pdTRUE != xQueueReceive(vidQueue, &bmp, getShowMenu() ? MENU_POLL_MS / portTICK_PERIOD_MS : portMAX_DELAY))
+		{
+			if (bmp != NULL)
+				ili9341_write_menu(x, y, xWidth, yHight, (const uint8_t **)bmp->line, bmp->linepal, settings.xStretch, settings.yStretch);
+		}
+#else
+		xQueueReceive(vidQueue, &bmp, portMAX_DELAY);
+#endif
+		PROF_END(PROF_VIDWAIT, t0);
+		powerVideoIdle(false);
+		if (presentMode == PRESENT_MODE_30 ||
+			(presentMode == PRESENT_MODE_ADAPTIVE && blitTime > framePeriodUs))
+		{
+			// 30: skip one frame. adaptive: can't make the deadline, show the newer frame
+			latency_drop(bmp);
+#if CONFIG_NES_PACE_STATS
+			pace.dropped++;
+#endif
+			xQueueSend(freeQueue, &bmp, portMAX_DELAY);
+			xQueueReceive(vidQueue, &bmp, portMAX_DELAY);
+		}
+		blitStart = esp_timer_get_time();
+		latency_blit(bmp, false);
+		PROF_BEGIN(t1);
+		ili9341_write_frame(x, y, /*DEFAULT_WIDTH, DEFAULT_HEIGHT,*/ xWidth, yHight, (const uint8_t **)bmp->line, bmp->linepal, settings.xStretch, settings.yStretch);
+		PROF_END(PROF_LCD, t1);
+		latency_blit(bmp, true);
+#if CONFIG_NES_PACE_STATS
+		pace_present();
+#endif
+#if CONFIG_NES_DFS
+		powerVideoBusy((int)(esp_timer_get_time() - blitStart));
+#endif
+		blitTime += ((int)(esp_timer_get_time() - blitStart) - blitTime) / 8;
+		xQueueSend(freeQueue, &bmp, portMAX_DELAY);
+		powerVideoIdle(true);
+	}
+#endif
+}
+
+/*
+** Input
+*/
+
+static void osd_initinput()
+{
+	psxcontrollerInit();
+	bthidInit();
+}
+
+#if CONFIG_NES_REPLAY
+static void replay_report()
+{
+	uint32 crc = nes_getcontextptr()->rominfo->crc;
+	const char *verdict[] = {"no golden entry", "FAIL", "PASS"};
+	int r = replay_check(CONFIG_NES_REPLAY_GOLDEN, crc, replayFrames);
+
+	logPrintf("replay: %08X %d %08X %08X %s\n", (unsigned)crc, replayFrames, (unsigned)replay_framehash(),
+			  (unsigned)replay_audiohash(), verdict[r + 1]);
+}
+#endif
+
+#if CONFIG_NES_MOVIE
+static void movie_start(void)
+{
+	free(movie);
+	movie = NULL;
+	movieFrames = 0;
+	// the benchmark plays a script already
+	if (rombench_running())
+		return;
+	movie = memplace_alloc(MEM_COLD, CONFIG_NES_MOVIE_KB * 1024);
+	if (movie == NULL)
+	{
+		printf("movie: no room to record\n");
+		return;
+	}
+	replay_record(movie, CONFIG_NES_MOVIE_KB * 1024);
+}
+
+// what happened can't be played back from power on, nothing more is recorded
+static void movie_drop(const char *why)
+{
+	if (movie == NULL)
+		return;
+	printf("movie: not recorded, %s\n", why);
+	replay_record(NULL, 0);
+	free(movie);
+	movie = NULL;
+}
+
+// b the buttons going to the game this frame, psxReadInput bits
+static void movie_note(int b)
+{
+	if (movie == NULL)
+		return;
+	replay_note(movieFrames, ~b & 0xffff);
+}
+
+// The game is left: the script goes out over UART, ready to be pasted into
+// CONFIG_NES_REPLAY_INPUT or given to the host harness
+static void movie_end(void)
+{
+	if (movie == NULL)
+		return;
+	if (replay_recorded() < 0)
+		printf("movie: not recorded, more than %d KB\n", CONFIG_NES_MOVIE_KB);
+	else
+		printf("movie: %08X %d %s\n", (unsigned)nes_getcontextptr()->rominfo->crc, movieFrames, movie);
+	replay_record(NULL, 0);
+	free(movie);
+	movie = NULL;
+}
+#endif
+
+void movieStateLoaded(void)
+{
+#if CONFIG_NES_MOVIE
+	// a state from flash is a different past
+	movie_drop("a state was loaded");
+#endif
+}
+
+static bool suspended;
+static bool resumeWanted;
+
+void setResume(void)
+{
+	resumeWanted = true;
+}
+
+bool getSuspended()
+{
+	bool ret = suspended;
+
+	suspended = false;
+	return ret;
+}
+
+// the snapshot goes to the suspend slot, main.c waits for it to be written
+static void suspendGame(void)
+{
+	nes_t *nes = nes_getcontextptr();
+	int size = state_snapshotsize();
+	uint8_t *buf = memplace_alloc(MEM_COLD, size);
+
+	if (buf == NULL)
+	{
+		printf("No room to suspend the game\n");
+		return;
+	}
+	state_snapshot(buf, size);
+	memplace_traffic(2 * size); // written, and read back by the flash write
+	romsave_storestate(nes->rominfo->crc, ROMSAVE_SUSPEND_SLOT, buf, size);
+	free(buf);
+	suspended = true;
+}
+
+static void resumeGame(void)
+{
+	nes_t *nes = nes_getcontextptr();
+	int size = state_snapshotsize();
+	uint8_t *buf = memplace_alloc(MEM_COLD, size);
+	int length;
+
+	if (buf == NULL)
+		return;
+	length = romsave_loadstate(nes->rominfo->crc, ROMSAVE_SUSPEND_SLOT, buf, size);
+	if (length > 0)
+		memplace_traffic(2 * length);
+	if (length < 0 || state_restore(buf, length))
+		printf("No suspended state, starting over\n");
+	free(buf);
+}
+
+static void fireEventsOf(const int *events, int b, int chg)
+{
+	event_t evh;
+
+	for (int x = 0; x < 16; x++, chg >>= 1, b >>= 1)
+	{
+		if (chg & 1)
+		{
+			evh = event_get(events[x]);
+			if (evh)
+				evh((b & 1) ? INP_STATE_BREAK : INP_STATE_MAKE);
+		}
+	}
 }
 
-static int logprint(const char *string)
+// psxReadInput bits, active low
+static const int inputEvents[16] = {
+	event_joypad1_select, 0, event_snapshot, event_joypad1_start, event_joypad1_up, event_joypad1_right, event_joypad1_down, event_joypad1_left,
+	event_state_load, event_state_save, event_rewind, event_fastforward, event_soft_reset, event_joypad1_a, event_joypad1_b, event_hard_reset};
+
+// player 2: a second Bluetooth pad, or the other console of a link
+static const int pad2Events[16] = {
+	event_joypad2_select, 0, 0, event_joypad2_start, event_joypad2_up, event_joypad2_right, event_joypad2_down, event_joypad2_left,
+	0, 0, 0, 0, 0, event_joypad2_a, event_joypad2_b, 0};
+
+static void fireEvents(int b, int chg)
+{
+	fireEventsOf(inputEvents, b, chg);
+}
+
+// The pad buttons as of this moment, when the game strobes the pad and
+// once a frame; the rest of the buttons only go with the frame.
+static int padApplied = PAD_MASK, pad2Applied = PAD_MASK;
+
+static void applyPad(void)
+{
+	int b = psxLatchPad();
+	int b2 = psxLatchPad2();
+
+	fireEvents(b, (b ^ padApplied) & PAD_MASK);
+	fireEventsOf(pad2Events, b2, (b2 ^ pad2Applied) & PAD_MASK);
+	padApplied = b;
+	pad2Applied = b2;
+}
+
+#if CONFIG_NES_NETPLAY
+// Linked, both pads come from netplayFrame, once per emulated frame, the same on both
+// consoles. Nothing else that changes the game goes, no states, rewind or resets.
+static bool linkPending; // a game was started, netplayBegin goes after its first frame
+static int linkPad1 = PAD_MASK, linkPad2 = PAD_MASK;
+
+static bool linked()
 {
-	return printf("%s", string);
+	return linkPending || netplayActive();
+}
+
+static void linkFrame()
+{
+	int pad1, pad2;
+
+	if (linkPending)
+	{
+		linkPending = false;
+		if (!netplayBegin(nes_getcontextptr()->rominfo->crc))
+			return;
+#if CONFIG_NES_MOVIE
+		movie_drop("linked, the other console's pad isn't in it");
+#endif
+		linkPad1 = linkPad2 = PAD_MASK;
+	}
+	if (!netplayActive())
+		return;
+	netplayFrame(psxReadInput(), nes_ramhash(), &pad1, &pad2);
+	if (!netplayActive())
+	{
+		// lost: player 2 lets go, player 1 is this console's pad again
+		fireEventsOf(pad2Events, PAD_MASK, ~linkPad2 & PAD_MASK);
+		padApplied = linkPad1;
+		pad2Applied = PAD_MASK;
+		return;
+	}
+	fireEventsOf(inputEvents, pad1, (pad1 ^ linkPad1) & PAD_MASK);
+	fireEventsOf(pad2Events, pad2, (pad2 ^ linkPad2) & PAD_MASK);
+	linkPad1 = pad1;
+	linkPad2 = pad2;
+}
+#else
+static bool linked()
+{
+	return false;
+}
+#endif
+
+// called by input_strobe, on a $4016 write
+void osd_strobeinput(void)
+{
+#if CONFIG_NES_MOVIE
+	// recorded, the pad goes once a frame, as it plays back
+	if (movie)
+		return;
+#endif
+#if !CONFIG_NES_REPLAY
+	if (!linked() && !rombench_running())
+		applyPad();
+#endif
+}
+
+void osd_getinput(void)
+{
+	static int oldb = 0xffff;
+	bool benchDone = false;
+#if CONFIG_NES_REPLAY
+	// The script replaces the pad; the result goes out once the last hashed frame is shown
+	int b = ~replay_buttons(replayFrames) & 0xffff;
+	if (replayFrames == CONFIG_NES_REPLAY_FRAMES)
+		replay_report();
+	int chg = b ^ oldb;
+#else
+	int b = psxReadInput();
+	int chg = (b ^ oldb) & ~PAD_MASK;
+	// the benchmark's script replaces the pad, Button1 still stops it
+	if (rombench_running())
+	{
+		benchDone = rombench_frame(&b);
+		chg = b ^ oldb;
+	}
+#endif
+	oldb = b;
+	event_t evh;
+
+	cputraceFrame(b);
+	rendertraceFrame(b);
+
+	// first frame of a game started to resume one
+	if (resumeWanted)
+	{
+		resumeWanted = false;
+		resumeGame();
+#if CONFIG_NES_MOVIE
+		movie_drop("the game was resumed");
+#endif
+	}
+	// Back to the menu, or to sleep: the emulator winds down and app_main takes over
+	if (getSuspend())
+		suspendGame();
+	if (getLauncher() || suspended || benchDone)
+	{
+#if CONFIG_NES_MOVIE
+		movie_end();
+#endif
+		evh = event_get(event_quit);
+		if (evh)
+			evh(INP_STATE_MAKE);
+		oldb = 0xffff;
+		padApplied = pad2Applied = PAD_MASK;
+		return;
+	}
+	if (linked())
+		return;
+#if CONFIG_NES_MENU_FREEZE
+	nes_setfreeze(getShowMenu());
+#endif
+	//	printf("Input: %x\n", b);
+	fireEvents(b, chg);
+#if !CONFIG_NES_REPLAY
+	if (!rombench_running())
+		applyPad();
+#endif
+#if CONFIG_NES_MOVIE
+	// as the game has them: the rest of the buttons and the pad just applied
+	movie_note((b & ~PAD_MASK) | (padApplied & PAD_MASK));
+#endif
+}
+
+static void osd_freeinput(void)
+{
+}
+
+void osd_getmouse(int *x, int *y, int *button)
+{
+}
+
+/*
+** Shutdown
+*/
+
+/* this is at the bottom, to eliminate warnings */
+// The menu draws with the same LCD driver, wait until the last frame is out
+static void osd_waitvideo(void)
+{
+#if CONFIG_HW_LCD_BEAM_RACE
+	while (uxQueueMessagesWaiting(lineQueue))
+		vTaskDelay(1);
+#else
+	// the emulator keeps its render buffer, all the others come back
+	while (uxQueueMessagesWaiting(freeQueue) < VID_BUFFERS - 1)
+		vTaskDelay(1);
+#endif
+	vTaskDelay(2); // the row or frame videoTask took last
+}
+
+void osd_shutdown()
+{
+	netplayEnd();
+	osd_stopsound();
+	osd_waitvideo();
+	osd_freeinput();
 }
 
 /*
@@ -327,16 +2003,42 @@ static int logprint(const char *string)
 
 int osd_init()
 {
-	log_chain_logfunc(logprint);
+	static bool ready;
+
+	logringInit();
+	cputraceStart();
+	rendertraceStart();
+#if CONFIG_NES_NETPLAY
+	linkPending = true;
+#endif
+	// Sound, LCD, tasks and queues stay up from one game to the next
+	if (ready)
+		return 0;
+#if CONFIG_NES_REPLAY
+	replay_load(CONFIG_NES_REPLAY_INPUT);
+#endif
 
 	if (osd_init_sound())
 		return -1;
 	printf("free heap after recv: %d", xPortGetFreeHeapSize());
 	ili9341_init();
-	ili9341_write_frame(0, 0, 320, 240, NULL, 0, 0);
-	vidQueue = xQueueCreate(1, sizeof(bitmap_t *));
-	xTaskCreatePinnedToCore(&videoTask, "videoTask", 2048, NULL, 5, NULL, 1);
+	ili9341_write_frame(0, 0, 320, 240, NULL, NULL, 0, 0);
+#if CONFIG_HW_LCD_BEAM_RACE
+	lineQueue = xQueueCreate(STREAM_LINES - 2, sizeof(int));
+#else
+	vidQueue = xQueueCreate(VID_BUFFERS, sizeof(bitmap_t *));
+	freeQueue = xQueueCreate(VID_BUFFERS, sizeof(bitmap_t *));
+#endif
+	tasks_start(TASK_VIDEO, &videoTask, NULL, NULL);
+	powerInit();
+#if CONFIG_NES_PPU_WORKER
+	if (osd_init_ppuworker())
+		return -1;
+#endif
 	osd_initinput();
 	printf("free heap after recv: %d", xPortGetFreeHeapSize());
+	// every task a game needs has started
+	tasks_report();
+	ready = true;
 	return 0;
 }
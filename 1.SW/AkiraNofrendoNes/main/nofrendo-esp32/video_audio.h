@@ -0,0 +1,27 @@
+#ifndef VIDEO_AUDIO_H
+#define VIDEO_AUDIO_H
+#include <stdint.h>
+#include <stdbool.h>
+
+//Audio telemetry (CONFIG_SOUND_STATS). Water marks and APU time cover the last 5 second
+//window, the counters run from boot.
+typedef struct
+{
+	uint32_t underruns;  //DMA buffers that went out without new samples in them
+	uint32_t dma_errors; //I2S_EVENT_DMA_ERROR from the driver
+	int ring_low;        //least and most samples in the audio ring
+	int ring_high;
+	int latency_ms;      //time from the APU rendering a sample to the DAC playing it
+	uint32_t apu_us_avg; //apu_process per frame
+	uint32_t apu_us_max;
+} audio_stats_t;
+
+void audio_get_stats(audio_stats_t *stats);
+
+//The next game started picks up from its suspend slot
+void setResume(void);
+//True once after the power button suspended a game, its state is queued for flash
+bool getSuspended();
+//A state was read back from flash, the recording (CONFIG_NES_MOVIE) can't replay from power on
+void movieStateLoaded(void);
+#endif
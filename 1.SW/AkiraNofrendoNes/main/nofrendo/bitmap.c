@@ -24,6 +24,7 @@
 */
 
 #include <stdio.h>
+#include <stdint.h>
 #include <string.h>
 #include <noftypes.h>
 #include <bitmap.h>
@@ -49,9 +50,11 @@ static bitmap_t *_make_bitmap(uint8 *data_addr, bool hw, int width,
       return NULL;
 
    bitmap->hardware = hw;
+   bitmap->sharedlines = false;
    bitmap->height = height;
    bitmap->width = width;
    bitmap->data = data_addr;
+   bitmap->linepal = NULL;
    bitmap->pitch = pitch + (overdraw * 2);
 
    /* Set up line pointers */
@@ -61,7 +64,7 @@ static bitmap_t *_make_bitmap(uint8 *data_addr, bool hw, int width,
    if (false == bitmap->hardware)
    {
       bitmap->pitch = (bitmap->pitch + 3) & ~3;
-      bitmap->line[0] = (uint8 *) (((uint32) bitmap->data + overdraw + 3) & ~3);
+      bitmap->line[0] = (uint8 *) (((uintptr_t) bitmap->data + overdraw + 3) & ~3);
    }
    else
    { 
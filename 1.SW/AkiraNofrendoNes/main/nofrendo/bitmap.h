@@ -44,7 +44,9 @@ typedef struct bitmap_s
 {
    int width, height, pitch;
    bool hardware;             /* is data a hardware region? */
+   bool sharedlines;          /* fewer line buffers than lines, used again down the frame */
    uint8 *data;               /* protected */
+   uint8 *linepal;            /* palette of each line, NULL if not kept; owned by the creator */
    uint8 *line[ZERO_LENGTH];  /* will hold line pointers */
 } bitmap_t;
 
@@ -219,7 +219,7 @@ static int load_config(char *filename)
                s = strchr(s, ']');
                if (NULL == s)
                {
-                  log_printf("load_config: missing ']' after group\n");
+                  log_printf(LOG_WARN "load_config: missing ']' after group\n");
                   s = group + strlen(group);
                }
                else
@@ -239,7 +239,7 @@ static int load_config(char *filename)
                s = strchr(s, '=');
                if (NULL == s)
                {
-                  log_printf("load_config: missing '=' after key\n");
+                  log_printf(LOG_WARN "load_config: missing '=' after key\n");
                   s = key + strlen(key);
                }
                else
@@ -260,7 +260,7 @@ static int load_config(char *filename)
                   myvar_t *var = my_create(group ? group : "", key, s);
                   if (NULL == var)
                   {
-                     log_printf("load_config: my_create failed\n");
+                     log_printf(LOG_WARN "load_config: my_create failed\n");
                      return -1;
                   }
 
@@ -291,7 +291,7 @@ static int save_config(char *filename)
    config_file = fopen(filename, "w");
    if (NULL == config_file)
    {
-      log_printf("save_config failed\n");
+      log_printf(LOG_WARN "save_config failed\n");
       return -1;
    }
 
@@ -316,6 +316,8 @@ static void close_config(void)
    }
 
    my_cleanup(myVars);
+   myVars = NULL;
+   mySaveNeeded = false;
 }
 
 static void write_int(const char *group, const char *key, int value)
@@ -329,7 +331,7 @@ static void write_int(const char *group, const char *key, int value)
    var = my_create(group, key, buf);
    if (NULL == var)
    {
-      log_printf("write_int failed\n");
+      log_printf(LOG_WARN "write_int failed\n");
       return;
    }
 
@@ -363,7 +365,7 @@ static void write_string(const char *group, const char *key, const char *value)
    var = my_create(group, key, value);
    if (NULL == var)
    {
-      log_printf("write_string failed\n");
+      log_printf(LOG_WARN "write_string failed\n");
       return;
    }
 
@@ -23,12 +23,26 @@
 ** $Id: nes6502.c,v 1.2 2001/04/27 14:37:11 neil Exp $
 */
 
+#include <string.h>
 #include "noftypes.h"
 #include "nes6502.h"
 #include "dis6502.h"
 
 // #define  NES6502_DISASM
 
+/* record instructions into a ring for nes6502_gettrace (CONFIG_NES_CPU_TRACE) */
+// #define  NES6502_TRACE
+
+/* count opcodes and handler accesses for nes6502_gethist (CONFIG_NES_HISTOGRAM) */
+// #define  NES6502_HISTOGRAM
+
+/* keep N and Z in one word and all flags at register width, see below */
+// #define  NES6502_LAZY_FLAGS
+
+/* cache decoded PRG-ROM instructions (CONFIG_NES_PREDECODE) */
+// #define  NES6502_PREDECODE
+#define  NES6502_PREDECODE_BITS  10 /* 1024 entries, 8KB */
+
 #ifdef __GNUC__
 #define NES6502_JUMPTABLE
 #endif /* __GNUC__ */
@@ -50,21 +64,62 @@
 
 #define EMPTY_READ(value) /* empty */
 
+/*
+** Instruction fetch -- with NES6502_PREDECODE the opcode and the
+** two bytes after it come out of the predecode cache in one go
+*/
+#ifdef NES6502_PREDECODE
+
+#define FETCH_OPCODE(opcode)                                                              \
+   {                                                                                      \
+      const uint8 *src = cpu.mem_page[PC >> NES6502_BANKSHIFT] + (PC & NES6502_BANKMASK); \
+      if (PC & 0x8000)                                                                    \
+      {                                                                                   \
+         nes6502_decoded *dec = &predecode[PC & PREDECODE_MASK];                          \
+         if (dec->src != src)                                                             \
+            predecode_fill(dec, src, PC);                                                 \
+         opcode = dec->opcode;                                                            \
+         operand = dec->operand;                                                          \
+      }                                                                                   \
+      else                                                                                \
+      {                                                                                   \
+         opcode = *src;                                                                   \
+         operand = predecode_operand(PC);                                                 \
+      }                                                                                   \
+      PC++;                                                                               \
+   }
+
+#define OPERAND_BYTE() ((uint8)operand)
+#define OPERAND_WORD() (operand)
+
+#else /* !NES6502_PREDECODE */
+
+#define FETCH_OPCODE(opcode)        \
+   {                                \
+      opcode = bank_readbyte(PC++); \
+   }
+
+#define OPERAND_BYTE() bank_readbyte(PC)
+#define OPERAND_WORD() bank_readword(PC)
+
+#endif /* !NES6502_PREDECODE */
+
 /*
 ** Addressing mode macros
 */
 
 /* Immediate */
-#define IMMEDIATE_BYTE(value)      \
-   {                               \
-      value = bank_readbyte(PC++); \
+#define IMMEDIATE_BYTE(value)  \
+   {                           \
+      value = OPERAND_BYTE();  \
+      PC++;                    \
    }
 
 /* Absolute */
-#define ABSOLUTE_ADDR(address)     \
-   {                               \
-      address = bank_readword(PC); \
-      PC += 2;                     \
+#define ABSOLUTE_ADDR(address)  \
+   {                            \
+      address = OPERAND_WORD(); \
+      PC += 2;                  \
    }
 
 #define ABSOLUTE(address, value)     \
@@ -238,8 +293,52 @@
 ** we need to check them (branches, etc).  This makes the
 ** zero flag only really be 'set' when z_flag == 0.
 ** The rest of the flags are stored as true booleans.
+**
+** NES6502_LAZY_FLAGS goes one further and keeps N and Z in a
+** single word, so setting them from a result is one store: Z is
+** set when the low byte is zero, N when bit 7 or bit 8 is.  Bit 8
+** is only used to hold N and Z together, when they come from P.
 */
 
+#ifdef NES6502_LAZY_FLAGS
+
+#define DECLARE_FLAGS \
+   uint32 nz_flag, v_flag, b_flag, d_flag, i_flag, c_flag;
+
+#define N_FLAG_SET() (nz_flag & 0x180)
+#define Z_FLAG_SET() (0 == (nz_flag & 0xFF))
+
+/* Scatter flags to separate variables */
+#define SCATTER_FLAGS(value)                                               \
+   {                                                                       \
+      nz_flag = (((value) & N_FLAG) << 1) | (((value) & Z_FLAG) ^ Z_FLAG); \
+      v_flag = (value) & V_FLAG;                                           \
+      b_flag = (value) & B_FLAG;                                           \
+      d_flag = (value) & D_FLAG;                                           \
+      i_flag = (value) & I_FLAG;                                           \
+      c_flag = (value) & C_FLAG;                                           \
+   }
+
+/* Combine flags into flag register */
+#define COMBINE_FLAGS() \
+   (                    \
+       (N_FLAG_SET() ? N_FLAG : 0) | (v_flag ? V_FLAG : 0) | R_FLAG | (b_flag ? B_FLAG : 0) | (d_flag ? D_FLAG : 0) | (i_flag ? I_FLAG : 0) | (Z_FLAG_SET() ? Z_FLAG : 0) | c_flag)
+
+/* Set N and Z flags based on given value */
+#define SET_NZ_FLAGS(value) nz_flag = (value);
+
+/* N from bit 7 of one value, Z from another (8 bit) one */
+#define SET_N_Z_FLAGS(n, z) nz_flag = (((n) & N_FLAG) << 1) | (z);
+
+#else /* !NES6502_LAZY_FLAGS */
+
+#define DECLARE_FLAGS             \
+   uint8 n_flag, v_flag, b_flag; \
+   uint8 d_flag, i_flag, z_flag, c_flag;
+
+#define N_FLAG_SET() (n_flag & N_FLAG)
+#define Z_FLAG_SET() (0 == z_flag)
+
 /* Scatter flags to separate variables */
 #define SCATTER_FLAGS(value)              \
    {                                      \
@@ -260,6 +359,15 @@
 /* Set N and Z flags based on given value */
 #define SET_NZ_FLAGS(value) n_flag = z_flag = (value);
 
+/* N from bit 7 of one value, Z from another (8 bit) one */
+#define SET_N_Z_FLAGS(n, z) \
+   {                        \
+      n_flag = (n);         \
+      z_flag = (z);         \
+   }
+
+#endif /* !NES6502_LAZY_FLAGS */
+
 /* For BCC, BCS, BEQ, BMI, BNE, BPL, BVC, BVS */
 #define RELATIVE_BRANCH(condition)                  \
    {                                                \
@@ -270,6 +378,8 @@
             ADD_CYCLES(1);                          \
          ADD_CYCLES(3);                             \
          PC += (int8)btemp;                         \
+         if (cpu.idle_skip && (int8)btemp < 0)      \
+            idle_branch(PC, (int8)btemp);           \
       }                                             \
       else                                          \
       {                                             \
@@ -312,38 +422,37 @@
 
 /* Warning! NES CPU has no decimal mode, so by default this does no BCD! */
 #ifdef NES6502_DECIMAL
-#define ADC(cycles, read_func)                         \
-   {                                                   \
-      read_func(data);                                 \
-      if (d_flag)                                      \
-      {                                                \
-         temp = (A & 0x0F) + (data & 0x0F) + c_flag;   \
-         if (temp >= 10)                               \
-            temp = (temp - 10) | 0x10;                 \
-         temp += (A & 0xF0) + (data & 0xF0);           \
-         z_flag = (A + data + c_flag) & 0xFF;          \
-         n_flag = temp;                                \
-         v_flag = ((~(A ^ data)) & (A ^ temp) & 0x80); \
-         if (temp > 0x90)                              \
-         {                                             \
-            temp += 0x60;                              \
-            c_flag = 1;                                \
-         }                                             \
-         else                                          \
-         {                                             \
-            c_flag = 0;                                \
-         }                                             \
-         A = (uint8)temp;                              \
-      }                                                \
-      else                                             \
-      {                                                \
-         temp = A + data + c_flag;                     \
-         c_flag = (temp >> 8) & 1;                     \
-         v_flag = ((~(A ^ data)) & (A ^ temp) & 0x80); \
-         A = (uint8)temp;                              \
-         SET_NZ_FLAGS(A);                              \
-      }                                                \
-      ADD_CYCLES(cycles);                              \
+#define ADC(cycles, read_func)                            \
+   {                                                      \
+      read_func(data);                                    \
+      if (d_flag)                                         \
+      {                                                   \
+         temp = (A & 0x0F) + (data & 0x0F) + c_flag;      \
+         if (temp >= 10)                                  \
+            temp = (temp - 10) | 0x10;                    \
+         temp += (A & 0xF0) + (data & 0xF0);              \
+         SET_N_Z_FLAGS(temp, (A + data + c_flag) & 0xFF); \
+         v_flag = ((~(A ^ data)) & (A ^ temp) & 0x80);    \
+         if (temp > 0x90)                                 \
+         {                                                \
+            temp += 0x60;                                 \
+            c_flag = 1;                                   \
+         }                                                \
+         else                                             \
+         {                                                \
+            c_flag = 0;                                   \
+         }                                                \
+         A = (uint8)temp;                                 \
+      }                                                   \
+      else                                                \
+      {                                                   \
+         temp = A + data + c_flag;                        \
+         c_flag = (temp >> 8) & 1;                        \
+         v_flag = ((~(A ^ data)) & (A ^ temp) & 0x80);    \
+         A = (uint8)temp;                                 \
+         SET_NZ_FLAGS(A);                                 \
+      }                                                   \
+      ADD_CYCLES(cycles);                                 \
    }
 #else
 #define ADC(cycles, read_func)                      \
@@ -363,7 +472,7 @@
    {                                   \
       read_func(data);                 \
       A &= data;                       \
-      c_flag = (n_flag & N_FLAG) >> 7; \
+      c_flag = N_FLAG_SET() ? 1 : 0;   \
       SET_NZ_FLAGS(A);                 \
       ADD_CYCLES(cycles);              \
    }
@@ -470,34 +579,33 @@
       RELATIVE_BRANCH(0 != c_flag); \
    }
 
-#define BEQ()                       \
-   {                                \
-      RELATIVE_BRANCH(0 == z_flag); \
+#define BEQ()                        \
+   {                                 \
+      RELATIVE_BRANCH(Z_FLAG_SET()); \
    }
 
 /* bit 7/6 of data move into N/V flags */
-#define BIT(cycles, read_func) \
-   {                           \
-      read_func(data);         \
-      n_flag = data;           \
-      v_flag = data & V_FLAG;  \
-      z_flag = data & A;       \
-      ADD_CYCLES(cycles);      \
+#define BIT(cycles, read_func)       \
+   {                                 \
+      read_func(data);               \
+      SET_N_Z_FLAGS(data, data & A); \
+      v_flag = data & V_FLAG;        \
+      ADD_CYCLES(cycles);            \
    }
 
-#define BMI()                          \
-   {                                   \
-      RELATIVE_BRANCH(n_flag &N_FLAG); \
+#define BMI()                        \
+   {                                 \
+      RELATIVE_BRANCH(N_FLAG_SET()); \
    }
 
-#define BNE()                       \
-   {                                \
-      RELATIVE_BRANCH(0 != z_flag); \
+#define BNE()                         \
+   {                                  \
+      RELATIVE_BRANCH(!Z_FLAG_SET()); \
    }
 
-#define BPL()                                  \
-   {                                           \
-      RELATIVE_BRANCH(0 == (n_flag & N_FLAG)); \
+#define BPL()                         \
+   {                                  \
+      RELATIVE_BRANCH(!N_FLAG_SET()); \
    }
 
 /* Software interrupt type thang */
@@ -679,7 +787,7 @@
 
 #define JMP_INDIRECT()                                                   \
    {                                                                     \
-      temp = bank_readword(PC);                                          \
+      temp = OPERAND_WORD();                                             \
       /* bug in crossing page boundaries */                              \
       if (0xFF == (temp & 0xFF))                                         \
          PC = (bank_readbyte(temp & 0xFF00) << 8) | bank_readbyte(temp); \
@@ -688,19 +796,23 @@
       ADD_CYCLES(5);                                                     \
    }
 
-#define JMP_ABSOLUTE() \
-   {                   \
-      JUMP(PC);        \
-      ADD_CYCLES(3);   \
+#define JMP_ABSOLUTE()                  \
+   {                                    \
+      temp = PC - 1;                    \
+      PC = OPERAND_WORD();              \
+      ADD_CYCLES(3);                    \
+      if (cpu.idle_skip && PC == temp)  \
+         idle_burn(3);                  \
    }
 
-#define JSR()          \
-   {                   \
-      PC++;            \
-      PUSH(PC >> 8);   \
-      PUSH(PC & 0xFF); \
-      JUMP(PC - 1);    \
-      ADD_CYCLES(6);   \
+#define JSR()                \
+   {                         \
+      temp = OPERAND_WORD(); \
+      PC++;                  \
+      PUSH(PC >> 8);         \
+      PUSH(PC & 0xFF);       \
+      PC = temp;             \
+      ADD_CYCLES(6);         \
    }
 
 /* undocumented */
@@ -1183,10 +1295,257 @@ INLINE void bank_writebyte(register uint32 address, register uint8 value)
    cpu.mem_page[address >> NES6502_BANKSHIFT][address & NES6502_BANKMASK] = value;
 }
 
+#ifdef NES6502_TRACE
+
+/* Instruction trace: a store of 16 bytes and a compare or two per
+** instruction while recording, one test of rec once stopped.
+*/
+static struct
+{
+   nes6502_trace *ring;
+   nes6502_trace *rec;  /* ring while recording, NULL once stopped */
+   uint32 mask, head;   /* head counts every entry written */
+   int after, left;     /* entries to go past a trigger, left -1 till one */
+   uint32 watch_pc, watch_addr;
+   int watch_value;     /* the watched RAM byte at the last instruction, -1 unseen */
+} trace = { NULL, NULL, 0, 0, 0, -1, NES6502_TRACE_NONE, NES6502_TRACE_NONE, -1 };
+
+INLINE void trace_trigger(void)
+{
+   if (trace.rec && trace.left < 0)
+   {
+      trace.left = trace.after;
+      if (0 == trace.left)
+         trace.rec = NULL;
+   }
+}
+
+INLINE void trace_step(uint32 pc, uint8 p, uint8 a, uint8 x, uint8 y, uint8 s)
+{
+   nes6502_trace *ent = &trace.rec[trace.head++ & trace.mask];
+
+   ent->cycles = cpu.total_cycles;
+   ent->pc = (uint16) pc;
+   ent->code[0] = bank_readbyte(pc);
+   ent->code[1] = bank_readbyte((pc + 1) & 0xFFFF);
+   ent->code[2] = bank_readbyte((pc + 2) & 0xFFFF);
+   ent->a = a;
+   ent->x = x;
+   ent->y = y;
+   ent->s = s;
+   ent->p = p;
+
+   if (trace.left < 0)
+   {
+      if (pc == trace.watch_pc)
+         trace_trigger();
+      if (trace.watch_addr < 0x800)
+      {
+         int value = ram[trace.watch_addr];
+
+         if (trace.watch_value >= 0 && value != trace.watch_value)
+            trace_trigger();
+         trace.watch_value = value;
+      }
+   }
+   else if (0 == --trace.left)
+   {
+      trace.rec = NULL;
+   }
+}
+
+#define TRACE_STEP() \
+   if (trace.rec) \
+      trace_step(PC, COMBINE_FLAGS(), A, X, Y, S)
+
+#else /* !NES6502_TRACE */
+
+#define TRACE_STEP()
+
+#endif /* !NES6502_TRACE */
+
+#ifdef NES6502_HISTOGRAM
+
+/* the handler entry each page dispatches to, from nes6502_buildpages;
+** a mixed page's is found by mem_readslow or mem_writeslow
+*/
+#define  HIST_MIXED  0xFF
+#define  HIST_ENTRY(index) \
+   ((index) < NES6502_HIST_HANDLERS ? (index) : NES6502_HIST_HANDLERS - 1)
+
+static nes6502_hist hist;
+static uint8 hist_readent[NES6502_DISPATCH_PAGES];
+static uint8 hist_writeent[NES6502_DISPATCH_PAGES];
+
+#define HIST_OPCODE(op) hist.opcode[op]++
+#define HIST_PAGE(count, ent, address) \
+   if (HIST_MIXED != ent[(address) >> 8]) \
+      count[ent[(address) >> 8]]++
+#define HIST_HANDLER(count, index) count[HIST_ENTRY(index)]++
+
+#else /* !NES6502_HISTOGRAM */
+
+#define HIST_OPCODE(op)
+#define HIST_PAGE(count, ent, address)
+#define HIST_HANDLER(count, index)
+
+#endif /* !NES6502_HISTOGRAM */
+
+#ifdef NES6502_PREDECODE
+
+/* Predecode cache
+**
+** PRG-ROM never changes under the CPU, only which bank a page points
+** at, so a decoded instruction stays good for as long as it sits at
+** the same host address.  Entries are found by CPU address and
+** checked against the host address of the opcode, which makes bank
+** switches free: a switched out bank simply stops matching, and
+** matches again when it comes back.  $0000-$7FFF (RAM, SRAM) is
+** writable and never cached.
+*/
+#define  PREDECODE_SIZE  (1 << NES6502_PREDECODE_BITS)
+#define  PREDECODE_MASK  (PREDECODE_SIZE - 1)
+
+typedef struct
+{
+   const uint8 *src;   /* host address of the opcode */
+   uint16 operand;     /* the next two bytes, whatever the mode */
+   uint8 opcode;
+} nes6502_decoded;
+
+static nes6502_decoded predecode[PREDECODE_SIZE];
+
+INLINE uint32 predecode_operand(uint32 address)
+{
+   return bank_readbyte((address + 1) & 0xFFFF)
+          | (bank_readbyte((address + 2) & 0xFFFF) << 8);
+}
+
+static void predecode_fill(nes6502_decoded *dec, const uint8 *src, uint32 address)
+{
+   dec->opcode = *src;
+   dec->operand = predecode_operand(address);
+
+   /* operand bytes in the next page can switch separately, so an
+   ** instruction straddling pages is decoded but never hits
+   */
+   if ((address & NES6502_BANKMASK) < NES6502_BANKMASK - 1)
+      dec->src = src;
+   else
+      dec->src = NULL;
+}
+
+#endif /* NES6502_PREDECODE */
+
+/* Idle loop detection
+**
+** A loop that only polls memory nothing but an interrupt or the PPU
+** can change will spin until the end of the timeslice: NMI, mapper
+** and frame IRQs are all raised between slices.  So once one is
+** recognised, burn whole loop iterations instead of interpreting
+** them, as many as leave the slice a cycle.  The last one is run for
+** real, so the slice ends on the instruction and the cycle it would
+** have anyway, and PC is where the next slice would find it.
+*/
+INLINE void idle_burn(int loop_cycles)
+{
+   int count;
+
+   /* an interrupt is about to be taken, let the loop run */
+   if (cpu.int_pending || remaining_cycles <= 0)
+      return;
+
+   /* the interpreter stops once no cycles are left, mid-loop or not */
+   count = (remaining_cycles - 1) / loop_cycles;
+   ADD_CYCLES(count * loop_cycles);
+}
+
+/* taken backwards branch from the instruction before `target' */
+static void idle_branch(uint32 target, int8 offset)
+{
+   uint32 branch = (target - offset - 2) & 0xFFFF;
+   uint32 address;
+   int cycles = 3 + (((branch + 2) ^ target) & 0xFF00 ? 1 : 0);
+   uint8 op;
+
+   switch (offset)
+   {
+   case -2:
+      /* Bxx * -- nothing in the loop can change the flag */
+      idle_burn(cycles);
+      break;
+
+   case -4:
+      /* LDA/LDX/LDY/BIT zp ; Bxx */
+      op = bank_readbyte(target);
+      if (0xA5 == op || 0xA6 == op || 0xA4 == op || 0x24 == op)
+         idle_burn(cycles + 3);
+      break;
+
+   case -5:
+      /* LDA/LDX/LDY/BIT abs ; Bxx, on RAM or the vblank flag */
+      op = bank_readbyte(target);
+      if (0xAD != op && 0xAE != op && 0xAC != op && 0x2C != op)
+         break;
+
+      address = bank_readbyte((target + 1) & 0xFFFF)
+              | (bank_readbyte((target + 2) & 0xFFFF) << 8);
+      if (address < 0x0800)
+         idle_burn(cycles + 4);
+      else if (0x2002 == address)
+      {
+         /* only BPL/BMI wait on vblank alone */
+         op = bank_readbyte(branch);
+         if (0x10 == op || 0x30 == op)
+            idle_burn(cycles + 4);
+      }
+      break;
+
+   default:
+      break;
+   }
+}
+
+/* search the range handlers, for pages several handlers share */
+static uint8 mem_readslow(uint32 address)
+{
+   nes6502_memread *mr;
+
+   for (mr = cpu.read_handler; mr->min_range != 0xFFFFFFFF; mr++)
+   {
+      if (address >= mr->min_range && address <= mr->max_range)
+      {
+         HIST_HANDLER(hist.read, mr - cpu.read_handler);
+         return mr->read_func(address);
+      }
+   }
+
+   /* return paged memory */
+   return bank_readbyte(address);
+}
+
+static void mem_writeslow(uint32 address, uint8 value)
+{
+   nes6502_memwrite *mw;
+
+   for (mw = cpu.write_handler; mw->min_range != 0xFFFFFFFF; mw++)
+   {
+      if (address >= mw->min_range && address <= mw->max_range)
+      {
+         HIST_HANDLER(hist.write, mw - cpu.write_handler);
+         mw->write_func(address, value);
+         return;
+      }
+   }
+
+   /* write to paged memory */
+   bank_writebyte(address, value);
+}
+
 /* read a byte of 6502 memory */
 static uint8 mem_readbyte(uint32 address)
 {
-   nes6502_memread *mr;
+   nes6502_readfunc func;
 
    /* TODO: following 2 cases are N2A03-specific */
    if (address < 0x800)
@@ -1199,24 +1558,21 @@ static uint8 mem_readbyte(uint32 address)
       /* always paged memory */
       return bank_readbyte(address);
    }
-   /* check memory range handlers */
-   else
-   {
-      for (mr = cpu.read_handler; mr->min_range != 0xFFFFFFFF; mr++)
-      {
-         if (address >= mr->min_range && address <= mr->max_range)
-            return mr->read_func(address);
-      }
-   }
 
-   /* return paged memory */
-   return bank_readbyte(address);
+   /* one lookup for the handler of this page */
+   func = cpu.read_page[address >> 8];
+   if (NULL == func)
+      return bank_readbyte(address);
+   else if (NES6502_READ_MIXED == func)
+      return mem_readslow(address);
+   HIST_PAGE(hist.read, hist_readent, address);
+   return func(address);
 }
 
 /* write a byte of data to 6502 memory */
 static void mem_writebyte(uint32 address, uint8 value)
 {
-   nes6502_memwrite *mw;
+   nes6502_writefunc func;
 
    /* RAM */
    if (address < 0x800)
@@ -1224,21 +1580,74 @@ static void mem_writebyte(uint32 address, uint8 value)
       ram[address] = value;
       return;
    }
-   /* check memory range handlers */
+
+#ifdef NES6502_TRACE
+   if (address == trace.watch_addr)
+      trace_trigger();
+#endif /* NES6502_TRACE */
+
+   func = cpu.write_page[address >> 8];
+   if (NULL == func)
+      bank_writebyte(address, value);
+   else if (NES6502_WRITE_MIXED == func)
+      mem_writeslow(address, value);
    else
    {
-      for (mw = cpu.write_handler; mw->min_range != 0xFFFFFFFF; mw++)
+      HIST_PAGE(hist.write, hist_writeent, address);
+      func(address, value);
+   }
+}
+
+/* Fill in the per page handler tables from the range handler lists. The
+** first handler touching a page decides it: if it covers the whole page
+** the page calls it directly, otherwise the page is searched like before.
+*/
+void nes6502_buildpages(nes6502_context *context)
+{
+   nes6502_memread *mr;
+   nes6502_memwrite *mw;
+   uint32 page, start, end;
+
+   ASSERT(context);
+   ASSERT(context->read_page && context->write_page);
+
+   for (page = 0; page < NES6502_DISPATCH_PAGES; page++)
+   {
+      start = page << 8;
+      end = start + 0xFF;
+
+      context->read_page[page] = NULL;
+      for (mr = context->read_handler; mr->min_range != 0xFFFFFFFF; mr++)
       {
-         if (address >= mw->min_range && address <= mw->max_range)
-         {
-            mw->write_func(address, value);
-            return;
-         }
+         if (mr->max_range < start || mr->min_range > end)
+            continue;
+         if (mr->min_range <= start && mr->max_range >= end)
+            context->read_page[page] = mr->read_func;
+         else
+            context->read_page[page] = NES6502_READ_MIXED;
+#ifdef NES6502_HISTOGRAM
+         hist_readent[page] = (NES6502_READ_MIXED == context->read_page[page])
+                              ? HIST_MIXED : HIST_ENTRY(mr - context->read_handler);
+#endif /* NES6502_HISTOGRAM */
+         break;
       }
-   }
 
-   /* write to paged memory */
-   bank_writebyte(address, value);
+      context->write_page[page] = NULL;
+      for (mw = context->write_handler; mw->min_range != 0xFFFFFFFF; mw++)
+      {
+         if (mw->max_range < start || mw->min_range > end)
+            continue;
+         if (mw->min_range <= start && mw->max_range >= end)
+            context->write_page[page] = mw->write_func;
+         else
+            context->write_page[page] = NES6502_WRITE_MIXED;
+#ifdef NES6502_HISTOGRAM
+         hist_writeent[page] = (NES6502_WRITE_MIXED == context->write_page[page])
+                               ? HIST_MIXED : HIST_ENTRY(mw - context->write_handler);
+#endif /* NES6502_HISTOGRAM */
+         break;
+      }
+   }
 }
 
 /* set the current context */
@@ -1259,6 +1668,11 @@ void nes6502_setcontext(nes6502_context *context)
 
    ram = cpu.mem_page[0]; /* quick zero-page/RAM references */
    stack = ram + STACK_OFFSET;
+
+#ifdef NES6502_PREDECODE
+   /* may be a different cart, at the same host addresses */
+   memset(predecode, 0, sizeof(predecode));
+#endif /* NES6502_PREDECODE */
 }
 
 /* get the current context */
@@ -1278,12 +1692,61 @@ void nes6502_getcontext(nes6502_context *context)
    }
 }
 
+/* Point one 4KB page of CPU space somewhere else -- the bankswitch
+** path, so no context copies
+*/
+void nes6502_setpage(int page, uint8 *ptr)
+{
+   ASSERT(page >= 0 && page < NES6502_NUMBANKS);
+
+   cpu.mem_page[page] = (NULL == ptr) ? null_page : ptr;
+
+   if (0 == page)
+   {
+      ram = cpu.mem_page[0];
+      stack = ram + STACK_OFFSET;
+   }
+}
+
+/* Memory that held code is about to hold something else (a PRG cache
+** slot being refilled): drop any decoded instructions taken from it
+*/
+void nes6502_flushcode(const uint8 *base, int length)
+{
+#ifdef NES6502_PREDECODE
+   int i;
+
+   for (i = 0; i < PREDECODE_SIZE; i++)
+   {
+      if (predecode[i].src >= base && predecode[i].src < base + length)
+         predecode[i].src = NULL;
+   }
+#endif /* NES6502_PREDECODE */
+}
+
 /* DMA a byte of data from ROM */
 uint8 nes6502_getbyte(uint32 address)
 {
    return bank_readbyte(address);
 }
 
+/* the 256 bytes of the page address is in, if they are plain memory with
+** no handler on them; NULL for register pages
+*/
+const uint8 *nes6502_getpage(uint32 address)
+{
+   address &= 0xFF00;
+   if (address < 0x8000 && NULL != cpu.read_page[address >> 8])
+      return NULL;
+   return cpu.mem_page[address >> NES6502_BANKSHIFT] + (address & NES6502_BANKMASK);
+}
+
+/* where the CPU is, between nes6502_execute calls */
+uint32 nes6502_getpc(void)
+{
+   return cpu.pc_reg;
+}
+
 /* get number of elapsed cycles */
 uint32 nes6502_getcycles(bool reset_flag)
 {
@@ -1326,14 +1789,18 @@ uint32 nes6502_getcycles(bool reset_flag)
    if (remaining_cycles <= 0)                                   \
       goto end_execute;                                         \
    log_printf(nes6502_disasm(PC, COMBINE_FLAGS(), A, X, Y, S)); \
-   goto *opcode_table[bank_readbyte(PC++)];
+   FETCH_OPCODE(opcode);                                        \
+   goto *opcode_table[opcode];
 
 #else /* !NES6520_DISASM */
 
 #define OPCODE_END            \
    if (remaining_cycles <= 0) \
       goto end_execute;       \
-   goto *opcode_table[bank_readbyte(PC++)];
+   TRACE_STEP();              \
+   FETCH_OPCODE(opcode);      \
+   HIST_OPCODE(opcode);       \
+   goto *opcode_table[opcode];
 
 #endif /* !NES6502_DISASM */
 
@@ -1353,18 +1820,54 @@ int nes6502_execute(int timeslice_cycles)
 
    uint32 temp, addr;  /* for macros */
    uint8 btemp, baddr; /* for macros */
-   uint8 data;
+   uint8 data, opcode;
+#ifdef NES6502_PREDECODE
+   uint32 operand;
+#endif /* NES6502_PREDECODE */
 
    /* flags */
-   uint8 n_flag, v_flag, b_flag;
-   uint8 d_flag, i_flag, z_flag, c_flag;
+   DECLARE_FLAGS
 
    /* local copies of regs */
    uint32 PC;
    uint8 A, X, Y, S;
 
 #ifdef NES6502_JUMPTABLE
-
+   static const void *opcode_table[256] =
+   {
+      &&op00, &&op01, &&op02, &&op03, &&op04, &&op05, &&op06, &&op07,
+      &&op08, &&op09, &&op0A, &&op0B, &&op0C, &&op0D, &&op0E, &&op0F,
+      &&op10, &&op11, &&op12, &&op13, &&op14, &&op15, &&op16, &&op17,
+      &&op18, &&op19, &&op1A, &&op1B, &&op1C, &&op1D, &&op1E, &&op1F,
+      &&op20, &&op21, &&op22, &&op23, &&op24, &&op25, &&op26, &&op27,
+      &&op28, &&op29, &&op2A, &&op2B, &&op2C, &&op2D, &&op2E, &&op2F,
+      &&op30, &&op31, &&op32, &&op33, &&op34, &&op35, &&op36, &&op37,
+      &&op38, &&op39, &&op3A, &&op3B, &&op3C, &&op3D, &&op3E, &&op3F,
+      &&op40, &&op41, &&op42, &&op43, &&op44, &&op45, &&op46, &&op47,
+      &&op48, &&op49, &&op4A, &&op4B, &&op4C, &&op4D, &&op4E, &&op4F,
+      &&op50, &&op51, &&op52, &&op53, &&op54, &&op55, &&op56, &&op57,
+      &&op58, &&op59, &&op5A, &&op5B, &&op5C, &&op5D, &&op5E, &&op5F,
+      &&op60, &&op61, &&op62, &&op63, &&op64, &&op65, &&op66, &&op67,
+      &&op68, &&op69, &&op6A, &&op6B, &&op6C, &&op6D, &&op6E, &&op6F,
+      &&op70, &&op71, &&op72, &&op73, &&op74, &&op75, &&op76, &&op77,
+      &&op78, &&op79, &&op7A, &&op7B, &&op7C, &&op7D, &&op7E, &&op7F,
+      &&op80, &&op81, &&op82, &&op83, &&op84, &&op85, &&op86, &&op87,
+      &&op88, &&op89, &&op8A, &&op8B, &&op8C, &&op8D, &&op8E, &&op8F,
+      &&op90, &&op91, &&op92, &&op93, &&op94, &&op95, &&op96, &&op97,
+      &&op98, &&op99, &&op9A, &&op9B, &&op9C, &&op9D, &&op9E, &&op9F,
+      &&opA0, &&opA1, &&opA2, &&opA3, &&opA4, &&opA5, &&opA6, &&opA7,
+      &&opA8, &&opA9, &&opAA, &&opAB, &&opAC, &&opAD, &&opAE, &&opAF,
+      &&opB0, &&opB1, &&opB2, &&opB3, &&opB4, &&opB5, &&opB6, &&opB7,
+      &&opB8, &&opB9, &&opBA, &&opBB, &&opBC, &&opBD, &&opBE, &&opBF,
+      &&opC0, &&opC1, &&opC2, &&opC3, &&opC4, &&opC5, &&opC6, &&opC7,
+      &&opC8, &&opC9, &&opCA, &&opCB, &&opCC, &&opCD, &&opCE, &&opCF,
+      &&opD0, &&opD1, &&opD2, &&opD3, &&opD4, &&opD5, &&opD6, &&opD7,
+      &&opD8, &&opD9, &&opDA, &&opDB, &&opDC, &&opDD, &&opDE, &&opDF,
+      &&opE0, &&opE1, &&opE2, &&opE3, &&opE4, &&opE5, &&opE6, &&opE7,
+      &&opE8, &&opE9, &&opEA, &&opEB, &&opEC, &&opED, &&opEE, &&opEF,
+      &&opF0, &&opF1, &&opF2, &&opF3, &&opF4, &&opF5, &&opF6, &&opF7,
+      &&opF8, &&opF9, &&opFA, &&opFB, &&opFC, &&opFD, &&opFE, &&opFF
+   };
 #endif /* NES6502_JUMPTABLE */
 
    remaining_cycles = timeslice_cycles;
@@ -1400,9 +1903,12 @@ int nes6502_execute(int timeslice_cycles)
 #ifdef NES6502_DISASM
       log_printf(nes6502_disasm(PC, COMBINE_FLAGS(), A, X, Y, S));
 #endif /* NES6502_DISASM */
+      TRACE_STEP();
 
       /* Fetch and execute instruction */
-      switch (bank_readbyte(PC++))
+      FETCH_OPCODE(opcode);
+      HIST_OPCODE(opcode);
+      switch (opcode)
       {
 #endif /* !NES6502_JUMPTABLE */
 
@@ -1461,7 +1967,7 @@ int nes6502_execute(int timeslice_cycles)
    ORA(2, IMMEDIATE_BYTE);
    OPCODE_END
 
-   OPCODE_BEGIN(0x0A) /* ASL A */
+   OPCODE_BEGIN(0A) /* ASL A */
    ASL_A();
    OPCODE_END
 
@@ -2363,8 +2869,7 @@ void nes6502_reset(void)
 #define DECLARE_LOCAL_REGS       \
    uint32 PC;                    \
    uint8 A, X, Y, S;             \
-   uint8 n_flag, v_flag, b_flag; \
-   uint8 d_flag, i_flag, z_flag, c_flag;
+   DECLARE_FLAGS
 
 /* Non-maskable interrupt */
 void nes6502_nmi(void)
@@ -2413,6 +2918,57 @@ void nes6502_release(void)
    remaining_cycles = 0;
 }
 
+#ifdef NES6502_TRACE
+void nes6502_settrace(nes6502_trace *ring, int entries, int after)
+{
+   ASSERT(0 == (entries & (entries - 1)));
+
+   trace.rec = NULL;
+   trace.ring = ring;
+   trace.mask = entries - 1;
+   trace.head = 0;
+   trace.after = MIN(after, entries - 1);
+   trace.left = -1;
+   trace.watch_value = -1;
+   trace.rec = ring;
+}
+
+void nes6502_tracewatch(uint32 pc, uint32 address)
+{
+   trace.watch_pc = pc;
+   trace.watch_addr = address;
+   trace.watch_value = -1;
+}
+
+void nes6502_tracetrigger(void)
+{
+   trace_trigger();
+}
+
+void nes6502_tracestop(void)
+{
+   trace.rec = NULL;
+}
+
+int nes6502_gettrace(uint32 *first)
+{
+   uint32 count;
+
+   if (NULL == trace.ring || trace.rec)
+      return 0;
+   count = MIN(trace.head, trace.mask + 1);
+   *first = trace.head - count;
+   return count;
+}
+#endif /* NES6502_TRACE */
+
+#ifdef NES6502_HISTOGRAM
+const nes6502_hist *nes6502_gethist(void)
+{
+   return &hist;
+}
+#endif /* NES6502_HISTOGRAM */
+
 /*
 ** $Log: nes6502.c,v $
 ** Revision 1.2  2001/04/27 14:37:11  neil
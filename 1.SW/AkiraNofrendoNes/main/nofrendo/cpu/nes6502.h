@@ -76,6 +76,17 @@ typedef struct
    void (*write_func)(uint32 address, uint8 value);
 } nes6502_memwrite;
 
+typedef uint8 (*nes6502_readfunc)(uint32 address);
+typedef void (*nes6502_writefunc)(uint32 address, uint8 value);
+
+/* Handler lookup per 256 byte page: NULL means plain paged memory,
+** NES6502_*_MIXED that a handler boundary falls inside the page and
+** the range lists have to be searched.
+*/
+#define  NES6502_DISPATCH_PAGES  256
+#define  NES6502_READ_MIXED      ((nes6502_readfunc) 1)
+#define  NES6502_WRITE_MIXED     ((nes6502_writefunc) 1)
+
 typedef struct
 {
    uint8 *mem_page[NES6502_NUMBANKS];  /* memory page pointers */
@@ -83,6 +94,10 @@ typedef struct
    nes6502_memread *read_handler;
    nes6502_memwrite *write_handler;
 
+   /* built from the lists above by nes6502_buildpages */
+   nes6502_readfunc *read_page;
+   nes6502_writefunc *write_page;
+
    uint32 pc_reg;
    uint8 a_reg, p_reg;
    uint8 x_reg, y_reg;
@@ -92,9 +107,39 @@ typedef struct
    
    uint8 int_pending, int_latency;
 
+   /* burn the rest of the timeslice in side-effect free wait loops */
+   uint8 idle_skip;
+
    int32 total_cycles, burn_cycles;
 } nes6502_context;
 
+/* An instruction as the trace ring keeps it (NES6502_TRACE): where it
+** was, its bytes and the registers and cycle count before it ran, so
+** it disassembles without the ROM.
+*/
+typedef struct
+{
+   uint32 cycles;    /* total_cycles, as nes6502_getcycles counts them */
+   uint16 pc;
+   uint8 code[3];    /* opcode and the two bytes after it */
+   uint8 a, x, y, s, p;
+} nes6502_trace;
+
+#define  NES6502_TRACE_NONE   0x10000  /* no watchpoint */
+
+/* Execution counts (NES6502_HISTOGRAM): instructions by opcode, and the
+** accesses that went to a handler by its index in read_handler and
+** write_handler. They only ever grow, take differences.
+*/
+#define  NES6502_HIST_HANDLERS   32
+
+typedef struct
+{
+   uint32 opcode[256];
+   uint32 read[NES6502_HIST_HANDLERS];
+   uint32 write[NES6502_HIST_HANDLERS];
+} nes6502_hist;
+
 #ifdef __cplusplus
 extern "C" {
 #endif /* __cplusplus */
@@ -105,10 +150,35 @@ extern int nes6502_execute(int total_cycles);
 extern void nes6502_nmi(void);
 extern void nes6502_irq(void);
 extern uint8 nes6502_getbyte(uint32 address);
+extern const uint8 *nes6502_getpage(uint32 address);
+extern void nes6502_setpage(int page, uint8 *ptr);
+extern void nes6502_flushcode(const uint8 *base, int length);
+extern void nes6502_buildpages(nes6502_context *context);
 extern uint32 nes6502_getcycles(bool reset_flag);
+extern uint32 nes6502_getpc(void);
 extern void nes6502_burn(int cycles);
 extern void nes6502_release(void);
 
+/* Instruction trace (NES6502_TRACE): every instruction goes into ring,
+** entries long (a power of two), over the oldest, until a trigger.
+** after more go in past the trigger, then recording stops and the ring
+** holds what led up to it. A NULL ring turns the trace off.
+*/
+extern void nes6502_settrace(nes6502_trace *ring, int entries, int after);
+/* trigger on running the instruction at pc, and on a write to address;
+** for RAM, $0000-$07FF, on its value changing
+*/
+extern void nes6502_tracewatch(uint32 pc, uint32 address);
+extern void nes6502_tracetrigger(void);
+/* stop now, as if a trigger's after had run out */
+extern void nes6502_tracestop(void);
+/* once recording has stopped, the number of entries held, the oldest at
+** ring[first & (entries - 1)]; 0 while still recording
+*/
+extern int nes6502_gettrace(uint32 *first);
+
+extern const nes6502_hist *nes6502_gethist(void);
+
 /* Context get/set */
 extern void nes6502_setcontext(nes6502_context *cpu);
 extern void nes6502_getcontext(nes6502_context *cpu);
@@ -35,6 +35,7 @@
 #include "nes/nesinput.h"
 #include "nes/nes_pal.h"
 #include "nes/nesstate.h"
+#include "nes/nes_rewind.h"
 
 /* pointer to our current system's event handler table */
 static event_t *system_events = NULL;
@@ -163,6 +164,20 @@ static void func_event_state_slot_9(int code)
       state_setslot(9);
 }
 
+/* held down: steps back through the rewind ring */
+static void func_event_rewind(int code)
+{
+   rewind_hold(INP_STATE_MAKE == code);
+}
+
+/* held down: the game runs as fast as it can */
+static void func_event_fastforward(int code)
+{
+#ifdef NES_FASTFORWARD
+   nes_fastforward(INP_STATE_MAKE == code);
+#endif
+}
+
 static void func_event_gui_toggle_oam(int code)
 {
    if (INP_STATE_MAKE == code)
@@ -460,6 +475,8 @@ static event_t nes_events[] =
         func_event_state_slot_7,
         func_event_state_slot_8,
         func_event_state_slot_9, /* 20 */
+        func_event_rewind,
+        func_event_fastforward,
         /* GUI */
         func_event_gui_toggle_oam,
         func_event_gui_toggle_wave,
@@ -468,10 +485,10 @@ static event_t nes_events[] =
         func_event_gui_pattern_color_down,
         func_event_gui_toggle_fps,
         func_event_gui_display_info,
-        func_event_gui_toggle,
+        func_event_gui_toggle, /* 30 */
         /* sound */
         func_event_toggle_channel_0,
-        func_event_toggle_channel_1, /* 30 */
+        func_event_toggle_channel_1,
         func_event_toggle_channel_2,
         func_event_toggle_channel_3,
         func_event_toggle_channel_4,
@@ -480,10 +497,10 @@ static event_t nes_events[] =
         func_event_set_filter_1,
         func_event_set_filter_2,
         /* picture */
-        func_event_toggle_sprites,
+        func_event_toggle_sprites, /* 40 */
         func_event_palette_hue_up,
         func_event_palette_hue_down,
-        func_event_palette_tint_up, /* 40 */
+        func_event_palette_tint_up,
         func_event_palette_tint_down,
         func_event_palette_set_default,
         func_event_palette_set_shady,
@@ -491,10 +508,10 @@ static event_t nes_events[] =
         func_event_joypad1_a,
         func_event_joypad1_b,
         func_event_joypad1_start,
-        func_event_joypad1_select,
+        func_event_joypad1_select, /* 50 */
         func_event_joypad1_up,
         func_event_joypad1_down,
-        func_event_joypad1_left, /* 50 */
+        func_event_joypad1_left,
         func_event_joypad1_right,
         /* joypad 2 */
         func_event_joypad2_a,
@@ -502,11 +519,11 @@ static event_t nes_events[] =
         func_event_joypad2_start,
         func_event_joypad2_select,
         func_event_joypad2_up,
-        func_event_joypad2_down,
+        func_event_joypad2_down, /* 60 */
         func_event_joypad2_left,
         func_event_joypad2_right,
         /* NSF control */
-        NULL, /* 60 */
+        NULL,
         NULL,
         NULL,
         /* OS-specific */
@@ -514,10 +531,10 @@ static event_t nes_events[] =
         NULL,
         NULL,
         NULL,
+        NULL, /* 70 */
         NULL,
         NULL,
         NULL,
-        NULL, /* 70 */
         NULL,
         /* last */
         NULL};
@@ -53,6 +53,8 @@ enum
    event_state_slot_7,
    event_state_slot_8,
    event_state_slot_9,
+   event_rewind,
+   event_fastforward,
    /* GUI */
    event_gui_toggle_oam,
    event_gui_toggle_wave,
@@ -27,7 +27,7 @@
 #include <string.h>
 #include <stdarg.h>
 #include <noftypes.h>
-#include <nes_ppu.h
+#include <nes_ppu.h>
 #include <nes_apu.h>
 #include <nesinput.h>
 #include <nes.h>
@@ -63,21 +63,33 @@ rgb_t gui_pal[GUI_TOTALCOLORS] =
 /**************************************************************/
 #include <pcx.h>
 #include <nesstate.h>
+#include <nes_prof.h>
 static bool option_drawsprites = true;
 
 /* save a PCX snapshot */
 void gui_savesnap(void)
 {
+#ifndef NES_NO_PCX
    char filename[PATH_MAX];
+#endif /* !NES_NO_PCX */
    nes_t *nes = nes_getcontextptr();
 
+   /* the frame on the screen, not the one being drawn */
+   if (0 == osd_savesnap(vid_getshown(), nes->ppu->curpal))
+   {
+      gui_sendmsg(GUI_GREEN, "Screen captured");
+      return;
+   }
+
+#ifndef NES_NO_PCX
    if (osd_makesnapname(filename, PATH_MAX) < 0)
       return;
 
-   if (pcx_write(filename, vid_getbuffer(), nes->ppu->curpal)) 
+   if (pcx_write(filename, vid_getshown(), nes->ppu->curpal)) 
       return;
 
    gui_sendmsg(GUI_GREEN, "Screen saved to %s", filename);
+#endif /* !NES_NO_PCX */
 }
 
 /* Show/hide sprites (hiding sprites useful for making maps) */
@@ -173,6 +185,47 @@ static int mouse_x, mouse_y, mouse_button;
 
 static bitmap_t *gui_surface;
 
+/* anything to draw at all: kept up by whatever turns something on or off */
+static bool gui_active = false;
+
+/* where the last frame's overlay went */
+static rect_t gui_dirty[GUI_MAX_DIRTIES];
+static int gui_num_dirties = 0;
+
+static void gui_setactive(void)
+{
+   gui_active = option_showfps || option_wavetype != GUI_WAVENONE || option_showpattern
+                || option_showoam || msg.ttl || option_showgui;
+}
+
+static void gui_adddirty(int x_pos, int y_pos, int width, int height)
+{
+   rect_t *rect;
+
+   if (x_pos < 0)
+   {
+      width += x_pos;
+      x_pos = 0;
+   }
+   if (y_pos < 0)
+   {
+      height += y_pos;
+      y_pos = 0;
+   }
+   if (x_pos + width > gui_surface->width)
+      width = gui_surface->width - x_pos;
+   if (y_pos + height > gui_surface->height)
+      height = gui_surface->height - y_pos;
+   if (width <= 0 || height <= 0 || GUI_MAX_DIRTIES == gui_num_dirties)
+      return;
+
+   rect = &gui_dirty[gui_num_dirties++];
+   rect->x = x_pos;
+   rect->y = y_pos;
+   rect->w = width;
+   rect->h = height;
+}
+
 
 /* Put a pixel on our bitmap- just for GUI use */
 INLINE void gui_putpixel(int x_pos, int y_pos, uint8 color)
@@ -368,8 +421,11 @@ static void gui_tickdec(void)
    if (msg.ttl > 0)
    {
       msg.ttl -= ticks;
-      if (msg.ttl < 0)
+      if (msg.ttl <= 0)
+      {
          msg.ttl = 0;
+         gui_setactive();
+      }
    }
 }
 
@@ -377,6 +433,7 @@ static void gui_tickdec(void)
 static void gui_updatefps(void)
 {
    static char fpsbuf[20];
+   int width = 90, lines = 1;
 
    /* Check to see if we need to do an sprintf or not */
    if (true == gui_fpsupdate)
@@ -387,34 +444,60 @@ static void gui_updatefps(void)
    }
 
    gui_textout(fpsbuf, gui_surface->width - 1 - 90, 1, &small, GUI_GREEN);
+
+#ifdef NES_PROFILE
+   /* profile of the last second under it, right aligned */
+   {
+      const char *text[PROF_LINES];
+      int i, count = prof_getlines(text);
+
+      for (i = 0; i < count; i++)
+      {
+         int length = gui_textlen((char *) text[i], &small);
+
+         gui_textout((char *) text[i], gui_surface->width - 1 - length,
+                     1 + (i + 1) * (small.height + 1), &small, GUI_GREEN);
+         if (length > width)
+            width = length;
+      }
+      lines += count;
+   }
+#endif
+
+   gui_adddirty(gui_surface->width - 1 - width, 1, width, lines * (small.height + 1));
 }
 
 /* Turn FPS on/off */
 void gui_togglefps(void)
 {
    option_showfps ^= true;
+   gui_setactive();
 }
 
 /* Turn GUI on/off */
 void gui_togglegui(void)
 {
    option_showgui ^= true;
+   gui_setactive();
 }
 
 void gui_togglewave(void)
 {
    option_wavetype = (option_wavetype + 1) % GUI_NUMWAVESTYLES;
+   gui_setactive();
 }
 
 void gui_toggleoam(void)
 {
    option_showoam ^= true;
+   gui_setactive();
 }
 
 /* TODO: hack! */
 void gui_togglepattern(void)
 {
    option_showpattern ^= true;
+   gui_setactive();
 }
 
 /* TODO: hack! */
@@ -435,7 +518,10 @@ void gui_incpatterncol(void)
 static void gui_updatemsg(void)
 {
    if (msg.ttl)
+   {
       gui_textbar(msg.text, 2, gui_surface->height - 10, &small, msg.color, GUI_DKGRAY, BUTTON_UP);
+      gui_adddirty(2, gui_surface->height - 10, gui_textlen(msg.text, &small) + 3, small.height + 3);
+   }
 }
 
 /* Little thing to display the waveform */
@@ -521,6 +607,7 @@ static void gui_updatewave(int wave_type)
    }
 
    gui_rect(xofs, yofs - 1, WAVEDISP_WIDTH, 66, GUI_DKGRAY);
+   gui_adddirty(xofs, yofs - 1, WAVEDISP_WIDTH, 66);
 }
 
 
@@ -535,6 +622,7 @@ static void gui_updatepattern(void)
    /* Dump the actual tables */
    ppu_dumppattern(gui_surface, 0, 0, 10, pattern_col);
    ppu_dumppattern(gui_surface, 1, 128, 10, pattern_col);
+   gui_adddirty(0, 0, 256, 139);
 }
 
 static void gui_updateoam(void)
@@ -544,16 +632,30 @@ static void gui_updateoam(void)
    y = option_showpattern ? 140 : 0;
    gui_textbar("Current OAM", 0, y, &small, GUI_GREEN, GUI_DKGRAY, BUTTON_UP);
    ppu_dumpoam(gui_surface, 0, y + 9);
+   /* 16 by 4 boxes of up to 8x16 sprites */
+   gui_adddirty(0, y, 16 * 9 + 1, 9 + 4 * 17 + 2);
 }
 
 
 /* The GUI overlay */
 void gui_frame(bool draw)
 {
+   int i;
+
    gui_fps++;
    if (false == draw)
       return;
 
+   gui_num_dirties = 0;
+#ifndef NOFRENDO_DEBUG
+   /* most frames: nothing on, nothing to count down */
+   if (false == gui_active)
+   {
+      gui_ticks = 0;
+      return;
+   }
+#endif /* !NOFRENDO_DEBUG */
+
    gui_surface = vid_getbuffer();
 
    ASSERT(gui_surface);
@@ -579,7 +681,18 @@ void gui_frame(bool draw)
    {
       osd_getmouse(&mouse_x, &mouse_y, &mouse_button);
       gui_drawmouse();
+      gui_adddirty(mouse_x, mouse_y, CURSOR_WIDTH, CURSOR_HEIGHT);
    }
+
+   /* whatever we drew here must not outlive us in a reused PPU line */
+   for (i = 0; i < gui_num_dirties; i++)
+      ppu_invalidaterows(gui_surface, gui_dirty[i].y, gui_dirty[i].h);
+}
+
+int gui_getdirty(const rect_t **rects)
+{
+   *rects = gui_dirty;
+   return gui_num_dirties;
 }
 
 void gui_sendmsg(int color, char *format, ...)
@@ -598,6 +711,7 @@ void gui_sendmsg(int color, char *format, ...)
 
    msg.ttl = gui_refresh * 2; /* 2 second delay */
    msg.color = color;
+   gui_setactive();
 }
 
 void gui_setrefresh(int frequency)
@@ -609,6 +723,7 @@ int gui_init(void)
 {
    gui_refresh = 60;
    memset(&msg, 0, sizeof(message_t));
+   gui_setactive();
 
    return 0; /* can't fail */
 }
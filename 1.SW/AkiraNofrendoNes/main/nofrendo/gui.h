@@ -56,6 +56,8 @@ enum
 extern rgb_t gui_pal[GUI_TOTALCOLORS];
 
 #define  MAX_MSG_LENGTH 256
+/* fps, wave, pattern, oam, message, mouse */
+#define  GUI_MAX_DIRTIES   6
 
 typedef struct message_s
 {
@@ -73,6 +75,8 @@ extern int gui_init(void);
 extern void gui_shutdown(void);
 
 extern void gui_frame(bool draw);
+/* the areas the last gui_frame drew on the frame buffer, up to GUI_MAX_DIRTIES */
+extern int gui_getdirty(const rect_t **rects);
 
 extern void gui_togglefps(void);
 extern void gui_togglegui(void);
@@ -26,6 +26,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <string.h>
 #include <noftypes.h>
 #include <log.h>
 
@@ -33,6 +34,14 @@
 //static FILE *errorlog = NULL;
 static int (*log_func)(const char *string) = NULL;
 
+static int log_level = LOG_LEVEL_INFO;
+static struct
+{
+   char name[16];
+   int level;
+} log_module[LOG_MODULES];
+static int log_modules;
+
 /* first up: debug versions of calls */
 #ifdef NOFRENDO_DEBUG
 int log_init(void)
@@ -55,10 +64,26 @@ void log_shutdown(void)
 //      fclose(errorlog);
 }
 
+#else /* !NOFRENDO_DEBUG */
+
+int log_init(void)
+{
+   return 0;
+}
+
+void log_shutdown(void)
+{
+}
+#endif /* !NOFRENDO_DEBUG */
+
+/* Messages are no longer compiled out without NOFRENDO_DEBUG: the OSD's
+** log function is meant to queue them, not wait for a serial port, and
+** what the levels don't want is dropped before it is formatted.
+*/
 int log_print(const char *string)
 {
    /* if we have a custom logging function, use that */
-   if (NULL != log_func)
+   if (NULL != log_func && LOG_OFF != log_level)
       log_func(string);
    
    /* Log it to disk, as well */
@@ -68,52 +93,75 @@ int log_print(const char *string)
    return 0;
 }
 
+/* the level messages of the module `text' starts with get through at */
+static int log_modulelevel(const char *text)
+{
+   const char *colon;
+   int i, len;
+
+   if (0 == log_modules || NULL == (colon = strchr(text, ':')))
+      return log_level;
+
+   len = colon - text;
+   for (i = 0; i < log_modules; i++)
+   {
+      if (0 == strncmp(log_module[i].name, text, len) && 0 == log_module[i].name[len])
+         return log_module[i].level;
+   }
+   return log_level;
+}
+
 int log_printf(const char *format, ... )
 {
    /* don't allocate on stack every call */
    static char buffer[1024 + 1];
+   const char *text = format;
+   int level = LOG_LEVEL_INFO, length;
    va_list arg;
 
-   va_start(arg, format);
+   if (NULL == log_func)
+      return 0;
 
-   if (NULL != log_func)
-   {
-      vsprintf(buffer, format, arg);
-      log_func(buffer);
-   }
+   if (text[0] >= LOG_ERROR[0] && text[0] <= LOG_DEBUG[0])
+      level = *text++;
+   if (level > log_modulelevel(text))
+      return 0;
 
+   va_start(arg, format);
+   length = vsnprintf(buffer, sizeof(buffer), text, arg);
 //   vfprintf(errorlog, format, arg);
    va_end(arg);
+   log_func(buffer);
 
-   return 0; /* should be number of chars written */
-}
-
-#else /* !NOFRENDO_DEBUG */
-
-int log_init(void)
-{
-   return 0;
+   return length;
 }
 
-void log_shutdown(void)
+int log_setlevel(const char *module, int level)
 {
-}
+   int i;
 
-int log_print(const char *string)
-{
-   UNUSED(string);
+   if (NULL == module)
+   {
+      log_level = level;
+      return 0;
+   }
 
+   for (i = 0; i < log_modules; i++)
+   {
+      if (0 == strcmp(log_module[i].name, module))
+         break;
+   }
+   if (i == log_modules)
+   {
+      if (LOG_MODULES == log_modules || strlen(module) >= sizeof(log_module[i].name))
+         return -1;
+      strcpy(log_module[i].name, module);
+      log_modules++;
+   }
+   log_module[i].level = level;
    return 0;
 }
 
-int log_printf(const char *format, ... )
-{
-   UNUSED(format);
-
-   return 0; /* should be number of chars written */
-}
-#endif /* !NOFRENDO_DEBUG */
-
 void log_chain_logfunc(int (*func)(const char *string))
 {
    log_func = func;
@@ -129,7 +177,11 @@ void log_assert(int expr, int line, const char *file, char *msg)
    else
       log_printf("ASSERT: line %d of %s\n", line, file);
 
+#ifdef __XTENSA__
    asm("break.n 1");
+#else
+   abort();
+#endif
 //   exit(-1);
 }
 
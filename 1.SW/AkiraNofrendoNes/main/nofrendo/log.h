@@ -28,11 +28,37 @@
 
 #include <stdio.h>
 
+/* How much a message matters, lowest first, the way kernel printk does it:
+** a level string goes in front of the format, log_printf(LOG_DEBUG "...").
+** A format without one is LOG_INFO.
+*/
+#define  LOG_ERROR      "\001"
+#define  LOG_WARN       "\002"
+#define  LOG_INFO       "\003"
+#define  LOG_DEBUG      "\004"
+
+enum
+{
+   LOG_OFF = 0,
+   LOG_LEVEL_ERROR,
+   LOG_LEVEL_WARN,
+   LOG_LEVEL_INFO,
+   LOG_LEVEL_DEBUG
+};
+
+#define  LOG_MODULES    8     /* modules log_setlevel can hold a level for */
+
 extern int log_init(void);
 extern void log_shutdown(void);
 extern int log_print(const char *string);
 extern int log_printf(const char *format, ...);
 extern void log_chain_logfunc(int (*logfunc)(const char *string));
+/* Messages above `level' are dropped before they are formatted. A module
+** is what a format starts with up to its first ':', "mapper 64" for
+** "mapper 64: ..."; NULL sets the level of everything else. Returns -1 if
+** there are already LOG_MODULES modules.
+*/
+extern int log_setlevel(const char *module, int level);
 extern void log_assert(int expr, int line, const char *file, char *msg);
 
 #endif /* _LOG_H_ */
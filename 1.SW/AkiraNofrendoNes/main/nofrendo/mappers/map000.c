@@ -34,8 +34,8 @@ mapintf_t map0_intf =
         NULL,   /* init routine */
         NULL,   /* vblank callback */
         NULL,   /* hblank callback */
-        NULL,   /* get state (snss) */
-        NULL,   /* set state (snss) */
+        NULL,   /* before a snapshot */
+        NULL,   /* after a restore */
         NULL,   /* memory read structure */
         NULL,   /* memory write structure */
         NULL    /* external sound device */
@@ -26,6 +26,7 @@
 #include <string.h>
 #include "noftypes.h"
 #include "../nes/nes_mmc.h"
+#include "../nes/nesstate.h"
 #include "../nes/nes.h"
 #include "../nes/nes_ppu.h"
 
@@ -150,6 +151,12 @@ static void map1_write(uint32 address, uint8 value)
 
 static void map1_init(void)
 {
+   state_region(&bitcount, sizeof(bitcount));
+   state_region(&latch, sizeof(latch));
+   state_region(regs, sizeof(regs));
+   state_region(&bank_select, sizeof(bank_select));
+   state_region(&lastreg, sizeof(lastreg));
+
    bitcount = 0;
    latch = 0;
 
@@ -161,26 +168,6 @@ static void map1_init(void)
    map1_write(0x8000, 0x80);
 }
 
-static void map1_getstate(SnssMapperBlock *state)
-{
-   state->extraData.mapper1.registers[0] = regs[0];
-   state->extraData.mapper1.registers[1] = regs[1];
-   state->extraData.mapper1.registers[2] = regs[2];
-   state->extraData.mapper1.registers[3] = regs[3];
-   state->extraData.mapper1.latch = latch;
-   state->extraData.mapper1.numberOfBits = bitcount;
-}
-
-static void map1_setstate(SnssMapperBlock *state)
-{
-   regs[1] = state->extraData.mapper1.registers[0];
-   regs[1] = state->extraData.mapper1.registers[1];
-   regs[2] = state->extraData.mapper1.registers[2];
-   regs[3] = state->extraData.mapper1.registers[3];
-   latch = state->extraData.mapper1.latch;
-   bitcount = state->extraData.mapper1.numberOfBits;
-}
-
 static map_memwrite map1_memwrite[] =
     {
         {0x8000, 0xFFFF, map1_write},
@@ -193,8 +180,8 @@ mapintf_t map1_intf =
         map1_init,     /* init routine */
         NULL,          /* vblank callback */
         NULL,          /* hblank callback */
-        map1_getstate, /* get state (snss) */
-        map1_setstate, /* set state (snss) */
+        NULL,          /* before a snapshot */
+        NULL,          /* after a restore */
         NULL,          /* memory read structure */
         map1_memwrite, /* memory write structure */
         NULL           /* external sound device */
@@ -47,8 +47,8 @@ mapintf_t map2_intf =
         NULL,          /* init routine */
         NULL,          /* vblank callback */
         NULL,          /* hblank callback */
-        NULL,          /* get state (snss) */
-        NULL,          /* set state (snss) */
+        NULL,          /* before a snapshot */
+        NULL,          /* after a restore */
         NULL,          /* memory read structure */
         map2_memwrite, /* memory write structure */
         NULL           /* external sound device */
@@ -25,23 +25,78 @@
 
 #include "noftypes.h"
 #include "../nes/nes_mmc.h"
+#include "../nes/nesstate.h"
 #include "../nes/nes.h"
 #include "../nes/nes_ppu.h"
-#include "../libsnss/libsnss.h"
 
+/* The counter is clocked once per rendered line, but only brought up to
+** date when something needs it: a register write, a line with rendering
+** off, the line it runs out on, and the start and end of the frame.  The
+** frame loop doesn't call us on the other lines.
+*/
 static struct
 {
    int counter, latch;
    bool enabled, reset;
+   int line;      /* last line clocked into counter, -1 before the first */
+   bool vblank;   /* between line 240 and the next frame's line 0 */
 } irq;
 
 static uint8 reg;
 static uint8 command;
 static uint16 vrombase;
 
+/* clock the counter for the lines after irq.line up to line, which all
+** had rendering on
+*/
+static void map4_catchup(int line)
+{
+   int lines = line - irq.line;
+
+   if (lines <= 0)
+      return;
+   irq.line = line;
+   if (irq.counter < 0)
+      return;
+
+   irq.reset = false;
+   if (lines <= irq.counter)
+   {
+      irq.counter -= lines;
+      return;
+   }
+
+   irq.counter = -1;
+   if (irq.enabled)
+   {
+      irq.reset = true;
+      nes_irq();
+   }
+}
+
+/* the last line that has been clocked by now */
+static int map4_line(void)
+{
+   int scanline = nes_getcontextptr()->scanline;
+
+   if (irq.vblank)
+      return -1;
+   return (scanline > 240) ? 240 : scanline;
+}
+
+/* ask for the line the counter runs out on, if it does this frame */
+static void map4_schedule(void)
+{
+   int due = irq.line + irq.counter + 1;
+
+   nes_sethblankline((irq.counter >= 0 && due <= 240) ? due : -1);
+}
+
 /* mapper 4: MMC3 */
 static void map4_write(uint32 address, uint8 value)
 {
+   map4_catchup(map4_line());
+
    switch (address & 0xE001)
    {
    case 0x8000:
@@ -144,52 +199,69 @@ static void map4_write(uint32 address, uint8 value)
 
    if (true == irq.reset)
       irq.counter = irq.latch;
+
+   map4_schedule();
 }
 
 static void map4_hblank(int vblank)
 {
-   if (vblank)
-      return;
+   int scanline = nes_getcontextptr()->scanline;
 
-   if (ppu_enabled())
+   if (vblank)
    {
-      if (irq.counter >= 0)
+      /* the frame's lines are all in, the next ones count from 0 */
+      if (241 == scanline)
       {
-         irq.reset = false;
-         irq.counter--;
-
-         if (irq.counter < 0)
-         {
-            if (irq.enabled)
-            {
-               irq.reset = true;
-               nes_irq();
-            }
-         }
+         map4_catchup(240);
+         irq.line = -1;
+         irq.vblank = true;
       }
    }
+   else
+   {
+      if (0 == scanline)
+         irq.vblank = false;
+
+      if (ppu_enabled())
+      {
+         map4_catchup(scanline);
+      }
+      else
+      {
+         /* rendering is off, this line doesn't count */
+         map4_catchup(scanline - 1);
+         irq.line = scanline;
+      }
+   }
+
+   map4_schedule();
 }
 
-static void map4_getstate(SnssMapperBlock *state)
+static void map4_getstate(void)
 {
-   state->extraData.mapper4.irqCounter = irq.counter;
-   state->extraData.mapper4.irqLatchCounter = irq.latch;
-   state->extraData.mapper4.irqCounterEnabled = irq.enabled;
-   state->extraData.mapper4.last8000Write = command;
+   map4_catchup(map4_line());
 }
 
-static void map4_setstate(SnssMapperBlock *state)
+static void map4_setstate(void)
 {
-   irq.counter = state->extraData.mapper4.irqCounter;
-   irq.latch = state->extraData.mapper4.irqLatchCounter;
-   irq.enabled = state->extraData.mapper4.irqCounterEnabled;
-   command = state->extraData.mapper4.last8000Write;
+   /* states are taken between frames; count on from wherever we are */
+   irq.vblank = (0 == nes_getcontextptr()->scanline || nes_getcontextptr()->scanline > 240);
+   irq.line = irq.vblank ? -1 : nes_getcontextptr()->scanline;
+   map4_schedule();
 }
 
 static void map4_init(void)
 {
+   state_region(&irq, sizeof(irq));
+   state_region(&reg, sizeof(reg));
+   state_region(&command, sizeof(command));
+   state_region(&vrombase, sizeof(vrombase));
+
    irq.counter = irq.latch = 0;
    irq.enabled = irq.reset = false;
+   irq.line = -1;
+   irq.vblank = true;
+   nes_sethblankline(-1);
    reg = command = 0;
    vrombase = 0x0000;
 }
@@ -201,16 +273,17 @@ static map_memwrite map4_memwrite[] =
 
 mapintf_t map4_intf =
     {
-        4,             /* mapper number */
-        "MMC3",        /* mapper name */
-        map4_init,     /* init routine */
-        NULL,          /* vblank callback */
-        map4_hblank,   /* hblank callback */
-        map4_getstate, /* get state (snss) */
-        map4_setstate, /* set state (snss) */
-        NULL,          /* memory read structure */
-        map4_memwrite, /* memory write structure */
-        NULL           /* external sound device */
+        4,                 /* mapper number */
+        "MMC3",            /* mapper name */
+        map4_init,         /* init routine */
+        NULL,              /* vblank callback */
+        map4_hblank,       /* hblank callback */
+        map4_getstate,     /* before a snapshot */
+        map4_setstate,     /* after a restore */
+        NULL,              /* memory read structure */
+        map4_memwrite,     /* memory write structure */
+        NULL,              /* external sound device */
+        MMC_HBLANK_RENDER | MMC_HBLANK_EVENT /* flags */
 };
 
 /*
@@ -23,8 +23,10 @@
 ** $Id: map005.c,v 1.2 2001/04/27 14:37:11 neil Exp $
 */
 
+#include <string.h>
 #include "noftypes.h"
 #include "../nes/nes_mmc.h"
+#include "../nes/nesstate.h"
 #include "../nes/nes.h"
 #include "../nes/nes_ppu.h"
 #include "log.h"
@@ -40,11 +42,59 @@ static struct
    int reset, latch;
 } irq;
 
+/* ExRAM, and the nametable fill mode shows */
+static uint8 exram[0x400];
+static uint8 fill_nt[0x400];
+static uint8 exram_mode;   /* $5104 */
+static uint8 nt_mapping;   /* $5105 */
+static uint8 chr_hi;       /* $5130 */
+static int page_size;      /* $5100, in KB */
+
+/* In mode 1 ExRAM picks a 4KB CHR bank and the palette of every tile */
+static void map5_setexattr(void)
+{
+   rominfo_t *cart = mmc_getinfo();
+   int banks = 1;
+
+   if (1 != exram_mode || 0 == cart->vrom_banks)
+   {
+      ppu_setexattr(NULL, NULL, 1, 0);
+      return;
+   }
+
+   while (banks * 2 <= cart->vrom_banks * 2)
+      banks *= 2;
+   ppu_setexattr(exram, cart->vrom, banks, chr_hi << 6);
+}
+
+/* each nametable is one of the two CIRAM pages, ExRAM or the fill one */
+static void map5_setnametables(void)
+{
+   int i;
+
+   ppu_mirror(nt_mapping & 1, (nt_mapping >> 2) & 1, (nt_mapping >> 4) & 1, (nt_mapping >> 6) & 1);
+   for (i = 0; i < 4; i++)
+   {
+      switch ((nt_mapping >> (i * 2)) & 3)
+      {
+      case 2:
+         ppu_setpage(1, 8 + i, exram - 0x2000 - (i << 10));
+         break;
+
+      case 3:
+         ppu_setpage(1, 8 + i, fill_nt - 0x2000 - (i << 10));
+         break;
+      }
+   }
+   ppu_mirrorhipages();
+}
+
 /* MMC5 - Castlevania III, etc */
 static void map5_hblank(int vblank)
 {
    UNUSED(vblank);
 
+   /* the frame loop only calls on the line asked for and a few others */
    if (irq.counter == nes_getcontextptr()->scanline)
    {
       if (true == irq.enabled)
@@ -60,11 +110,19 @@ static void map5_hblank(int vblank)
 
 static void map5_write(uint32 address, uint8 value)
 {
-   static int page_size = 8;
-
-   /* ex-ram memory-- bleh! */
    if (address >= 0x5C00 && address <= 0x5FFF)
+   {
+      /* read only in mode 3 */
+      if (3 != exram_mode)
+      {
+         exram[address & 0x3FF] = value;
+
+         /* shown as a nametable: line reuse can't see CPU writes */
+         if ((exram_mode < 2) && (0xAA & nt_mapping & ~(nt_mapping << 1)))
+            ppu_invalidatelines();
+      }
       return;
+   }
 
    switch (address)
    {
@@ -101,16 +159,27 @@ static void map5_write(uint32 address, uint8 value)
       10:ex-ram
       11:exram + write protect
       */
+      exram_mode = value & 3;
+      map5_setexattr();
       break;
 
    case 0x5105:
-      /* TODO: exram needs to fill in nametables 2-3 */
-      ppu_mirror(value & 3, (value >> 2) & 3, (value >> 4) & 3, value >> 6);
+      nt_mapping = value;
+      map5_setnametables();
       break;
 
    case 0x5106:
+      /* fill mode tile */
+      memset(fill_nt, value, 0x3C0);
+      if (0xAA & nt_mapping & (nt_mapping << 1))
+         ppu_invalidatelines();
+      break;
+
    case 0x5107:
-      /* ex-ram fill mode stuff */
+      /* fill mode palette, for every tile */
+      memset(fill_nt + 0x3C0, (value & 3) * 0x55, 0x40);
+      if (0xAA & nt_mapping & (nt_mapping << 1))
+         ppu_invalidatelines();
       break;
 
    case 0x5113:
@@ -189,9 +258,16 @@ static void map5_write(uint32 address, uint8 value)
       mmc_bankvrom(1, 0x1C00, value);
       break;
 
+   case 0x5130:
+      /* top CHR bits, for extended attributes */
+      chr_hi = value & 3;
+      map5_setexattr();
+      break;
+
    case 0x5203:
       irq.counter = value;
       irq.latch = value;
+      nes_sethblankline(value);
       //      irq.reset = false;
       break;
 
@@ -202,7 +278,7 @@ static void map5_write(uint32 address, uint8 value)
 
    default:
 #ifdef NOFRENDO_DEBUG
-      log_printf("unknown mmc5 write: $%02X to $%04X\n", value, address);
+      log_printf(LOG_DEBUG "unknown mmc5 write: $%02X to $%04X\n", value, address);
 #endif /* NOFRENDO_DEBUG */
       break;
    }
@@ -216,10 +292,14 @@ static uint8 map5_read(uint32 address)
       /* if reset == 1, we've hit scanline */
       return (irq.reset ? 0x40 : 0x00);
    }
+   else if (address >= 0x5C00 && exram_mode >= 2)
+   {
+      return exram[address & 0x3FF];
+   }
    else
    {
 #ifdef NOFRENDO_DEBUG
-      log_printf("invalid MMC5 read: $%04X", address);
+      log_printf(LOG_DEBUG "invalid MMC5 read: $%04X", address);
 #endif
       return 0xFF;
    }
@@ -227,6 +307,14 @@ static uint8 map5_read(uint32 address)
 
 static void map5_init(void)
 {
+   state_region(&irq, sizeof(irq));
+   state_region(exram, sizeof(exram));
+   state_region(fill_nt, sizeof(fill_nt));
+   state_region(&exram_mode, sizeof(exram_mode));
+   state_region(&nt_mapping, sizeof(nt_mapping));
+   state_region(&chr_hi, sizeof(chr_hi));
+   state_region(&page_size, sizeof(page_size));
+
    mmc_bankrom(8, 0x8000, MMC_LASTBANK);
    mmc_bankrom(8, 0xA000, MMC_LASTBANK);
    mmc_bankrom(8, 0xC000, MMC_LASTBANK);
@@ -234,17 +322,23 @@ static void map5_init(void)
 
    irq.counter = irq.enabled = 0;
    irq.reset = irq.latch = 0;
-}
+   nes_sethblankline(0);
 
-/* incomplete SNSS definition */
-static void map5_getstate(SnssMapperBlock *state)
-{
-   state->extraData.mapper5.dummy = 0;
+   memset(exram, 0, sizeof(exram));
+   memset(fill_nt, 0, sizeof(fill_nt));
+   exram_mode = nt_mapping = chr_hi = 0;
+   page_size = 8;
+   map5_setexattr();
 }
 
-static void map5_setstate(SnssMapperBlock *state)
+/* the restored mirroring knows nothing of ExRAM or the fill page, nor the
+** frame loop of the IRQ line
+*/
+static void map5_setstate(void)
 {
-   UNUSED(state);
+   map5_setnametables();
+   map5_setexattr();
+   nes_sethblankline(irq.counter);
 }
 
 static map_memwrite map5_memwrite[] =
@@ -257,6 +351,7 @@ static map_memwrite map5_memwrite[] =
 static map_memread map5_memread[] =
     {
         {0x5204, 0x5204, map5_read},
+        {0x5C00, 0x5FFF, map5_read},
         {-1, -1, NULL}};
 
 mapintf_t map5_intf =
@@ -266,11 +361,16 @@ mapintf_t map5_intf =
         map5_init,     /* init routine */
         NULL,          /* vblank callback */
         map5_hblank,   /* hblank callback */
-        map5_getstate, /* get state (snss) */
-        map5_setstate, /* set state (snss) */
+        NULL,          /* before a snapshot */
+        map5_setstate, /* after a restore */
         map5_memread,  /* memory read structure */
         map5_memwrite, /* memory write structure */
-        &mmc5_ext      /* external sound device */
+#ifdef NES_NO_EXPSOUND
+        NULL,          /* the build has no expansion sound */
+#else
+        &mmc5_ext,     /* external sound device */
+#endif
+        MMC_HBLANK_RENDER | MMC_HBLANK_EVENT /* flags */
 };
 /*
 ** $Log: map005.c,v $
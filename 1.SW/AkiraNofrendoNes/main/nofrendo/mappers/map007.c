@@ -57,8 +57,8 @@ mapintf_t map7_intf =
         map7_init,     /* init routine */
         NULL,          /* vblank callback */
         NULL,          /* hblank callback */
-        NULL,          /* get state (snss) */
-        NULL,          /* set state (snss) */
+        NULL,          /* before a snapshot */
+        NULL,          /* after a restore */
         NULL,          /* memory read structure */
         map7_memwrite, /* memory write structure */
         NULL           /* external sound device */
@@ -56,8 +56,8 @@ mapintf_t map8_intf =
         map8_init,     /* init routine */
         NULL,          /* vblank callback */
         NULL,          /* hblank callback */
-        NULL,          /* get state (snss) */
-        NULL,          /* set state (snss) */
+        NULL,          /* before a snapshot */
+        NULL,          /* after a restore */
         NULL,          /* memory read structure */
         map8_memwrite, /* memory write structure */
         NULL           /* external sound device */
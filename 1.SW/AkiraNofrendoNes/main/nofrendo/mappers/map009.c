@@ -27,9 +27,9 @@
 
 #include "noftypes.h"
 #include "../nes/nes_mmc.h"
+#include "../nes/nesstate.h"
 #include "../nes/nes.h"
 #include "../nes/nes_ppu.h"
-#include "../libsnss/libsnss.h"
 
 static uint8 latch[2];
 static uint8 regs[4];
@@ -104,6 +104,9 @@ static void map9_write(uint32 address, uint8 value)
 
 static void map9_init(void)
 {
+   state_region(latch, sizeof(latch));
+   state_region(regs, sizeof(regs));
+
    memset(regs, 0, sizeof(regs));
 
    mmc_bankrom(8, 0x8000, 0);
@@ -117,26 +120,6 @@ static void map9_init(void)
    ppu_setlatchfunc(mmc9_latchfunc);
 }
 
-static void map9_getstate(SnssMapperBlock *state)
-{
-   state->extraData.mapper9.latch[0] = latch[0];
-   state->extraData.mapper9.latch[1] = latch[1];
-   state->extraData.mapper9.lastB000Write = regs[0];
-   state->extraData.mapper9.lastC000Write = regs[1];
-   state->extraData.mapper9.lastD000Write = regs[2];
-   state->extraData.mapper9.lastE000Write = regs[3];
-}
-
-static void map9_setstate(SnssMapperBlock *state)
-{
-   latch[0] = state->extraData.mapper9.latch[0];
-   latch[1] = state->extraData.mapper9.latch[1];
-   regs[0] = state->extraData.mapper9.lastB000Write;
-   regs[1] = state->extraData.mapper9.lastC000Write;
-   regs[2] = state->extraData.mapper9.lastD000Write;
-   regs[3] = state->extraData.mapper9.lastE000Write;
-}
-
 static map_memwrite map9_memwrite[] =
     {
         {0x8000, 0xFFFF, map9_write},
@@ -149,8 +132,8 @@ mapintf_t map9_intf =
         map9_init,     /* init routine */
         NULL,          /* vblank callback */
         NULL,          /* hblank callback */
-        map9_getstate, /* get state (snss) */
-        map9_setstate, /* set state (snss) */
+        NULL,          /* before a snapshot */
+        NULL,          /* after a restore */
         NULL,          /* memory read structure */
         map9_memwrite, /* memory write structure */
         NULL           /* external sound device */
@@ -26,7 +26,6 @@
 #include "../nes/nes_mmc.h"
 #include "../nes/nes.h"
 #include "../nes/nes_ppu.h"
-#include "../libsnss/libsnss.h"
 
 /* mapper 11: Color Dreams, Wisdom Tree */
 static void map11_write(uint32 address, uint8 value)
@@ -55,8 +54,8 @@ mapintf_t map11_intf =
         map11_init,     /* init routine */
         NULL,           /* vblank callback */
         NULL,           /* hblank callback */
-        NULL,           /* get state (snss) */
-        NULL,           /* set state (snss) */
+        NULL,           /* before a snapshot */
+        NULL,           /* after a restore */
         NULL,           /* memory read structure */
         map11_memwrite, /* memory write structure */
         NULL            /* external sound device */
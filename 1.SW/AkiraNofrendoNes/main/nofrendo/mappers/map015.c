@@ -26,7 +26,6 @@
 #include "../nes/nes_mmc.h"
 #include "../nes/nes.h"
 #include "../nes/nes_ppu.h"
-#include "../libsnss/libsnss.h"
 
 /* mapper 15: Contra 100-in-1 */
 static void map15_write(uint32 address, uint8 value)
@@ -102,8 +101,8 @@ mapintf_t map15_intf =
         map15_init,        /* init routine */
         NULL,              /* vblank callback */
         NULL,              /* hblank callback */
-        NULL,              /* get state (snss) */
-        NULL,              /* set state (snss) */
+        NULL,              /* before a snapshot */
+        NULL,              /* after a restore */
         NULL,              /* memory read structure */
         map15_memwrite,    /* memory write structure */
         NULL               /* external sound device */
@@ -25,9 +25,9 @@
 
 #include "noftypes.h"
 #include "../nes/nes_mmc.h"
+#include "../nes/nesstate.h"
 #include "../nes/nes.h"
 #include "../nes/nes_ppu.h"
-#include "../libsnss/libsnss.h"
 
 static struct
 {
@@ -39,6 +39,8 @@ static struct
 
 static void map16_init(void)
 {
+   state_region(&irq, sizeof(irq));
+
    mmc_bankrom(16, 0x8000, 0);
    mmc_bankrom(16, 0xC000, MMC_LASTBANK);
    irq.counter = 0;
@@ -115,19 +117,6 @@ static void map16_hblank(int vblank)
    }
 }
 
-static void map16_getstate(SnssMapperBlock *state)
-{
-   state->extraData.mapper16.irqCounterLowByte = irq.counter & 0xFF;
-   state->extraData.mapper16.irqCounterHighByte = irq.counter >> 8;
-   state->extraData.mapper16.irqCounterEnabled = irq.enabled;
-}
-
-static void map16_setstate(SnssMapperBlock *state)
-{
-   irq.counter = (state->extraData.mapper16.irqCounterHighByte << 8) | state->extraData.mapper16.irqCounterLowByte;
-   irq.enabled = state->extraData.mapper16.irqCounterEnabled;
-}
-
 static map_memwrite map16_memwrite[] =
     {
         {0x6000, 0x600D, map16_write},
@@ -142,8 +131,8 @@ mapintf_t map16_intf =
         map16_init,     /* init routine */
         NULL,           /* vblank callback */
         map16_hblank,   /* hblank callback */
-        map16_getstate, /* get state (snss) */
-        map16_setstate, /* set state (snss) */
+        NULL,           /* before a snapshot */
+        NULL,           /* after a restore */
         NULL,           /* memory read structure */
         map16_memwrite, /* memory write structure */
         NULL            /* external sound device */
@@ -24,9 +24,9 @@
 */
 #include "noftypes.h"
 #include "../nes/nes_mmc.h"
+#include "../nes/nesstate.h"
 #include "../nes/nes.h"
 #include "../nes/nes_ppu.h"
-#include "../libsnss/libsnss.h"
 /* mapper 18: Jaleco SS8806 */
 #define VRC_PBANK(bank, value, high)                                                                  \
    do                                                                                                 \
@@ -54,16 +54,22 @@ static struct
    int clockticks;
 } irq;
 
-static void map18_init(void)
-{
-   irq.counter = irq.enabled = 0;
-}
-
 static uint8 lownybbles[8];
 static uint8 highnybbles[8];
 static uint8 lowprgnybbles[3];
 static uint8 highprgnybbles[3];
 
+static void map18_init(void)
+{
+   state_region(&irq, sizeof(irq));
+   state_region(lownybbles, sizeof(lownybbles));
+   state_region(highnybbles, sizeof(highnybbles));
+   state_region(lowprgnybbles, sizeof(lowprgnybbles));
+   state_region(highprgnybbles, sizeof(highprgnybbles));
+
+   irq.counter = irq.enabled = 0;
+}
+
 static void map18_write(uint32 address, uint8 value)
 {
    switch (address)
@@ -202,19 +208,6 @@ static map_memwrite map18_memwrite[] =
         {0x8000, 0xFFFF, map18_write},
         {-1, -1, NULL}};
 
-static void map18_getstate(SnssMapperBlock *state)
-{
-   state->extraData.mapper18.irqCounterLowByte = irq.counter & 0xFF;
-   state->extraData.mapper18.irqCounterHighByte = irq.counter >> 8;
-   state->extraData.mapper18.irqCounterEnabled = irq.enabled;
-}
-
-static void map18_setstate(SnssMapperBlock *state)
-{
-   irq.counter = (state->extraData.mapper18.irqCounterHighByte << 8) | state->extraData.mapper18.irqCounterLowByte;
-   irq.enabled = state->extraData.mapper18.irqCounterEnabled;
-}
-
 mapintf_t map18_intf =
     {
         18,              /* mapper number */
@@ -222,8 +215,8 @@ mapintf_t map18_intf =
         map18_init,      /* init routine */
         NULL,            /* vblank callback */
         NULL,            /* hblank callback */
-        map18_getstate,  /* get state (snss) */
-        map18_setstate,  /* set state (snss) */
+        NULL,            /* before a snapshot */
+        NULL,            /* after a restore */
         NULL,            /* memory read structure */
         map18_memwrite,  /* memory write structure */
         NULL             /* external sound device */
@@ -25,9 +25,9 @@
 
 #include "noftypes.h"
 #include "../nes/nes_mmc.h"
+#include "../nes/nesstate.h"
 #include "../nes/nes.h"
 #include "../nes/nes_ppu.h"
-#include "../libsnss/libsnss.h"
 
 /* TODO: shouldn't there be an h-blank IRQ handler??? */
 
@@ -48,6 +48,8 @@ static struct
 
 static void map19_init(void)
 {
+   state_region(&irq, sizeof(irq));
+
    irq.counter = irq.enabled = 0;
 }
 
@@ -102,19 +104,6 @@ static void map19_write(uint32 address, uint8 value)
    }
 }
 
-static void map19_getstate(SnssMapperBlock *state)
-{
-   state->extraData.mapper19.irqCounterLowByte = irq.counter & 0xFF;
-   state->extraData.mapper19.irqCounterHighByte = irq.counter >> 8;
-   state->extraData.mapper19.irqCounterEnabled = irq.enabled;
-}
-
-static void map19_setstate(SnssMapperBlock *state)
-{
-   irq.counter = (state->extraData.mapper19.irqCounterHighByte << 8) | state->extraData.mapper19.irqCounterLowByte;
-   irq.enabled = state->extraData.mapper19.irqCounterEnabled;
-}
-
 static map_memwrite map19_memwrite[] =
     {
         {0x5000, 0x5FFF, map19_write},
@@ -128,8 +117,8 @@ mapintf_t map19_intf =
         map19_init,     /* init routine */
         NULL,           /* vblank callback */
         NULL,           /* hblank callback */
-        map19_getstate, /* get state (snss) */
-        map19_setstate, /* set state (snss) */
+        NULL,           /* before a snapshot */
+        NULL,           /* after a restore */
         NULL,           /* memory read structure */
         map19_memwrite, /* memory write structure */
         NULL            /* external sound device */
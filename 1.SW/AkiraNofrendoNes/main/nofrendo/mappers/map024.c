@@ -25,9 +25,9 @@
 
 #include "noftypes.h"
 #include "../nes/nes_mmc.h"
+#include "../nes/nesstate.h"
 #include "../nes/nes.h"
 #include "../nes/nes_ppu.h"
-#include "../libsnss/libsnss.h"
 #include "log.h"
 #include "../sndhrdw/vrcvisnd.h"
 
@@ -39,6 +39,8 @@ static struct
 
 static void map24_init(void)
 {
+   state_region(&irq, sizeof(irq));
+
    irq.counter = irq.enabled = 0;
    irq.latch = irq.wait_state = 0;
 }
@@ -148,24 +150,12 @@ static void map24_write(uint32 address, uint8 value)
 
    default:
 #ifdef NOFRENDO_DEBUG
-      log_printf("invalid VRC6 write: $%02X to $%04X", value, address);
+      log_printf(LOG_DEBUG "invalid VRC6 write: $%02X to $%04X", value, address);
 #endif
       break;
    }
 }
 
-static void map24_getstate(SnssMapperBlock *state)
-{
-   state->extraData.mapper24.irqCounter = irq.counter;
-   state->extraData.mapper24.irqCounterEnabled = irq.enabled;
-}
-
-static void map24_setstate(SnssMapperBlock *state)
-{
-   irq.counter = state->extraData.mapper24.irqCounter;
-   irq.enabled = state->extraData.mapper24.irqCounterEnabled;
-}
-
 static map_memwrite map24_memwrite[] =
     {
         {0x8000, 0xF002, map24_write},
@@ -178,11 +168,15 @@ mapintf_t map24_intf =
         map24_init,     /* init routine */
         NULL,           /* vblank callback */
         map24_hblank,   /* hblank callback */
-        map24_getstate, /* get state (snss) */
-        map24_setstate, /* set state (snss) */
+        NULL,           /* before a snapshot */
+        NULL,           /* after a restore */
         NULL,           /* memory read structure */
         map24_memwrite, /* memory write structure */
+#ifdef NES_NO_EXPSOUND
+        NULL            /* the build has no expansion sound */
+#else
         &vrcvi_ext      /* external sound device */
+#endif
 };
 
 /*
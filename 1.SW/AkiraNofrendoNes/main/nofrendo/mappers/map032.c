@@ -25,6 +25,7 @@
 
 #include "noftypes.h"
 #include "../nes/nes_mmc.h"
+#include "../nes/nesstate.h"
 #include "../nes/nes_ppu.h"
 
 static int select_c000 = 0;
@@ -66,6 +67,13 @@ static void map32_write(uint32 address, uint8 value)
    }
 }
 
+static void map32_init(void)
+{
+   state_region(&select_c000, sizeof(select_c000));
+
+   select_c000 = 0;
+}
+
 static map_memwrite map32_memwrite[] =
     {
         {0x8000, 0xFFFF, map32_write},
@@ -75,11 +83,11 @@ mapintf_t map32_intf =
     {
         32,             /* mapper number */
         "Irem G-101",   /* mapper name */
-        NULL,           /* init routine */
+        map32_init,     /* init routine */
         NULL,           /* vblank callback */
         NULL,           /* hblank callback */
-        NULL,           /* get state (snss) */
-        NULL,           /* set state (snss) */
+        NULL,           /* before a snapshot */
+        NULL,           /* after a restore */
         NULL,           /* memory read structure */
         map32_memwrite, /* memory write structure */
         NULL            /* external sound device */
@@ -59,8 +59,8 @@ mapintf_t map34_intf =
         map34_init,     /* init routine */
         NULL,           /* vblank callback */
         NULL,           /* hblank callback */
-        NULL,           /* get state (snss) */
-        NULL,           /* set state (snss) */
+        NULL,           /* before a snapshot */
+        NULL,           /* after a restore */
         NULL,           /* memory read structure */
         map34_memwrite, /* memory write structure */
         NULL            /* external sound device */
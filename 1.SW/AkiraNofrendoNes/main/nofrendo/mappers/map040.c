@@ -25,9 +25,9 @@
 
 #include "noftypes.h"
 #include "../nes/nes_mmc.h"
+#include "../nes/nesstate.h"
 #include "../nes/nes.h"
 #include "../nes/nes_ppu.h"
-#include "../libsnss/libsnss.h"
 #include "log.h"
 
 #define MAP40_IRQ_PERIOD (4096 / 113.666666)
@@ -40,6 +40,8 @@ static struct
 /* mapper 40: SMB 2j (hack) */
 static void map40_init(void)
 {
+   state_region(&irq, sizeof(irq));
+
    mmc_bankrom(8, 0x6000, 6);
    mmc_bankrom(8, 0x8000, 4);
    mmc_bankrom(8, 0xA000, 5);
@@ -88,18 +90,6 @@ static void map40_write(uint32 address, uint8 value)
    }
 }
 
-static void map40_getstate(SnssMapperBlock *state)
-{
-   state->extraData.mapper40.irqCounter = irq.counter;
-   state->extraData.mapper40.irqCounterEnabled = irq.enabled;
-}
-
-static void map40_setstate(SnssMapperBlock *state)
-{
-   irq.counter = state->extraData.mapper40.irqCounter;
-   irq.enabled = state->extraData.mapper40.irqCounterEnabled;
-}
-
 static map_memwrite map40_memwrite[] =
     {
         {0x8000, 0xFFFF, map40_write},
@@ -112,8 +102,8 @@ mapintf_t map40_intf =
         map40_init,        /* init routine */
         NULL,              /* vblank callback */
         map40_hblank,      /* hblank callback */
-        map40_getstate,    /* get state (snss) */
-        map40_setstate,    /* set state (snss) */
+        NULL,              /* before a snapshot */
+        NULL,              /* after a restore */
         NULL,              /* memory read structure */
         map40_memwrite,    /* memory write structure */
         NULL               /* external sound device */
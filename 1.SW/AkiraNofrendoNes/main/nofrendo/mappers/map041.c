@@ -28,9 +28,9 @@
 
 #include "noftypes.h"
 #include "../nes/nes_mmc.h"
+#include "../nes/nesstate.h"
 #include "../nes/nes.h"
 #include "../nes/nes_ppu.h"
-#include "../libsnss/libsnss.h"
 #include "log.h"
 
 static uint8 register_low;
@@ -53,6 +53,9 @@ static void map41_set_chr(void)
 /******************************/
 static void map41_init(void)
 {
+  state_region(&register_low, sizeof(register_low));
+  state_region(&register_high, sizeof(register_high));
+
   /* Both registers set to zero at power on */
   /* TODO: Registers should also be cleared on a soft reset */
   register_low = 0x00;
@@ -107,30 +110,6 @@ static void map41_high_write(uint32 address, uint8 value)
   return;
 }
 
-/****************************************************/
-/* Shove extra mapper information into a SNSS block */
-/****************************************************/
-static void map41_setstate(SnssMapperBlock *state)
-{
-  /* TODO: Store SNSS information */
-  UNUSED(state);
-
-  /* Done */
-  return;
-}
-
-/*****************************************************/
-/* Pull extra mapper information out of a SNSS block */
-/*****************************************************/
-static void map41_getstate(SnssMapperBlock *state)
-{
-  /* TODO: Retrieve SNSS information */
-  UNUSED(state);
-
-  /* Done */
-  return;
-}
-
 static map_memwrite map41_memwrite[] =
     {
         {0x6000, 0x67FF, map41_low_write},
@@ -144,8 +123,8 @@ mapintf_t map41_intf =
         map41_init,       /* Initialization routine */
         NULL,             /* VBlank callback */
         NULL,             /* HBlank callback */
-        map41_getstate,   /* Get state (SNSS) */
-        map41_setstate,   /* Set state (SNSS) */
+        NULL,             /* Before a snapshot */
+        NULL,             /* After a restore */
         NULL,             /* Memory read structure */
         map41_memwrite,   /* Memory write structure */
         NULL              /* External sound device */
@@ -28,9 +28,9 @@
 
 #include "noftypes.h"
 #include "../nes/nes_mmc.h"
+#include "../nes/nesstate.h"
 #include "../nes/nes.h"
 #include "../nes/nes_ppu.h"
-#include "../libsnss/libsnss.h"
 #include "log.h"
 
 static struct
@@ -57,6 +57,8 @@ static void map42_irq_reset(void)
 /********************************************/
 static void map42_init(void)
 {
+  state_region(&irq, sizeof(irq));
+
   /* Set the hardwired pages */
   mmc_bankrom(8, 0x8000, 0x0C);
   mmc_bankrom(8, 0xA000, 0x0D);
@@ -135,30 +137,6 @@ static void map42_write(uint32 address, uint8 value)
   return;
 }
 
-/****************************************************/
-/* Shove extra mapper information into a SNSS block */
-/****************************************************/
-static void map42_setstate(SnssMapperBlock *state)
-{
-  /* TODO: Store SNSS information */
-  UNUSED(state);
-
-  /* Done */
-  return;
-}
-
-/*****************************************************/
-/* Pull extra mapper information out of a SNSS block */
-/*****************************************************/
-static void map42_getstate(SnssMapperBlock *state)
-{
-  /* TODO: Retrieve SNSS information */
-  UNUSED(state);
-
-  /* Done */
-  return;
-}
-
 static map_memwrite map42_memwrite[] =
     {
         {0xE000, 0xFFFF, map42_write},
@@ -171,8 +149,8 @@ mapintf_t map42_intf =
         map42_init,             /* Initialization routine */
         NULL,                   /* VBlank callback */
         map42_hblank,           /* HBlank callback */
-        map42_getstate,         /* Get state (SNSS) */
-        map42_setstate,         /* Set state (SNSS) */
+        NULL,                   /* Before a snapshot */
+        NULL,                   /* After a restore */
         NULL,                   /* Memory read structure */
         map42_memwrite,         /* Memory write structure */
         NULL                    /* External sound device */
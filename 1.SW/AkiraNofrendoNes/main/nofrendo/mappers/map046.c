@@ -28,9 +28,9 @@
 
 #include "noftypes.h"
 #include "../nes/nes_mmc.h"
+#include "../nes/nesstate.h"
 #include "../nes/nes.h"
 #include "../nes/nes_ppu.h"
-#include "../libsnss/libsnss.h"
 #include "log.h"
 
 static uint8 prg_low_bank;
@@ -56,6 +56,11 @@ static void map46_set_banks(void)
 /*********************************************************/
 static void map46_init(void)
 {
+  state_region(&prg_low_bank, sizeof(prg_low_bank));
+  state_region(&chr_low_bank, sizeof(chr_low_bank));
+  state_region(&prg_high_bank, sizeof(prg_high_bank));
+  state_region(&chr_high_bank, sizeof(chr_high_bank));
+
   /* High bank switch register is set to zero on reset */
   prg_high_bank = 0x00;
   chr_high_bank = 0x00;
@@ -91,30 +96,6 @@ static void map46_write(uint32 address, uint8 value)
   return;
 }
 
-/****************************************************/
-/* Shove extra mapper information into a SNSS block */
-/****************************************************/
-static void map46_setstate(SnssMapperBlock *state)
-{
-  /* TODO: Store SNSS information */
-  UNUSED(state);
-
-  /* Done */
-  return;
-}
-
-/*****************************************************/
-/* Pull extra mapper information out of a SNSS block */
-/*****************************************************/
-static void map46_getstate(SnssMapperBlock *state)
-{
-  /* TODO: Retrieve SNSS information */
-  UNUSED(state);
-
-  /* Done */
-  return;
-}
-
 static map_memwrite map46_memwrite[] =
     {
         {0x6000, 0xFFFF, map46_write},
@@ -127,8 +108,8 @@ mapintf_t map46_intf =
         map46_init,             /* Initialization routine */
         NULL,                   /* VBlank callback */
         NULL,                   /* HBlank callback */
-        map46_getstate,         /* Get state (SNSS) */
-        map46_setstate,         /* Set state (SNSS) */
+        NULL,                   /* Before a snapshot */
+        NULL,                   /* After a restore */
         NULL,                   /* Memory read structure */
         map46_memwrite,         /* Memory write structure */
         NULL                    /* External sound device */
@@ -28,9 +28,9 @@
 
 #include "noftypes.h"
 #include "../nes/nes_mmc.h"
+#include "../nes/nesstate.h"
 #include "../nes/nes.h"
 #include "../nes/nes_ppu.h"
-#include "../libsnss/libsnss.h"
 #include "log.h"
 
 static struct
@@ -57,6 +57,8 @@ static void map50_irq_reset(void)
 /**************************************************************/
 static void map50_init(void)
 {
+  state_region(&irq, sizeof(irq));
+
   /* Set the hardwired pages */
   mmc_bankrom(8, 0x6000, 0x0F);
   mmc_bankrom(8, 0x8000, 0x08);
@@ -138,30 +140,6 @@ static void map50_write(uint32 address, uint8 value)
   return;
 }
 
-/****************************************************/
-/* Shove extra mapper information into a SNSS block */
-/****************************************************/
-static void map50_setstate(SnssMapperBlock *state)
-{
-  /* TODO: Store SNSS information */
-  UNUSED(state);
-
-  /* Done */
-  return;
-}
-
-/*****************************************************/
-/* Pull extra mapper information out of a SNSS block */
-/*****************************************************/
-static void map50_getstate(SnssMapperBlock *state)
-{
-  /* TODO: Retrieve SNSS information */
-  UNUSED(state);
-
-  /* Done */
-  return;
-}
-
 static map_memwrite map50_memwrite[] =
     {
         {0x4000, 0x5FFF, map50_write},
@@ -174,8 +152,8 @@ mapintf_t map50_intf =
         map50_init,                       /* Initialization routine */
         NULL,                             /* VBlank callback */
         map50_hblank,                     /* HBlank callback */
-        map50_getstate,                   /* Get state (SNSS) */
-        map50_setstate,                   /* Set state (SNSS) */
+        NULL,                             /* Before a snapshot */
+        NULL,                             /* After a restore */
         NULL,                             /* Memory read structure */
         map50_memwrite,                   /* Memory write structure */
         NULL                              /* External sound device */
@@ -24,9 +24,9 @@
 */
 #include "noftypes.h"
 #include "../nes/nes_mmc.h"
+#include "../nes/nesstate.h"
 #include "../nes/nes.h"
 #include "../nes/nes_ppu.h"
-#include "../libsnss/libsnss.h"
 #include "log.h"
 
 static struct
@@ -120,7 +120,7 @@ static void map64_write(uint32 address, uint8 value)
 
       default:
 #ifdef NOFRENDO_DEBUG
-         log_printf("mapper 64: unknown command #%d", command & 0xF);
+         log_printf(LOG_DEBUG "mapper 64: unknown command #%d", command & 0xF);
 #endif
          break;
       }
@@ -154,7 +154,7 @@ static void map64_write(uint32 address, uint8 value)
 
    default:
 #ifdef NOFRENDO_DEBUG
-      log_printf("mapper 64: Wrote $%02X to $%04X", value, address);
+      log_printf(LOG_DEBUG "mapper 64: Wrote $%02X to $%04X", value, address);
 #endif
       break;
    }
@@ -165,6 +165,10 @@ static void map64_write(uint32 address, uint8 value)
 
 static void map64_init(void)
 {
+   state_region(&irq, sizeof(irq));
+   state_region(&command, sizeof(command));
+   state_region(&vrombase, sizeof(vrombase));
+
    mmc_bankrom(8, 0x8000, MMC_LASTBANK);
    mmc_bankrom(8, 0xA000, MMC_LASTBANK);
    mmc_bankrom(8, 0xC000, MMC_LASTBANK);
@@ -186,11 +190,12 @@ mapintf_t map64_intf =
         map64_init,       /* init routine */
         NULL,             /* vblank callback */
         map64_hblank,     /* hblank callback */
-        NULL,             /* get state (snss) */
-        NULL,             /* set state (snss) */
+        NULL,             /* before a snapshot */
+        NULL,             /* after a restore */
         NULL,             /* memory read structure */
         map64_memwrite,   /* memory write structure */
-        NULL              /* external sound device */
+        NULL,             /* external sound device */
+        MMC_HBLANK_RENDER /* flags */
 };
 
 /*
@@ -25,9 +25,9 @@
 
 #include "noftypes.h"
 #include "../nes/nes_mmc.h"
+#include "../nes/nesstate.h"
 #include "../nes/nes.h"
 #include "../nes/nes_ppu.h"
-#include "../libsnss/libsnss.h"
 #include "log.h"
 static struct
 {
@@ -39,6 +39,8 @@ static struct
 
 static void map65_init(void)
 {
+   state_region(&irq, sizeof(irq));
+
    irq.counter = 0;
    irq.enabled = false;
    irq.low = irq.high = 0;
@@ -106,8 +108,8 @@ mapintf_t map65_intf =
         map65_init,     /* init routine */
         NULL,           /* vblank callback */
         NULL,           /* hblank callback */
-        NULL,           /* get state (snss) */
-        NULL,           /* set state (snss) */
+        NULL,           /* before a snapshot */
+        NULL,           /* after a restore */
         NULL,           /* memory read structure */
         map65_memwrite, /* memory write structure */
         NULL            /* external sound device */
@@ -27,7 +27,6 @@
 #include "../nes/nes_mmc.h"
 #include "../nes/nes.h"
 #include "../nes/nes_ppu.h"
-#include "../libsnss/libsnss.h"
 #include "log.h"
 /* mapper 66: GNROM */
 static void map66_write(uint32 address, uint8 value)
@@ -56,8 +55,8 @@ mapintf_t map66_intf =
         map66_init,     /* init routine */
         NULL,           /* vblank callback */
         NULL,           /* hblank callback */
-        NULL,           /* get state (snss) */
-        NULL,           /* set state (snss) */
+        NULL,           /* before a snapshot */
+        NULL,           /* after a restore */
         NULL,           /* memory read structure */
         map66_memwrite, /* memory write structure */
         NULL            /* external sound device */
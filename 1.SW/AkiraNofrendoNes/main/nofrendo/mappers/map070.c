@@ -26,7 +26,6 @@
 #include "../nes/nes_mmc.h"
 #include "../nes/nes.h"
 #include "../nes/nes_ppu.h"
-#include "../libsnss/libsnss.h"
 
 /* mapper 70: Arkanoid II, Kamen Rider Club, etc. */
 /* ($8000-$FFFF) D6-D4 = switch $8000-$BFFF */
@@ -70,8 +69,8 @@ mapintf_t map70_intf =
         NULL,           /* init routine */
         NULL,           /* vblank callback */
         NULL,           /* hblank callback */
-        NULL,           /* get state (snss) */
-        NULL,           /* set state (snss) */
+        NULL,           /* before a snapshot */
+        NULL,           /* after a restore */
         NULL,           /* memory read structure */
         map70_memwrite, /* memory write structure */
         NULL            /* external sound device */
@@ -27,9 +27,9 @@
 
 #include "noftypes.h"
 #include "../nes/nes_mmc.h"
+#include "../nes/nesstate.h"
 #include "../nes/nes.h"
 #include "../nes/nes_ppu.h"
-#include "../libsnss/libsnss.h"
 #include "log.h"
 
 static struct
@@ -43,6 +43,8 @@ static struct
 /**************************/
 static void map73_init(void)
 {
+  state_region(&irq, sizeof(irq));
+
   /* Turn off IRQs */
   irq.enabled = false;
   irq.counter = 0x0000;
@@ -121,30 +123,6 @@ static void map73_write(uint32 address, uint8 value)
   return;
 }
 
-/****************************************************/
-/* Shove extra mapper information into a SNSS block */
-/****************************************************/
-static void map73_setstate(SnssMapperBlock *state)
-{
-  /* TODO: Store SNSS information */
-  UNUSED(state);
-
-  /* Done */
-  return;
-}
-
-/*****************************************************/
-/* Pull extra mapper information out of a SNSS block */
-/*****************************************************/
-static void map73_getstate(SnssMapperBlock *state)
-{
-  /* TODO: Retrieve SNSS information */
-  UNUSED(state);
-
-  /* Done */
-  return;
-}
-
 static map_memwrite map73_memwrite[] =
     {
         {0x8000, 0xFFFF, map73_write},
@@ -157,8 +135,8 @@ mapintf_t map73_intf =
         map73_init,     /* Initialization routine */
         NULL,           /* VBlank callback */
         map73_hblank,   /* HBlank callback */
-        map73_getstate, /* Get state (SNSS) */
-        map73_setstate, /* Set state (SNSS) */
+        NULL,           /* Before a snapshot */
+        NULL,           /* After a restore */
         NULL,           /* Memory read structure */
         map73_memwrite, /* Memory write structure */
         NULL            /* External sound device */
@@ -25,9 +25,9 @@
 
 #include "noftypes.h"
 #include "../nes/nes_mmc.h"
+#include "../nes/nesstate.h"
 #include "../nes/nes.h"
 #include "../nes/nes_ppu.h"
-#include "../libsnss/libsnss.h"
 
 static uint8 latch[2];
 static uint8 hibits;
@@ -77,6 +77,15 @@ static void map75_write(uint32 address, uint8 value)
    }
 }
 
+static void map75_init(void)
+{
+   state_region(latch, sizeof(latch));
+   state_region(&hibits, sizeof(hibits));
+
+   latch[0] = latch[1] = 0;
+   hibits = 0;
+}
+
 static map_memwrite map75_memwrite[] =
     {
         {0x8000, 0xFFFF, map75_write},
@@ -86,11 +95,11 @@ mapintf_t map75_intf =
     {
         75,             /* mapper number */
         "Konami VRC1",  /* mapper name */
-        NULL,           /* init routine */
+        map75_init,     /* init routine */
         NULL,           /* vblank callback */
         NULL,           /* hblank callback */
-        NULL,           /* get state (snss) */
-        NULL,           /* set state (snss) */
+        NULL,           /* before a snapshot */
+        NULL,           /* after a restore */
         NULL,           /* memory read structure */
         map75_memwrite, /* memory write structure */
         NULL            /* external sound device */
@@ -26,7 +26,6 @@
 #include "../nes/nes_mmc.h"
 #include "../nes/nes.h"
 #include "../nes/nes_ppu.h"
-#include "../libsnss/libsnss.h"
 
 /* mapper 78: Holy Diver, Cosmo Carrier */
 /* ($8000-$FFFF) D2-D0 = switch $8000-$BFFF */
@@ -66,8 +65,8 @@ mapintf_t map78_intf =
         NULL,           /* init routine */
         NULL,           /* vblank callback */
         NULL,           /* hblank callback */
-        NULL,           /* get state (snss) */
-        NULL,           /* set state (snss) */
+        NULL,           /* before a snapshot */
+        NULL,           /* after a restore */
         NULL,           /* memory read structure */
         map78_memwrite, /* memory write structure */
         NULL            /* external sound device */
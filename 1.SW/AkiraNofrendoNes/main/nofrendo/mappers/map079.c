@@ -27,7 +27,6 @@
 #include "../nes/nes_mmc.h"
 #include "../nes/nes.h"
 #include "../nes/nes_ppu.h"
-#include "../libsnss/libsnss.h"
 
 /* mapper 79: NINA-03/06 */
 static void map79_write(uint32 address, uint8 value)
@@ -57,8 +56,8 @@ mapintf_t map79_intf =
         map79_init,     /* init routine */
         NULL,           /* vblank callback */
         NULL,           /* hblank callback */
-        NULL,           /* get state (snss) */
-        NULL,           /* set state (snss) */
+        NULL,           /* before a snapshot */
+        NULL,           /* after a restore */
         NULL,           /* memory read structure */
         map79_memwrite, /* memory write structure */
         NULL            /* external sound device */
@@ -25,9 +25,9 @@
 
 #include "noftypes.h"
 #include "../nes/nes_mmc.h"
+#include "../nes/nesstate.h"
 #include "../nes/nes.h"
 #include "../nes/nes_ppu.h"
-#include "../libsnss/libsnss.h"
 #include "log.h"
 
 static struct
@@ -129,7 +129,7 @@ static void map85_write(uint32 address, uint8 value)
 
    default:
 #ifdef NOFRENDO_DEBUG
-      log_printf("unhandled vrc7 write: $%02X to $%04X\n", value, address);
+      log_printf(LOG_DEBUG "unhandled vrc7 write: $%02X to $%04X\n", value, address);
 #endif /* NOFRENDO_DEBUG */
       break;
    }
@@ -159,6 +159,8 @@ static map_memwrite map85_memwrite[] =
 
 static void map85_init(void)
 {
+   state_region(&irq, sizeof(irq));
+
    mmc_bankrom(16, 0x8000, 0);
    mmc_bankrom(16, 0xC000, MMC_LASTBANK);
 
@@ -176,8 +178,8 @@ mapintf_t map85_intf =
         map85_init,     /* init routine */
         NULL,           /* vblank callback */
         map85_hblank,   /* hblank callback */
-        NULL,           /* get state (snss) */
-        NULL,           /* set state (snss) */
+        NULL,           /* before a snapshot */
+        NULL,           /* after a restore */
         NULL,           /* memory read structure */
         map85_memwrite, /* memory write structure */
         NULL};
@@ -29,7 +29,6 @@
 #include "../nes/nes_mmc.h"
 #include "../nes/nes.h"
 #include "../nes/nes_ppu.h"
-#include "../libsnss/libsnss.h"
 #include "log.h"
 
 /******************************************/
@@ -62,8 +61,8 @@ mapintf_t map87_intf =
         NULL,              /* Initialization routine */
         NULL,              /* VBlank callback */
         NULL,              /* HBlank callback */
-        NULL,              /* Get state (SNSS) */
-        NULL,              /* Set state (SNSS) */
+        NULL,              /* Before a snapshot */
+        NULL,              /* After a restore */
         NULL,              /* Memory read structure */
         map87_memwrite,    /* Memory write structure */
         NULL               /* External sound device */
@@ -27,7 +27,6 @@
 #include "../nes/nes_mmc.h"
 #include "../nes/nes.h"
 #include "../nes/nes_ppu.h"
-#include "../libsnss/libsnss.h"
 #include "log.h"
 
 static void map93_write(uint32 address, uint8 value)
@@ -55,8 +54,8 @@ mapintf_t map93_intf =
         NULL,           /* init routine */
         NULL,           /* vblank callback */
         NULL,           /* hblank callback */
-        NULL,           /* get state (snss) */
-        NULL,           /* set state (snss) */
+        NULL,           /* before a snapshot */
+        NULL,           /* after a restore */
         NULL,           /* memory read structure */
         map93_memwrite, /* memory write structure */
         NULL            /* external sound device */
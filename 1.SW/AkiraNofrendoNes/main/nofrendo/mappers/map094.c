@@ -27,7 +27,6 @@
 #include "../nes/nes_mmc.h"
 #include "../nes/nes.h"
 #include "../nes/nes_ppu.h"
-#include "../libsnss/libsnss.h"
 #include "log.h"
 
 /* mapper 94: Senjou no Ookami */
@@ -51,8 +50,8 @@ mapintf_t map94_intf =
         NULL,           /* init routine */
         NULL,           /* vblank callback */
         NULL,           /* hblank callback */
-        NULL,           /* get state (snss) */
-        NULL,           /* set state (snss) */
+        NULL,           /* before a snapshot */
+        NULL,           /* after a restore */
         NULL,           /* memory read structure */
         map94_memwrite, /* memory write structure */
         NULL            /* external sound device */
@@ -27,7 +27,6 @@
 #include "../nes/nes_mmc.h"
 #include "../nes/nes.h"
 #include "../nes/nes_ppu.h"
-#include "../libsnss/libsnss.h"
 #include "log.h"
 /* Switch VROM for VS games */
 static void map99_vromswitch(uint8 value)
@@ -50,8 +49,8 @@ mapintf_t map99_intf =
         map99_init,   /* init routine */
         NULL,         /* vblank callback */
         NULL,         /* hblank callback */
-        NULL,         /* get state (snss) */
-        NULL,         /* set state (snss) */
+        NULL,         /* before a snapshot */
+        NULL,         /* after a restore */
         NULL,         /* memory read structure */
         NULL,         /* memory write structure */
         NULL          /* external sound device */
@@ -25,9 +25,9 @@
 
 #include "noftypes.h"
 #include "../nes/nes_mmc.h"
+#include "../nes/nesstate.h"
 #include "../nes/nes.h"
 #include "../nes/nes_ppu.h"
-#include "../libsnss/libsnss.h"
 #include "log.h"
 static struct
 {
@@ -72,7 +72,7 @@ static void map160_write(uint32 address, uint8 value)
 #ifdef NOFRENDO_DEBUG
    else
    {
-      log_printf("mapper 160: untrapped write $%02X to $%04X\n", value, address);
+      log_printf(LOG_DEBUG "mapper 160: untrapped write $%02X to $%04X\n", value, address);
    }
 #endif /* NOFRENDO_DEBUG */
 }
@@ -98,6 +98,8 @@ static void map160_hblank(int vblank)
 
 static void map160_init(void)
 {
+   state_region(&irq, sizeof(irq));
+
    irq.enabled = false;
    irq.expired = false;
    irq.counter = 0;
@@ -116,11 +118,12 @@ mapintf_t map160_intf =
         map160_init,        /* init routine */
         NULL,               /* vblank callback */
         map160_hblank,      /* hblank callback */
-        NULL,               /* get state (snss) */
-        NULL,               /* set state (snss) */
+        NULL,               /* before a snapshot */
+        NULL,               /* after a restore */
         NULL,               /* memory read structure */
         map160_memwrite,    /* memory write structure */
-        NULL                /* external sound device */
+        NULL,               /* external sound device */
+        MMC_HBLANK_RENDER   /* flags */
 };
 
 /*
@@ -30,7 +30,6 @@
 #include "../nes/nes_mmc.h"
 #include "../nes/nes.h"
 #include "../nes/nes_ppu.h"
-#include "../libsnss/libsnss.h"
 #include "log.h"
 
 /************************/
@@ -91,8 +90,8 @@ mapintf_t map229_intf =
         map229_init,         /* Initialization routine */
         NULL,                /* VBlank callback */
         NULL,                /* HBlank callback */
-        NULL,                /* Get state (SNSS) */
-        NULL,                /* Set state (SNSS) */
+        NULL,                /* Before a snapshot */
+        NULL,                /* After a restore */
         NULL,                /* Memory read structure */
         map229_memwrite,     /* Memory write structure */
         NULL                 /* External sound device */
@@ -27,7 +27,6 @@
 #include "../nes/nes_mmc.h"
 #include "../nes/nes.h"
 #include "../nes/nes_ppu.h"
-#include "../libsnss/libsnss.h"
 #include "log.h"
 
 /* mapper 231: NINA-07, used in Wally Bear and the NO! Gang */
@@ -61,8 +60,8 @@ mapintf_t map231_intf =
         map231_init,     /* init routine */
         NULL,            /* vblank callback */
         NULL,            /* hblank callback */
-        NULL,            /* get state (snss) */
-        NULL,            /* set state (snss) */
+        NULL,            /* before a snapshot */
+        NULL,            /* after a restore */
         NULL,            /* memory read structure */
         map231_memwrite, /* memory write structure */
         NULL             /* external sound device */
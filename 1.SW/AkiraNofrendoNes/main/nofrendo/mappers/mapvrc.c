@@ -25,9 +25,9 @@
 
 #include "noftypes.h"
 #include "../nes/nes_mmc.h"
+#include "../nes/nesstate.h"
 #include "../nes/nes.h"
 #include "../nes/nes_ppu.h"
-#include "../libsnss/libsnss.h"
 #include "log.h"
 
 #define VRC_VBANK(bank, value, high)                                                  \
@@ -51,6 +51,11 @@ static uint8 highnybbles[8];
 
 static void vrc_init(void)
 {
+   state_region(&irq, sizeof(irq));
+   state_region(&select_c000, sizeof(select_c000));
+   state_region(lownybbles, sizeof(lownybbles));
+   state_region(highnybbles, sizeof(highnybbles));
+
    irq.counter = irq.enabled = 0;
    irq.latch = irq.wait_state = 0;
 }
@@ -189,7 +194,7 @@ static void map21_write(uint32 address, uint8 value)
 
    default:
 #ifdef NOFRENDO_DEBUG
-      log_printf("wrote $%02X to $%04X", value, address);
+      log_printf(LOG_DEBUG "wrote $%02X to $%04X", value, address);
 #endif
       break;
    }
@@ -365,7 +370,7 @@ static void map23_write(uint32 address, uint8 value)
 
    default:
 #ifdef NOFRENDO_DEBUG
-      log_printf("wrote $%02X to $%04X", value, address);
+      log_printf(LOG_DEBUG "wrote $%02X to $%04X", value, address);
 #endif
       break;
    }
@@ -402,18 +407,6 @@ static map_memwrite map23_memwrite[] =
         {0x8000, 0xFFFF, map23_write},
         {-1, -1, NULL}};
 
-static void map21_getstate(SnssMapperBlock *state)
-{
-   state->extraData.mapper21.irqCounter = irq.counter;
-   state->extraData.mapper21.irqCounterEnabled = irq.enabled;
-}
-
-static void map21_setstate(SnssMapperBlock *state)
-{
-   irq.counter = state->extraData.mapper21.irqCounter;
-   irq.enabled = state->extraData.mapper21.irqCounterEnabled;
-}
-
 mapintf_t map21_intf =
     {
         21,              /* mapper number */
@@ -421,8 +414,8 @@ mapintf_t map21_intf =
         vrc_init,        /* init routine */
         NULL,            /* vblank callback */
         vrc_hblank,      /* hblank callback */
-        map21_getstate,  /* get state (snss) */
-        map21_setstate,  /* set state (snss) */
+        NULL,            /* before a snapshot */
+        NULL,            /* after a restore */
         NULL,            /* memory read structure */
         map21_memwrite,  /* memory write structure */
         NULL             /* external sound device */
@@ -435,8 +428,8 @@ mapintf_t map22_intf =
         vrc_init,        /* init routine */
         NULL,            /* vblank callback */
         NULL,            /* hblank callback */
-        NULL,            /* get state (snss) */
-        NULL,            /* set state (snss) */
+        NULL,            /* before a snapshot */
+        NULL,            /* after a restore */
         NULL,            /* memory read structure */
         map22_memwrite,  /* memory write structure */
         NULL             /* external sound device */
@@ -449,8 +442,8 @@ mapintf_t map23_intf =
         vrc_init,        /* init routine */
         NULL,            /* vblank callback */
         vrc_hblank,      /* hblank callback */
-        NULL,            /* get state (snss) */
-        NULL,            /* set state (snss) */
+        NULL,            /* before a snapshot */
+        NULL,            /* after a restore */
         NULL,            /* memory read structure */
         map23_memwrite,  /* memory write structure */
         NULL             /* external sound device */
@@ -460,11 +453,11 @@ mapintf_t map25_intf =
     {
         25,              /* mapper number */
         "Konami VRC4 B", /* mapper name */
-        NULL,            /* init routine */
+        vrc_init,        /* init routine */
         NULL,            /* vblank callback */
         vrc_hblank,      /* hblank callback */
-        NULL,            /* get state (snss) */
-        NULL,            /* set state (snss) */
+        NULL,            /* before a snapshot */
+        NULL,            /* after a restore */
         NULL,            /* memory read structure */
         map21_memwrite,  /* memory write structure */
         NULL             /* external sound device */
@@ -26,6 +26,47 @@
 #include "noftypes.h"
 #include "nes_mmc.h"
 
+/* A build may pick its mappers: it defines NES_MAPPER_LIST and a
+** NES_MAPPER_<number> for each, and compiles only their files.  Without
+** the list every mapper here is in.
+*/
+#ifndef NES_MAPPER_LIST
+#define NES_MAPPER_0
+#define NES_MAPPER_1
+#define NES_MAPPER_2
+#define NES_MAPPER_3
+#define NES_MAPPER_4
+#define NES_MAPPER_5
+#define NES_MAPPER_7
+#define NES_MAPPER_8
+#define NES_MAPPER_9
+#define NES_MAPPER_11
+#define NES_MAPPER_15
+#define NES_MAPPER_16
+#define NES_MAPPER_18
+#define NES_MAPPER_19
+#define NES_MAPPER_21
+#define NES_MAPPER_22
+#define NES_MAPPER_23
+#define NES_MAPPER_24
+#define NES_MAPPER_25
+#define NES_MAPPER_32
+#define NES_MAPPER_33
+#define NES_MAPPER_34
+#define NES_MAPPER_40
+#define NES_MAPPER_64
+#define NES_MAPPER_65
+#define NES_MAPPER_66
+#define NES_MAPPER_70
+#define NES_MAPPER_75
+#define NES_MAPPER_78
+#define NES_MAPPER_79
+#define NES_MAPPER_85
+#define NES_MAPPER_94
+#define NES_MAPPER_99
+#define NES_MAPPER_231
+#endif /* !NES_MAPPER_LIST */
+
 /* mapper interfaces */
 extern mapintf_t map0_intf;
 extern mapintf_t map1_intf;
@@ -65,40 +106,108 @@ extern mapintf_t map231_intf;
 /* implemented mapper interfaces */
 const mapintf_t *mappers[] =
     {
+#ifdef NES_MAPPER_0
         &map0_intf,
+#endif
+#ifdef NES_MAPPER_1
         &map1_intf,
+#endif
+#ifdef NES_MAPPER_2
         &map2_intf,
+#endif
+#ifdef NES_MAPPER_3
         &map3_intf,
+#endif
+#ifdef NES_MAPPER_4
         &map4_intf,
+#endif
+#ifdef NES_MAPPER_5
         &map5_intf,
+#endif
+#ifdef NES_MAPPER_7
         &map7_intf,
+#endif
+#ifdef NES_MAPPER_8
         &map8_intf,
+#endif
+#ifdef NES_MAPPER_9
         &map9_intf,
+#endif
+#ifdef NES_MAPPER_11
         &map11_intf,
+#endif
+#ifdef NES_MAPPER_15
         &map15_intf,
+#endif
+#ifdef NES_MAPPER_16
         &map16_intf,
+#endif
+#ifdef NES_MAPPER_18
         &map18_intf,
+#endif
+#ifdef NES_MAPPER_19
         &map19_intf,
+#endif
+#ifdef NES_MAPPER_21
         &map21_intf,
+#endif
+#ifdef NES_MAPPER_22
         &map22_intf,
+#endif
+#ifdef NES_MAPPER_23
         &map23_intf,
+#endif
+#ifdef NES_MAPPER_24
         &map24_intf,
+#endif
+#ifdef NES_MAPPER_25
         &map25_intf,
+#endif
+#ifdef NES_MAPPER_32
         &map32_intf,
+#endif
+#ifdef NES_MAPPER_33
         &map33_intf,
+#endif
+#ifdef NES_MAPPER_34
         &map34_intf,
+#endif
+#ifdef NES_MAPPER_40
         &map40_intf,
+#endif
+#ifdef NES_MAPPER_64
         &map64_intf,
+#endif
+#ifdef NES_MAPPER_65
         &map65_intf,
+#endif
+#ifdef NES_MAPPER_66
         &map66_intf,
+#endif
+#ifdef NES_MAPPER_70
         &map70_intf,
+#endif
+#ifdef NES_MAPPER_75
         &map75_intf,
+#endif
+#ifdef NES_MAPPER_78
         &map78_intf,
+#endif
+#ifdef NES_MAPPER_79
         &map79_intf,
+#endif
+#ifdef NES_MAPPER_85
         &map85_intf,
+#endif
+#ifdef NES_MAPPER_94
         &map94_intf,
+#endif
+#ifdef NES_MAPPER_99
         &map99_intf,
+#endif
+#ifdef NES_MAPPER_231
         &map231_intf,
+#endif
         NULL};
 
 /*
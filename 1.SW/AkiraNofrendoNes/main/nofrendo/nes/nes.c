@@ -37,18 +37,38 @@
 #include "../sndhrdw/nes_apu.h"
 #include "../nes/nes_ppu.h"
 #include "../nes/nes_rom.h"
+#include "../nes/nes_prof.h"
+#include "../nes/nes_hist.h"
+#include "../nes/nes_heat.h"
+#include "../nes/nes_gamedb.h"
+#include "../nes/nes_rtrace.h"
+#include "../nes/nes_replay.h"
+#include "../nes/nes_rewind.h"
+#include "../nes/nesstate.h"
+#include "../nes/nes_arena.h"
+#ifdef NES_CHEATS
+#include "../nes/nes_cheat.h"
+#endif
 #include "vid_drv.h"
 #include "nofrendo.h"
 
-#define NES_CLOCK_DIVIDER 12
-// #define  NES_MASTER_CLOCK     21477272.727272727272
-#define NES_MASTER_CLOCK (236250000 / 11)
-#define NES_SCANLINE_CYCLES (1364.0 / NES_CLOCK_DIVIDER)
-#define NES_FIQ_PERIOD (NES_MASTER_CLOCK / NES_CLOCK_DIVIDER / 60)
+/* NTSC runs off a 21.477MHz master clock, PAL and Dendy off 26.602MHz:
+** a PPU dot is 4 or 5 master clocks, a CPU cycle 12, 16 on PAL and 15 on
+** Dendy, which has PAL's frame and NTSC's CPU and APU speed in it
+*/
+static const nes_timing_t nes_timings[] =
+{
+   /* name    CPU Hz        div  line  post vbl  IRQ    Hz  frame us */
+   { "NTSC",  APU_BASEFREQ, 12,  1364,  0,   0,  29829, 60, 16639 },
+   { "PAL",   1662607.0,    16,  1705,  0,   50, 33252, 50, 19997 },
+   { "Dendy", 1773447.5,    15,  1705,  50,  0,  29829, 50, 19997 }
+};
 
 #define NES_RAMSIZE 0x800
 
-#define NES_SKIP_LIMIT (NES_REFRESH_RATE / 5) /* 12 or 10, depending on PAL/NTSC */
+/* post-render vblank lines, where the PPU does nothing */
+#define NES_VBLANK_IDLE_FIRST 242
+#define NES_VBLANK_IDLE_LAST 260
 
 static nes_t nes;
 
@@ -245,6 +265,9 @@ static void build_address_handlers(nes_t *machine)
    machine->writehandler[num_handlers].write_func = NULL;
    num_handlers++;
    ASSERT(num_handlers <= MAX_MEM_HANDLERS);
+
+   /* and the per page lookup the CPU actually uses */
+   nes6502_buildpages(machine->cpu);
 }
 
 /* raise an IRQ */
@@ -272,7 +295,7 @@ static uint8 nes_clearfiq(void)
 void nes_setfiq(uint8 value)
 {
    nes.fiq_state = value;
-   nes.fiq_cycles = (int)NES_FIQ_PERIOD;
+   nes.fiq_cycles = nes.timing->fiq_period;
 }
 
 static void nes_checkfiq(int cycles)
@@ -280,7 +303,7 @@ static void nes_checkfiq(int cycles)
    nes.fiq_cycles -= cycles;
    if (nes.fiq_cycles <= 0)
    {
-      nes.fiq_cycles += (int)NES_FIQ_PERIOD;
+      nes.fiq_cycles += nes.timing->fiq_period;
       if (0 == (nes.fiq_state & 0xC0))
       {
          nes.fiq_occurred = true;
@@ -289,49 +312,210 @@ static void nes_checkfiq(int cycles)
    }
 }
 
+/* Run the CPU for (at least) the given number of cycles, splitting
+** the timeslice at the frame IRQ so it's raised when it is due and
+** not at the end of whatever slice it falls in.  DMC DMA fetches split
+** it the same way, so they steal their cycles and see the banks mapped
+** in when they happen.  Slices can then be as long as the caller likes;
+** the other events (NMI, mapper hblank) fall on scanline boundaries and
+** are the caller's business.
+*/
+static int nes_runcpu(int cycles)
+{
+   int elapsed = 0;
+
+   while (elapsed < cycles)
+   {
+      int slice = cycles - elapsed;
+      int32 dmc;
+      int ran;
+
+      if (0 == (nes.fiq_state & 0xC0) && nes.fiq_cycles > 0 && nes.fiq_cycles < slice)
+         slice = nes.fiq_cycles;
+
+      dmc = apu_dmcdue();
+      if (dmc <= 0)
+      {
+         apu_dmcfetch();
+         dmc = apu_dmcdue();
+      }
+      if (dmc < slice)
+         slice = dmc;
+
+      PROF_BEGIN(t0);
+      ran = nes6502_execute(slice);
+      PROF_END(PROF_CPU, t0);
+      nes_checkfiq(ran);
+      elapsed += ran;
+   }
+
+   return elapsed;
+}
+
 void nes_nmi(void)
 {
    nes6502_nmi();
 }
 
-static void nes_renderframe(bool draw_flag)
+void nes_sethblankline(int scanline)
 {
+   nes.hblank_line = scanline;
+}
+
+/* A mapper hook is either always there (1), never there (0), or looked
+** up every time (-1), for the copy of the frame loop that can't tell
+*/
+#define  NES_HOOK(has, test)  ((has) < 0 ? (test) : (has))
+
+/* ...or, for MMC_HBLANK_EVENT boards (2), only wanted on some lines */
+#define  NES_HBLANK(has)      (2 == (has) ? (nes.scanline == nes.hblank_line \
+                                             || 0 == nes.scanline || 241 == nes.scanline \
+                                             || false == ppu_enabled()) \
+                                          : NES_HOOK(has, NULL != mapintf->hblank))
+
+/* The lines a PAL or Dendy frame has on top of NTSC's, run after the one
+** they follow as far as the PPU and the mapper can tell. A scanline
+** counter only counts lines the PPU renders, and these it doesn't; any
+** other hblank hook gets each of them, with the number of the line before.
+*/
+static void nes_extralines(mapintf_t *mapintf, int lines, int in_vblank)
+{
+   const nes_timing_t *timing = nes.timing;
    int elapsed_cycles;
-   mapintf_t *mapintf = nes.mmc->intf;
-   int in_vblank = 0;
 
-   while (262 != nes.scanline)
+   if (NULL == mapintf->hblank || (mapintf->flags & (MMC_HBLANK_RENDER | MMC_HBLANK_EVENT)))
    {
-      //      ppu_scanline(nes.vidbuf, nes.scanline, draw_flag);
-      ppu_scanline(vid_getbuffer(), nes.scanline, draw_flag);
-
-      if (241 == nes.scanline)
-      {
-         /* 7-9 cycle delay between when VINT flag goes up and NMI is taken */
-         elapsed_cycles = nes6502_execute(7);
-         nes.scanline_cycles -= elapsed_cycles;
-         nes_checkfiq(elapsed_cycles);
-
-         ppu_checknmi();
+      nes.scanline_clocks += timing->scanline_clocks * lines;
+      elapsed_cycles = nes_runcpu(nes.scanline_clocks / timing->cpu_divider);
+      nes.scanline_clocks -= elapsed_cycles * timing->cpu_divider;
+      return;
+   }
 
-         if (mapintf->vblank)
-            mapintf->vblank();
-         in_vblank = 1;
-      }
+   while (lines--)
+   {
+      PROF_BEGIN(t1);
+      mapintf->hblank(in_vblank);
+      PROF_END(PROF_MAPPER, t1);
+      nes.scanline_clocks += timing->scanline_clocks;
+      elapsed_cycles = nes_runcpu(nes.scanline_clocks / timing->cpu_divider);
+      nes.scanline_clocks -= elapsed_cycles * timing->cpu_divider;
+   }
+}
 
-      if (mapintf->hblank)
-         mapintf->hblank(in_vblank);
+/* the cheats' RAM freezes go in before every frame */
+#ifdef NES_CHEATS
+#define  NES_CHEATFRAME()   cheat_frame()
+#else
+#define  NES_CHEATFRAME()
+#endif
+
+/* the bank heat map samples after every scanline's CPU run */
+#ifdef NES_HEATMAP
+#define  NES_HEATLINE()     heat_line()
+#else
+#define  NES_HEATLINE()
+#endif
+
+/* The frame loop, made once per kind of mapper: in the copies for the
+** simple ones the hook tests fold away, so NROM/UxROM/CNROM and the
+** scanline IRQ boards don't check for vblank and hblank callbacks they
+** haven't got every scanline.  nes_insertcart picks the copy.
+*/
+#define  NES_MAKE_RENDERFRAME(name, HBLANK, VBLANK, IDLESKIP)                            \
+   static void name(bool draw_flag)                                                      \
+   {                                                                                     \
+      int elapsed_cycles;                                                                \
+      mapintf_t *mapintf = nes.mmc->intf;                                                \
+      const nes_timing_t *timing = nes.timing;                                           \
+      int in_vblank = 0;                                                                 \
+                                                                                         \
+      NES_CHEATFRAME();                                                                  \
+      while (262 != nes.scanline)                                                        \
+      {                                                                                  \
+         /* nothing to do between the idle vblank lines unless the mapper                \
+         ** counts them, so run them in one go                                           \
+         */                                                                              \
+         if (NES_VBLANK_IDLE_FIRST == nes.scanline && NES_HOOK(IDLESKIP,                 \
+             NULL == mapintf->hblank || (mapintf->flags & MMC_HBLANK_RENDER)))           \
+         {                                                                               \
+            nes.scanline_clocks += timing->scanline_clocks * (timing->vblank_extra      \
+                                   + NES_VBLANK_IDLE_LAST - NES_VBLANK_IDLE_FIRST + 1); \
+            elapsed_cycles = nes_runcpu(nes.scanline_clocks / timing->cpu_divider);      \
+            nes.scanline_clocks -= elapsed_cycles * timing->cpu_divider;                 \
+            nes.scanline = NES_VBLANK_IDLE_LAST + 1;                                     \
+            NES_HEATLINE();                                                              \
+         }                                                                               \
+                                                                                         \
+         PROF_BEGIN(t0);                                                                 \
+         ppu_scanline(vid_getbuffer(), nes.scanline, draw_flag);                         \
+         PROF_END(PROF_PPU, t0);                                                         \
+         if (draw_flag && nes.scanline < NES_SCREEN_HEIGHT)                              \
+            vid_linedone(nes.scanline);                                                  \
+                                                                                         \
+         if (241 == nes.scanline)                                                        \
+         {                                                                               \
+            /* 7-9 cycle delay between when VINT flag goes up and NMI is taken */        \
+            elapsed_cycles = nes_runcpu(7);                                              \
+            nes.scanline_clocks -= elapsed_cycles * timing->cpu_divider;                 \
+                                                                                         \
+            ppu_checknmi();                                                              \
+                                                                                         \
+            if (NES_HOOK(VBLANK, NULL != mapintf->vblank))                               \
+            {                                                                            \
+               PROF_BEGIN(t1);                                                           \
+               mapintf->vblank();                                                        \
+               PROF_END(PROF_MAPPER, t1);                                                \
+            }                                                                            \
+            in_vblank = 1;                                                               \
+         }                                                                               \
+                                                                                         \
+         if (NES_HBLANK(HBLANK))                                                         \
+         {                                                                               \
+            PROF_BEGIN(t1);                                                              \
+            mapintf->hblank(in_vblank);                                                  \
+            PROF_END(PROF_MAPPER, t1);                                                   \
+         }                                                                               \
+                                                                                         \
+         nes.scanline_clocks += timing->scanline_clocks;                                 \
+         elapsed_cycles = nes_runcpu(nes.scanline_clocks / timing->cpu_divider);         \
+         nes.scanline_clocks -= elapsed_cycles * timing->cpu_divider;                    \
+         NES_HEATLINE();                                                                 \
+                                                                                         \
+         PROF_BEGIN(t2);                                                                 \
+         ppu_endscanline(nes.scanline);                                                  \
+         PROF_END(PROF_PPU, t2);                                                         \
+                                                                                         \
+         if (NES_SCREEN_HEIGHT == nes.scanline && timing->postrender_extra)              \
+            nes_extralines(mapintf, timing->postrender_extra, 0);                        \
+         else if (NES_VBLANK_IDLE_LAST == nes.scanline && timing->vblank_extra)          \
+            nes_extralines(mapintf, timing->vblank_extra, 1);                            \
+         nes.scanline++;                                                                 \
+      }                                                                                  \
+                                                                                         \
+      nes.scanline = 0;                                                                  \
+   }
 
-      nes.scanline_cycles += (float)NES_SCANLINE_CYCLES;
-      elapsed_cycles = nes6502_execute((int)nes.scanline_cycles);
-      nes.scanline_cycles -= (float)elapsed_cycles;
-      nes_checkfiq(elapsed_cycles);
+/* no hooks: NROM, UxROM, CNROM and the like */
+NES_MAKE_RENDERFRAME(nes_renderframe_plain, 0, 0, 1)
+/* an hblank hook that sleeps through vblank: scanline counters */
+NES_MAKE_RENDERFRAME(nes_renderframe_irq, 1, 0, 1)
+/* one that says which line it wants next: MMC3 */
+NES_MAKE_RENDERFRAME(nes_renderframe_event, 2, 0, 1)
+/* anything else: MMC5, the vblank counters, ... */
+NES_MAKE_RENDERFRAME(nes_renderframe_any, -1, -1, -1)
 
-      ppu_endscanline(nes.scanline);
-      nes.scanline++;
-   }
+static void (*nes_renderframe)(bool draw_flag) = nes_renderframe_any;
 
-   nes.scanline = 0;
+static void nes_pickframeloop(mapintf_t *intf)
+{
+   if (NULL == intf->hblank && NULL == intf->vblank)
+      nes_renderframe = nes_renderframe_plain;
+   else if (NULL == intf->vblank && (intf->flags & MMC_HBLANK_EVENT))
+      nes_renderframe = nes_renderframe_event;
+   else if (NULL == intf->vblank && (intf->flags & MMC_HBLANK_RENDER))
+      nes_renderframe = nes_renderframe_irq;
+   else
+      nes_renderframe = nes_renderframe_any;
 }
 
 static void system_video(bool draw)
@@ -357,56 +541,396 @@ static void system_video(bool draw)
    osd_getinput();
 }
 
+/* Frame skip controller. Keeps running averages of what a drawn and a
+** skipped frame cost (emulation plus handing the frame to the display, so
+** a blit that holds up the next buffer counts too), and how far we are
+** behind the frame clock. A frame is skipped when drawing it is predicted
+** to push us over, before we are a whole frame late.
+*/
+#define FRAME_PERIOD_US (nes.timing->frame_us)
+
+static struct
+{
+   int draw_us, skip_us;   /* running averages, 1/8 weight */
+   int debt_us;            /* time over budget so far */
+   int since_skip;         /* frames drawn since the last skipped one */
+} fskip;
+
+static void fskip_account(bool drawn, int us)
+{
+   if (drawn)
+   {
+      fskip.draw_us += (us - fskip.draw_us) / 8;
+      fskip.since_skip++;
+   }
+   else
+   {
+      fskip.skip_us += (us - fskip.skip_us) / 8;
+      fskip.since_skip = 0;
+   }
+
+   fskip.debt_us += us - FRAME_PERIOD_US;
+   if (fskip.debt_us < 0)
+      fskip.debt_us = 0;
+   else if (fskip.debt_us > 4 * FRAME_PERIOD_US)
+      fskip.debt_us = 4 * FRAME_PERIOD_US; /* too far gone, just run slow */
+}
+
+/* should the frame that is due now be drawn? */
+static bool fskip_draw(int frames_due)
+{
+   bool skip;
+
+   /* frameskip_cap of n: at most one frame in n is skipped */
+   if (nes.frameskip_cap < 2 || fskip.since_skip < nes.frameskip_cap - 1)
+      return true;
+
+   if (frames_due > 1)
+      skip = true;
+   else
+      skip = (fskip.debt_us + fskip.draw_us > FRAME_PERIOD_US);
+
+   return (false == skip);
+}
+
+void nes_setframeskipcap(int cap)
+{
+   nes.frameskip_cap = cap;
+}
+
+void nes_setpaced(bool paced)
+{
+   nes.autoframeskip = paced;
+}
+
+uint32 nes_ramhash(void)
+{
+   return replay_hashbuf(nes.cpu->mem_page[0], NES_RAMSIZE);
+}
+
+#ifdef NES_RUNAHEAD
+/* Run-ahead: the frame the game is really on runs unseen and makes the
+** sound, then a snapshot is taken and nes.runahead more frames are run
+** on the same input, and the last of those is what gets shown.  Going
+** back to the snapshot after that hides as many frames of the game's
+** own input lag.  The frames run ahead take the skip path and only the
+** last one is drawn, so the cost is about that of one skipped frame
+** each, plus the snapshot both ways.  Expansion sound chips keep what
+** the ahead frames did to them.
+*/
+#define NES_RUNAHEAD_MAX 2
+
+static struct
+{
+   uint8 *buf;
+   int size;
+   /* what it costs */
+   int frames;
+   uint32 total_us, max_us;
+} runahead;
+
+void nes_setrunahead(int frames)
+{
+   if (frames < 0)
+      frames = 0;
+   else if (frames > NES_RUNAHEAD_MAX)
+      frames = NES_RUNAHEAD_MAX;
+   nes.runahead = frames;
+}
+
+static bool runahead_frame(bool draw)
+{
+   uint32 start;
+   int i, us;
+
+   if (NULL == runahead.buf)
+   {
+      runahead.size = state_snapshotsize();
+      runahead.buf = arena_alloc(ARENA_BULK, runahead.size);
+      if (NULL == runahead.buf)
+      {
+         log_printf(LOG_WARN "Run-ahead: no room for a %d byte snapshot\n", runahead.size);
+         nes.runahead = 0;
+         return false;
+      }
+   }
+
+   nes_renderframe(false);
+   osd_endframe();
+
+   start = osd_getmicros();
+   state_snapshot(runahead.buf, runahead.size);
+   apu_mark();
+   for (i = 1; i <= nes.runahead; i++)
+      nes_renderframe(draw && i == nes.runahead);
+   state_restore(runahead.buf, runahead.size);
+   arena_traffic(ARENA_BULK, 2 * runahead.size);
+   apu_rollback();
+
+   us = (int)(osd_getmicros() - start);
+   runahead.frames++;
+   runahead.total_us += us;
+   if ((uint32)us > runahead.max_us)
+      runahead.max_us = us;
+   return true;
+}
+
+static void runahead_free(void)
+{
+   if (runahead.frames)
+      printf("Run-ahead: %d frames ahead, %d us a frame on top, %d at most\n",
+             nes.runahead, (int)(runahead.total_us / runahead.frames), (int)runahead.max_us);
+   arena_free(runahead.buf);
+   memset(&runahead, 0, sizeof(runahead));
+}
+
+/* Frames to run ahead, for a game whose profile says it reads the pad
+** late enough for run-ahead to help.  NES_RUNAHEAD_ALL runs everything
+** NES_RUNAHEAD frames ahead, to measure a new title.
+*/
+static int nes_runaheadframes(const gamedb_t *profile)
+{
+#ifdef NES_RUNAHEAD_ALL
+   return NES_RUNAHEAD;
+#else  /* !NES_RUNAHEAD_ALL */
+   return NULL != profile ? profile->runahead : 0;
+#endif /* !NES_RUNAHEAD_ALL */
+}
+#endif /* NES_RUNAHEAD */
+
+#ifdef NES_FASTFORWARD
+/* Fast-forward: while the button is held frames are run back to back,
+** without waiting for the frame clock, and only one in NES_FASTFORWARD
+** is drawn, the others take the skip path.  Every frame still makes its
+** sound, which keeps the APU in step; what the OSD plays of it is up to
+** osd_fastforward.  How many times real time that comes to is printed
+** every second and when the button is let go, which makes it a handy
+** throughput figure too.
+*/
+static struct
+{
+   int frames;          /* emulated since fast-forward went on */
+   uint32 start_us;
+   int report_frames;   /* the same, since the last report */
+   uint32 report_us;
+} fastfwd;
+
+void nes_fastforward(bool held)
+{
+   nes.fastforward = held;
+}
+
+static void fastfwd_report(const char *prefix, int frames, uint32 us)
+{
+   /* real time is the TV system's frames a second, in hundredths */
+   int speed = us ? (int)((uint64_t)frames * 100000000 / nes.timing->refresh_rate / us) : 0;
+
+   log_printf("%s%d.%02dx real time, %d frames in %d ms\n", prefix,
+              speed / 100, speed % 100, frames, (int)(us / 1000));
+}
+
+/* fast-forward going on or off, from the main loop */
+static void fastfwd_switch(bool on)
+{
+   uint32 now = osd_getmicros();
+
+   if (on)
+   {
+      memset(&fastfwd, 0, sizeof(fastfwd));
+      fastfwd.start_us = fastfwd.report_us = now;
+   }
+   else if (fastfwd.frames)
+      fastfwd_report("Fast-forward: ", fastfwd.frames, now - fastfwd.start_us);
+   osd_fastforward(on);
+}
+
+static void fastfwd_frame(void)
+{
+   bool draw = (0 == fastfwd.frames % NES_FASTFORWARD);
+   uint32 now;
+
+   nes_renderframe(draw);
+   osd_endframe();
+   system_video(draw);
+   rewind_frame();
+#ifdef NES_HISTOGRAM
+   hist_frame();
+#endif
+#ifdef NES_HEATMAP
+   heat_frame();
+#endif
+#ifdef NES_RENDERTRACE
+   rtrace_frame();
+#endif
+
+   fastfwd.frames++;
+   fastfwd.report_frames++;
+   now = osd_getmicros();
+   if (now - fastfwd.report_us >= 1000000)
+   {
+      fastfwd_report("Fast-forward ", fastfwd.report_frames, now - fastfwd.report_us);
+      fastfwd.report_frames = 0;
+      fastfwd.report_us = now;
+   }
+}
+#endif /* NES_FASTFORWARD */
+
+/* one emulated frame and its sound */
+static void nes_runframe(bool draw)
+{
+#ifdef NES_HISTOGRAM
+   /* run-ahead's extra frames count into the CPU's side, not as frames */
+   hist_frame();
+#endif
+#ifdef NES_HEATMAP
+   heat_frame();
+#endif
+#ifdef NES_RENDERTRACE
+   rtrace_frame();
+#endif
+#ifdef NES_RUNAHEAD
+   if (nes.runahead > 0 && runahead_frame(draw))
+      return;
+#endif
+   nes_renderframe(draw);
+   osd_endframe();
+}
+
+/* Pausing puts up the last frame once more, at half brightness, and stops
+** the sound output; after that nothing goes to the screen or the APU.
+** A freeze only stops them.
+*/
+static void nes_pausescreen(bool pause)
+{
+   nes.paused = pause;
+   ppu_dimpal(nes.ppu, pause && false == nes.freeze);
+   if (pause && false == nes.freeze)
+   {
+      vid_copyshown();
+      /* whatever the buffer's lines were drawn from, they're the shown frame's now */
+      ppu_invalidatelines();
+      system_video(true);
+   }
+   osd_pause(pause);
+}
+
 /* main emulation loop */
 void nes_emulate(void)
 {
    int last_ticks, frames_to_render;
+   uint32 frame_start;
+   bool fastforwarding = false; /* what fastfwd_switch was last told */
 
    osd_setsound(nes.apu->process);
 
    last_ticks = nofrendo_ticks;
    frames_to_render = 0;
-   nes.scanline_cycles = 0;
-   nes.fiq_cycles = (int)NES_FIQ_PERIOD;
+   nes.scanline_clocks = 0;
+   nes.fiq_cycles = nes.timing->fiq_period;
 
    while (false == nes.poweroff)
    {
+#ifdef NES_FASTFORWARD
+      if (nes.fastforward != fastforwarding && (false == nes.pause || false == nes.fastforward))
+      {
+         fastforwarding = nes.fastforward;
+         fastfwd_switch(fastforwarding);
+      }
+#endif
+
+      /* nothing due yet: sleep instead of spinning on nofrendo_ticks */
+      if (nofrendo_ticks == last_ticks && 0 == frames_to_render
+          && (true == nes.autoframeskip || true == nes.pause || true == nes.freeze) && false == fastforwarding)
+         osd_waitframe();
+
       if (nofrendo_ticks != last_ticks)
       {
          int tick_diff = nofrendo_ticks - last_ticks;
 
          frames_to_render += tick_diff;
          gui_tick(tick_diff);
+         rom_checksram(nes.rominfo);
          last_ticks = nofrendo_ticks;
       }
 
-      if (true == nes.pause)
+      if ((nes.pause || nes.freeze) != nes.paused)
+         nes_pausescreen(nes.pause || nes.freeze);
+
+      if (true == nes.paused)
       {
-         /* TODO: dim the screen, and pause/silence the apu */
-         system_video(true);
+         /* the dimmed or frozen frame is up, only input is looked at till unpaused */
+         osd_getinput();
+         frames_to_render = 0;
+      }
+#ifdef NES_FASTFORWARD
+      else if (true == fastforwarding)
+      {
+         /* the clock's ticks are not owed once it's let go */
          frames_to_render = 0;
+         frame_start = osd_getmicros();
+         fastfwd_frame();
+#ifdef NES_PROFILE
+         prof_frame((int)(osd_getmicros() - frame_start));
+#endif
       }
-      else if (frames_to_render > 1)
+#endif
+      else if (true == nes.autoframeskip && frames_to_render > 0)
       {
+         bool draw = fskip_draw(frames_to_render);
+
+         /* more than the controller is allowed to catch up: drop the backlog */
+         if (frames_to_render > nes.frameskip_cap)
+            frames_to_render = 1;
+
+         frame_start = osd_getmicros();
          frames_to_render--;
-         nes_renderframe(false);
-         system_video(false);
+         nes_runframe(draw);
+         system_video(draw);
+         rewind_frame();
+         fskip_account(draw, (int)(osd_getmicros() - frame_start));
+#ifdef NES_PROFILE
+         prof_frame((int)(osd_getmicros() - frame_start));
+#endif
       }
-      else if ((1 == frames_to_render && true == nes.autoframeskip) || false == nes.autoframeskip)
+      else if (false == nes.autoframeskip)
       {
          frames_to_render = 0;
-         nes_renderframe(true);
+         frame_start = osd_getmicros();
+         nes_runframe(true);
          system_video(true);
+         rewind_frame();
+#ifdef NES_PROFILE
+         prof_frame((int)(osd_getmicros() - frame_start));
+#endif
       }
    }
+
+#ifdef NES_FASTFORWARD
+   if (true == fastforwarding)
+      fastfwd_switch(false);
+#endif
+   /* left while paused: the next game gets its sound back */
+   if (true == nes.paused)
+      nes_pausescreen(false);
 }
 
-static void mem_trash(uint8 *buffer, int length)
+/* a word of xorshift32 at a time, rather than rand() a byte: newlib's
+** is a 64-bit multiply through the reentrancy struct, 8k times over VRAM
+*/
+void nes_memtrash(uint8 *buffer, int length)
 {
+   static uint32 state = 0x2545F491;
+   uint32 word;
    int i;
 
-   for (i = 0; i < length; i++)
-      buffer[i] = (uint8)rand();
+   for (i = 0; i < length; i += 4)
+   {
+      state ^= state << 13;
+      state ^= state >> 17;
+      state ^= state << 5;
+      word = state;
+      memcpy(buffer + i, &word, (length - i < 4) ? length - i : 4);
+   }
 }
 
 /* Reset NES hardware */
@@ -416,7 +940,7 @@ void nes_reset(int reset_type)
    {
       memset(nes.cpu->mem_page[0], 0, NES_RAMSIZE);
       if (nes.rominfo->vram)
-         mem_trash(nes.rominfo->vram, 0x2000 * nes.rominfo->vram_banks);
+         nes_memtrash(nes.rominfo->vram, 0x2000 * nes.rominfo->vram_banks);
    }
 
    apu_reset();
@@ -434,6 +958,16 @@ void nes_destroy(nes_t **machine)
 {
    if (*machine)
    {
+#ifdef NES_HISTOGRAM
+      hist_report();
+#endif
+#ifdef NES_HEATMAP
+      heat_report();
+#endif
+      rewind_free();
+#ifdef NES_RUNAHEAD
+      runahead_free();
+#endif
       rom_free(&(*machine)->rominfo);
       mmc_destroy(&(*machine)->mmc);
       ppu_destroy(&(*machine)->ppu);
@@ -442,13 +976,14 @@ void nes_destroy(nes_t **machine)
       if ((*machine)->cpu)
       {
          if ((*machine)->cpu->mem_page[0])
-            free((*machine)->cpu->mem_page[0]);
-         free((*machine)->cpu);
+            arena_free((*machine)->cpu->mem_page[0]);
+         arena_free((*machine)->cpu);
       }
 
-      free(*machine);
+      arena_free(*machine);
       *machine = NULL;
    }
+   arena_destroy();
 }
 
 void nes_poweroff(void)
@@ -461,15 +996,59 @@ void nes_togglepause(void)
    nes.pause ^= true;
 }
 
+void nes_setfreeze(bool freeze)
+{
+   nes.freeze = freeze;
+}
+
 /* insert a cart into the NES */
+/* Whether the game's vblank/NMI wait loops are safe to skip, as its
+** profile says.  Building with NES_IDLESKIP_ALL turns it on for
+** everything, which is handy for trying a new title.
+*/
+static bool nes_idleskip(const gamedb_t *profile)
+{
+#ifdef NES_IDLESKIP_ALL
+   return true;
+#else  /* !NES_IDLESKIP_ALL */
+   return NULL != profile && (profile->flags & GAMEDB_IDLESKIP);
+#endif /* !NES_IDLESKIP_ALL */
+}
+
+/* the cart's TV system, and the APU clocked and paced to match */
+static void nes_settiming(nes_t *machine)
+{
+   apu_t *apu = machine->apu;
+
+   machine->timing = &nes_timings[machine->rominfo->region];
+   if (machine->timing != &nes_timings[REGION_NTSC])
+      log_printf("%s timing\n", machine->timing->name);
+
+   apu_setcontext(apu);
+   apu_setparams(machine->timing->cpu_clock, apu->sample_rate,
+                 machine->timing->refresh_rate, apu->sample_bits);
+   apu_setpalperiods(machine->timing == &nes_timings[REGION_PAL]);
+   apu_getcontext(apu);
+
+   /* PAL and Dendy PPUs have red and green emphasis the other way round */
+   ppu_setemphasisswap(machine->timing != &nes_timings[REGION_NTSC]);
+}
+
 int nes_insertcart(const char *filename, nes_t *machine)
 {
+   const gamedb_t *profile;
+
    nes6502_setcontext(machine->cpu);
 
    /* rom file */
    machine->rominfo = rom_load(filename);
    if (NULL == machine->rominfo)
       goto _fail;
+   prof_startstage(STARTUP_ROM);
+#ifdef NES_CHEATS
+   /* before the mapper maps anything, so the first banks come patched */
+   cheat_load(machine->rominfo->crc);
+#endif
 
    /* map cart's SRAM to CPU $6000-$7FFF */
    if (machine->rominfo->sram)
@@ -478,7 +1057,8 @@ int nes_insertcart(const char *filename, nes_t *machine)
       machine->cpu->mem_page[7] = machine->rominfo->sram + 0x1000;
    }
 
-   /* mapper */
+   /* mapper, which registers its state regions when it and its sound chip start */
+   state_clearregions();
    machine->mmc = mmc_create(machine->rominfo);
    if (NULL == machine->mmc)
       goto _fail;
@@ -487,13 +1067,40 @@ int nes_insertcart(const char *filename, nes_t *machine)
    if (NULL != machine->rominfo->vram)
       machine->ppu->vram_present = true;
 
+   /* before the sound chip's init, which takes the APU's clock */
+   nes_settiming(machine);
    apu_setext(machine->apu, machine->mmc->intf->sound_ext);
+   nes_pickframeloop(machine->mmc->intf);
 
    build_address_handlers(machine);
 
+   /* the game's profile, for what the build leaves to it */
+   profile = gamedb_find(machine->rominfo->crc);
+   if (profile)
+      log_printf("Profile: flags %02X, skip cap %d, run-ahead %d, %d MHz\n", profile->flags,
+                 profile->skip_cap, profile->runahead, profile->clock * 8);
+   machine->cpu->idle_skip = nes_idleskip(profile);
+   if (machine->cpu->idle_skip)
+      log_printf("Idle loop skipping enabled\n");
+#ifdef NES_RUNAHEAD
+   machine->runahead = nes_runaheadframes(profile);
+   if (machine->runahead)
+      printf("Run-ahead: %d frames\n", machine->runahead);
+#endif
+   machine->frameskip_cap = (profile && profile->skip_cap) ? profile->skip_cap : NES_FRAMESKIP_CAP;
+   osd_setminclock(profile ? profile->clock * 8 : 0);
+
    nes_setcontext(machine);
+   prof_startstage(STARTUP_MAPPER);
 
    nes_reset(HARD_RESET);
+   prof_startstage(STARTUP_RESET);
+#ifdef NES_HISTOGRAM
+   hist_start();
+#endif
+#ifdef NES_HEATMAP
+   heat_start();
+#endif
    return 0;
 
 _fail:
@@ -508,11 +1115,13 @@ nes_t *nes_create(void)
    sndinfo_t osd_sound;
    int i;
 
-   machine = malloc(sizeof(nes_t));
+   arena_create();
+   machine = arena_alloc(ARENA_FAST, sizeof(nes_t));
    if (NULL == machine)
+   {
+      arena_destroy();
       return NULL;
-
-   memset(machine, 0, sizeof(nes_t));
+   }
 
    /* bitmap */
    /* 8 pixel overdraw */
@@ -520,17 +1129,17 @@ nes_t *nes_create(void)
    //   if (NULL == machine->vidbuf)
    //      goto _fail;
 
+   machine->timing = &nes_timings[REGION_NTSC];
    machine->autoframeskip = true;
+   machine->frameskip_cap = NES_FRAMESKIP_CAP;
 
    /* cpu */
-   machine->cpu = malloc(sizeof(nes6502_context));
+   machine->cpu = arena_alloc(ARENA_FAST, sizeof(nes6502_context));
    if (NULL == machine->cpu)
       goto _fail;
 
-   memset(machine->cpu, 0, sizeof(nes6502_context));
-
    /* allocate 2kB RAM */
-   machine->cpu->mem_page[0] = malloc(NES_RAMSIZE);
+   machine->cpu->mem_page[0] = arena_alloc(ARENA_FAST, NES_RAMSIZE);
    if (NULL == machine->cpu->mem_page[0])
       goto _fail;
 
@@ -540,10 +1149,12 @@ nes_t *nes_create(void)
 
    machine->cpu->read_handler = machine->readhandler;
    machine->cpu->write_handler = machine->writehandler;
+   machine->cpu->read_page = machine->readpage;
+   machine->cpu->write_page = machine->writepage;
 
    /* apu */
    osd_getsoundinfo(&osd_sound);
-   machine->apu = apu_create(0, osd_sound.sample_rate, NES_REFRESH_RATE, osd_sound.bps);
+   machine->apu = apu_create(0, osd_sound.sample_rate, machine->timing->refresh_rate, osd_sound.bps);
 
    if (NULL == machine->apu)
       goto _fail;
@@ -559,6 +1170,8 @@ nes_t *nes_create(void)
 
    machine->poweroff = false;
    machine->pause = false;
+   machine->paused = false;
+   machine->freeze = false;
 
    return machine;
 
@@ -44,52 +44,90 @@
 #define NES_SCREEN_WIDTH 256
 #define NES_SCREEN_HEIGHT 240
 
-/* NTSC = 60Hz, PAL = 50Hz */
-#ifdef PAL
-#define NES_REFRESH_RATE 50
-#else                       /* !PAL */
-#define NES_REFRESH_RATE 50 // 60
-#endif                      /* !PAL */
+/* NTSC = 60Hz, PAL and Dendy = 50Hz: the rate of the game in, see
+** nes_timing_t. This is NTSC's, for what only wants to know roughly how
+** long a second is; anything holding a frame of something is sized for
+** NES_REFRESH_MIN.
+*/
+#define NES_REFRESH_RATE 60
+#define NES_REFRESH_MIN 50
 
 #define MAX_MEM_HANDLERS 32
 
+/* auto frameskip drops at most one frame in this many */
+#define NES_FRAMESKIP_CAP 3
+
 enum
 {
    SOFT_RESET,
    HARD_RESET
 };
 
+/* A TV system's frame: a PAL or Dendy one is NTSC's 262 lines with 50
+** more put in, in vblank on PAL and before it on Dendy, and every line
+** is 341 dots whatever the clocks. The lines are numbered as on NTSC,
+** so the PPU and the mappers see the same 0-261; the extra ones run after
+** line 240 or 260, which they are told again.
+*/
+typedef struct nes_timing_s
+{
+   const char *name;
+   double cpu_clock;       /* Hz, also the APU's */
+   int cpu_divider;        /* master clocks in a CPU cycle */
+   int scanline_clocks;    /* master clocks in a line */
+   int postrender_extra;   /* idle lines put in after line 240 */
+   int vblank_extra;       /* vblank lines put in after line 260 */
+   int fiq_period;         /* CPU cycles between frame IRQs */
+   int refresh_rate;       /* frames a second, rounded */
+   int frame_us;           /* a frame, exactly */
+} nes_timing_t;
+
 typedef struct nes_s
 {
    /* hardware things */
    nes6502_context *cpu;
-   nes6502_memread readhandler[MAX_MEM_HANDLERS];
-   nes6502_memwrite writehandler[MAX_MEM_HANDLERS];
-
    ppu_t *ppu;
    apu_t *apu;
    mmc_t *mmc;
    rominfo_t *rominfo;
 
-   /* video buffer */
-   /* For the ESP32, it costs too much memory to render to a separate buffer and blit that to the main buffer.
-      Instead, the code has been modified to directly grab the primary buffer from the video subsystem and render
-      there, saving us about 64K of memory. */
-   //   bitmap_t *vidbuf;
+   /* the frame loop's, every scanline, so ahead of the 2KB of tables */
+   int scanline;
+   int hblank_line;     /* next line an MMC_HBLANK_EVENT mapper wants, -1 none */
+   int32 scanline_clocks; /* master clocks owed to the CPU */
+   const nes_timing_t *timing; /* the cart's TV system */
 
    bool fiq_occurred;
    uint8 fiq_state;
    int fiq_cycles;
 
-   int scanline;
+   /* the CPU context points at these */
+   nes6502_memread readhandler[MAX_MEM_HANDLERS];
+   nes6502_memwrite writehandler[MAX_MEM_HANDLERS];
+   nes6502_readfunc readpage[NES6502_DISPATCH_PAGES];
+   nes6502_writefunc writepage[NES6502_DISPATCH_PAGES];
+
+   /* video buffer */
+   /* For the ESP32, it costs too much memory to render to a separate buffer and blit that to the main buffer.
+      Instead, the code has been modified to directly grab the primary buffer from the video subsystem and render
+      there, saving us about 64K of memory. */
+   //   bitmap_t *vidbuf;
 
    /* Timing stuff */
-   float scanline_cycles;
    bool autoframeskip;
+   int frameskip_cap;   /* skip at most one frame in this many */
+#ifdef NES_RUNAHEAD
+   int runahead;        /* frames emulated past the one shown, 0 is off */
+#endif
+#ifdef NES_FASTFORWARD
+   bool fastforward;    /* unpaced, one frame in NES_FASTFORWARD drawn */
+#endif
 
    /* control */
    bool poweroff;
    bool pause;
+   bool paused;         /* the pause screen is up, emulation has stopped */
+   bool freeze;         /* stopped as for pause, the frame left as it is */
 
 } nes_t;
 
@@ -106,15 +144,34 @@ extern nes_t *nes_create(void);
 extern void nes_destroy(nes_t **machine);
 extern int nes_insertcart(const char *filename, nes_t *machine);
 
+extern void nes_setframeskipcap(int cap);
+/* false: every frame drawn, back to back, as fast as they go */
+extern void nes_setpaced(bool paced);
+/* hash of the CPU RAM, to check two machines fed the same input still agree */
+extern uint32 nes_ramhash(void);
+#ifdef NES_RUNAHEAD
+extern void nes_setrunahead(int frames);
+#endif
+#ifdef NES_FASTFORWARD
+/* fast-forward button */
+extern void nes_fastforward(bool held);
+#endif
 extern void nes_setfiq(uint8 state);
 extern void nes_nmi(void);
 extern void nes_irq(void);
+extern void nes_sethblankline(int scanline);
 extern void nes_emulate(void);
 
 extern void nes_reset(int reset_type);
+/* memory as it powers up: noise, not the same each time */
+extern void nes_memtrash(uint8 *buffer, int length);
 
 extern void nes_poweroff(void);
 extern void nes_togglepause(void);
+/* stop, and start again, as a pause does but without the pause screen:
+** the last frame stays up for the front end to draw an overlay on
+*/
+extern void nes_setfreeze(bool freeze);
 
 #endif /* _NES_H_ */
 
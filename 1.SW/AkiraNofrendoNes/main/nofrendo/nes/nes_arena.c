@@ -0,0 +1,180 @@
+/*
+** Nofrendo (c) 1998-2000 Matthew Conte (matt@conte.com)
+**
+**
+** This program is free software; you can redistribute it and/or
+** modify it under the terms of version 2 of the GNU Library General 
+** Public License as published by the Free Software Foundation.
+**
+** This program is distributed in the hope that it will be useful, 
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU 
+** Library General Public License for more details.  To obtain a 
+** copy of the GNU Library General Public License, write to the Free 
+** Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+**
+** Any permitted reproduction of these routines, in whole or in part,
+** must bear this legend.
+**
+**
+** nes_arena.c
+**
+** Per-machine memory arena
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <noftypes.h>
+#include <log.h>
+#include <nes6502.h>
+#include <nes_apu.h>
+#include <nes.h>
+#include <nes_ppu.h>
+#include <nes_mmc.h>
+#include <nes_rom.h>
+#include <nes_rewind.h>
+#include <nes_arena.h>
+
+/* The machine, its RAM, caches, VRAM and SRAM are carved one after the
+** other out of regions reserved when the machine is made, and all go
+** back in one go at eject, so a game doesn't leave the heap more broken
+** up than it found it.  A region is sized for the worst cart the build
+** supports; what doesn't fit comes from the heap, and shows up in the
+** report, which says how big the regions should have been.
+*/
+extern void *osd_arenareserve(int region, int size);
+extern void osd_arenarelease(int region, void *block);
+
+#ifndef NES_PRGCACHE
+#define  NES_PRGCACHE   0
+#endif
+#ifndef NES_CHRCACHE
+#define  NES_CHRCACHE   0
+#endif
+
+/* a snapshot of an 8KB VRAM, 8KB SRAM game, nesstate.c's state_t and room */
+#define  ARENA_SNAPSHOT (sizeof(nes6502_context) + sizeof(ppu_t) + sizeof(apu_t) \
+                         + 0x800 + 0x200 + 0x2000 + 0x2000)
+
+#ifdef NES_REWIND
+#define  ARENA_REWIND   (NES_REWIND_KB * 1024 + 2 * ARENA_SNAPSHOT)
+#else
+#define  ARENA_REWIND   0
+#endif
+#ifdef NES_RUNAHEAD
+#define  ARENA_RUNAHEAD ARENA_SNAPSHOT
+#else
+#define  ARENA_RUNAHEAD 0
+#endif
+
+static const char *region_name[ARENA_REGIONS] = { "fast", "bulk" };
+
+static struct
+{
+   uint8 *base;
+   int size, used;
+   int peak;                  /* most used by any game so far */
+   int heap_blocks, heap_bytes;
+} arena[ARENA_REGIONS];
+
+/* kept across games: PSRAM traffic is watched over the whole session */
+static uint32 arena_moved[ARENA_REGIONS];
+
+/* the machine and chip contexts, 2KB RAM, both caches, VRAM, 8KB of
+** SRAM and its copy, and the PRG bank counters of a 4MB game
+*/
+static int arena_fastsize(void)
+{
+   return sizeof(nes_t) + sizeof(nes6502_context) + 0x800 + sizeof(ppu_t)
+          + sizeof(apu_t) + sizeof(mmc_t) + sizeof(rominfo_t)
+          + NES_PRGCACHE * 0x2000 + NES_CHRCACHE * 0x400
+          + 0x2000 + 2 * 0x2000 + 512 * sizeof(uint16)
+          + 16 * 4;                /* alignment */
+}
+
+void arena_create(void)
+{
+   int size[ARENA_REGIONS];
+   int i;
+
+   size[ARENA_FAST] = arena_fastsize();
+   size[ARENA_BULK] = ARENA_REWIND + ARENA_RUNAHEAD;
+
+   for (i = 0; i < ARENA_REGIONS; i++)
+   {
+      arena[i].used = 0;
+      arena[i].heap_blocks = arena[i].heap_bytes = 0;
+      arena[i].size = 0;
+      arena[i].base = size[i] ? osd_arenareserve(i, size[i]) : NULL;
+      if (arena[i].base)
+      {
+         arena[i].size = size[i];
+         memset(arena[i].base, 0, size[i]);
+      }
+      else if (size[i])
+         log_printf(LOG_WARN "arena: no room for %d byte %s region\n", size[i], region_name[i]);
+   }
+}
+
+void *arena_alloc(int region, int size)
+{
+   int aligned = (size + 3) & ~3;
+   void *block;
+
+   if (arena[region].used + aligned <= arena[region].size)
+   {
+      block = arena[region].base + arena[region].used;
+      arena[region].used += aligned;
+      if (arena[region].used > arena[region].peak)
+         arena[region].peak = arena[region].used;
+      return block;
+   }
+
+   block = calloc(1, size);
+   if (block)
+   {
+      arena[region].heap_blocks++;
+      arena[region].heap_bytes += size;
+   }
+   return block;
+}
+
+void arena_free(void *block)
+{
+   int i;
+
+   for (i = 0; i < ARENA_REGIONS; i++)
+   {
+      if ((uint8 *) block >= arena[i].base && (uint8 *) block < arena[i].base + arena[i].size)
+         return;
+   }
+   free(block);
+}
+
+void arena_destroy(void)
+{
+   int i;
+
+   for (i = 0; i < ARENA_REGIONS; i++)
+   {
+      if (arena[i].size || arena[i].heap_blocks)
+         printf("arena %s: %d of %d bytes, peak %d, %d blocks (%d bytes) from the heap\n",
+                region_name[i], arena[i].used, arena[i].size, arena[i].peak,
+                arena[i].heap_blocks, arena[i].heap_bytes);
+      if (arena[i].base)
+         osd_arenarelease(i, arena[i].base);
+      arena[i].base = NULL;
+      arena[i].size = arena[i].used = 0;
+   }
+}
+
+void arena_traffic(int region, int bytes)
+{
+   arena_moved[region] += bytes;
+}
+
+uint32 arena_gettraffic(int region)
+{
+   return arena_moved[region];
+}
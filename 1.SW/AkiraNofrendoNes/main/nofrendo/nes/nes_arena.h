@@ -0,0 +1,52 @@
+/*
+** Nofrendo (c) 1998-2000 Matthew Conte (matt@conte.com)
+**
+**
+** This program is free software; you can redistribute it and/or
+** modify it under the terms of version 2 of the GNU Library General 
+** Public License as published by the Free Software Foundation.
+**
+** This program is distributed in the hope that it will be useful, 
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU 
+** Library General Public License for more details.  To obtain a 
+** copy of the GNU Library General Public License, write to the Free 
+** Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+**
+** Any permitted reproduction of these routines, in whole or in part,
+** must bear this legend.
+**
+**
+** nes_arena.h
+**
+** Per-machine memory arena
+*/
+
+#ifndef _NES_ARENA_H_
+#define _NES_ARENA_H_
+
+#include <noftypes.h>
+
+/* where a block should live */
+enum
+{
+   ARENA_FAST,    /* internal RAM: what the emulator touches every frame */
+   ARENA_BULK,    /* PSRAM if there is any: snapshots and the rewind ring */
+   ARENA_REGIONS
+};
+
+/* reserve the regions, at machine creation */
+extern void arena_create(void);
+/* a zeroed, 32-bit aligned block out of a region, or the heap once it's full */
+extern void *arena_alloc(int region, int size);
+/* arena blocks go with arena_destroy, heap ones are freed now */
+extern void arena_free(void *block);
+/* drop the lot and report what each region used, at eject */
+extern void arena_destroy(void);
+/* roughly how many bytes were just read or written in a region's blocks,
+** by the code that goes over them, and the running total since boot
+*/
+extern void arena_traffic(int region, int bytes);
+extern uint32 arena_gettraffic(int region);
+
+#endif /* _NES_ARENA_H_ */
@@ -0,0 +1,330 @@
+/*
+** Nofrendo (c) 1998-2000 Matthew Conte (matt@conte.com)
+**
+**
+** This program is free software; you can redistribute it and/or
+** modify it under the terms of version 2 of the GNU Library General
+** Public License as published by the Free Software Foundation.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+** Library General Public License for more details.  To obtain a
+** copy of the GNU Library General Public License, write to the Free
+** Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+**
+** Any permitted reproduction of these routines, in whole or in part,
+** must bear this legend.
+**
+**
+** nes_cheat.c
+**
+** Game Genie and raw address cheats, without a compare on any memory
+** access. A ROM patch changes which page the CPU reads from, not how it
+** reads: mmc_mapprg asks cheat_prg for every bank it maps, and a bank a
+** code hits is mapped from a RAM copy with the patch in it instead of
+** from flash or the PRG cache. RAM codes are written back once a frame.
+*/
+
+#include <string.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <noftypes.h>
+#include <log.h>
+#include <nes6502.h>
+#include <nes.h>
+#include <nes_mmc.h>
+#include <nes_arena.h>
+#include <nes_cheat.h>
+
+#define  CHEAT_MAX      32
+#define  CHEAT_NOCMP    -1
+
+extern int osd_loadcheats(uint32 crc, char *buf, int size);
+
+typedef struct cheat_s
+{
+   uint16 address;
+   uint8 value;
+   int compare;      /* CHEAT_NOCMP, or the byte that has to be there */
+} cheat_t;
+
+typedef struct cheatcopy_s
+{
+   uint8 *data;
+   int window, bank; /* -1 if free */
+} cheatcopy_t;
+
+static struct
+{
+   cheat_t list[CHEAT_MAX];
+   int count;
+   uint8 rom_windows;   /* 8KB windows of $8000-$FFFF any ROM code hits */
+   bool freezes;
+   cheatcopy_t copy[NES_CHEAT_BANKS];
+   int mapped[8];       /* copy in each window, -1 if none */
+   bool dirty;          /* codes changed, the windows need mapping again */
+} cheat;
+
+/* the letters of a Game Genie code stand for 0-15 */
+static int cheat_ggdigit(char c)
+{
+   static const char letters[] = "APZLGITYEOXUKSVN";
+   const char *p = strchr(letters, toupper((unsigned char) c));
+
+   return (c && p) ? (int) (p - letters) : -1;
+}
+
+static int cheat_gamegenie(const char *code, int len, cheat_t *c)
+{
+   int n[8], i;
+
+   for (i = 0; i < len; i++)
+   {
+      n[i] = cheat_ggdigit(code[i]);
+      if (n[i] < 0)
+         return -1;
+   }
+
+   c->address = 0x8000 + (((n[3] & 7) << 12) | ((n[5] & 7) << 8) | ((n[4] & 8) << 8)
+                        | ((n[2] & 7) << 4) | ((n[1] & 8) << 4) | (n[4] & 7) | (n[3] & 8));
+   if (6 == len)
+   {
+      c->value = ((n[1] & 7) << 4) | ((n[0] & 8) << 4) | (n[0] & 7) | (n[5] & 8);
+      c->compare = CHEAT_NOCMP;
+   }
+   else
+   {
+      c->value = ((n[1] & 7) << 4) | ((n[0] & 8) << 4) | (n[0] & 7) | (n[7] & 8);
+      c->compare = ((n[7] & 7) << 4) | ((n[6] & 8) << 4) | (n[6] & 7) | (n[5] & 8);
+   }
+   return 0;
+}
+
+/* AAAA:VV or AAAA?CC:VV */
+static int cheat_raw(const char *code, cheat_t *c)
+{
+   char *end;
+   long address, value, compare = CHEAT_NOCMP;
+
+   address = strtol(code, &end, 16);
+   if (end == code || address < 0 || address > 0xFFFF)
+      return -1;
+   if ('?' == *end)
+   {
+      code = end + 1;
+      compare = strtol(code, &end, 16);
+      if (end == code || compare < 0 || compare > 0xFF)
+         return -1;
+   }
+   if (':' != *end)
+      return -1;
+   code = end + 1;
+   value = strtol(code, &end, 16);
+   if (end == code || *end || value < 0 || value > 0xFF)
+      return -1;
+
+   /* RAM, battery RAM or ROM; the registers in between change under us */
+   if (address >= 0x2000 && address < 0x6000)
+      return -1;
+
+   c->address = (uint16) address;
+   c->value = (uint8) value;
+   c->compare = (int) compare;
+   return 0;
+}
+
+int cheat_add(const char *code)
+{
+   int len = strlen(code);
+   cheat_t *c;
+
+   if (cheat.count >= CHEAT_MAX)
+      return -1;
+   c = &cheat.list[cheat.count];
+
+   if (NULL == strchr(code, ':') && (6 == len || 8 == len))
+   {
+      if (cheat_gamegenie(code, len, c))
+         return -1;
+   }
+   else if (cheat_raw(code, c))
+      return -1;
+
+   if (c->address >= 0x8000)
+      cheat.rom_windows |= 1 << (c->address >> 13);
+   else
+      cheat.freezes = true;
+   cheat.count++;
+   cheat.dirty = true;
+   return 0;
+}
+
+int cheat_addlist(const char *list)
+{
+   char code[16];
+   int len, taken = 0;
+
+   while (*list)
+   {
+      len = strcspn(list, " ,;\t\r\n");
+      if (len > 0 && len < (int) sizeof(code))
+      {
+         memcpy(code, list, len);
+         code[len] = 0;
+         if (0 == cheat_add(code))
+            taken++;
+         else
+            log_printf(LOG_WARN "cheat: %s isn't a code\n", code);
+      }
+      list += len;
+      if (*list)
+         list++;
+   }
+   return taken;
+}
+
+void cheat_clear(void)
+{
+   if (0 == cheat.count)
+      return;
+   cheat.count = 0;
+   cheat.rom_windows = 0;
+   cheat.freezes = false;
+   cheat.dirty = true;
+}
+
+void cheat_load(uint32 crc)
+{
+   char buf[512];
+   int i, length;
+
+   /* the copies were in the last game's arena */
+   memset(&cheat, 0, sizeof(cheat));
+   for (i = 0; i < NES_CHEAT_BANKS; i++)
+      cheat.copy[i].window = cheat.copy[i].bank = -1;
+   for (i = 0; i < 8; i++)
+      cheat.mapped[i] = -1;
+
+   length = osd_loadcheats(crc, buf, sizeof(buf) - 1);
+   if (length <= 0)
+      return;
+   buf[length] = 0;
+   log_printf("cheat: %d codes\n", cheat_addlist(buf));
+   /* nothing is mapped yet, mmc_create does it with the codes in */
+   cheat.dirty = false;
+}
+
+/* does code `c' patch `rom', an 8KB bank going into window `window' */
+INLINE bool cheat_applies(const cheat_t *c, int window, const uint8 *rom)
+{
+   return (c->address >> 13) == window
+          && (CHEAT_NOCMP == c->compare || rom[c->address & 0x1FFF] == c->compare);
+}
+
+static bool cheat_hits(int window, const uint8 *rom)
+{
+   int i;
+
+   for (i = 0; i < cheat.count; i++)
+   {
+      if (cheat_applies(&cheat.list[i], window, rom))
+         return true;
+   }
+   return false;
+}
+
+static bool cheat_copyinuse(int n)
+{
+   int i;
+
+   for (i = 0; i < 8; i++)
+   {
+      if (cheat.mapped[i] == n)
+         return true;
+   }
+   return false;
+}
+
+uint8 *cheat_prg(int window, int bank, const uint8 *rom, uint8 *mapped)
+{
+   int i, n = -1;
+
+   cheat.mapped[window] = -1;
+   if (0 == (cheat.rom_windows & (1 << window)) || false == cheat_hits(window, rom))
+      return mapped;
+
+   for (i = 0; i < NES_CHEAT_BANKS; i++)
+   {
+      if (cheat.copy[i].window == window && cheat.copy[i].bank == bank)
+      {
+         cheat.mapped[window] = i;
+         return cheat.copy[i].data;
+      }
+      if (n < 0 && false == cheat_copyinuse(i))
+         n = i;
+   }
+
+   /* more patched banks in CPU space than copies: this one goes unpatched */
+   if (n < 0)
+      return mapped;
+   if (NULL == cheat.copy[n].data)
+   {
+      cheat.copy[n].data = arena_alloc(ARENA_FAST, 0x2000);
+      if (NULL == cheat.copy[n].data)
+         return mapped;
+   }
+   else
+      nes6502_flushcode(cheat.copy[n].data, 0x2000);
+
+   memcpy(cheat.copy[n].data, rom, 0x2000);
+   for (i = 0; i < cheat.count; i++)
+   {
+      if (cheat_applies(&cheat.list[i], window, rom))
+         cheat.copy[n].data[cheat.list[i].address & 0x1FFF] = cheat.list[i].value;
+   }
+   cheat.copy[n].window = window;
+   cheat.copy[n].bank = bank;
+   cheat.mapped[window] = n;
+   return cheat.copy[n].data;
+}
+
+void cheat_frame(void)
+{
+   nes_t *machine;
+   uint8 *p;
+   int i;
+
+   if (cheat.dirty)
+   {
+      /* the copies are of the old codes: drop them and map the banks again */
+      cheat.dirty = false;
+      for (i = 0; i < NES_CHEAT_BANKS; i++)
+      {
+         if (cheat.copy[i].data)
+            nes6502_flushcode(cheat.copy[i].data, 0x2000);
+         cheat.copy[i].window = cheat.copy[i].bank = -1;
+      }
+      for (i = 0; i < 8; i++)
+         cheat.mapped[i] = -1;
+      mmc_remapprg();
+   }
+
+   if (false == cheat.freezes)
+      return;
+
+   machine = nes_getcontextptr();
+   for (i = 0; i < cheat.count; i++)
+   {
+      const cheat_t *c = &cheat.list[i];
+
+      if (c->address < 0x2000)
+         p = &machine->cpu->mem_page[0][c->address & 0x7FF];
+      else if (c->address < 0x8000 && machine->rominfo->sram)
+         p = &machine->rominfo->sram[c->address & 0x1FFF];
+      else
+         continue;
+      if (CHEAT_NOCMP == c->compare || *p == c->compare)
+         *p = c->value;
+   }
+}
@@ -0,0 +1,58 @@
+/*
+** Nofrendo (c) 1998-2000 Matthew Conte (matt@conte.com)
+**
+**
+** This program is free software; you can redistribute it and/or
+** modify it under the terms of version 2 of the GNU Library General
+** Public License as published by the Free Software Foundation.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+** Library General Public License for more details.  To obtain a
+** copy of the GNU Library General Public License, write to the Free
+** Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+**
+** Any permitted reproduction of these routines, in whole or in part,
+** must bear this legend.
+**
+**
+** nes_cheat.h
+**
+** Game Genie and raw address cheats
+*/
+
+#ifndef _NES_CHEAT_H_
+#define _NES_CHEAT_H_
+
+#include <noftypes.h>
+
+/* 8KB banks that can be held patched in RAM at once */
+#ifndef NES_CHEAT_BANKS
+#define  NES_CHEAT_BANKS   2
+#endif
+
+/* A code is a 6 or 8 letter Game Genie code, or raw "AAAA:VV" or
+** "AAAA?CC:VV" in hex: write VV at AAAA, only where CC is now. ROM
+** addresses ($8000 and up) are patched into a RAM copy of each bank they
+** hit; RAM ($0000-$1FFF) and battery RAM ($6000-$7FFF) are frozen, set
+** again every frame. Returns 0, or -1 if the code isn't one or there are
+** too many.
+*/
+extern int cheat_add(const char *code);
+/* every code of a list separated by spaces, commas or newlines; returns
+** how many were taken
+*/
+extern int cheat_addlist(const char *list);
+extern void cheat_clear(void);
+/* the codes osd_loadcheats has for this game, after the cart is in */
+extern void cheat_load(uint32 crc);
+
+/* mmc_mapprg: where 8KB bank `bank' of `rom' goes in window `window', if
+** not at `mapped' then a patched copy of it
+*/
+extern uint8 *cheat_prg(int window, int bank, const uint8 *rom, uint8 *mapped);
+/* the freezes, once a frame */
+extern void cheat_frame(void);
+
+#endif /* _NES_CHEAT_H_ */
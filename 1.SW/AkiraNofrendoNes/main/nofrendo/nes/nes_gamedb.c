@@ -0,0 +1,56 @@
+/*
+** Nofrendo (c) 1998-2000 Matthew Conte (matt@conte.com)
+**
+**
+** This program is free software; you can redistribute it and/or
+** modify it under the terms of version 2 of the GNU Library General 
+** Public License as published by the Free Software Foundation.
+**
+** This program is distributed in the hope that it will be useful, 
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU 
+** Library General Public License for more details.  To obtain a 
+** copy of the GNU Library General Public License, write to the Free 
+** Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+**
+** Any permitted reproduction of these routines, in whole or in part,
+** must bear this legend.
+**
+**
+** nes_gamedb.c
+**
+** The per-game profile table.  It is generated, not built at boot: edit
+** host/gamedb.txt and run make gamedb in host/, which sorts and checks
+** the entries and writes nes_gamedb.inc.  host/gamedb.py --bench turns
+** the launcher benchmark's UART lines into entries to start from.
+*/
+
+#include <noftypes.h>
+#include <nes_gamedb.h>
+
+static const gamedb_t gamedb[] =
+{
+#include "nes_gamedb.inc"
+   { 0, 0, 0, 0, 0 } /* end of list, not searched */
+};
+
+#define  GAMEDB_COUNT   ((int) (sizeof(gamedb) / sizeof(gamedb[0])) - 1)
+
+const gamedb_t *gamedb_find(uint32 crc)
+{
+   int lo = 0, hi = GAMEDB_COUNT;
+
+   while (lo < hi)
+   {
+      int mid = (lo + hi) / 2;
+
+      if (gamedb[mid].crc == crc)
+         return &gamedb[mid];
+      if (gamedb[mid].crc < crc)
+         lo = mid + 1;
+      else
+         hi = mid;
+   }
+
+   return NULL;
+}
@@ -0,0 +1,50 @@
+/*
+** Nofrendo (c) 1998-2000 Matthew Conte (matt@conte.com)
+**
+**
+** This program is free software; you can redistribute it and/or
+** modify it under the terms of version 2 of the GNU Library General 
+** Public License as published by the Free Software Foundation.
+**
+** This program is distributed in the hope that it will be useful, 
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU 
+** Library General Public License for more details.  To obtain a 
+** copy of the GNU Library General Public License, write to the Free 
+** Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+**
+** Any permitted reproduction of these routines, in whole or in part,
+** must bear this legend.
+**
+**
+** nes_gamedb.h
+**
+** Per-game performance profiles, by PRG ROM CRC32: the idle loop skip,
+** the frame skip cap, run-ahead and the CPU clock floor a game is known
+** to want, so nobody has to tune them by hand
+*/
+
+#ifndef _NES_GAMEDB_H_
+#define _NES_GAMEDB_H_
+
+#include <noftypes.h>
+
+/* gamedb_t flags */
+#define  GAMEDB_IDLESKIP   0x01  /* its vblank/NMI wait loops are safe to skip */
+
+/* An entry of the table host/gamedb.py builds from host/gamedb.txt into
+** nes_gamedb.inc, sorted by crc.  A zero field leaves the build's default.
+*/
+typedef struct gamedb_s
+{
+   uint32 crc;
+   uint8 flags;         /* GAMEDB_xxx */
+   uint8 skip_cap;      /* skip at most one frame in this many */
+   uint8 runahead;      /* frames to run ahead, with NES_RUNAHEAD */
+   uint8 clock;         /* lowest CPU clock, in units of 8 MHz */
+} gamedb_t;
+
+/* the game's profile, NULL without one */
+extern const gamedb_t *gamedb_find(uint32 crc);
+
+#endif /* _NES_GAMEDB_H_ */
@@ -0,0 +1,233 @@
+/*
+** Nofrendo (c) 1998-2000 Matthew Conte (matt@conte.com)
+**
+**
+** This program is free software; you can redistribute it and/or
+** modify it under the terms of version 2 of the GNU Library General 
+** Public License as published by the Free Software Foundation.
+**
+** This program is distributed in the hope that it will be useful, 
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU 
+** Library General Public License for more details.  To obtain a 
+** copy of the GNU Library General Public License, write to the Free 
+** Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+**
+** Any permitted reproduction of these routines, in whole or in part,
+** must bear this legend.
+**
+**
+** nes_heat.c
+**
+** Bank heat map: where the PC is and which pattern banks the PPU has in
+** after every scanline, counted per 8KB bank of PRG-ROM and CHR-ROM. A
+** frame's flash cache misses are shared out over the PRG banks it ran
+** from by how long it ran from each, and PRG samples are split by
+** whether the bank ran from a PRG cache slot (NES_PRGCACHE), so the
+** map shows both what the cache should hold and whether it does.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <noftypes.h>
+#include <osd.h>
+#include <nes6502.h>
+#include <nes.h>
+#include <nes_mmc.h>
+#include <nes_rom.h>
+#include <nes_heat.h>
+
+#ifdef NES_HEATMAP
+
+#define  HEAT_BANKS           256   /* 8KB banks, 2MB of either */
+#define  HEAT_REPORT_SECONDS  10
+#define  HEAT_TOP             8
+#define  HEAT_MAP_LINE        64    /* banks per line of the map */
+
+typedef struct
+{
+   uint32 samples[HEAT_BANKS];
+   uint32 cached[HEAT_BANKS];    /* PRG: of those, from a cache slot */
+   uint32 misses[HEAT_BANKS];    /* PRG: cache misses shared out */
+   int banks;
+} heatmap_t;
+
+static struct
+{
+   heatmap_t prg, chr;
+   uint16 frame_prg[HEAT_BANKS]; /* this frame's samples, for the misses */
+   int frame_samples;
+   uint32 last_misses;
+   uint32 total_misses;
+   int frames, report_frames;
+   bool started;
+} heat;
+
+void heat_start(void)
+{
+   rominfo_t *rominfo = nes_getcontextptr()->rominfo;
+
+   memset(&heat, 0, sizeof(heat));
+   heat.prg.banks = rominfo->rom_banks * 2;
+   heat.chr.banks = rominfo->vrom_banks;
+   if (heat.prg.banks > HEAT_BANKS)
+      heat.prg.banks = HEAT_BANKS;
+   if (heat.chr.banks > HEAT_BANKS)
+      heat.chr.banks = HEAT_BANKS;
+   heat.last_misses = osd_getcachemisses();
+   heat.started = true;
+}
+
+void heat_line(void)
+{
+   uint32 pc = nes6502_getpc();
+   int bank, i;
+
+   if (pc & 0x8000)
+   {
+      bank = mmc_getprgbank(pc);
+      if (bank < heat.prg.banks)
+      {
+         heat.prg.samples[bank]++;
+         if (mmc_prgcached(pc))
+            heat.prg.cached[bank]++;
+         heat.frame_prg[bank]++;
+         heat.frame_samples++;
+      }
+   }
+
+   /* every 1KB the PPU has in, as a share of its 8KB bank */
+   for (i = 0; i < 8 && heat.chr.banks; i++)
+   {
+      bank = mmc_getchrbank(i << 10) >> 3;
+      if (bank < heat.chr.banks)
+         heat.chr.samples[bank]++;
+   }
+}
+
+void heat_frame(void)
+{
+   uint32 now, misses;
+   int i;
+
+   if (false == heat.started)
+      return;
+
+   now = osd_getcachemisses();
+   misses = now - heat.last_misses;
+   heat.last_misses = now;
+   heat.total_misses += misses;
+   for (i = 0; i < heat.prg.banks && heat.frame_samples; i++)
+   {
+      if (heat.frame_prg[i])
+         heat.prg.misses[i] += (uint32) ((unsigned long long) misses * heat.frame_prg[i] / heat.frame_samples);
+   }
+   memset(heat.frame_prg, 0, sizeof(heat.frame_prg));
+   heat.frame_samples = 0;
+
+   heat.frames++;
+   if (++heat.report_frames == HEAT_REPORT_SECONDS * nes_getcontextptr()->timing->refresh_rate)
+   {
+      heat.report_frames = 0;
+      heat_report();
+   }
+}
+
+/* per mille of total */
+static unsigned heat_share(uint32 count, unsigned long long total)
+{
+   return total ? (unsigned) (count * 1000ULL / total) : 0;
+}
+
+/* one character per bank, blank for never and '@' for the hottest */
+static void heat_map(const char *name, const heatmap_t *map)
+{
+   static const char shades[] = " .:-=+*#%@";
+   uint32 hottest = 0;
+   int i;
+
+   for (i = 0; i < map->banks; i++)
+   {
+      if (map->samples[i] > hottest)
+         hottest = map->samples[i];
+   }
+   for (i = 0; i < map->banks; i++)
+   {
+      int shade = map->samples[i] ? 1 + (int) ((unsigned long long) (map->samples[i] - 1) * 9 / hottest) : 0;
+
+      if (0 == i % HEAT_MAP_LINE)
+         printf("%sheat %s %3d |", i ? "|\n" : "", name, i);
+      putchar(shades[shade]);
+   }
+   printf("|\n");
+}
+
+/* the hottest banks: share of the samples, of them from RAM, and misses a frame */
+static void heat_top(const char *name, heatmap_t *map, bool prg)
+{
+   uint32 samples[HEAT_BANKS];
+   unsigned long long total = 0;
+   int i, j;
+
+   for (i = 0; i < map->banks; i++)
+   {
+      samples[i] = map->samples[i];
+      total += samples[i];
+   }
+   if (0 == total)
+      return;
+
+   printf("heat %s top:", name);
+   for (i = 0; i < HEAT_TOP; i++)
+   {
+      int best = 0;
+      unsigned share;
+
+      for (j = 1; j < map->banks; j++)
+      {
+         if (samples[j] > samples[best])
+            best = j;
+      }
+      if (0 == samples[best])
+         break;
+      share = heat_share(samples[best], total);
+      printf(" %d %u.%u%%", best, share / 10, share % 10);
+      if (prg)
+      {
+         share = heat_share(map->cached[best], samples[best]);
+         printf(" (ram %u%%, %u miss)", share / 10, (unsigned) (map->misses[best] / heat.frames));
+      }
+      samples[best] = 0;
+   }
+   printf("\n");
+}
+
+void heat_report(void)
+{
+   nes_t *nes = nes_getcontextptr();
+   unsigned long long samples = 0, cached = 0;
+   unsigned share;
+   int i;
+
+   if (false == heat.started || 0 == heat.frames)
+      return;
+
+   for (i = 0; i < heat.prg.banks; i++)
+   {
+      samples += heat.prg.samples[i];
+      cached += heat.prg.cached[i];
+   }
+   share = heat_share(cached, samples);
+   printf("heat %08X: %d frames, %d PRG and %d CHR 8KB banks, PRG from RAM %u.%u%%, %u misses/frame\n",
+          nes->rominfo->crc, heat.frames, heat.prg.banks, heat.chr.banks, share / 10, share % 10,
+          (unsigned) (heat.total_misses / heat.frames));
+   heat_map("prg", &heat.prg);
+   heat_top("prg", &heat.prg, true);
+   if (heat.chr.banks)
+   {
+      heat_map("chr", &heat.chr);
+      heat_top("chr", &heat.chr, false);
+   }
+}
+
+#endif /* NES_HEATMAP */
@@ -0,0 +1,45 @@
+/*
+** Nofrendo (c) 1998-2000 Matthew Conte (matt@conte.com)
+**
+**
+** This program is free software; you can redistribute it and/or
+** modify it under the terms of version 2 of the GNU Library General 
+** Public License as published by the Free Software Foundation.
+**
+** This program is distributed in the hope that it will be useful, 
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU 
+** Library General Public License for more details.  To obtain a 
+** copy of the GNU Library General Public License, write to the Free 
+** Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+**
+** Any permitted reproduction of these routines, in whole or in part,
+** must bear this legend.
+**
+**
+** nes_heat.h
+**
+** Which 8KB PRG and CHR banks a game runs from, sampled every scanline,
+** with the platform's flash cache misses shared out over them; compiled
+** in with NES_HEATMAP
+*/
+
+#ifndef _NES_HEAT_H_
+#define _NES_HEAT_H_
+
+#include <noftypes.h>
+
+#ifdef NES_HEATMAP
+
+/* a game is in, count from here */
+extern void heat_start(void);
+/* after the CPU has run a scanline */
+extern void heat_line(void);
+/* once per emulated frame */
+extern void heat_frame(void);
+/* the map since heat_start, over UART; every 10 seconds and when the game ends */
+extern void heat_report(void);
+
+#endif /* NES_HEATMAP */
+
+#endif /* _NES_HEAT_H_ */
@@ -0,0 +1,228 @@
+/*
+** Nofrendo (c) 1998-2000 Matthew Conte (matt@conte.com)
+**
+**
+** This program is free software; you can redistribute it and/or
+** modify it under the terms of version 2 of the GNU Library General 
+** Public License as published by the Free Software Foundation.
+**
+** This program is distributed in the hope that it will be useful, 
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU 
+** Library General Public License for more details.  To obtain a 
+** copy of the GNU Library General Public License, write to the Free 
+** Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+**
+** Any permitted reproduction of these routines, in whole or in part,
+** must bear this legend.
+**
+**
+** nes_hist.c
+**
+** What a game makes the emulator do: instructions by opcode and by
+** addressing mode, handler calls by handler and bank switches per frame,
+** printed over UART as tables so the fast paths can go where games are
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <noftypes.h>
+#include <nes6502.h>
+#include <nes.h>
+#include <nes_rom.h>
+#include <nes_hist.h>
+
+#ifdef NES_HISTOGRAM
+
+#define  HIST_REPORT_SECONDS  60
+#define  HIST_TOP_OPCODES     32    /* the rest are summed up */
+#define  HIST_PER_LINE        8
+
+uint32 hist_banks[HIST_BANKS];
+
+/* addressing modes, as dis6502.c has them */
+enum
+{
+   IMP, ACC, REL, IMM, ABS, ABX, ABY, ZPG, ZPX, ZPY, IND, IZX, IZY, HIST_MODES
+};
+
+static const char *hist_modenames[HIST_MODES] =
+{
+   "imp", "acc", "rel", "imm", "abs", "abs,x", "abs,y",
+   "zp", "zp,x", "zp,y", "ind", "(zp,x)", "(zp),y"
+};
+
+static const uint8 hist_mode[256] =
+{
+   IMP, IZX, IMP, IZX, ZPG, ZPG, ZPG, ZPG, IMP, IMM, ACC, IMM, ABS, ABS, ABS, ABS, /* 00 */
+   REL, IZY, IMP, IZY, ZPX, ZPX, ZPX, ZPX, IMP, ABY, IMP, ABY, ABX, ABX, ABX, ABX, /* 10 */
+   ABS, IZX, IMP, IZX, ZPG, ZPG, ZPG, ZPG, IMP, IMM, ACC, IMM, ABS, ABS, ABS, ABS, /* 20 */
+   REL, IZY, IMP, IZY, IMP, ZPX, ZPX, ZPX, IMP, ABY, IMP, ABY, ABX, ABX, ABX, ABX, /* 30 */
+   IMP, IZX, IMP, IZX, ZPG, ZPG, ZPG, ZPG, IMP, IMM, ACC, IMM, ABS, ABS, ABS, ABS, /* 40 */
+   REL, IZY, IMP, IZY, ZPX, ZPX, ZPX, ZPX, IMP, ABY, IMP, ABY, ABX, ABX, ABX, ABX, /* 50 */
+   IMP, IZX, IMP, IZX, ZPG, ZPG, ZPG, ZPG, IMP, IMM, ACC, IMM, IND, ABS, ABS, ABS, /* 60 */
+   REL, IZY, IMP, IZY, ZPX, ZPX, ZPX, ZPX, IMP, ABY, IMP, ABY, ABX, ABX, ABX, ABX, /* 70 */
+   IMM, IZX, IMM, IZX, ZPG, ZPG, ZPG, ZPG, IMP, IMM, IMP, IMM, ABS, ABS, ABS, ABS, /* 80 */
+   REL, IZY, IMP, IZY, ZPX, ZPX, ZPY, ZPY, IMP, ABY, IMP, ABY, ABX, ABX, ABY, ABY, /* 90 */
+   IMM, IZX, IMM, IZX, ZPG, ZPG, ZPG, ZPG, IMP, IMM, IMP, IMM, ABS, ABS, ABS, ABS, /* A0 */
+   REL, IZY, IMP, IZY, ZPX, ZPX, ZPY, ZPY, IMP, ABY, IMP, ABY, ABX, ABX, ABY, ABY, /* B0 */
+   IMM, IZX, IMM, IZX, ZPG, ZPG, ZPG, ZPG, IMP, IMM, IMP, IMM, ABS, ABS, ABS, ABS, /* C0 */
+   REL, IZY, IMP, IZY, ZPX, ZPX, ZPX, ZPX, IMP, ABY, IMP, ABY, ABX, ABX, ABX, ABX, /* D0 */
+   IMM, IZX, IMM, IZX, ZPG, ZPG, ZPG, ZPG, IMP, IMM, IMP, IMM, ABS, ABS, ABS, ABS, /* E0 */
+   REL, IZY, IMP, IZY, ZPX, ZPX, ZPX, ZPX, IMP, ABY, IMP, ABY, ABX, ABX, ABX, ABX /* F0 */
+};
+
+static struct
+{
+   nes6502_hist start;           /* the CPU's counts at hist_start */
+   uint32 banks_start[HIST_BANKS];
+   uint32 banks_last[HIST_BANKS];
+   uint32 banks_max[HIST_BANKS];  /* most in one frame */
+   int frames, report_frames;
+   bool started;
+} hist;
+
+void hist_start(void)
+{
+   memcpy(&hist.start, nes6502_gethist(), sizeof(hist.start));
+   memcpy(hist.banks_start, hist_banks, sizeof(hist_banks));
+   memcpy(hist.banks_last, hist_banks, sizeof(hist_banks));
+   memset(hist.banks_max, 0, sizeof(hist.banks_max));
+   hist.frames = hist.report_frames = 0;
+   hist.started = true;
+}
+
+void hist_frame(void)
+{
+   int i;
+
+   if (false == hist.started)
+      return;
+   for (i = 0; i < HIST_BANKS; i++)
+   {
+      uint32 delta = hist_banks[i] - hist.banks_last[i];
+
+      hist.banks_last[i] = hist_banks[i];
+      if (delta > hist.banks_max[i])
+         hist.banks_max[i] = delta;
+   }
+   hist.frames++;
+   if (++hist.report_frames == HIST_REPORT_SECONDS * nes_getcontextptr()->timing->refresh_rate)
+   {
+      hist.report_frames = 0;
+      hist_report();
+   }
+}
+
+/* count * scale / total without overflowing: a minute of a game is
+** some 10^8 instructions, the total of an hour doesn't fit 32 bits
+*/
+static uint32 hist_scale(unsigned long long count, uint32 scale, unsigned long long total)
+{
+   return (uint32) (count * scale / total);
+}
+
+/* tenths, as %u.%u */
+#define  TENTHS(x)   (unsigned) ((x) / 10), (unsigned) ((x) % 10)
+
+/* the handlers that were called, per frame, by their range */
+static void hist_handlers(const char *name, const uint32 *now, const uint32 *start,
+                          const uint32 (*range)[2], int count)
+{
+   int i, n = 0;
+
+   for (i = 0; i < count; i++)
+   {
+      uint32 calls = now[i] - start[i];
+
+      if (0 == calls)
+         continue;
+      if (0 == n % HIST_PER_LINE)
+         printf("%shist %s", n ? "\n" : "", name);
+      printf(" $%04X-$%04X %u.%u", (unsigned) range[i][0], (unsigned) range[i][1],
+             TENTHS(hist_scale(calls, 10, hist.frames)));
+      n++;
+   }
+   if (n)
+      printf(" /frame\n");
+}
+
+void hist_report(void)
+{
+   nes_t *nes = nes_getcontextptr();
+   const nes6502_hist *now = nes6502_gethist();
+   const nes6502_memread *mr;
+   const nes6502_memwrite *mw;
+   uint32 ops[256], range[NES6502_HIST_HANDLERS][2];
+   unsigned long long modes[HIST_MODES], total = 0, shown = 0;
+   int i, j, n;
+
+   if (false == hist.started || 0 == hist.frames)
+      return;
+
+   memset(modes, 0, sizeof(modes));
+   for (i = 0; i < 256; i++)
+   {
+      ops[i] = now->opcode[i] - hist.start.opcode[i];
+      modes[hist_mode[i]] += ops[i];
+      total += ops[i];
+   }
+   if (0 == total)
+      return;
+
+   printf("hist %08X: %d frames, %u instructions a frame\n", nes->rominfo->crc,
+          hist.frames, (unsigned) (total / (unsigned) hist.frames));
+
+   /* the most run opcodes in per cent, the biggest taken out each time */
+   for (i = 0; i < HIST_TOP_OPCODES; i++)
+   {
+      int best = 0;
+
+      for (j = 1; j < 256; j++)
+      {
+         if (ops[j] > ops[best])
+            best = j;
+      }
+      if (0 == ops[best])
+         break;
+      if (0 == i % HIST_PER_LINE)
+         printf("%shist op", i ? "\n" : "");
+      printf(" %02X %u.%u", best, TENTHS(hist_scale(ops[best], 1000, total)));
+      shown += ops[best];
+      ops[best] = 0;
+   }
+   printf(" %%, rest %u.%u\n", TENTHS(hist_scale(total - shown, 1000, total)));
+
+   for (i = 0, n = 0; i < HIST_MODES; i++)
+   {
+      if (0 == modes[i])
+         continue;
+      if (0 == n % HIST_PER_LINE)
+         printf("%shist mode", n ? "\n" : "");
+      printf(" %s %u.%u", hist_modenames[i], TENTHS(hist_scale(modes[i], 1000, total)));
+      n++;
+   }
+   printf(" %%\n");
+
+   /* handler n counts into slot n, the last slot takes any past it */
+   for (n = 0, mr = nes->cpu->read_handler; n < NES6502_HIST_HANDLERS && mr->min_range != 0xFFFFFFFF; n++, mr++)
+   {
+      range[n][0] = mr->min_range;
+      range[n][1] = mr->max_range;
+   }
+   hist_handlers("read", now->read, hist.start.read, range, n);
+   for (n = 0, mw = nes->cpu->write_handler; n < NES6502_HIST_HANDLERS && mw->min_range != 0xFFFFFFFF; n++, mw++)
+   {
+      range[n][0] = mw->min_range;
+      range[n][1] = mw->max_range;
+   }
+   hist_handlers("write", now->write, hist.start.write, range, n);
+
+   printf("hist banks prg %u.%u/frame (max %u) chr %u.%u/frame (max %u)\n",
+          TENTHS(hist_scale(hist_banks[HIST_PRG] - hist.banks_start[HIST_PRG], 10, hist.frames)),
+          (unsigned) hist.banks_max[HIST_PRG],
+          TENTHS(hist_scale(hist_banks[HIST_CHR] - hist.banks_start[HIST_CHR], 10, hist.frames)),
+          (unsigned) hist.banks_max[HIST_CHR]);
+}
+
+#endif /* NES_HISTOGRAM */
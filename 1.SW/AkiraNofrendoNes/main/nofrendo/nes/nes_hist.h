@@ -0,0 +1,58 @@
+/*
+** Nofrendo (c) 1998-2000 Matthew Conte (matt@conte.com)
+**
+**
+** This program is free software; you can redistribute it and/or
+** modify it under the terms of version 2 of the GNU Library General 
+** Public License as published by the Free Software Foundation.
+**
+** This program is distributed in the hope that it will be useful, 
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU 
+** Library General Public License for more details.  To obtain a 
+** copy of the GNU Library General Public License, write to the Free 
+** Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+**
+** Any permitted reproduction of these routines, in whole or in part,
+** must bear this legend.
+**
+**
+** nes_hist.h
+**
+** Opcode, addressing mode, handler and bank switch counts per game,
+** compiled in with NES_HISTOGRAM (and NES6502_HISTOGRAM for the CPU)
+*/
+
+#ifndef _NES_HIST_H_
+#define _NES_HIST_H_
+
+#include <noftypes.h>
+
+#ifdef NES_HISTOGRAM
+
+enum
+{
+   HIST_PRG,      /* mmc_bankrom */
+   HIST_CHR,      /* mmc_bankvrom */
+   HIST_BANKS
+};
+
+/* bank switches since boot, by kind */
+extern uint32 hist_banks[HIST_BANKS];
+
+#define  HIST_BANK(kind)   (hist_banks[kind]++)
+
+/* a game is in, count from here */
+extern void hist_start(void);
+/* once per emulated frame */
+extern void hist_frame(void);
+/* the tables since hist_start, over UART; every minute and when the game ends */
+extern void hist_report(void);
+
+#else /* !NES_HISTOGRAM */
+
+#define  HIST_BANK(kind)
+
+#endif /* !NES_HISTOGRAM */
+
+#endif /* _NES_HIST_H_ */
@@ -32,6 +32,11 @@
 #include "log.h"
 #include "mmclist.h"
 #include "nes_rom.h"
+#include "nes_arena.h"
+#include "nes_hist.h"
+#ifdef NES_CHEATS
+#include "nes_cheat.h"
+#endif
 
 #define MMC_8KROM (mmc.cart->rom_banks * 2)
 #define MMC_16KROM (mmc.cart->rom_banks)
@@ -68,95 +73,435 @@ void mmc_getcontext(mmc_t *dest_mmc)
    *dest_mmc = mmc;
 }
 
+/* 1KB CHR-ROM bank mapped at each 1KB of pattern space */
+static int chr_bank[8];
+
+#ifdef NES_CHRCACHE
+
+/* CHR bank cache
+**
+** Same idea as the PRG cache below, for pattern fetches: NES_CHRCACHE
+** 1KB banks are kept in RAM.  A bank switched in from flash is only
+** copied when the PPU is about to draw a line with it (mmc_stagechr),
+** so banks switched in and out again between drawn lines, or during
+** skipped frames, never cost a copy.  A slot is reused least recently
+** mapped first, and only once nothing in pattern space points at it.
+*/
+typedef struct chrslot_s
+{
+   uint8 *data;
+   int bank;      /* 1KB bank held, -1 if free */
+   uint32 stamp;  /* stage count when last mapped */
+} chrslot_t;
+
+static chrslot_t chr_slot[NES_CHRCACHE];
+static uint32 chr_clock;
+static int chr_window[8];  /* slot mapped at each 1KB of pattern space, -1 if flash */
+static uint8 chr_pending;  /* pages mapped from flash and not staged yet */
+
+static void chr_cachecreate(void)
+{
+   int i;
+
+   for (i = 0; i < NES_CHRCACHE; i++)
+   {
+      chr_slot[i].data = (i < MMC_1KVROM) ? arena_alloc(ARENA_FAST, 0x400) : NULL;
+      chr_slot[i].bank = -1;
+      chr_slot[i].stamp = 0;
+   }
+
+   for (i = 0; i < 8; i++)
+      chr_window[i] = -1;
+   chr_pending = 0;
+   chr_clock = 0;
+}
+
+static void chr_cachedestroy(void)
+{
+   int i;
+
+   for (i = 0; i < NES_CHRCACHE; i++)
+   {
+      if (chr_slot[i].data)
+         arena_free(chr_slot[i].data);
+      chr_slot[i].data = NULL;
+      chr_slot[i].bank = -1;
+   }
+   chr_pending = 0;
+}
+
+static int chr_find(int bank)
+{
+   int i;
+
+   for (i = 0; i < NES_CHRCACHE; i++)
+   {
+      if (chr_slot[i].bank == bank)
+         return i;
+   }
+   return -1;
+}
+
+static bool chr_inuse(int slot)
+{
+   int i;
+
+   for (i = 0; i < 8; i++)
+   {
+      if (chr_window[i] == slot)
+         return true;
+   }
+   return false;
+}
+
+bool mmc_chrpending(void)
+{
+   return 0 != chr_pending;
+}
+
+/* copy the banks mapped from flash since the last drawn line into RAM */
+void mmc_stagechr(void)
+{
+   int page, i, slot;
+
+   for (page = 0; page < 8; page++)
+   {
+      if (0 == (chr_pending & (1 << page)))
+         continue;
+
+      slot = chr_find(chr_bank[page]);
+      if (slot < 0)
+      {
+         /* a free slot, else the least recently mapped one out of pattern space */
+         for (i = 0; i < NES_CHRCACHE; i++)
+         {
+            if (NULL == chr_slot[i].data)
+               continue;
+            if (chr_slot[i].bank < 0)
+            {
+               slot = i;
+               break;
+            }
+            if (chr_inuse(i))
+               continue;
+            if (slot < 0 || chr_slot[i].stamp < chr_slot[slot].stamp)
+               slot = i;
+         }
+
+         /* every slot is on screen, stay on flash */
+         if (slot < 0)
+            continue;
+
+         memcpy(chr_slot[slot].data, &mmc.cart->vrom[chr_bank[page] << 10], 0x400);
+         chr_slot[slot].bank = chr_bank[page];
+      }
+
+      chr_slot[slot].stamp = ++chr_clock;
+      chr_window[page] = slot;
+      ppu_setpage(1, page, chr_slot[slot].data - (page << 10));
+   }
+
+   chr_pending = 0;
+}
+
+#endif /* NES_CHRCACHE */
+
+/* map 1KB bank `bank' at 1KB page `page' of pattern space */
+static void mmc_mapchr(int page, int bank)
+{
+   chr_bank[page] = bank;
+#ifdef NES_CHRCACHE
+   chr_window[page] = chr_find(bank);
+   if (chr_window[page] >= 0)
+   {
+      chr_slot[chr_window[page]].stamp = ++chr_clock;
+      chr_pending &= ~(1 << page);
+      ppu_setpage(1, page, chr_slot[chr_window[page]].data - (page << 10));
+      return;
+   }
+   chr_pending |= 1 << page;
+#endif
+   ppu_setpage(1, page, &mmc.cart->vrom[bank << 10] - (page << 10));
+}
+
+/* 1KB CHR-ROM bank mapped at address */
+int mmc_getchrbank(uint32 address)
+{
+   return chr_bank[(address >> 10) & 7];
+}
+
 /* VROM bankswitching */
 void mmc_bankvrom(int size, uint32 address, int bank)
 {
+   int page = (address >> 10) & 7;
+   int i;
+
    if (0 == mmc.cart->vrom_banks)
       return;
+   HIST_BANK(HIST_CHR);
 
    switch (size)
    {
    case 1:
       if (bank == MMC_LASTBANK)
          bank = MMC_LAST1KVROM;
-      ppu_setpage(1, address >> 10, &mmc.cart->vrom[(bank % MMC_1KVROM) << 10] - address);
+      mmc_mapchr(page, bank % MMC_1KVROM);
       break;
 
    case 2:
       if (bank == MMC_LASTBANK)
          bank = MMC_LAST2KVROM;
-      ppu_setpage(2, address >> 10, &mmc.cart->vrom[(bank % MMC_2KVROM) << 11] - address);
+      bank = (bank % MMC_2KVROM) * 2;
+      for (i = 0; i < 2; i++)
+         mmc_mapchr(page + i, bank + i);
       break;
 
    case 4:
       if (bank == MMC_LASTBANK)
          bank = MMC_LAST4KVROM;
-      ppu_setpage(4, address >> 10, &mmc.cart->vrom[(bank % MMC_4KVROM) << 12] - address);
+      bank = (bank % MMC_4KVROM) * 4;
+      for (i = 0; i < 4; i++)
+         mmc_mapchr(page + i, bank + i);
       break;
 
    case 8:
       if (bank == MMC_LASTBANK)
          bank = MMC_LAST8KVROM;
-      ppu_setpage(8, 0, &mmc.cart->vrom[(bank % MMC_8KVROM) << 13]);
+      bank = (bank % MMC_8KVROM) * 8;
+      for (i = 0; i < 8; i++)
+         mmc_mapchr(i, bank + i);
       break;
 
    default:
-      log_printf("invalid VROM bank size %d\n", size);
+      log_printf(LOG_WARN "invalid VROM bank size %d\n", size);
+   }
+}
+
+/* 8KB PRG-ROM bank mapped at each 8KB of CPU space */
+static int prg_bank[8];
+
+#ifdef NES_PRGCACHE
+
+/* PRG bank cache
+**
+** PRG-ROM is normally run straight out of memory mapped flash, through
+** the same cache the emulator's own code goes through.  This keeps
+** NES_PRGCACHE 8KB banks in RAM instead.  Every bank switch counts a
+** use of the bank it maps in; a bank gets a slot when one is free, or
+** when it has been used at least as often as the least recently mapped
+** bank that isn't in CPU space right now, and its pages then point at
+** the copy.  The fixed bank is mapped at reset while slots are free,
+** so it always ends up in RAM.  Use counts are halved every
+** PRG_DECAY switches so that banks from the last level don't hold on
+** to their slots forever.
+*/
+#define  PRG_DECAY   1024
+
+typedef struct prgslot_s
+{
+   uint8 *data;
+   int bank;      /* 8KB bank held, -1 if free */
+   uint32 stamp;  /* bank switch count when last mapped */
+} prgslot_t;
+
+static prgslot_t prg_slot[NES_PRGCACHE];
+static uint16 *prg_uses;   /* per 8KB bank */
+static uint32 prg_clock;
+static int prg_window[8];  /* slot mapped at each 8KB of CPU space, -1 if flash */
+
+static void prg_cachecreate(void)
+{
+   int i;
+
+   prg_uses = arena_alloc(ARENA_FAST, MMC_8KROM * sizeof(uint16));
+   prg_clock = 0;
+
+   for (i = 0; i < NES_PRGCACHE; i++)
+   {
+      prg_slot[i].data = (i < MMC_8KROM && prg_uses) ? arena_alloc(ARENA_FAST, 0x2000) : NULL;
+      prg_slot[i].bank = -1;
+      prg_slot[i].stamp = 0;
+   }
+
+   for (i = 0; i < 8; i++)
+      prg_window[i] = -1;
+}
+
+static void prg_cachedestroy(void)
+{
+   int i;
+
+   for (i = 0; i < NES_PRGCACHE; i++)
+   {
+      if (prg_slot[i].data)
+      {
+         nes6502_flushcode(prg_slot[i].data, 0x2000);
+         arena_free(prg_slot[i].data);
+      }
+      prg_slot[i].data = NULL;
+      prg_slot[i].bank = -1;
+   }
+
+   if (prg_uses)
+      arena_free(prg_uses);
+   prg_uses = NULL;
+}
+
+static bool prg_inuse(int slot)
+{
+   int i;
+
+   for (i = 0; i < 8; i++)
+   {
+      if (prg_window[i] == slot)
+         return true;
+   }
+   return false;
+}
+
+/* where to map 8KB bank `bank' in window `window' from: its RAM copy,
+** a new one, or flash
+*/
+static uint8 *prg_cached(int window, int bank)
+{
+   uint8 *rom = &mmc.cart->rom[bank << 13];
+   int i, victim = -1;
+
+   prg_window[window] = -1;
+   if (NULL == prg_uses)
+      return rom;
+
+   if (prg_uses[bank] < 0xFFFF)
+      prg_uses[bank]++;
+   if (0 == (++prg_clock % PRG_DECAY))
+   {
+      for (i = 0; i < MMC_8KROM; i++)
+         prg_uses[i] >>= 1;
+   }
+
+   for (i = 0; i < NES_PRGCACHE; i++)
+   {
+      if (prg_slot[i].bank == bank)
+      {
+         victim = i;
+         goto mapped;
+      }
    }
+
+   /* a free slot, else the least recently mapped one out of CPU space */
+   for (i = 0; i < NES_PRGCACHE; i++)
+   {
+      if (NULL == prg_slot[i].data)
+         continue;
+      if (prg_slot[i].bank < 0)
+      {
+         victim = i;
+         break;
+      }
+      if (prg_inuse(i))
+         continue;
+      if (victim < 0 || prg_slot[i].stamp < prg_slot[victim].stamp)
+         victim = i;
+   }
+
+   if (victim < 0)
+      return rom;
+
+   if (prg_slot[victim].bank >= 0)
+   {
+      if (prg_uses[bank] < prg_uses[prg_slot[victim].bank])
+         return rom;
+      nes6502_flushcode(prg_slot[victim].data, 0x2000);
+   }
+
+   memcpy(prg_slot[victim].data, rom, 0x2000);
+   prg_slot[victim].bank = bank;
+
+mapped:
+   prg_slot[victim].stamp = prg_clock;
+   prg_window[window] = victim;
+   return prg_slot[victim].data;
+}
+
+#endif /* NES_PRGCACHE */
+
+/* map 8KB bank `bank' at 8KB window `window' of CPU space */
+static void mmc_mapprg(int window, int bank)
+{
+   uint8 *rom;
+
+   prg_bank[window] = bank;
+#ifdef NES_PRGCACHE
+   rom = prg_cached(window, bank);
+#else
+   rom = &mmc.cart->rom[bank << 13];
+#endif
+#ifdef NES_CHEATS
+   rom = cheat_prg(window, bank, &mmc.cart->rom[bank << 13], rom);
+#endif
+   nes6502_setpage(window * 2, rom);
+   nes6502_setpage(window * 2 + 1, rom + 0x1000);
+}
+
+/* the same banks once more, after the cheats changed */
+void mmc_remapprg(void)
+{
+   int window;
+
+   for (window = 4; window < 8; window++)
+      mmc_mapprg(window, prg_bank[window]);
+}
+
+/* 8KB PRG-ROM bank mapped at address */
+int mmc_getprgbank(uint32 address)
+{
+   return prg_bank[(address >> 13) & 7];
+}
+
+/* whether the 8KB at address runs from a PRG cache slot, not the image */
+bool mmc_prgcached(uint32 address)
+{
+#ifdef NES_PRGCACHE
+   return prg_window[(address >> 13) & 7] >= 0;
+#else
+   return false;
+#endif
 }
 
 /* ROM bankswitching */
 void mmc_bankrom(int size, uint32 address, int bank)
 {
-   nes6502_context mmc_cpu;
-
-   nes6502_getcontext(&mmc_cpu);
+   int window = (address >> 13) & 7;
 
+   HIST_BANK(HIST_PRG);
    switch (size)
    {
    case 8:
       if (bank == MMC_LASTBANK)
          bank = MMC_LAST8KROM;
-      {
-         int page = address >> NES6502_BANKSHIFT;
-         mmc_cpu.mem_page[page] = &mmc.cart->rom[(bank % MMC_8KROM) << 13];
-         mmc_cpu.mem_page[page + 1] = mmc_cpu.mem_page[page] + 0x1000;
-      }
-
+      mmc_mapprg(window, bank % MMC_8KROM);
       break;
 
    case 16:
       if (bank == MMC_LASTBANK)
          bank = MMC_LAST16KROM;
-      {
-         int page = address >> NES6502_BANKSHIFT;
-         mmc_cpu.mem_page[page] = &mmc.cart->rom[(bank % MMC_16KROM) << 14];
-         mmc_cpu.mem_page[page + 1] = mmc_cpu.mem_page[page] + 0x1000;
-         mmc_cpu.mem_page[page + 2] = mmc_cpu.mem_page[page] + 0x2000;
-         mmc_cpu.mem_page[page + 3] = mmc_cpu.mem_page[page] + 0x3000;
-      }
+      bank = (bank % MMC_16KROM) * 2;
+      mmc_mapprg(window, bank);
+      mmc_mapprg(window + 1, bank + 1);
       break;
 
    case 32:
       if (bank == MMC_LASTBANK)
          bank = MMC_LAST32KROM;
-
-      mmc_cpu.mem_page[8] = &mmc.cart->rom[(bank % MMC_32KROM) << 15];
-      mmc_cpu.mem_page[9] = mmc_cpu.mem_page[8] + 0x1000;
-      mmc_cpu.mem_page[10] = mmc_cpu.mem_page[8] + 0x2000;
-      mmc_cpu.mem_page[11] = mmc_cpu.mem_page[8] + 0x3000;
-      mmc_cpu.mem_page[12] = mmc_cpu.mem_page[8] + 0x4000;
-      mmc_cpu.mem_page[13] = mmc_cpu.mem_page[8] + 0x5000;
-      mmc_cpu.mem_page[14] = mmc_cpu.mem_page[8] + 0x6000;
-      mmc_cpu.mem_page[15] = mmc_cpu.mem_page[8] + 0x7000;
+      bank = (bank % MMC_32KROM) * 4;
+      for (window = 0; window < 4; window++)
+         mmc_mapprg(4 + window, bank + window);
       break;
 
    default:
-      log_printf("invalid ROM bank size %d\n", size);
+      log_printf(LOG_WARN "invalid ROM bank size %d\n", size);
       break;
    }
-
-   nes6502_setcontext(&mmc_cpu);
 }
 
 /* Check to see if this mapper is supported */
@@ -213,17 +558,24 @@ void mmc_reset(void)
 
    ppu_setlatchfunc(NULL);
    ppu_setvromswitch(NULL);
+   ppu_setexattr(NULL, NULL, 1, 0);
 
    if (mmc.intf->init)
       mmc.intf->init();
 
-   log_printf("reset memory mapper\n");
+   log_printf(LOG_DEBUG "reset memory mapper\n");
 }
 
 void mmc_destroy(mmc_t **nes_mmc)
 {
+#ifdef NES_PRGCACHE
+   prg_cachedestroy();
+#endif
+#ifdef NES_CHRCACHE
+   chr_cachedestroy();
+#endif
    if (*nes_mmc)
-      free(*nes_mmc);
+      arena_free(*nes_mmc);
 }
 
 mmc_t *mmc_create(rominfo_t *rominfo)
@@ -237,16 +589,20 @@ mmc_t *mmc_create(rominfo_t *rominfo)
          return NULL; /* Should *never* happen */
    }
 
-   temp = malloc(sizeof(mmc_t));
+   temp = arena_alloc(ARENA_FAST, sizeof(mmc_t));
    if (NULL == temp)
       return NULL;
 
-   memset(temp, 0, sizeof(mmc_t));
-
    temp->intf = *map_ptr;
    temp->cart = rominfo;
 
    mmc_setcontext(temp);
+#ifdef NES_PRGCACHE
+   prg_cachecreate();
+#endif
+#ifdef NES_CHRCACHE
+   chr_cachecreate();
+#endif
 
    log_printf("created memory mapper: %s\n", (*map_ptr)->name);
 
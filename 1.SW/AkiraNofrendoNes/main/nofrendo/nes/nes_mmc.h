@@ -50,13 +50,20 @@ typedef struct mapintf_s
    void (*init)(void);
    void (*vblank)(void);
    void (*hblank)(int vblank);
-   void (*get_state)(SnssMapperBlock *state);
-   void (*set_state)(SnssMapperBlock *state);
+   void (*get_state)(void); /* bring the state_region()s up to date */
+   void (*set_state)(void); /* they were restored, rebuild the rest */
    map_memread *mem_read;
    map_memwrite *mem_write;
    apuext_t *sound_ext;
+   uint8 flags;
 } mapintf_t;
 
+/* mapintf_t flags */
+#define MMC_HBLANK_RENDER 0x01 /* hblank callback does nothing in vblank */
+#define MMC_HBLANK_EVENT  0x02 /* ...and is only wanted on nes_sethblankline's
+                               ** line, lines with rendering off, line 0 and
+                               ** the first vblank line */
+
 #include "nes_rom.h"
 typedef struct mmc_s
 {
@@ -67,7 +74,15 @@ typedef struct mmc_s
 extern rominfo_t *mmc_getinfo(void);
 
 extern void mmc_bankvrom(int size, uint32 address, int bank);
+extern int mmc_getchrbank(uint32 address);
+#ifdef NES_CHRCACHE
+extern bool mmc_chrpending(void);
+extern void mmc_stagechr(void);
+#endif
 extern void mmc_bankrom(int size, uint32 address, int bank);
+extern int mmc_getprgbank(uint32 address);
+extern bool mmc_prgcached(uint32 address);
+extern void mmc_remapprg(void);
 
 /* Prototypes */
 extern mmc_t *mmc_create(rominfo_t *rominfo);
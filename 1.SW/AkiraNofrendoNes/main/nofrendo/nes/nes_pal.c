@@ -24,6 +24,7 @@
 */
 
 #include <math.h>
+#include <string.h>
 #include "noftypes.h"
 #include "bitmap.h"
 #include "nes_pal.h"
@@ -95,8 +96,19 @@ rgb_t shady_palette[] =
 /* our global palette */
 rgb_t nes_palette[64];
 
-static float hue = 334.0f;
-static float tint = 0.4f;
+#define PAL_HUE 334.0f
+#define PAL_TINT 0.4f
+
+static float hue = PAL_HUE;
+static float tint = PAL_TINT;
+
+/* what pal_generate makes of the default hue and tint, worked out by
+** host/tables.py: the trig is in double, done in software on the ESP32
+*/
+static const rgb_t pal_default[64] =
+{
+#include "nes_pal.inc"
+};
 
 #include <gui.h>
 
@@ -142,6 +154,12 @@ void pal_generate(void)
    float s, y, theta;
    int r, g, b;
 
+   if (PAL_HUE == hue && PAL_TINT == tint)
+   {
+      memcpy(nes_palette, pal_default, sizeof(pal_default));
+      return;
+   }
+
    for (x = 0; x < 4; x++)
    {
       for (z = 0; z < 16; z++)
@@ -38,6 +38,8 @@
 #include "vid_drv.h"
 #include "nes_pal.h"
 #include "nesinput.h"
+#include "nes_arena.h"
+#include "nes_rtrace.h"
 
 /* PPU access */
 #define PPU_MEM(x) ppu.page[(x) >> 10][(x)]
@@ -50,10 +52,321 @@
 #define SP_CLEAR(V) (0 == ((V) & SP_PIXEL))
 
 /* Full BG color */
-#define FULLBG (ppu.palette[0] | BG_TRANS)
+#define FULLBG(l) ((l)->palette[0] | BG_TRANS)
+#define LINE_MEM(l, x) (l)->page[(x) >> 10][(x)]
 
 /* the NES PPU */
 static ppu_t ppu;
+#ifdef NES_PPU_BATCH
+static ppu_worker_t ppu_batchworker;
+static ppu_worker_t *ppu_worker = &ppu_batchworker;
+#else /* !NES_PPU_BATCH */
+static ppu_worker_t *ppu_worker = NULL;
+#endif /* !NES_PPU_BATCH */
+static bool ppu_emphasisswap = false;
+
+/* Sprites in range of each scanline, in OAM order, at most PPU_MAXSPRITE,
+** with the row of the tile to fetch (vertical flip already applied).
+** Rebuilt from OAM when it or the sprite height changes, rather than
+** range-checking all 64 entries on every line.
+*/
+typedef struct obj_slot_s
+{
+   uint8 sprite;
+   uint8 row;
+} obj_slot_t;
+
+static struct
+{
+   uint8 count[240];
+   obj_slot_t slot[240][PPU_MAXSPRITE];
+   uint8 height;        /* sprite height the lists were built for */
+   bool dirty;
+} obj_eval;
+
+/* Palette-high bits (col_high) of every tile of the four nametables,
+** kept up to date as the attribute tables are written, so drawing a
+** background line doesn't have to pick them out of the attribute bytes.
+*/
+static uint8 nt_colhigh[4][30][32];
+
+/* physical nametable behind one of the four logical ones, -1 if it isn't
+** internal PPU RAM
+*/
+static int ppu_ntindex(uint8 * const *page, int nametab)
+{
+   uint32 offset = (uint32)(page[8 + nametab] + 0x2000 + (nametab << 10) - ppu.nametab);
+
+   return (offset < sizeof(ppu.nametab)) ? (int)(offset >> 10) : -1;
+}
+
+/* The pages holding count consecutive 1KB of pattern tables from base, as
+** one pointer to index with the full address, if they're mapped as one
+** block (CHR RAM, 4KB/8KB banks); NULL when they have to be looked up
+** page by page
+*/
+static uint8 *ppu_flatpages(uint8 * const *page, uint32 base, int count)
+{
+   int first = base >> 10, i;
+
+   for (i = 1; i < count; i++)
+   {
+      if (page[first + i] != page[first])
+         return NULL;
+   }
+
+   return page[first];
+}
+
+/* offset is 0x3C0-0x3FF: one attribute byte, four 2x2 tile groups */
+static void ppu_setcolhigh(int nametab, int offset)
+{
+   uint8 attrib = ppu.nametab[(nametab << 10) + offset];
+   int y_tile = ((offset - 0x3C0) >> 3) << 2;
+   int x_tile = ((offset - 0x3C0) & 7) << 2;
+   int x, y;
+
+   for (y = 0; y < 4 && y_tile + y < 30; y++)
+   {
+      for (x = 0; x < 4; x++)
+         nt_colhigh[nametab][y_tile + y][x_tile + x] = ((attrib >> ((x & 2) + ((y & 2) << 1))) & 3) << 2;
+   }
+}
+
+static void ppu_buildcolhigh(void)
+{
+   int nametab, offset;
+
+   for (nametab = 0; nametab < 4; nametab++)
+   {
+      for (offset = 0x3C0; offset < 0x400; offset++)
+         ppu_setcolhigh(nametab, offset);
+   }
+}
+
+INLINE void ppu_attribwrite(uint32 address)
+{
+   uint32 offset = (uint32)(&PPU_MEM(address) - ppu.nametab);
+
+   if (offset < sizeof(ppu.nametab) && (offset & 0x3FF) >= 0x3C0)
+      ppu_setcolhigh(offset >> 10, offset & 0x3FF);
+}
+
+#ifdef NES_PPU_LINEREUSE
+/* Lines that would come out the same as when this frame buffer was last
+** drawn are left alone. Everything a background line is made of gets a
+** stamp off one clock when it changes: bank pointers, CHR-RAM pages,
+** nametable rows and the palette. A line whose registers match the ones it
+** was drawn with, and with no inputs newer than that, is still correct.
+*/
+#define PPU_LINESETS 3           /* frame buffers in rotation */
+#define PPU_LINEVALID 0x80000000
+
+static struct
+{
+   uint32 clock;
+   uint32 page[16];
+   uint32 nt_row[4][32];
+   uint32 palette;
+} ppu_stamp;
+
+static struct
+{
+   bitmap_t *bmp;
+   uint32 state[240];    /* registers the line was drawn with, 0 if not reusable */
+   uint32 drawn[240];    /* clock when it was drawn */
+} ppu_lines[PPU_LINESETS];
+static int ppu_lineset_next = 0;
+
+#define PPU_PAGES_SAVE()   uint8 *saved_pages[16]; memcpy(saved_pages, ppu.page, sizeof(saved_pages))
+#define PPU_PAGES_STAMP()  ppu_stamppages(saved_pages)
+#define PPU_STAMP_VRAM(a)  ppu_stampvram(a)
+#define PPU_STAMP_PAL()    ppu_stamp.palette = ppu_tick()
+
+/* nothing drawn so far can be reused, i.e. something else drew on it */
+void ppu_invalidatelines(void)
+{
+   int i;
+
+   for (i = 0; i < PPU_LINESETS; i++)
+      ppu_lines[i].bmp = NULL;
+}
+
+void ppu_invalidaterows(bitmap_t *bmp, int y, int height)
+{
+   int set;
+
+   for (set = 0; set < PPU_LINESETS; set++)
+   {
+      if (bmp == ppu_lines[set].bmp)
+         break;
+   }
+   if (PPU_LINESETS == set)
+      return;
+
+   if (y < 0)
+   {
+      height += y;
+      y = 0;
+   }
+   if (y + height > NES_SCREEN_HEIGHT)
+      height = NES_SCREEN_HEIGHT - y;
+   if (height > 0)
+      memset(&ppu_lines[set].state[y], 0, height * sizeof(ppu_lines[set].state[0]));
+}
+
+static uint32 ppu_tick(void)
+{
+   /* stamps from before a wraparound would look old */
+   if (0 == ++ppu_stamp.clock)
+   {
+      memset(&ppu_stamp, 0, sizeof(ppu_stamp));
+      ppu_invalidatelines();
+      ppu_stamp.clock = 1;
+   }
+
+   return ppu_stamp.clock;
+}
+
+static void ppu_stamppages(uint8 * const *saved_pages)
+{
+   int i;
+
+   for (i = 0; i < 16; i++)
+   {
+      if (saved_pages[i] != ppu.page[i])
+         ppu_stamp.page[i] = ppu_tick();
+   }
+}
+
+static void ppu_stampvram(uint32 address)
+{
+   uint32 offset = (uint32)(&PPU_MEM(address) - ppu.nametab);
+   uint32 now = ppu_tick();
+
+   if (offset < sizeof(ppu.nametab))
+   {
+      uint32 *rows = ppu_stamp.nt_row[offset >> 10];
+
+      offset &= 0x3FF;
+      rows[offset >> 5] = now;
+
+      /* an attribute byte covers four rows of tiles */
+      if (offset >= 0x3C0)
+      {
+         rows += ((offset - 0x3C0) >> 3) << 2;
+         rows[0] = rows[1] = rows[2] = rows[3] = now;
+      }
+   }
+   else
+   {
+      ppu_stamp.page[address >> 10] = now;
+   }
+}
+
+/* Check whether the line already in the buffer is the one we'd draw, and
+** if not, record what it's about to be drawn with
+*/
+static bool ppu_linereused(bitmap_t *bmp, int scanline)
+{
+   uint32 state, newest;
+   int set;
+
+   for (set = 0; set < PPU_LINESETS; set++)
+   {
+      if (bmp == ppu_lines[set].bmp)
+         break;
+   }
+
+   if (PPU_LINESETS == set)
+   {
+      /* line buffers shared between scanlines can't be tracked */
+      if (bmp->sharedlines)
+         return false;
+
+      set = ppu_lineset_next;
+      ppu_lineset_next = (ppu_lineset_next + 1) % PPU_LINESETS;
+      ppu_lines[set].bmp = bmp;
+      memset(ppu_lines[set].state, 0, sizeof(ppu_lines[set].state));
+   }
+
+   state = PPU_LINEVALID;
+   newest = ppu_stamp.palette;
+
+   /* mid-line latching, ExRAM and sprites aren't tracked, those lines get drawn */
+   if (ppu.latchfunc || ppu.exattr || (ppu.obj_on && ppu.drawsprites && obj_eval.count[scanline]))
+   {
+      state = 0;
+   }
+   else if (ppu.bg_on)
+   {
+      int y_tile = (ppu.vaddr >> 5) & 0x1F;
+      int nametab = (ppu.vaddr >> 10) & 3;
+      int nt1 = ppu_ntindex(ppu.page, nametab);
+      int nt2 = ppu_ntindex(ppu.page, nametab ^ 1);
+      int page = ppu.bg_base >> 10;
+      int i;
+
+      /* rows 30 and 31 are the attribute tables */
+      if (y_tile >= 30 || nt1 < 0 || nt2 < 0)
+      {
+         state = 0;
+      }
+      else
+      {
+         state |= (ppu.vaddr & 0x7FFF) | (ppu.tile_xofs << 15) | (ppu.bg_base << 6)
+                  | (ppu.bg_mask ? (1 << 20) : 0) | (1 << 21);
+
+         for (i = page; i < page + 4; i++)
+         {
+            if (ppu_stamp.page[i] > newest)
+               newest = ppu_stamp.page[i];
+         }
+         if (ppu_stamp.page[8 + nametab] > newest)
+            newest = ppu_stamp.page[8 + nametab];
+         if (ppu_stamp.page[8 + (nametab ^ 1)] > newest)
+            newest = ppu_stamp.page[8 + (nametab ^ 1)];
+         if (ppu_stamp.nt_row[nt1][y_tile] > newest)
+            newest = ppu_stamp.nt_row[nt1][y_tile];
+         if (ppu_stamp.nt_row[nt2][y_tile] > newest)
+            newest = ppu_stamp.nt_row[nt2][y_tile];
+      }
+   }
+
+   if (state && state == ppu_lines[set].state[scanline] && newest <= ppu_lines[set].drawn[scanline])
+      return true;
+
+   ppu_lines[set].state[scanline] = state;
+   ppu_lines[set].drawn[scanline] = ppu_stamp.clock;
+   return false;
+}
+#else /* !NES_PPU_LINEREUSE */
+#define PPU_PAGES_SAVE()
+#define PPU_PAGES_STAMP()
+#define PPU_STAMP_VRAM(a)
+#define PPU_STAMP_PAL()
+
+void ppu_invalidatelines(void)
+{
+}
+
+void ppu_invalidaterows(bitmap_t *bmp, int y, int height)
+{
+}
+#endif /* !NES_PPU_LINEREUSE */
+
+/* lines handed to the worker may still be reading VRAM/OAM */
+INLINE void ppu_syncworker(void)
+{
+   if (ppu_worker)
+      ppu_worker->sync();
+}
+
+void ppu_setworker(ppu_worker_t *worker)
+{
+   ppu_syncworker();
+   ppu_worker = worker;
+}
 
 void ppu_displaysprites(bool display)
 {
@@ -65,6 +378,9 @@ void ppu_setcontext(ppu_t *src_ppu)
    int nametab[4];
    ASSERT(src_ppu);
    ppu = *src_ppu;
+   obj_eval.dirty = true;
+   ppu_invalidatelines();
+   ppu_buildcolhigh();
 
    /* we can't just copy contexts here, because more than likely,
    ** the top 8 pages of the ppu are pointing to internal PPU memory,
@@ -87,6 +403,8 @@ void ppu_setcontext(ppu_t *src_ppu)
    ppu.page[13] = ppu.page[9] - 0x1000;
    ppu.page[14] = ppu.page[10] - 0x1000;
    ppu.page[15] = ppu.page[11] - 0x1000;
+
+   RTRACE(rtrace_context());
 }
 
 void ppu_getcontext(ppu_t *dest_ppu)
@@ -119,17 +437,83 @@ void ppu_getcontext(ppu_t *dest_ppu)
    dest_ppu->page[15] = dest_ppu->page[11] - 0x1000;
 }
 
+/* Pattern decode tables: each bitplane byte spread out to one byte
+** per pixel, left pixel first, and the same mirrored for h-flipped
+** sprites.  A tile row is then two ORs per word instead of the
+** bit-interleave and eight shift-and-masks, for any CHR contents --
+** so there's nothing to rebuild on bankswitches or CHR-RAM writes.
+*/
+typedef union
+{
+   uint32 word[2];
+   uint8 pixel[8];
+} ppu_tilerow_t;
+
+static ppu_tilerow_t chr_expand[256], chr_expand_flip[256];
+static uint8 chr_flipbits[256];
+
+static void ppu_buildchrluts(void)
+{
+   int value, pixel;
+
+   for (value = 0; value < 256; value++)
+   {
+      chr_flipbits[value] = 0;
+      for (pixel = 0; pixel < 8; pixel++)
+      {
+         chr_expand[value].pixel[pixel] = (value >> (7 - pixel)) & 1;
+         chr_expand_flip[value].pixel[pixel] = (value >> pixel) & 1;
+         chr_flipbits[value] |= ((value >> pixel) & 1) << (7 - pixel);
+      }
+   }
+}
+
+/* A line's pixels a bit each, leftmost in bit 7 of byte x / 8 like a
+** pattern byte: bg is where the background is solid, made by the
+** background pass; sp is where a sprite took the pixel, made as the
+** sprites go. The byte past the end is for sprites running off the right.
+*/
+typedef struct ppu_masks_s
+{
+   uint8 bg[NES_SCREEN_WIDTH / 8 + 1];
+   uint8 sp[NES_SCREEN_WIDTH / 8 + 1];
+} ppu_masks_t;
+
+/* the 8 bits of pixels x to x + 7 */
+#define PPU_MASKBITS(m, x) \
+   ((uint8) ((((m)[(x) >> 3] << 8) | (m)[((x) >> 3) + 1]) >> (8 - ((x) & 7))))
+
+INLINE void ppu_setmaskbits(uint8 *mask, int x, uint8 bits)
+{
+   mask[x >> 3] |= bits >> (x & 7);
+   mask[(x >> 3) + 1] |= (uint8) (bits << (8 - (x & 7)));
+}
+
+/* the two bitplanes of a row, as one 0-3 color index per pixel */
+#define DECODE_TILEROW(row, table, pat1, pat2)                              \
+   {                                                                        \
+      (row).word[0] = (table)[pat1].word[0] | ((table)[pat2].word[0] << 1); \
+      (row).word[1] = (table)[pat1].word[1] | ((table)[pat2].word[1] << 1); \
+   }
+
+/* four decoded pixels resolved through the palette into one word,
+** leftmost pixel in the low byte (little-endian framebuffer)
+*/
+#define BG_QUAD(colors, w)                                                   \
+   ((uint32) (colors)[(w) & 3]                                               \
+    | ((uint32) (colors)[((w) >> 8) & 3] << 8)                               \
+    | ((uint32) (colors)[((w) >> 16) & 3] << 16)                             \
+    | ((uint32) (colors)[(w) >> 24] << 24))
+
 ppu_t *ppu_create(void)
 {
    static bool pal_generated = false;
    ppu_t *temp;
 
-   temp = malloc(sizeof(ppu_t));
+   temp = arena_alloc(ARENA_FAST, sizeof(ppu_t));
    if (NULL == temp)
       return NULL;
 
-   memset(temp, 0, sizeof(ppu_t));
-
    temp->latchfunc = NULL;
    temp->vromswitch = NULL;
    temp->vram_present = false;
@@ -139,6 +523,7 @@ ppu_t *ppu_create(void)
    if (false == pal_generated)
    {
       pal_generate();
+      ppu_buildchrluts();
       pal_generated = true;
    }
 
@@ -149,15 +534,24 @@ ppu_t *ppu_create(void)
 
 void ppu_destroy(ppu_t **src_ppu)
 {
+   /* the worker may still be drawing from the pages being freed */
+   ppu_syncworker();
+
    if (*src_ppu)
    {
-      free(*src_ppu);
+      arena_free(*src_ppu);
       *src_ppu = NULL;
    }
 }
 
 void ppu_setpage(int size, int page_num, uint8 *location)
 {
+#ifdef NES_RENDERTRACE
+   int first = page_num;
+#endif
+
+   PPU_PAGES_SAVE();
+
    /* deliberately fall through */
    switch (size)
    {
@@ -175,19 +569,29 @@ void ppu_setpage(int size, int page_num, uint8 *location)
       ppu.page[page_num++] = location;
       break;
    }
+
+   PPU_PAGES_STAMP();
+   RTRACE(rtrace_pages(first, page_num - first));
 }
 
 /* make sure $3000-$3F00 mirrors $2000-$2F00 */
 void ppu_mirrorhipages(void)
 {
+   PPU_PAGES_SAVE();
+
    ppu.page[12] = ppu.page[8] - 0x1000;
    ppu.page[13] = ppu.page[9] - 0x1000;
    ppu.page[14] = ppu.page[10] - 0x1000;
    ppu.page[15] = ppu.page[11] - 0x1000;
+
+   PPU_PAGES_STAMP();
+   RTRACE(rtrace_pages(12, 4));
 }
 
 void ppu_mirror(int nt1, int nt2, int nt3, int nt4)
 {
+   PPU_PAGES_SAVE();
+
    ppu.page[8] = ppu.nametab + (nt1 << 10) - 0x2000;
    ppu.page[9] = ppu.nametab + (nt2 << 10) - 0x2400;
    ppu.page[10] = ppu.nametab + (nt3 << 10) - 0x2800;
@@ -196,6 +600,9 @@ void ppu_mirror(int nt1, int nt2, int nt3, int nt4)
    ppu.page[13] = ppu.page[9] - 0x1000;
    ppu.page[14] = ppu.page[10] - 0x1000;
    ppu.page[15] = ppu.page[11] - 0x1000;
+
+   PPU_PAGES_STAMP();
+   RTRACE(rtrace_pages(8, 8));
 }
 
 /* bleh, for snss */
@@ -204,19 +611,39 @@ uint8 *ppu_getpage(int page)
    return ppu.page[page];
 }
 
-static void mem_trash(uint8 *buffer, int length)
+#ifdef NES_RENDERTRACE
+/* the live PPU, for the render trace's keyframes and replays */
+ppu_t *ppu_tracecontext(void)
 {
-   int i;
+   return &ppu;
+}
 
-   for (i = 0; i < length; i++)
-      buffer[i] = (uint8)rand();
+/* after the live PPU's memory or registers were changed behind its back */
+void ppu_refresh(void)
+{
+   ppu_syncworker();
+   obj_eval.dirty = true;
+   ppu_invalidatelines();
+   ppu_buildcolhigh();
 }
 
+/* OAM as a DMA left it */
+void ppu_setoam(const uint8 *oam)
+{
+   ppu_syncworker();
+   memcpy(ppu.oam, oam, sizeof(ppu.oam));
+   obj_eval.dirty = true;
+}
+#endif /* NES_RENDERTRACE */
+
 /* reset state of ppu */
 void ppu_reset(int reset_type)
 {
    if (HARD_RESET == reset_type)
-      mem_trash(ppu.oam, 256);
+      nes_memtrash(ppu.oam, 256);
+   obj_eval.dirty = true;
+   ppu_invalidatelines();
+   ppu_buildcolhigh();
 
    ppu.ctrl0 = 0;
    ppu.ctrl1 = PPU_CTRL1F_OBJON | PPU_CTRL1F_BGON;
@@ -228,6 +655,8 @@ void ppu_reset(int reset_type)
 
    ppu.latch = 0;
    ppu.vram_accessible = true;
+
+   RTRACE(rtrace_context());
 }
 
 /* we render a scanline of graphics first so we know exactly
@@ -248,35 +677,42 @@ static void ppu_setstrike(int x_loc)
 static void ppu_oamdma(uint8 value)
 {
    uint32 cpu_address;
-   uint8 oam_loc;
+   const uint8 *page;
+   uint8 copy[256];
+   int i;
+
+   ppu_syncworker();
 
+   /* RAM or ROM, as it nearly always is, is copied straight out */
    cpu_address = (uint32)(value << 8);
+   page = nes6502_getpage(cpu_address);
+   if (NULL == page)
+   {
+      for (i = 0; i < 256; i++)
+         copy[i] = nes6502_getbyte(cpu_address + i);
+      page = copy;
+   }
 
    /* Sprite DMA starts at the current SPRRAM address */
-   oam_loc = ppu.oam_addr;
-   do
-   {
-      ppu.oam[oam_loc++] = nes6502_getbyte(cpu_address++);
-   } while (oam_loc != ppu.oam_addr);
+   memcpy(ppu.oam + ppu.oam_addr, page, 256 - ppu.oam_addr);
+   memcpy(ppu.oam, page + 256 - ppu.oam_addr, ppu.oam_addr);
 
    /* TODO: enough with houdini */
-   cpu_address -= 256;
    /* Odd address in $2003 */
    if ((ppu.oam_addr >> 2) & 1)
    {
-      for (oam_loc = 4; oam_loc < 8; oam_loc++)
-         ppu.oam[oam_loc] = nes6502_getbyte(cpu_address++);
-      cpu_address += 248;
-      for (oam_loc = 0; oam_loc < 4; oam_loc++)
-         ppu.oam[oam_loc] = nes6502_getbyte(cpu_address++);
+      memcpy(ppu.oam + 4, page, 4);
+      memcpy(ppu.oam, page + 252, 4);
    }
    /* Even address in $2003 */
    else
    {
-      for (oam_loc = 0; oam_loc < 8; oam_loc++)
-         ppu.oam[oam_loc] = nes6502_getbyte(cpu_address++);
+      memcpy(ppu.oam, page, 8);
    }
 
+   obj_eval.dirty = true;
+   RTRACE(rtrace_oam(ppu.oam));
+
    /* make the CPU spin for DMA cycles */
    nes6502_burn(513);
    nes6502_release();
@@ -345,6 +781,8 @@ uint8 ppu_read(uint32 address)
 {
    uint8 value;
 
+   RTRACE(rtrace_read(address));
+
    /* handle mirrored reads up to $3FFF */
    switch (address & 0x2007)
    {
@@ -370,7 +808,7 @@ uint8 ppu_read(uint32 address)
       if ((ppu.bg_on || ppu.obj_on) && !ppu.vram_accessible)
       {
          ppu.vdata_latch = 0xFF;
-         log_printf("VRAM read at $%04X, scanline %d\n",
+         log_printf(LOG_DEBUG "VRAM read at $%04X, scanline %d\n",
                     ppu.vaddr, nes_getcontextptr()->scanline);
       }
       else
@@ -402,6 +840,8 @@ uint8 ppu_read(uint32 address)
 /* Write to $2000-$2007 */
 void ppu_write(uint32 address, uint8 value)
 {
+   RTRACE(rtrace_write(address, value));
+
    /* write goes into ppu latch... */
    ppu.latch = value;
 
@@ -435,7 +875,9 @@ void ppu_write(uint32 address, uint8 value)
       break;
 
    case PPU_OAMDATA:
+      ppu_syncworker();
       ppu.oam[ppu.oam_addr++] = value;
+      obj_eval.dirty = true;
       break;
 
    case PPU_SCROLL:
@@ -478,14 +920,17 @@ void ppu_write(uint32 address, uint8 value)
       break;
 
    case PPU_VDATA:
+      ppu_syncworker();
       if (ppu.vaddr < 0x3F00)
       {
          /* VRAM only accessible during scanlines 241-260 */
          if ((ppu.bg_on || ppu.obj_on) && !ppu.vram_accessible)
          {
-            log_printf("VRAM write to $%04X, scanline %d\n",
+            log_printf(LOG_DEBUG "VRAM write to $%04X, scanline %d\n",
                        ppu.vaddr, nes_getcontextptr()->scanline);
             PPU_MEM(ppu.vaddr) = 0xFF; /* corrupt */
+            PPU_STAMP_VRAM(ppu.vaddr);
+            ppu_attribwrite(ppu.vaddr);
          }
          else
          {
@@ -495,6 +940,8 @@ void ppu_write(uint32 address, uint8 value)
                ppu.vaddr -= 0x1000;
 
             PPU_MEM(addr) = value;
+            PPU_STAMP_VRAM(addr);
+            ppu_attribwrite(addr);
          }
       }
       else
@@ -510,6 +957,8 @@ void ppu_write(uint32 address, uint8 value)
          {
             ppu.palette[ppu.vaddr & 0x1F] = value & 0x3F;
          }
+
+         PPU_STAMP_PAL();
       }
 
       ppu.vaddr += ppu.vaddr_inc;
@@ -560,6 +1009,42 @@ void ppu_setdefaultpal(ppu_t *src_ppu)
    ppu_setpal(src_ppu, nes_palette);
 }
 
+/* hand the video driver the palette at half brightness, or back as built */
+void ppu_dimpal(ppu_t *src_ppu, bool dim)
+{
+   rgb_t pal[256];
+   int i;
+
+   if (false == dim)
+   {
+      vid_setpalette(src_ppu->curpal);
+      return;
+   }
+
+   for (i = 0; i < 256; i++)
+   {
+      pal[i].r = src_ppu->curpal[i].r >> 1;
+      pal[i].g = src_ppu->curpal[i].g >> 1;
+      pal[i].b = src_ppu->curpal[i].b >> 1;
+   }
+   vid_setpalette(pal);
+}
+
+/* $2001 bit 5 is red on NTSC and green on PAL, and bit 6 the other one */
+void ppu_setemphasisswap(bool swap)
+{
+   ppu_emphasisswap = swap;
+}
+
+INLINE uint8 ppu_emphasis(void)
+{
+   uint8 emphasis = (ppu.ctrl1 & PPU_CTRL1F_EMPHASIS) >> 5;
+
+   if (ppu_emphasisswap)
+      emphasis = (emphasis & 4) | ((emphasis & 1) << 1) | ((emphasis >> 1) & 1);
+   return emphasis;
+}
+
 void ppu_setlatchfunc(ppulatchfunc_t func)
 {
    ppu.latchfunc = func;
@@ -570,200 +1055,324 @@ void ppu_setvromswitch(ppuvromswitch_t func)
    ppu.vromswitch = func;
 }
 
+void ppu_setexattr(const uint8 *exram, const uint8 *chr, int chr_banks, int chr_hi)
+{
+   ppu.exattr = exram;
+   ppu.exchr = chr;
+   ppu.exchr_mask = chr_banks - 1;
+   ppu.exchr_hi = chr_hi;
+}
+
 /* rendering routines */
 INLINE void draw_bgtile(uint8 *surface, uint8 pat1, uint8 pat2,
                         const uint8 *colors)
 {
-   uint32 pattern = ((pat2 & 0xAA) << 8) | ((pat2 & 0x55) << 1) | ((pat1 & 0xAA) << 7) | (pat1 & 0x55);
+   ppu_tilerow_t row;
+
+   DECODE_TILEROW(row, chr_expand, pat1, pat2);
+
+   surface[0] = colors[row.pixel[0]];
+   surface[1] = colors[row.pixel[1]];
+   surface[2] = colors[row.pixel[2]];
+   surface[3] = colors[row.pixel[3]];
+   surface[4] = colors[row.pixel[4]];
+   surface[5] = colors[row.pixel[5]];
+   surface[6] = colors[row.pixel[6]];
+   surface[7] = colors[row.pixel[7]];
+}
+
+/* same as draw_bgtile, but two aligned word stores instead of eight bytes */
+INLINE void draw_bgtile32(uint32 *surface, uint8 pat1, uint8 pat2,
+                          const uint8 *colors)
+{
+   ppu_tilerow_t row;
 
-   *surface++ = colors[(pattern >> 14) & 3];
-   *surface++ = colors[(pattern >> 6) & 3];
-   *surface++ = colors[(pattern >> 12) & 3];
-   *surface++ = colors[(pattern >> 4) & 3];
-   *surface++ = colors[(pattern >> 10) & 3];
-   *surface++ = colors[(pattern >> 2) & 3];
-   *surface++ = colors[(pattern >> 8) & 3];
-   *surface = colors[pattern & 3];
+   DECODE_TILEROW(row, chr_expand, pat1, pat2);
+
+   surface[0] = BG_QUAD(colors, row.word[0]);
+   surface[1] = BG_QUAD(colors, row.word[1]);
 }
 
-INLINE int draw_oamtile(uint8 *surface, uint8 attrib, uint8 pat1,
-                        uint8 pat2, const uint8 *col_tbl, bool check_strike)
+/* One sprite row at x_loc. Which pixels it shows is all mask work: its
+** own opaque bits against what earlier sprites took and, for one behind
+** the background, where that's solid; only the pixels it paints are
+** decoded and written. A pixel it's behind still gets SP_PIXEL, as the
+** line's other users expect.
+*/
+INLINE int draw_oamtile(uint8 *surface, ppu_masks_t *masks, int x_loc, uint8 attrib,
+                        uint8 pat1, uint8 pat2, const uint8 *col_tbl, bool check_strike)
 {
    int strike_pixel = -1;
-   uint32 color = ((pat2 & 0xAA) << 8) | ((pat2 & 0x55) << 1) | ((pat1 & 0xAA) << 7) | (pat1 & 0x55);
+   ppu_tilerow_t row;
+   uint8 opaque, bg, paint, tag;
+   int i;
+
+   opaque = pat1 | pat2;
+   if (attrib & OAMF_HFLIP)
+      opaque = chr_flipbits[opaque];
+
+   /* off the right edge */
+   if (x_loc > NES_SCREEN_WIDTH - 8)
+      opaque &= 0xFF << (x_loc - (NES_SCREEN_WIDTH - 8));
 
    /* sprite is not 100% transparent */
-   if (color)
+   if (0 == opaque)
+      return -1;
+
+   bg = PPU_MASKBITS(masks->bg, x_loc);
+
+   /* leftmost solid sprite pixel over a solid bg pixel */
+   if (check_strike && (opaque & bg))
    {
-      uint8 colors[8];
+      for (strike_pixel = 0; 0 == (opaque & bg & (0x80 >> strike_pixel)); strike_pixel++)
+         ;
+   }
 
-      /* swap pixels around if our tile is flipped */
+   paint = opaque & ~PPU_MASKBITS(masks->sp, x_loc);
+   ppu_setmaskbits(masks->sp, x_loc, opaque);
+   tag = 0;
+   if (attrib & OAMF_BEHIND)
+   {
+      tag = paint & bg;
+      paint &= ~bg;
+   }
+
+   if (paint)
+   {
+      /* flipped tiles come out of the mirrored table */
       if (0 == (attrib & OAMF_HFLIP))
-      {
-         colors[0] = (color >> 14) & 3;
-         colors[1] = (color >> 6) & 3;
-         colors[2] = (color >> 12) & 3;
-         colors[3] = (color >> 4) & 3;
-         colors[4] = (color >> 10) & 3;
-         colors[5] = (color >> 2) & 3;
-         colors[6] = (color >> 8) & 3;
-         colors[7] = color & 3;
-      }
+         DECODE_TILEROW(row, chr_expand, pat1, pat2)
       else
-      {
-         colors[7] = (color >> 14) & 3;
-         colors[6] = (color >> 6) & 3;
-         colors[5] = (color >> 12) & 3;
-         colors[4] = (color >> 4) & 3;
-         colors[3] = (color >> 10) & 3;
-         colors[2] = (color >> 2) & 3;
-         colors[1] = (color >> 8) & 3;
-         colors[0] = color & 3;
-      }
+         DECODE_TILEROW(row, chr_expand_flip, pat1, pat2)
 
-      /* check for solid sprite pixel overlapping solid bg pixel */
-      if (check_strike)
+      for (i = 0; paint; i++, paint <<= 1)
       {
-         if (colors[0] && BG_SOLID(surface[0]))
-            strike_pixel = 0;
-         else if (colors[1] && BG_SOLID(surface[1]))
-            strike_pixel = 1;
-         else if (colors[2] && BG_SOLID(surface[2]))
-            strike_pixel = 2;
-         else if (colors[3] && BG_SOLID(surface[3]))
-            strike_pixel = 3;
-         else if (colors[4] && BG_SOLID(surface[4]))
-            strike_pixel = 4;
-         else if (colors[5] && BG_SOLID(surface[5]))
-            strike_pixel = 5;
-         else if (colors[6] && BG_SOLID(surface[6]))
-            strike_pixel = 6;
-         else if (colors[7] && BG_SOLID(surface[7]))
-            strike_pixel = 7;
+         if (paint & 0x80)
+            surface[i] = SP_PIXEL | col_tbl[row.pixel[i]];
       }
+   }
 
-      /* draw the character */
-      if (attrib & OAMF_BEHIND)
-      {
-         if (colors[0])
-            surface[0] = SP_PIXEL | (BG_CLEAR(surface[0]) ? col_tbl[colors[0]] : surface[0]);
-         if (colors[1])
-            surface[1] = SP_PIXEL | (BG_CLEAR(surface[1]) ? col_tbl[colors[1]] : surface[1]);
-         if (colors[2])
-            surface[2] = SP_PIXEL | (BG_CLEAR(surface[2]) ? col_tbl[colors[2]] : surface[2]);
-         if (colors[3])
-            surface[3] = SP_PIXEL | (BG_CLEAR(surface[3]) ? col_tbl[colors[3]] : surface[3]);
-         if (colors[4])
-            surface[4] = SP_PIXEL | (BG_CLEAR(surface[4]) ? col_tbl[colors[4]] : surface[4]);
-         if (colors[5])
-            surface[5] = SP_PIXEL | (BG_CLEAR(surface[5]) ? col_tbl[colors[5]] : surface[5]);
-         if (colors[6])
-            surface[6] = SP_PIXEL | (BG_CLEAR(surface[6]) ? col_tbl[colors[6]] : surface[6]);
-         if (colors[7])
-            surface[7] = SP_PIXEL | (BG_CLEAR(surface[7]) ? col_tbl[colors[7]] : surface[7]);
-      }
-      else
-      {
-         if (colors[0] && SP_CLEAR(surface[0]))
-            surface[0] = SP_PIXEL | col_tbl[colors[0]];
-         if (colors[1] && SP_CLEAR(surface[1]))
-            surface[1] = SP_PIXEL | col_tbl[colors[1]];
-         if (colors[2] && SP_CLEAR(surface[2]))
-            surface[2] = SP_PIXEL | col_tbl[colors[2]];
-         if (colors[3] && SP_CLEAR(surface[3]))
-            surface[3] = SP_PIXEL | col_tbl[colors[3]];
-         if (colors[4] && SP_CLEAR(surface[4]))
-            surface[4] = SP_PIXEL | col_tbl[colors[4]];
-         if (colors[5] && SP_CLEAR(surface[5]))
-            surface[5] = SP_PIXEL | col_tbl[colors[5]];
-         if (colors[6] && SP_CLEAR(surface[6]))
-            surface[6] = SP_PIXEL | col_tbl[colors[6]];
-         if (colors[7] && SP_CLEAR(surface[7]))
-            surface[7] = SP_PIXEL | col_tbl[colors[7]];
-      }
+   for (i = 0; tag; i++, tag <<= 1)
+   {
+      if (tag & 0x80)
+         surface[i] |= SP_PIXEL;
    }
 
    return strike_pixel;
 }
 
-static void ppu_renderbg(uint8 *vidbuf)
+/* move a staged line of 33 tiles into place, scrolled left by xofs pixels */
+static void ppu_scrollline(uint32 *dest, const uint32 *stage, int xofs)
 {
-   uint8 *bmp_ptr, *data_ptr, *tile_ptr, *attrib_ptr;
-   uint32 refresh_vaddr, bg_offset, attrib_base;
-   int tile_count;
-   uint8 tile_index, x_tile, y_tile;
-   uint8 col_high, attrib, attrib_shift;
+   const uint32 *src = stage + (xofs >> 2);
+   int shift = (xofs & 3) << 3;
+   int i;
 
-   /* draw a line of transparent background color if bg is disabled */
-   if (false == ppu.bg_on)
+   if (0 == shift)
    {
-      memset(vidbuf, FULLBG, NES_SCREEN_WIDTH);
-      return;
+      for (i = 0; i < NES_SCREEN_WIDTH / 4; i++)
+         dest[i] = src[i];
+   }
+   else
+   {
+      for (i = 0; i < NES_SCREEN_WIDTH / 4; i++)
+         dest[i] = (src[i] >> shift) | (src[i + 1] << (32 - shift));
+   }
+}
+
+/* The general case: 33 tiles with the attribute maths done as we go, and
+** the $FD/$FE tile latch called for each of them (MMC2/MMC4).  Made once
+** per kind of board, so the ones without a latch don't test for it every
+** tile; MMC5's extended attribute mode gets its own copy as well.
+*/
+#define PPU_MAKE_RENDERBGTILES(name, LATCH, EXATTR)                                              \
+   static void name(const ppu_line_t *line, uint32 *bmp_ptr, uint32 *stage, uint8 *mask_ptr)     \
+   {                                                                                             \
+      uint8 *data_ptr, *tile_ptr, *attrib_ptr;                                                   \
+      uint32 *line_end;                                                                          \
+      uint32 refresh_vaddr, bg_offset, attrib_base;                                              \
+      int tile_count;                                                                            \
+      uint8 tile_index, x_tile, y_tile;                                                          \
+      uint8 col_high, attrib, attrib_shift;                                                      \
+                                                                                                 \
+      line_end = (uint32 *) (line->buf + NES_SCREEN_WIDTH);                                      \
+                                                                                                 \
+      refresh_vaddr = 0x2000 + (line->vaddr & 0x0FE0); /* mask out x tile */                     \
+      x_tile = line->vaddr & 0x1F;                                                               \
+      y_tile = (line->vaddr >> 5) & 0x1F;                  /* to simplify calculations */        \
+      bg_offset = ((line->vaddr >> 12) & 7) + line->bg_base; /* offset in y tile */              \
+                                                                                                 \
+      /* calculate initial values */                                                             \
+      tile_ptr = &LINE_MEM(line, refresh_vaddr + x_tile); /* pointer to tile index */            \
+      attrib_base = (refresh_vaddr & 0x2C00) + 0x3C0 + ((y_tile & 0x1C) << 1);                   \
+      attrib_ptr = &LINE_MEM(line, attrib_base + (x_tile >> 2));                                 \
+      attrib = *attrib_ptr++;                                                                    \
+      attrib_shift = (x_tile & 2) + ((y_tile & 2) << 1);                                         \
+      col_high = ((attrib >> attrib_shift) & 3) << 2;                                            \
+                                                                                                 \
+      /* ppu fetches 33 tiles */                                                                 \
+      tile_count = 33;                                                                           \
+      while (tile_count--)                                                                       \
+      {                                                                                          \
+         /* Tile number from nametable */                                                        \
+         tile_index = *tile_ptr++;                                                               \
+         data_ptr = &LINE_MEM(line, bg_offset + (tile_index << 4));                              \
+                                                                                                 \
+         /* MMC5 extended attributes: a 4KB CHR bank and palette per tile */                     \
+         if (EXATTR)                                                                             \
+         {                                                                                       \
+            uint8 ex = ppu.exattr[(refresh_vaddr + x_tile) & 0x3FF];                             \
+            uint32 bank = ((ex & 0x3F) | ppu.exchr_hi) & ppu.exchr_mask;                         \
+                                                                                                 \
+            data_ptr = (uint8 *) ppu.exchr + (bank << 12) + (bg_offset & 7) + (tile_index << 4); \
+            col_high = (ex >> 6) << 2;                                                           \
+         }                                                                                       \
+                                                                                                 \
+         /* Handle $FD/$FE tile VROM switching (PunchOut) */                                     \
+         if (LATCH)                                                                              \
+            ppu.latchfunc(line->bg_base, tile_index);                                            \
+                                                                                                 \
+         /* 33rd tile is offscreen when unscrolled, but still gets fetched */                    \
+         if (bmp_ptr == line_end)                                                                \
+            bmp_ptr = stage;                                                                     \
+                                                                                                 \
+         draw_bgtile32(bmp_ptr, data_ptr[0], data_ptr[8], line->palette + col_high);             \
+         bmp_ptr += 2;                                                                           \
+         *mask_ptr++ = data_ptr[0] | data_ptr[8];                                                \
+                                                                                                 \
+         x_tile++;                                                                               \
+                                                                                                 \
+         if (0 == (x_tile & 1)) /* check every 2 tiles */                                        \
+         {                                                                                       \
+            if (0 == (x_tile & 3)) /* check every 4 tiles */                                     \
+            {                                                                                    \
+               if (32 == x_tile) /* check every 32 tiles */                                      \
+               {                                                                                 \
+                  x_tile = 0;                                                                    \
+                  refresh_vaddr ^= (1 << 10); /* switch nametable */                             \
+                  attrib_base ^= (1 << 10);                                                      \
+                                                                                                 \
+                  /* recalculate pointers */                                                     \
+                  tile_ptr = &LINE_MEM(line, refresh_vaddr);                                     \
+                  attrib_ptr = &LINE_MEM(line, attrib_base);                                     \
+               }                                                                                 \
+                                                                                                 \
+               /* Get the attribute byte */                                                      \
+               attrib = *attrib_ptr++;                                                           \
+            }                                                                                    \
+                                                                                                 \
+            attrib_shift ^= 2;                                                                   \
+            col_high = ((attrib >> attrib_shift) & 3) << 2;                                      \
+         }                                                                                       \
+      }                                                                                          \
    }
 
-   bmp_ptr = vidbuf - ppu.tile_xofs;              /* scroll x */
-   refresh_vaddr = 0x2000 + (ppu.vaddr & 0x0FE0); /* mask out x tile */
-   x_tile = ppu.vaddr & 0x1F;
-   y_tile = (ppu.vaddr >> 5) & 0x1F;                  /* to simplify calculations */
-   bg_offset = ((ppu.vaddr >> 12) & 7) + ppu.bg_base; /* offset in y tile */
+PPU_MAKE_RENDERBGTILES(ppu_renderbgtiles_plain, 0, 0)
+PPU_MAKE_RENDERBGTILES(ppu_renderbgtiles_latch, 1, 0)
+PPU_MAKE_RENDERBGTILES(ppu_renderbgtiles_exattr, 0, 1)
 
-   /* calculate initial values */
-   tile_ptr = &PPU_MEM(refresh_vaddr + x_tile); /* pointer to tile index */
-   attrib_base = (refresh_vaddr & 0x2C00) + 0x3C0 + ((y_tile & 0x1C) << 1);
-   attrib_ptr = &PPU_MEM(attrib_base + (x_tile >> 2));
-   attrib = *attrib_ptr++;
-   attrib_shift = (x_tile & 2) + ((y_tile & 2) << 1);
-   col_high = ((attrib >> attrib_shift) & 3) << 2;
+/* A run of tiles from one nametable row, col_high from nt_colhigh */
+INLINE uint32 *ppu_renderbgrun(const ppu_line_t *line, uint32 *bmp_ptr, uint8 *mask_ptr,
+                               const uint8 *tile_ptr, const uint8 *colhigh_ptr, const uint8 *pat_ptr,
+                               uint32 bg_offset, int tile_count)
+{
+   const uint8 *data_ptr;
+   uint32 tile_adr;
 
-   /* ppu fetches 33 tiles */
-   tile_count = 33;
    while (tile_count--)
    {
-      /* Tile number from nametable */
-      tile_index = *tile_ptr++;
-      data_ptr = &PPU_MEM(bg_offset + (tile_index << 4));
+      tile_adr = bg_offset + (*tile_ptr++ << 4);
+      data_ptr = pat_ptr ? pat_ptr + tile_adr : &LINE_MEM(line, tile_adr);
+      draw_bgtile32(bmp_ptr, data_ptr[0], data_ptr[8], line->palette + *colhigh_ptr++);
+      bmp_ptr += 2;
+      *mask_ptr++ = data_ptr[0] | data_ptr[8];
+   }
 
-      /* Handle $FD/$FE tile VROM switching (PunchOut) */
-      if (ppu.latchfunc)
-         ppu.latchfunc(ppu.bg_base, tile_index);
+   return bmp_ptr;
+}
 
-      draw_bgtile(bmp_ptr, data_ptr[0], data_ptr[8], ppu.palette + col_high);
-      bmp_ptr += 8;
+static void ppu_renderbg(const ppu_line_t *line, ppu_masks_t *masks)
+{
+   uint8 *vidbuf = line->buf;
+   uint32 *bmp_ptr;
+   uint32 stage[33 * 2]; /* 33 tiles, for fine x scroll */
+   uint8 opaque[33];     /* their solid pixels, unscrolled */
+   int xofs, x_tile, y_tile, nametab, nt1, nt2, i;
 
-      x_tile++;
+   /* draw a line of transparent background color if bg is disabled */
+   if (false == line->bg_on)
+   {
+      memset(vidbuf, FULLBG(line), NES_SCREEN_WIDTH);
+      memset(masks->bg, 0, sizeof(masks->bg));
+      return;
+   }
 
-      if (0 == (x_tile & 1)) /* check every 2 tiles */
-      {
-         if (0 == (x_tile & 3)) /* check every 4 tiles */
-         {
-            if (32 == x_tile) /* check every 32 tiles */
-            {
-               x_tile = 0;
-               refresh_vaddr ^= (1 << 10); /* switch nametable */
-               attrib_base ^= (1 << 10);
-
-               /* recalculate pointers */
-               tile_ptr = &PPU_MEM(refresh_vaddr);
-               attrib_ptr = &PPU_MEM(attrib_base);
-            }
-
-            /* Get the attribute byte */
-            attrib = *attrib_ptr++;
-         }
+   /* Unscrolled lines go straight into the (aligned) line; with fine x
+   ** scroll we draw into the staging buffer and shift it into place
+   ** afterwards, so nothing gets written outside the line either way.
+   */
+   xofs = line->tile_xofs;
+   bmp_ptr = xofs ? stage : (uint32 *) vidbuf;
 
-         attrib_shift ^= 2;
-         col_high = ((attrib >> attrib_shift) & 3) << 2;
-      }
+   x_tile = line->vaddr & 0x1F;
+   y_tile = (line->vaddr >> 5) & 0x1F;
+   nametab = (line->vaddr >> 10) & 3;
+   nt1 = ppu_ntindex(line->page, nametab);
+   nt2 = ppu_ntindex(line->page, nametab ^ 1);
+
+   /* MMC5 looks up every tile in ExRAM; rows 30 and 31 would be the
+   ** attribute tables themselves
+   */
+   opaque[32] = 0;
+   if (ppu.exattr)
+   {
+      ppu_renderbgtiles_exattr(line, bmp_ptr, stage, opaque);
+   }
+   else if (NULL == ppu.latchfunc && y_tile < 30 && nt1 >= 0 && nt2 >= 0)
+   {
+      uint32 bg_offset = ((line->vaddr >> 12) & 7) + line->bg_base; /* offset in y tile */
+      uint32 row = y_tile << 5;
+      const uint8 *pat_ptr = ppu_flatpages(line->page, line->bg_base, 4);
+      int tile_count, run;
+
+      /* the 33rd tile is only seen when scrolled */
+      tile_count = xofs ? 33 : 32;
+      run = 32 - x_tile;
+      if (run > tile_count)
+         run = tile_count;
+
+      /* rest of this nametable's row, then on into the next one */
+      bmp_ptr = ppu_renderbgrun(line, bmp_ptr, opaque, &LINE_MEM(line, 0x2000 + (nametab << 10) + row + x_tile),
+                                &nt_colhigh[nt1][y_tile][x_tile], pat_ptr, bg_offset, run);
+      ppu_renderbgrun(line, bmp_ptr, opaque + run, &LINE_MEM(line, 0x2000 + ((nametab ^ 1) << 10) + row),
+                      nt_colhigh[nt2][y_tile], pat_ptr, bg_offset, tile_count - run);
+   }
+   else if (ppu.latchfunc)
+   {
+      ppu_renderbgtiles_latch(line, bmp_ptr, stage, opaque);
+   }
+   else
+   {
+      ppu_renderbgtiles_plain(line, bmp_ptr, stage, opaque);
    }
 
+   if (xofs)
+      ppu_scrollline((uint32 *) vidbuf, stage, xofs);
+
+   /* and the solid pixels scrolled the same way */
+   for (i = 0; i < NES_SCREEN_WIDTH / 8; i++)
+      masks->bg[i] = (uint8) ((opaque[i] << xofs) | (opaque[i + 1] >> (8 - xofs)));
+   masks->bg[NES_SCREEN_WIDTH / 8] = 0;
+
    /* Blank left hand column if need be */
-   if (ppu.bg_mask)
+   if (line->bg_mask)
    {
       uint32 *buf_ptr = (uint32 *)vidbuf;
-      uint32 bg_clear = FULLBG | FULLBG << 8 | FULLBG << 16 | FULLBG << 24;
+      uint32 bg_clear = FULLBG(line) * 0x01010101;
 
       ((uint32 *)buf_ptr)[0] = bg_clear;
       ((uint32 *)buf_ptr)[1] = bg_clear;
+      masks->bg[0] = 0;
    }
 }
 
@@ -776,114 +1385,190 @@ typedef struct obj_s
    uint8 x_loc;
 } obj_t;
 
-/* TODO: fetch valid OAM a scanline before, like the Real Thing */
-static void ppu_renderoam(uint8 *vidbuf, int scanline)
+/* Sort OAM into the per-scanline sprite lists */
+static void ppu_evaloam(void)
 {
-   uint8 *buf_ptr;
-   uint32 vram_offset, savecol[2];
-   int sprite_num, spritecount;
    obj_t *sprite_ptr;
-   uint8 sprite_height;
+   int sprite_num, scanline, last_line;
+   uint8 sprite_height = ppu.obj_height;
 
-   if (false == ppu.obj_on)
-      return;
+   /* queued lines may still be reading the old lists */
+   ppu_syncworker();
 
-   /* Get our buffer pointer */
-   buf_ptr = vidbuf;
-
-   /* Save left hand column? */
-   if (ppu.obj_mask)
-   {
-      savecol[0] = ((uint32 *)buf_ptr)[0];
-      savecol[1] = ((uint32 *)buf_ptr)[1];
-   }
-
-   sprite_height = ppu.obj_height;
-   vram_offset = ppu.obj_base;
-   spritecount = 0;
+   memset(obj_eval.count, 0, sizeof(obj_eval.count));
 
    sprite_ptr = (obj_t *)ppu.oam;
 
    for (sprite_num = 0; sprite_num < 64; sprite_num++, sprite_ptr++)
    {
-      uint8 *data_ptr, *bmp_ptr;
-      uint32 vram_adr;
-      int y_offset;
-      uint8 tile_index, attrib, col_high;
-      uint8 sprite_y, sprite_x;
-      bool check_strike;
-      int strike_pixel;
-
-      sprite_y = sprite_ptr->y_loc + 1;
-
-      /* Check to see if sprite is out of range */
-      if ((sprite_y > scanline) || (sprite_y <= (scanline - sprite_height)) || (0 == sprite_y) || (sprite_y >= 240))
+      int sprite_y = sprite_ptr->y_loc + 1;
+
+      /* Y of $EF and up never shows */
+      if (sprite_y >= 240)
          continue;
 
-      sprite_x = sprite_ptr->x_loc;
-      tile_index = sprite_ptr->tile;
-      attrib = sprite_ptr->atr;
+      last_line = sprite_y + sprite_height;
+      if (last_line > 240)
+         last_line = 240;
 
-      bmp_ptr = buf_ptr + sprite_x;
+      for (scanline = sprite_y; scanline < last_line; scanline++)
+      {
+         uint8 count = obj_eval.count[scanline];
+         int y_offset;
 
-      /* Handle $FD/$FE tile VROM switching (PunchOut) */
-      if (ppu.latchfunc)
-         ppu.latchfunc(vram_offset, tile_index);
+         /* maximum of 8 sprites per scanline */
+         if (PPU_MAXSPRITE == count)
+            continue;
 
-      /* Get upper two bits of color */
-      col_high = ((attrib & 3) << 2);
+         /* Calculate offset (line within the sprite) */
+         y_offset = scanline - sprite_y;
+         if (y_offset > 7)
+            y_offset += 8;
 
-      /* 8x16 even sprites use $0000, odd use $1000 */
-      if (16 == ppu.obj_height)
-         vram_adr = ((tile_index & 1) << 12) | ((tile_index & 0xFE) << 4);
-      else
-         vram_adr = vram_offset + (tile_index << 4);
+         /* Account for vertical flippage */
+         if (sprite_ptr->atr & OAMF_VFLIP)
+            y_offset = ((16 == sprite_height) ? 23 : 7) - y_offset;
 
-      /* Get the address of the tile */
-      data_ptr = &PPU_MEM(vram_adr);
+         obj_eval.slot[scanline][count].sprite = sprite_num;
+         obj_eval.slot[scanline][count].row = y_offset;
+         obj_eval.count[scanline] = count + 1;
+      }
+   }
 
-      /* Calculate offset (line within the sprite) */
-      y_offset = scanline - sprite_y;
-      if (y_offset > 7)
-         y_offset += 8;
+   obj_eval.height = sprite_height;
+   obj_eval.dirty = false;
+}
 
-      /* Account for vertical flippage */
-      if (attrib & OAMF_VFLIP)
-      {
-         if (16 == ppu.obj_height)
-            y_offset -= 23;
-         else
-            y_offset -= 7;
+/* TODO: fetch valid OAM a scanline before, like the Real Thing.  Made
+** twice like ppu_renderbgtiles, for the latch test per sprite.
+*/
+#define PPU_MAKE_RENDEROAM(name, LATCH)                                                                                       \
+   static void name(const ppu_line_t *line, ppu_masks_t *masks)                                                               \
+   {                                                                                                                          \
+      uint8 *vidbuf = line->buf;                                                                                              \
+      int scanline = line->scanline;                                                                                          \
+      uint8 *buf_ptr;                                                                                                         \
+      uint32 vram_offset, savecol[2] = { 0, 0 }; /* read back with obj_mask only, GCC can't tell */                           \
+      const obj_slot_t *slot;                                                                                                 \
+      uint8 *pat_ptr;                                                                                                         \
+      int spritecount;                                                                                                        \
+                                                                                                                              \
+      if (false == line->obj_on)                                                                                              \
+         return;                                                                                                              \
+                                                                                                                              \
+      spritecount = obj_eval.count[scanline];                                                                                 \
+      if (0 == spritecount)                                                                                                   \
+         return;                                                                                                              \
+      memset(masks->sp, 0, sizeof(masks->sp));                                                                                \
+                                                                                                                              \
+      /* Get our buffer pointer */                                                                                            \
+      buf_ptr = vidbuf;                                                                                                       \
+                                                                                                                              \
+      /* Save left hand column? */                                                                                            \
+      if (line->obj_mask)                                                                                                     \
+      {                                                                                                                       \
+         savecol[0] = ((uint32 *)buf_ptr)[0];                                                                                 \
+         savecol[1] = ((uint32 *)buf_ptr)[1];                                                                                 \
+      }                                                                                                                       \
+                                                                                                                              \
+      vram_offset = line->obj_base;                                                                                           \
+                                                                                                                              \
+      /* one block for the line's sprites, unless the latch flips banks */                                                    \
+      if (LATCH)                                                                                                              \
+         pat_ptr = NULL;                                                                                                      \
+      else if (16 == line->obj_height)                                                                                        \
+         pat_ptr = ppu_flatpages(line->page, 0, 8);                                                                           \
+      else                                                                                                                    \
+         pat_ptr = ppu_flatpages(line->page, vram_offset, 4);                                                                 \
+                                                                                                                              \
+      /* maximum of 8 sprites per scanline */                                                                                 \
+      if (PPU_MAXSPRITE == spritecount && line->live)                                                                         \
+         ppu.stat |= PPU_STATF_MAXSPRITE;                                                                                     \
+                                                                                                                              \
+      for (slot = obj_eval.slot[scanline]; spritecount--; slot++)                                                             \
+      {                                                                                                                       \
+         obj_t *sprite_ptr = (obj_t *)line->oam + slot->sprite;                                                               \
+         uint8 *data_ptr, *bmp_ptr;                                                                                           \
+         uint32 vram_adr;                                                                                                     \
+         uint8 tile_index, attrib, col_high;                                                                                  \
+         bool check_strike;                                                                                                   \
+         int strike_pixel;                                                                                                    \
+                                                                                                                              \
+         tile_index = sprite_ptr->tile;                                                                                       \
+         attrib = sprite_ptr->atr;                                                                                            \
+                                                                                                                              \
+         bmp_ptr = buf_ptr + sprite_ptr->x_loc;                                                                               \
+                                                                                                                              \
+         /* Handle $FD/$FE tile VROM switching (PunchOut) */                                                                  \
+         if (LATCH)                                                                                                           \
+            ppu.latchfunc(vram_offset, tile_index);                                                                           \
+                                                                                                                              \
+         /* Get upper two bits of color */                                                                                    \
+         col_high = ((attrib & 3) << 2);                                                                                      \
+                                                                                                                              \
+         /* 8x16 even sprites use $0000, odd use $1000 */                                                                     \
+         if (16 == line->obj_height)                                                                                          \
+            vram_adr = ((tile_index & 1) << 12) | ((tile_index & 0xFE) << 4);                                                 \
+         else                                                                                                                 \
+            vram_adr = vram_offset + (tile_index << 4);                                                                       \
+                                                                                                                              \
+         /* Get the address of the tile row */                                                                                \
+         data_ptr = (pat_ptr ? pat_ptr + vram_adr : &LINE_MEM(line, vram_adr)) + slot->row;                                   \
+                                                                                                                              \
+         /* if we're on sprite 0 and sprite 0 strike flag isn't set,                                                          \
+         ** check for a strike                                                                                                \
+         */                                                                                                                   \
+         check_strike = line->live && (0 == slot->sprite) && (false == ppu.strikeflag);                                       \
+         strike_pixel = draw_oamtile(bmp_ptr, masks, sprite_ptr->x_loc, attrib, data_ptr[0], data_ptr[8],                     \
+                                     line->palette + 16 + col_high, check_strike);                                            \
+         if (strike_pixel >= 0)                                                                                               \
+            ppu_setstrike(strike_pixel);                                                                                      \
+      }                                                                                                                       \
+                                                                                                                              \
+      /* Restore lefthand column */                                                                                           \
+      if (line->obj_mask)                                                                                                     \
+      {                                                                                                                       \
+         ((uint32 *)buf_ptr)[0] = savecol[0];                                                                                 \
+         ((uint32 *)buf_ptr)[1] = savecol[1];                                                                                 \
+      }                                                                                                                       \
+   }
 
-         data_ptr -= y_offset;
-      }
-      else
-      {
-         data_ptr += y_offset;
-      }
+PPU_MAKE_RENDEROAM(ppu_renderoam_plain, 0)
+PPU_MAKE_RENDEROAM(ppu_renderoam_latch, 1)
 
-      /* if we're on sprite 0 and sprite 0 strike flag isn't set,
-      ** check for a strike
-      */
-      check_strike = (0 == sprite_num) && (false == ppu.strikeflag);
-      strike_pixel = draw_oamtile(bmp_ptr, attrib, data_ptr[0], data_ptr[8], ppu.palette + 16 + col_high, check_strike);
-      if (strike_pixel >= 0)
-         ppu_setstrike(strike_pixel);
+/* the latch can come and go with the cart, so pick per line */
+INLINE void ppu_renderoam(const ppu_line_t *line, ppu_masks_t *masks)
+{
+   if (ppu.latchfunc)
+      ppu_renderoam_latch(line, masks);
+   else
+      ppu_renderoam_plain(line, masks);
+}
 
-      /* maximum of 8 sprites per scanline */
-      if (++spritecount == PPU_MAXSPRITE)
-      {
-         ppu.stat |= PPU_STATF_MAXSPRITE;
-         break;
-      }
-   }
+/* Background opacity of the 8 pixels starting at x_loc on the current
+** line, leftmost pixel in bit 7 -- the same fetch ppu_renderbg does, for
+** just the two tiles sprite 0 can overlap.
+*/
+static uint8 ppu_bgopaque(int x_loc)
+{
+   uint32 tile_adr, pat_adr;
+   uint32 opaque = 0;
+   int pixel, x_tile, i;
+
+   pixel = x_loc + ppu.tile_xofs;
+   x_tile = (ppu.vaddr & 0x1F) + (pixel >> 3);
 
-   /* Restore lefthand column */
-   if (ppu.obj_mask)
+   for (i = 0; i < 2; i++, x_tile++)
    {
-      ((uint32 *)buf_ptr)[0] = savecol[0];
-      ((uint32 *)buf_ptr)[1] = savecol[1];
+      tile_adr = 0x2000 | (ppu.vaddr & 0x0FE0) | (x_tile & 0x1F);
+      if (x_tile & 0x20)
+         tile_adr ^= (1 << 10); /* switch nametable */
+
+      pat_adr = ppu.bg_base + (PPU_MEM(tile_adr) << 4) + ((ppu.vaddr >> 12) & 7);
+      opaque = (opaque << 8) | PPU_MEM(pat_adr) | PPU_MEM(pat_adr + 8);
    }
+
+   return (uint8)(opaque >> (8 - (pixel & 7)));
 }
 
 /* Fake rendering a line */
@@ -892,25 +1577,23 @@ static void ppu_fakeoam(int scanline)
 {
    uint8 *data_ptr;
    obj_t *sprite_ptr;
-   uint32 vram_adr, color;
-   int y_offset;
-   uint8 pat1, pat2;
-   uint8 tile_index, attrib;
-   uint8 sprite_height, sprite_y, sprite_x;
+   const obj_slot_t *slot;
+   uint32 vram_adr;
+   uint8 tile_index, attrib, sprite_x;
+   uint8 hit;
+   int i;
 
    /* we don't need to be here if strike flag is set */
 
-   if (false == ppu.obj_on || ppu.strikeflag)
+   if (false == ppu.obj_on || false == ppu.bg_on || ppu.strikeflag)
       return;
 
-   sprite_height = ppu.obj_height;
-   sprite_ptr = (obj_t *)ppu.oam;
-   sprite_y = sprite_ptr->y_loc + 1;
-
-   /* Check to see if sprite is out of range */
-   if ((sprite_y > scanline) || (sprite_y <= (scanline - sprite_height)) || (0 == sprite_y) || (sprite_y > 240))
+   /* sprite 0 sorts first, if it's on this line at all */
+   slot = obj_eval.slot[scanline];
+   if (0 == obj_eval.count[scanline] || 0 != slot->sprite)
       return;
 
+   sprite_ptr = (obj_t *)ppu.oam;
    sprite_x = sprite_ptr->x_loc;
    tile_index = sprite_ptr->tile;
    attrib = sprite_ptr->atr;
@@ -921,76 +1604,35 @@ static void ppu_fakeoam(int scanline)
    else
       vram_adr = ppu.obj_base + (tile_index << 4);
 
-   data_ptr = &PPU_MEM(vram_adr);
+   data_ptr = &PPU_MEM(vram_adr) + slot->row;
 
-   /* Calculate offset (line within the sprite) */
-   y_offset = scanline - sprite_y;
-   if (y_offset > 7)
-      y_offset += 8;
+   /* solid sprite 0 pixels, leftmost in bit 7 */
+   hit = data_ptr[0] | data_ptr[8];
+   if (0 == hit)
+      return;
 
-   /* Account for vertical flippage */
-   if (attrib & OAMF_VFLIP)
+   if (attrib & OAMF_HFLIP)
    {
-      if (16 == ppu.obj_height)
-         y_offset -= 23;
-      else
-         y_offset -= 7;
-      data_ptr -= y_offset;
-   }
-   else
-   {
-      data_ptr += y_offset;
+      hit = ((hit & 0xF0) >> 4) | ((hit & 0x0F) << 4);
+      hit = ((hit & 0xCC) >> 2) | ((hit & 0x33) << 2);
+      hit = ((hit & 0xAA) >> 1) | ((hit & 0x55) << 1);
    }
 
-   /* check for a solid sprite 0 pixel */
-   pat1 = data_ptr[0];
-   pat2 = data_ptr[8];
-   color = ((pat2 & 0xAA) << 8) | ((pat2 & 0x55) << 1) | ((pat1 & 0xAA) << 7) | (pat1 & 0x55);
+   /* ...over solid background pixels, none in the left column if
+   ** $2001 clips either the background or the sprites there
+   */
+   hit &= ppu_bgopaque(sprite_x);
+   if ((ppu.bg_mask || ppu.obj_mask) && sprite_x < 8)
+      hit &= 0xFF >> (8 - sprite_x);
 
-   if (color)
+   /* the hardware never reports a hit at x = 255 */
+   for (i = 0; i < 8 && sprite_x + i < NES_SCREEN_WIDTH - 1; i++)
    {
-      uint8 colors[8];
-
-      /* buckle up, it's going to get ugly... */
-      if (0 == (attrib & OAMF_HFLIP))
+      if (hit & (0x80 >> i))
       {
-         colors[0] = (color >> 14) & 3;
-         colors[1] = (color >> 6) & 3;
-         colors[2] = (color >> 12) & 3;
-         colors[3] = (color >> 4) & 3;
-         colors[4] = (color >> 10) & 3;
-         colors[5] = (color >> 2) & 3;
-         colors[6] = (color >> 8) & 3;
-         colors[7] = color & 3;
-      }
-      else
-      {
-         colors[7] = (color >> 14) & 3;
-         colors[6] = (color >> 6) & 3;
-         colors[5] = (color >> 12) & 3;
-         colors[4] = (color >> 4) & 3;
-         colors[3] = (color >> 10) & 3;
-         colors[2] = (color >> 2) & 3;
-         colors[1] = (color >> 8) & 3;
-         colors[0] = color & 3;
+         ppu_setstrike(sprite_x + i);
+         break;
       }
-
-      if (colors[0])
-         ppu_setstrike(sprite_x + 0);
-      else if (colors[1])
-         ppu_setstrike(sprite_x + 1);
-      else if (colors[2])
-         ppu_setstrike(sprite_x + 2);
-      else if (colors[3])
-         ppu_setstrike(sprite_x + 3);
-      else if (colors[4])
-         ppu_setstrike(sprite_x + 4);
-      else if (colors[5])
-         ppu_setstrike(sprite_x + 5);
-      else if (colors[6])
-         ppu_setstrike(sprite_x + 6);
-      else if (colors[7])
-         ppu_setstrike(sprite_x + 7);
    }
 }
 
@@ -999,9 +1641,98 @@ bool ppu_enabled(void)
    return (ppu.bg_on || ppu.obj_on);
 }
 
+/* Take the state for drawing this scanline. A copy owns its page pointers
+** and palette, so it stays valid while the CPU moves on.
+*/
+static void ppu_snapline(ppu_line_t *line, uint8 *buf, int scanline, bool copy)
+{
+   line->buf = buf;
+   line->scanline = scanline;
+   line->oam = ppu.oam;
+   line->vaddr = ppu.vaddr;
+   line->tile_xofs = ppu.tile_xofs;
+   line->obj_height = ppu.obj_height;
+   line->obj_base = ppu.obj_base;
+   line->bg_base = ppu.bg_base;
+   line->bg_on = ppu.bg_on;
+   line->obj_on = ppu.obj_on;
+   line->obj_mask = ppu.obj_mask;
+   line->bg_mask = ppu.bg_mask;
+   line->drawsprites = ppu.drawsprites;
+   line->live = !copy;
+
+   if (copy)
+   {
+      memcpy(line->page_copy, ppu.page, sizeof(line->page_copy));
+      memcpy(line->pal_copy, ppu.palette, sizeof(line->pal_copy));
+      line->page = line->page_copy;
+      line->palette = line->pal_copy;
+   }
+   else
+   {
+      line->page = ppu.page;
+      line->palette = ppu.palette;
+   }
+}
+
+/* Draw a line taken by ppu_snapline; this is what the worker calls */
+void ppu_renderline(const ppu_line_t *line)
+{
+   ppu_masks_t masks;
+
+   ppu_renderbg(line, &masks);
+   if (true == line->drawsprites)
+      ppu_renderoam(line, &masks);
+}
+
+#ifdef NES_PPU_BATCH
+/* Catch-up rendering: a worker on this same CPU. Lines are snapped as
+** for a worker on another core and drawn in one go once the batch is
+** full, or when something they read is about to change (the usual sync
+** points: VRAM and OAM writes, CHR staging, end of frame). Writes to
+** $2000/$2001/$2005/$2006 don't flush, every line keeps its own copy.
+** A run of lines goes through the renderer back to back, with its code
+** and the pattern data still in cache, instead of between the 6502's.
+*/
+#define PPU_BATCH_LINES 32
+static ppu_line_t ppu_batch[PPU_BATCH_LINES];
+static int ppu_batchcount = 0;
+
+static void ppu_batchsync(void)
+{
+   int i;
+
+   for (i = 0; i < ppu_batchcount; i++)
+      ppu_renderline(&ppu_batch[i]);
+   ppu_batchcount = 0;
+}
+
+static ppu_line_t *ppu_batchgetline(void)
+{
+   if (PPU_BATCH_LINES == ppu_batchcount)
+      ppu_batchsync();
+
+   return &ppu_batch[ppu_batchcount];
+}
+
+static void ppu_batchputline(ppu_line_t *line)
+{
+   ppu_batchcount++;
+}
+
+static ppu_worker_t ppu_batchworker =
+{
+   ppu_batchgetline,
+   ppu_batchputline,
+   ppu_batchsync
+};
+#endif /* NES_PPU_BATCH */
+
 static void ppu_renderscanline(bitmap_t *bmp, int scanline, bool draw_flag)
 {
    uint8 *buf = bmp->line[scanline];
+   ppu_line_t line;
+   ppu_masks_t masks;
 
    /* start scanline - transfer ppu latch into vaddr */
    if (ppu.bg_on || ppu.obj_on)
@@ -1017,18 +1748,58 @@ static void ppu_renderscanline(bitmap_t *bmp, int scanline, bool draw_flag)
       }
    }
 
+   if (obj_eval.dirty || obj_eval.height != ppu.obj_height)
+      ppu_evaloam();
+
+#ifdef NES_PPU_LINEREUSE
+   /* still in the buffer from last time; sprite 0 is never on such a line,
+   ** unless sprites are hidden
+   */
+   if (draw_flag && ppu_linereused(bmp, scanline))
+   {
+      ppu_fakeoam(scanline);
+      return;
+   }
+#endif /* NES_PPU_LINEREUSE */
+
+#ifdef NES_CHRCACHE
+   /* CHR banks switched in since the last drawn line get their RAM copy */
+   if (draw_flag && mmc_chrpending())
+   {
+      ppu_syncworker();
+      mmc_stagechr();
+   }
+#endif /* NES_CHRCACHE */
+
+   /* the worker can't do $FD/$FE latching, that has to happen mid-line,
+   ** and ExRAM can change before it gets to the line
+   */
+   if (draw_flag && ppu_worker && NULL == ppu.latchfunc && NULL == ppu.exattr)
+   {
+      ppu_line_t *queued = ppu_worker->getline();
+      ppu_snapline(queued, buf, scanline, true);
+      ppu_worker->putline(queued);
+      ppu_fakeoam(scanline);
+      return;
+   }
+
    if (draw_flag)
-      ppu_renderbg(buf);
+   {
+      ppu_snapline(&line, buf, scanline, false);
+      ppu_renderbg(&line, &masks);
+   }
 
    /* TODO: fetch obj data 1 scanline before */
    if (true == ppu.drawsprites && true == draw_flag)
-      ppu_renderoam(buf, scanline);
+      ppu_renderoam(&line, &masks);
    else
       ppu_fakeoam(scanline);
 }
 
 void ppu_endscanline(int scanline)
 {
+   RTRACE(rtrace_endline(scanline));
+
    /* modify vram address at end of scanline */
    if (scanline < 240 && (ppu.bg_on || ppu.obj_on))
    {
@@ -1067,13 +1838,32 @@ void ppu_checknmi(void)
       nes_nmi();
 }
 
+/* A bitmap's height is how much of the frame the display shows; lines
+** below it only get the sprite 0 and vaddr work, not pixels. Except on
+** a cart with $FD/$FE latches, whose tiles have to be fetched to switch.
+*/
+INLINE bool ppu_lineshown(const bitmap_t *bmp, int scanline)
+{
+   return scanline < bmp->height || NULL != ppu.latchfunc;
+}
+
 void ppu_scanline(bitmap_t *bmp, int scanline, bool draw_flag)
 {
-   if (scanline < 240)
+   RTRACE(rtrace_linestart());
+
+   if (240 == scanline)
+   {
+      /* frame is done: the blit and vblank writes must not race the worker */
+      ppu_syncworker();
+   }
+   else if (scanline < 240)
    {
       /* Lower the Max Sprite per scanline flag */
       ppu.stat &= ~PPU_STATF_MAXSPRITE;
-      ppu_renderscanline(bmp, scanline, draw_flag);
+      /* as $2001 stands when the line starts, a reused line included */
+      if (bmp->linepal)
+         bmp->linepal[scanline] = ppu_emphasis();
+      ppu_renderscanline(bmp, scanline, draw_flag && ppu_lineshown(bmp, scanline));
    }
    else if (241 == scanline)
    {
@@ -1088,6 +1878,11 @@ void ppu_scanline(bitmap_t *bmp, int scanline, bool draw_flag)
 
       ppu.vram_accessible = false;
    }
+
+   /* after the line, so pages switched while drawing it (the CHR cache
+   ** staging, $FD/$FE latches) replay before it
+   */
+   RTRACE(rtrace_line(scanline, draw_flag));
 }
 
 /*
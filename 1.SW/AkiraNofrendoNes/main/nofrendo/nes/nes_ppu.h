@@ -56,6 +56,13 @@
 #define PPU_CTRL1F_BGON 0x08
 #define PPU_CTRL1F_OBJMASK 0x04
 #define PPU_CTRL1F_BGMASK 0x02
+#define PPU_CTRL1F_EMPHASIS 0xE0
+
+/* A bitmap with linepal gets each line's colour emphasis, the $2001 bits
+** as red | green << 1 | blue << 2 whatever the TV system; the video
+** driver keeps a palette for each of them
+*/
+#define PPU_EMPHASES 8
 
 /* $2002 */
 #define PPU_STATF_VBLANK 0x80
@@ -76,47 +83,101 @@ typedef void (*ppuvromswitch_t)(uint8 value);
 
 typedef struct ppu_s
 {
-   /* big nasty memory chunks */
-   uint8 nametab[0x1000];
-   uint8 oam[256];
-   uint8 palette[32];
-   uint8 *page[16];
-
-   /* hardware registers */
-   uint8 ctrl0, ctrl1, stat, oam_addr;
+   /* what drawing a line reads, in the first few cache lines: the
+   ** registers, the 1KB page pointers and the palette
+   */
    uint32 vaddr, vaddr_latch;
    int tile_xofs, flipflop;
    int vaddr_inc;
    uint32 tile_nametab;
-
-   uint8 obj_height;
    uint32 obj_base, bg_base;
 
+   uint8 ctrl0, ctrl1, stat, oam_addr;
+   uint8 obj_height;
    bool bg_on, obj_on;
    bool obj_mask, bg_mask;
-
-   uint8 latch, vdata_latch;
-   uint8 strobe;
+   bool drawsprites;
 
    bool strikeflag;
    uint32 strike_cycle;
 
+   uint8 *page[16];
+   uint8 palette[32];
+
    /* callbacks for naughty mappers */
    ppulatchfunc_t latchfunc;
    ppuvromswitch_t vromswitch;
 
-   /* copy of our current palette */
-   rgb_t curpal[256];
+   /* MMC5 extended attributes, NULL when off */
+   const uint8 *exattr;
+   const uint8 *exchr;
+   uint32 exchr_mask, exchr_hi;
 
+   /* only on $2007 accesses */
+   uint8 latch, vdata_latch;
+   uint8 strobe;
    bool vram_accessible;
-
    bool vram_present;
-   bool drawsprites;
+
+   /* big nasty memory chunks, reached through page[] and the sprite lists */
+   uint8 oam[256];
+   uint8 nametab[0x1000];
+
+   /* copy of our current palette, for the video driver and screenshots */
+   rgb_t curpal[256];
 } ppu_t;
 
+/* Everything needed to draw one scanline, so it can be drawn later
+** (or on another core) while the CPU keeps running
+*/
+typedef struct ppu_line_s
+{
+   uint8 *buf;
+   int scanline;
+
+   uint8 **page;        /* ppu.page when drawn in place, else page_copy */
+   uint8 *palette;      /* ppu.palette when drawn in place, else pal_copy */
+   uint8 *oam;
+
+   uint32 vaddr;
+   int tile_xofs;
+   uint8 obj_height;
+   uint32 obj_base, bg_base;
+   bool bg_on, obj_on;
+   bool obj_mask, bg_mask;
+   bool drawsprites;
+   bool live;           /* drawn on the CPU's time: sprite 0 hits and overflow count */
+
+   uint8 *page_copy[16];
+   uint8 pal_copy[32];
+} ppu_line_t;
+
+/* Hooks for drawing scanlines on a separate worker. The CPU keeps sprite 0
+** hits to itself (ppu_fakeoam), and syncs up before anything the worker
+** reads (VRAM, OAM) can change.
+*/
+typedef struct ppu_worker_s
+{
+   ppu_line_t *(*getline)(void);       /* free slot, waits while the worker is behind */
+   void (*putline)(ppu_line_t *line);  /* hand a filled slot over */
+   void (*sync)(void);                 /* return once every line handed over is drawn */
+} ppu_worker_t;
+
+extern void ppu_setworker(ppu_worker_t *worker);
+extern void ppu_renderline(const ppu_line_t *line);
+
+/* something other than the PPU drew on the frame buffers */
+extern void ppu_invalidatelines(void);
+/* ... or on only these rows of one of them */
+extern void ppu_invalidaterows(bitmap_t *bmp, int y, int height);
+
 /* TODO: should use this pointers */
 extern void ppu_setlatchfunc(ppulatchfunc_t func);
 extern void ppu_setvromswitch(ppuvromswitch_t func);
+/* MMC5 extended attribute mode: per tile, exram gives the palette and a
+** 4KB bank of chr (chr_banks of them, a power of two), with chr_hi on top
+*/
+extern void ppu_setexattr(const uint8 *exram, const uint8 *chr, int chr_banks, int chr_hi);
 
 extern void ppu_getcontext(ppu_t *dest_ppu);
 extern void ppu_setcontext(ppu_t *src_ppu);
@@ -130,6 +191,13 @@ extern void ppu_mirror(int nt1, int nt2, int nt3, int nt4);
 extern void ppu_setpage(int size, int page_num, uint8 *location);
 extern uint8 *ppu_getpage(int page);
 
+#ifdef NES_RENDERTRACE
+/* for nes_rtrace.c */
+extern ppu_t *ppu_tracecontext(void);
+extern void ppu_refresh(void);
+extern void ppu_setoam(const uint8 *oam);
+#endif /* NES_RENDERTRACE */
+
 /* control */
 extern void ppu_reset(int reset_type);
 extern bool ppu_enabled(void);
@@ -149,6 +217,8 @@ extern void ppu_writehigh(uint32 address, uint8 value);
 /* rendering */
 extern void ppu_setpal(ppu_t *src_ppu, rgb_t *pal);
 extern void ppu_setdefaultpal(ppu_t *src_ppu);
+extern void ppu_dimpal(ppu_t *src_ppu, bool dim);
+extern void ppu_setemphasisswap(bool swap);
 
 /* bleh */
 extern void ppu_dumppattern(bitmap_t *bmp, int table_num, int x_loc, int y_loc, int col);
@@ -0,0 +1,234 @@
+/*
+** Nofrendo (c) 1998-2000 Matthew Conte (matt@conte.com)
+**
+**
+** This program is free software; you can redistribute it and/or
+** modify it under the terms of version 2 of the GNU Library General 
+** Public License as published by the Free Software Foundation.
+**
+** This program is distributed in the hope that it will be useful, 
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU 
+** Library General Public License for more details.  To obtain a 
+** copy of the GNU Library General Public License, write to the Free 
+** Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+**
+** Any permitted reproduction of these routines, in whole or in part,
+** must bear this legend.
+**
+**
+** nes_prof.c
+**
+** Per-frame profiling: min/avg/max per slot and a frame time histogram
+** over one second windows, for the GUI overlay and a UART line; and the
+** stages of putting a game in, once, up to its first frame
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <noftypes.h>
+#include <osd.h>
+#include <log.h>
+#include <nes.h>
+#include <nes_prof.h>
+
+#ifdef NES_PROFILE
+
+#define  PROF_WINDOW       (nes_getcontextptr()->timing->refresh_rate) /* frames per window */
+#define  PROF_UART_WINDOWS 5                 /* print every 5 seconds */
+#define  PROF_HIST         8                 /* quarter frame period buckets, | marks the budget */
+#define  PROF_PERIOD_US    (nes_getcontextptr()->timing->frame_us)
+#define  PROF_LINE_LEN     40
+#define  PROF_LOG_LEN      100               /* a UART line, the log ring cuts at 120 */
+
+volatile uint32 prof_cycles[PROF_SLOTS];
+
+static const char *prof_names[PROF_SLOTS] =
+{
+   "cpu", "ppu", "map", "apu", "i2s", "vwt", "lcd", "yld"
+};
+
+static const char *startup_names[STARTUP_STAGES] =
+{
+   "new", "rom", "map", "rst", "vid", "frm"
+};
+
+static struct
+{
+   uint32 mark;               /* the end of the last stage */
+   int us[STARTUP_STAGES];
+   bool timing;
+} startup;
+
+static struct
+{
+   uint32 last[PROF_SLOTS];   /* prof_cycles at the end of the last frame */
+   uint32 min[PROF_SLOTS], max[PROF_SLOTS], sum[PROF_SLOTS];
+   int frame_min, frame_max, frame_sum;
+   int hist[PROF_HIST];
+   int frames, windows;
+   bool started;
+   uint32 start_cycles, start_us;   /* window start, to get the clock rate */
+   char text[PROF_LINES][PROF_LINE_LEN];
+   const char *lines[PROF_LINES];
+   int count;
+} prof;
+
+static void prof_clear(void)
+{
+   int i;
+
+   for (i = 0; i < PROF_SLOTS; i++)
+   {
+      prof.min[i] = 0xFFFFFFFF;
+      prof.max[i] = prof.sum[i] = 0;
+   }
+   prof.frame_min = 0x7FFFFFFF;
+   prof.frame_max = prof.frame_sum = 0;
+   memset(prof.hist, 0, sizeof(prof.hist));
+   prof.frames = 0;
+   prof.start_cycles = osd_getcycles();
+   prof.start_us = osd_getmicros();
+}
+
+/* turn the window into text; cycle counts go to microseconds at the
+** rate the cycle counter actually ran at over the window
+*/
+static void prof_report(void)
+{
+   uint32 us = osd_getmicros() - prof.start_us;
+   uint32 mhz = us ? (osd_getcycles() - prof.start_cycles) / us : 0;
+   int i, n = 0;
+
+   if (0 == mhz)
+      mhz = 1;
+
+   snprintf(prof.text[n++], PROF_LINE_LEN, "frm %5d %5d %5d",
+            prof.frame_sum / prof.frames, prof.frame_min, prof.frame_max);
+   for (i = 0; i < PROF_SLOTS; i++)
+      snprintf(prof.text[n++], PROF_LINE_LEN, "%s %5u %5u %5u", prof_names[i],
+               (unsigned)(prof.sum[i] / prof.frames / mhz),
+               (unsigned)(prof.min[i] / mhz), (unsigned)(prof.max[i] / mhz));
+   snprintf(prof.text[n++], PROF_LINE_LEN, "hst %d %d %d %d|%d %d %d %d",
+            prof.hist[0], prof.hist[1], prof.hist[2], prof.hist[3],
+            prof.hist[4], prof.hist[5], prof.hist[6], prof.hist[7]);
+   for (i = 0; i < PROF_OSD_LINES; i++)
+   {
+      osd_profinfo(i, prof.text[n], PROF_LINE_LEN);
+      if (prof.text[n][0])
+         n++;
+   }
+
+   for (i = 0; i < n; i++)
+      prof.lines[i] = prof.text[i];
+   prof.count = n;
+
+   /* as few log lines as fit the figures, each one whole */
+   if (++prof.windows == PROF_UART_WINDOWS)
+   {
+      char line[PROF_LOG_LEN + PROF_LINE_LEN];
+      int len = 0;
+
+      for (i = 0; i < n; i++)
+      {
+         if (len && len + (int) strlen(prof.text[i]) + 3 > PROF_LOG_LEN)
+         {
+            log_printf("prof us avg/min/max:%s\n", line);
+            len = 0;
+         }
+         len += snprintf(line + len, sizeof(line) - len, " %s%s", prof.text[i], (i < n - 1) ? " |" : "");
+      }
+      log_printf("prof us avg/min/max:%s\n", line);
+      prof.windows = 0;
+   }
+}
+
+void prof_frame(int us)
+{
+   int i;
+
+   prof_startstage(STARTUP_FRAME);
+
+   /* the totals count from boot: start from wherever they are now */
+   if (false == prof.started)
+   {
+      for (i = 0; i < PROF_SLOTS; i++)
+         prof.last[i] = prof_cycles[i];
+      prof_clear();
+      prof.started = true;
+      return;
+   }
+
+   for (i = 0; i < PROF_SLOTS; i++)
+   {
+      uint32 now = prof_cycles[i];
+      uint32 delta = now - prof.last[i];
+
+      prof.last[i] = now;
+      prof.sum[i] += delta;
+      if (delta < prof.min[i])
+         prof.min[i] = delta;
+      if (delta > prof.max[i])
+         prof.max[i] = delta;
+   }
+
+   prof.frame_sum += us;
+   if (us < prof.frame_min)
+      prof.frame_min = us;
+   if (us > prof.frame_max)
+      prof.frame_max = us;
+   i = us * 4 / PROF_PERIOD_US;
+   prof.hist[i < PROF_HIST ? i : PROF_HIST - 1]++;
+
+   if (++prof.frames == PROF_WINDOW)
+   {
+      prof_report();
+      prof_clear();
+   }
+}
+
+void prof_startbegin(void)
+{
+   memset(startup.us, 0, sizeof(startup.us));
+   startup.mark = osd_getmicros();
+   startup.timing = true;
+}
+
+void prof_startstage(int stage)
+{
+   uint32 now = osd_getmicros();
+   int i, total = 0;
+
+   if (false == startup.timing)
+      return;
+   startup.us[stage] = (int) (now - startup.mark);
+   startup.mark = now;
+   if (STARTUP_FRAME != stage)
+      return;
+
+   startup.timing = false;
+   printf("startup us:");
+   for (i = 0; i < STARTUP_STAGES; i++)
+   {
+      printf(" %s %d", startup_names[i], startup.us[i]);
+      total += startup.us[i];
+   }
+   printf(" | total %d\n", total);
+}
+
+int prof_getlines(const char **lines)
+{
+   int i;
+
+   for (i = 0; i < prof.count; i++)
+      lines[i] = prof.lines[i];
+
+   return prof.count;
+}
+
+const char *prof_name(int slot)
+{
+   return prof_names[slot];
+}
+
+#endif /* NES_PROFILE */
@@ -0,0 +1,92 @@
+/*
+** Nofrendo (c) 1998-2000 Matthew Conte (matt@conte.com)
+**
+**
+** This program is free software; you can redistribute it and/or
+** modify it under the terms of version 2 of the GNU Library General 
+** Public License as published by the Free Software Foundation.
+**
+** This program is distributed in the hope that it will be useful, 
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU 
+** Library General Public License for more details.  To obtain a 
+** copy of the GNU Library General Public License, write to the Free 
+** Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+**
+** Any permitted reproduction of these routines, in whole or in part,
+** must bear this legend.
+**
+**
+** nes_prof.h
+**
+** Per-frame and startup profiling, compiled in with NES_PROFILE
+*/
+
+#ifndef _NES_PROF_H_
+#define _NES_PROF_H_
+
+#include <noftypes.h>
+#include <osd.h>
+
+#ifdef NES_PROFILE
+
+enum
+{
+   PROF_CPU,      /* nes6502_execute */
+   PROF_PPU,      /* ppu_scanline, ppu_endscanline */
+   PROF_MAPPER,   /* mapper hblank/vblank hooks */
+   PROF_APU,      /* apu_process */
+   PROF_I2S,      /* handing samples to I2S, audio task */
+   PROF_VIDWAIT,  /* display task waiting for a frame or line */
+   PROF_LCD,      /* sending to the LCD, display task */
+   PROF_YIELD,    /* emulator's core lent to a background task, OSD */
+   PROF_SLOTS
+};
+
+/* Running cycle totals. They only ever grow and each slot is only
+** touched by one task, so other tasks can add to theirs without locks;
+** the per-frame figures are the differences between frames.
+*/
+extern volatile uint32 prof_cycles[PROF_SLOTS];
+
+#define  PROF_BEGIN(t)     uint32 t = osd_getcycles()
+#define  PROF_END(slot, t) (prof_cycles[slot] += osd_getcycles() - (t))
+
+/* once per emulated frame, with the time the frame took */
+extern void prof_frame(int us);
+/* overlay text for the last complete window, returns the line count */
+#define  PROF_OSD_LINES    5
+#define  PROF_LINES        (PROF_SLOTS + 2 + PROF_OSD_LINES)
+extern int prof_getlines(const char **lines);
+/* the short name a slot goes by in the overlay */
+extern const char *prof_name(int slot);
+
+/* Putting a game in, stage by stage, to its first emulated frame; the
+** times go out over UART once the frame is done
+*/
+enum
+{
+   STARTUP_CREATE,   /* nes_create: CPU, APU, PPU */
+   STARTUP_ROM,      /* rom_load */
+   STARTUP_MAPPER,   /* the mapper, its sound chip, handlers, profile */
+   STARTUP_RESET,    /* nes_reset */
+   STARTUP_VIDEO,    /* video mode, frame timer */
+   STARTUP_FRAME,    /* the first frame, drawn */
+   STARTUP_STAGES
+};
+
+/* a game is about to be put in */
+extern void prof_startbegin(void);
+/* stage is done */
+extern void prof_startstage(int stage);
+
+#else /* !NES_PROFILE */
+
+#define  PROF_BEGIN(t)
+#define  PROF_END(slot, t)
+#define  prof_startbegin()
+#define  prof_startstage(stage)
+
+#endif /* !NES_PROFILE */
+
+#endif /* _NES_PROF_H_ */
@@ -0,0 +1,258 @@
+/*
+** Nofrendo (c) 1998-2000 Matthew Conte (matt@conte.com)
+**
+**
+** This program is free software; you can redistribute it and/or
+** modify it under the terms of version 2 of the GNU Library General 
+** Public License as published by the Free Software Foundation.
+**
+** This program is distributed in the hope that it will be useful, 
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU 
+** Library General Public License for more details.  To obtain a 
+** copy of the GNU Library General Public License, write to the Free 
+** Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+**
+** Any permitted reproduction of these routines, in whole or in part,
+** must bear this legend.
+**
+**
+** nes_replay.c
+**
+** Input replay and frame/audio hashes. The hashes only depend on the ROM,
+** the script and the emulation, so a change that is meant to be bit-exact
+** has to leave them alone; see nes_replay.h for the formats.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <noftypes.h>
+#include <bitmap.h>
+#include <nes_replay.h>
+
+#define  FNV_BASIS         2166136261u
+#define  FNV_PRIME         16777619u
+#define  REPLAY_ENTRY      24    /* room an entry may take when recorded */
+
+static struct
+{
+   const char *script, *pos;   /* the next entry to look at, NULL past the end */
+   int held;
+   uint32 frame_hash, audio_hash;
+   char *rec;                  /* the movie being recorded */
+   int rec_size, rec_len, rec_held;
+} replay = { .frame_hash = FNV_BASIS, .audio_hash = FNV_BASIS };
+
+static const struct
+{
+   char name;
+   int mask;
+} replay_names[] =
+{
+   { 'A', REPLAY_A }, { 'B', REPLAY_B }, { 's', REPLAY_SELECT }, { 'S', REPLAY_START },
+   { 'U', REPLAY_UP }, { 'D', REPLAY_DOWN }, { 'L', REPLAY_LEFT }, { 'R', REPLAY_RIGHT },
+   { 'W', REPLAY_REWIND }, { 'F', REPLAY_FASTFWD }, { 'r', REPLAY_RESET }, { 'p', REPLAY_POWER }
+};
+
+#define  REPLAY_NAMES      ((int) (sizeof(replay_names) / sizeof(replay_names[0])))
+
+/* FNV-1a */
+INLINE uint32 replay_hash(uint32 hash, const uint8 *data, int len)
+{
+   while (len--)
+   {
+      hash ^= *data++;
+      hash *= FNV_PRIME;
+   }
+   return hash;
+}
+
+/* end of the current entry */
+static bool replay_eol(char c)
+{
+   return ('\0' == c || '\n' == c || ';' == c);
+}
+
+static const char *replay_nextline(const char *s)
+{
+   while (false == replay_eol(*s))
+      s++;
+   return *s ? s + 1 : s;
+}
+
+static int replay_parsebuttons(const char *s)
+{
+   int b = 0, i;
+
+   for (; false == replay_eol(*s) && '#' != *s; s++)
+   {
+      for (i = 0; i < REPLAY_NAMES; i++)
+      {
+         if (replay_names[i].name == *s)
+            b |= replay_names[i].mask;
+      }
+   }
+   return b;
+}
+
+/* the entry at or after s, NULL if there's none; its frame, and where its
+** buttons start
+*/
+static const char *replay_entry(const char *s, int *frame, char **rest)
+{
+   for (; *s; s = replay_nextline(s))
+   {
+      long f = strtol(s, rest, 10);
+
+      if (*rest != s)
+      {
+         *frame = (int) f;
+         return s;
+      }
+      /* blank or comment */
+   }
+   return NULL;
+}
+
+int replay_load(const char *script)
+{
+   const char *s = script;
+   char *rest;
+   int frame, count = 0;
+
+   replay.script = replay.pos = script;
+   replay.held = 0;
+   replay.frame_hash = replay.audio_hash = FNV_BASIS;
+
+   for (; NULL != (s = replay_entry(s, &frame, &rest)); s = replay_nextline(s))
+      count++;
+
+   return count;
+}
+
+int replay_buttons(int frame)
+{
+   char *rest;
+   int next;
+
+   while (NULL != replay.pos)
+   {
+      replay.pos = replay_entry(replay.pos, &next, &rest);
+      if (NULL == replay.pos || next > frame)
+         break;
+      replay.held = replay_parsebuttons(rest);
+      replay.pos = replay_nextline(replay.pos);
+   }
+
+   return replay.held;
+}
+
+void replay_record(char *buf, int size)
+{
+   replay.rec = buf;
+   replay.rec_size = size;
+   replay.rec_len = 0;
+   replay.rec_held = -1;   /* the first frame always gets an entry */
+   if (NULL != buf && size > 0)
+      buf[0] = '\0';
+}
+
+void replay_note(int frame, int buttons)
+{
+   char entry[REPLAY_ENTRY];
+   int len, i;
+
+   buttons &= (REPLAY_SELECT | REPLAY_START | REPLAY_UP | REPLAY_RIGHT | REPLAY_DOWN | REPLAY_LEFT
+               | REPLAY_REWIND | REPLAY_FASTFWD | REPLAY_RESET | REPLAY_A | REPLAY_B | REPLAY_POWER);
+   if (NULL == replay.rec || replay.rec_len < 0 || buttons == replay.rec_held)
+      return;
+   replay.rec_held = buttons;
+
+   len = snprintf(entry, sizeof(entry), "%s%d ", replay.rec_len ? ";" : "", frame);
+   for (i = 0; i < REPLAY_NAMES; i++)
+   {
+      if (buttons & replay_names[i].mask)
+         entry[len++] = replay_names[i].name;
+   }
+   if (0 == buttons)
+      entry[len++] = '-';
+
+   if (replay.rec_len + len >= replay.rec_size)
+   {
+      replay.rec_len = -1;
+      return;
+   }
+   memcpy(replay.rec + replay.rec_len, entry, len);
+   replay.rec_len += len;
+   replay.rec[replay.rec_len] = '\0';
+}
+
+int replay_recorded(void)
+{
+   return replay.rec_len;
+}
+
+uint32 replay_hashbuf(const uint8 *data, int len)
+{
+   return replay_hash(FNV_BASIS, data, len);
+}
+
+uint32 replay_frame(const bitmap_t *bmp)
+{
+   uint32 hash = FNV_BASIS;
+   int y;
+
+   for (y = 0; y < bmp->height; y++)
+      hash = replay_hash(hash, bmp->line[y], bmp->width);
+   replay.frame_hash = replay_hash(replay.frame_hash, (uint8 *) &hash, sizeof(hash));
+
+   return hash;
+}
+
+/* samples go in little endian so both ends agree */
+void replay_audio(const int16 *samples, int count)
+{
+   uint32 hash = replay.audio_hash;
+
+   while (count--)
+   {
+      uint16 s = (uint16) *samples++;
+
+      hash = (hash ^ (s & 0xFF)) * FNV_PRIME;
+      hash = (hash ^ (s >> 8)) * FNV_PRIME;
+   }
+   replay.audio_hash = hash;
+}
+
+uint32 replay_framehash(void)
+{
+   return replay.frame_hash;
+}
+
+uint32 replay_audiohash(void)
+{
+   return replay.audio_hash;
+}
+
+int replay_check(const char *golden, uint32 crc, int frames)
+{
+   for (; *golden; golden = replay_nextline(golden))
+   {
+      char *p;
+      uint32 g_crc, g_frame, g_audio;
+      long g_frames;
+
+      g_crc = (uint32) strtoul(golden, &p, 16);
+      if (p == golden)
+         continue;
+      g_frames = strtol(p, &p, 10);
+      g_frame = (uint32) strtoul(p, &p, 16);
+      g_audio = (uint32) strtoul(p, &p, 16);
+
+      if (g_crc == crc && g_frames == frames)
+         return (g_frame == replay.frame_hash && g_audio == replay.audio_hash);
+   }
+
+   return -1;
+}
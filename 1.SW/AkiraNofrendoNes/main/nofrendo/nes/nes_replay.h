@@ -0,0 +1,82 @@
+/*
+** Nofrendo (c) 1998-2000 Matthew Conte (matt@conte.com)
+**
+**
+** This program is free software; you can redistribute it and/or
+** modify it under the terms of version 2 of the GNU Library General 
+** Public License as published by the Free Software Foundation.
+**
+** This program is distributed in the hope that it will be useful, 
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU 
+** Library General Public License for more details.  To obtain a 
+** copy of the GNU Library General Public License, write to the Free 
+** Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+**
+** Any permitted reproduction of these routines, in whole or in part,
+** must bear this legend.
+**
+**
+** nes_replay.h
+**
+** Input replay and frame/audio hashes for regression runs
+*/
+
+
+#ifndef _NES_REPLAY_H_
+#define _NES_REPLAY_H_
+
+#include <noftypes.h>
+#include <bitmap.h>
+
+/* Buttons, in the bit order of the device's controller word */
+#define  REPLAY_SELECT     0x0001
+#define  REPLAY_START      0x0008
+#define  REPLAY_UP         0x0010
+#define  REPLAY_RIGHT      0x0020
+#define  REPLAY_DOWN       0x0040
+#define  REPLAY_LEFT       0x0080
+#define  REPLAY_REWIND     0x0400
+#define  REPLAY_FASTFWD    0x0800
+#define  REPLAY_RESET      0x1000
+#define  REPLAY_A          0x2000
+#define  REPLAY_B          0x4000
+#define  REPLAY_POWER      0x8000
+
+/* Input script: "<frame> <buttons>" entries separated by newlines or ';',
+** buttons held from that frame on. Buttons are any of A B s(elect) S(tart)
+** U D L R, W (rewind, with NES_REWIND), F (fast-forward, with
+** NES_FASTFORWARD), r (reset), p (power cycle), or - for none; # comments
+** out the rest of a line. The script is read as the frames come, it has to
+** stay around. Returns the number of entries.
+*/
+extern int replay_load(const char *script);
+/* buttons held in the given frame; frames must not go backwards */
+extern int replay_buttons(int frame);
+
+/* Recording a movie: the buttons of every frame go into buf as a script,
+** one ';' separated entry each time they change, so whatever replays a
+** script replays it. NULL stops.
+*/
+extern void replay_record(char *buf, int size);
+/* the buttons held in frame, once a frame, frames in order */
+extern void replay_note(int frame, int buttons);
+/* the script's length so far, -1 once an entry didn't fit */
+extern int replay_recorded(void);
+
+/* fold a finished frame / a fragment of 16-bit samples into the hashes */
+extern uint32 replay_frame(const bitmap_t *bmp);
+extern void replay_audio(const int16 *samples, int count);
+extern uint32 replay_framehash(void);
+/* the same hash over any buffer, on its own */
+extern uint32 replay_hashbuf(const uint8 *data, int len);
+extern uint32 replay_audiohash(void);
+
+/* Look the hashes up in a golden list of "<crc> <frames> <frame hash>
+** <audio hash>" entries (hex crc and hashes, same separators as scripts).
+** Returns 1 if they match, 0 if they don't, -1 if there's no entry for
+** this ROM CRC and frame count.
+*/
+extern int replay_check(const char *golden, uint32 crc, int frames);
+
+#endif /* _NES_REPLAY_H_ */
@@ -0,0 +1,261 @@
+/*
+** Nofrendo (c) 1998-2000 Matthew Conte (matt@conte.com)
+**
+**
+** This program is free software; you can redistribute it and/or
+** modify it under the terms of version 2 of the GNU Library General 
+** Public License as published by the Free Software Foundation.
+**
+** This program is distributed in the hope that it will be useful, 
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU 
+** Library General Public License for more details.  To obtain a 
+** copy of the GNU Library General Public License, write to the Free 
+** Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+**
+** Any permitted reproduction of these routines, in whole or in part,
+** must bear this legend.
+**
+**
+** nes_rewind.c
+**
+** Rewind ring of delta compressed snapshots
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <noftypes.h>
+#include <log.h>
+#include <osd.h>
+#include <gui.h>
+#include <nesstate.h>
+#include <nes_rewind.h>
+#include <nes_arena.h>
+
+#ifdef NES_REWIND
+
+#ifndef NES_REWIND_INTERVAL
+#define  NES_REWIND_INTERVAL  10     /* frames between snapshots */
+#endif
+
+#define  REWIND_ENTRIES       1024
+#define  REWIND_MAXRUN        0xFFFF
+
+/* The ring holds deltas going back from the newest snapshot, which is kept
+** whole in ref: entry n is snapshot n XOR snapshot n-1, so XORing the newest
+** entry into ref steps it back one.  An entry is a list of tokens, one word
+** of (equal words << 16 | changed words) followed by the changed words
+** XORed.  All of it is done a word at a time, the snapshot is padded to a
+** whole number of words.  Running out of room drops the oldest entries.
+*/
+static struct
+{
+   uint32 *ref, *cur;            /* newest snapshot, scratch for the next */
+   int size, words;              /* of a snapshot */
+   uint32 *ring;
+   int ring_words;
+   struct
+   {
+      int offset, length;        /* in words */
+   } entry[REWIND_ENTRIES];
+   int first, count;             /* oldest entry, entries in the ring */
+   int frames;                   /* since the last snapshot */
+   bool held, started;
+   bool stepping;                /* ref is what was last restored */
+   /* what it costs */
+   int snapshots, steps;
+   uint32 total_us, max_us, total_words;
+} rw;
+
+/* XOR cur into ref as tokens at out, leaving ref equal to cur */
+static int rewind_encode(uint32 *out)
+{
+   uint32 *ref = rw.ref, *cur = rw.cur, *o = out, *token;
+   int i = 0, n = rw.words, same, changed;
+
+   while (i < n)
+   {
+      same = changed = 0;
+      while (i < n && cur[i] == ref[i] && same < REWIND_MAXRUN)
+         same++, i++;
+
+      token = o++;
+      /* a single equal word costs less as part of the run than a token */
+      while (i < n && changed < REWIND_MAXRUN
+             && (cur[i] != ref[i] || (i + 1 < n && cur[i + 1] != ref[i + 1])))
+      {
+         *o++ = cur[i] ^ ref[i];
+         ref[i] = cur[i];
+         changed++, i++;
+      }
+      *token = (same << 16) | changed;
+   }
+
+   return o - out;
+}
+
+static void rewind_decode(const uint32 *in, int length)
+{
+   uint32 *ref = rw.ref;
+   const uint32 *end = in + length;
+   int changed;
+
+   while (in < end)
+   {
+      ref += *in >> 16;
+      changed = *in++ & REWIND_MAXRUN;
+      while (changed--)
+         *ref++ ^= *in++;
+   }
+}
+
+static bool rewind_alloc(void)
+{
+   rw.size = state_snapshotsize();
+   rw.words = (rw.size + 3) / 4;
+   rw.ring_words = NES_REWIND_KB * 256;
+   /* the worst an entry can get: every word changed */
+   if (rw.words + rw.words / REWIND_MAXRUN + 2 > rw.ring_words)
+   {
+      log_printf(LOG_WARN "rewind: %d byte snapshots don't fit the ring\n", rw.size);
+      return false;
+   }
+
+   rw.ref = arena_alloc(ARENA_BULK, rw.words * 4);
+   rw.cur = arena_alloc(ARENA_BULK, rw.words * 4);
+   rw.ring = arena_alloc(ARENA_BULK, rw.ring_words * 4);
+   if (NULL == rw.ref || NULL == rw.cur || NULL == rw.ring)
+   {
+      log_printf(LOG_WARN "rewind: no room for a %d KB ring\n", NES_REWIND_KB);
+      rewind_free();
+      return false;
+   }
+   return true;
+}
+
+static void rewind_capture(void)
+{
+   uint32 start = osd_getmicros(), us;
+   int need = rw.words + rw.words / REWIND_MAXRUN + 2;
+   int pos = 0, last, length;
+
+   if (false == rw.started)
+   {
+      /* the first one only becomes ref */
+      state_snapshot((uint8 *) rw.ref, rw.size);
+      arena_traffic(ARENA_BULK, rw.size);
+      rw.started = true;
+      return;
+   }
+
+   if (rw.count)
+   {
+      last = (rw.first + rw.count - 1) % REWIND_ENTRIES;
+      pos = rw.entry[last].offset + rw.entry[last].length;
+   }
+   if (pos + need > rw.ring_words)
+      pos = 0;
+   /* entries follow each other round the ring, oldest first after pos */
+   while (rw.count
+          && (REWIND_ENTRIES == rw.count
+              || (rw.entry[rw.first].offset < pos + need
+                  && rw.entry[rw.first].offset + rw.entry[rw.first].length > pos)))
+   {
+      rw.first = (rw.first + 1) % REWIND_ENTRIES;
+      rw.count--;
+   }
+
+   state_snapshot((uint8 *) rw.cur, rw.size);
+   length = rewind_encode(rw.ring + pos);
+   /* cur written and read, ref read, the tokens written */
+   arena_traffic(ARENA_BULK, 3 * rw.size + 4 * length);
+
+   last = (rw.first + rw.count) % REWIND_ENTRIES;
+   rw.entry[last].offset = pos;
+   rw.entry[last].length = length;
+   rw.count++;
+
+   us = osd_getmicros() - start;
+   rw.snapshots++;
+   rw.total_us += us;
+   rw.total_words += length;
+   if (us > rw.max_us)
+      rw.max_us = us;
+}
+
+static void rewind_step(void)
+{
+   int last;
+
+   if (false == rw.started)
+      return;
+
+   /* the first step goes back to the newest snapshot itself */
+   if (false == rw.stepping)
+   {
+      rw.stepping = true;
+      state_restore((uint8 *) rw.ref, rw.size);
+      arena_traffic(ARENA_BULK, rw.size);
+      rw.steps++;
+      return;
+   }
+
+   if (0 == rw.count)
+   {
+      gui_sendmsg(GUI_RED, "Can't rewind further");
+      return;
+   }
+
+   last = (rw.first + rw.count - 1) % REWIND_ENTRIES;
+   rewind_decode(rw.ring + rw.entry[last].offset, rw.entry[last].length);
+   rw.count--;
+   state_restore((uint8 *) rw.ref, rw.size);
+   arena_traffic(ARENA_BULK, rw.size + 8 * rw.entry[last].length);
+   rw.steps++;
+}
+
+void rewind_frame(void)
+{
+   if (NULL == rw.ring && (rw.size < 0 || false == rewind_alloc()))
+   {
+      rw.size = -1;   /* don't try again for this game */
+      return;
+   }
+
+   if (rw.held)
+   {
+      /* one snapshot per frame shown, NES_REWIND_INTERVAL times as fast */
+      rewind_step();
+      rw.frames = 0;
+   }
+   else
+   {
+      rw.stepping = false;
+      if (++rw.frames >= NES_REWIND_INTERVAL)
+      {
+         rewind_capture();
+         rw.frames = 0;
+      }
+   }
+}
+
+void rewind_hold(bool held)
+{
+   rw.held = held;
+}
+
+void rewind_free(void)
+{
+   if (rw.snapshots)
+      printf("rewind: %d snapshots, %d us avg, %d us max, %d bytes avg, %d steps back\n",
+             rw.snapshots, (int)(rw.total_us / rw.snapshots), (int)rw.max_us,
+             (int)(rw.total_words * 4 / rw.snapshots), rw.steps);
+
+   arena_free(rw.ref);
+   arena_free(rw.cur);
+   arena_free(rw.ring);
+   memset(&rw, 0, sizeof(rw));
+}
+
+#endif /* NES_REWIND */
@@ -0,0 +1,53 @@
+/*
+** Nofrendo (c) 1998-2000 Matthew Conte (matt@conte.com)
+**
+**
+** This program is free software; you can redistribute it and/or
+** modify it under the terms of version 2 of the GNU Library General 
+** Public License as published by the Free Software Foundation.
+**
+** This program is distributed in the hope that it will be useful, 
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU 
+** Library General Public License for more details.  To obtain a 
+** copy of the GNU Library General Public License, write to the Free 
+** Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+**
+** Any permitted reproduction of these routines, in whole or in part,
+** must bear this legend.
+**
+**
+** nes_rewind.h
+**
+** Rewind ring of delta compressed snapshots, compiled in with NES_REWIND
+*/
+
+#ifndef _NES_REWIND_H_
+#define _NES_REWIND_H_
+
+#include <noftypes.h>
+
+#ifdef NES_REWIND
+
+#ifndef NES_REWIND_KB
+#define  NES_REWIND_KB        256    /* ring size */
+#endif
+
+/* once per emulated frame: takes a snapshot every NES_REWIND_INTERVAL
+** frames, or steps back one while the rewind button is held
+*/
+extern void rewind_frame(void);
+/* rewind button */
+extern void rewind_hold(bool held);
+/* drop the ring, when the game is left */
+extern void rewind_free(void);
+
+#else /* !NES_REWIND */
+
+#define  rewind_frame()
+#define  rewind_hold(held)
+#define  rewind_free()
+
+#endif /* !NES_REWIND */
+
+#endif /* _NES_REWIND_H_ */
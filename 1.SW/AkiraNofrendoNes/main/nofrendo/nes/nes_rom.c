@@ -39,8 +39,14 @@
 #include "../sndhrdw/nes_apu.h"
 #include "../nes/nes_rom.h"
 #include "../libsnss/libsnss.h"
+#include "../nes/nes_arena.h"
 #include "log.h"
 extern char *osd_getromdata();
+extern void osd_freeromdata(char *data);
+extern int osd_loadsram(uint32 crc, uint8 *data, int length);
+extern void osd_savesram(uint32 crc, const uint8 *data, int length);
+/* the TV system the ROM slot or the file name says, -1 to take the header's */
+extern int osd_romregion(void);
 
 /* Max length for displayed filename */
 #define ROM_DISP_MAXLEN 20
@@ -83,49 +89,65 @@ typedef struct inesheader_s
 #define SRAM_BANK_LENGTH 0x0400
 #define VRAM_BANK_LENGTH 0x2000
 
+/* Battery-backed RAM goes to whatever storage the OSD has, keyed by the
+** PRG ROM CRC. CPU writes go straight into the SRAM page, so changes are
+** found by comparing against a copy every SRAM_POLL_TICKS; once the game
+** has left it alone for SRAM_QUIET_POLLS it is handed to the OSD, which
+** is expected to write it out in the background.
+*/
+#define SRAM_POLL_TICKS    NES_REFRESH_RATE
+#define SRAM_QUIET_POLLS   2
+
+#define SRAM_LENGTH(r)     (SRAM_BANK_LENGTH * (r)->sram_banks)
+
 /* Save battery-backed RAM */
 static void rom_savesram(rominfo_t *rominfo)
 {
-   FILE *fp;
-   char fn[PATH_MAX + 1];
-
    ASSERT(rominfo);
 
-   if (rominfo->flags & ROM_FLAG_BATTERY)
-   {
-      strncpy(fn, rominfo->filename, PATH_MAX);
-      osd_newextension(fn, ".sav");
+   if (NULL == rominfo->sram_seen)
+      return;
 
-      fp = fopen(fn, "wb");
-      if (NULL != fp)
-      {
-         fwrite(rominfo->sram, SRAM_BANK_LENGTH, rominfo->sram_banks, fp);
-         fclose(fp);
-         log_printf("Wrote battery RAM to %s.\n", fn);
-      }
+   if (rominfo->sram_quiet
+       || memcmp(rominfo->sram, rominfo->sram_seen, SRAM_LENGTH(rominfo)))
+   {
+      osd_savesram(rominfo->crc, rominfo->sram, SRAM_LENGTH(rominfo));
+      log_printf("Wrote battery RAM\n");
    }
 }
 
-/* Load battery-backed RAM from disk */
+/* Load battery-backed RAM */
 static void rom_loadsram(rominfo_t *rominfo)
 {
-   FILE *fp;
-   char fn[PATH_MAX + 1];
-
    ASSERT(rominfo);
 
    if (rominfo->flags & ROM_FLAG_BATTERY)
    {
-      strncpy(fn, rominfo->filename, PATH_MAX);
-      osd_newextension(fn, ".sav");
+      if (0 == osd_loadsram(rominfo->crc, rominfo->sram, SRAM_LENGTH(rominfo)))
+         log_printf("Read battery RAM\n");
 
-      fp = fopen(fn, "rb");
-      if (NULL != fp)
-      {
-         fread(rominfo->sram, SRAM_BANK_LENGTH, rominfo->sram_banks, fp);
-         fclose(fp);
-         log_printf("Read battery RAM from %s.\n", fn);
-      }
+      /* without a copy to compare against it simply isn't saved */
+      rominfo->sram_seen = arena_alloc(ARENA_FAST, SRAM_LENGTH(rominfo));
+      if (rominfo->sram_seen)
+         memcpy(rominfo->sram_seen, rominfo->sram, SRAM_LENGTH(rominfo));
+   }
+}
+
+/* Called every frame tick, saves battery RAM once the game stops writing it */
+void rom_checksram(rominfo_t *rominfo)
+{
+   if (NULL == rominfo->sram_seen || ++rominfo->sram_ticks < SRAM_POLL_TICKS)
+      return;
+   rominfo->sram_ticks = 0;
+
+   if (memcmp(rominfo->sram, rominfo->sram_seen, SRAM_LENGTH(rominfo)))
+   {
+      memcpy(rominfo->sram_seen, rominfo->sram, SRAM_LENGTH(rominfo));
+      rominfo->sram_quiet = SRAM_QUIET_POLLS;
+   }
+   else if (rominfo->sram_quiet && 0 == --rominfo->sram_quiet)
+   {
+      osd_savesram(rominfo->crc, rominfo->sram_seen, SRAM_LENGTH(rominfo));
    }
 }
 
@@ -133,15 +155,13 @@ static void rom_loadsram(rominfo_t *rominfo)
 static int rom_allocsram(rominfo_t *rominfo)
 {
    /* Load up SRAM */
-   rominfo->sram = malloc(SRAM_BANK_LENGTH * rominfo->sram_banks);
+   /* arena blocks come out clear */
+   rominfo->sram = arena_alloc(ARENA_FAST, SRAM_BANK_LENGTH * rominfo->sram_banks);
    if (NULL == rominfo->sram)
    {
       gui_sendmsg(GUI_RED, "Could not allocate space for battery RAM");
       return -1;
    }
-
-   /* make damn sure SRAM is clear */
-   memset(rominfo->sram, 0, SRAM_BANK_LENGTH * rominfo->sram_banks);
    return 0;
 }
 
@@ -195,18 +215,41 @@ static int rom_loadrom(unsigned char **rom, rominfo_t *rominfo)
    }
    else
    {
-      rominfo->vram = malloc(VRAM_LENGTH);
+      rominfo->vram = arena_alloc(ARENA_FAST, VRAM_LENGTH);
       if (NULL == rominfo->vram)
       {
          gui_sendmsg(GUI_RED, "Could not allocate space for VRAM");
          return -1;
       }
-      memset(rominfo->vram, 0, VRAM_LENGTH);
    }
 
    return 0;
 }
 
+/* CRC32 (same as zip) of the PRG ROM, nybble at a time to keep the
+** table small -- runs once per load
+*/
+static uint32 rom_crc32(const uint8 *data, int length)
+{
+   static const uint32 crc_nybble[16] =
+   {
+      0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC,
+      0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+      0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+      0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+   };
+   uint32 crc = 0xFFFFFFFF;
+
+   while (length--)
+   {
+      crc ^= *data++;
+      crc = (crc >> 4) ^ crc_nybble[crc & 0x0F];
+      crc = (crc >> 4) ^ crc_nybble[crc & 0x0F];
+   }
+
+   return ~crc;
+}
+
 /* If we've got a VS. system game, load in the palette, as well */
 static void rom_checkforpal(rominfo_t *rominfo)
 {
@@ -378,13 +421,27 @@ static int rom_getheader(unsigned char **rom, rominfo_t *rominfo)
          log_printf("`DiskDude!' found in ROM header, ignoring high mapper nybble\n");
       else
       {
-         log_printf("ROM header dirty, possible problem\n");
+         log_printf(LOG_WARN "ROM header dirty, possible problem\n");
          rominfo->mapper_number |= (head.mapper_hinybble & 0xF0);
       }
 
       rom_adddirty(rominfo->filename);
    }
 
+   /* TV system: two bits of NES 2.0 byte 12 (multi-region plays as NTSC),
+   ** else the PAL bit of iNES byte 9, which a clean header may have set
+   */
+   rominfo->region = REGION_NTSC;
+   if (0x08 == (head.mapper_hinybble & 0x0C))
+   {
+      if (1 == (head.reserved[4] & 3))
+         rominfo->region = REGION_PAL;
+      else if (3 == (head.reserved[4] & 3))
+         rominfo->region = REGION_DENDY;
+   }
+   else if (false == header_dirty && (head.reserved[1] & 1))
+      rominfo->region = REGION_PAL;
+
    /* TODO: this is an ugly hack, but necessary, I guess */
    /* Check for VS unisystem mapper */
    if (99 == rominfo->mapper_number)
@@ -439,17 +496,32 @@ rominfo_t *rom_load(const char *filename)
 {
    unsigned char *rom = (unsigned char *)osd_getromdata();
    rominfo_t *rominfo;
+   int region;
 
-   rominfo = malloc(sizeof(rominfo_t));
+   if (NULL == rom)
+   {
+      gui_sendmsg(GUI_RED, "ROM not found");
+      return NULL;
+   }
+
+   rominfo = arena_alloc(ARENA_FAST, sizeof(rominfo_t));
    if (NULL == rominfo)
+   {
+      osd_freeromdata((char *) rom);
       return NULL;
+   }
 
-   memset(rominfo, 0, sizeof(rominfo_t));
+   rominfo->image = rom;
 
    /* Get the header and stick it into rominfo struct */
    if (rom_getheader(&rom, rominfo))
       goto _fail;
 
+   /* what the ROM's menu entry says beats a header few dumps get right */
+   region = osd_romregion();
+   if (region >= REGION_NTSC && region <= REGION_DENDY)
+      rominfo->region = (region_t) region;
+
    /* Make sure we really support the mapper */
    if (false == mmc_peek(rominfo->mapper_number))
    {
@@ -469,6 +541,9 @@ rominfo_t *rom_load(const char *filename)
    if (rom_loadrom(&rom, rominfo))
       goto _fail;
 
+   rominfo->crc = rom_crc32(rominfo->rom, rominfo->rom_banks * ROM_BANK_LENGTH);
+   log_printf("PRG ROM CRC32: %08X\n", (unsigned) rominfo->crc);
+
    rom_loadsram(rominfo);
 
    /* See if there's a palette we can load up */
@@ -503,15 +578,16 @@ void rom_free(rominfo_t **rominfo)
    rom_savesram(*rominfo);
 
    if ((*rominfo)->sram)
-      free((*rominfo)->sram);
-   if ((*rominfo)->rom)
-      free((*rominfo)->rom);
-   if ((*rominfo)->vrom)
-      free((*rominfo)->vrom);
+      arena_free((*rominfo)->sram);
+   if ((*rominfo)->sram_seen)
+      arena_free((*rominfo)->sram_seen);
+   /* rom and vrom point into the image, which the OSD owns */
+   if ((*rominfo)->image)
+      osd_freeromdata((char *) (*rominfo)->image);
    if ((*rominfo)->vram)
-      free((*rominfo)->vram);
+      arena_free((*rominfo)->vram);
 
-   free(*rominfo);
+   arena_free(*rominfo);
 
    gui_sendmsg(GUI_GREEN, "ROM freed");
 }
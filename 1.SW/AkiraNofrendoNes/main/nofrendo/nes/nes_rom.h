@@ -35,6 +35,14 @@ typedef enum
    MIRROR_VERT    = 1
 } mirror_t;
 
+/* TV system, an index to nes.c's timing profiles */
+typedef enum
+{
+   REGION_NTSC    = 0,
+   REGION_PAL     = 1,
+   REGION_DENDY   = 2
+} region_t;
+
 #define  ROM_FLAG_BATTERY     0x01
 #define  ROM_FLAG_TRAINER     0x02
 #define  ROM_FLAG_FOURSCREEN  0x04
@@ -45,18 +53,28 @@ typedef struct rominfo_s
    /* pointers to ROM and VROM */
    uint8 *rom, *vrom;
 
+   /* the iNES image from osd_getromdata, handed back by rom_free */
+   uint8 *image;
+
    /* pointers to SRAM and VRAM */
    uint8 *sram, *vram;
 
+   /* battery carts: SRAM as of the last check, and write-back state */
+   uint8 *sram_seen;
+   int sram_ticks, sram_quiet;
+
    /* number of banks */
    int rom_banks, vrom_banks;
    int sram_banks, vram_banks;
 
    int mapper_number;
    mirror_t mirror;
+   region_t region;
 
    uint8 flags;
 
+   uint32 crc; /* CRC32 of PRG ROM, identifies the game */
+
    char filename[PATH_MAX + 1];
 } rominfo_t;
 
@@ -64,6 +82,7 @@ typedef struct rominfo_s
 extern int rom_checkmagic(const char *filename);
 extern rominfo_t *rom_load(const char *filename);
 extern void rom_free(rominfo_t **rominfo);
+extern void rom_checksram(rominfo_t *rominfo);
 extern char *rom_getinfo(rominfo_t *rominfo);
 
 
@@ -0,0 +1,644 @@
+/*
+** Nofrendo (c) 1998-2000 Matthew Conte (matt@conte.com)
+**
+**
+** This program is free software; you can redistribute it and/or
+** modify it under the terms of version 2 of the GNU Library General 
+** Public License as published by the Free Software Foundation.
+**
+** This program is distributed in the hope that it will be useful, 
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU 
+** Library General Public License for more details.  To obtain a 
+** copy of the GNU Library General Public License, write to the Free 
+** Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+**
+** Any permitted reproduction of these routines, in whole or in part,
+** must bear this legend.
+**
+**
+** nes_rtrace.c
+**
+** Render trace capture and replay. Every call that changes what the PPU
+** draws goes into the trace in the order it was made, so a replay
+** through the same calls draws the same frames, with the renderer, the
+** line reuse and the blit doing all their usual work and the 6502 none.
+** Sprite 0 hits and the $2002 bits the CPU would have seen don't matter
+** to the picture and aren't kept.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <noftypes.h>
+#include <osd.h>
+#include <vid_drv.h>
+#include <nes.h>
+#include <nes_ppu.h>
+#include <nes_mmc.h>
+#include <nes_rom.h>
+#include <nes_replay.h>
+#include <nes_rtrace.h>
+
+#ifdef NES_RENDERTRACE
+
+/* Events. Scanlines past 241 but 261 don't do anything in ppu_scanline
+** and aren't kept, so a line fits in a byte.
+*/
+enum
+{
+   RT_END = 0x00,
+   RT_FRAME = 0x01,     /* the frame before is done, flush it */
+   RT_KEY = 0x02,       /* registers, palette, OAM, nametables, CHR RAM */
+   RT_OAM = 0x03,       /* 256 bytes, OAM after a DMA */
+   RT_LINE = 0x04,      /* scanline, ppu_scanline without drawing */
+   RT_LINEDRAW = 0x05,  /* scanline, ppu_scanline drawing */
+   RT_PRERENDER = 0x06, /* ppu_scanline(261, ...) */
+   RT_ENDLINE = 0x07,   /* scanline, ppu_endscanline */
+   RT_WRITE = 0x08,     /* | register, value */
+   RT_READ = 0x10,      /* | register, for $2002 and $2007 */
+   RT_PAGE = 0x20       /* | page, source and offset or the page itself */
+};
+
+/* where a page points */
+enum
+{
+   RT_SRC_VROM,         /* offset into CHR ROM */
+   RT_SRC_VRAM,         /* offset into CHR RAM */
+   RT_SRC_NAMETAB,      /* offset into the PPU's nametables */
+   RT_SRC_COPY          /* anything else: the 1KB it holds */
+};
+
+#define  RT_PAGESIZE    0x400
+#define  RT_REGS        13
+#define  RT_KEYSIZE     (1 + RT_REGS + 32 + 256 + 0x1000 + 4)
+
+enum
+{
+   RT_IDLE,
+   RT_ARMED,            /* waiting for the next frame */
+   RT_RECORDING,
+   RT_DONE
+};
+
+bool rtrace_on = false;
+
+static struct
+{
+   int state;
+   uint8 *buf;
+   int size, pos;
+   int good;            /* end of the last whole frame */
+   int frames, wanted;
+   bool rekey;          /* the PPU was loaded, keyframe before the next event */
+} rt;
+
+static void rt_put16(uint8 *p, uint32 value)
+{
+   p[0] = (uint8) value;
+   p[1] = (uint8) (value >> 8);
+}
+
+static void rt_put32(uint8 *p, uint32 value)
+{
+   rt_put16(p, value);
+   rt_put16(p + 2, value >> 16);
+}
+
+static uint32 rt_get16(const uint8 *p)
+{
+   return p[0] | (p[1] << 8);
+}
+
+static uint32 rt_get32(const uint8 *p)
+{
+   return rt_get16(p) | (rt_get16(p + 2) << 16);
+}
+
+static int rt_vramsize(const rominfo_t *rom)
+{
+   return rom->vram ? 0x2000 * rom->vram_banks : 0;
+}
+
+/*
+** Capture
+*/
+
+/* the trace ends with the last whole frame and its header filled in */
+static void rt_finish(void)
+{
+   rt.pos = rt.good;
+   rt.buf[rt.pos++] = RT_END;
+   rt_put32(rt.buf + 8, rt.frames);
+   rt_put32(rt.buf + 12, rt.pos);
+   rt.state = RT_DONE;
+   rtrace_on = false;
+}
+
+/* room for an event, NULL and the capture over if there's none; one byte
+** is always kept back for the RT_END
+*/
+static uint8 *rt_reserve(int bytes)
+{
+   uint8 *p;
+
+   if (rt.pos + bytes >= rt.size)
+   {
+      printf("rtrace: out of room after %d frames\n", rt.frames);
+      rt_finish();
+      return NULL;
+   }
+   p = rt.buf + rt.pos;
+   rt.pos += bytes;
+   return p;
+}
+
+static void rt_page(int page)
+{
+   const ppu_t *ppu = ppu_tracecontext();
+   const rominfo_t *rom = nes_getcontextptr()->rominfo;
+   const uint8 *data = ppu->page[page] + (page << 10);
+   uint32 offset, vrom_size = rom->vrom_banks * 0x2000;
+   int src;
+   uint8 *p;
+
+   if (rom->vrom && data >= rom->vrom && data + RT_PAGESIZE <= rom->vrom + vrom_size)
+      src = RT_SRC_VROM, offset = data - rom->vrom;
+   /* a copy of the bank the mapper has in, the CHR cache's */
+   else if (page < 8 && rom->vrom && (offset = mmc_getchrbank(page << 10) << 10) + RT_PAGESIZE <= vrom_size
+            && 0 == memcmp(data, rom->vrom + offset, RT_PAGESIZE))
+      src = RT_SRC_VROM;
+   else if (rom->vram && data >= rom->vram && data + RT_PAGESIZE <= rom->vram + rt_vramsize(rom))
+      src = RT_SRC_VRAM, offset = data - rom->vram;
+   else if (data >= ppu->nametab && data + RT_PAGESIZE <= ppu->nametab + sizeof(ppu->nametab))
+      src = RT_SRC_NAMETAB, offset = data - ppu->nametab;
+   else
+      src = RT_SRC_COPY, offset = 0;
+
+   p = rt_reserve(2 + (RT_SRC_COPY == src ? RT_PAGESIZE : 3));
+   if (NULL == p)
+      return;
+   p[0] = RT_PAGE | page;
+   p[1] = src;
+   if (RT_SRC_COPY == src)
+   {
+      memcpy(p + 2, data, RT_PAGESIZE);
+   }
+   else
+   {
+      rt_put16(p + 2, offset);
+      p[4] = (uint8) (offset >> 16);
+   }
+}
+
+/* the PPU as it stands, then where every page points */
+static void rt_keyframe(void)
+{
+   const ppu_t *ppu = ppu_tracecontext();
+   const rominfo_t *rom = nes_getcontextptr()->rominfo;
+   int vram = rt_vramsize(rom);
+   uint8 *p;
+   int i;
+
+   rt.rekey = false;
+   p = rt_reserve(RT_KEYSIZE + vram);
+   if (NULL == p)
+      return;
+   *p++ = RT_KEY;
+   *p++ = ppu->ctrl0;
+   *p++ = ppu->ctrl1;
+   *p++ = ppu->stat;
+   *p++ = ppu->oam_addr;
+   rt_put16(p, ppu->vaddr);
+   rt_put16(p + 2, ppu->vaddr_latch);
+   p += 4;
+   *p++ = ppu->tile_xofs;
+   *p++ = ppu->flipflop;
+   *p++ = ppu->latch;
+   *p++ = ppu->vdata_latch;
+   *p++ = ppu->vram_accessible;
+   memcpy(p, ppu->palette, 32);
+   memcpy(p + 32, ppu->oam, 256);
+   memcpy(p + 32 + 256, ppu->nametab, 0x1000);
+   p += 32 + 256 + 0x1000;
+   rt_put32(p, vram);
+   if (vram)
+      memcpy(p + 4, rom->vram, vram);
+
+   for (i = 0; i < 16 && RT_RECORDING == rt.state; i++)
+      rt_page(i);
+}
+
+/* with a keyframe first if the PPU has been loaded since the last event */
+static uint8 *rt_event(int bytes)
+{
+   if (rt.rekey)
+   {
+      rt_keyframe();
+      if (RT_RECORDING != rt.state)
+         return NULL;
+   }
+   return rt_reserve(bytes);
+}
+
+void rtrace_write(uint32 address, uint8 value)
+{
+   uint8 *p = rt_event(2);
+
+   if (p)
+   {
+      p[0] = RT_WRITE | (address & 7);
+      p[1] = value;
+   }
+}
+
+/* the only reads that change anything: the $2005/$2006 toggle and the
+** VRAM address
+*/
+void rtrace_read(uint32 address)
+{
+   uint8 *p;
+
+   address &= 0x2007;
+   if (PPU_STAT != address && PPU_VDATA != address)
+      return;
+   p = rt_event(1);
+   if (p)
+      p[0] = RT_READ | (address & 7);
+}
+
+void rtrace_oam(const uint8 *oam)
+{
+   uint8 *p = rt_event(1 + 256);
+
+   if (p)
+   {
+      p[0] = RT_OAM;
+      memcpy(p + 1, oam, 256);
+   }
+}
+
+/* pages the keyframe still to come will have anyway aren't kept */
+void rtrace_pages(int first, int count)
+{
+   while (count-- && false == rt.rekey && RT_RECORDING == rt.state)
+      rt_page(first++);
+}
+
+/* a keyframe a load has left owing goes in before the line changes anything */
+void rtrace_linestart(void)
+{
+   if (rt.rekey)
+      rt_keyframe();
+}
+
+void rtrace_line(int scanline, bool draw_flag)
+{
+   uint8 *p;
+
+   if (scanline > 241 && 261 != scanline)
+      return;
+   p = rt_event(261 == scanline ? 1 : 2);
+   if (NULL == p)
+      return;
+   if (261 == scanline)
+   {
+      p[0] = RT_PRERENDER;
+   }
+   else
+   {
+      p[0] = draw_flag ? RT_LINEDRAW : RT_LINE;
+      p[1] = scanline;
+   }
+}
+
+void rtrace_endline(int scanline)
+{
+   uint8 *p;
+
+   if (scanline >= 240)
+      return;
+   p = rt_event(2);
+   if (p)
+   {
+      p[0] = RT_ENDLINE;
+      p[1] = scanline;
+   }
+}
+
+void rtrace_context(void)
+{
+   rt.rekey = true;
+}
+
+void rtrace_capture(uint8 *buf, int size, int frames)
+{
+   rtrace_on = false;
+   memset(&rt, 0, sizeof(rt));
+   if (size <= RTRACE_HEADER)
+      return;
+   rt.buf = buf;
+   rt.size = size;
+   rt.wanted = frames;
+   rt.state = RT_ARMED;
+}
+
+void rtrace_stop(void)
+{
+   if (RT_ARMED == rt.state)
+      rt.state = RT_IDLE;
+   if (RT_RECORDING != rt.state)
+      return;
+
+   /* the frame just flushed is the last */
+   if (rt_event(1))
+   {
+      rt.buf[rt.pos - 1] = RT_FRAME;
+      rt.good = rt.pos;
+      rt.frames++;
+      rt_finish();
+   }
+}
+
+void rtrace_frame(void)
+{
+   const rominfo_t *rom = nes_getcontextptr()->rominfo;
+
+   if (RT_ARMED == rt.state)
+   {
+      rt_put32(rt.buf, RTRACE_MAGIC);
+      rt_put32(rt.buf + 4, rom->crc);
+      rt.pos = rt.good = RTRACE_HEADER;
+      rt.state = RT_RECORDING;
+      rtrace_on = true;
+      rt_keyframe();
+      return;
+   }
+   if (RT_RECORDING != rt.state)
+      return;
+
+   /* the frame before has been drawn and flushed */
+   if (NULL == rt_event(1))
+      return;
+   rt.buf[rt.pos - 1] = RT_FRAME;
+   rt.good = rt.pos;
+   if (++rt.frames == rt.wanted)
+      rt_finish();
+}
+
+int rtrace_done(void)
+{
+   return RT_DONE == rt.state ? rt.pos : 0;
+}
+
+/*
+** Replay
+*/
+
+static struct
+{
+   const rominfo_t *rom;
+   uint8 *vram;                     /* the trace's CHR RAM */
+   uint8 *copy;                     /* RT_SRC_COPY pages, 1KB per page */
+} rp;
+
+/* make sure there are n more bytes */
+#define  RP_NEED(n)  if (end - p < (n)) return -1
+
+static int rp_key(const uint8 *p, const uint8 *end)
+{
+   ppu_t *ppu = ppu_tracecontext();
+   int vram;
+
+   RP_NEED(RT_KEYSIZE - 1);
+   vram = rt_get32(p + RT_REGS + 32 + 256 + 0x1000);
+   if (vram != rt_vramsize(rp.rom))
+      return -1;
+   RP_NEED(RT_KEYSIZE - 1 + vram);
+
+   /* the bits that come from $2000 and $2001 through the usual path; that
+   ** moves the latches, so they go in after
+   */
+   ppu_write(PPU_CTRL0, p[0]);
+   ppu_write(PPU_CTRL1, p[1]);
+   ppu->stat = p[2];
+   ppu->oam_addr = p[3];
+   ppu->vaddr = rt_get16(p + 4);
+   ppu->vaddr_latch = rt_get16(p + 6);
+   ppu->tile_xofs = p[8];
+   ppu->flipflop = p[9];
+   ppu->latch = p[10];
+   ppu->vdata_latch = p[11];
+   ppu->vram_accessible = p[12];
+   p += RT_REGS;
+   memcpy(ppu->palette, p, 32);
+   memcpy(ppu->oam, p + 32, 256);
+   memcpy(ppu->nametab, p + 32 + 256, 0x1000);
+   if (vram)
+      memcpy(rp.vram, p + RT_KEYSIZE - 1 - RT_REGS, vram);
+   ppu_refresh();
+
+   return RT_KEYSIZE - 1 + vram;
+}
+
+static int rp_page(int page, const uint8 *p, const uint8 *end)
+{
+   uint8 *data;
+   uint32 offset;
+
+   RP_NEED(1);
+   if (RT_SRC_COPY == p[0])
+   {
+      RP_NEED(1 + RT_PAGESIZE);
+      data = rp.copy + (page << 10);
+      memcpy(data, p + 1, RT_PAGESIZE);
+      ppu_setpage(1, page, data - (page << 10));
+      return 1 + RT_PAGESIZE;
+   }
+
+   RP_NEED(4);
+   offset = rt_get16(p + 1) | (p[3] << 16);
+   switch (p[0])
+   {
+   case RT_SRC_VROM:
+      if (NULL == rp.rom->vrom || offset + RT_PAGESIZE > (uint32) rp.rom->vrom_banks * 0x2000)
+         return -1;
+      data = rp.rom->vrom + offset;
+      break;
+
+   case RT_SRC_VRAM:
+      if (offset + RT_PAGESIZE > (uint32) rt_vramsize(rp.rom))
+         return -1;
+      data = rp.vram + offset;
+      break;
+
+   case RT_SRC_NAMETAB:
+      if (offset + RT_PAGESIZE > 0x1000)
+         return -1;
+      data = ppu_tracecontext()->nametab + offset;
+      break;
+
+   default:
+      return -1;
+   }
+   ppu_setpage(1, page, data - (page << 10));
+   return 4;
+}
+
+/* One pass over the trace. Returns the number of frames, -1 if the trace
+** is damaged.
+*/
+static int rp_pass(const uint8 *trace, int len, bool blit, uint32 *hash)
+{
+   const uint8 *p = trace + RTRACE_HEADER, *end = trace + len;
+   int frames = 0, n;
+
+   while (p < end)
+   {
+      uint8 op = *p++;
+
+      switch (op)
+      {
+      case RT_END:
+         return frames;
+
+      case RT_FRAME:
+         if (hash)
+         {
+            uint32 pair[2];
+
+            pair[0] = *hash;
+            pair[1] = replay_frame(vid_getbuffer());
+            *hash = replay_hashbuf((uint8 *) pair, sizeof(pair));
+         }
+         if (blit)
+            vid_flush();
+         frames++;
+         break;
+
+      case RT_KEY:
+         n = rp_key(p, end);
+         if (n < 0)
+            return -1;
+         p += n;
+         break;
+
+      case RT_OAM:
+         RP_NEED(256);
+         ppu_setoam(p);
+         p += 256;
+         break;
+
+      case RT_LINE:
+      case RT_LINEDRAW:
+         RP_NEED(1);
+         ppu_scanline(vid_getbuffer(), *p, RT_LINEDRAW == op);
+         if (blit && RT_LINEDRAW == op && *p < NES_SCREEN_HEIGHT)
+            vid_linedone(*p);
+         p++;
+         break;
+
+      case RT_PRERENDER:
+         ppu_scanline(vid_getbuffer(), 261, false);
+         break;
+
+      case RT_ENDLINE:
+         RP_NEED(1);
+         ppu_endscanline(*p++);
+         break;
+
+      default:
+         if (RT_WRITE == (op & 0xF8))
+         {
+            RP_NEED(1);
+            ppu_write(0x2000 | (op & 7), *p++);
+         }
+         else if (RT_READ == (op & 0xF8))
+         {
+            ppu_read(0x2000 | (op & 7));
+         }
+         else if (RT_PAGE == (op & 0xF0))
+         {
+            n = rp_page(op & 0x0F, p, end);
+            if (n < 0)
+               return -1;
+            p += n;
+         }
+         else
+         {
+            return -1;
+         }
+         break;
+      }
+   }
+
+   return -1;
+}
+
+int rtrace_bench(const uint8 *trace, int len, int passes, rtrace_result_t *result)
+{
+   ppu_t *ppu = ppu_tracecontext();
+   ppu_t *saved;
+   uint32 start, ppu_us = 0, all_us = 0;
+   int frames, i;
+
+   memset(result, 0, sizeof(*result));
+   rp.rom = nes_getcontextptr()->rominfo;
+   if (len < RTRACE_HEADER + 1 || RTRACE_MAGIC != rt_get32(trace) || rt_get32(trace + 12) > (uint32) len)
+      return -1;
+   if (rt_get32(trace + 4) != rp.rom->crc || RT_RECORDING == rt.state || passes < 1)
+      return -1;
+   len = rt_get32(trace + 12);
+
+   saved = malloc(sizeof(ppu_t));
+   rp.vram = malloc(rt_vramsize(rp.rom) + 16 * RT_PAGESIZE);
+   if (NULL == saved || NULL == rp.vram)
+   {
+      free(saved);
+      free(rp.vram);
+      return -1;
+   }
+   rp.copy = rp.vram + rt_vramsize(rp.rom);
+
+#ifdef NES_CHRCACHE
+   /* what the next drawn line would stage, so none of the replay's do */
+   if (mmc_chrpending())
+      mmc_stagechr();
+#endif
+
+   /* the mapper's hooks would switch banks of the running game; the
+   ** trace has the pages they switched to
+   */
+   *saved = *ppu;
+   ppu->latchfunc = NULL;
+   ppu->vromswitch = NULL;
+   ppu->exattr = NULL;
+
+   frames = rp_pass(trace, len, false, &result->hash);
+   for (i = 0; frames > 0 && i < passes; i++)
+   {
+      start = osd_getmicros();
+      rp_pass(trace, len, false, NULL);
+      ppu_us += osd_getmicros() - start;
+   }
+   for (i = 0; frames > 0 && i < passes; i++)
+   {
+      start = osd_getmicros();
+      rp_pass(trace, len, true, NULL);
+      all_us += osd_getmicros() - start;
+   }
+
+   *ppu = *saved;
+   ppu_refresh();
+   free(saved);
+   free(rp.vram);
+
+   if (frames <= 0)
+      return -1;
+   result->frames = frames;
+   result->ppu_us = ppu_us / passes / frames;
+   result->blit_us = (all_us > ppu_us ? all_us - ppu_us : 0) / passes / frames;
+   return 0;
+}
+
+#endif /* NES_RENDERTRACE */
@@ -0,0 +1,91 @@
+/*
+** Nofrendo (c) 1998-2000 Matthew Conte (matt@conte.com)
+**
+**
+** This program is free software; you can redistribute it and/or
+** modify it under the terms of version 2 of the GNU Library General 
+** Public License as published by the Free Software Foundation.
+**
+** This program is distributed in the hope that it will be useful, 
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU 
+** Library General Public License for more details.  To obtain a 
+** copy of the GNU Library General Public License, write to the Free 
+** Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+**
+** Any permitted reproduction of these routines, in whole or in part,
+** must bear this legend.
+**
+**
+** nes_rtrace.h
+**
+** Render trace: what the PPU was told over a run of frames (register
+** reads and writes, OAM DMA, pattern and nametable pages and scanline
+** calls), captured into a buffer and replayed through the renderer and
+** the blit with no CPU emulation; compiled in with NES_RENDERTRACE
+*/
+
+#ifndef _NES_RTRACE_H_
+#define _NES_RTRACE_H_
+
+#include <noftypes.h>
+
+#ifdef NES_RENDERTRACE
+
+/* A trace is a header, then events: one opcode byte and what it needs.
+** It opens with a keyframe (registers, palette, OAM, nametables, CHR RAM
+** and all 16 pages) and takes another wherever the PPU's state is loaded
+** (save states, run-ahead, reset). Pattern pages are kept as an offset
+** into CHR ROM or RAM, which the replay takes from the cart it runs with,
+** so a trace only replays with the game it came from.
+*/
+#define  RTRACE_MAGIC      0x3154524E  /* "NRT1" */
+#define  RTRACE_HEADER     16          /* magic, ROM CRC, frames, bytes */
+
+typedef struct rtrace_result_s
+{
+   int frames;
+   uint32 hash;         /* of all frames, replay_frame's hash of each */
+   uint32 ppu_us;       /* per frame, with nothing sent out */
+   uint32 blit_us;      /* per frame, what going through vid_flush adds */
+} rtrace_result_t;
+
+/* hooks in nes_ppu.c, only taken while capturing */
+extern bool rtrace_on;
+
+#define  RTRACE(call)   do { if (rtrace_on) call; } while (0)
+
+extern void rtrace_write(uint32 address, uint8 value);
+extern void rtrace_read(uint32 address);
+extern void rtrace_oam(const uint8 *oam);
+extern void rtrace_pages(int first, int count);
+extern void rtrace_linestart(void);
+extern void rtrace_line(int scanline, bool draw_flag);
+extern void rtrace_endline(int scanline);
+extern void rtrace_context(void);
+
+/* Capture frames frames into buf, from the start of the next one. A
+** capture that runs out of room ends with the last frame that fit.
+*/
+extern void rtrace_capture(uint8 *buf, int size, int frames);
+/* end a capture early, between frames, with the one just flushed */
+extern void rtrace_stop(void);
+/* once per emulated frame, before it runs */
+extern void rtrace_frame(void);
+/* bytes in the finished trace, 0 while it's still going or if there's none */
+extern int rtrace_done(void);
+
+/* Replay a trace passes times with the display off and passes times
+** through vid_flush, after one untimed pass for the hash. The PPU is
+** put back as it was. Returns 0, or -1 if the trace doesn't fit the cart
+** or is damaged.
+*/
+extern int rtrace_bench(const uint8 *trace, int len, int passes, rtrace_result_t *result);
+
+#else /* !NES_RENDERTRACE */
+
+#define  RTRACE(call)
+
+#endif /* !NES_RENDERTRACE */
+
+#endif /* _NES_RTRACE_H_ */
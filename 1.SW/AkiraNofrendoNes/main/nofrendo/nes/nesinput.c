@@ -27,6 +27,9 @@
 #include "nesinput.h"
 #include "log.h"
 
+/* lets the OSD bring the pad up to date right when the game latches it */
+extern void osd_strobeinput(void);
+
 /* TODO: make a linked list of inputs sources, so they
 **       can be removed if need be
 */
@@ -173,6 +176,7 @@ void input_event(nesinput_t *input, int state, int value)
 
 void input_strobe(void)
 {
+   osd_strobeinput();
    pad0_readcount = 0;
    pad1_readcount = 0;
    ppad_readcount = 0;
@@ -24,6 +24,8 @@
 */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include "noftypes.h"
 #include "nesstate.h"
@@ -31,465 +33,308 @@
 #include "nes.h"
 #include "log.h"
 #include "osd.h"
-#include "../libsnss/libsnss.h"
 #include "../cpu/nes6502.h"
 
+extern int osd_loadstate(uint32 crc, int slot, uint8 *data, int size);
+extern void osd_savestate(uint32 crc, int slot, const uint8 *data, int length);
+
 #define FIRST_STATE_SLOT 0
 #define LAST_STATE_SLOT 9
 
-static int state_slot = FIRST_STATE_SLOT;
-
-/* Set the state-save slot to use (0 - 9) */
-void state_setslot(int slot)
-{
-   /* Don't send a message if we're already at that slot */
-   if (state_slot != slot && slot >= FIRST_STATE_SLOT && slot <= LAST_STATE_SLOT)
-   {
-      state_slot = slot;
-      gui_sendmsg(GUI_WHITE, "State slot set to %d", slot);
-   }
-}
+#define STATE_MAGIC     0x53534B41 /* "AKSS" */
+#define STATE_RAMSIZE   0x800
 
-static int save_baseblock(nes_t *state, SNSS_FILE *snssFile)
+/* Native snapshot: the chip contexts as they are, RAM behind them, then
+** the mapper's regions, VRAM and SRAM.  Host byte order and struct layout,
+** so only good for the build and the game that made it, which header and
+** crc check.  Pointers in the contexts are never restored from it: the
+** live ones are kept, and what they point at is rebuilt from bank numbers
+** and offsets.
+*/
+typedef struct state_s
 {
-   int i;
-
-   ASSERT(state);
+   uint32 magic;
+   uint32 header;          /* sizeof(state_t), catches other builds */
+   uint32 crc;             /* PRG ROM CRC of the game */
+   uint32 length;          /* of the whole snapshot */
+
+   nes6502_context cpu;
+   ppu_t ppu;
+   apu_t apu;
+   uint32 regions;         /* bytes of state_region()s after the RAM */
+
+   int prg_bank[4];        /* 8KB banks at $8000-$FFFF */
+   int chr_bank[8];        /* 1KB CHR-ROM banks */
+   int32 chr_offset[8];    /* CHR-RAM: pattern page pointers less VRAM */
+   uint8 nt_map[4];        /* physical nametable behind each logical one */
+
+   bool fiq_occurred;
+   uint8 fiq_state;
+   int fiq_cycles;
+   int scanline;
+   int32 scanline_clocks;
+
+   uint8 ram[STATE_RAMSIZE];
+} state_t;
 
-   nes6502_getcontext(state->cpu);
-   ppu_getcontext(state->ppu);
-
-   snssFile->baseBlock.regA = state->cpu->a_reg;
-   snssFile->baseBlock.regX = state->cpu->x_reg;
-   snssFile->baseBlock.regY = state->cpu->y_reg;
-   snssFile->baseBlock.regFlags = state->cpu->p_reg;
-   snssFile->baseBlock.regStack = state->cpu->s_reg;
-   snssFile->baseBlock.regPc = state->cpu->pc_reg;
-
-   snssFile->baseBlock.reg2000 = state->ppu->ctrl0;
-   snssFile->baseBlock.reg2001 = state->ppu->ctrl1;
-
-   memcpy(snssFile->baseBlock.cpuRam, state->cpu->mem_page[0], 0x800);
-   memcpy(snssFile->baseBlock.spriteRam, state->ppu->oam, 0x100);
-   memcpy(snssFile->baseBlock.ppuRam, state->ppu->nametab, 0x1000);
-
-   /* Mask off priority color bits */
-   for (i = 0; i < 32; i++)
-      snssFile->baseBlock.palette[i] = state->ppu->palette[i] & 0x3F;
-
-   snssFile->baseBlock.mirrorState[0] = (state->ppu->page[8] + 0x2000 - state->ppu->nametab) / 0x400;
-   snssFile->baseBlock.mirrorState[1] = (state->ppu->page[9] + 0x2400 - state->ppu->nametab) / 0x400;
-   snssFile->baseBlock.mirrorState[2] = (state->ppu->page[10] + 0x2800 - state->ppu->nametab) / 0x400;
-   snssFile->baseBlock.mirrorState[3] = (state->ppu->page[11] + 0x2C00 - state->ppu->nametab) / 0x400;
-
-   snssFile->baseBlock.vramAddress = state->ppu->vaddr;
-   snssFile->baseBlock.spriteRamAddress = state->ppu->oam_addr;
-   snssFile->baseBlock.tileXOffset = state->ppu->tile_xofs;
-
-   return 0;
-}
+static int state_slot = FIRST_STATE_SLOT;
 
-static bool save_vramblock(nes_t *state, SNSS_FILE *snssFile)
+static struct
 {
-   ASSERT(state);
-
-   if (NULL == state->rominfo->vram)
-      return -1;
-
-   if (state->rominfo->vram_banks > 2)
-   {
-      log_printf("too many VRAM banks: %d\n", state->rominfo->vram_banks);
-      return -1;
-   }
+   void *data;
+   int size;
+} regions[STATE_REGIONS];
+static int region_count;
+static int region_bytes;
 
-   snssFile->vramBlock.vramSize = VRAM_8K * state->rominfo->vram_banks;
-
-   memcpy(snssFile->vramBlock.vram, state->rominfo->vram, snssFile->vramBlock.vramSize);
-   return 0;
-}
-
-static int save_sramblock(nes_t *state, SNSS_FILE *snssFile)
+void state_region(void *data, int size)
 {
    int i;
-   bool written = false;
-   int sram_length;
 
-   ASSERT(state);
-
-   sram_length = state->rominfo->sram_banks * SRAM_1K;
-
-   /* Check to see if any SRAM was written to */
-   for (i = 0; i < sram_length; i++)
+   for (i = 0; i < region_count; i++)
    {
-      if (state->rominfo->sram[i])
-      {
-         written = true;
-         break;
-      }
+      if (regions[i].data == data)
+         return;
    }
 
-   if (false == written)
-      return -1;
-
-   if (state->rominfo->sram_banks > 8)
+   ASSERT(region_count < STATE_REGIONS);
+   if (region_count == STATE_REGIONS)
    {
-      log_printf("Unsupported number of SRAM banks: %d\n", state->rominfo->sram_banks);
-      return -1;
+      log_printf("state: no room for another region\n");
+      return;
    }
-
-   snssFile->sramBlock.sramSize = SRAM_1K * state->rominfo->sram_banks;
-
-   /* TODO: this should not always be true!! */
-   snssFile->sramBlock.sramEnabled = true;
-
-   memcpy(snssFile->sramBlock.sram, state->rominfo->sram, snssFile->sramBlock.sramSize);
-
-   return 0;
+   regions[region_count].data = data;
+   regions[region_count++].size = size;
+   region_bytes += size;
 }
 
-static int save_soundblock(nes_t *state, SNSS_FILE *snssFile)
+void state_clearregions(void)
 {
-   ASSERT(state);
-
-   apu_getcontext(state->apu);
-
-   /* rect 0 */
-   snssFile->soundBlock.soundRegisters[0x00] = state->apu->rectangle[0].regs[0];
-   snssFile->soundBlock.soundRegisters[0x01] = state->apu->rectangle[0].regs[1];
-   snssFile->soundBlock.soundRegisters[0x02] = state->apu->rectangle[0].regs[2];
-   snssFile->soundBlock.soundRegisters[0x03] = state->apu->rectangle[0].regs[3];
-   /* rect 1 */
-   snssFile->soundBlock.soundRegisters[0x04] = state->apu->rectangle[1].regs[0];
-   snssFile->soundBlock.soundRegisters[0x05] = state->apu->rectangle[1].regs[1];
-   snssFile->soundBlock.soundRegisters[0x06] = state->apu->rectangle[1].regs[2];
-   snssFile->soundBlock.soundRegisters[0x07] = state->apu->rectangle[1].regs[3];
-   /* triangle */
-   snssFile->soundBlock.soundRegisters[0x08] = state->apu->triangle.regs[0];
-   snssFile->soundBlock.soundRegisters[0x0A] = state->apu->triangle.regs[1];
-   snssFile->soundBlock.soundRegisters[0x0B] = state->apu->triangle.regs[2];
-   /* noise */
-   snssFile->soundBlock.soundRegisters[0X0C] = state->apu->noise.regs[0];
-   snssFile->soundBlock.soundRegisters[0X0E] = state->apu->noise.regs[1];
-   snssFile->soundBlock.soundRegisters[0x0F] = state->apu->noise.regs[2];
-   /* dmc */
-   snssFile->soundBlock.soundRegisters[0x10] = state->apu->dmc.regs[0];
-   snssFile->soundBlock.soundRegisters[0x11] = state->apu->dmc.regs[1];
-   snssFile->soundBlock.soundRegisters[0x12] = state->apu->dmc.regs[2];
-   snssFile->soundBlock.soundRegisters[0x13] = state->apu->dmc.regs[3];
-   /* control */
-   snssFile->soundBlock.soundRegisters[0x15] = state->apu->enable_reg;
-
-   return 0;
+   region_count = 0;
+   region_bytes = 0;
 }
 
-static int save_mapperblock(nes_t *state, SNSS_FILE *snssFile)
+/* Set the state-save slot to use (0 - 9) */
+void state_setslot(int slot)
 {
-   int i;
-   ASSERT(state);
-
-   mmc_getcontext(state->mmc);
-
-   /* TODO: filthy hack in snss standard */
-   /* We don't need to write mapper state for mapper 0 */
-   if (0 == state->mmc->intf->number)
-      return -1;
-
-   nes6502_getcontext(state->cpu);
-
-   /* TODO: snss spec should be updated, using 4kB ROM pages.. */
-   for (i = 0; i < 4; i++)
-      snssFile->mapperBlock.prgPages[i] = (state->cpu->mem_page[(i + 4) * 2] - state->rominfo->rom) >> 13;
-
-   if (state->rominfo->vrom_banks)
-   {
-      for (i = 0; i < 8; i++)
-         snssFile->mapperBlock.chrPages[i] = (ppu_getpage(i) - state->rominfo->vrom + (i * 0x400)) >> 10;
-   }
-   else
+   /* Don't send a message if we're already at that slot */
+   if (state_slot != slot && slot >= FIRST_STATE_SLOT && slot <= LAST_STATE_SLOT)
    {
-      /* bleh! slight hack */
-      for (i = 0; i < 8; i++)
-         snssFile->mapperBlock.chrPages[i] = i;
+      state_slot = slot;
+      gui_sendmsg(GUI_WHITE, "State slot set to %d", slot);
    }
+}
 
-   if (state->mmc->intf->get_state)
-      state->mmc->intf->get_state(&snssFile->mapperBlock);
+static int vram_length(const rominfo_t *rominfo)
+{
+   return rominfo->vram ? VRAM_8K * rominfo->vram_banks : 0;
+}
 
-   return 0;
+static int sram_length(const rominfo_t *rominfo)
+{
+   return rominfo->sram ? SRAM_1K * rominfo->sram_banks : 0;
 }
 
-static void load_baseblock(nes_t *state, SNSS_FILE *snssFile)
+/* Bytes a snapshot of the running game takes */
+int state_snapshotsize(void)
 {
-   int i;
+   nes_t *machine = nes_getcontextptr();
 
-   ASSERT(state);
+   return sizeof(state_t) + region_bytes + vram_length(machine->rominfo) + sram_length(machine->rominfo);
+}
 
-   nes6502_getcontext(state->cpu);
-   ppu_getcontext(state->ppu);
+/* Snapshot the running game into buf, returns its length or -1 if buf
+** is too small.  Only call between frames.
+*/
+int state_snapshot(uint8 *buf, int size)
+{
+   nes_t *machine = nes_getcontextptr();
+   state_t *state = (state_t *) buf;
+   uint8 *data = buf + sizeof(state_t);
+   int vram = vram_length(machine->rominfo);
+   int i;
 
-   state->cpu->a_reg = snssFile->baseBlock.regA;
-   state->cpu->x_reg = snssFile->baseBlock.regX;
-   state->cpu->y_reg = snssFile->baseBlock.regY;
-   state->cpu->p_reg = snssFile->baseBlock.regFlags;
-   state->cpu->s_reg = snssFile->baseBlock.regStack;
-   state->cpu->pc_reg = snssFile->baseBlock.regPc;
+   if (size < state_snapshotsize())
+      return -1;
 
-   state->ppu->ctrl0 = snssFile->baseBlock.reg2000;
-   state->ppu->ctrl1 = snssFile->baseBlock.reg2001;
+   nes6502_getcontext(machine->cpu);
+   ppu_getcontext(machine->ppu);
+   apu_getcontext(machine->apu);
 
-   memcpy(state->cpu->mem_page[0], snssFile->baseBlock.cpuRam, 0x800);
-   memcpy(state->ppu->oam, snssFile->baseBlock.spriteRam, 0x100);
-   memcpy(state->ppu->nametab, snssFile->baseBlock.ppuRam, 0x1000);
-   memcpy(state->ppu->palette, snssFile->baseBlock.palette, 0x20);
+   state->magic = STATE_MAGIC;
+   state->header = sizeof(state_t);
+   state->crc = machine->rominfo->crc;
+   state->length = state_snapshotsize();
 
-   /* TODO: argh, this is to handle nofrendo's filthy sprite priority method */
-   for (i = 0; i < 8; i++)
-      state->ppu->palette[i << 2] = state->ppu->palette[0] | 0x80; // BG_TRANS_MASK;
+   state->cpu = *machine->cpu;
+   state->ppu = *machine->ppu;
+   state->apu = *machine->apu;
+   state->regions = region_bytes;
 
    for (i = 0; i < 4; i++)
+      state->prg_bank[i] = mmc_getprgbank(0x8000 + i * 0x2000);
+   for (i = 0; i < 8; i++)
    {
-      state->ppu->page[i + 8] = state->ppu->page[i + 12] =
-          state->ppu->nametab + (snssFile->baseBlock.mirrorState[i] * 0x400) - (0x2000 + (i * 0x400));
+      state->chr_bank[i] = mmc_getchrbank(i * 0x400);
+      state->chr_offset[i] = machine->rominfo->vram ? (int32) (machine->ppu->page[i] - machine->rominfo->vram) : 0;
    }
+   /* ppu_getcontext made these relative to the copy's nametab */
+   for (i = 0; i < 4; i++)
+      state->nt_map[i] = ((machine->ppu->page[8 + i] + 0x2000 + (i << 10) - machine->ppu->nametab) >> 10) & 3;
 
-   state->ppu->vaddr = snssFile->baseBlock.vramAddress;
-   state->ppu->oam_addr = snssFile->baseBlock.spriteRamAddress;
-   state->ppu->tile_xofs = snssFile->baseBlock.tileXOffset;
-
-   /* do some extra handling */
-   state->ppu->flipflop = 0;
-   state->ppu->strikeflag = false;
-
-   nes6502_setcontext(state->cpu);
-   ppu_setcontext(state->ppu);
-
-   ppu_write(PPU_CTRL0, state->ppu->ctrl0);
-   ppu_write(PPU_CTRL1, state->ppu->ctrl1);
-   ppu_write(PPU_VADDR, (uint8)(state->ppu->vaddr >> 8));
-   ppu_write(PPU_VADDR, (uint8)(state->ppu->vaddr & 0xFF));
-}
-
-static void load_vramblock(nes_t *state, SNSS_FILE *snssFile)
-{
-   ASSERT(state);
-
-   ASSERT(snssFile->vramBlock.vramSize <= VRAM_8K); /* can't handle more than this! */
-   memcpy(state->rominfo->vram, snssFile->vramBlock.vram, snssFile->vramBlock.vramSize);
-}
+   state->fiq_occurred = machine->fiq_occurred;
+   state->fiq_state = machine->fiq_state;
+   state->fiq_cycles = machine->fiq_cycles;
+   state->scanline = machine->scanline;
+   state->scanline_clocks = machine->scanline_clocks;
 
-static void load_sramblock(nes_t *state, SNSS_FILE *snssFile)
-{
-   ASSERT(state);
+   memcpy(state->ram, machine->cpu->mem_page[0], STATE_RAMSIZE);
 
-   ASSERT(snssFile->sramBlock.sramSize <= SRAM_8K); /* can't handle more than this! */
-   memcpy(state->rominfo->sram, snssFile->sramBlock.sram, snssFile->sramBlock.sramSize);
-}
+   /* the mapper brings its regions up to date first */
+   if (machine->mmc->intf->get_state)
+      machine->mmc->intf->get_state();
+   for (i = 0; i < region_count; i++)
+   {
+      memcpy(data, regions[i].data, regions[i].size);
+      data += regions[i].size;
+   }
+   memcpy(data, machine->rominfo->vram, vram);
+   memcpy(data + vram, machine->rominfo->sram, sram_length(machine->rominfo));
 
-static void load_controllerblock(nes_t *state, SNSS_FILE *snssFile)
-{
-   UNUSED(state);
-   UNUSED(snssFile);
+   return state->length;
 }
 
-static void load_soundblock(nes_t *state, SNSS_FILE *snssFile)
+/* Put the running game back the way a snapshot of it found it */
+int state_restore(const uint8 *buf, int length)
 {
+   nes_t *machine = nes_getcontextptr(); /* the live machine, not a copy */
+   const state_t *state = (const state_t *) buf;
+   const uint8 *data = buf + sizeof(state_t);
+   int vram = vram_length(machine->rominfo);
+   ppu_t *ppu = machine->ppu;
+   uint8 *pages[8];
+   ppulatchfunc_t latchfunc;
+   ppuvromswitch_t vromswitch;
+   bool drawsprites;
    int i;
 
-   ASSERT(state);
+   if (length < (int) sizeof(state_t) || STATE_MAGIC != state->magic
+       || sizeof(state_t) != state->header || machine->rominfo->crc != state->crc
+       || region_bytes != (int) state->regions || state_snapshotsize() != (int) state->length || length < (int) state->length)
+      return -1;
 
-   for (i = 0; i < 0x15; i++)
+   /* CPU: registers and counters, everything after the page tables */
+   nes6502_getcontext(machine->cpu);
+   memcpy(&machine->cpu->pc_reg, &state->cpu.pc_reg,
+          sizeof(nes6502_context) - offsetof(nes6502_context, pc_reg));
+   nes6502_setcontext(machine->cpu);
+   memcpy(machine->cpu->mem_page[0], state->ram, STATE_RAMSIZE);
+
+   /* PPU: all but the pattern pages, mapper hooks and sprite switch */
+   ppu_getcontext(ppu);
+   memcpy(pages, ppu->page, sizeof(pages));
+   latchfunc = ppu->latchfunc;
+   vromswitch = ppu->vromswitch;
+   drawsprites = ppu->drawsprites;
+   *ppu = state->ppu;
+   memcpy(ppu->page, pages, sizeof(pages));
+   ppu->latchfunc = latchfunc;
+   ppu->vromswitch = vromswitch;
+   ppu->drawsprites = drawsprites;
+   for (i = 0; i < 4; i++)
    {
-      if (i != 0x13) /* do NOT trigger OAM DMA! */
-         apu_write(0x4000 + i, snssFile->soundBlock.soundRegisters[i]);
+      ppu->page[8 + i] = ppu->nametab + (state->nt_map[i] << 10) - (0x2000 + (i << 10));
+      ppu->page[12 + i] = ppu->page[8 + i] - 0x1000;
    }
-}
+   ppu_setcontext(ppu);
 
-/* TODO: magic numbers galore */
-static void load_mapperblock(nes_t *state, SNSS_FILE *snssFile)
-{
-   int i;
+   /* APU: the channels, which come before the output setup */
+   apu_getcontext(machine->apu);
+   memcpy(machine->apu, &state->apu, offsetof(apu_t, buffer));
+   apu_setcontext(machine->apu);
 
-   ASSERT(state);
+   machine->fiq_occurred = state->fiq_occurred;
+   machine->fiq_state = state->fiq_state;
+   machine->fiq_cycles = state->fiq_cycles;
+   machine->scanline = state->scanline;
+   machine->scanline_clocks = state->scanline_clocks;
 
-   mmc_getcontext(state->mmc);
+   memcpy(machine->rominfo->vram, data + region_bytes, vram);
+   memcpy(machine->rominfo->sram, data + region_bytes + vram, sram_length(machine->rominfo));
 
+   /* banks last, they go through the PRG/CHR caches */
    for (i = 0; i < 4; i++)
-      mmc_bankrom(8, 0x8000 + (i * 0x2000), snssFile->mapperBlock.prgPages[i]);
-
-   if (state->rominfo->vrom_banks)
+      mmc_bankrom(8, 0x8000 + i * 0x2000, state->prg_bank[i]);
+   for (i = 0; i < 8; i++)
    {
-      for (i = 0; i < 8; i++)
-         mmc_bankvrom(1, i * 0x400, snssFile->mapperBlock.chrPages[i]);
+      if (machine->rominfo->vrom_banks)
+         mmc_bankvrom(1, i * 0x400, state->chr_bank[i]);
+      else if (machine->rominfo->vram)
+         ppu_setpage(1, i, machine->rominfo->vram + state->chr_offset[i]);
    }
-   else
+   /* then the mapper, and whatever it derives from its registers */
+   for (i = 0; i < region_count; i++)
    {
-      ASSERT(state->rominfo->vram);
-
-      for (i = 0; i < 8; i++)
-         ppu_setpage(1, i, state->rominfo->vram);
+      memcpy(regions[i].data, data, regions[i].size);
+      data += regions[i].size;
    }
+   if (machine->mmc->intf->set_state)
+      machine->mmc->intf->set_state();
 
-   if (state->mmc->intf->set_state)
-      state->mmc->intf->set_state(&snssFile->mapperBlock);
-
-   mmc_setcontext(state->mmc);
+   return 0;
 }
 
 int state_save(void)
 {
-   SNSS_FILE *snssFile;
-   SNSS_RETURN_CODE status;
-   char fn[PATH_MAX + 1], ext[5];
-   nes_t *machine;
-
-   /* get the pointer to our NES machine context */
-   machine = nes_getcontextptr();
-   ASSERT(machine);
-
-   /* build our filename using the image's name and the slot number */
-   strncpy(fn, machine->rominfo->filename, PATH_MAX - 4);
+   nes_t *machine = nes_getcontextptr();
+   int size = state_snapshotsize();
+   uint8 *buf;
 
    ASSERT(state_slot >= FIRST_STATE_SLOT && state_slot <= LAST_STATE_SLOT);
-   sprintf(ext, ".ss%d", state_slot);
-   osd_newextension(fn, ext);
-
-   /* open our state file for writing */
-   status = SNSS_OpenFile(&snssFile, fn, SNSS_OPEN_WRITE);
-   if (SNSS_OK != status)
-      goto _error;
 
-   /* now get all of our blocks */
-   if (0 == save_baseblock(machine, snssFile))
+   buf = malloc(size);
+   if (NULL == buf)
    {
-      status = SNSS_WriteBlock(snssFile, SNSS_BASR);
-      if (SNSS_OK != status)
-         goto _error;
-   }
-
-   if (0 == save_vramblock(machine, snssFile))
-   {
-      status = SNSS_WriteBlock(snssFile, SNSS_VRAM);
-      if (SNSS_OK != status)
-         goto _error;
-   }
-
-   if (0 == save_sramblock(machine, snssFile))
-   {
-      status = SNSS_WriteBlock(snssFile, SNSS_SRAM);
-      if (SNSS_OK != status)
-         goto _error;
-   }
-
-   if (0 == save_soundblock(machine, snssFile))
-   {
-      status = SNSS_WriteBlock(snssFile, SNSS_SOUN);
-      if (SNSS_OK != status)
-         goto _error;
-   }
-
-   if (0 == save_mapperblock(machine, snssFile))
-   {
-      status = SNSS_WriteBlock(snssFile, SNSS_MPRD);
-      if (SNSS_OK != status)
-         goto _error;
+      gui_sendmsg(GUI_RED, "No room for a state");
+      return -1;
    }
 
-   /* close the file, we're done */
-   status = SNSS_CloseFile(&snssFile);
-   if (SNSS_OK != status)
-      goto _error;
+   /* the OSD takes a copy and writes it out in its own time */
+   state_snapshot(buf, size);
+   osd_savestate(machine->rominfo->crc, state_slot, buf, size);
+   free(buf);
 
    gui_sendmsg(GUI_GREEN, "State %d saved", state_slot);
    return 0;
-
-_error:
-   gui_sendmsg(GUI_RED, "error: %s", SNSS_GetErrorString(status));
-   SNSS_CloseFile(&snssFile);
-   return -1;
 }
 
 int state_load(void)
 {
-   SNSS_FILE *snssFile;
-   SNSS_RETURN_CODE status;
-   SNSS_BLOCK_TYPE block_type;
-   char fn[PATH_MAX + 1], ext[5];
-   unsigned int i;
-   nes_t *machine;
-
-   /* get our machine's context pointer */
-   machine = nes_getcontextptr();
-   ASSERT(machine);
-
-   /* build the state name using the ROM's name and the slot number */
-   strncpy(fn, machine->rominfo->filename, PATH_MAX - 4);
+   nes_t *machine = nes_getcontextptr();
+   int size = state_snapshotsize();
+   int length;
+   uint8 *buf;
 
    ASSERT(state_slot >= FIRST_STATE_SLOT && state_slot <= LAST_STATE_SLOT);
-   sprintf(ext, ".ss%d", state_slot);
-   osd_newextension(fn, ext);
 
-   /* open our file for writing */
-   status = SNSS_OpenFile(&snssFile, fn, SNSS_OPEN_READ);
-   if (SNSS_OK != status)
-      goto _error;
-
-   /* iterate through all present blocks */
-   for (i = 0; i < snssFile->headerBlock.numberOfBlocks; i++)
+   buf = malloc(size);
+   if (NULL == buf)
    {
-      status = SNSS_GetNextBlockType(&block_type, snssFile);
-      if (SNSS_OK != status)
-         goto _error;
-
-      status = SNSS_ReadBlock(snssFile, block_type);
-      if (SNSS_OK != status)
-         goto _error;
-
-      switch (block_type)
-      {
-      case SNSS_BASR:
-         load_baseblock(machine, snssFile);
-         break;
-
-      case SNSS_VRAM:
-         load_vramblock(machine, snssFile);
-         break;
-
-      case SNSS_SRAM:
-         load_sramblock(machine, snssFile);
-         break;
-
-      case SNSS_MPRD:
-         load_mapperblock(machine, snssFile);
-         break;
-
-      case SNSS_CNTR:
-         load_controllerblock(machine, snssFile);
-         break;
-
-      case SNSS_SOUN:
-         load_soundblock(machine, snssFile);
-         break;
-
-      case SNSS_UNKNOWN_BLOCK:
-      default:
-         log_printf("unknown SNSS block type\n");
-         break;
-      }
+      gui_sendmsg(GUI_RED, "No room for a state");
+      return -1;
    }
 
-   /* close file, we're done */
-   status = SNSS_CloseFile(&snssFile);
-   if (SNSS_OK != status)
-      goto _error;
+   length = osd_loadstate(machine->rominfo->crc, state_slot, buf, size);
+   if (length < 0 || state_restore(buf, length))
+   {
+      free(buf);
+      gui_sendmsg(GUI_RED, "No state %d", state_slot);
+      return -1;
+   }
+   free(buf);
 
    gui_sendmsg(GUI_GREEN, "State %d restored", state_slot);
-
    return 0;
-
-_error:
-   gui_sendmsg(GUI_RED, "error: %s", SNSS_GetErrorString(status));
-   SNSS_CloseFile(&snssFile);
-   return -1;
 }
 
 /*
@@ -32,6 +32,22 @@ extern void state_setslot(int slot);
 extern int state_load();
 extern int state_save();
 
+/* in-memory snapshots, a few memcpys each way */
+extern int state_snapshotsize(void);
+extern int state_snapshot(uint8 *buf, int size);
+extern int state_restore(const uint8 *buf, int length);
+
+/* State outside the chip contexts, the mapper's registers and IRQ counter
+** and its sound chip's channels: plain data, no pointers, registered by
+** their init routines and copied as it is.  Registering the same region
+** again does nothing, so inits can run on every reset.  The regions are
+** forgotten when a new cart goes in.
+*/
+#define STATE_REGIONS 8
+
+extern void state_region(void *data, int size);
+extern void state_clearregions(void);
+
 #endif /* _NESSTATE_H_ */
 
 /*
@@ -35,6 +35,7 @@
 #include "../nofrendo/log.h"
 #include "../nofrendo/nes/nes.h"
 #include "../nofrendo/nes/nes_pal.h"
+#include "../nofrendo/nes/nes_prof.h"
 #include "../nofrendo/nes/nesinput.h"
 #include "../nofrendo/osd.h"
 #include <stdint.h>
@@ -86,13 +87,15 @@ static void shutdown_everything(void)
 }
 
 /* End the current context */
+/* This is called from event handlers, i.e. from inside nes_emulate, so it
+** only stops the machine: internal_insert destroys it once it's returned.
+*/
 void main_eject(void)
 {
    switch (console.type)
    {
    case system_nes:
       nes_poweroff();
-      nes_destroy(&(console.machine.nes));
       break;
 
    default:
@@ -160,24 +163,31 @@ static int internal_insert(const char *filename, system_t type)
    switch (console.type)
    {
    case system_nes:
-      gui_setrefresh(NES_REFRESH_RATE);
-
+      prof_startbegin();
       console.machine.nes = nes_create();
       if (NULL == console.machine.nes)
       {
-         log_printf("Failed to create NES instance.\n");
+         log_printf(LOG_ERROR "Failed to create NES instance.\n");
          return -1;
       }
+      prof_startstage(STARTUP_CREATE);
 
       if (nes_insertcart(console.filename, console.machine.nes))
+      {
+         nes_destroy(&(console.machine.nes));
          return -1;
+      }
 
       vid_setmode(NES_SCREEN_WIDTH, NES_VISIBLE_HEIGHT);
 
-      if (install_timer(NES_REFRESH_RATE))
+      /* the cart is in: the frame rate is its TV system's */
+      gui_setrefresh(console.machine.nes->timing->refresh_rate);
+      if (install_timer(console.machine.nes->timing->refresh_rate))
          return -1;
+      prof_startstage(STARTUP_VIDEO);
 
       nes_emulate();
+      nes_destroy(&(console.machine.nes));
       break;
 
    case system_unknown:
@@ -248,9 +258,14 @@ int main_loop(const char *filename, system_t type)
    while (false == console.quit)
    {
       if (internal_insert(console.nextfilename, console.nexttype))
+      {
+         shutdown_everything();
          return 1;
+      }
    }
 
+   /* everything is set up again by the next nofrendo_main */
+   shutdown_everything();
    return 0;
 }
 
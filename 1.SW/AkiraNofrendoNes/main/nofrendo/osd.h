@@ -83,6 +83,37 @@ extern int osd_main(int argc, char *argv[]);
 
 extern int osd_installtimer(int frequency, void *func, int funcsize,
                             void *counter, int countersize);
+/* block until the timer installed above next fires */
+extern void osd_waitframe(void);
+/* a frame was emulated, drawn or skipped: time to pull its audio */
+extern void osd_endframe(void);
+/* the emulator stopped for a pause (true) or goes on again (false); no
+** audio is made in between, the sound output can be stopped
+*/
+extern void osd_pause(bool paused);
+/* the slowest the CPU may be clocked while this game runs, from its
+** profile (nes_gamedb.h), in MHz; 0 for no floor
+*/
+extern void osd_setminclock(int mhz);
+#ifdef NES_FASTFORWARD
+/* fast-forward goes on or off: while on, frames come as fast as they can
+** be made and only one in NES_FASTFORWARD is drawn
+*/
+extern void osd_fastforward(bool on);
+#endif
+/* free running microsecond clock, for timing frames */
+extern uint32 osd_getmicros(void);
+#ifdef NES_PROFILE
+/* cycle counter of the calling core, and platform stats for the profiling
+** overlay: line 0 up to PROF_OSD_LINES - 1, left empty if there's nothing
+*/
+extern uint32 osd_getcycles(void);
+extern void osd_profinfo(int line, char *buf, int len);
+#endif
+#ifdef NES_HEATMAP
+/* a running count of the platform's flash cache misses, 0 if it has none */
+extern uint32 osd_getcachemisses(void);
+#endif
 
 /* filename manipulation */
 extern void osd_fullname(char *fullname, const char *shortname);
@@ -94,6 +125,10 @@ extern void osd_getmouse(int *x, int *y, int *button);
 
 /* build a filename for a snapshot, return -ve for error */
 extern int osd_makesnapname(char *filename, int len);
+/* take a snapshot to store in the background: copy the frame and palette
+** and return 0, or -ve to have it written to osd_makesnapname here
+*/
+extern int osd_savesnap(bitmap_t *bmp, rgb_t *pal);
 
 #endif /* !NSF_PLAYER */
 
@@ -29,11 +29,29 @@
 #include <bitmap.h>
 #include <pcx.h>
 
-/* Save a PCX snapshot from a given NES bitmap */
-int pcx_write(char *filename, bitmap_t *bmp, rgb_t *pal)
+/* where an encoded snapshot goes: a file, or memory from p up to end */
+typedef struct pcxout_s
 {
    FILE *fp;
+   uint8 *p, *end;
+} pcxout_t;
+
+static int pcx_put(pcxout_t *out, const void *data, int length)
+{
+   if (out->fp)
+      return (fwrite(data, 1, length, out->fp) == (size_t) length) ? 0 : -1;
+
+   if (out->end - out->p < length)
+      return -1;
+   memcpy(out->p, data, length);
+   out->p += length;
+   return 0;
+}
+
+static int pcx_encode_to(pcxout_t *out, bitmap_t *bmp, rgb_t *pal)
+{
    pcxheader_t header;
+   uint8 rgb[3];
    int i, line;
    int width, height, x_min, y_min;
 
@@ -44,10 +62,6 @@ int pcx_write(char *filename, bitmap_t *bmp, rgb_t *pal)
    x_min = 0;
    y_min = 0;
 
-   fp = fopen(filename, "wb");
-   if (NULL == fp)
-      return -1;
-
    /* Fill in the header nonsense */
    memset(&header, 0, sizeof(header));
 
@@ -65,12 +79,13 @@ int pcx_write(char *filename, bitmap_t *bmp, rgb_t *pal)
    header.HscreenSize = width - 1;
    header.VscreenSize = height - 1;
 
-   fwrite(&header, 1, sizeof(header), fp);
+   if (pcx_put(out, &header, sizeof(header)))
+      return -1;
 
    /* RLE encoding */
    for (line = 0; line < height; line++)
    {
-      uint8 last, *mem;
+      uint8 last, *mem, run[2];
       int xpos = 0;
 
       mem = bmp->line[line + y_min] + x_min;
@@ -85,34 +100,70 @@ int pcx_write(char *filename, bitmap_t *bmp, rgb_t *pal)
             xpos++;
             rle_count++;
          }
-         while (*mem == last && xpos < width && rle_count < 0x3F);
+         while (xpos < width && *mem == last && rle_count < 0x3F);
 
+         run[0] = 0xC0 | rle_count;
+         run[1] = last;
          if (rle_count > 1 || 0xC0 == (last & 0xC0))
-         {
-            fputc(0xC0 | rle_count, fp);
-            fputc(last, fp);
-         }
+            i = pcx_put(out, run, 2);
          else
-         {
-            fputc(last, fp);
-         }
+            i = pcx_put(out, &last, 1);
+         if (i)
+            return -1;
       }
    }
 
    /* Write palette */
-   fputc(0x0C, fp); /* $0C signifies 256 color palette */
+   rgb[0] = 0x0C; /* $0C signifies 256 color palette */
+   if (pcx_put(out, rgb, 1))
+      return -1;
    for (i = 0; i < 256; i++)
    {
-      fputc(pal[i].r, fp);
-      fputc(pal[i].g, fp);
-      fputc(pal[i].b, fp);
+      rgb[0] = pal[i].r;
+      rgb[1] = pal[i].g;
+      rgb[2] = pal[i].b;
+      if (pcx_put(out, rgb, 3))
+         return -1;
    }
 
-   /* We're done! */
-   fclose(fp);
    return 0;
 }
 
+/* Encode a PCX snapshot of a given NES bitmap into memory, for OSDs that
+** store it somewhere other than a file; returns its length, -1 if it
+** doesn't fit in size bytes (PCX_MAXSIZE always does)
+*/
+int pcx_encode(uint8 *buf, int size, bitmap_t *bmp, rgb_t *pal)
+{
+   pcxout_t out;
+
+   out.fp = NULL;
+   out.p = buf;
+   out.end = buf + size;
+   if (pcx_encode_to(&out, bmp, pal))
+      return -1;
+   return out.p - buf;
+}
+
+/* Save a PCX snapshot from a given NES bitmap */
+int pcx_write(char *filename, bitmap_t *bmp, rgb_t *pal)
+{
+   pcxout_t out;
+   int ret;
+
+   memset(&out, 0, sizeof(out));
+   out.fp = fopen(filename, "wb");
+   if (NULL == out.fp)
+      return -1;
+
+   ret = pcx_encode_to(&out, bmp, pal);
+
+   /* We're done! */
+   if (fclose(out.fp))
+      ret = -1;
+   return ret;
+}
+
 /*
 ** $Log: pcx.c,v $
 ** Revision 1.2  2001/04/27 14:37:11  neil
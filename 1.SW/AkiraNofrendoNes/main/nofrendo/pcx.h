@@ -52,6 +52,10 @@ typedef struct pcxheader_s
    uint8  Filler[54]       __PACKED__;
 } pcxheader_t;
 
+/* the most a width x height snapshot can take: every pixel escaped */
+#define  PCX_MAXSIZE(width, height)  ((int) sizeof(pcxheader_t) + 2 * (width) * (height) + 769)
+
+extern int pcx_encode(uint8 *out, int size, bitmap_t *bmp, rgb_t *pal);
 extern int pcx_write(char *filename, bitmap_t *bmp, rgb_t *pal);
 
 #endif /* _PCX_H_ */
@@ -30,12 +30,13 @@
 static int32 fds_incsize = 0;
 
 /* mix sound channels together */
-static int32 fds_process(void)
+static int fds_render(int32 *out, int count)
 {
-   int32 output;
-   output = 0;
+   UNUSED(out);
+   UNUSED(count);
 
-   return output;
+   /* no fds channels yet: always silent */
+   return 0;
 }
 
 /* write to registers */
@@ -65,9 +66,10 @@ apuext_t fds_ext =
         NULL, /* no init */
         NULL, /* no shutdown */
         fds_reset,
-        fds_process,
+        NULL, /* renders in blocks */
         NULL, /* no reads */
-        fds_memwrite};
+        fds_memwrite,
+        fds_render};
 
 /*
 ** $Log: fds_snd.c,v $
@@ -27,6 +27,7 @@
 #include "noftypes.h"
 #include "mmc5_snd.h"
 #include "../sndhrdw/nes_apu.h"
+#include "../nes/nesstate.h"
 
 /* TODO: encapsulate apu/mmc5 rectangle */
 
@@ -68,7 +69,7 @@ typedef struct mmc5rectangle_s
 
    bool enabled;
 
-   float accum;
+   int32 accum; /* 16.16 */
    int32 freq;
    int32 output_vol;
    bool fixed_envelope;
@@ -92,7 +93,7 @@ typedef struct mmc5dac_s
 
 static struct
 {
-   float incsize;
+   int32 incsize;
    uint8 mul[2];
    mmc5rectangle_t rect[2];
    mmc5dac_t dac;
@@ -153,7 +154,7 @@ static int32 mmc5_rectangle(mmc5rectangle_t *chan)
 
    while (chan->accum < 0)
    {
-      chan->accum += chan->freq;
+      chan->accum += APU_FIXED(chan->freq);
       chan->adder = (chan->adder + 1) & 0x0F;
 
 #ifdef APU_OVERSAMPLE
@@ -202,17 +203,31 @@ static uint8 mmc5_read(uint32 address)
    }
 }
 
-/* mix vrcvi sound channels together */
-static int32 mmc5_process(void)
+/* a rectangle that has died away stays at 0 until it's written to */
+#define MMC5_SILENT(chan) (0 == (chan)->output_vol && (false == (chan)->enabled || 0 == (chan)->vbl_length))
+
+/* mix a block of mmc5 sound channels together */
+static int mmc5_render(int32 *out, int count)
 {
-   int32 accum;
+   int32 accum, any = 0;
+   int i;
+
+   /* most MMC5 games never use the channels: nothing to mix */
+   if (false == mmc5.dac.enabled && MMC5_SILENT(&mmc5.rect[0]) && MMC5_SILENT(&mmc5.rect[1]))
+      return 0;
 
-   accum = mmc5_rectangle(&mmc5.rect[0]);
-   accum += mmc5_rectangle(&mmc5.rect[1]);
-   if (mmc5.dac.enabled)
-      accum += mmc5.dac.output;
+   for (i = 0; i < count; i++)
+   {
+      accum = mmc5_rectangle(&mmc5.rect[0]);
+      accum += mmc5_rectangle(&mmc5.rect[1]);
+      if (mmc5.dac.enabled)
+         accum += mmc5.dac.output;
+
+      out[i] = accum;
+      any |= accum;
+   }
 
-   return accum;
+   return (0 != any);
 }
 
 /* write to registers */
@@ -346,6 +361,7 @@ static int mmc5_init(void)
    for (i = 0; i < 32; i++)
       vbl_lut[i] = vbl_length[i] * num_samples;
 
+   state_region(&mmc5, sizeof(mmc5));
    return 0;
 }
 
@@ -366,9 +382,10 @@ apuext_t mmc5_ext =
         mmc5_init,
         NULL, /* no shutdown */
         mmc5_reset,
-        mmc5_process,
+        NULL, /* renders in blocks */
         mmc5_memread,
-        mmc5_memwrite};
+        mmc5_memwrite,
+        mmc5_render};
 
 /*
 ** $Log: mmc5_snd.c,v $
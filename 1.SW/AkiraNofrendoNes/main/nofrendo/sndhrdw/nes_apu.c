@@ -24,12 +24,16 @@
 */
 
 #include <string.h>
+#include <stddef.h>
+#include <stdint.h>
 #include "noftypes.h"
 #include "log.h"
 #include "../sndhrdw/nes_apu.h"
 #include "../cpu/nes6502.h"
+#include "../nes/nes_arena.h"
 
 #define APU_OVERSAMPLE
+#define APU_BLIP
 #define APU_VOLUME_DECAY(x) ((x) -= ((x) >> 7))
 
 /* the following seem to be the correct (empirically determined)
@@ -48,12 +52,6 @@ static int32 decay_lut[16];
 static int vbl_lut[32];
 static int trilength_lut[128];
 
-/* noise lookups for both modes */
-#ifndef REALTIME_NOISE
-static int8 noise_long_lut[APU_NOISE_32K];
-static int8 noise_short_lut[APU_NOISE_93];
-#endif /* !REALTIME_NOISE */
-
 /* vblank length table used for rectangles, triangle, noise */
 static const uint8 vbl_length[32] =
     {
@@ -79,33 +77,47 @@ static const int freq_limit[8] =
     {
         0x3FF, 0x555, 0x666, 0x71C, 0x787, 0x7C1, 0x7E0, 0x7F0};
 
-/* noise frequency lookup table */
-static const int noise_freq[16] =
+/* noise frequency lookup table, NTSC and PAL */
+static const int noise_freq[2][16] =
     {
-        4, 8, 16, 32, 64, 96, 128, 160,
-        202, 254, 380, 508, 762, 1016, 2034, 4068};
+        {4, 8, 16, 32, 64, 96, 128, 160,
+         202, 254, 380, 508, 762, 1016, 2034, 4068},
+        {4, 8, 14, 30, 60, 88, 118, 148,
+         188, 236, 354, 472, 708, 944, 1890, 3778}};
 
-/* DMC transfer freqs */
-const int dmc_clocks[16] =
+/* DMC transfer freqs, NTSC and PAL */
+static const int dmc_clocks[2][16] =
     {
-        428, 380, 340, 320, 286, 254, 226, 214,
-        190, 160, 142, 128, 106, 85, 72, 54};
+        {428, 380, 340, 320, 286, 254, 226, 214,
+         190, 160, 142, 128, 106, 85, 72, 54},
+        {398, 354, 316, 298, 276, 236, 210, 198,
+         176, 148, 132, 118, 98, 78, 66, 50}};
 
 /* ratios of pos/neg pulse for rectangle waves */
 static const int duty_flip[4] = {2, 4, 8, 12};
 
+#ifdef APU_BLIP
+/* see the register journal, before apu_write */
+static void apu_journal_flush(void);
+#else  /* !APU_BLIP */
+#define apu_journal_flush()
+#endif /* !APU_BLIP */
+
 void apu_setcontext(apu_t *src_apu)
 {
+   apu_journal_flush();
    apu = *src_apu;
 }
 
 void apu_getcontext(apu_t *dest_apu)
 {
+   apu_journal_flush();
    *dest_apu = apu;
 }
 
 void apu_setchan(int chan, bool enabled)
 {
+   apu_journal_flush();
    if (enabled)
       apu.mix_enable |= (1 << chan);
    else
@@ -114,54 +126,22 @@ void apu_setchan(int chan, bool enabled)
 
 /* emulation of the 15-bit shift register the
 ** NES uses to generate pseudo-random series
-** for the white noise channel
+** for the white noise channel, stepped as it
+** clocks rather than played from a table
 */
-#ifdef REALTIME_NOISE
-INLINE int8 shift_register15(uint8 xor_tap)
+INLINE int8 shift_register15(void)
 {
-   static int sreg = 0x4000;
    int bit0, tap, bit14;
 
-   bit0 = sreg & 1;
-   tap = (sreg & xor_tap) ? 1 : 0;
+   bit0 = apu.noise.sreg & 1;
+   tap = (apu.noise.sreg & apu.noise.xor_tap) ? 1 : 0;
    bit14 = (bit0 ^ tap);
-   sreg >>= 1;
-   sreg |= (bit14 << 14);
+   apu.noise.sreg >>= 1;
+   apu.noise.sreg |= (bit14 << 14);
    return (bit0 ^ 1);
 }
-#else  /* !REALTIME_NOISE */
-static void shift_register15(int8 *buf, int count)
-{
-   static int sreg = 0x4000;
-   int bit0, bit1, bit6, bit14;
-
-   if (count == APU_NOISE_93)
-   {
-      while (count--)
-      {
-         bit0 = sreg & 1;
-         bit6 = (sreg & 0x40) >> 6;
-         bit14 = (bit0 ^ bit6);
-         sreg >>= 1;
-         sreg |= (bit14 << 14);
-         *buf++ = bit0 ^ 1;
-      }
-   }
-   else /* 32K noise */
-   {
-      while (count--)
-      {
-         bit0 = sreg & 1;
-         bit1 = (sreg & 2) >> 1;
-         bit14 = (bit0 ^ bit1);
-         sreg >>= 1;
-         sreg |= (bit14 << 14);
-         *buf++ = bit0 ^ 1;
-      }
-   }
-}
-#endif /* !REALTIME_NOISE */
 
+#ifndef APU_BLIP
 /* RECTANGLE WAVE
 ** ==============
 ** reg0: 0-3=volume, 4=envelope, 5=hold, 6-7=duty cycle
@@ -237,7 +217,7 @@ static void shift_register15(int8 *buf, int count)
                                                                                                                                          \
       while (apu.rectangle[ch].accum < 0)                                                                                                \
       {                                                                                                                                  \
-         apu.rectangle[ch].accum += apu.rectangle[ch].freq + 1;                                                                          \
+         apu.rectangle[ch].accum += APU_FIXED(apu.rectangle[ch].freq + 1);                                                               \
          apu.rectangle[ch].adder = (apu.rectangle[ch].adder + 1) & 0x0F;                                                                 \
                                                                                                                                          \
          if (apu.rectangle[ch].adder < apu.rectangle[ch].duty_flip)                                                                      \
@@ -311,7 +291,7 @@ static void shift_register15(int8 *buf, int count)
                                                                                                                                          \
       while (apu.rectangle[ch].accum < 0)                                                                                                \
       {                                                                                                                                  \
-         apu.rectangle[ch].accum += (apu.rectangle[ch].freq + 1);                                                                        \
+         apu.rectangle[ch].accum += APU_FIXED(apu.rectangle[ch].freq + 1);                                                               \
          apu.rectangle[ch].adder = (apu.rectangle[ch].adder + 1) & 0x0F;                                                                 \
       }                                                                                                                                  \
                                                                                                                                          \
@@ -366,7 +346,7 @@ static int32 apu_triangle(void)
    apu.triangle.accum -= apu.cycle_rate;
    while (apu.triangle.accum < 0)
    {
-      apu.triangle.accum += apu.triangle.freq;
+      apu.triangle.accum += APU_FIXED(apu.triangle.freq);
       apu.triangle.adder = (apu.triangle.adder + 1) & 0x1F;
 
       if (apu.triangle.adder & 0x10)
@@ -384,15 +364,13 @@ static int32 apu_triangle(void)
 ** reg2: 7=small(93 byte) sample,3-0=freq lookup
 ** reg3: 7-4=vbl length counter
 */
-/* TODO: AAAAAAAAAAAAAAAAAAAAAAAA!  #ifdef MADNESS! */
 static int32 apu_noise(void)
 {
    int32 outvol;
 
-#if defined(APU_OVERSAMPLE) && defined(REALTIME_NOISE)
-#else  /* !(APU_OVERSAMPLE && REALTIME_NOISE) */
+#ifndef APU_OVERSAMPLE
    int32 noise_bit;
-#endif /* !(APU_OVERSAMPLE && REALTIME_NOISE) */
+#endif /* !APU_OVERSAMPLE */
 #ifdef APU_OVERSAMPLE
    int num_times;
    int32 total;
@@ -434,49 +412,18 @@ static int32 apu_noise(void)
 
    while (apu.noise.accum < 0)
    {
-      apu.noise.accum += apu.noise.freq;
-
-#ifdef REALTIME_NOISE
+      apu.noise.accum += APU_FIXED(apu.noise.freq);
 
 #ifdef APU_OVERSAMPLE
-      if (shift_register15(apu.noise.xor_tap))
+      if (shift_register15())
          total += outvol;
       else
          total -= outvol;
 
       num_times++;
 #else  /* !APU_OVERSAMPLE */
-      noise_bit = shift_register15(apu.noise.xor_tap);
+      noise_bit = shift_register15();
 #endif /* !APU_OVERSAMPLE */
-
-#else /* !REALTIME_NOISE */
-      apu.noise.cur_pos++;
-
-      if (apu.noise.short_sample)
-      {
-         if (APU_NOISE_93 == apu.noise.cur_pos)
-            apu.noise.cur_pos = 0;
-      }
-      else
-      {
-         if (APU_NOISE_32K == apu.noise.cur_pos)
-            apu.noise.cur_pos = 0;
-      }
-
-#ifdef APU_OVERSAMPLE
-      if (apu.noise.short_sample)
-         noise_bit = noise_short_lut[apu.noise.cur_pos];
-      else
-         noise_bit = noise_long_lut[apu.noise.cur_pos];
-
-      if (noise_bit)
-         total += outvol;
-      else
-         total -= outvol;
-
-      num_times++;
-#endif /* APU_OVERSAMPLE */
-#endif /* !REALTIME_NOISE */
    }
 
 #ifdef APU_OVERSAMPLE
@@ -487,13 +434,6 @@ static int32 apu_noise(void)
    else
       outvol = (apu.noise.env_vol ^ 0x0F) << 8;
 
-#ifndef REALTIME_NOISE
-   if (apu.noise.short_sample)
-      noise_bit = noise_short_lut[apu.noise.cur_pos];
-   else
-      noise_bit = noise_long_lut[apu.noise.cur_pos];
-#endif /* !REALTIME_NOISE */
-
    if (noise_bit)
       apu.noise.output_vol = outvol;
    else
@@ -502,14 +442,22 @@ static int32 apu_noise(void)
 
    return APU_NOISE_OUTPUT;
 }
+#endif /* !APU_BLIP */
 
 INLINE void apu_dmcreload(void)
 {
    apu.dmc.address = apu.dmc.cached_addr;
    apu.dmc.dma_length = apu.dmc.cached_dmalength;
    apu.dmc.irq_occurred = false;
+
+   /* a new sample: nothing of the last one is left to fetch or play */
+   apu.dmc.dma_bytes = apu.dmc.cached_dmalength >> 3;
+   apu.dmc.next_length = 0;
+   apu.dmc.queue_head = apu.dmc.queue_tail = 0;
 }
 
+#ifndef APU_BLIP
+
 /* DELTA MODULATION CHANNEL
 ** =========================
 ** reg0: 7=irq gen, 6=looping, 3-0=pointer to clock table
@@ -530,7 +478,7 @@ static int32 apu_dmc(void)
 
       while (apu.dmc.accum < 0)
       {
-         apu.dmc.accum += apu.dmc.freq;
+         apu.dmc.accum += APU_FIXED(apu.dmc.freq);
 
          delta_bit = (apu.dmc.dma_length & 7) ^ 7;
 
@@ -594,8 +542,656 @@ static int32 apu_dmc(void)
 
    return APU_DMC_OUTPUT;
 }
+#else /* APU_BLIP */
+
+/* BAND-LIMITED SYNTHESIS
+** ======================
+** Rather than stepping every channel once per output sample, the channels
+** run in CPU cycles and only do work when their output level changes.
+** Each change goes into a buffer of deltas as a band-limited step at its
+** exact, fractional sample position; the output is the running sum of
+** that buffer.  Channels are caught up to the CPU before every register
+** access and when the frame's samples are pulled, so a write takes effect
+** on the cycle the game made it instead of at the next sample boundary.
+**
+** Length counters, envelopes and sweeps are clocked from a 240Hz frame
+** tick, with the lookup tables built for APU_BLIP_TICKS ticks per frame,
+** which keeps their rates the same as under the per-sample code.
+*/
+#define APU_BLIP_TICKS     4    /* frame ticks per refresh */
+#define APU_BLIP_PHASES    16   /* sub-sample positions of the kernel */
+#define APU_BLIP_TAPS      8
+#define APU_BLIP_DELAY     (APU_BLIP_TAPS / 2 - 1)
+#define APU_BLIP_SIZE      2048 /* samples, must hold more than a frame */
+#define APU_BLIP_BACKLOG   8    /* samples kept ready past each read */
+#define APU_BLIP_DRIFT     6    /* resampling ratio moves at most 1/64 */
+#define APU_BLIP_BASS      7    /* high-pass near 80Hz, same rate as APU_VOLUME_DECAY */
+
+/* sample position (16.16) of a 16.16 cycle offset into the current run */
+#define APU_BLIP_POS(base, t) ((base) + (uint32)(((uint64_t)(uint32)(t) * blip.factor) >> 32))
+
+/* output levels, same relative volumes as the per-sample mixer */
+#define APU_BLIP_TRIANGLE(adder) (((((adder) & 0x10) ? (30 - (adder)) : (adder)) * 640) - 4480)
+#define APU_BLIP_NOISE(vol) (((vol) * 3) >> 2)
+#define APU_BLIP_DMC(dac) ((dac) * 192)
+
+static struct apu_blip_s
+{
+   int32 buf[APU_BLIP_SIZE + APU_BLIP_TAPS];
+   int16 kernel[APU_BLIP_PHASES][APU_BLIP_TAPS];
+   /* apu_mark keeps everything from here on */
+   uint32 factor;        /* output samples per CPU cycle, 0.32 */
+   uint32 nominal;
+   uint32 offset;        /* buffer position of blip.time, 16.16 */
+   uint32 time;          /* CPU cycle the channels have been run up to */
+   uint32 frame_time;    /* CPU cycle of the last apu_process */
+   int32 tick_cycles;
+   int32 tick_left;
+   int32 sum;            /* integrator */
+   int32 level[5];       /* level each channel last put out */
+   int8 noise_bit;
+   bool quiet;           /* no deltas anywhere in buf */
+} blip;
+
+/* windowed sinc, one row per sub-sample phase, each row summing to 1.0;
+** worked out by host/tables.py, the trig is in double, done in software
+** on the ESP32. blip keeps a copy next to the buffer it's added to.
+*/
+static const int16 apu_blip_kernel[APU_BLIP_PHASES][APU_BLIP_TAPS] =
+{
+#include "nes_apu_blip.inc"
+};
+
+static void apu_blip_buildkernel(void)
+{
+   memcpy(blip.kernel, apu_blip_kernel, sizeof(blip.kernel));
+}
+
+static void apu_blip_clear(void)
+{
+   /* the writes still take, their cycles mean nothing on the new timeline */
+   apu_journal_flush();
+   memset(blip.buf, 0, sizeof(blip.buf));
+   memset(blip.level, 0, sizeof(blip.level));
+   blip.sum = 0;
+   blip.quiet = true;
+   blip.offset = 0;
+   blip.factor = blip.nominal;
+   blip.time = blip.frame_time = nes6502_getcycles(false);
+   blip.tick_left = blip.tick_cycles;
+}
+
+/* band-limited step, for the channels with hard edges */
+INLINE void apu_blip_step(uint32 pos, int32 delta)
+{
+   const int16 *kernel;
+   int32 *out;
+   int tap;
+
+   /* nobody has been reading, the buffer is full */
+   if ((pos >> APU_FIXED_SHIFT) >= APU_BLIP_SIZE)
+      return;
+
+   out = blip.buf + (pos >> APU_FIXED_SHIFT);
+   kernel = blip.kernel[(pos >> (APU_FIXED_SHIFT - 4)) & (APU_BLIP_PHASES - 1)];
+   blip.quiet = false;
+
+   for (tap = 0; tap < APU_BLIP_TAPS; tap++)
+      out[tap] += kernel[tap] * delta;
+}
+
+/* two-tap linear step: triangle steps are small and noise is broadband
+** anyway, neither needs the full kernel
+*/
+INLINE void apu_blip_ramp(uint32 pos, int32 delta)
+{
+   int32 *out;
+   int32 frac;
+
+   if ((pos >> APU_FIXED_SHIFT) >= APU_BLIP_SIZE)
+      return;
+
+   out = blip.buf + (pos >> APU_FIXED_SHIFT) + APU_BLIP_DELAY;
+   frac = (pos & 0xFFFF) >> 1;
+   blip.quiet = false;
+
+   out[0] += delta * (0x8000 - frac);
+   out[1] += delta * frac;
+}
+
+INLINE void apu_blip_set(int chan, int32 level, uint32 pos)
+{
+   int32 delta = level - blip.level[chan];
+
+   if (delta)
+   {
+      blip.level[chan] = level;
+      apu_blip_step(pos, delta);
+   }
+}
+
+INLINE void apu_blip_setramp(int chan, int32 level, uint32 pos)
+{
+   int32 delta = level - blip.level[chan];
+
+   if (delta)
+   {
+      blip.level[chan] = level;
+      apu_blip_ramp(pos, delta);
+   }
+}
+
+/* RECTANGLE WAVE
+** ==============
+** see the register layout above; the frame tick does the length counter,
+** envelope and sweep, the run does the duty cycle sequencer
+*/
+static void apu_blip_ticksquare(int ch)
+{
+   rectangle_t *chan = &apu.rectangle[ch];
+
+   if (false == chan->enabled || 0 == chan->vbl_length)
+      return;
+
+   /* vbl length counter */
+   if (false == chan->holdnote)
+      chan->vbl_length--;
+
+   /* envelope decay at a rate of (env_delay + 1) / 240 secs */
+   chan->env_phase -= 4; /* 240/60 */
+   while (chan->env_phase < 0)
+   {
+      chan->env_phase += chan->env_delay;
+
+      if (chan->holdnote)
+         chan->env_vol = (chan->env_vol + 1) & 0x0F;
+      else if (chan->env_vol < 0x0F)
+         chan->env_vol++;
+   }
+
+   if (chan->freq < 8 || (false == chan->sweep_inc && chan->freq > chan->freq_limit))
+      return;
+
+   /* frequency sweeping at a rate of (sweep_delay + 1) / 120 secs */
+   if (chan->sweep_on && chan->sweep_shifts)
+   {
+      chan->sweep_phase -= 2; /* 120/60 */
+      while (chan->sweep_phase < 0)
+      {
+         chan->sweep_phase += chan->sweep_delay;
+
+         if (chan->sweep_inc) /* ramp up */
+         {
+            if (0 == ch)
+               chan->freq += ~(chan->freq >> chan->sweep_shifts);
+            else
+               chan->freq -= (chan->freq >> chan->sweep_shifts);
+         }
+         else /* ramp down */
+         {
+            chan->freq += (chan->freq >> chan->sweep_shifts);
+         }
+      }
+   }
+}
+
+/* both pulses in one pass over their edges, merged in time order.  The
+** pair goes out as a single level, so an edge costs one kernel add and
+** edges that coincide (the same note on both voices is common) share one.
+** level[0] and level[1] hold each channel's part of it.
+*/
+static void apu_blip_squares(int32 span, uint32 base)
+{
+   int32 t[2], period[2], output[2], part[2], before, after;
+   int ch;
+
+   before = blip.level[0] + blip.level[1];
+
+   for (ch = 0; ch < 2; ch++)
+   {
+      rectangle_t *chan = &apu.rectangle[ch];
+
+      part[ch] = blip.level[ch];
+      t[ch] = span; /* never steps */
+      period[ch] = output[ch] = 0;
+
+      /* a silent channel holds its part and the high-pass takes it down,
+      ** just like output_vol decayed in the per-sample code
+      */
+      if (false == chan->enabled || 0 == chan->vbl_length)
+         continue;
+      if (chan->freq < 8 || (false == chan->sweep_inc && chan->freq > chan->freq_limit))
+         continue;
+
+      if (0 == (apu.mix_enable & (1 << ch)))
+         output[ch] = 0;
+      else if (chan->fixed_envelope)
+         output[ch] = chan->volume << 8; /* fixed volume */
+      else
+         output[ch] = (chan->env_vol ^ 0x0F) << 8;
+
+      /* volume may have changed since the last run */
+      part[ch] = (chan->adder < chan->duty_flip) ? output[ch] : -output[ch];
+      period[ch] = APU_FIXED(chan->freq + 1);
+      t[ch] = chan->accum;
+   }
+
+   after = part[0] + part[1];
+   if (after != before)
+      apu_blip_step(base, after - before);
+
+   while (t[0] < span || t[1] < span)
+   {
+      int32 now = (t[0] < t[1]) ? t[0] : t[1];
+
+      for (ch = 0; ch < 2; ch++)
+      {
+         rectangle_t *chan = &apu.rectangle[ch];
+
+         if (t[ch] != now)
+            continue;
+
+         chan->adder = (chan->adder + 1) & 0x0F;
+         part[ch] = (chan->adder < chan->duty_flip) ? output[ch] : -output[ch];
+         t[ch] += period[ch];
+      }
+
+      before = after;
+      after = part[0] + part[1];
+      if (after != before)
+         apu_blip_step(APU_BLIP_POS(base, now), after - before);
+   }
+
+   for (ch = 0; ch < 2; ch++)
+   {
+      if (period[ch])
+         apu.rectangle[ch].accum = t[ch] - span;
+      blip.level[ch] = part[ch];
+   }
+}
+
+/* TRIANGLE WAVE */
+static void apu_blip_ticktriangle(void)
+{
+   if (false == apu.triangle.enabled || 0 == apu.triangle.vbl_length)
+      return;
+
+   if (apu.triangle.counter_started)
+   {
+      if (apu.triangle.linear_length > 0)
+         apu.triangle.linear_length--;
+      if (apu.triangle.vbl_length && false == apu.triangle.holdnote)
+         apu.triangle.vbl_length--;
+   }
+   else if (false == apu.triangle.holdnote && apu.triangle.write_latency)
+   {
+      if (--apu.triangle.write_latency == 0)
+         apu.triangle.counter_started = true;
+   }
+}
+
+static void apu_blip_triangle(int32 span, uint32 base)
+{
+   int32 period, t;
+
+   if (false == apu.triangle.enabled || 0 == apu.triangle.vbl_length)
+      return;
+   if (0 == apu.triangle.linear_length || apu.triangle.freq < 4) /* inaudible */
+      return;
+
+   if (0 == (apu.mix_enable & 0x04))
+   {
+      apu_blip_setramp(2, 0, base);
+      return;
+   }
+
+   apu_blip_setramp(2, APU_BLIP_TRIANGLE(apu.triangle.adder), base);
+
+   period = APU_FIXED(apu.triangle.freq);
+   for (t = apu.triangle.accum; t < span; t += period)
+   {
+      apu.triangle.adder = (apu.triangle.adder + 1) & 0x1F;
+      apu_blip_setramp(2, APU_BLIP_TRIANGLE(apu.triangle.adder), APU_BLIP_POS(base, t));
+   }
+   apu.triangle.accum = t - span;
+}
+
+/* WHITE NOISE CHANNEL */
+static void apu_blip_ticknoise(void)
+{
+   if (false == apu.noise.enabled || 0 == apu.noise.vbl_length)
+      return;
+
+   /* vbl length counter */
+   if (false == apu.noise.holdnote)
+      apu.noise.vbl_length--;
+
+   /* envelope decay at a rate of (env_delay + 1) / 240 secs */
+   apu.noise.env_phase -= 4; /* 240/60 */
+   while (apu.noise.env_phase < 0)
+   {
+      apu.noise.env_phase += apu.noise.env_delay;
+
+      if (apu.noise.holdnote)
+         apu.noise.env_vol = (apu.noise.env_vol + 1) & 0x0F;
+      else if (apu.noise.env_vol < 0x0F)
+         apu.noise.env_vol++;
+   }
+}
+
+static void apu_blip_noise(int32 span, uint32 base)
+{
+   int32 outvol, period, t;
+
+   if (false == apu.noise.enabled || 0 == apu.noise.vbl_length)
+      return;
+
+   if (0 == (apu.mix_enable & 0x08))
+      outvol = 0;
+   else if (apu.noise.fixed_envelope)
+      outvol = APU_BLIP_NOISE(apu.noise.volume << 8); /* fixed volume */
+   else
+      outvol = APU_BLIP_NOISE((apu.noise.env_vol ^ 0x0F) << 8);
+
+   apu_blip_setramp(3, blip.noise_bit ? outvol : -outvol, base);
+
+   period = APU_FIXED(apu.noise.freq);
+   for (t = apu.noise.accum; t < span; t += period)
+   {
+      blip.noise_bit = shift_register15();
+      apu_blip_setramp(3, blip.noise_bit ? outvol : -outvol, APU_BLIP_POS(base, t));
+   }
+   apu.noise.accum = t - span;
+}
+
+static void apu_dmcdma(void);
+
+/* the byte DMA fetched for the step the output is at; if the CPU hasn't got
+** to its fetch yet (an APU access a few cycles past it), it's done now
+*/
+INLINE uint8 apu_dmcpop(void)
+{
+   if (apu.dmc.queue_head == apu.dmc.queue_tail)
+   {
+      if (0 == apu.dmc.dma_bytes)
+         return apu.dmc.cur_byte;
+      apu_dmcdma();
+   }
+   return apu.dmc.queue[apu.dmc.queue_tail++ & (APU_DMC_QUEUE - 1)];
+}
+
+/* DELTA MODULATION CHANNEL */
+static void apu_blip_dmc(int32 span, uint32 base)
+{
+   int32 gain, t;
+   int delta_bit;
+
+   /* $4011 writes land here too, DMA or not */
+   gain = (apu.mix_enable & 0x10) ? 1 : 0;
+   apu_blip_set(4, APU_BLIP_DMC(apu.dmc.regs[1]) * gain, base);
+
+   /* only process when channel is alive */
+   if (0 == apu.dmc.dma_length)
+      return;
+
+   for (t = apu.dmc.accum; t < span; t += APU_FIXED(apu.dmc.freq))
+   {
+      delta_bit = (apu.dmc.dma_length & 7) ^ 7;
+
+      if (7 == delta_bit)
+         apu.dmc.cur_byte = apu_dmcpop();
+
+      if (--apu.dmc.dma_length == 0)
+      {
+         /* DMA has had the last byte and knows if the sample loops; the IRQ
+         ** went off then too
+         */
+         apu.dmc.dma_length = apu.dmc.next_length;
+         apu.dmc.next_length = 0;
+         if (0 == apu.dmc.dma_length)
+         {
+            t = span;
+            break;
+         }
+      }
+
+      /* positive delta */
+      if (apu.dmc.cur_byte & (1 << delta_bit))
+      {
+         if (apu.dmc.regs[1] < 0x7D)
+            apu.dmc.regs[1] += 2;
+      }
+      /* negative delta */
+      else
+      {
+         if (apu.dmc.regs[1] > 1)
+            apu.dmc.regs[1] -= 2;
+      }
+
+      apu_blip_set(4, APU_BLIP_DMC(apu.dmc.regs[1]) * gain, APU_BLIP_POS(base, t));
+   }
+   apu.dmc.accum = t - span;
+}
+
+/* run all channels from blip.time up to CPU cycle now */
+static void apu_blip_run(uint32 now)
+{
+   int32 span = (int32)(now - blip.time);
+
+   /* CPU was reset or swapped out from under us: pick up from here */
+   if (span < 0 || span > blip.tick_cycles * APU_BLIP_TICKS * 4)
+   {
+      blip.time = now;
+      return;
+   }
+
+   while (span > 0)
+   {
+      int32 run = (span < blip.tick_left) ? span : blip.tick_left;
+      int32 fixed = APU_FIXED(run);
+      uint32 base = blip.offset;
+
+      apu_blip_squares(fixed, base);
+      apu_blip_triangle(fixed, base);
+      apu_blip_noise(fixed, base);
+      apu_blip_dmc(fixed, base);
+
+      blip.offset = APU_BLIP_POS(base, fixed);
+      if (blip.offset > APU_FIXED(APU_BLIP_SIZE))
+         blip.offset = APU_FIXED(APU_BLIP_SIZE);
+
+      blip.time += run;
+      span -= run;
+
+      blip.tick_left -= run;
+      if (0 == blip.tick_left)
+      {
+         blip.tick_left = blip.tick_cycles;
+         apu_blip_ticksquare(0);
+         apu_blip_ticksquare(1);
+         apu_blip_ticktriangle();
+         apu_blip_ticknoise();
+      }
+   }
+}
+
+/* DMC DMA
+** =======
+** The output takes a new byte every 8 steps of its timer; the fetch for it
+** is made on that step's CPU cycle, when nes_runcpu stops there, so it
+** reads whatever bank is mapped in then, takes APU_DMC_STALL cycles off
+** the CPU and raises the IRQ on time, all without the channels being run.
+** The bytes wait in a queue for the output, which is caught up only at
+** APU accesses and at the end of the frame as before.  When that's
+** changed, the output is current: where it's at says when the next fetch is.
+*/
+static void apu_dmcschedule(void)
+{
+   if (0 == apu.dmc.dma_length)
+   {
+      apu.dmc.dma_bytes = 0;
+      apu.dmc.queue_head = apu.dmc.queue_tail = 0;
+      return;
+   }
+
+   /* a byte starts at every step the bits left are a multiple of 8 */
+   apu.dmc.dma_time = blip.time + ((apu.dmc.accum + (apu.dmc.dma_length & 7)
+                                    * APU_FIXED(apu.dmc.freq)) >> APU_FIXED_SHIFT);
+}
+
+static void apu_dmcdma(void)
+{
+   /* the output hasn't been run for a while: make room.  If it got to its
+   ** step before this fetch was made, it made it itself
+   */
+   if ((uint8)(apu.dmc.queue_head - apu.dmc.queue_tail) >= APU_DMC_QUEUE)
+   {
+      uint32 due = apu.dmc.dma_time;
+
+      apu_journal_flush();
+      apu_blip_run(nes6502_getcycles(false));
+      if (0 == apu.dmc.dma_bytes || due != apu.dmc.dma_time)
+         return;
+   }
+
+   apu.dmc.queue[apu.dmc.queue_head++ & (APU_DMC_QUEUE - 1)] = nes6502_getbyte(apu.dmc.address);
+   nes6502_burn(APU_DMC_STALL);
+
+   /* prevent wraparound */
+   if (0xFFFF == apu.dmc.address)
+      apu.dmc.address = 0x8000;
+   else
+      apu.dmc.address++;
+   apu.dmc.dma_time += 8 * apu.dmc.freq;
+
+   if (--apu.dmc.dma_bytes)
+      return;
+
+   /* if loop bit set, we're cool to retrigger sample */
+   if (apu.dmc.looping)
+   {
+      apu.dmc.address = apu.dmc.cached_addr;
+      apu.dmc.dma_bytes = apu.dmc.cached_dmalength >> 3;
+      apu.dmc.next_length = apu.dmc.cached_dmalength;
+      return;
+   }
+
+   /* check to see if we should generate an irq */
+   if (apu.dmc.irq_gen)
+   {
+      apu.dmc.irq_occurred = true;
+      if (apu.irq_callback)
+         apu.irq_callback();
+   }
+
+   /* bodge for timestamp queue */
+   apu.dmc.enabled = false;
+}
+
+/* $4015 with nothing left to fetch; the output may still be on the last
+** byte, and goes straight on into the new sample
+*/
+static void apu_dmcstart(void)
+{
+   if (0 == apu.dmc.dma_length)
+   {
+      apu_dmcreload();
+      return;
+   }
+
+   apu.dmc.address = apu.dmc.cached_addr;
+   apu.dmc.dma_bytes = apu.dmc.cached_dmalength >> 3;
+   apu.dmc.next_length = apu.dmc.cached_dmalength;
+   apu.dmc.irq_occurred = false;
+}
+
+int32 apu_dmcdue(void)
+{
+   if (0 == apu.dmc.dma_bytes)
+      return 0x7FFFFFFF;
+   return (int32)(apu.dmc.dma_time - nes6502_getcycles(false));
+}
+
+void apu_dmcfetch(void)
+{
+   while (apu.dmc.dma_bytes && (int32)(apu.dmc.dma_time - nes6502_getcycles(false)) <= 0)
+      apu_dmcdma();
+}
+#endif /* APU_BLIP */
+
+#ifndef APU_BLIP
+/* the per-sample DMC fetches its bytes itself */
+int32 apu_dmcdue(void)
+{
+   return 0x7FFFFFFF;
+}
+
+void apu_dmcfetch(void)
+{
+}
+#endif /* !APU_BLIP */
+
+#ifdef APU_BLIP
+/* REGISTER JOURNAL
+** ================
+** Writes to the squares, the triangle, the noise and the DAC, most of what
+** a game does to the APU, don't run the channels on the spot: they go into
+** the journal with their CPU cycle, and the channels are run through it in
+** order, each write applied on its cycle, when the frame's samples are
+** pulled or anything else needs the APU current.  The output is the same
+** as running at every write, but the synthesis is one batch per frame
+** instead of a few hundred cycles of it between instructions.  The rest
+** of the DMC and $4015 have effects the CPU sees before then (IRQs, DMA,
+** status) and still go through at once, after the journal.
+*/
+#define APU_JOURNAL 64
+
+static struct
+{
+   uint32 cycle;
+   uint16 address;
+   uint8 value;
+} journal[APU_JOURNAL];
+static int journal_count;
+
+static void apu_regwrite(uint32 address, uint8 value);
+
+static void apu_journal_flush(void)
+{
+   int i;
+
+   for (i = 0; i < journal_count; i++)
+   {
+      apu_blip_run(journal[i].cycle);
+      apu_regwrite(journal[i].address, journal[i].value);
+   }
+   journal_count = 0;
+}
 
 void apu_write(uint32 address, uint8 value)
+{
+   uint32 now = nes6502_getcycles(false);
+
+   if (address < APU_WRE0 || APU_WRE1 == address)
+   {
+      if (APU_JOURNAL == journal_count)
+         apu_journal_flush();
+      journal[journal_count].cycle = now;
+      journal[journal_count].address = (uint16)address;
+      journal[journal_count++].value = value;
+      return;
+   }
+
+   /* everything up to this cycle still sees the old register values */
+   apu_journal_flush();
+   apu_blip_run(now);
+   apu_regwrite(address, value);
+}
+
+static void apu_regwrite(uint32 address, uint8 value)
+#else  /* !APU_BLIP */
+void apu_write(uint32 address, uint8 value)
+#endif /* !APU_BLIP */
 {
    int chan;
 
@@ -671,7 +1267,11 @@ void apu_write(uint32 address, uint8 value)
       ** for the 6502 code to do a couple of table dereferences and load up
       ** the other triregs
       */
-      apu.triangle.write_latency = (int)(228 / apu.cycle_rate);
+#ifdef APU_BLIP
+      apu.triangle.write_latency = 1; /* next frame tick */
+#else  /* !APU_BLIP */
+      apu.triangle.write_latency = APU_FIXED(228) / apu.cycle_rate;
+#endif /* !APU_BLIP */
       apu.triangle.freq = (((value & 7) << 8) + apu.triangle.regs[1]) + 1;
       apu.triangle.vbl_length = vbl_lut[value >> 3];
       apu.triangle.counter_started = false;
@@ -689,20 +1289,9 @@ void apu_write(uint32 address, uint8 value)
 
    case APU_WRD2:
       apu.noise.regs[1] = value;
-      apu.noise.freq = noise_freq[value & 0x0F];
+      apu.noise.freq = noise_freq[apu.pal_periods][value & 0x0F];
 
-#ifdef REALTIME_NOISE
       apu.noise.xor_tap = (value & 0x80) ? 0x40 : 0x02;
-#else  /* !REALTIME_NOISE */
-      /* detect transition from long->short sample */
-      if ((value & 0x80) && false == apu.noise.short_sample)
-      {
-         /* recalculate short noise buffer */
-         shift_register15(noise_short_lut, APU_NOISE_93);
-         apu.noise.cur_pos = 0;
-      }
-      apu.noise.short_sample = (value & 0x80) ? true : false;
-#endif /* !REALTIME_NOISE */
       break;
 
    case APU_WRD3:
@@ -714,7 +1303,7 @@ void apu_write(uint32 address, uint8 value)
    /* DMC */
    case APU_WRE0:
       apu.dmc.regs[0] = value;
-      apu.dmc.freq = dmc_clocks[value & 0x0F];
+      apu.dmc.freq = dmc_clocks[apu.pal_periods][value & 0x0F];
       apu.dmc.looping = (value & 0x40) ? true : false;
 
       if (value & 0x80)
@@ -790,8 +1379,13 @@ void apu_write(uint32 address, uint8 value)
 
       if (value & 0x10)
       {
+#ifdef APU_BLIP
+         if (0 == apu.dmc.dma_bytes)
+            apu_dmcstart();
+#else  /* !APU_BLIP */
          if (0 == apu.dmc.dma_length)
             apu_dmcreload();
+#endif /* !APU_BLIP */
       }
       else
       {
@@ -809,6 +1403,12 @@ void apu_write(uint32 address, uint8 value)
    default:
       break;
    }
+
+#ifdef APU_BLIP
+   /* a new sample, none, or a new rate: the next fetch moves */
+   if ((APU_WRE0 == address || APU_SMASK == address) && apu.dmc.dma_bytes)
+      apu_dmcschedule();
+#endif /* APU_BLIP */
 }
 
 /* Read from $4000-$4017 */
@@ -821,6 +1421,10 @@ uint8_t apu_read(uint32_t address)
    switch (address)
    {
    case APU_SMASK:
+#ifdef APU_BLIP
+      apu_journal_flush();
+      apu_blip_run(nes6502_getcycles(false));
+#endif /* APU_BLIP */
       value = 0;
       /* Return 1 in 0-5 bit pos if a channel is playing */
       if (apu.rectangle[0].enabled && apu.rectangle[0].vbl_length)
@@ -861,37 +1465,134 @@ uint8_t apu_read(uint32_t address)
          out = -0x8000;       \
    }
 
+/* a fragment of flat output at the centre line, in the mixer's format */
+static void apu_silence(void *buffer, int num_samples)
+{
+   if (NULL == buffer)
+      return;
+
+   if (APU_FORMAT_DAC16 == apu.format)
+   {
+      uint16 *buf16 = (uint16 *)buffer;
+
+      while (num_samples--)
+         *buf16++ = 0x8000;
+   }
+   else if (16 == apu.sample_bits)
+   {
+      memset(buffer, 0, num_samples * sizeof(int16));
+   }
+   else
+   {
+      memset(buffer, 0x80, num_samples);
+   }
+}
+
+/* offset binary, and each sample lands in the other half of its 32-bit
+** word, which is the order a 16-bit mono I2S FIFO sends them out in
+*/
+#define APU_DAC16_OUTPUT(ptr, out)                                   \
+   do                                                                \
+   {                                                                 \
+      *(uint16 *)((uintptr_t)(ptr) ^ 2) = (uint16)((out) ^ 0x8000);  \
+      (ptr)++;                                                       \
+   } while (0)
+
+/* the mixer takes expansion sound a block at a time */
+#define APU_EXT_BLOCK 256
+
+/* expansion chip output for the next count samples, NULL when it's silent */
+static int32 *apu_extblock(int count)
+{
+   static int32 block[APU_EXT_BLOCK];
+   int i;
+
+   if (NULL == apu.ext || 0 == (apu.mix_enable & 0x20))
+      return NULL;
+
+   if (apu.ext->render)
+      return apu.ext->render(block, count) ? block : NULL;
+
+   /* drivers that only do one sample at a time */
+   if (NULL == apu.ext->process)
+      return NULL;
+   for (i = 0; i < count; i++)
+      block[i] = apu.ext->process();
+
+   return block;
+}
+
+#ifdef APU_BLIP
+/* pull num_samples out of the delta buffer: everything the channels did
+** since the last call, resampled so the output keeps pace with however
+** many samples the sound driver asks for
+*/
 void apu_process(void *buffer, int num_samples)
 {
    static int32 prev_sample = 0;
 
-   int16 *buf16;
-   uint8 *buf8;
+   uint32 now = nes6502_getcycles(false);
+   int32 elapsed, backlog, used, avail;
+   int16 *buf16 = (int16 *)buffer;
+   uint8 *buf8 = (uint8 *)buffer;
+   int i, done, count;
 
-   if (NULL != buffer)
+   apu_journal_flush();
+   apu_blip_run(now);
+
+   elapsed = (int32)(now - blip.frame_time);
+   blip.frame_time = now;
+
+   /* bleh */
+   apu.buffer = buffer;
+
+   avail = (int32)(blip.offset >> APU_FIXED_SHIFT);
+   used = avail + APU_BLIP_TAPS;
+   if (used > APU_BLIP_SIZE + APU_BLIP_TAPS)
+      used = APU_BLIP_SIZE + APU_BLIP_TAPS;
+
+   /* no deltas at all: nothing to integrate, and nothing to shift after */
+   if (blip.quiet)
+      used = 0;
+
+   for (done = 0; done < num_samples; done += count)
    {
-      /* bleh */
-      apu.buffer = buffer;
+      int32 *ext;
 
-      buf16 = (int16 *)buffer;
-      buf8 = (uint8 *)buffer;
+      count = num_samples - done;
+      if (count > APU_EXT_BLOCK)
+         count = APU_EXT_BLOCK;
 
-      while (num_samples--)
+      ext = (NULL == buffer) ? NULL : apu_extblock(count);
+
+      /* no level changes, the integrator has settled on zero and the
+      ** expansion chip is quiet: this stretch comes out flat
+      */
+      if (0 == used && 0 == (blip.sum >> 15) && 0 == prev_sample && NULL == ext)
+      {
+         if (NULL != buffer)
+         {
+            apu_silence((16 == apu.sample_bits) ? (void *)buf16 : (void *)buf8, count);
+            buf16 += count;
+            buf8 += count;
+         }
+         continue;
+      }
+
+      for (i = 0; i < count; i++)
       {
-         int32 next_sample, accum = 0;
-
-         if (apu.mix_enable & 0x01)
-            accum += apu_rectangle_0();
-         if (apu.mix_enable & 0x02)
-            accum += apu_rectangle_1();
-         if (apu.mix_enable & 0x04)
-            accum += apu_triangle();
-         if (apu.mix_enable & 0x08)
-            accum += apu_noise();
-         if (apu.mix_enable & 0x10)
-            accum += apu_dmc();
-         if (apu.ext && (apu.mix_enable & 0x20))
-            accum += apu.ext->process();
+         int32 next_sample, accum;
+
+         if (done + i < used)
+            blip.sum += blip.buf[done + i];
+         accum = blip.sum >> 15;
+         blip.sum -= accum * (1 << (15 - APU_BLIP_BASS));
+
+         if (NULL == buffer)
+            continue;
+
+         if (ext)
+            accum += ext[i];
 
          /* do any filtering */
          if (APU_FILTER_NONE != apu.filter_type)
@@ -911,26 +1612,283 @@ void apu_process(void *buffer, int num_samples)
 
          /* do clipping */
          CLIP_OUTPUT16(accum);
+         accum = (accum * apu.gain) >> 8;
 
-         /* signed 16-bit output, unsigned 8-bit */
-         if (16 == apu.sample_bits)
+         /* signed 16-bit output, unsigned 8-bit, or straight to the DAC */
+         if (APU_FORMAT_DAC16 == apu.format)
+            APU_DAC16_OUTPUT(buf16, accum);
+         else if (16 == apu.sample_bits)
             *buf16++ = (int16)accum;
          else
             *buf8++ = (accum >> 8) ^ 0x80;
       }
    }
+
+   /* keep whatever the kernel tails and the backlog left behind */
+   if (num_samples < used)
+   {
+      memmove(blip.buf, blip.buf + num_samples, (used - num_samples) * sizeof(int32));
+      memset(blip.buf + used - num_samples, 0, num_samples * sizeof(int32));
+
+      blip.quiet = true;
+      for (i = 0; i < used - num_samples; i++)
+      {
+         if (blip.buf[i])
+         {
+            blip.quiet = false;
+            break;
+         }
+      }
+   }
+   else if (used)
+   {
+      memset(blip.buf, 0, used * sizeof(int32));
+      blip.quiet = true;
+   }
+
+   backlog = avail - num_samples;
+   if (backlog < 0)
+   {
+      /* ran dry: restart the timeline at the read position */
+      blip.offset &= APU_FIXED(1) - 1;
+      backlog = 0;
+   }
+   else
+   {
+      blip.offset -= APU_FIXED(num_samples);
+   }
+
+   /* aim to produce the same count again next frame, plus the backlog */
+   if (elapsed > 0)
+   {
+      uint32 limit = blip.nominal >> APU_BLIP_DRIFT;
+      uint64_t factor = ((uint64_t)(num_samples + APU_BLIP_BACKLOG - backlog) << 32) / (uint32)elapsed;
+
+      if (factor > blip.nominal + limit)
+         factor = blip.nominal + limit;
+      else if (factor < blip.nominal - limit)
+         factor = blip.nominal - limit;
+
+      blip.factor = (uint32)factor;
+   }
+}
+#else  /* !APU_BLIP */
+/* APU_VOLUME_DECAY never moves a level in [0, 128) */
+#define APU_SETTLED(vol) ((vol) >= 0 && (vol) < 128)
+
+/* channels that need calling this fragment; the ones that are neither
+** playing nor still decaying only add their (constant) level to idle.
+** nothing turns a channel on between apu_writes, so once per call is enough
+*/
+static uint8 apu_livechannels(int32 *idle)
+{
+   uint8 live = apu.mix_enable;
+   int32 level = 0;
+   int ch;
+
+   for (ch = 0; ch < 2; ch++)
+   {
+      if ((false == apu.rectangle[ch].enabled || 0 == apu.rectangle[ch].vbl_length) && APU_SETTLED(apu.rectangle[ch].output_vol))
+      {
+         if (live & (1 << ch))
+            level += APU_RECTANGLE_OUTPUT(ch);
+         live &= ~(1 << ch);
+      }
+   }
+
+   if ((false == apu.triangle.enabled || 0 == apu.triangle.vbl_length) && APU_SETTLED(apu.triangle.output_vol))
+   {
+      if (live & 0x04)
+         level += APU_TRIANGLE_OUTPUT;
+      live &= ~0x04;
+   }
+
+   if ((false == apu.noise.enabled || 0 == apu.noise.vbl_length) && APU_SETTLED(apu.noise.output_vol))
+   {
+      if (live & 0x08)
+         level += APU_NOISE_OUTPUT;
+      live &= ~0x08;
+   }
+
+   if (0 == apu.dmc.dma_length && APU_SETTLED(apu.dmc.output_vol))
+   {
+      if (live & 0x10)
+         level += APU_DMC_OUTPUT;
+      live &= ~0x10;
+   }
+
+   /* expansion sound comes in blocks, see apu_extblock */
+   live &= ~0x20;
+
+   *idle = level;
+   return live;
 }
 
+void apu_process(void *buffer, int num_samples)
+{
+   static int32 prev_sample = 0;
+
+   int16 *buf16;
+   uint8 *buf8;
+   int32 idle;
+   uint8 live;
+   int i, done, count;
+
+   if (NULL != buffer)
+   {
+      /* bleh */
+      apu.buffer = buffer;
+
+      buf16 = (int16 *)buffer;
+      buf8 = (uint8 *)buffer;
+
+      live = apu_livechannels(&idle);
+
+      for (done = 0; done < num_samples; done += count)
+      {
+         int32 *ext;
+
+         count = num_samples - done;
+         if (count > APU_EXT_BLOCK)
+            count = APU_EXT_BLOCK;
+
+         ext = apu_extblock(count);
+
+         /* everything flat at zero: so is this stretch */
+         if (0 == live && 0 == idle && 0 == prev_sample && NULL == ext)
+         {
+            apu_silence((16 == apu.sample_bits) ? (void *)buf16 : (void *)buf8, count);
+            buf16 += count;
+            buf8 += count;
+            continue;
+         }
+
+         for (i = 0; i < count; i++)
+         {
+            int32 next_sample, accum = idle;
+
+            if (live & 0x01)
+               accum += apu_rectangle_0();
+            if (live & 0x02)
+               accum += apu_rectangle_1();
+            if (live & 0x04)
+               accum += apu_triangle();
+            if (live & 0x08)
+               accum += apu_noise();
+            if (live & 0x10)
+               accum += apu_dmc();
+            if (ext)
+               accum += ext[i];
+
+            /* do any filtering */
+            if (APU_FILTER_NONE != apu.filter_type)
+            {
+               next_sample = accum;
+
+               if (APU_FILTER_LOWPASS == apu.filter_type)
+               {
+                  accum += prev_sample;
+                  accum >>= 1;
+               }
+               else
+                  accum = (accum + accum + accum + prev_sample) >> 2;
+
+               prev_sample = next_sample;
+            }
+
+            /* do clipping */
+            CLIP_OUTPUT16(accum);
+            accum = (accum * apu.gain) >> 8;
+
+            /* signed 16-bit output, unsigned 8-bit, or straight to the DAC */
+            if (APU_FORMAT_DAC16 == apu.format)
+               APU_DAC16_OUTPUT(buf16, accum);
+            else if (16 == apu.sample_bits)
+               *buf16++ = (int16)accum;
+            else
+               *buf8++ = (accum >> 8) ^ 0x80;
+         }
+      }
+   }
+}
+#endif /* !APU_BLIP */
+
+#ifdef NES_RUNAHEAD
+/* Run-ahead: apu_mark remembers the output side of the mixer, and
+** apu_rollback throws away whatever the channels put out since and goes
+** back there.  The channels themselves go back with the APU context.
+*/
+#ifdef APU_BLIP
+#define APU_BLIP_MARKED (sizeof(blip) - offsetof(struct apu_blip_s, factor))
+
+static struct
+{
+   int32 buf[APU_BLIP_SIZE + APU_BLIP_TAPS];
+   int used;
+   uint8 state[APU_BLIP_MARKED];
+} blip_mark;
+
+/* words of blip.buf that may have deltas in them */
+static int apu_blip_used(void)
+{
+   int used = (int)(blip.offset >> APU_FIXED_SHIFT) + APU_BLIP_TAPS;
+
+   if (blip.quiet)
+      return 0;
+   return (used > APU_BLIP_SIZE + APU_BLIP_TAPS) ? APU_BLIP_SIZE + APU_BLIP_TAPS : used;
+}
+
+void apu_mark(void)
+{
+   apu_journal_flush();
+   blip_mark.used = apu_blip_used();
+   memcpy(blip_mark.buf, blip.buf, blip_mark.used * sizeof(int32));
+   memcpy(blip_mark.state, &blip.factor, APU_BLIP_MARKED);
+}
+
+void apu_rollback(void)
+{
+   apu_journal_flush();
+   memset(blip.buf, 0, apu_blip_used() * sizeof(int32));
+   memcpy(blip.buf, blip_mark.buf, blip_mark.used * sizeof(int32));
+   memcpy(&blip.factor, blip_mark.state, APU_BLIP_MARKED);
+}
+#else  /* !APU_BLIP */
+void apu_mark(void)
+{
+}
+
+void apu_rollback(void)
+{
+}
+#endif /* !APU_BLIP */
+#endif /* NES_RUNAHEAD */
+
 /* set the filter type */
 void apu_setfilter(int filter_type)
 {
    apu.filter_type = filter_type;
 }
 
+void apu_setformat(int format)
+{
+   apu.format = format;
+}
+
+/* 256 is unity; applied after clipping, once per sample */
+void apu_setgain(int gain)
+{
+   apu.gain = gain;
+}
+
 void apu_reset(void)
 {
    uint32 address;
 
+#ifdef APU_BLIP
+   apu_blip_clear();
+#endif /* APU_BLIP */
+
    /* initialize all channel members */
    for (address = 0x4000; address <= 0x4013; address++)
       apu_write(address, 0);
@@ -956,12 +1914,6 @@ void apu_build_luts(int num_samples)
    /* triangle wave channel's linear length table */
    for (i = 0; i < 128; i++)
       trilength_lut[i] = (int)(0.25 * i * num_samples);
-
-#ifndef REALTIME_NOISE
-   /* generate noise samples */
-   shift_register15(noise_long_lut, APU_NOISE_32K);
-   shift_register15(noise_short_lut, APU_NOISE_93);
-#endif /* !REALTIME_NOISE */
 }
 
 void apu_setparams(double base_freq, int sample_rate, int refresh_rate, int sample_bits)
@@ -974,29 +1926,44 @@ void apu_setparams(double base_freq, int sample_rate, int refresh_rate, int samp
       apu.base_freq = APU_BASEFREQ;
    else
       apu.base_freq = base_freq;
-   apu.cycle_rate = (float)(apu.base_freq / sample_rate);
+   apu.cycle_rate = (int32)(apu.base_freq * (1 << APU_FIXED_SHIFT) / sample_rate);
 
+#ifdef APU_BLIP
+   blip.nominal = (uint32)(sample_rate * 4294967296.0 / apu.base_freq);
+   blip.tick_cycles = (int32)(apu.base_freq / (refresh_rate * APU_BLIP_TICKS));
+   apu_blip_buildkernel();
+
+   /* counters are clocked by the frame tick, not per sample */
+   apu_build_luts(APU_BLIP_TICKS);
+#else  /* !APU_BLIP */
    /* build various lookup tables for apu */
    apu_build_luts(apu.num_samples);
+#endif /* !APU_BLIP */
 
    apu_reset();
 }
 
+/* a PAL APU has its own noise and DMC period tables; Dendy's are NTSC's */
+void apu_setpalperiods(bool pal)
+{
+   apu.pal_periods = pal ? 1 : 0;
+}
+
 /* Initializes emulated sound hardware, creates waveforms/voices */
 apu_t *apu_create(double base_freq, int sample_rate, int refresh_rate, int sample_bits)
 {
    apu_t *temp_apu;
    int channel;
 
-   temp_apu = malloc(sizeof(apu_t));
+   temp_apu = arena_alloc(ARENA_FAST, sizeof(apu_t));
    if (NULL == temp_apu)
       return NULL;
 
-   memset(temp_apu, 0, sizeof(apu_t));
-
    /* set the update routine */
    temp_apu->process = apu_process;
    temp_apu->ext = NULL;
+   temp_apu->pal_periods = 0;
+   temp_apu->noise.sreg = 0x4000; /* as it powers up, a reset leaves it */
 
    /* clear the callbacks */
    temp_apu->irq_callback = NULL;
@@ -1010,6 +1977,8 @@ apu_t *apu_create(double base_freq, int sample_rate, int refresh_rate, int sampl
       apu_setchan(channel, true);
 
    apu_setfilter(APU_FILTER_WEIGHTED);
+   apu_setformat(APU_FORMAT_NATIVE);
+   apu_setgain(0x100);
 
    apu_getcontext(temp_apu);
 
@@ -1022,7 +1991,7 @@ void apu_destroy(apu_t **src_apu)
    {
       if ((*src_apu)->ext && NULL != (*src_apu)->ext->shutdown)
          (*src_apu)->ext->shutdown();
-      free(*src_apu);
+      arena_free(*src_apu);
       *src_apu = NULL;
    }
 }
@@ -27,9 +27,8 @@
 #define _NES_APU_H_
 
 #include <stdbool.h>
+#include <stdint.h>
 #include "noftypes.h"
-/* define this for realtime generated noise */
-#define REALTIME_NOISE
 
 #define APU_WRA0 0x4000
 #define APU_WRA1 0x4001
@@ -52,12 +51,17 @@
 
 #define APU_SMASK 0x4015
 
-/* length of generated noise */
-#define APU_NOISE_32K 0x7FFF
-#define APU_NOISE_93 93
-
 #define APU_BASEFREQ 1789772.7272727272727272
 
+/* DMC bytes fetched and not played yet, a power of two */
+#define APU_DMC_QUEUE 16
+/* CPU cycles a DMC fetch takes away */
+#define APU_DMC_STALL 4
+
+/* channel timing runs in 16.16 fixed point CPU cycles */
+#define APU_FIXED_SHIFT 16
+#define APU_FIXED(cycles) ((int32)(cycles) << APU_FIXED_SHIFT)
+
 /* channel structures */
 /* As much data as possible is precalculated,
 ** to keep the sample processing as lean as possible
@@ -69,7 +73,7 @@ typedef struct rectangle_s
 
    bool enabled;
 
-   float accum;
+   int32 accum; /* 16.16 */
    int32 freq;
    int32 output_vol;
    bool fixed_envelope;
@@ -100,7 +104,7 @@ typedef struct triangle_s
 
    bool enabled;
 
-   float accum;
+   int32 accum; /* 16.16 */
    int32 freq;
    int32 output_vol;
 
@@ -121,7 +125,7 @@ typedef struct noise_s
 
    bool enabled;
 
-   float accum;
+   int32 accum; /* 16.16 */
    int32 freq;
    int32 output_vol;
 
@@ -135,12 +139,8 @@ typedef struct noise_s
 
    int vbl_length;
 
-#ifdef REALTIME_NOISE
    uint8 xor_tap;
-#else
-   bool short_sample;
-   int cur_pos;
-#endif /* REALTIME_NOISE */
+   uint16 sreg;  /* the shift register, goes with the context */
 } noise_t;
 
 typedef struct dmc_s
@@ -150,16 +150,26 @@ typedef struct dmc_s
    /* bodge for timestamp queue */
    bool enabled;
 
-   float accum;
+   int32 accum; /* 16.16 */
    int32 freq;
    int32 output_vol;
 
-   uint32 address;
+   uint32 address;      /* of the next fetch */
    uint32 cached_addr;
-   int dma_length;
+   int dma_length;      /* bits of the sample left to play */
    int cached_dmalength;
    uint8 cur_byte;
 
+   /* DMA runs on the CPU's clock, not the output's: nes_runcpu stops at
+   ** dma_time for apu_dmcfetch, which reads the byte, stalls the CPU and
+   ** queues the byte for the output to take when it gets there
+   */
+   uint32 dma_time;     /* CPU cycle of the next fetch */
+   int dma_bytes;       /* bytes of the sample left to fetch, 0 none due */
+   int next_length;     /* bits the output goes on with when it's done, 0 stop */
+   uint8 queue[APU_DMC_QUEUE];
+   uint8 queue_head, queue_tail;
+
    bool looping;
    bool irq_gen;
    bool irq_occurred;
@@ -173,6 +183,14 @@ enum
    APU_FILTER_WEIGHTED
 };
 
+/* output formats */
+enum
+{
+   APU_FORMAT_NATIVE, /* sample_bits: signed 16-bit or unsigned 8-bit */
+   APU_FORMAT_DAC16   /* unsigned 16-bit, top byte for an 8-bit DAC, word
+                      ** pairs swapped into 32-bit I2S FIFO order */
+};
+
 typedef struct
 {
    uint32 min_range, max_range;
@@ -194,6 +212,9 @@ typedef struct apuext_s
    int32_t (*process)(void);
    apu_memread *mem_read;
    apu_memwrite *mem_write;
+   /* fill count samples of output; may return 0 instead of a block of zeros.
+   ** when set, process is not used */
+   int (*render)(int32 *buffer, int count);
 } apuext_t;
 
 typedef struct apu_s
@@ -209,9 +230,12 @@ typedef struct apu_s
 
    uint8_t mix_enable;
    int filter_type;
+   int format;
+   int32 gain; /* output gain, 8.8 */
 
    double base_freq;
-   float cycle_rate;
+   int32 cycle_rate; /* CPU cycles per sample, 16.16 */
+   uint8_t pal_periods; /* 1: PAL noise and DMC periods */
 
    int sample_rate;
    int sample_bits;
@@ -236,13 +260,25 @@ extern "C"
 
    extern void apu_setparams(double base_freq, int sample_rate, int refresh_rate, int sample_bits);
    extern apu_t *apu_create(double base_freq, int sample_rate, int refresh_rate, int sample_bits);
+   extern void apu_setpalperiods(bool pal);
    extern void apu_destroy(apu_t **apu);
 
    extern void apu_process(void *buffer, int num_samples);
+   /* DMC DMA, for nes_runcpu: CPU cycles to the next fetch (0x7FFFFFFF if
+   ** there's none, <= 0 if it's due), and every fetch due by now
+   */
+   extern int32 apu_dmcdue(void);
+   extern void apu_dmcfetch(void);
+#ifdef NES_RUNAHEAD
+   extern void apu_mark(void);
+   extern void apu_rollback(void);
+#endif
    extern void apu_reset(void);
 
    extern void apu_setext(apu_t *apu, apuext_t *ext);
    extern void apu_setfilter(int filter_type);
+   extern void apu_setformat(int format);
+   extern void apu_setgain(int gain);
    extern void apu_setchan(int chan, bool enabled);
 
    extern uint8_t apu_read(uint32_t address);
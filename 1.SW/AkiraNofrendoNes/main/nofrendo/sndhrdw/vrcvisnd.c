@@ -23,22 +23,27 @@
 ** $Id: vrcvisnd.c,v 1.2 2001/04/27 14:37:11 neil Exp $
 */
 
+#include <string.h>
 #include "noftypes.h"
 #include "vrcvisnd.h"
 #include "../sndhrdw/nes_apu.h"
+#include "../nes/nesstate.h"
 
+/* the two rectangles side by side, so the block loop below walks one
+** array per field instead of hopping between channel structs
+*/
 typedef struct vrcvirectangle_s
 {
-   bool enabled;
+   bool enabled[2];
 
-   uint8 reg[3];
+   uint8 reg[2][3];
 
-   float accum;
-   uint8 adder;
+   int32 accum[2]; /* 16.16 */
+   uint8 adder[2];
 
-   int32 freq;
-   int32 volume;
-   uint8 duty_flip;
+   int32 freq[2];
+   int32 volume[2];
+   uint8 duty_flip[2];
 } vrcvirectangle_t;
 
 typedef struct vrcvisawtooth_s
@@ -47,7 +52,7 @@ typedef struct vrcvisawtooth_s
 
    uint8 reg[3];
 
-   float accum;
+   int32 accum; /* 16.16 */
    uint8 adder;
    uint8 output_acc;
 
@@ -57,77 +62,126 @@ typedef struct vrcvisawtooth_s
 
 typedef struct vrcvisnd_s
 {
-   vrcvirectangle_t rectangle[2];
+   vrcvirectangle_t rectangle;
    vrcvisawtooth_t saw;
-   float incsize;
+   int32 incsize;
 } vrcvisnd_t;
 
 static vrcvisnd_t vrcvi;
 
-/* VRCVI rectangle wave generation */
-static int32 vrcvi_rectangle(vrcvirectangle_t *chan)
+/* VRCVI rectangle wave generation, count samples of channel ch added into out */
+static void vrcvi_rectangle(int ch, int32 *out, int count)
 {
    /* reg0: 0-3=volume, 4-6=duty cycle
    ** reg1: 8 bits of freq
    ** reg2: 0-3=high freq, 7=enable
    */
+   int32 accum = vrcvi.rectangle.accum[ch];
+   int32 period = APU_FIXED(vrcvi.rectangle.freq[ch]);
+   int32 volume = vrcvi.rectangle.volume[ch];
+   uint8 adder = vrcvi.rectangle.adder[ch];
+   uint8 duty_flip = vrcvi.rectangle.duty_flip[ch];
+   int i;
 
-   chan->accum -= vrcvi.incsize; /* # of clocks per wave cycle */
-   while (chan->accum < 0)
+   /* disabled: only the phase moves, in one go */
+   if (false == vrcvi.rectangle.enabled[ch])
    {
-      chan->accum += chan->freq;
-      chan->adder = (chan->adder + 1) & 0x0F;
-   }
-
-   /* return if not enabled */
-   if (false == chan->enabled)
-      return 0;
+      accum -= vrcvi.incsize * count;
+      if (accum < 0)
+      {
+         int32 steps = (period - 1 - accum) / period;
 
-   if (chan->adder < chan->duty_flip)
-      return -(chan->volume);
+         accum += steps * period;
+         adder = (adder + steps) & 0x0F;
+      }
+   }
    else
-      return chan->volume;
+   {
+      for (i = 0; i < count; i++)
+      {
+         accum -= vrcvi.incsize; /* # of clocks per wave cycle */
+         while (accum < 0)
+         {
+            accum += period;
+            adder = (adder + 1) & 0x0F;
+         }
+
+         out[i] += (adder < duty_flip) ? -volume : volume;
+      }
+   }
+
+   vrcvi.rectangle.accum[ch] = accum;
+   vrcvi.rectangle.adder[ch] = adder;
 }
 
 /* VRCVI sawtooth wave generation */
-static int32 vrcvi_sawtooth(vrcvisawtooth_t *chan)
+static void vrcvi_sawtooth(vrcvisawtooth_t *chan, int32 *out, int count)
 {
    /* reg0: 0-5=phase accumulator bits
    ** reg1: 8 bits of freq
    ** reg2: 0-3=high freq, 7=enable
    */
+   int i;
 
-   chan->accum -= vrcvi.incsize; /* # of clocks per wav cycle */
-   while (chan->accum < 0)
+   /* disabled: step the phase in one go.  after a wrap the accumulator is
+   ** always adder * volume, since volume can't change in between
+   */
+   if (false == chan->enabled)
    {
-      chan->accum += chan->freq;
-      chan->output_acc += chan->volume;
-
-      chan->adder++;
-      if (7 == chan->adder)
+      chan->accum -= vrcvi.incsize * count;
+      if (chan->accum < 0)
       {
-         chan->adder = 0;
-         chan->output_acc = 0;
+         int32 period = APU_FIXED(chan->freq);
+         int32 steps = (period - 1 - chan->accum) / period;
+
+         chan->accum += steps * period;
+         if (steps >= 7 - chan->adder)
+         {
+            chan->adder = (chan->adder + steps) % 7;
+            chan->output_acc = chan->adder * chan->volume;
+         }
+         else
+         {
+            chan->adder += steps;
+            chan->output_acc += steps * chan->volume;
+         }
       }
+      return;
    }
 
-   /* return if not enabled */
-   if (false == chan->enabled)
-      return 0;
+   for (i = 0; i < count; i++)
+   {
+      chan->accum -= vrcvi.incsize; /* # of clocks per wav cycle */
+      while (chan->accum < 0)
+      {
+         chan->accum += APU_FIXED(chan->freq);
+         chan->output_acc += chan->volume;
+
+         chan->adder++;
+         if (7 == chan->adder)
+         {
+            chan->adder = 0;
+            chan->output_acc = 0;
+         }
+      }
 
-   return (chan->output_acc >> 3) << 9;
+      out[i] += (chan->output_acc >> 3) << 9;
+   }
 }
 
-/* mix vrcvi sound channels together */
-static int32 vrcvi_process(void)
+/* mix a block of vrcvi sound channels together */
+static int vrcvi_render(int32 *out, int count)
 {
-   int32 output;
+   bool live = vrcvi.rectangle.enabled[0] || vrcvi.rectangle.enabled[1] || vrcvi.saw.enabled;
+
+   if (live)
+      memset(out, 0, count * sizeof(int32));
 
-   output = vrcvi_rectangle(&vrcvi.rectangle[0]);
-   output += vrcvi_rectangle(&vrcvi.rectangle[1]);
-   output += vrcvi_sawtooth(&vrcvi.saw);
+   vrcvi_rectangle(0, out, count);
+   vrcvi_rectangle(1, out, count);
+   vrcvi_sawtooth(&vrcvi.saw, out, count);
 
-   return output;
+   return live;
 }
 
 /* write to registers */
@@ -139,22 +193,22 @@ static void vrcvi_write(uint32 address, uint8 value)
    {
    case 0x9000:
    case 0xA000:
-      vrcvi.rectangle[chan].reg[0] = value;
-      vrcvi.rectangle[chan].volume = (value & 0x0F) << 8;
-      vrcvi.rectangle[chan].duty_flip = (value >> 4) + 1;
+      vrcvi.rectangle.reg[chan][0] = value;
+      vrcvi.rectangle.volume[chan] = (value & 0x0F) << 8;
+      vrcvi.rectangle.duty_flip[chan] = (value >> 4) + 1;
       break;
 
    case 0x9001:
    case 0xA001:
-      vrcvi.rectangle[chan].reg[1] = value;
-      vrcvi.rectangle[chan].freq = ((vrcvi.rectangle[chan].reg[2] & 0x0F) << 8) + value + 1;
+      vrcvi.rectangle.reg[chan][1] = value;
+      vrcvi.rectangle.freq[chan] = ((vrcvi.rectangle.reg[chan][2] & 0x0F) << 8) + value + 1;
       break;
 
    case 0x9002:
    case 0xA002:
-      vrcvi.rectangle[chan].reg[2] = value;
-      vrcvi.rectangle[chan].freq = ((value & 0x0F) << 8) + vrcvi.rectangle[chan].reg[1] + 1;
-      vrcvi.rectangle[chan].enabled = (value & 0x80) ? true : false;
+      vrcvi.rectangle.reg[chan][2] = value;
+      vrcvi.rectangle.freq[chan] = ((value & 0x0F) << 8) + vrcvi.rectangle.reg[chan][1] + 1;
+      vrcvi.rectangle.enabled[chan] = (value & 0x80) ? true : false;
       break;
 
    case 0xB000:
@@ -197,6 +251,12 @@ static void vrcvi_reset(void)
    }
 }
 
+static int vrcvi_init(void)
+{
+   state_region(&vrcvi, sizeof(vrcvi));
+   return 0;
+}
+
 static apu_memwrite vrcvi_memwrite[] =
     {
         {0x9000, 0x9002, vrcvi_write}, /* vrc6 */
@@ -206,12 +266,13 @@ static apu_memwrite vrcvi_memwrite[] =
 
 apuext_t vrcvi_ext =
     {
-        NULL, /* no init */
+        vrcvi_init,
         NULL, /* no shutdown */
         vrcvi_reset,
-        vrcvi_process,
+        NULL, /* renders in blocks */
         NULL, /* no reads */
-        vrcvi_memwrite};
+        vrcvi_memwrite,
+        vrcvi_render};
 
 /*
 ** $Log: vrcvisnd.c,v $
@@ -36,6 +36,8 @@ static bitmap_t *screen = NULL;
 
 /* primary / backbuffer surfaces */
 static bitmap_t *primary_buffer = NULL; //, *back_buffer = NULL;
+/* the one vid_flush last handed out */
+static bitmap_t *shown_buffer = NULL;
 
 static viddriver_t *driver = NULL;
 
@@ -123,6 +125,11 @@ bitmap_t *vid_getbuffer(void)
    return primary_buffer;
 }
 
+bitmap_t *vid_getshown(void)
+{
+   return shown_buffer ? shown_buffer : primary_buffer;
+}
+
 void vid_setpalette(rgb_t *p)
 {
    ASSERT(driver);
@@ -356,21 +363,52 @@ void vid_flush(void)
    else
       vid_blitscreen(num_dirties, dirty_rects);
 
+   shown_buffer = primary_buffer;
+
+   /* the driver now owns that frame, render the next one elsewhere */
+   if (driver->next_buffer)
+      primary_buffer = driver->next_buffer();
+
    /* Swap pointers to the main/back buffers */
 //   temp = back_buffer;
 //   back_buffer = primary_buffer;
 //   primary_buffer = temp;
 }
 
+/* start the next frame as a copy of the last one flushed; that one is only
+** read, by a driver that may still be sending it
+*/
+void vid_copyshown(void)
+{
+   int i;
+
+   if (NULL == shown_buffer || shown_buffer == primary_buffer)
+      return;
+
+   for (i = 0; i < primary_buffer->height; i++)
+      memcpy(primary_buffer->line[i], shown_buffer->line[i], primary_buffer->width);
+}
+
+/* let drivers that stream the picture out pick up each line as it is done */
+void vid_linedone(int scanline)
+{
+   if (driver->line_done)
+      driver->line_done(primary_buffer, scanline);
+}
+
 /* emulated machine tells us which resolution it wants */
 int vid_setmode(int width, int height)
 {
-   if (NULL != primary_buffer)
+   if (NULL != primary_buffer && NULL == driver->create_buffer)
       bmp_destroy(&primary_buffer);
 //   if (NULL != back_buffer)
 //      bmp_destroy(&back_buffer);
 
-   primary_buffer = bmp_create(width, height, 0); /* no overdraw */
+   shown_buffer = NULL;
+   if (driver && driver->create_buffer)
+      primary_buffer = driver->create_buffer(width, height);
+   else
+      primary_buffer = bmp_create(width, height, 0); /* no overdraw */
    if (NULL == primary_buffer)
       return -1;
 
@@ -384,7 +422,9 @@ int vid_setmode(int width, int height)
    }
    bmp_clear(back_buffer, GUI_BLACK);
 #endif
-   bmp_clear(primary_buffer, GUI_BLACK);
+   /* driver surfaces need not be one contiguous block */
+   if (false == primary_buffer->hardware)
+      bmp_clear(primary_buffer, GUI_BLACK);
 
    return 0;
 }
@@ -424,7 +464,7 @@ int vid_init(int width, int height, viddriver_t *osd_driver)
 {
    if (vid_findmode(width, height, osd_driver))
    {
-      log_printf("video initialization failed for %s at %dx%d\n",
+      log_printf(LOG_ERROR "video initialization failed for %s at %dx%d\n",
                  osd_driver->name, width, height);
       return -1;
    }
@@ -438,8 +478,10 @@ void vid_shutdown(void)
    if (NULL == driver)
       return;
 
-   if (NULL != primary_buffer)
+   if (NULL != primary_buffer && NULL == driver->create_buffer)
       bmp_destroy(&primary_buffer);
+   primary_buffer = NULL;
+   shown_buffer = NULL;
 #if 0
    if (NULL != back_buffer)
       bmp_destroy(&back_buffer);
@@ -51,10 +51,19 @@ typedef struct viddriver_s
                             rect_t *dirty_rects);
    /* immediately invalidate the buffer, i.e. full redraw */
    bool      invalidate;
+   /* provide the surface the machine renders into (can be NULL) */
+   /* surfaces handed out here belong to the driver, not to vid_drv */
+   bitmap_t *(*create_buffer)(int width, int height);
+   /* a scanline of the primary buffer is complete (can be NULL) */
+   void      (*line_done)(bitmap_t *primary, int scanline);
+   /* surface to render the next frame into, after custom_blit (can be NULL) */
+   bitmap_t *(*next_buffer)(void);
 } viddriver_t;
 
 /* TODO: filth */
 extern bitmap_t *vid_getbuffer(void);
+/* the frame last flushed, what is on the screen */
+extern bitmap_t *vid_getshown(void);
 
 extern int  vid_init(int width, int height, viddriver_t *osd_driver);
 extern void vid_shutdown(void);
@@ -65,6 +74,8 @@ extern void vid_setpalette(rgb_t *pal);
 extern void vid_blit(bitmap_t *bitmap, int src_x, int src_y, int dest_x, 
                      int dest_y, int blit_width, int blit_height);
 extern void vid_flush(void);
+extern void vid_copyshown(void);
+extern void vid_linedone(int scanline);
 
 #endif /* _VID_DRV_H_ */
 
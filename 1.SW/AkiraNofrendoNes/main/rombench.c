@@ -0,0 +1,217 @@
+#include <stdio.h>
+#include <string.h>
+#include "sdkconfig.h"
+#include "rombench.h"
+
+#if CONFIG_NES_BENCH
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "driver/gpio.h"
+#include "nofrendo/nes/nes.h"
+#include "nofrendo/nes/nes_prof.h"
+#include "nofrendo/nes/nes_replay.h"
+#include "spi_lcd.h"
+
+bool cpGetPixel(char cpChar, int cp1, int cp2);
+
+// The table is drawn in the menu's 16x18 font: 20 columns, a header and
+// BENCH_ROWS games. Games past that are only on UART.
+#define BENCH_ROWS 12
+#define BENCH_COLS 20
+#define BENCH_CELL_W 16
+#define BENCH_CELL_H 18
+
+typedef struct
+{
+	int entry;
+	int fps10; // frames per second, in tenths
+	int heapKb;
+} bench_row_t;
+
+static bench_row_t rows[BENCH_ROWS];
+static int rowCount;
+static int benchMode = -1; // -1 while no game runs under the benchmark
+static int benchEntry;
+static int frames;
+static bool finished;
+static int64_t startUs;
+#if CONFIG_NES_PROFILE
+static uint32_t startCycles;
+static uint32_t startProf[PROF_SLOTS];
+#endif
+
+int rombench_enabled(void)
+{
+	return 1;
+}
+
+void rombench_begin(int mode)
+{
+	rowCount = 0;
+	replay_load(CONFIG_NES_BENCH_INPUT);
+	printf("bench: %s, %d frames a game\n", mode == ROMBENCH_HEADLESS ? "no LCD" : "LCD", CONFIG_NES_BENCH_FRAMES);
+	benchMode = mode;
+}
+
+void rombench_game(int entry)
+{
+	benchEntry = entry;
+	frames = 0;
+	finished = false;
+}
+
+bool rombench_finished(void)
+{
+	return finished;
+}
+
+bool rombench_running(void)
+{
+	return benchMode >= 0 && !finished;
+}
+
+bool rombench_headless(void)
+{
+	return benchMode == ROMBENCH_HEADLESS && !finished;
+}
+
+static void report(void)
+{
+	int64_t us = esp_timer_get_time() - startUs;
+	int fps10 = us ? (int)(frames * 10000000LL / us) : 0;
+	int heapKb = heap_caps_get_free_size(MALLOC_CAP_INTERNAL) / 1024;
+	char line[160];
+	int len;
+
+	len = snprintf(line, sizeof(line), "bench: %d %08X %d %d.%d", benchEntry + 1,
+				   (unsigned)nes_getcontextptr()->rominfo->crc, frames, fps10 / 10, fps10 % 10);
+#if CONFIG_NES_PROFILE
+	// cycles to us at the rate the counter ran over the game, as nes_prof.c does
+	uint32_t mhz = us ? (uint32_t)((osd_getcycles() - startCycles) / us) : 0;
+
+	if (mhz == 0)
+		mhz = 1;
+	for (int i = 0; i < PROF_SLOTS; i++)
+		len += snprintf(line + len, sizeof(line) - len, " %s %u", prof_name(i),
+						(unsigned)((prof_cycles[i] - startProf[i]) / frames / mhz));
+#endif
+	snprintf(line + len, sizeof(line) - len, " heap %d %d psram %d", heapKb,
+			 (int)(heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL) / 1024),
+			 (int)(heap_caps_get_free_size(MALLOC_CAP_SPIRAM) / 1024));
+	printf("%s\n", line);
+
+	if (rowCount < BENCH_ROWS)
+	{
+		rows[rowCount].entry = benchEntry;
+		rows[rowCount].fps10 = fps10;
+		rows[rowCount++].heapKb = heapKb;
+	}
+}
+
+bool rombench_frame(int *buttons)
+{
+	*buttons = ~replay_buttons(frames) & 0xffff;
+	// timed from the first frame the game runs, the load is not in it
+	if (frames == 0)
+	{
+		startUs = esp_timer_get_time();
+#if CONFIG_NES_PROFILE
+		startCycles = osd_getcycles();
+		memcpy(startProf, (const void *)prof_cycles, sizeof(startProf));
+#endif
+	}
+	if (frames == CONFIG_NES_BENCH_FRAMES)
+	{
+		report();
+		finished = true;
+		return true;
+	}
+	frames++;
+	return false;
+}
+
+static void drawTable(void)
+{
+	char text[BENCH_ROWS + 1][BENCH_COLS + 1];
+
+	memset(text, 0, sizeof(text));
+	snprintf(text[0], BENCH_COLS + 1, "No.   fps  heap");
+	for (int i = 0; i < rowCount; i++)
+		snprintf(text[i + 1], BENCH_COLS + 1, "%2d. %4d.%d  %3dk", rows[i].entry + 1, rows[i].fps10 / 10,
+				 rows[i].fps10 % 10, rows[i].heapKb);
+
+	for (int y = 0; y < 240; y += LCD_BUF_LINES)
+	{
+		uint16_t *dest = ili9341_get_lines_buffer();
+
+		for (int l = 0; l < LCD_BUF_LINES; l++)
+		{
+			int row = (y + l) / BENCH_CELL_H;
+
+			for (int x = 0; x < 320; x++)
+			{
+				char c = row <= BENCH_ROWS ? text[row][x / BENCH_CELL_W] : 0;
+
+				*dest++ = c && cpGetPixel(c, x % BENCH_CELL_W, (y + l) % BENCH_CELL_H) ? 0xFFFF : 0;
+			}
+		}
+		ili9341_send_lines(y, LCD_BUF_LINES);
+	}
+	ili9341_wait_lines();
+}
+
+void rombench_end(void)
+{
+	benchMode = -1;
+	printf("bench: done, %d games\n", rowCount);
+	drawTable();
+	// Button1 goes back to the menu, as it leaves upload mode
+	while (gpio_get_level(12) == 0)
+		vTaskDelay(50 / portTICK_PERIOD_MS);
+	while (gpio_get_level(12) == 1)
+		vTaskDelay(20 / portTICK_PERIOD_MS);
+}
+
+#else /* !CONFIG_NES_BENCH */
+
+int rombench_enabled(void)
+{
+	return 0;
+}
+
+void rombench_begin(int mode)
+{
+}
+
+void rombench_game(int entry)
+{
+}
+
+bool rombench_finished(void)
+{
+	return false;
+}
+
+void rombench_end(void)
+{
+}
+
+bool rombench_running(void)
+{
+	return false;
+}
+
+bool rombench_headless(void)
+{
+	return false;
+}
+
+bool rombench_frame(int *buttons)
+{
+	return false;
+}
+
+#endif /* !CONFIG_NES_BENCH */
@@ -0,0 +1,66 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+// Benchmark mode, two entries at the end of the launcher with CONFIG_NES_BENCH.
+// Every game of the list runs for CONFIG_NES_BENCH_FRAMES frames on the input
+// script CONFIG_NES_BENCH_INPUT, unpaced, every frame drawn. "Benchmark" sends
+// the frames to the LCD the way a game does, "Benchmark, no LCD" drops them
+// once the PPU has drawn them. As each game finishes one line goes out over
+// UART:
+//
+//   bench: <entry> <PRG CRC> <frames> <fps> [<slot> <us> ...] heap <KB> <KB> psram <KB>
+//
+// with the time per frame of each CONFIG_NES_PROFILE slot, and the internal
+// RAM free, its largest block, and the PSRAM free while the game was loaded.
+// After the last game the same figures are shown as a table until a button
+// is pressed. The same script and frame count are run on every board, so the
+// figures compare across firmware builds and hardware revisions.
+
+// romListEntry() slot number of the benchmark entries, the offset is the mode
+#define ROMBENCH_SLOT -3
+#define ROMBENCH_LCD 0
+#define ROMBENCH_HEADLESS 1
+
+/**
+ * @brief whether the menu should offer benchmark mode
+ */
+int rombench_enabled(void);
+
+/**
+ * @brief a benchmark run in mode starts, the results of the last are dropped
+ */
+void rombench_begin(int mode);
+
+/**
+ * @brief the game of menu entry entry is about to run under the benchmark
+ */
+void rombench_game(int entry);
+
+/**
+ * @brief whether the game ran all its frames, rather than Button1 stopping it
+ */
+bool rombench_finished(void);
+
+/**
+ * @brief the run is over: show the table until a button is pressed
+ */
+void rombench_end(void);
+
+/**
+ * @brief a game is running under the benchmark, its pad is the script
+ */
+bool rombench_running(void);
+
+/**
+ * @brief the frames are not to go to the LCD
+ */
+bool rombench_headless(void);
+
+/**
+ * @brief once a frame, from osd_getinput
+ *
+ * @param buttons set to the script's buttons for this frame, psxReadInput() bits
+ * @return true once the game has run its frames and should stop
+ */
+bool rombench_frame(int *buttons);
@@ -0,0 +1,366 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
+#include "esp_partition.h"
+#include "esp_heap_caps.h"
+#include "nvs_flash.h"
+#include "nvs.h"
+#include "romsave.h"
+#include "tasks.h"
+#include "emuyield.h"
+
+// on the emulator's core, with CONFIG_NES_YIELD: the longest a save waits for it, and the slice
+#define ROMSAVE_YIELD_MS 100
+#define ROMSAVE_SLICE_US 2000
+
+// One save waiting for the writer. The lock is held for the whole flash
+// write, so the buffer never changes under it.
+static SemaphoreHandle_t lock;
+static TaskHandle_t writer;
+static int yieldClient = -1;
+static uint8_t *staged;
+static int stagedSize;
+static int stagedLength; // 0: nothing to write
+static uint32_t stagedCrc;
+
+// One save state waiting, same rules
+static uint8_t *stateBuf;
+static int stateSize;
+static int stateLength;
+static uint32_t stateCrc;
+static int stateSlot;
+
+// The state partition: ROMSAVE_STATE_RECORD sized records, a copy of every
+// record header is kept in RAM so finding one doesn't read the flash
+static const esp_partition_t *statePart;
+static romsave_state_t *records;
+static int recordCount;
+static uint32_t lastSeq;
+
+static void key_name(char *key, uint32_t crc)
+{
+	sprintf(key, "%08X", (unsigned)crc);
+}
+
+static bool record_valid(int i)
+{
+	return memcmp(records[i].magic, ROMSAVE_STATE_MAGIC, 4) == 0;
+}
+
+// newest record of a game's slot, -1 if there is none
+static int record_find(uint32_t crc, int slot)
+{
+	int found = -1;
+
+	for (int i = 0; i < recordCount; i++)
+	{
+		if (record_valid(i) && records[i].crc == crc && records[i].slot == slot
+			&& (found < 0 || records[i].seq > records[found].seq))
+			found = i;
+	}
+	return found;
+}
+
+// Where the next state goes: an empty record, else the oldest one that an
+// older copy of some slot is still sitting in, else the oldest record of
+// this slot, else the oldest one. Writing round the records in seq order
+// like this wears the sectors evenly.
+static int record_victim(uint32_t crc, int slot)
+{
+	int stale = -1, same = -1, oldest = -1;
+
+	for (int i = 0; i < recordCount; i++)
+	{
+		if (!record_valid(i))
+			return i;
+		if (record_find(records[i].crc, records[i].slot) != i)
+		{
+			if (stale < 0 || records[i].seq < records[stale].seq)
+				stale = i;
+		}
+		else if (records[i].crc == crc && records[i].slot == slot)
+			same = i;
+		if (oldest < 0 || records[i].seq < records[oldest].seq)
+			oldest = i;
+	}
+	if (stale >= 0)
+		return stale;
+	return same >= 0 ? same : oldest;
+}
+
+static void state_write(void)
+{
+	romsave_state_t hdr;
+	int64_t t0 = esp_timer_get_time();
+	int i = record_victim(stateCrc, stateSlot);
+	uint32_t base = i * ROMSAVE_STATE_RECORD;
+	uint32_t erase = (sizeof(hdr) + stateLength + 4095) & ~4095;
+	esp_err_t err;
+
+	memcpy(hdr.magic, ROMSAVE_STATE_MAGIC, 4);
+	hdr.crc = stateCrc;
+	hdr.slot = stateSlot;
+	hdr.seq = ++lastSeq;
+	hdr.length = stateLength;
+
+	// the header goes last, a write cut short leaves the record empty
+	memset(&records[i], 0xff, sizeof(records[i]));
+	err = esp_partition_erase_range(statePart, base, erase);
+	if (err == ESP_OK)
+		err = esp_partition_write(statePart, base + sizeof(hdr), stateBuf, stateLength);
+	if (err == ESP_OK)
+		err = esp_partition_write(statePart, base, &hdr, sizeof(hdr));
+	if (err == ESP_OK)
+	{
+		records[i] = hdr;
+		printf("State %08X/%d: saved %d bytes to record %d in %d ms\n", (unsigned)stateCrc, stateSlot, stateLength, i, (int)((esp_timer_get_time() - t0) / 1000));
+	}
+	else
+		printf("State %08X/%d: save failed (%d)\n", (unsigned)stateCrc, stateSlot, err);
+}
+
+static void writerTask(void *arg)
+{
+	nvs_handle_t nvs;
+	esp_err_t err;
+	char key[9];
+
+	while (1)
+	{
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+		xSemaphoreTake(lock, portMAX_DELAY);
+		if (stateLength)
+		{
+			state_write();
+			stateLength = 0;
+		}
+		if (stagedLength)
+		{
+			int64_t t0 = esp_timer_get_time();
+
+			key_name(key, stagedCrc);
+			err = nvs_open("sram", NVS_READWRITE, &nvs);
+			if (err == ESP_OK)
+			{
+				err = nvs_set_blob(nvs, key, staged, stagedLength);
+				if (err == ESP_OK)
+					err = nvs_commit(nvs);
+				nvs_close(nvs);
+			}
+			if (err == ESP_OK)
+				printf("SRAM %s: saved %d bytes in %d ms\n", key, stagedLength, (int)((esp_timer_get_time() - t0) / 1000));
+			else
+				printf("SRAM %s: save failed (%d), is the NVS partition full?\n", key, err);
+			stagedLength = 0;
+		}
+		xSemaphoreGive(lock);
+		emuYieldDone(yieldClient);
+	}
+}
+
+void romsave_init(void)
+{
+	lock = xSemaphoreCreateMutex();
+
+	statePart = esp_partition_find_first(ROMSAVE_STATE_TYPE, ROMSAVE_STATE_SUBTYPE, ROMSAVE_STATE_LABEL);
+	if (statePart)
+		recordCount = statePart->size / ROMSAVE_STATE_RECORD;
+	if (recordCount)
+		records = malloc(recordCount * sizeof(records[0]));
+	if (records == NULL)
+		recordCount = 0;
+	for (int i = 0; i < recordCount; i++)
+	{
+		if (esp_partition_read(statePart, i * ROMSAVE_STATE_RECORD, &records[i], sizeof(records[i])) != ESP_OK)
+			memset(&records[i], 0xff, sizeof(records[i]));
+		if (record_valid(i) && records[i].seq > lastSeq)
+			lastSeq = records[i].seq;
+	}
+	if (recordCount)
+		printf("State partition: %d records\n", recordCount);
+	else
+		printf("No state partition, save states last until the game is left\n");
+
+	// the emulator runs on core 0, flash writes wait for idle time on core 1
+	tasks_start(TASK_SRAM, &writerTask, NULL, &writer);
+	yieldClient = emuYieldRegister(TASK_SRAM, ROMSAVE_YIELD_MS, ROMSAVE_SLICE_US);
+}
+
+int romsave_load(uint32_t crc, uint8_t *data, int length)
+{
+	nvs_handle_t nvs;
+	size_t len;
+	char key[9];
+	int ret = -1;
+
+	xSemaphoreTake(lock, portMAX_DELAY);
+	// back to the same game before its save went out
+	if (stagedLength && stagedCrc == crc)
+	{
+		if (stagedLength == length)
+		{
+			memcpy(data, staged, length);
+			ret = 0;
+		}
+		xSemaphoreGive(lock);
+		return ret;
+	}
+
+	key_name(key, crc);
+	if (nvs_open("sram", NVS_READWRITE, &nvs) == ESP_OK)
+	{
+		if (nvs_get_blob(nvs, key, NULL, &len) == ESP_OK && len == length
+			&& nvs_get_blob(nvs, key, data, &len) == ESP_OK)
+			ret = 0;
+		nvs_close(nvs);
+	}
+	xSemaphoreGive(lock);
+	return ret;
+}
+
+void romsave_store(uint32_t crc, const uint8_t *data, int length)
+{
+	xSemaphoreTake(lock, portMAX_DELAY);
+	while (stagedLength && stagedCrc != crc)
+	{
+		// another game's save hasn't gone out yet
+		xSemaphoreGive(lock);
+		vTaskDelay(1);
+		xSemaphoreTake(lock, portMAX_DELAY);
+	}
+	if (stagedSize < length)
+	{
+		free(staged);
+		staged = malloc(length);
+		stagedSize = staged ? length : 0;
+	}
+	if (staged)
+	{
+		memcpy(staged, data, length);
+		stagedLength = length;
+		stagedCrc = crc;
+	}
+	else
+		printf("SRAM: no room to stage %d bytes\n", length);
+	xSemaphoreGive(lock);
+	emuYieldWant(yieldClient);
+	xTaskNotifyGive(writer);
+}
+
+int romsave_loadstate(uint32_t crc, int slot, uint8_t *data, int size)
+{
+	int ret = -1;
+	int i;
+
+	xSemaphoreTake(lock, portMAX_DELAY);
+	// still staged, or never got further than RAM
+	if (stateBuf && stateCrc == crc && stateSlot == slot && (stateLength || recordCount == 0))
+	{
+		if (stateSize <= size)
+		{
+			memcpy(data, stateBuf, stateSize);
+			ret = stateSize;
+		}
+		xSemaphoreGive(lock);
+		return ret;
+	}
+
+	i = record_find(crc, slot);
+	if (i >= 0 && records[i].length <= size
+		&& esp_partition_read(statePart, i * ROMSAVE_STATE_RECORD + sizeof(records[i]), data, records[i].length) == ESP_OK)
+		ret = records[i].length;
+	xSemaphoreGive(lock);
+	return ret;
+}
+
+void romsave_storestate(uint32_t crc, int slot, const uint8_t *data, int length)
+{
+	if (length > ROMSAVE_STATE_RECORD - (int)sizeof(romsave_state_t) && recordCount)
+	{
+		printf("State: %d bytes don't fit a record\n", length);
+		return;
+	}
+
+	xSemaphoreTake(lock, portMAX_DELAY);
+	while (stateLength && (stateCrc != crc || stateSlot != slot))
+	{
+		xSemaphoreGive(lock);
+		vTaskDelay(1);
+		xSemaphoreTake(lock, portMAX_DELAY);
+	}
+	if (stateSize != length)
+	{
+		free(stateBuf);
+		stateBuf = heap_caps_malloc(length, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+		if (stateBuf == NULL)
+			stateBuf = malloc(length);
+		stateSize = stateBuf ? length : 0;
+	}
+	if (stateBuf)
+	{
+		memcpy(stateBuf, data, length);
+		stateCrc = crc;
+		stateSlot = slot;
+		// without a partition the copy here is all there is
+		stateLength = recordCount ? length : 0;
+	}
+	else
+		printf("State: no room to stage %d bytes\n", length);
+	xSemaphoreGive(lock);
+	if (recordCount)
+	{
+		emuYieldWant(yieldClient);
+		xTaskNotifyGive(writer);
+	}
+}
+
+void romsave_flush(void)
+{
+	xSemaphoreTake(lock, portMAX_DELAY);
+	while (stagedLength || stateLength)
+	{
+		xSemaphoreGive(lock);
+		vTaskDelay(1);
+		xSemaphoreTake(lock, portMAX_DELAY);
+	}
+	xSemaphoreGive(lock);
+}
+
+int romsave_loadcheats(uint32_t crc, char *codes, int size)
+{
+	nvs_handle_t nvs;
+	size_t len = size;
+	char key[9];
+	int ret = -1;
+
+	key_name(key, crc);
+	if (nvs_open("cheats", NVS_READONLY, &nvs) == ESP_OK)
+	{
+		if (nvs_get_str(nvs, key, codes, &len) == ESP_OK)
+			ret = strlen(codes);
+		nvs_close(nvs);
+	}
+	return ret;
+}
+
+int romsave_storecheats(uint32_t crc, const char *codes)
+{
+	nvs_handle_t nvs;
+	char key[9];
+	esp_err_t err;
+
+	key_name(key, crc);
+	if (nvs_open("cheats", NVS_READWRITE, &nvs) != ESP_OK)
+		return -1;
+	err = codes[0] ? nvs_set_str(nvs, key, codes) : nvs_erase_key(nvs, key);
+	if (err == ESP_ERR_NVS_NOT_FOUND)
+		err = ESP_OK;
+	if (err == ESP_OK)
+		err = nvs_commit(nvs);
+	nvs_close(nvs);
+	return err == ESP_OK ? 0 : -1;
+}
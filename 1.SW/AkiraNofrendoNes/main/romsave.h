@@ -0,0 +1,85 @@
+#pragma once
+#include <stdint.h>
+
+// Battery RAM of the games, one NVS blob each in namespace "sram", keyed by
+// the PRG ROM CRC. NVS spreads its writes over the partition's pages by
+// itself, so a save doesn't wear out one sector. The NVS partition needs
+// room for the SRAM of every battery game played (8 KB each, usually).
+
+/**
+ * @brief start the writer task, call once before the first game, after nvs_flash_init
+ */
+void romsave_init(void);
+
+/**
+ * @brief read the saved battery RAM of a game
+ *
+ * @return - 0 if there was a save of exactly length bytes, -1 otherwise
+ */
+int romsave_load(uint32_t crc, uint8_t *data, int length);
+
+/**
+ * @brief queue the battery RAM of a game to be written
+ *
+ * Copies data and returns, the writer task on the other core does the flash
+ * write. Only waits if a write is already in progress.
+ */
+void romsave_store(uint32_t crc, const uint8_t *data, int length);
+
+// Save states go to the partition labelled ROMSAVE_STATE_LABEL, of type
+// ROMSAVE_STATE_TYPE and subtype ROMSAVE_STATE_SUBTYPE (0x40/1 is the ROM
+// list's), cut into ROMSAVE_STATE_RECORD sized records: a romsave_state_t
+// then the snapshot. Every save takes a fresh record, the newest seq of a
+// game's slot is the one loaded. 640 KB gives ten records, the line in
+// partitions.csv being
+//   states, 0x40, 0x10, , 640K
+// Without the partition the last state saved is kept in RAM only.
+#define ROMSAVE_STATE_TYPE 0x40
+#define ROMSAVE_STATE_SUBTYPE 0x10
+#define ROMSAVE_STATE_LABEL "states"
+#define ROMSAVE_STATE_RECORD 0x10000
+#define ROMSAVE_STATE_MAGIC "AKST"
+#define ROMSAVE_SUSPEND_SLOT 10 // the power button's, past the 0-9 the core uses
+
+typedef struct
+{
+	char magic[4];   // ROMSAVE_STATE_MAGIC, written after the snapshot
+	uint32_t crc;    // PRG ROM CRC
+	uint32_t slot;   // 0-9, ROMSAVE_SUSPEND_SLOT
+	uint32_t seq;    // counts up with every save
+	uint32_t length; // bytes of snapshot
+} romsave_state_t;
+
+/**
+ * @brief read the newest save state of a game's slot
+ *
+ * @return - bytes read, -1 if there is none or it's bigger than size
+ */
+int romsave_loadstate(uint32_t crc, int slot, uint8_t *data, int size);
+
+/**
+ * @brief queue a save state to be written, like romsave_store
+ */
+void romsave_storestate(uint32_t crc, int slot, const uint8_t *data, int length);
+
+/**
+ * @brief wait until every queued save is in flash, before sleeping
+ */
+void romsave_flush(void);
+
+// Cheat codes of the games, a string each in NVS namespace "cheats", keyed
+// by the PRG ROM CRC like the battery RAM; see nes_cheat.h for the codes.
+
+/**
+ * @brief read a game's cheat codes into codes, NUL terminated
+ *
+ * @return - the length of the string, -1 if the game has none or they don't fit
+ */
+int romsave_loadcheats(uint32_t crc, char *codes, int size);
+
+/**
+ * @brief set a game's cheat codes, an empty string removes them
+ *
+ * @return - 0 once they're in flash, -1 if not
+ */
+int romsave_storecheats(uint32_t crc, const char *codes);
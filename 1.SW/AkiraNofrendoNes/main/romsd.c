@@ -0,0 +1,268 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sdkconfig.h"
+#include "romsd.h"
+
+#ifdef CONFIG_HW_SD_ENA
+
+#include <dirent.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include "esp_vfs_fat.h"
+#include "sdmmc_cmd.h"
+#include "driver/sdspi_host.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "nvs_flash.h"
+#include "nvs.h"
+#if __has_include("esp_rom_crc.h")
+#include "esp_rom_crc.h"
+#else
+#include "rom/crc.h"
+#define esp_rom_crc32_le crc32_le
+#endif
+
+#define ROMSD_INDEX_VERSION 1
+
+typedef struct
+{
+	uint32_t sig;      // of the directory listing the index was built from
+	uint16_t version;  // ROMSD_INDEX_VERSION
+	uint16_t count;
+	romsd_entry_t entry[ROMSD_MAX];
+} romsd_index_t;
+
+static romsd_index_t sdindex;
+static bool mounted;
+
+static bool is_rom(const char *name)
+{
+	size_t len = strlen(name);
+
+	return len > 4 && len < sizeof(sdindex.entry[0].name) && strcasecmp(name + len - 4, ".nes") == 0;
+}
+
+// FNV-1a over the names and sizes of the ROMs, in directory order
+static uint32_t listing_sig(void)
+{
+	uint32_t sig = 2166136261u;
+	char path[64];
+	struct dirent *de;
+	struct stat st;
+	DIR *dir;
+
+	dir = opendir(ROMSD_MOUNT);
+	if (dir == NULL)
+		return 0;
+	while ((de = readdir(dir)) != NULL)
+	{
+		if (!is_rom(de->d_name))
+			continue;
+		snprintf(path, sizeof(path), ROMSD_MOUNT "/%s", de->d_name);
+		if (stat(path, &st))
+			continue;
+		for (const char *c = de->d_name; *c; c++)
+			sig = (sig ^ (uint8_t)*c) * 16777619u;
+		for (int i = 0; i < 4; i++)
+			sig = (sig ^ (uint8_t)(st.st_size >> (i * 8))) * 16777619u;
+	}
+	closedir(dir);
+	return sig;
+}
+
+// read the header and PRG ROM of one file for its index entry
+static bool index_file(const char *name, romsd_entry_t *e)
+{
+	static uint8_t buf[4096];
+	uint8_t hdr[16];
+	char path[64];
+	uint32_t left, crc = 0;
+	FILE *fp;
+
+	snprintf(path, sizeof(path), ROMSD_MOUNT "/%s", name);
+	fp = fopen(path, "rb");
+	if (fp == NULL)
+		return false;
+	if (fread(hdr, 1, 16, fp) != 16 || memcmp(hdr, "NES\x1a", 4))
+	{
+		fclose(fp);
+		return false;
+	}
+	if (hdr[6] & 0x04)
+		fseek(fp, 512, SEEK_CUR);
+	for (left = hdr[4] * 16384; left; left -= sizeof(buf))
+	{
+		if (fread(buf, 1, sizeof(buf), fp) != sizeof(buf))
+		{
+			fclose(fp);
+			return false;
+		}
+		crc = esp_rom_crc32_le(crc, buf, sizeof(buf));
+	}
+	fseek(fp, 0, SEEK_END);
+	e->size = ftell(fp);
+	fclose(fp);
+
+	strncpy(e->name, name, sizeof(e->name) - 1);
+	e->name[sizeof(e->name) - 1] = 0;
+	e->crc = crc;
+	e->mapper = (hdr[6] >> 4) | (hdr[7] & 0xF0);
+	e->reserved = 0;
+	return true;
+}
+
+static void index_build(uint32_t sig)
+{
+	struct dirent *de;
+	DIR *dir;
+	int64_t t0 = esp_timer_get_time();
+
+	sdindex.sig = sig;
+	sdindex.version = ROMSD_INDEX_VERSION;
+	sdindex.count = 0;
+
+	dir = opendir(ROMSD_MOUNT);
+	if (dir == NULL)
+		return;
+	while ((de = readdir(dir)) != NULL && sdindex.count < ROMSD_MAX)
+	{
+		if (is_rom(de->d_name) && index_file(de->d_name, &sdindex.entry[sdindex.count]))
+			sdindex.count++;
+	}
+	closedir(dir);
+	printf("SD: indexed %d ROMs in %d ms\n", sdindex.count, (int)((esp_timer_get_time() - t0) / 1000));
+}
+
+int romsd_init(void)
+{
+	sdmmc_card_t *card;
+	nvs_handle_t nvs;
+	size_t len;
+	uint32_t sig;
+
+	if (!mounted)
+	{
+		spi_bus_config_t bus = {
+			.mosi_io_num = CONFIG_HW_SD_MOSI,
+			.miso_io_num = CONFIG_HW_SD_MISO,
+			.sclk_io_num = CONFIG_HW_SD_CLK,
+			.quadwp_io_num = -1,
+			.quadhd_io_num = -1,
+			.max_transfer_sz = 4096,
+		};
+		sdmmc_host_t host = SDSPI_HOST_DEFAULT();
+		sdspi_device_config_t slot = SDSPI_DEVICE_CONFIG_DEFAULT();
+		esp_vfs_fat_sdmmc_mount_config_t mount = {
+			.format_if_mount_failed = false,
+			.max_files = 2,
+			.allocation_unit_size = 16 * 1024,
+		};
+
+		// the LCD drives VSPI by hand, the card gets HSPI
+		host.slot = SPI2_HOST;
+		if (spi_bus_initialize(host.slot, &bus, SPI_DMA_CH_AUTO) != ESP_OK)
+			return 0;
+		slot.gpio_cs = CONFIG_HW_SD_CS;
+		slot.host_id = host.slot;
+		if (esp_vfs_fat_sdspi_mount(ROMSD_MOUNT, &host, &slot, &mount, &card) != ESP_OK)
+		{
+			printf("SD: no card\n");
+			spi_bus_free(host.slot);
+			return 0;
+		}
+		mounted = true;
+	}
+
+	sig = listing_sig();
+	if (nvs_open("romsd", NVS_READWRITE, &nvs) != ESP_OK)
+	{
+		index_build(sig);
+		return sdindex.count;
+	}
+
+	len = sizeof(sdindex);
+	if (nvs_get_blob(nvs, "index", &sdindex, &len) != ESP_OK || sdindex.sig != sig
+		|| sdindex.version != ROMSD_INDEX_VERSION || sdindex.count > ROMSD_MAX)
+	{
+		index_build(sig);
+		len = sizeof(sdindex) - sizeof(sdindex.entry) + sdindex.count * sizeof(sdindex.entry[0]);
+		if (nvs_set_blob(nvs, "index", &sdindex, len) == ESP_OK)
+			nvs_commit(nvs);
+	}
+	nvs_close(nvs);
+
+	return sdindex.count;
+}
+
+bool romsd_mounted(void)
+{
+	return mounted;
+}
+
+const romsd_entry_t *romsd_entry(int index)
+{
+	if (index < 0 || index >= sdindex.count)
+		return NULL;
+	return &sdindex.entry[index];
+}
+
+char *romsd_load(int index)
+{
+	const romsd_entry_t *e = romsd_entry(index);
+	char path[64];
+	char *image;
+	FILE *fp;
+	int64_t t0 = esp_timer_get_time();
+
+	if (e == NULL)
+		return NULL;
+
+	printf("SD: %s, mapper %d, %u bytes, CRC %08X\n", e->name, e->mapper, (unsigned)e->size, (unsigned)e->crc);
+	image = heap_caps_malloc(e->size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+	if (image == NULL)
+		image = malloc(e->size);
+	if (image == NULL)
+	{
+		printf("No room to load %u byte ROM\n", (unsigned)e->size);
+		return NULL;
+	}
+
+	snprintf(path, sizeof(path), ROMSD_MOUNT "/%s", e->name);
+	fp = fopen(path, "rb");
+	if (fp == NULL || fread(image, 1, e->size, fp) != e->size)
+	{
+		printf("SD: can't read %s\n", path);
+		if (fp)
+			fclose(fp);
+		free(image);
+		return NULL;
+	}
+	fclose(fp);
+	printf("SD: loaded in %d ms\n", (int)((esp_timer_get_time() - t0) / 1000));
+	return image;
+}
+
+#else /* !CONFIG_HW_SD_ENA */
+
+int romsd_init(void)
+{
+	return 0;
+}
+
+bool romsd_mounted(void)
+{
+	return false;
+}
+
+const romsd_entry_t *romsd_entry(int index)
+{
+	return NULL;
+}
+
+char *romsd_load(int index)
+{
+	return NULL;
+}
+
+#endif /* !CONFIG_HW_SD_ENA */
@@ -0,0 +1,47 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+// ROMs on an SD card (FAT, SPI mode), as a second library next to the
+// flash slots. The *.nes files in the root directory are indexed once; the
+// index is kept in NVS with a signature of the directory listing, and only
+// rebuilt when files are added, removed or change size.
+#define ROMSD_MOUNT "/sd"
+#define ROMSD_MAX 64
+
+// romListEntry() slot number of SD card games, the offset is the index entry
+#define ROMSD_SLOT -1
+
+typedef struct
+{
+	char name[40];    // file name in ROMSD_MOUNT, the menu title without ".nes"
+	uint32_t size;    // bytes of iNES image
+	uint32_t crc;     // CRC32 of the PRG ROM, same as rominfo->crc
+	uint16_t mapper;  // iNES mapper number
+	uint16_t reserved;
+} romsd_entry_t;
+
+/**
+ * @brief mount the card and load or build the index
+ *
+ * @return - number of games on the card, 0 if there's no card (or it's
+ *           disabled in menuconfig)
+ */
+int romsd_init(void);
+
+/**
+ * @return - true once romsd_init has mounted a card, files can go to ROMSD_MOUNT
+ */
+bool romsd_mounted(void);
+
+/**
+ * @return - index entry of a game, NULL if out of range
+ */
+const romsd_entry_t *romsd_entry(int index);
+
+/**
+ * @brief read a game into PSRAM, or internal RAM if there's none
+ *
+ * @return - the iNES image, NULL if it can't be read or doesn't fit
+ */
+char *romsd_load(int index);
@@ -0,0 +1,213 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_partition.h"
+#include "esp_spi_flash.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "romslot.h"
+
+// the image handed out by romslot_load if it's mapped rather than in RAM
+static const void *mapped;
+static spi_flash_mmap_handle_t mappedHandle;
+
+const esp_partition_t *romslot_read(int slot, uint32_t offset, romslot_t *hdr)
+{
+	const esp_partition_t *part;
+
+	part = esp_partition_find_first(ROMSLOT_SUBTYPE(slot), 1, NULL);
+	if (part == NULL || offset > part->size - sizeof(*hdr))
+		return NULL;
+	if (esp_partition_read(part, offset, hdr, sizeof(*hdr)) != ESP_OK)
+		return NULL;
+	if (memcmp(hdr->magic, ROMSLOT_MAGIC, 4) || hdr->version != ROMSLOT_VERSION)
+		return NULL;
+	if (hdr->size < 16 || hdr->packed > part->size - offset - sizeof(*hdr)
+		|| (!(hdr->flags & ROMSLOT_LZ4) && hdr->packed != hdr->size))
+	{
+		printf("ROM slot %d@%u: %u byte image doesn't fit %u byte partition\n", slot, (unsigned)offset,
+			   (unsigned)hdr->packed, (unsigned)part->size);
+		return NULL;
+	}
+	hdr->title[sizeof(hdr->title) - 1] = 0;
+	return part;
+}
+
+uint32_t romslot_next(const romslot_t *hdr, uint32_t offset)
+{
+	if (!(hdr->flags & ROMSLOT_MORE))
+		return 0;
+	return (offset + sizeof(*hdr) + hdr->packed + 3) & ~3;
+}
+
+// Unpack an LZ4 block. Works straight off the mapped flash, so the packed
+// image is read once, front to back, and never copied to RAM.
+static int lz4_unpack(const uint8_t *src, int srclen, uint8_t *dst, int dstlen)
+{
+	const uint8_t *send = src + srclen;
+	uint8_t *d = dst;
+	uint8_t *dend = dst + dstlen;
+
+	while (src < send)
+	{
+		int token = *src++;
+		int len = token >> 4;
+		int b;
+
+		if (len == 15)
+		{
+			do
+			{
+				if (src >= send)
+					return -1;
+				b = *src++;
+				len += b;
+			} while (b == 255);
+		}
+		if (len > send - src || len > dend - d)
+			return -1;
+		memcpy(d, src, len);
+		d += len;
+		src += len;
+
+		// the last sequence is literals only
+		if (src >= send)
+			break;
+
+		if (send - src < 2)
+			return -1;
+		int off = src[0] | (src[1] << 8);
+		src += 2;
+		if (off == 0 || off > d - dst)
+			return -1;
+
+		len = token & 15;
+		if (len == 15)
+		{
+			do
+			{
+				if (src >= send)
+					return -1;
+				b = *src++;
+				len += b;
+			} while (b == 255);
+		}
+		len += 4;
+		if (len > dend - d)
+			return -1;
+
+		// matches may overlap what they write
+		const uint8_t *m = d - off;
+		while (len--)
+			*d++ = *m++;
+	}
+
+	return d - dst;
+}
+
+char *romslot_load(int slot, uint32_t offset)
+{
+	const esp_partition_t *part;
+	spi_flash_mmap_handle_t hrom;
+	const void *romdata;
+	romslot_t hdr;
+	char *image;
+
+	part = romslot_read(slot, offset, &hdr);
+	if (part == NULL)
+	{
+		// slot flashed without a header (raw .nes): map the whole partition
+		part = esp_partition_find_first(ROMSLOT_SUBTYPE(slot), 1, NULL);
+		if (part == NULL || offset)
+		{
+			printf("Couldn't find rom part!\n");
+			return NULL;
+		}
+		printf("ROM slot %d has no header, mapping %u bytes\n", slot, (unsigned)part->size);
+		if (esp_partition_mmap(part, 0, part->size, SPI_FLASH_MMAP_DATA, &romdata, &hrom) != ESP_OK)
+		{
+			printf("Couldn't map rom part!\n");
+			return NULL;
+		}
+		mapped = romdata;
+		mappedHandle = hrom;
+		return (char *)romdata;
+	}
+
+	printf("ROM slot %d@%u: %s, mapper %d, %u bytes, CRC %08X%s\n", slot, (unsigned)offset, hdr.title, hdr.mapper,
+		   (unsigned)hdr.size, (unsigned)hdr.crc, (hdr.flags & ROMSLOT_LZ4) ? ", LZ4" : "");
+
+	// map only the image, the MMU window is shared with code
+	if (esp_partition_mmap(part, offset + sizeof(hdr), hdr.packed, SPI_FLASH_MMAP_DATA, &romdata, &hrom) != ESP_OK)
+	{
+		printf("Couldn't map rom part!\n");
+		return NULL;
+	}
+	if (!(hdr.flags & ROMSLOT_LZ4))
+	{
+		mapped = romdata;
+		mappedHandle = hrom;
+		return (char *)romdata;
+	}
+
+	// PSRAM on WROVER units, internal RAM otherwise
+	int64_t t0 = esp_timer_get_time();
+	image = heap_caps_malloc(hdr.size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+	if (image == NULL)
+		image = malloc(hdr.size);
+	if (image == NULL)
+	{
+		printf("No room to unpack %u byte ROM\n", (unsigned)hdr.size);
+		spi_flash_munmap(hrom);
+		return NULL;
+	}
+	int len = lz4_unpack(romdata, hdr.packed, (uint8_t *)image, hdr.size);
+	spi_flash_munmap(hrom);
+	if (len != hdr.size)
+	{
+		printf("ROM slot %d@%u: broken LZ4 image\n", slot, (unsigned)offset);
+		free(image);
+		return NULL;
+	}
+	printf("Unpacked %u -> %u bytes in %d ms\n", (unsigned)hdr.packed, (unsigned)hdr.size,
+		   (int)((esp_timer_get_time() - t0) / 1000));
+	return image;
+}
+
+void romslot_free(char *image)
+{
+	if (image == NULL)
+		return;
+	if (image == mapped)
+	{
+		spi_flash_munmap(mappedHandle);
+		mapped = NULL;
+	}
+	else
+		free(image);
+}
+
+int romslot_region(const char *title)
+{
+	static const struct
+	{
+		const char *tag;
+		int region;
+	} tags[] = {
+		{"(E)", ROMSLOT_REGION_PAL},
+		{"(Europe)", ROMSLOT_REGION_PAL},
+		{"(PAL)", ROMSLOT_REGION_PAL},
+		{"(Dendy)", ROMSLOT_REGION_DENDY},
+		{"(U)", ROMSLOT_REGION_NTSC},
+		{"(USA)", ROMSLOT_REGION_NTSC},
+		{"(J)", ROMSLOT_REGION_NTSC},
+		{"(Japan)", ROMSLOT_REGION_NTSC},
+	};
+
+	for (int i = 0; i < sizeof(tags) / sizeof(tags[0]); i++)
+	{
+		if (strstr(title, tags[i].tag))
+			return tags[i].region;
+	}
+	return ROMSLOT_REGION_HEADER;
+}
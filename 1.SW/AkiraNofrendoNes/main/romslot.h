@@ -0,0 +1,75 @@
+#pragma once
+#include <stdint.h>
+#include "esp_partition.h"
+
+// A ROM partition (subtype 0x41 + slot) holds one or more entries, each a
+// header followed by its iNES image, plain or LZ4 compressed. The next entry
+// starts at the next 4 byte boundary if ROMSLOT_MORE is set. Written by
+// AkiraUpdater.py, read by the loader and by the menu, which lists every
+// entry of every slot.
+#define ROMSLOT_MAGIC "AKRS"
+#define ROMSLOT_VERSION 2
+#define ROMSLOT_COUNT 14
+#define ROMSLOT_SUBTYPE(slot) (0x41 + (slot))
+
+// romslot_t flags
+#define ROMSLOT_LZ4 0x01  // image is an LZ4 block (no frame), unpacked into RAM at load
+#define ROMSLOT_MORE 0x02 // another entry follows
+
+// romslot_t region, what AkiraUpdater.py made of the file name; entries
+// written before there was one have ROMSLOT_REGION_HEADER
+#define ROMSLOT_REGION_HEADER 0 // as the iNES header says
+#define ROMSLOT_REGION_NTSC 1
+#define ROMSLOT_REGION_PAL 2
+#define ROMSLOT_REGION_DENDY 3
+
+typedef struct
+{
+	char magic[4];     // ROMSLOT_MAGIC
+	uint8_t version;   // ROMSLOT_VERSION
+	char icon;         // menu icon character, see iconData.c
+	uint16_t mapper;   // iNES mapper number
+	uint32_t size;     // bytes of iNES image
+	uint32_t crc;      // CRC32 of the PRG ROM, same as rominfo->crc
+	uint32_t packed;   // bytes stored after the header, == size unless ROMSLOT_LZ4
+	uint8_t flags;     // ROMSLOT_xxx
+	uint8_t region;    // ROMSLOT_REGION_xxx
+	uint8_t reserved[2];
+	char title[40];    // NUL terminated
+} romslot_t;           // 64 bytes, little endian
+
+/**
+ * @brief read and check the header of the entry at offset in a ROM slot
+ *
+ * @return - the slot's partition, NULL if there's none or the header is
+ *           missing or doesn't fit the partition (hdr is then undefined)
+ */
+const esp_partition_t *romslot_read(int slot, uint32_t offset, romslot_t *hdr);
+
+/**
+ * @brief offset of the entry after the one read at offset, 0 if it's the last
+ */
+uint32_t romslot_next(const romslot_t *hdr, uint32_t offset);
+
+/**
+ * @brief map or unpack the iNES image of the entry at offset in a ROM slot
+ *
+ * A slot without a header (a raw .nes flashed the old way) is mapped whole.
+ *
+ * @return - the image, NULL if the slot is empty or broken
+ */
+char *romslot_load(int slot, uint32_t offset);
+
+/**
+ * @brief TV system of a game by the tags of its title or file name, the way
+ *        AkiraUpdater.py does it: (E), (Europe) or (PAL) is PAL, (Dendy) is
+ *        Dendy, (U), (USA), (J) or (Japan) is NTSC
+ *
+ * @return - ROMSLOT_REGION_xxx, ROMSLOT_REGION_HEADER if there's no tag
+ */
+int romslot_region(const char *title);
+
+/**
+ * @brief unmap or free an image from romslot_load() or romsd_load()
+ */
+void romslot_free(char *image);
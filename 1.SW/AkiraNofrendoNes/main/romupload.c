@@ -0,0 +1,528 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sdkconfig.h"
+#include "romupload.h"
+
+#if CONFIG_NES_UPLOAD
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_wifi.h"
+#include "esp_netif.h"
+#include "esp_event.h"
+#include "esp_http_server.h"
+#include "esp_partition.h"
+#include "esp_timer.h"
+#include "driver/gpio.h"
+#include "romslot.h"
+#include "romsd.h"
+#include "romsave.h"
+#if __has_include("esp_rom_crc.h")
+#include "esp_rom_crc.h"
+#else
+#include "rom/crc.h"
+#define esp_rom_crc32_le crc32_le
+#endif
+
+#define UPLOAD_CHUNK 4096
+#define UPLOAD_SECTOR 4096
+#define UPLOAD_CHEATS 511 // what the core reads of a game's codes
+
+// One upload on its way in. The HTTP server runs one request at a time, so
+// there is only ever one of these.
+typedef struct
+{
+	httpd_req_t *req;
+	const esp_partition_t *part; // slot uploads
+	FILE *fp;                    // SD uploads
+	uint32_t base;               // where the body starts in part
+	uint32_t erased;             // part is erased up to here
+	uint32_t length;             // bytes of body, from Content-Length
+	uint32_t pos;                // bytes of body taken so far
+	uint32_t crc;                // CRC32 of those
+	bool holdHead;               // the body starts with a slot header: keep it back
+	uint8_t head[sizeof(romslot_t)];
+	uint8_t nes[16];             // iNES header at the start of the body
+	uint32_t prgCrc;             // CRC32 of the PRG ROM part of the body
+	uint8_t *buf;
+} upload_t;
+
+static httpd_handle_t server;
+
+static int query_str(httpd_req_t *req, const char *key, char *val, int size)
+{
+	char query[256];
+	char raw[sizeof(query)];
+	char *d = raw;
+
+	// escapes are three bytes a character, so the value is looked up whole
+	// and decoded before it's cut down to size
+	if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK
+		|| httpd_query_key_value(query, key, raw, sizeof(raw)) != ESP_OK)
+		return -1;
+	// undo the URL encoding, in place, the result is never longer
+	for (const char *s = raw; *s; d++)
+	{
+		if (*s == '%' && s[1] && s[2])
+		{
+			char hex[3] = {s[1], s[2], 0};
+			*d = (char)strtol(hex, NULL, 16);
+			s += 3;
+		}
+		else
+		{
+			*d = (*s == '+') ? ' ' : *s;
+			s++;
+		}
+	}
+	*d = 0;
+	snprintf(val, size, "%s", raw);
+	return 0;
+}
+
+static int query_int(httpd_req_t *req, const char *key, int base, int def)
+{
+	char val[16];
+
+	if (query_str(req, key, val, sizeof(val)))
+		return def;
+	return (int)strtoul(val, NULL, base);
+}
+
+// the PRG ROM of the iNES image being uploaded, once its header is in
+static void prg_range(const upload_t *u, uint32_t *start, uint32_t *end)
+{
+	*start = 16 + ((u->nes[6] & 0x04) ? 512 : 0);
+	*end = *start + u->nes[4] * 16384;
+}
+
+static esp_err_t sink_flash(upload_t *u, const uint8_t *data, int n, uint32_t pos)
+{
+	uint32_t end = u->base + pos + n;
+
+	// a header held back is written once the rest is known to be good
+	if (u->holdHead && pos < sizeof(u->head))
+	{
+		int take = sizeof(u->head) - pos < n ? sizeof(u->head) - pos : n;
+
+		memcpy(u->head + pos, data, take);
+		data += take;
+		pos += take;
+		n -= take;
+		if (n == 0)
+			return ESP_OK;
+	}
+	while (u->erased < end)
+	{
+		if (esp_partition_erase_range(u->part, u->erased, UPLOAD_SECTOR) != ESP_OK)
+			return ESP_FAIL;
+		u->erased += UPLOAD_SECTOR;
+	}
+	return esp_partition_write(u->part, u->base + pos, data, n);
+}
+
+static esp_err_t sink_file(upload_t *u, const uint8_t *data, int n, uint32_t pos)
+{
+	return fwrite(data, 1, n, u->fp) == n ? ESP_OK : ESP_FAIL;
+}
+
+// Take the whole body, chunk by chunk, into the sink. The CRCs are kept up
+// on the way, the one of the PRG ROM only means something for .nes bodies.
+static esp_err_t upload_body(upload_t *u, esp_err_t (*sink)(upload_t *, const uint8_t *, int, uint32_t))
+{
+	uint32_t prgStart = 0, prgEnd = 0;
+	int n;
+
+	while (u->pos < u->length)
+	{
+		n = httpd_req_recv(u->req, (char *)u->buf, UPLOAD_CHUNK);
+		if (n == HTTPD_SOCK_ERR_TIMEOUT)
+			continue;
+		if (n <= 0)
+			return ESP_FAIL;
+		if (n > u->length - u->pos)
+			n = u->length - u->pos;
+
+		for (int i = 0; i < n && u->pos + i < sizeof(u->nes); i++)
+			u->nes[u->pos + i] = u->buf[i];
+		if (u->pos + n >= sizeof(u->nes))
+			prg_range(u, &prgStart, &prgEnd);
+		if (u->pos + n > prgStart && u->pos < prgEnd)
+		{
+			uint32_t from = u->pos > prgStart ? u->pos : prgStart;
+			uint32_t to = u->pos + n < prgEnd ? u->pos + n : prgEnd;
+
+			u->prgCrc = esp_rom_crc32_le(u->prgCrc, u->buf + (from - u->pos), to - from);
+		}
+		u->crc = esp_rom_crc32_le(u->crc, u->buf, n);
+
+		if (sink(u, u->buf, n, u->pos) != ESP_OK)
+			return ESP_FAIL;
+		u->pos += n;
+	}
+	return ESP_OK;
+}
+
+// CRC of the body as the flash has it now, the held back header from RAM
+static uint32_t flash_crc(upload_t *u)
+{
+	uint32_t crc = 0;
+	uint32_t pos = 0;
+	int n;
+
+	if (u->holdHead)
+	{
+		crc = esp_rom_crc32_le(crc, u->head, sizeof(u->head));
+		pos = sizeof(u->head);
+	}
+	for (; pos < u->length; pos += n)
+	{
+		n = u->length - pos < UPLOAD_CHUNK ? u->length - pos : UPLOAD_CHUNK;
+		if (esp_partition_read(u->part, u->base + pos, u->buf, n) != ESP_OK)
+			return ~u->crc; // anything but a match
+		crc = esp_rom_crc32_le(crc, u->buf, n);
+	}
+	return crc;
+}
+
+static uint32_t file_crc(upload_t *u, const char *path)
+{
+	uint32_t crc = 0;
+	FILE *fp = fopen(path, "rb");
+	int n;
+
+	if (fp == NULL)
+		return ~u->crc;
+	while ((n = fread(u->buf, 1, UPLOAD_CHUNK, fp)) > 0)
+		crc = esp_rom_crc32_le(crc, u->buf, n);
+	fclose(fp);
+	return crc;
+}
+
+// the first slot with nothing flashed in it that has room for size bytes
+static int free_slot(uint32_t size)
+{
+	const esp_partition_t *part;
+	uint32_t magic;
+
+	for (int slot = 0; slot < ROMSLOT_COUNT; slot++)
+	{
+		part = esp_partition_find_first(ROMSLOT_SUBTYPE(slot), 1, NULL);
+		if (part && part->size >= size && esp_partition_read(part, 0, &magic, 4) == ESP_OK && magic == 0xFFFFFFFF)
+			return slot;
+	}
+	return -1;
+}
+
+static esp_err_t reply(httpd_req_t *req, const char *status, const char *msg)
+{
+	printf("Upload: %s\n", msg);
+	httpd_resp_set_status(req, status);
+	httpd_resp_set_type(req, "text/plain");
+	return httpd_resp_sendstr(req, msg);
+}
+
+// Body into a ROM slot: a .nes image behind a header made here (/rom), or
+// a slot image with its headers (/slot)
+static esp_err_t slot_post(httpd_req_t *req, bool image)
+{
+	upload_t u = {.req = req, .length = req->content_len};
+	uint32_t want = query_int(req, "crc", 16, 0);
+	int slot = query_int(req, "slot", 10, -1);
+	int64_t t0 = esp_timer_get_time();
+	romslot_t hdr;
+	char msg[96];
+	esp_err_t err;
+
+	u.base = image ? 0 : sizeof(romslot_t);
+	u.holdHead = image;
+	if (slot < 0 && !image)
+		slot = free_slot(u.base + u.length);
+	if (slot < 0 || slot >= ROMSLOT_COUNT)
+		return reply(req, "400 Bad Request", "no slot given, and no empty one big enough");
+	u.part = esp_partition_find_first(ROMSLOT_SUBTYPE(slot), 1, NULL);
+	if (u.part == NULL || u.length < sizeof(romslot_t) || u.base + u.length > u.part->size)
+		return reply(req, "400 Bad Request", "doesn't fit the slot");
+	u.buf = malloc(UPLOAD_CHUNK);
+	if (u.buf == NULL)
+		return reply(req, "500 Internal Server Error", "out of memory");
+
+	// the old header goes first, an upload cut short leaves the slot empty
+	printf("Upload: %u bytes into slot %d\n", (unsigned)u.length, slot);
+	err = upload_body(&u, sink_flash);
+	if (err != ESP_OK)
+		snprintf(msg, sizeof(msg), "slot %d: receive or flash write failed", slot);
+	else if (u.crc != want)
+		snprintf(msg, sizeof(msg), "slot %d: CRC %08X, expected %08X", slot, (unsigned)u.crc, (unsigned)want);
+	else if (flash_crc(&u) != want)
+		snprintf(msg, sizeof(msg), "slot %d: flash doesn't read back right", slot);
+	else if (!image && memcmp(u.nes, "NES\x1a", 4))
+		snprintf(msg, sizeof(msg), "slot %d: not an iNES file", slot);
+	else
+	{
+		if (image)
+			memcpy(&hdr, u.head, sizeof(hdr));
+		else
+		{
+			memset(&hdr, 0, sizeof(hdr));
+			memcpy(hdr.magic, ROMSLOT_MAGIC, 4);
+			hdr.version = ROMSLOT_VERSION;
+			hdr.icon = ';';
+			hdr.mapper = (u.nes[6] >> 4) | (u.nes[7] & 0xF0);
+			hdr.size = u.length;
+			hdr.packed = u.length;
+			hdr.crc = u.prgCrc;
+			if (query_str(req, "title", hdr.title, sizeof(hdr.title)))
+				snprintf(hdr.title, sizeof(hdr.title), "Slot %d", slot + 1);
+			// by the title's tags, as for any other way in
+			hdr.region = romslot_region(hdr.title);
+		}
+		err = ESP_FAIL;
+		if (memcmp(hdr.magic, ROMSLOT_MAGIC, 4) == 0 && hdr.version == ROMSLOT_VERSION)
+			err = esp_partition_write(u.part, 0, &hdr, sizeof(hdr));
+		if (err == ESP_OK && romslot_read(slot, 0, &hdr))
+		{
+			snprintf(msg, sizeof(msg), "slot %d: %.40s, %u bytes in %d ms", slot, hdr.title, (unsigned)u.length,
+					 (int)((esp_timer_get_time() - t0) / 1000));
+			free(u.buf);
+			return reply(req, "200 OK", msg);
+		}
+		snprintf(msg, sizeof(msg), "slot %d: not a slot image of this version", slot);
+	}
+	free(u.buf);
+	return reply(req, "400 Bad Request", msg);
+}
+
+static esp_err_t rom_post(httpd_req_t *req)
+{
+	return slot_post(req, false);
+}
+
+static esp_err_t image_post(httpd_req_t *req)
+{
+	return slot_post(req, true);
+}
+
+#ifdef CONFIG_HW_SD_ENA
+// Body onto the SD card, under a temporary name until it checks out
+static esp_err_t sd_post(httpd_req_t *req)
+{
+	upload_t u = {.req = req, .length = req->content_len};
+	uint32_t want = query_int(req, "crc", 16, 0);
+	char name[40], tmp[64], path[64], msg[96];
+	esp_err_t err;
+
+	if (query_str(req, "name", name, sizeof(name) - 4) || strchr(name, '/') || name[0] == 0)
+		return reply(req, "400 Bad Request", "no file name");
+	romsd_init(); // mounts the card
+	snprintf(tmp, sizeof(tmp), ROMSD_MOUNT "/upload.tmp");
+	snprintf(path, sizeof(path), ROMSD_MOUNT "/%s.nes", name);
+	u.buf = malloc(UPLOAD_CHUNK);
+	u.fp = fopen(tmp, "wb");
+	if (u.buf == NULL || u.fp == NULL)
+	{
+		if (u.fp)
+			fclose(u.fp);
+		free(u.buf);
+		return reply(req, "500 Internal Server Error", "can't write to the SD card");
+	}
+	err = upload_body(&u, sink_file);
+	if (fclose(u.fp))
+		err = ESP_FAIL;
+	if (err != ESP_OK)
+		snprintf(msg, sizeof(msg), "%s: receive or write failed", name);
+	else if (u.crc != want || file_crc(&u, tmp) != want)
+		snprintf(msg, sizeof(msg), "%s: CRC mismatch", name);
+	else if (memcmp(u.nes, "NES\x1a", 4))
+		snprintf(msg, sizeof(msg), "%s: not an iNES file", name);
+	else
+	{
+		remove(path);
+		if (rename(tmp, path) == 0)
+		{
+			free(u.buf);
+			snprintf(msg, sizeof(msg), "%s.nes: %u bytes", name, (unsigned)u.length);
+			return reply(req, "200 OK", msg);
+		}
+		snprintf(msg, sizeof(msg), "%s: rename failed", name);
+	}
+	remove(tmp);
+	free(u.buf);
+	return reply(req, "400 Bad Request", msg);
+}
+#endif
+
+// A game's cheat codes into NVS, game= its PRG ROM CRC; an empty body clears them
+static esp_err_t cheats_post(httpd_req_t *req)
+{
+	uint32_t game = query_int(req, "game", 16, 0);
+	char codes[UPLOAD_CHEATS + 1], msg[64];
+	int got = 0, n;
+
+	if (game == 0)
+		return reply(req, "400 Bad Request", "no game CRC");
+	if (req->content_len > UPLOAD_CHEATS)
+		return reply(req, "400 Bad Request", "too many codes");
+	while (got < req->content_len)
+	{
+		n = httpd_req_recv(req, codes + got, req->content_len - got);
+		if (n == HTTPD_SOCK_ERR_TIMEOUT)
+			continue;
+		if (n <= 0)
+			return reply(req, "400 Bad Request", "receive failed");
+		got += n;
+	}
+	codes[got] = 0;
+	if (romsave_storecheats(game, codes))
+		return reply(req, "500 Internal Server Error", "NVS write failed");
+	snprintf(msg, sizeof(msg), "%08X: cheats %s", (unsigned)game, got ? "set" : "cleared");
+	return reply(req, "200 OK", msg);
+}
+
+static const char page[] =
+	"<!DOCTYPE html><html><head><title>Akira upload</title></head><body><h2>Akira ROM upload</h2>"
+	"<p><input type=file id=f multiple> slot <input id=s size=3 placeholder=auto> "
+	"<button onclick=go()>Upload</button></p><pre id=o></pre><script>"
+	"function crc(b){let c,t=[];for(let n=0;n<256;n++){c=n;for(let k=0;k<8;k++)c=c&1?0xEDB88320^(c>>>1):c>>>1;t[n]=c>>>0}"
+	"c=~0;for(let i=0;i<b.length;i++)c=t[(c^b[i])&255]^(c>>>8);return((~c)>>>0).toString(16)}"
+	"async function go(){for(const f of document.getElementById('f').files){"
+	"const b=new Uint8Array(await f.arrayBuffer()),s=document.getElementById('s').value;"
+	"const q='crc='+crc(b)+'&title='+encodeURIComponent(f.name.replace(/\\.nes$/i,'').slice(0,39))+(s?'&slot='+(s-1):'');"
+	"const r=await fetch('/rom?'+q,{method:'POST',body:b});document.getElementById('o').textContent+=await r.text()+'\\n'}"
+	"location.reload()}"
+	"async function cheats(){const b=new Uint8Array(await document.getElementById('g').files[0].arrayBuffer()),p=16+(b[6]&4?512:0);"
+	"const r=await fetch('/cheats?game='+crc(b.subarray(p,p+b[4]*16384)),{method:'POST',body:document.getElementById('c').value});"
+	"document.getElementById('o').textContent+=await r.text()+'\\n'}</script>"
+	"<p>cheats for <input type=file id=g> <input id=c size=40 placeholder='SXIOPO, 07E5:09'> "
+	"<button onclick=cheats()>Save</button></p><pre>";
+
+static esp_err_t index_get(httpd_req_t *req)
+{
+	const esp_partition_t *part;
+	romslot_t hdr;
+	uint32_t offset;
+	char line[96];
+
+	httpd_resp_set_type(req, "text/html");
+	httpd_resp_sendstr_chunk(req, page);
+	for (int slot = 0; slot < ROMSLOT_COUNT; slot++)
+	{
+		part = esp_partition_find_first(ROMSLOT_SUBTYPE(slot), 1, NULL);
+		if (part == NULL)
+			continue;
+		snprintf(line, sizeof(line), "slot %2d, %4u KB:", slot + 1, (unsigned)(part->size / 1024));
+		httpd_resp_sendstr_chunk(req, line);
+		offset = 0;
+		if (romslot_read(slot, 0, &hdr) == NULL)
+			httpd_resp_sendstr_chunk(req, " -");
+		else
+			do
+			{
+				if (romslot_read(slot, offset, &hdr) == NULL)
+					break;
+				// the titles are ours, but keep the page a page
+				for (char *c = hdr.title; *c; c++)
+					if (*c == '<' || *c == '&')
+						*c = ' ';
+				snprintf(line, sizeof(line), " %s%s", hdr.title, (hdr.flags & ROMSLOT_LZ4) ? " (lz4)" : "");
+				httpd_resp_sendstr_chunk(req, line);
+				offset = romslot_next(&hdr, offset);
+			} while (offset);
+		httpd_resp_sendstr_chunk(req, "\n");
+	}
+	httpd_resp_sendstr_chunk(req, "</pre></body></html>");
+	return httpd_resp_sendstr_chunk(req, NULL);
+}
+
+static void wifi_start(void)
+{
+	static bool netifReady;
+	wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+	wifi_config_t ap = {0};
+
+	if (!netifReady)
+	{
+		esp_netif_init();
+		esp_event_loop_create_default();
+		esp_netif_create_default_wifi_ap();
+		netifReady = true;
+	}
+	esp_wifi_init(&cfg);
+	strncpy((char *)ap.ap.ssid, CONFIG_NES_UPLOAD_SSID, sizeof(ap.ap.ssid));
+	ap.ap.ssid_len = strlen(CONFIG_NES_UPLOAD_SSID);
+	strncpy((char *)ap.ap.password, CONFIG_NES_UPLOAD_PASSWORD, sizeof(ap.ap.password));
+	// no password is an open network, romupload_run turns down one too short for WPA2
+	ap.ap.authmode = strlen(CONFIG_NES_UPLOAD_PASSWORD) ? WIFI_AUTH_WPA2_PSK : WIFI_AUTH_OPEN;
+	ap.ap.max_connection = 2;
+	esp_wifi_set_mode(WIFI_MODE_AP);
+	esp_wifi_set_config(WIFI_IF_AP, &ap);
+	esp_wifi_start();
+}
+
+int romupload_enabled(void)
+{
+	return 1;
+}
+
+void romupload_run(void)
+{
+	httpd_config_t cfg = HTTPD_DEFAULT_CONFIG();
+	const httpd_uri_t uris[] = {
+		{.uri = "/", .method = HTTP_GET, .handler = index_get},
+		{.uri = "/rom", .method = HTTP_POST, .handler = rom_post},
+		{.uri = "/slot", .method = HTTP_POST, .handler = image_post},
+		{.uri = "/cheats", .method = HTTP_POST, .handler = cheats_post},
+#ifdef CONFIG_HW_SD_ENA
+		{.uri = "/sd", .method = HTTP_POST, .handler = sd_post},
+#endif
+	};
+	int passwordLen = strlen(CONFIG_NES_UPLOAD_PASSWORD);
+
+	// a password WPA2 can't take would leave the flash open to anyone in range
+	if (passwordLen > 0 && passwordLen < 8)
+	{
+		printf("Upload: not started, CONFIG_NES_UPLOAD_PASSWORD has %d characters, WPA2 needs 8\n", passwordLen);
+		return;
+	}
+	wifi_start();
+	cfg.stack_size = 6144;
+	if (httpd_start(&server, &cfg) != ESP_OK)
+	{
+		printf("Upload: HTTP server didn't start\n");
+		esp_wifi_stop();
+		esp_wifi_deinit();
+		return;
+	}
+	for (int i = 0; i < sizeof(uris) / sizeof(uris[0]); i++)
+		httpd_register_uri_handler(server, &uris[i]);
+	printf("Upload: join %s, open http://192.168.4.1/, Button1 to leave\n", CONFIG_NES_UPLOAD_SSID);
+
+	// Button1 let go of from picking the entry, pressed, let go again
+	while (gpio_get_level(12) == 1)
+		vTaskDelay(20 / portTICK_PERIOD_MS);
+	while (gpio_get_level(12) == 0)
+		vTaskDelay(50 / portTICK_PERIOD_MS);
+	while (gpio_get_level(12) == 1)
+		vTaskDelay(20 / portTICK_PERIOD_MS);
+
+	httpd_stop(server);
+	server = NULL;
+	// the emulator wants the RAM the Wi-Fi driver has
+	esp_wifi_stop();
+	esp_wifi_deinit();
+	printf("Upload: done\n");
+}
+
+#else /* !CONFIG_NES_UPLOAD */
+
+int romupload_enabled(void)
+{
+	return 0;
+}
+
+void romupload_run(void)
+{
+}
+
+#endif /* !CONFIG_NES_UPLOAD */
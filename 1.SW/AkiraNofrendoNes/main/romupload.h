@@ -0,0 +1,34 @@
+#pragma once
+
+// Upload mode, the last entry of the launcher with CONFIG_NES_UPLOAD: a Wi-Fi
+// access point (CONFIG_NES_UPLOAD_SSID) and an HTTP server on 192.168.4.1
+// that streams what is posted straight into flash, a chunk at a time. The
+// image is never in RAM as a whole.
+//
+//   GET  /                         upload page, lists the slots
+//   POST /rom?slot=N&title=T&crc=C a .nes file, stored as the one plain entry
+//                                  of slot N, or of the first empty slot
+//                                  big enough if there's no slot=
+//   POST /slot?slot=N&crc=C        a whole slot image as AkiraUpdater.py
+//                                  builds it: several games, LZ4 packed
+//   POST /sd?name=F&crc=C          a .nes file onto the SD card, as F.nes
+//   POST /cheats?game=G            the cheat codes of the game whose PRG ROM
+//                                  CRC is G, the body as nes_cheat.h has them
+//
+// crc is the CRC32 of the body, in hex. The body is checked against it as it
+// comes in and again read back from flash. The slot header, which is what
+// the menu lists, is written last and only if both match, so a failed
+// upload leaves an empty slot rather than a broken one.
+
+// romListEntry() slot number of the upload entry
+#define ROMUPLOAD_SLOT -2
+
+/**
+ * @brief whether the menu should offer upload mode
+ */
+int romupload_enabled(void);
+
+/**
+ * @brief run upload mode until Button1 is pressed, then switch Wi-Fi off
+ */
+void romupload_run(void);
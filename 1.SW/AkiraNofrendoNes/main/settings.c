@@ -0,0 +1,315 @@
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "nvs_flash.h"
+#include "nvs.h"
+#include "settings.h"
+#include "tasks.h"
+#include "nofrendo/nofconfig.h"
+
+typedef struct
+{
+	const char *group, *key; // as config.c's read_int knows them
+	int8_t min, max, def;
+	bool perRom;
+} setting_desc_t;
+
+static const setting_desc_t descs[SETTING_COUNT] = {
+	[SETTING_VOLUME] = {"sound", "volume", 0, 4, 0, false},
+	[SETTING_BRIGHT] = {"video", "bright", 0, 4, 2, false},
+	[SETTING_XSTRETCH] = {"video", "xstretch", 0, 1, 0, true},
+	[SETTING_YSTRETCH] = {"video", "ystretch", 0, 1, 0, true},
+};
+
+_Static_assert(sizeof(settings_t) == SETTING_COUNT, "settings_t is one int8_t per id");
+#define FIELD(id) (((int8_t *)&settings)[id])
+
+settings_t settings;
+
+// what's stored: the global values, and the running game's overrides
+static int8_t global[SETTING_COUNT];
+static int8_t romValue[SETTING_COUNT];
+static uint8_t romMask; // bit per id overridden
+static uint32_t romCrc; // 0: no game
+
+// settings_find's table, ids by the hash of "group/key", -1 empty
+#define SETTINGS_SLOTS 16
+static int8_t slots[SETTINGS_SLOTS];
+
+// The dirty flags and the values are the lock's; the writer copies them out
+// and lets go before it writes, so a change never waits for the flash
+static SemaphoreHandle_t lock;
+static TaskHandle_t writer;
+static bool globalDirty, romDirty, writing;
+static volatile bool hurry; // settings_flush is waiting, no more delay
+
+static uint32_t name_hash(const char *group, const char *key)
+{
+	uint32_t h = 2166136261u;
+
+	// FNV-1a, case blind like config.c's stricmp
+	for (const char *s = group; *s; s++)
+		h = (h ^ (uint8_t)tolower((unsigned char)*s)) * 16777619u;
+	h = (h ^ '/') * 16777619u;
+	for (const char *s = key; *s; s++)
+		h = (h ^ (uint8_t)tolower((unsigned char)*s)) * 16777619u;
+	return h;
+}
+
+static void key_name(char *key, uint32_t crc)
+{
+	sprintf(key, "%08X", (unsigned)crc);
+}
+
+static void apply(void)
+{
+	for (int id = 0; id < SETTING_COUNT; id++)
+		FIELD(id) = (romMask & (1 << id)) ? romValue[id] : global[id];
+}
+
+// blobs: the version, then for a game the mask, then a value per id
+static void blob_read(const char *space, const char *key, uint8_t *blob, size_t length)
+{
+	nvs_handle_t nvs;
+	size_t len = length;
+
+	if (nvs_open(space, NVS_READONLY, &nvs) != ESP_OK)
+		return;
+	if (nvs_get_blob(nvs, key, blob, &len) != ESP_OK || len != length || blob[0] != SETTINGS_VERSION)
+		blob[0] = 0;
+	nvs_close(nvs);
+}
+
+static esp_err_t blob_write(const char *space, const char *key, const uint8_t *blob, size_t length)
+{
+	nvs_handle_t nvs;
+	esp_err_t err = nvs_open(space, NVS_READWRITE, &nvs);
+
+	if (err != ESP_OK)
+		return err;
+	err = nvs_set_blob(nvs, key, blob, length);
+	if (err == ESP_OK)
+		err = nvs_commit(nvs);
+	nvs_close(nvs);
+	return err;
+}
+
+static bool in_range(int id, int value)
+{
+	return value >= descs[id].min && value <= descs[id].max;
+}
+
+static void writerTask(void *arg)
+{
+	uint8_t globalBlob[1 + SETTING_COUNT], romBlob[2 + SETTING_COUNT];
+	bool doGlobal, doRom;
+	uint32_t crc;
+	char key[9];
+	esp_err_t err;
+
+	while (1)
+	{
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+		// every change pushes the write back, until a quiet spell
+		while (!hurry && ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(SETTINGS_COMMIT_MS)))
+			;
+
+		xSemaphoreTake(lock, portMAX_DELAY);
+		doGlobal = globalDirty;
+		doRom = romDirty;
+		globalBlob[0] = romBlob[0] = SETTINGS_VERSION;
+		memcpy(globalBlob + 1, global, SETTING_COUNT);
+		romBlob[1] = romMask;
+		memcpy(romBlob + 2, romValue, SETTING_COUNT);
+		crc = romCrc;
+		globalDirty = romDirty = false;
+		writing = true;
+		xSemaphoreGive(lock);
+
+		if (doGlobal)
+		{
+			err = blob_write("settings", "global", globalBlob, sizeof(globalBlob));
+			if (err != ESP_OK)
+				printf("Settings: save failed (%d)\n", err);
+		}
+		if (doRom)
+		{
+			key_name(key, crc);
+			err = blob_write("setrom", key, romBlob, sizeof(romBlob));
+			if (err != ESP_OK)
+				printf("Settings %s: save failed (%d)\n", key, err);
+		}
+		xSemaphoreTake(lock, portMAX_DELAY);
+		writing = false;
+		hurry = false;
+		xSemaphoreGive(lock);
+	}
+}
+
+void settings_init(void)
+{
+	uint8_t blob[1 + SETTING_COUNT];
+
+	memset(slots, -1, sizeof(slots));
+	for (int id = 0; id < SETTING_COUNT; id++)
+	{
+		int slot = name_hash(descs[id].group, descs[id].key) & (SETTINGS_SLOTS - 1);
+
+		while (slots[slot] >= 0)
+			slot = (slot + 1) & (SETTINGS_SLOTS - 1);
+		slots[slot] = id;
+		global[id] = descs[id].def;
+	}
+
+	blob[0] = 0;
+	blob_read("settings", "global", blob, sizeof(blob));
+	for (int id = 0; blob[0] && id < SETTING_COUNT; id++)
+	{
+		if (in_range(id, (int8_t)blob[1 + id]))
+			global[id] = blob[1 + id];
+	}
+	apply();
+	printf("Settings: %s\n", blob[0] ? "loaded" : "defaults");
+
+	lock = xSemaphoreCreateMutex();
+	// the emulator runs on core 0, flash writes wait for idle time on core 1
+	tasks_start(TASK_SETTINGS, &writerTask, NULL, &writer);
+}
+
+void settings_rom(uint32_t crc)
+{
+	uint8_t blob[2 + SETTING_COUNT];
+	char key[9];
+
+	if (crc == romCrc)
+		return;
+	// the game left hasn't had its overrides written yet
+	if (romDirty)
+		settings_flush();
+
+	blob[0] = 0;
+	if (crc)
+	{
+		key_name(key, crc);
+		blob_read("setrom", key, blob, sizeof(blob));
+	}
+
+	xSemaphoreTake(lock, portMAX_DELAY);
+	romCrc = crc;
+	romMask = blob[0] ? blob[1] : 0;
+	for (int id = 0; id < SETTING_COUNT; id++)
+	{
+		romValue[id] = blob[0] ? (int8_t)blob[2 + id] : 0;
+		if (!descs[id].perRom || !in_range(id, romValue[id]))
+			romMask &= ~(1 << id);
+	}
+	apply();
+	xSemaphoreGive(lock);
+}
+
+int settings_get(int id)
+{
+	return FIELD(id);
+}
+
+void settings_set(int id, int value)
+{
+	if (value < descs[id].min)
+		value = descs[id].min;
+	if (value > descs[id].max)
+		value = descs[id].max;
+	if (value == FIELD(id))
+		return;
+
+	xSemaphoreTake(lock, portMAX_DELAY);
+	if (descs[id].perRom && romCrc)
+	{
+		romValue[id] = value;
+		romMask |= 1 << id;
+		romDirty = true;
+	}
+	else
+	{
+		global[id] = value;
+		globalDirty = true;
+	}
+	FIELD(id) = value;
+	xSemaphoreGive(lock);
+	xTaskNotifyGive(writer);
+}
+
+int settings_find(const char *group, const char *key)
+{
+	int slot = name_hash(group, key) & (SETTINGS_SLOTS - 1);
+
+	for (; slots[slot] >= 0; slot = (slot + 1) & (SETTINGS_SLOTS - 1))
+	{
+		const setting_desc_t *d = &descs[slots[slot]];
+
+		if (strcasecmp(group, d->group) == 0 && strcasecmp(key, d->key) == 0)
+			return slots[slot];
+	}
+	return -1;
+}
+
+void settings_flush(void)
+{
+	xSemaphoreTake(lock, portMAX_DELAY);
+	while (globalDirty || romDirty || writing)
+	{
+		hurry = true;
+		xSemaphoreGive(lock);
+		xTaskNotifyGive(writer);
+		vTaskDelay(1);
+		xSemaphoreTake(lock, portMAX_DELAY);
+	}
+	xSemaphoreGive(lock);
+}
+
+// The core's configuration API over the settings: there's no file system
+// for config.c's file, and what the core asks for by name is here
+static bool open_config(void)
+{
+	return false;
+}
+
+static void close_config(void)
+{
+}
+
+static int read_int(const char *group, const char *key, int def)
+{
+	int id = settings_find(group, key);
+
+	return id < 0 ? def : settings_get(id);
+}
+
+static const char *read_string(const char *group, const char *key, const char *def)
+{
+	return def;
+}
+
+static void write_int(const char *group, const char *key, int value)
+{
+	int id = settings_find(group, key);
+
+	if (id >= 0)
+		settings_set(id, value);
+}
+
+static void write_string(const char *group, const char *key, const char *value)
+{
+}
+
+config_t config = {
+	open_config,
+	close_config,
+	read_int,
+	read_string,
+	write_int,
+	write_string,
+	CONFIG_FILE};
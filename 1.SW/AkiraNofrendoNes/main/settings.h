@@ -0,0 +1,66 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+// The settings of the launcher and the in-game menu, kept in RAM and
+// written to NVS a while after they last changed by a task on core 1, so
+// they're back after a power cycle. Namespace "settings" has the blob of
+// the global values; namespace "setrom" has one blob per game that
+// overrides the per-game settings, keyed by the PRG ROM CRC like romsave's.
+//
+// The emulator and the LCD code read the fields of settings directly, it
+// always has the values that apply to the game running, if any.
+
+// ids, in the order of settings_t's fields
+#define SETTING_VOLUME 0   // 0-4, 0 is mute
+#define SETTING_BRIGHT 1   // 0-4, backlight
+#define SETTING_XSTRETCH 2 // 0-1, per game
+#define SETTING_YSTRETCH 3 // 0-1, per game
+#define SETTING_COUNT 4
+
+#define SETTINGS_VERSION 1
+// ms after the last change the NVS write goes out, a run of button presses is one write
+#define SETTINGS_COMMIT_MS 2000
+
+typedef struct
+{
+	int8_t volume;
+	int8_t bright;
+	int8_t xStretch;
+	int8_t yStretch;
+} settings_t;
+
+extern settings_t settings;
+
+/**
+ * @brief load the global settings and start the writer task, call once after nvs_flash_init
+ */
+void settings_init(void);
+
+/**
+ * @brief switch to a game's settings, its overrides over the global ones; 0 for none
+ */
+void settings_rom(uint32_t crc);
+
+/**
+ * @brief the value of a setting, by id
+ */
+int settings_get(int id);
+
+/**
+ * @brief change a setting, clamped to its range
+ *
+ * A per-game setting changed while a game runs goes to that game's
+ * overrides, the rest to the global values. Only marks it to be written.
+ */
+void settings_set(int id, int value);
+
+/**
+ * @brief a setting's id by its config.c style group and key, -1 if there isn't one
+ */
+int settings_find(const char *group, const char *key);
+
+/**
+ * @brief wait until every change is in flash, before sleeping
+ */
+void settings_flush(void);
@@ -0,0 +1,200 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_partition.h"
+#include <noftypes.h>
+#include <pcx.h>
+#include "romsave.h"
+#include "romsd.h"
+#include "snapshot.h"
+#include "memplace.h"
+#include "tasks.h"
+#include "emuyield.h"
+
+// on the emulator's core, with CONFIG_NES_YIELD: the longest a frame waits for it, and the slice
+#define SNAPSHOT_YIELD_MS 200
+#define SNAPSHOT_SLICE_US 2000
+
+// The frame waiting for the task, NULL when there's none. Set by the
+// emulator, cleared by the task once it's stored; nothing else touches it.
+static bitmap_t *volatile pending;
+static rgb_t pendingPal[256];
+static uint32_t pendingCrc;
+static TaskHandle_t task;
+static int yieldClient = -1;
+
+static const esp_partition_t *part;
+static int recordCount;
+static uint32_t lastSeq;
+static int nextRecord;
+static int nextFile = -1; // SNAPnnnn.PCX number, -1 till the card is looked at
+
+// a bitmap of its own with the picture of bmp, in PSRAM if there is some
+static bitmap_t *frame_copy(bitmap_t *bmp)
+{
+	int size = bmp->width * bmp->height;
+	int lines = bmp->height * sizeof(uint8 *);
+	bitmap_t *copy;
+
+	copy = memplace_alloc(MEM_COLD, sizeof(bitmap_t) + lines + size);
+	if (copy == NULL)
+		return NULL;
+	copy->width = copy->pitch = bmp->width;
+	copy->height = bmp->height;
+	copy->hardware = false;
+	copy->sharedlines = false;
+	copy->data = (uint8 *)copy->line + lines;
+	copy->linepal = NULL; // a PCX has the one palette
+	for (int i = 0; i < bmp->height; i++)
+		copy->line[i] = copy->data + i * bmp->width;
+
+	// one memcpy when the frame buffer is in one piece, as it is on the device
+	if (bmp->pitch == bmp->width && bmp->line[bmp->height - 1] == bmp->line[0] + size - bmp->width)
+		memcpy(copy->data, bmp->line[0], size);
+	else
+		for (int i = 0; i < bmp->height; i++)
+			memcpy(copy->line[i], bmp->line[i], bmp->width);
+	// and read back once by the encoder
+	memplace_traffic(2 * size);
+	return copy;
+}
+
+int snapshot_take(bitmap_t *bmp, rgb_t *pal, uint32_t crc)
+{
+	bitmap_t *copy;
+
+	if (task == NULL || pending || (!romsd_mounted() && recordCount == 0))
+		return -1;
+	copy = frame_copy(bmp);
+	if (copy == NULL)
+		return -1;
+	memcpy(pendingPal, pal, sizeof(pendingPal));
+	pendingCrc = crc;
+	pending = copy;
+	emuYieldWant(yieldClient);
+	xTaskNotifyGive(task);
+	return 0;
+}
+
+// the number after the highest SNAPnnnn.PCX on the card
+static int file_next(void)
+{
+	struct dirent *de;
+	DIR *dir;
+	int n, next = 0;
+
+	dir = opendir(ROMSD_MOUNT);
+	if (dir == NULL)
+		return 0;
+	while ((de = readdir(dir)) != NULL)
+	{
+		if (sscanf(de->d_name, "SNAP%4d.PCX", &n) == 1 && n >= next)
+			next = n + 1;
+	}
+	closedir(dir);
+	return next;
+}
+
+static bool file_write(bitmap_t *bmp, char *path, int size)
+{
+	if (nextFile < 0)
+		nextFile = file_next();
+	snprintf(path, size, ROMSD_MOUNT "/SNAP%04d.PCX", nextFile % 10000);
+	if (pcx_write(path, bmp, pendingPal))
+		return false;
+	nextFile++;
+	return true;
+}
+
+// into the oldest record
+static bool record_write(bitmap_t *bmp, char *where, int size)
+{
+	snapshot_record_t hdr;
+	uint8_t *buf;
+	int length;
+	uint32_t base = nextRecord * SNAPSHOT_RECORD;
+	esp_err_t err;
+
+	buf = memplace_alloc(MEM_COLD, SNAPSHOT_RECORD);
+	if (buf == NULL)
+	{
+		snprintf(where, size, "nowhere, no room to encode");
+		return false;
+	}
+	length = pcx_encode(buf, SNAPSHOT_RECORD - sizeof(hdr), bmp, pendingPal);
+	if (length < 0)
+	{
+		free(buf);
+		snprintf(where, size, "nowhere, it doesn't fit a record");
+		return false;
+	}
+
+	memcpy(hdr.magic, SNAPSHOT_MAGIC, 4);
+	hdr.crc = pendingCrc;
+	hdr.seq = ++lastSeq;
+	hdr.length = length;
+	// the header goes last, a write cut short leaves the record empty
+	err = esp_partition_erase_range(part, base, (sizeof(hdr) + length + 4095) & ~4095);
+	if (err == ESP_OK)
+		err = esp_partition_write(part, base + sizeof(hdr), buf, length);
+	if (err == ESP_OK)
+		err = esp_partition_write(part, base, &hdr, sizeof(hdr));
+	free(buf);
+	snprintf(where, size, "record %d, %d bytes", nextRecord, length);
+	nextRecord = (nextRecord + 1) % recordCount;
+	return err == ESP_OK;
+}
+
+static void snapTask(void *arg)
+{
+	char where[64];
+
+	while (1)
+	{
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+		bitmap_t *bmp = pending;
+		int64_t t0 = esp_timer_get_time();
+		bool ok;
+
+		if (bmp == NULL)
+			continue;
+		if (romsd_mounted())
+			ok = file_write(bmp, where, sizeof(where));
+		else
+			ok = record_write(bmp, where, sizeof(where));
+		printf("Snapshot %08X: %s %s in %d ms\n", (unsigned)pendingCrc, ok ? "saved to" : "not saved,", where,
+			   (int)((esp_timer_get_time() - t0) / 1000));
+		free(bmp);
+		pending = NULL;
+		emuYieldDone(yieldClient);
+	}
+}
+
+void snapshot_init(void)
+{
+	snapshot_record_t hdr;
+
+	part = esp_partition_find_first(ROMSAVE_STATE_TYPE, SNAPSHOT_SUBTYPE, SNAPSHOT_LABEL);
+	if (part)
+		recordCount = part->size / SNAPSHOT_RECORD;
+	// carry on after the newest one
+	for (int i = 0; i < recordCount; i++)
+	{
+		if (esp_partition_read(part, i * SNAPSHOT_RECORD, &hdr, sizeof(hdr)) == ESP_OK
+			&& memcmp(hdr.magic, SNAPSHOT_MAGIC, 4) == 0 && hdr.seq > lastSeq)
+		{
+			lastSeq = hdr.seq;
+			nextRecord = (i + 1) % recordCount;
+		}
+	}
+	if (recordCount)
+		printf("Snapshot partition: %d records\n", recordCount);
+
+	// encoding and flash writes wait for idle time on core 1, like the saves
+	tasks_start(TASK_SNAPSHOT, &snapTask, NULL, &task);
+	yieldClient = emuYieldRegister(TASK_SNAPSHOT, SNAPSHOT_YIELD_MS, SNAPSHOT_SLICE_US);
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include <stdint.h>
+#include <bitmap.h>
+
+// Screenshots, for bug reports from units in the field. The emulator only
+// copies the frame on the screen and its palette into a spare buffer; the
+// snapshot task on the other core encodes it as PCX and stores it, as
+// SNAPnnnn.PCX on the SD card if one is mounted, else in the partition
+// labelled SNAPSHOT_LABEL, type ROMSAVE_STATE_TYPE, subtype SNAPSHOT_SUBTYPE,
+// cut into SNAPSHOT_RECORD sized records like the save states: a
+// snapshot_record_t then the PCX file. The newest overwrites the oldest;
+// read them out with esptool read_flash. In partitions.csv:
+//   snapshots, 0x40, 0x11, , 256K
+#define SNAPSHOT_SUBTYPE 0x11
+#define SNAPSHOT_LABEL "snapshots"
+#define SNAPSHOT_RECORD 0x10000
+#define SNAPSHOT_MAGIC "AKSN"
+
+typedef struct
+{
+	char magic[4];   // SNAPSHOT_MAGIC, written after the file
+	uint32_t crc;    // PRG ROM CRC of the game
+	uint32_t seq;    // counts up with every snapshot
+	uint32_t length; // bytes of PCX file
+} snapshot_record_t;
+
+/**
+ * @brief find the partition and start the snapshot task, call once before the first game
+ */
+void snapshot_init(void);
+
+/**
+ * @brief queue a snapshot of a frame, from the emulator
+ *
+ * Copies the picture and the palette and returns. Doesn't wait for anything.
+ *
+ * @return - 0 if it was taken, -1 if the last one isn't stored yet, there's
+ *           nowhere to store it or no room for the copy
+ */
+int snapshot_take(bitmap_t *bmp, rgb_t *pal, uint32_t crc);
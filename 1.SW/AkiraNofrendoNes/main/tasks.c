@@ -0,0 +1,70 @@
+#include <stdio.h>
+#include "sdkconfig.h"
+#include "tasks.h"
+
+typedef struct
+{
+	const char *name;
+	int8_t core; // -1 is either
+	uint8_t prio;
+	uint16_t stack; // bytes
+} task_desc_t;
+
+#define TASK(name, id) {name, CONFIG_TASK_##id##_CORE, CONFIG_TASK_##id##_PRIO, CONFIG_TASK_##id##_STACK}
+
+static const task_desc_t table[TASK_COUNT] = {
+	[TASK_EMU] = TASK("emuTask", EMU),
+	[TASK_VIDEO] = TASK("videoTask", VIDEO),
+	[TASK_AUDIO] = TASK("audioTask", AUDIO),
+	[TASK_PPU] = TASK("ppuTask", PPU),
+	[TASK_SRAM] = TASK("sramTask", SRAM),
+	[TASK_SETTINGS] = TASK("setTask", SETTINGS),
+	[TASK_SNAPSHOT] = TASK("snapTask", SNAPSHOT),
+	[TASK_LOG] = TASK("logTask", LOG),
+	[TASK_TRACE] = TASK("traceTask", TRACE),
+	[TASK_BT] = TASK("btTask", BT),
+	[TASK_DECODE] = TASK("decodeTask", DECODE),
+};
+
+bool tasks_start(int id, TaskFunction_t fn, void *arg, TaskHandle_t *handle)
+{
+	const task_desc_t *t = &table[id];
+
+	return xTaskCreatePinnedToCore(fn, t->name, t->stack, arg, t->prio, handle,
+								   t->core < 0 ? tskNO_AFFINITY : t->core) == pdPASS;
+}
+
+const char *tasks_name(int id)
+{
+	return table[id].name;
+}
+
+int tasks_core(int id)
+{
+	return table[id].core;
+}
+
+void tasks_report(void)
+{
+	TaskHandle_t task;
+
+	for (int i = 0; i < TASK_COUNT; i++)
+	{
+		const task_desc_t *t = &table[i];
+
+		// the ones not started in this build, or done and gone
+		task = xTaskGetHandle(t->name);
+		if (task == NULL)
+			continue;
+		if (t->core < 0)
+			printf("task %-10s core any prio %2d stack %5d, %5d never used\n", t->name, (int)uxTaskPriorityGet(task),
+				   t->stack, (int)uxTaskGetStackHighWaterMark(task));
+		else
+			printf("task %-10s core %d   prio %2d stack %5d, %5d never used\n", t->name, t->core,
+				   (int)uxTaskPriorityGet(task), t->stack, (int)uxTaskGetStackHighWaterMark(task));
+	}
+	task = xTaskGetHandle("esp_timer");
+	if (task)
+		printf("task %-10s core 0   prio %2d (ESP-IDF's), %5d never used\n", "esp_timer", (int)uxTaskPriorityGet(task),
+			   (int)uxTaskGetStackHighWaterMark(task));
+}
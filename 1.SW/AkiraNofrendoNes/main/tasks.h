@@ -0,0 +1,49 @@
+#pragma once
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// Every task the firmware starts, with the core it is pinned to, its
+// priority and its stack, set in menuconfig under "Task topology"
+// (CONFIG_TASK_<NAME>_CORE, _PRIO and _STACK). A core of -1 lets FreeRTOS
+// run the task on either. The defaults keep the emulator on core 0 and
+// move everything else to core 1, so a task waiting on the LCD, the DAC
+// or the flash never takes time out of a frame. The esp_timer task that
+// ticks the frames is ESP-IDF's own, on core 0; it is only reported.
+
+// the rows of the table
+#define TASK_EMU 0      // the launcher and the emulator
+#define TASK_VIDEO 1    // frames and lines to the LCD
+#define TASK_AUDIO 2    // samples to I2S
+#define TASK_PPU 3      // CONFIG_NES_PPU_WORKER's scanlines
+#define TASK_SRAM 4     // battery RAM and save states to flash
+#define TASK_SETTINGS 5 // settings to NVS
+#define TASK_SNAPSHOT 6 // screenshots to flash
+#define TASK_LOG 7      // logring.c's lines to UART
+#define TASK_TRACE 8    // cputrace.c's dump
+#define TASK_BT 9       // Bluetooth pads
+#define TASK_DECODE 10  // the menu's intro picture
+#define TASK_COUNT 11
+
+/**
+ * @brief start task id of the table, running fn(arg)
+ *
+ * @param handle set to the task, may be NULL
+ * @return - false if there was no room for it
+ */
+bool tasks_start(int id, TaskFunction_t fn, void *arg, TaskHandle_t *handle);
+
+/**
+ * @brief the FreeRTOS name of task id
+ */
+const char *tasks_name(int id);
+
+/**
+ * @brief the core task id is pinned to, -1 for either
+ */
+int tasks_core(int id);
+
+/**
+ * @brief print each task running: its core, priority, stack and how much of it was never used
+ */
+void tasks_report(void);
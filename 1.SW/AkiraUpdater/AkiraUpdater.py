@@ -1,6 +1,10 @@
 import subprocess
 import os
+import struct
 import sys
+import tempfile
+import urllib.request
+import zlib
 import tkinter as tk
 from tkinter import ttk
 from tkinter import filedialog
@@ -16,7 +20,30 @@ flash_data = [
     ("0x3df000", "rom14.bin", 132),
 ]
 
-selected_roms = {i: "" for i in range(len(flash_data))}
+selected_roms = {i: () for i in range(len(flash_data))}
+
+# Slot header, see main/romslot.h in the emulator
+ROMSLOT_MAGIC = b"AKRS"
+ROMSLOT_VERSION = 2
+ROMSLOT_FORMAT = "<4sBcHIIIBB2x40s"
+ROMSLOT_ICON = b";"
+ROMSLOT_LZ4 = 0x01
+ROMSLOT_MORE = 0x02
+ROMSLOT_REGION_HEADER = 0
+ROMSLOT_REGION_NTSC = 1
+ROMSLOT_REGION_PAL = 2
+ROMSLOT_REGION_DENDY = 3
+# file name tags and the TV system they stand for, as romslot_region() has them
+ROMSLOT_REGION_TAGS = [
+    ("(E)", ROMSLOT_REGION_PAL),
+    ("(Europe)", ROMSLOT_REGION_PAL),
+    ("(PAL)", ROMSLOT_REGION_PAL),
+    ("(Dendy)", ROMSLOT_REGION_DENDY),
+    ("(U)", ROMSLOT_REGION_NTSC),
+    ("(USA)", ROMSLOT_REGION_NTSC),
+    ("(J)", ROMSLOT_REGION_NTSC),
+    ("(Japan)", ROMSLOT_REGION_NTSC),
+]
 
 
 def ensure_packages():
@@ -70,7 +97,118 @@ def get_esptool_path():
         return None
 
 
-def flash_rom_to_esp32(address, filename, size, esptool_path, port):
+def lz4_compress(data):
+    """Greedy LZ4 block compressor (no frame), what the emulator's lz4_unpack reads."""
+    out = bytearray()
+
+    def put_length(n):
+        while n >= 255:
+            out.append(255)
+            n -= 255
+        out.append(n)
+
+    table = {}
+    n = len(data)
+    anchor = i = 0
+    # the format wants the last match to start 12 bytes before the end
+    # and the last 5 bytes to be literals
+    while i < n - 12:
+        key = data[i : i + 4]
+        ref = table.get(key)
+        table[key] = i
+        if ref is None or i - ref > 0xFFFF:
+            i += 1
+            continue
+
+        match = 4
+        while i + match < n - 5 and data[ref + match] == data[i + match]:
+            match += 1
+
+        literals = i - anchor
+        out.append((min(literals, 15) << 4) | min(match - 4, 15))
+        if literals >= 15:
+            put_length(literals - 15)
+        out += data[anchor:i]
+        out += struct.pack("<H", i - ref)
+        if match - 4 >= 15:
+            put_length(match - 4 - 15)
+        i += match
+        anchor = i
+
+    literals = n - anchor
+    out.append(min(literals, 15) << 4)
+    if literals >= 15:
+        put_length(literals - 15)
+    out += data[anchor:]
+    return bytes(out)
+
+
+def rom_region(filename):
+    """TV system by the file name's tags, ROMSLOT_REGION_HEADER if it has none."""
+    name = os.path.basename(filename)
+    for tag, region in ROMSLOT_REGION_TAGS:
+        if tag in name:
+            return region
+    return ROMSLOT_REGION_HEADER
+
+
+def make_slot_entry(filename, more):
+    """Header plus (compressed if that's smaller) image for one iNES file."""
+    with open(filename, "rb") as f:
+        nes = f.read()
+    if len(nes) < 16 or nes[:4] != b"NES\x1a":
+        raise ValueError(f"{filename} is not an iNES file")
+
+    prg_start = 16 + (512 if nes[6] & 0x04 else 0)
+    prg = nes[prg_start : prg_start + nes[4] * 16384]
+    mapper = (nes[6] >> 4) | (nes[7] & 0xF0)
+    title = os.path.splitext(os.path.basename(filename))[0].encode("ascii", "replace")[:39]
+
+    flags = ROMSLOT_MORE if more else 0
+    payload = lz4_compress(nes)
+    if len(payload) < len(nes):
+        flags |= ROMSLOT_LZ4
+    else:
+        payload = nes
+
+    header = struct.pack(
+        ROMSLOT_FORMAT,
+        ROMSLOT_MAGIC,
+        ROMSLOT_VERSION,
+        ROMSLOT_ICON,
+        mapper,
+        len(nes),
+        zlib.crc32(prg) & 0xFFFFFFFF,
+        len(payload),
+        flags,
+        rom_region(filename),
+        title,
+    )
+    entry = header + payload
+    # next entry starts 4 byte aligned
+    return entry + bytes(-len(entry) % 4)
+
+
+def make_slot_image(filenames, size):
+    """Pack one or more iNES files into a slot, returns the path of the image to flash."""
+    image = b"".join(
+        make_slot_entry(name, i < len(filenames) - 1) for i, name in enumerate(filenames)
+    )
+    if len(image) > size * 1024:
+        raise ValueError(
+            f"{', '.join(filenames)} need {len(image)} bytes, slot holds {size * 1024}"
+        )
+
+    fd, path = tempfile.mkstemp(suffix=".bin")
+    with os.fdopen(fd, "wb") as f:
+        f.write(image)
+    return path
+
+
+def flash_rom_to_esp32(address, filenames, size, esptool_path, port):
+    if not filenames:
+        return
+    image = make_slot_image(filenames, size)
     command = [
         sys.executable,
         esptool_path,
@@ -82,15 +220,37 @@ def flash_rom_to_esp32(address, filename, size, esptool_path, port):
         "115200",
         "write_flash",
         address,
-        filename,
+        image,
     ]
-    subprocess.run(command, check=True)
+    try:
+        subprocess.run(command, check=True)
+    finally:
+        os.remove(image)
+
+
+def upload_rom_over_wifi(slot, filenames, size, host):
+    """Post a slot image to the console's upload mode (Wi-Fi upload in its menu)."""
+    if not filenames:
+        return
+    image = make_slot_image(filenames, size)
+    try:
+        with open(image, "rb") as f:
+            data = f.read()
+        url = f"http://{host}/slot?slot={slot}&crc={zlib.crc32(data) & 0xFFFFFFFF:08x}"
+        request = urllib.request.Request(url, data=data, method="POST")
+        with urllib.request.urlopen(request, timeout=120) as response:
+            print(response.read().decode())
+    except OSError as e:
+        print(f"Upload of ROM {slot + 1} failed: {e}")
+    finally:
+        os.remove(image)
 
 
 def select_file(index):
-    file_path = filedialog.askopenfilename(title=f"Select ROM {index + 1} File")
-    if file_path:
-        selected_roms[index] = file_path
+    # several games can share a slot, they're stored compressed
+    file_paths = filedialog.askopenfilenames(title=f"Select ROM {index + 1} File(s)")
+    if file_paths:
+        selected_roms[index] = file_paths
 
 
 def main():
@@ -162,7 +322,18 @@ def main():
             for i in range(len(flash_data))
         ],
         width=20,
-    ).grid(row=len(flash_data) + 3, columnspan=3, pady=20)
+    ).grid(row=len(flash_data) + 3, column=0, columnspan=2, pady=20)
+
+    # the console's upload mode, on its own access point
+    ttk.Button(
+        frame,
+        text="Upload over Wi-Fi",
+        command=lambda: [
+            upload_rom_over_wifi(i, selected_roms[i], flash_data[i][2], "192.168.4.1")
+            for i in range(len(flash_data))
+        ],
+        width=20,
+    ).grid(row=len(flash_data) + 3, column=2, pady=20)
 
     root.mainloop()
 